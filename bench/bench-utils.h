@@ -0,0 +1,88 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TPM_BENCH_UTILS_H
+#define XAPTUM_TPM_BENCH_UTILS_H
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <tss2/tss2_sys.h>
+
+char *mssim_conf_g = "host=localhost,port=2321";
+const char* dev_file_path_g = NULL;   // indicates to use default
+
+#define BENCH_ASSERT(cond) \
+    do \
+    { \
+        if (!(cond)) { \
+            fprintf(stderr, "Condition \'%s\' failed\n\tin file: \'%s\'\n\tin function: \'%s\'\n\tat line: %d\n", #cond,__FILE__,  __func__, __LINE__); \
+            exit(1); \
+        } \
+    } while(0)
+
+static inline
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#define TCTI_UTILS_ASSERT BENCH_ASSERT
+#include "../tss2/test/tcti-utils.h"
+
+static inline
+void free_tcti(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    if (tcti_ctx) {
+        Tss2_Tcti_Finalize(tcti_ctx);
+        free(tcti_ctx);
+    }
+}
+
+static inline
+void init_sapi(TSS2_TCTI_CONTEXT *tcti_ctx, TSS2_SYS_CONTEXT **sapi_ctx)
+{
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+
+    *sapi_ctx = calloc(sapi_ctx_size, 1);
+    BENCH_ASSERT(NULL != *sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TSS2_RC init_ret = Tss2_Sys_Initialize(*sapi_ctx,
+                                           sapi_ctx_size,
+                                           tcti_ctx,
+                                           &abi_version);
+    BENCH_ASSERT(TSS2_RC_SUCCESS == init_ret);
+}
+
+static inline
+void free_sapi(TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    if (sapi_ctx) {
+        Tss2_Sys_Finalize(sapi_ctx);
+        free(sapi_ctx);
+    }
+}
+
+#endif
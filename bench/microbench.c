@@ -0,0 +1,664 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+/*
+ * Host-side cost of the marshaling, ASN.1 and PEM encoding paths,
+ * with no TPM involved.
+ *
+ * The `sys_*` cases run whole one-call SAPI functions in a dry-run
+ * context (no TCTI), so only the command marshaling is measured.
+ * The `sys_*_template` cases do the same from a pre-marshaled command
+ * (see tss2/tss2_sys_template.h), patching just the digest or NV range.
+ *
+ * Each case runs `iterations` operations per batch, on inputs drawn from
+ * a pool of random (but valid) values, and reports the median over all
+ * batches, in counter ticks (the TSC on x86, CNTVCT on aarch64) and in ns,
+ * as one JSON object per line.
+ *
+ * Usage: microbench [iterations] [seed]
+ */
+
+#include <xaptum-tpm/keys.h>
+#include <tss2/tss2_sys_template.h>
+
+#include "bench-utils.h"
+
+#include "../tss2/src/internal/cmdauths.h"
+#include "../tss2/src/internal/marshal.h"
+#include "../tss2/src/internal/sys_context_common.h"
+#include "../src/internal/asn1.h"
+#include "../src/internal/pem.h"
+#include "../src/internal/sha256.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define DEFAULT_ITERATIONS 2000
+#define BATCHES 31
+#define POOL_SIZE 64    // must be a power of 2
+
+#if defined(__x86_64__) || defined(__i386__)
+#define COUNTER_NAME "tsc"
+static inline
+uint64_t read_counter(void)
+{
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+#elif defined(__aarch64__)
+#define COUNTER_NAME "cntvct"
+static inline
+uint64_t read_counter(void)
+{
+    uint64_t val;
+    __asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+}
+#else
+#define COUNTER_NAME "ns"
+static inline
+uint64_t read_counter(void)
+{
+    return now_ns();
+}
+#endif
+
+struct inputs {
+    TPM2B_PUBLIC publics[POOL_SIZE];
+    struct xtpm_key keys[POOL_SIZE];
+
+    uint8_t signatures[POOL_SIZE][2 + 2 + 2*(2 + 32)];
+    uint32_t signature_lengths[POOL_SIZE];
+
+    TSS2L_SYS_AUTH_COMMAND cmd_auths[POOL_SIZE];
+
+    // Each holds a response (with auths) already received.
+    TSS2_SYS_CONTEXT_OPAQUE *responses[POOL_SIZE];
+
+    uint8_t asn1[POOL_SIZE][ASN1_LOADABLE_KEY_MIN_BUF];
+    size_t asn1_lengths[POOL_SIZE];
+
+    TPM2B_DIGEST digests[POOL_SIZE];
+
+    // Messages to hash, one per SIMD lane
+    uint8_t messages[SHA256_LANES][1024];
+
+    TSS2_SYS_CONTEXT *dryrun_ctx;
+    struct xtpm_command_template sign_template;
+    struct xtpm_command_template nv_read_template;
+    TSS2_SYS_CONTEXT_OPAQUE *scratch_ctx;
+    char pem_path[256];
+
+    volatile uint64_t sink;     // keeps results live
+};
+
+typedef void (*bench_fn)(struct inputs *in, unsigned i);
+
+static uint64_t rng_state_g;
+
+static
+uint64_t rng_next(void)
+{
+    // xorshift64*
+    rng_state_g ^= rng_state_g >> 12;
+    rng_state_g ^= rng_state_g << 25;
+    rng_state_g ^= rng_state_g >> 27;
+    return rng_state_g * 0x2545F4914F6CDD1Dull;
+}
+
+static
+void rng_fill(uint8_t *buf, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+        buf[i] = (uint8_t)rng_next();
+}
+
+static
+void random_public(TPM2B_PUBLIC *out)
+{
+    memset(out, 0, sizeof(TPM2B_PUBLIC));
+
+    TPMT_PUBLIC *area = &out->publicArea;
+    area->type = TPM2_ALG_ECC;
+    area->nameAlg = TPM2_ALG_SHA256;
+    area->objectAttributes = TPMA_OBJECT_USERWITHAUTH |
+                             TPMA_OBJECT_FIXEDTPM |
+                             TPMA_OBJECT_FIXEDPARENT |
+                             TPMA_OBJECT_SENSITIVEDATAORIGIN;
+
+    if (rng_next() & 1) {
+        area->authPolicy.size = 32;
+        rng_fill(area->authPolicy.buffer, 32);
+    }
+
+    TPMS_ECC_PARMS *parms = &area->parameters.eccDetail;
+    if (rng_next() & 1) {
+        // A storage key
+        area->objectAttributes |= TPMA_OBJECT_RESTRICTED | TPMA_OBJECT_DECRYPT;
+        parms->symmetric.algorithm = TPM2_ALG_AES;
+        parms->symmetric.keyBits.aes = 128;
+        parms->symmetric.mode.sym = TPM2_ALG_CFB;
+        parms->scheme.scheme = TPM2_ALG_NULL;
+    } else {
+        // A signing key
+        area->objectAttributes |= TPMA_OBJECT_SIGN_ENCRYPT;
+        parms->symmetric.algorithm = TPM2_ALG_NULL;
+        if (rng_next() & 1) {
+            parms->scheme.scheme = TPM2_ALG_ECDSA;
+            parms->scheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+        } else {
+            parms->scheme.scheme = TPM2_ALG_NULL;
+        }
+    }
+    parms->curveID = TPM2_ECC_NIST_P256;
+    parms->kdf.scheme = TPM2_ALG_NULL;
+
+    area->unique.ecc.x.size = 32;
+    rng_fill(area->unique.ecc.x.buffer, 32);
+    area->unique.ecc.y.size = 32;
+    rng_fill(area->unique.ecc.y.buffer, 32);
+
+    // Let the marshaling compute the size.
+    uint8_t buf[sizeof(TPM2B_PUBLIC) + 16];
+    uint8_t *ptr = buf;
+    marshal_tpm2b_public(out, &ptr);
+    out->size = ptr - buf - sizeof(uint16_t);
+}
+
+static
+void random_signature(uint8_t *buf, uint32_t *length)
+{
+    uint8_t *ptr = buf;
+    marshal_uint16((rng_next() & 1) ? TPM2_ALG_ECDSA : TPM2_ALG_ECDAA, &ptr);
+    marshal_uint16(TPM2_ALG_SHA256, &ptr);
+    for (int i = 0; i < 2; i++) {
+        marshal_uint16(32, &ptr);
+        rng_fill(ptr, 32);
+        ptr += 32;
+    }
+    *length = ptr - buf;
+}
+
+static
+void random_cmd_auths(TSS2L_SYS_AUTH_COMMAND *out)
+{
+    memset(out, 0, sizeof(TSS2L_SYS_AUTH_COMMAND));
+
+    out->count = 1 + rng_next() % 3;
+    for (unsigned i = 0; i < out->count; i++) {
+        TPMS_AUTH_COMMAND *auth = &out->auths[i];
+        auth->sessionHandle = TPM2_RS_PW;
+        auth->hmac.size = rng_next() % 33;
+        rng_fill(auth->hmac.buffer, auth->hmac.size);
+    }
+}
+
+static
+TSS2_SYS_CONTEXT_OPAQUE *new_dryrun_context(void)
+{
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    TSS2_SYS_CONTEXT *sapi_ctx = calloc(sapi_ctx_size, 1);
+    BENCH_ASSERT(NULL != sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    BENCH_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_InitializeDryRun(sapi_ctx, sapi_ctx_size, &abi_version));
+    return (TSS2_SYS_CONTEXT_OPAQUE*)sapi_ctx;
+}
+
+static
+void reset_response(TSS2_SYS_CONTEXT_OPAQUE *ctx)
+{
+    ctx->ptr = ctx->buffer + 10;    // just past the header
+    ctx->remaining_response = ctx->response_length - 10;
+}
+
+static
+TSS2_SYS_CONTEXT_OPAQUE *random_response(void)
+{
+    TSS2_SYS_CONTEXT_OPAQUE *ctx = new_dryrun_context();
+
+    uint8_t count = 1 + rng_next() % 3;
+    uint32_t parameter_size = rng_next() % 65;
+
+    uint8_t *ptr = ctx->buffer;
+    marshal_uint16(TPM2_ST_SESSIONS, &ptr);
+    ptr += sizeof(uint32_t);    // responseSize, filled in below
+    marshal_uint32(TSS2_RC_SUCCESS, &ptr);
+    marshal_uint32(parameter_size, &ptr);
+    rng_fill(ptr, parameter_size);
+    ptr += parameter_size;
+    for (uint8_t i = 0; i < count; i++) {
+        uint16_t nonce_size = rng_next() % 33;
+        marshal_uint16(nonce_size, &ptr);
+        rng_fill(ptr, nonce_size);
+        ptr += nonce_size;
+        *ptr++ = TPMA_SESSION_CONTINUESESSION;
+        marshal_uint16(0, &ptr);    // hmac
+    }
+
+    ctx->response_length = ptr - ctx->buffer;
+    uint8_t *size_ptr = ctx->buffer + sizeof(uint16_t);
+    marshal_uint32(ctx->response_length, &size_ptr);
+
+    ctx->cmd_auths_count = count;
+    reset_response(ctx);
+
+    return ctx;
+}
+
+static
+void init_inputs(struct inputs *in, uint64_t seed)
+{
+    memset(in, 0, sizeof(struct inputs));
+
+    rng_state_g = seed ? seed : 1;
+
+    for (unsigned i = 0; i < POOL_SIZE; i++) {
+        random_public(&in->publics[i]);
+
+        random_public(&in->keys[i].public_key);
+        in->keys[i].parent_handle = 0x81000001;
+        in->keys[i].private_key_blob.size = 96 + rng_next() % 129;
+        rng_fill(in->keys[i].private_key_blob.buffer, in->keys[i].private_key_blob.size);
+
+        random_signature(in->signatures[i], &in->signature_lengths[i]);
+
+        random_cmd_auths(&in->cmd_auths[i]);
+
+        in->responses[i] = random_response();
+
+        build_asn1_from_key(&in->keys[i], in->asn1[i], &in->asn1_lengths[i]);
+
+        in->digests[i].size = 32;
+        rng_fill(in->digests[i].buffer, 32);
+    }
+
+    for (unsigned i = 0; i < SHA256_LANES; i++)
+        rng_fill(in->messages[i], sizeof(in->messages[i]));
+
+    in->dryrun_ctx = (TSS2_SYS_CONTEXT*)new_dryrun_context();
+    in->scratch_ctx = new_dryrun_context();
+
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = {
+        .auths[0] = {.sessionHandle = TPM2_RS_PW},
+        .count = 1
+    };
+    TPMT_SIG_SCHEME scheme = {.scheme = TPM2_ALG_ECDSA};
+    scheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+    TPMT_TK_HASHCHECK validation = {.tag = TPM2_ST_HASHCHECK, .hierarchy = TPM2_RH_NULL};
+
+    BENCH_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_Sign_Prepare(in->dryrun_ctx, 0x80000001, &in->digests[0], &scheme, &validation));
+    BENCH_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_SetCmdAuths(in->dryrun_ctx, &auth_cmd));
+    BENCH_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_SaveTemplate(in->dryrun_ctx, &in->sign_template));
+
+    BENCH_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_NV_Read_Prepare(in->dryrun_ctx, 0x1410000, 0x1410000, 0, 0));
+    BENCH_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_SetCmdAuths(in->dryrun_ctx, &auth_cmd));
+    BENCH_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_SaveTemplate(in->dryrun_ctx, &in->nv_read_template));
+
+    const char *tmpdir = getenv("TMPDIR");
+    snprintf(in->pem_path, sizeof(in->pem_path), "%s/microbench-%d.pem",
+             tmpdir ? tmpdir : "/tmp", (int)getpid());
+}
+
+static
+void free_inputs(struct inputs *in)
+{
+    for (unsigned i = 0; i < POOL_SIZE; i++)
+        free_sapi((TSS2_SYS_CONTEXT*)in->responses[i]);
+    free_sapi(in->dryrun_ctx);
+    free_sapi((TSS2_SYS_CONTEXT*)in->scratch_ctx);
+    remove(in->pem_path);
+}
+
+static
+void bench_marshal_tpm2b_public(struct inputs *in, unsigned i)
+{
+    uint8_t buf[sizeof(TPM2B_PUBLIC) + 16];
+    uint8_t *ptr = buf;
+    marshal_tpm2b_public(&in->publics[i], &ptr);
+    in->sink += ptr - buf;
+}
+
+static
+void bench_unmarshal_tpmt_signature(struct inputs *in, unsigned i)
+{
+    TPMT_SIGNATURE signature;
+    uint8_t *ptr = in->signatures[i];
+    uint32_t length = in->signature_lengths[i];
+    BENCH_ASSERT(0 == unmarshal_tpmt_signature(&ptr, &length, &signature));
+    in->sink += signature.sigAlg;
+}
+
+static
+void bench_view_tpmt_signature(struct inputs *in, unsigned i)
+{
+    struct xtpm_signature_view signature;
+    uint8_t *ptr = in->signatures[i];
+    uint32_t length = in->signature_lengths[i];
+    BENCH_ASSERT(0 == view_tpmt_signature(&ptr, &length, &signature));
+    in->sink += signature.r.data[0];
+}
+
+static
+void bench_set_cmdauths(struct inputs *in, unsigned i)
+{
+    TSS2_SYS_CONTEXT_OPAQUE *ctx = in->scratch_ctx;
+    ctx->ptr = ctx->buffer + 10 + sizeof(TPM2_HANDLE);    // header and one handle
+    BENCH_ASSERT(TSS2_RC_SUCCESS == set_cmdauths(ctx, &in->cmd_auths[i]));
+    in->sink += ctx->ptr - ctx->buffer;
+}
+
+static
+void bench_get_rspauths(struct inputs *in, unsigned i)
+{
+    TSS2_SYS_CONTEXT_OPAQUE *ctx = in->responses[i];
+    TSS2L_SYS_AUTH_RESPONSE rsp_auths = {.count = ctx->cmd_auths_count};
+    reset_response(ctx);
+    BENCH_ASSERT(TSS2_RC_SUCCESS == get_rspauths(ctx, &rsp_auths));
+    in->sink += rsp_auths.auths[0].nonce.size;
+}
+
+static
+void bench_build_asn1_from_key(struct inputs *in, unsigned i)
+{
+    uint8_t buf[ASN1_LOADABLE_KEY_MIN_BUF];
+    size_t length = 0;
+    build_asn1_from_key(&in->keys[i], buf, &length);
+    in->sink += length;
+}
+
+static
+void bench_write_pem(struct inputs *in, unsigned i)
+{
+    BENCH_ASSERT(0 == write_pem(in->pem_path, in->asn1[i], in->asn1_lengths[i]));
+}
+
+static
+void bench_sys_sign(struct inputs *in, unsigned i)
+{
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = {
+        .auths[0] = {.sessionHandle = TPM2_RS_PW},
+        .count = 1
+    };
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+
+    TPMT_SIG_SCHEME scheme = {.scheme = TPM2_ALG_ECDSA};
+    scheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+    TPMT_TK_HASHCHECK validation = {.tag = TPM2_ST_HASHCHECK, .hierarchy = TPM2_RH_NULL};
+    TPMT_SIGNATURE signature;
+
+    TSS2_RC ret = Tss2_Sys_Sign(in->dryrun_ctx,
+                                0x80000001,
+                                &auth_cmd,
+                                &in->digests[i],
+                                &scheme,
+                                &validation,
+                                &signature,
+                                &auth_rsp);
+    BENCH_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+}
+
+static
+void bench_sys_sign_template(struct inputs *in, unsigned i)
+{
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+    TPMT_SIGNATURE signature;
+
+    BENCH_ASSERT(TSS2_RC_SUCCESS == xtpm_template_set_digest(&in->sign_template, &in->digests[i]));
+
+    TSS2_RC ret = Tss2_Sys_Sign_FromTemplate(in->dryrun_ctx,
+                                             &in->sign_template,
+                                             &signature,
+                                             &auth_rsp);
+    BENCH_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+}
+
+static
+void bench_sys_nv_read(struct inputs *in, unsigned i)
+{
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = {
+        .auths[0] = {.sessionHandle = TPM2_RS_PW},
+        .count = 1
+    };
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+
+    TPM2B_MAX_NV_BUFFER data;
+
+    TSS2_RC ret = Tss2_Sys_NV_Read(in->dryrun_ctx,
+                                   0x1410000,
+                                   0x1410000,
+                                   &auth_cmd,
+                                   32,
+                                   i * 32,
+                                   &data,
+                                   &auth_rsp);
+    BENCH_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+}
+
+static
+void bench_sys_nv_read_template(struct inputs *in, unsigned i)
+{
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+
+    TPM2B_MAX_NV_BUFFER data;
+
+    BENCH_ASSERT(TSS2_RC_SUCCESS == xtpm_template_set_nv_range(&in->nv_read_template, 32, i * 32));
+
+    TSS2_RC ret = Tss2_Sys_NV_Read_FromTemplate(in->dryrun_ctx,
+                                                &in->nv_read_template,
+                                                &data,
+                                                &auth_rsp);
+    BENCH_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+}
+
+static
+void bench_sys_load(struct inputs *in, unsigned i)
+{
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = {
+        .auths[0] = {.sessionHandle = TPM2_RS_PW},
+        .count = 1
+    };
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+
+    TPM2_HANDLE handle;
+    TPM2B_NAME name;
+
+    TSS2_RC ret = Tss2_Sys_Load(in->dryrun_ctx,
+                                in->keys[i].parent_handle,
+                                &auth_cmd,
+                                &in->keys[i].private_key_blob,
+                                &in->keys[i].public_key,
+                                &handle,
+                                &name,
+                                &auth_rsp);
+    BENCH_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+}
+
+static
+void bench_sys_createprimary(struct inputs *in, unsigned i)
+{
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = {
+        .auths[0] = {.sessionHandle = TPM2_RS_PW},
+        .count = 1
+    };
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+
+    TPM2B_SENSITIVE_CREATE in_sensitive = {0};
+    TPM2B_DATA outside_info = {0};
+    TPML_PCR_SELECTION creation_pcr = {0};
+
+    TPM2_HANDLE handle;
+    TPM2B_PUBLIC out_public;
+    TPM2B_CREATION_DATA creation_data;
+    TPM2B_DIGEST creation_hash;
+    TPMT_TK_CREATION creation_ticket;
+    TPM2B_NAME name;
+
+    TSS2_RC ret = Tss2_Sys_CreatePrimary(in->dryrun_ctx,
+                                         TPM2_RH_OWNER,
+                                         &auth_cmd,
+                                         &in_sensitive,
+                                         &in->publics[i],
+                                         &outside_info,
+                                         &creation_pcr,
+                                         &handle,
+                                         &out_public,
+                                         &creation_data,
+                                         &creation_hash,
+                                         &creation_ticket,
+                                         &name,
+                                         &auth_rsp);
+    BENCH_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+}
+
+static
+void sha256_many_with(enum sha256_impl impl, struct inputs *in)
+{
+    const uint8_t *messages[SHA256_LANES];
+    size_t lengths[SHA256_LANES];
+    for (unsigned lane = 0; lane < SHA256_LANES; lane++) {
+        messages[lane] = in->messages[lane];
+        lengths[lane] = sizeof(in->messages[lane]);
+    }
+
+    uint8_t digests[SHA256_LANES][SHA256_DIGEST_SIZE];
+    sha256_many_impl(impl, messages, lengths, SHA256_LANES, digests);
+    in->sink += digests[SHA256_LANES - 1][0];
+}
+
+static
+void bench_sha256_1k_generic(struct inputs *in, unsigned i)
+{
+    const uint8_t *message = in->messages[i % SHA256_LANES];
+    size_t length = sizeof(in->messages[0]);
+
+    uint8_t digest[1][SHA256_DIGEST_SIZE];
+    sha256_many_impl(SHA256_IMPL_GENERIC, &message, &length, 1, digest);
+    in->sink += digest[0][0];
+}
+
+static
+void bench_sha256_1k_shani(struct inputs *in, unsigned i)
+{
+    const uint8_t *message = in->messages[i % SHA256_LANES];
+    size_t length = sizeof(in->messages[0]);
+
+    uint8_t digest[1][SHA256_DIGEST_SIZE];
+    sha256_many_impl(SHA256_IMPL_SHANI, &message, &length, 1, digest);
+    in->sink += digest[0][0];
+}
+
+static
+void bench_sha256_8x1k_shani(struct inputs *in, unsigned i)
+{
+    (void)i;
+    sha256_many_with(SHA256_IMPL_SHANI, in);
+}
+
+static
+void bench_sha256_8x1k_avx2(struct inputs *in, unsigned i)
+{
+    (void)i;
+    sha256_many_with(SHA256_IMPL_AVX2, in);
+}
+
+static
+int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static
+void run(const char *name, bench_fn fn, struct inputs *in, int iterations)
+{
+    uint64_t ticks[BATCHES];
+    uint64_t ns[BATCHES];
+
+    // Warm up caches and branch predictors.
+    for (int i = 0; i < iterations; i++)
+        fn(in, i & (POOL_SIZE - 1));
+
+    for (int b = 0; b < BATCHES; b++) {
+        uint64_t start_ns = now_ns();
+        uint64_t start_ticks = read_counter();
+        for (int i = 0; i < iterations; i++)
+            fn(in, i & (POOL_SIZE - 1));
+        ticks[b] = read_counter() - start_ticks;
+        ns[b] = now_ns() - start_ns;
+    }
+
+    qsort(ticks, BATCHES, sizeof(uint64_t), compare_u64);
+    qsort(ns, BATCHES, sizeof(uint64_t), compare_u64);
+
+    printf("{\"name\":\"%s\",\"iterations\":%d,\"batches\":%d,"
+           "\"counter\":\"%s\",\"ticks_per_op\":%.1f,\"ns_per_op\":%.1f}\n",
+           name,
+           iterations,
+           BATCHES,
+           COUNTER_NAME,
+           (double)ticks[BATCHES / 2] / iterations,
+           (double)ns[BATCHES / 2] / iterations);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = DEFAULT_ITERATIONS;
+    if (argc >= 2)
+        iterations = atoi(argv[1]);
+    BENCH_ASSERT(iterations > 0);
+
+    uint64_t seed = 0x5eed;
+    if (argc >= 3)
+        seed = strtoull(argv[2], NULL, 0);
+
+    struct inputs *in = malloc(sizeof(struct inputs));
+    BENCH_ASSERT(NULL != in);
+    init_inputs(in, seed);
+
+    run("marshal_tpm2b_public", bench_marshal_tpm2b_public, in, iterations);
+    run("unmarshal_tpmt_signature", bench_unmarshal_tpmt_signature, in, iterations);
+    run("view_tpmt_signature", bench_view_tpmt_signature, in, iterations);
+    run("set_cmdauths", bench_set_cmdauths, in, iterations);
+    run("get_rspauths", bench_get_rspauths, in, iterations);
+    run("build_asn1_from_key", bench_build_asn1_from_key, in, iterations);
+    // Includes opening and closing the file.
+    run("write_pem", bench_write_pem, in, iterations / 20 ? iterations / 20 : 1);
+    run("sys_sign", bench_sys_sign, in, iterations);
+    run("sys_sign_template", bench_sys_sign_template, in, iterations);
+    run("sys_nv_read", bench_sys_nv_read, in, iterations);
+    run("sys_nv_read_template", bench_sys_nv_read_template, in, iterations);
+    run("sys_load", bench_sys_load, in, iterations);
+    run("sys_createprimary", bench_sys_createprimary, in, iterations);
+    // Host-side hashing of 1 KiB messages, for signing
+    run("sha256_1k_generic", bench_sha256_1k_generic, in, iterations / 10 ? iterations / 10 : 1);
+    if (sha256_impl_supported(SHA256_IMPL_SHANI)) {
+        run("sha256_1k_shani", bench_sha256_1k_shani, in, iterations / 10 ? iterations / 10 : 1);
+        run("sha256_8x1k_shani", bench_sha256_8x1k_shani, in, iterations / 80 ? iterations / 80 : 1);
+    }
+    if (sha256_impl_supported(SHA256_IMPL_AVX2))
+        run("sha256_8x1k_avx2", bench_sha256_8x1k_avx2, in, iterations / 80 ? iterations / 80 : 1);
+
+    free_inputs(in);
+    free(in);
+}
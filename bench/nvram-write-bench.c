@@ -0,0 +1,137 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+/*
+ * Throughput of writing a 4 KB certificate to NV,
+ * with a hand-rolled blocking Tss2_Sys_NV_Write loop vs. `xtpm_write_nvram`.
+ *
+ * Usage: nvram-write-bench [iterations]
+ */
+
+#include <xaptum-tpm/nvram.h>
+
+#include "bench-utils.h"
+
+#include <string.h>
+
+#define CERT_SIZE 4096
+#define BENCH_INDEX 0x1600010
+#define DEFAULT_ITERATIONS 20
+
+static TSS2L_SYS_AUTH_COMMAND auth_cmd_g = {
+    .auths[0] = {.sessionHandle = TPM2_RS_PW},
+    .count = 1
+};
+
+static
+void define_index(TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+
+    // Ignore failure: the index may not exist yet.
+    (void)Tss2_Sys_NV_UndefineSpace(sapi_ctx, TPM2_RH_OWNER, BENCH_INDEX, &auth_cmd_g, &auth_rsp);
+
+    TPM2B_NV_PUBLIC public_info = {0};
+    public_info.nvPublic.nvIndex = BENCH_INDEX;
+    public_info.nvPublic.nameAlg = TPM2_ALG_SHA256;
+    public_info.nvPublic.attributes = TPMA_NV_OWNERWRITE | TPMA_NV_OWNERREAD;
+    public_info.nvPublic.dataSize = CERT_SIZE;
+
+    TPM2B_AUTH nv_auth = {.size = 0};
+
+    TSS2_RC ret = Tss2_Sys_NV_DefineSpace(sapi_ctx,
+                                          TPM2_RH_OWNER,
+                                          &auth_cmd_g,
+                                          &nv_auth,
+                                          &public_info,
+                                          &auth_rsp);
+    BENCH_ASSERT(TSS2_RC_SUCCESS == ret);
+}
+
+static
+TSS2_RC write_blocking(const uint8_t *cert, TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+
+    TPM2B_MAX_NV_BUFFER chunk;
+    uint16_t offset = 0;
+    while (offset < CERT_SIZE) {
+        chunk.size = CERT_SIZE - offset < TPM2_MAX_NV_BUFFER_SIZE ? CERT_SIZE - offset : TPM2_MAX_NV_BUFFER_SIZE;
+        memcpy(chunk.buffer, cert + offset, chunk.size);
+
+        TSS2_RC ret = Tss2_Sys_NV_Write(sapi_ctx,
+                                        TPM2_RH_OWNER,
+                                        BENCH_INDEX,
+                                        &auth_cmd_g,
+                                        &chunk,
+                                        offset,
+                                        &auth_rsp);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        offset += chunk.size;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+void report(const char *name, uint64_t elapsed_ns, int iterations)
+{
+    double seconds = (double)elapsed_ns / 1e9;
+    printf("%-20s %8.3f ms/cert  %10.1f KB/s\n",
+           name,
+           seconds * 1e3 / iterations,
+           (double)CERT_SIZE * iterations / 1024.0 / seconds);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = DEFAULT_ITERATIONS;
+    if (argc >= 2)
+        iterations = atoi(argv[1]);
+    BENCH_ASSERT(iterations > 0);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    init_tcti(&tcti_ctx);
+
+    TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    define_index(sapi_ctx);
+
+    uint8_t cert[CERT_SIZE];
+    for (size_t i = 0; i < sizeof(cert); i++)
+        cert[i] = (uint8_t)(i * 31);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < iterations; i++)
+        BENCH_ASSERT(TSS2_RC_SUCCESS == write_blocking(cert, sapi_ctx));
+    report("blocking-loop", now_ns() - start, iterations);
+
+    start = now_ns();
+    for (int i = 0; i < iterations; i++)
+        BENCH_ASSERT(TSS2_RC_SUCCESS == xtpm_write_nvram(cert, CERT_SIZE, BENCH_INDEX, TPM2_RH_OWNER, sapi_ctx));
+    report("xtpm_write_nvram", now_ns() - start, iterations);
+
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+    (void)Tss2_Sys_NV_UndefineSpace(sapi_ctx, TPM2_RH_OWNER, BENCH_INDEX, &auth_cmd_g, &auth_rsp);
+
+    free_sapi(sapi_ctx);
+    free_tcti(tcti_ctx);
+}
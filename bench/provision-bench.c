@@ -0,0 +1,126 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+/*
+ * Factory provisioning throughput: devices per hour for defining and writing
+ * all of the Xaptum NV indices with `xtpm_provision_nvram`,
+ * both on a blank device and on an already-provisioned one (a re-run).
+ *
+ * Usage: provision-bench [iterations]
+ */
+
+#include <xaptum-tpm/nvram.h>
+#include <xaptum-tpm/provision.h>
+
+#include "bench-utils.h"
+
+#include <string.h>
+
+#define DEFAULT_ITERATIONS 10
+#define ATTRIBUTES (TPMA_NV_PPWRITE | TPMA_NV_AUTHREAD | TPMA_NV_PLATFORMCREATE)
+
+static unsigned char gpk_g[258];
+static unsigned char cred_g[260];
+static unsigned char cred_sig_g[72];
+static unsigned char root_asn1cert_g[600];
+static unsigned char basename_g[32];
+static unsigned char server_id_g[16];
+static unsigned char root_xttcert_g[1500];
+
+static struct xtpm_nv_entry entries_g[] = {
+    {XTPM_GPK_HANDLE,           ATTRIBUTES, gpk_g,              sizeof(gpk_g)},
+    {XTPM_CRED_HANDLE,          ATTRIBUTES, cred_g,             sizeof(cred_g)},
+    {XTPM_CRED_SIG_HANDLE,      ATTRIBUTES, cred_sig_g,         sizeof(cred_sig_g)},
+    {XTPM_ROOT_ASN1CERT_HANDLE, ATTRIBUTES, root_asn1cert_g,    sizeof(root_asn1cert_g)},
+    {XTPM_BASENAME_HANDLE,      ATTRIBUTES, basename_g,         sizeof(basename_g)},
+    {XTPM_SERVER_ID_HANDLE,     ATTRIBUTES, server_id_g,        sizeof(server_id_g)},
+    {XTPM_ROOT_XTTCERT_HANDLE,  ATTRIBUTES, root_xttcert_g,     sizeof(root_xttcert_g)},
+};
+
+#define ENTRY_COUNT (sizeof(entries_g) / sizeof(entries_g[0]))
+
+static
+void undefine_all(TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = {
+        .auths[0] = {.sessionHandle = TPM2_RS_PW},
+        .count = 1
+    };
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+
+    // Ignore failures: the indices may not exist yet.
+    for (size_t i = 0; i < ENTRY_COUNT; i++)
+        (void)Tss2_Sys_NV_UndefineSpace(sapi_ctx, TPM2_RH_PLATFORM, entries_g[i].index, &auth_cmd, &auth_rsp);
+}
+
+static
+void report(const char *name, uint64_t elapsed_ns, int iterations)
+{
+    double seconds = (double)elapsed_ns / 1e9;
+    printf("%-12s %8.1f ms/device  %10.0f devices/hour\n",
+           name,
+           seconds * 1e3 / iterations,
+           3600.0 * iterations / seconds);
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = DEFAULT_ITERATIONS;
+    if (argc >= 2)
+        iterations = atoi(argv[1]);
+    BENCH_ASSERT(iterations > 0);
+
+    for (size_t i = 0; i < ENTRY_COUNT; i++)
+        memset((unsigned char*)entries_g[i].data, 0xA0 + (int)i, entries_g[i].data_size);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    init_tcti(&tcti_ctx);
+
+    TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    enum xtpm_provision_action actions[ENTRY_COUNT];
+
+    // Blank device: undefining is outside the timed region.
+    uint64_t elapsed = 0;
+    for (int i = 0; i < iterations; i++) {
+        undefine_all(sapi_ctx);
+
+        uint64_t start = now_ns();
+        BENCH_ASSERT(TSS2_RC_SUCCESS == xtpm_provision_nvram(entries_g, ENTRY_COUNT, TPM2_RH_PLATFORM, NULL, 0, actions, sapi_ctx));
+        elapsed += now_ns() - start;
+
+        for (size_t j = 0; j < ENTRY_COUNT; j++)
+            BENCH_ASSERT(XTPM_PROVISION_DEFINED == actions[j]);
+    }
+    report("blank", elapsed, iterations);
+
+    // Already provisioned: every index is read back and skipped.
+    uint64_t start = now_ns();
+    for (int i = 0; i < iterations; i++)
+        BENCH_ASSERT(TSS2_RC_SUCCESS == xtpm_provision_nvram(entries_g, ENTRY_COUNT, TPM2_RH_PLATFORM, NULL, 0, actions, sapi_ctx));
+    report("re-run", now_ns() - start, iterations);
+
+    for (size_t j = 0; j < ENTRY_COUNT; j++)
+        BENCH_ASSERT(XTPM_PROVISION_UNCHANGED == actions[j]);
+
+    undefine_all(sapi_ctx);
+
+    free_sapi(sapi_ctx);
+    free_tcti(tcti_ctx);
+}
@@ -0,0 +1,172 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+/*
+ * Throughput of 1 to 64 threads sharing one TPM,
+ * each through its own client of a `tss2-tcti-mux`, vs. all through one
+ * SAPI context behind a mutex.
+ *
+ * Each operation is a Tss2_Sys_ReadPublic of the default parent key
+ * (an error response, if there is none, still counts).
+ *
+ * Usage: tcti-mux-bench [seconds per step]
+ */
+
+#include <tss2/tss2_tcti_mux.h>
+
+#include "bench-utils.h"
+
+#include <pthread.h>
+
+#define MAX_THREADS 64
+#define READ_HANDLE 0x81000001
+#define DEFAULT_SECONDS 1
+
+struct shared {
+    TSS2_TCTI_MUX_CONTEXT *mux_ctx;     // for the mux runs
+    TSS2_SYS_CONTEXT *sapi_ctx;         // for the mutex runs
+    pthread_mutex_t lock;
+    int stop;
+};
+
+struct worker {
+    pthread_t thread;
+    struct shared *shared;
+    uint64_t ops;
+};
+
+static
+void read_public(TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    TPM2B_PUBLIC out_public = {.size = 0};
+    TPM2B_NAME name = {.size = 0};
+    TPM2B_NAME qualified_name = {.size = 0};
+
+    TSS2_RC ret = Tss2_Sys_ReadPublic(sapi_ctx,
+                                      READ_HANDLE,
+                                      NULL,
+                                      &out_public,
+                                      &name,
+                                      &qualified_name,
+                                      NULL);
+
+    // Only the TPM itself may fail the command.
+    BENCH_ASSERT(TSS2_TPM_RC_LEVEL == (ret & (0xff << TSS2_RC_LEVEL_SHIFT)));
+}
+
+static
+void *mux_worker(void *arg)
+{
+    struct worker *worker = arg;
+
+    size_t ctx_size;
+    BENCH_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Mux_Client_Init(NULL, &ctx_size, worker->shared->mux_ctx));
+    TSS2_TCTI_CONTEXT *tcti_ctx = calloc(ctx_size, 1);
+    BENCH_ASSERT(NULL != tcti_ctx);
+    BENCH_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Mux_Client_Init(tcti_ctx, &ctx_size, worker->shared->mux_ctx));
+
+    TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    while (!__atomic_load_n(&worker->shared->stop, __ATOMIC_RELAXED)) {
+        read_public(sapi_ctx);
+        worker->ops++;
+    }
+
+    free_sapi(sapi_ctx);
+    free_tcti(tcti_ctx);
+
+    return NULL;
+}
+
+static
+void *mutex_worker(void *arg)
+{
+    struct worker *worker = arg;
+
+    while (!__atomic_load_n(&worker->shared->stop, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&worker->shared->lock);
+        read_public(worker->shared->sapi_ctx);
+        pthread_mutex_unlock(&worker->shared->lock);
+        worker->ops++;
+    }
+
+    return NULL;
+}
+
+static
+double run(struct shared *shared, void *(*fn)(void*), int thread_count, int seconds)
+{
+    struct worker workers[MAX_THREADS];
+
+    shared->stop = 0;
+    for (int i = 0; i < thread_count; i++) {
+        workers[i] = (struct worker){.shared = shared, .ops = 0};
+        BENCH_ASSERT(0 == pthread_create(&workers[i].thread, NULL, fn, &workers[i]));
+    }
+
+    uint64_t start = now_ns();
+    struct timespec duration = {.tv_sec = seconds, .tv_nsec = 0};
+    nanosleep(&duration, NULL);
+    __atomic_store_n(&shared->stop, 1, __ATOMIC_RELAXED);
+
+    uint64_t ops = 0;
+    for (int i = 0; i < thread_count; i++) {
+        BENCH_ASSERT(0 == pthread_join(workers[i].thread, NULL));
+        ops += workers[i].ops;
+    }
+
+    return (double)ops * 1e9 / (double)(now_ns() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = DEFAULT_SECONDS;
+    if (argc >= 2)
+        seconds = atoi(argv[1]);
+    BENCH_ASSERT(seconds > 0);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    init_tcti(&tcti_ctx);
+
+    struct shared shared = {.stop = 0};
+    BENCH_ASSERT(0 == pthread_mutex_init(&shared.lock, NULL));
+    init_sapi(tcti_ctx, &shared.sapi_ctx);
+
+    size_t ctx_size;
+    BENCH_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Mux_Init(NULL, &ctx_size, tcti_ctx));
+    shared.mux_ctx = calloc(ctx_size, 1);
+    BENCH_ASSERT(NULL != shared.mux_ctx);
+    BENCH_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Mux_Init(shared.mux_ctx, &ctx_size, tcti_ctx));
+
+    printf("%-8s %14s %14s\n", "threads", "mux ops/s", "mutex ops/s");
+    for (int thread_count = 1; thread_count <= MAX_THREADS; thread_count *= 2) {
+        double mux_rate = run(&shared, mux_worker, thread_count, seconds);
+        double mutex_rate = run(&shared, mutex_worker, thread_count, seconds);
+        printf("%-8d %14.1f %14.1f\n", thread_count, mux_rate, mutex_rate);
+        fflush(stdout);
+    }
+
+    free_sapi(shared.sapi_ctx);
+    pthread_mutex_destroy(&shared.lock);
+
+    // Also finalizes tcti_ctx
+    Tss2_Tcti_Mux_Finalize(shared.mux_ctx);
+    free(shared.mux_ctx);
+    free(tcti_ctx);
+}
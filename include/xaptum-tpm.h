@@ -20,7 +20,13 @@
 #define XAPTUM_TPM_H
 #pragma once
 
+#include <xaptum-tpm/ecdaa.h>
+#include <xaptum-tpm/hash.h>
 #include <xaptum-tpm/keys.h>
 #include <xaptum-tpm/nvram.h>
+#include <xaptum-tpm/provision.h>
+#ifndef XTPM_NO_HEAP
+#include <xaptum-tpm/service.h>
+#endif
 
 #endif
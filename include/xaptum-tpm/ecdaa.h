@@ -0,0 +1,199 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TPM_ECDAA_H
+#define XAPTUM_TPM_ECDAA_H
+#pragma once
+
+#include <tss2/tss2_sys.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Number of commits a `struct xtpm_ecdaa_commit_pool` holds.
+ */
+#define XTPM_ECDAA_COMMIT_POOL_SIZE 8
+
+/*
+ * How many commits back the TPM still accepts a commit's counter
+ * (the size of the reference implementation's commit array).
+ * Older pooled commits are discarded, rather than failing in Sign.
+ */
+#define XTPM_ECDAA_COMMIT_WINDOW 128
+
+/*
+ * The result of a TPM2_Commit, which an ECDAA Sign consumes by its `counter`.
+ */
+struct xtpm_ecdaa_commit {
+    TPM2B_ECC_POINT K;
+    TPM2B_ECC_POINT L;
+    TPM2B_ECC_POINT E;
+    uint16_t counter;
+};
+
+/*
+ * Computes the digest the TPM signs (e.g. the DAA challenge) into `digest_out`,
+ * from the message digest and the commit the signature uses.
+ *
+ * Must return 0 on success, or non-zero on failure.
+ */
+typedef int (*xtpm_ecdaa_challenge_fn)(const struct xtpm_ecdaa_commit *commit,
+                                       const TPM2B_DIGEST *msg_digest,
+                                       TPM2B_DIGEST *digest_out,
+                                       void *user_data);
+
+/*
+ * Commits made ahead of time for one ECDAA key and basename,
+ * so that signing takes one TPM round trip instead of two.
+ *
+ * Treat the fields as private.
+ */
+struct xtpm_ecdaa_commit_pool {
+    TPM2_HANDLE key_handle;
+    TPM2B_ECC_POINT P1;
+    TPM2B_SENSITIVE_DATA s2;
+    TPM2B_ECC_PARAMETER y2;
+    int have_newest;
+    uint16_t newest_counter;
+    unsigned first;
+    unsigned count;
+    struct xtpm_ecdaa_commit commits[XTPM_ECDAA_COMMIT_POOL_SIZE];
+};
+
+/*
+ * Start an empty pool of commits for the ECDAA key at `key_handle`
+ * (e.g. XTPM_ECDAA_KEY_HANDLE), which must have no auth set.
+ *
+ * `P1`, `s2` and `y2` are passed to each TPM2_Commit as is:
+ * for a basename, `s2` is the basename and `y2` the y-coordinate of its point,
+ * and any of them may be NULL (sent as empty).
+ */
+void
+xtpm_ecdaa_commit_pool_init(struct xtpm_ecdaa_commit_pool *pool,
+                            TPM2_HANDLE key_handle,
+                            const TPM2B_ECC_POINT *P1,
+                            const TPM2B_SENSITIVE_DATA *s2,
+                            const TPM2B_ECC_PARAMETER *y2);
+
+/*
+ * Commit until the pool is full, e.g. while the connection is idle.
+ *
+ * On failure, the commits made so far stay in the pool.
+ */
+TSS2_RC
+xtpm_ecdaa_commit_pool_fill(struct xtpm_ecdaa_commit_pool *pool,
+                            TSS2_SYS_CONTEXT *sapi_ctx);
+
+/*
+ * Number of commits in the pool.
+ */
+unsigned
+xtpm_ecdaa_commit_pool_count(const struct xtpm_ecdaa_commit_pool *pool);
+
+/*
+ * Discard all pooled commits, e.g. after the TPM was restarted.
+ */
+void
+xtpm_ecdaa_commit_pool_clear(struct xtpm_ecdaa_commit_pool *pool);
+
+/*
+ * ECDAA-sign (with SHA-256) using up the oldest pooled commit,
+ * or a new one if the pool is empty.
+ *
+ * The digest signed is computed by `challenge_fn` (which must not be NULL),
+ * from `msg_digest` and the commit chosen, which is returned in `commit_out`.
+ * The signature is returned in `signature_out`.
+ *
+ * If the TPM no longer accepts the pooled commit, the pool is cleared
+ * and the challenge is computed again for a new commit.
+ * On any other failure (e.g. from the TCTI), the commit is returned to the pool.
+ */
+TSS2_RC
+xtpm_ecdaa_commit_pool_sign(struct xtpm_ecdaa_commit_pool *pool,
+                            TSS2_SYS_CONTEXT *sapi_ctx,
+                            xtpm_ecdaa_challenge_fn challenge_fn,
+                            void *challenge_user_data,
+                            const TPM2B_DIGEST *msg_digest,
+                            struct xtpm_ecdaa_commit *commit_out,
+                            TPMT_SIGNATURE *signature_out);
+
+/*
+ * Signing state for the provisioned ECDAA key (at XTPM_ECDAA_KEY_HANDLE),
+ * so that each signature needs no NV or ReadPublic round trips, and no allocation.
+ *
+ * Treat the fields as private, except `public_key` and `basename`,
+ * which are valid after a successful `xtpm_ecdaa_ctx_init`.
+ */
+struct xtpm_ecdaa_ctx {
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    TPM2B_PUBLIC public_key;
+    TPM2B_SENSITIVE_DATA basename;
+    xtpm_ecdaa_challenge_fn challenge_fn;
+    void *challenge_user_data;
+    struct xtpm_ecdaa_commit_pool pool;
+};
+
+/*
+ * Read the ECDAA key's public area and the basename (from XTPM_BASENAME_HANDLE), once.
+ * Returns TSS2_BASE_RC_BAD_VALUE if the key is not an ECC key that can ECDAA-sign with SHA-256.
+ * The basename may be up to TPM2_MAX_SYM_DATA (128) bytes, the most a Commit takes.
+ *
+ * Commits pass the basename as `s2`, and `basename_y` as `y2`:
+ * it must be the y-coordinate of the point whose x-coordinate is the basename's
+ * SHA-256 hash (this library does no EC arithmetic).
+ * If `basename_y` is NULL, commits are made without the basename.
+ *
+ * If `challenge_fn` is NULL, `xtpm_ecdaa_sign` signs the message digest as is.
+ *
+ * Until the context is no longer used, `sapi_ctx` must not be used for anything else.
+ */
+TSS2_RC
+xtpm_ecdaa_ctx_init(struct xtpm_ecdaa_ctx *ctx,
+                    TSS2_SYS_CONTEXT *sapi_ctx,
+                    const TPM2B_ECC_PARAMETER *basename_y,
+                    xtpm_ecdaa_challenge_fn challenge_fn,
+                    void *challenge_user_data);
+
+/*
+ * Fill the context's pool of commits (see `xtpm_ecdaa_commit_pool_fill`),
+ * e.g. while the connection is idle.
+ */
+TSS2_RC
+xtpm_ecdaa_precommit(struct xtpm_ecdaa_ctx *ctx);
+
+/*
+ * ECDAA-sign `msg_digest`: one round trip (Sign) with a pooled commit,
+ * otherwise two (Commit, then Sign).
+ *
+ * The digest signed is computed by the context's challenge function,
+ * from `msg_digest` and the commit (returned in `commit_out`).
+ * If the TPM rejects a pooled commit, the challenge is computed again for a new one.
+ */
+TSS2_RC
+xtpm_ecdaa_sign(struct xtpm_ecdaa_ctx *ctx,
+                const TPM2B_DIGEST *msg_digest,
+                struct xtpm_ecdaa_commit *commit_out,
+                TPMT_SIGNATURE *signature_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,112 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TPM_HASH_H
+#define XAPTUM_TPM_HASH_H
+#pragma once
+
+#include <tss2/tss2_sys.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A SHA-256 hash sequence in the TPM, for messages to be signed
+ * by a restricted signing key: such a key only signs a digest
+ * the TPM computed itself, as shown by the hashcheck ticket it returns.
+ *
+ * Data is sent in chunks as large as the TPM accepts (its TPM2_PT_INPUT_BUFFER),
+ * and the next chunk is gathered while the TPM hashes the previous one.
+ *
+ * Treat the fields as private.
+ */
+struct xtpm_hash_sequence {
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    TPMI_DH_OBJECT handle;
+    uint16_t chunk_size;
+    int update_pending;
+    TPM2B_MAX_BUFFER buffer;
+};
+
+/*
+ * Ask the TPM for its largest input buffer, once.
+ *
+ * While a sequence is started, `sapi_ctx` must not be used for anything else
+ * (an update may still be in flight).
+ */
+TSS2_RC
+xtpm_hash_sequence_init(struct xtpm_hash_sequence *seq,
+                        TSS2_SYS_CONTEXT *sapi_ctx);
+
+/*
+ * Start hashing a new message in the TPM.
+ *
+ * The sequence takes up one of the TPM's transient object slots until
+ * it's completed or aborted.
+ */
+TSS2_RC
+xtpm_hash_sequence_start(struct xtpm_hash_sequence *seq);
+
+/*
+ * Hash the next `length` bytes of the message.
+ *
+ * On failure, the sequence must be aborted.
+ */
+TSS2_RC
+xtpm_hash_sequence_update(struct xtpm_hash_sequence *seq,
+                          const void *data,
+                          size_t length);
+
+/*
+ * Finish hashing the message: its digest is returned in `digest_out`,
+ * and a ticket for it (from `hierarchy`) in `ticket_out`.
+ *
+ * The ticket is a NULL ticket if `hierarchy` is TPM2_RH_NULL,
+ * or if the message starts with TPM2_GENERATED_VALUE
+ * (so a restricted key can't be made to sign a forged attestation).
+ *
+ * On failure, the sequence must be aborted.
+ */
+TSS2_RC
+xtpm_hash_sequence_complete(struct xtpm_hash_sequence *seq,
+                            TPMI_RH_HIERARCHY hierarchy,
+                            TPM2B_DIGEST *digest_out,
+                            TPMT_TK_HASHCHECK *ticket_out);
+
+/*
+ * Finish hashing the message (with an owner-hierarchy ticket),
+ * and ECDSA-sign its digest with the key at `key_handle`, which must have no auth set.
+ */
+TSS2_RC
+xtpm_hash_sequence_sign(struct xtpm_hash_sequence *seq,
+                        TPM2_HANDLE key_handle,
+                        TPMT_SIGNATURE *signature_out);
+
+/*
+ * Flush a started sequence from the TPM, without finishing it.
+ * Does nothing if no sequence is started.
+ */
+TSS2_RC
+xtpm_hash_sequence_abort(struct xtpm_hash_sequence *seq);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,6 +24,8 @@
 #include <tss2/tss2_sys.h>
 
 #define XTPM_PUB_KEY_SIZE 65
+#define XTPM_RAW_SIGNATURE_SIZE 64
+#define XTPM_SIGN_BLOCK_SIZE 64
 
 #ifdef __cplusplus
 extern "C" {
@@ -40,6 +42,28 @@ struct xtpm_key {
     TPM2B_PRIVATE private_key_blob;
 };
 
+/*
+ * State for hashing a message piece by piece before signing it.
+ *
+ * Treat the fields as private.
+ */
+struct xtpm_sign_ctx {
+    uint32_t hash_state[8];
+    uint64_t hashed_length;
+    uint8_t partial_block[XTPM_SIGN_BLOCK_SIZE];
+};
+
+/*
+ * Each function taking a TCTI context has a `_sapi` variant taking
+ * an initialized SAPI context instead, whose storage the caller owns
+ * (e.g. a static buffer of `Tss2_Sys_GetContextSize()` bytes).
+ * The `_sapi` variants never allocate.
+ *
+ * When built with `XTPM_NO_HEAP`, only they are available,
+ * and `xtpm_write_key` (which uses stdio) is left out as well.
+ */
+
+#ifndef XTPM_NO_HEAP
 /*
  * Create new child key.
  *
@@ -65,7 +89,17 @@ xtpm_gen_key(TSS2_TCTI_CONTEXT *tcti_ctx,
              const char *hierarchy_password,
              size_t hierarchy_password_length,
              struct xtpm_key *out);
+#endif
 
+TSS2_RC
+xtpm_gen_key_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                  TPM2_HANDLE parent_handle,
+                  TPMI_RH_HIERARCHY hierarchy,
+                  const char *hierarchy_password,
+                  size_t hierarchy_password_length,
+                  struct xtpm_key *out);
+
+#ifndef XTPM_NO_HEAP
 /*
  * Load the `xtpm_key` into the TPM, so it's usable for signing.
  *
@@ -75,20 +109,34 @@ TSS2_RC
 xtpm_load_key(TSS2_TCTI_CONTEXT *tcti_ctx,
               const struct xtpm_key *key,
               TPM2_HANDLE *handle_out);
+#endif
+
+TSS2_RC
+xtpm_load_key_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                   const struct xtpm_key *key,
+                   TPM2_HANDLE *handle_out);
 
+#ifndef XTPM_NO_HEAP
 /*
  * Flush a memory-resident key (at `handle`) from the TPM.
  */
 TSS2_RC
 xtpm_flush_key(TSS2_TCTI_CONTEXT *tcti_ctx,
                TPM2_HANDLE handle);
+#endif
+
+TSS2_RC
+xtpm_flush_key_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                    TPM2_HANDLE handle);
 
+#ifndef XTPM_NO_HEAP
 /*
  * Write key to PEM file.
  */
 TSS2_RC
 xtpm_write_key(const struct xtpm_key *key,
                const char *filename);
+#endif
 
 /*
  * Retrieve the public key from a `xtpm_key` in x9.62 uncompressed format
@@ -99,6 +147,7 @@ TSS2_RC
 xtpm_get_public_key(const struct xtpm_key *key,
                     uint8_t *buf);
 
+#ifndef XTPM_NO_HEAP
 /*
  * Generate signature over `digest` using `key`.
  *
@@ -112,6 +161,99 @@ xtpm_sign(TSS2_TCTI_CONTEXT *tcti_ctx,
           const struct xtpm_key *key,
           const TPM2B_DIGEST *digest,
           TPMT_SIGNATURE *signature_out);
+#endif
+
+TSS2_RC
+xtpm_sign_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+               const struct xtpm_key *key,
+               const TPM2B_DIGEST *digest,
+               TPMT_SIGNATURE *signature_out);
+
+#ifndef XTPM_NO_HEAP
+/*
+ * Generate an ECDSA signature over `digest` using `key`, like `xtpm_sign`,
+ * written as r || s (each 32 bytes, big-endian)
+ * to the `XTPM_RAW_SIGNATURE_SIZE` bytes at `signature_out`.
+ *
+ * With the bundled TSS2, r and s are copied straight out of the TPM's response.
+ */
+TSS2_RC
+xtpm_sign_raw(TSS2_TCTI_CONTEXT *tcti_ctx,
+              const struct xtpm_key *key,
+              const TPM2B_DIGEST *digest,
+              uint8_t *signature_out);
+#endif
+
+TSS2_RC
+xtpm_sign_raw_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                   const struct xtpm_key *key,
+                   const TPM2B_DIGEST *digest,
+                   uint8_t *signature_out);
+
+/*
+ * Start hashing a new message to be signed with `xtpm_sign_final`.
+ *
+ * The message is hashed (SHA-256) on the host, using the CPU's
+ * SHA extensions when it has them.
+ */
+void
+xtpm_sign_init(struct xtpm_sign_ctx *ctx);
+
+/*
+ * Hash the next `length` bytes of the message.
+ */
+void
+xtpm_sign_update(struct xtpm_sign_ctx *ctx,
+                 const void *data,
+                 size_t length);
+
+#ifndef XTPM_NO_HEAP
+/*
+ * Finish hashing the message, and sign its digest using `key`, as `xtpm_sign`.
+ *
+ * `ctx` must be re-initialized before it's used again.
+ */
+TSS2_RC
+xtpm_sign_final(TSS2_TCTI_CONTEXT *tcti_ctx,
+                const struct xtpm_key *key,
+                struct xtpm_sign_ctx *ctx,
+                TPMT_SIGNATURE *signature_out);
+#endif
+
+TSS2_RC
+xtpm_sign_final_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                     const struct xtpm_key *key,
+                     struct xtpm_sign_ctx *ctx,
+                     TPMT_SIGNATURE *signature_out);
+
+#ifndef XTPM_NO_HEAP
+/*
+ * Sign each of the `count` messages (of the given `lengths`) using `key`,
+ * into the corresponding `signatures_out`.
+ *
+ * The key is loaded once for the whole batch.
+ * The messages are hashed (SHA-256) on the host: the first several at once
+ * in SIMD lanes on CPUs with AVX2 but no SHA extensions, and each of the rest
+ * while the TPM signs an earlier one.
+ *
+ * On failure, some of the signatures may already have been written.
+ */
+TSS2_RC
+xtpm_sign_message_batch(TSS2_TCTI_CONTEXT *tcti_ctx,
+                        const struct xtpm_key *key,
+                        const uint8_t *const *messages,
+                        const size_t *lengths,
+                        size_t count,
+                        TPMT_SIGNATURE *signatures_out);
+#endif
+
+TSS2_RC
+xtpm_sign_message_batch_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                             const struct xtpm_key *key,
+                             const uint8_t *const *messages,
+                             const size_t *lengths,
+                             size_t count,
+                             TPMT_SIGNATURE *signatures_out);
 
 #ifdef __cplusplus
 }
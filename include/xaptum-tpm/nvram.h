@@ -67,6 +67,93 @@ xtpm_read_nvram(unsigned char *out,
                 TPM2_HANDLE index,
                 TSS2_SYS_CONTEXT *sapi_context);
 
+/*
+ * Write `size` bytes from `in` to NV index `index`, starting at offset 0.
+ *
+ * The data is sent in chunks of at most TPM2_MAX_NV_BUFFER_SIZE bytes,
+ * authorized with an empty password on `auth_handle`
+ * (e.g. TPM2_RH_PLATFORM, TPM2_RH_OWNER, or `index` itself).
+ */
+TSS2_RC
+xtpm_write_nvram(const unsigned char *in,
+                 uint16_t size,
+                 TPM2_HANDLE index,
+                 TPMI_RH_NV_AUTH auth_handle,
+                 TSS2_SYS_CONTEXT *sapi_context);
+
+/*
+ * Source of data for `xtpm_write_nvram_stream`.
+ *
+ * Must fill `buf` with exactly `length` bytes, and return 0 on success
+ * or non-zero on failure.
+ */
+typedef int (*xtpm_nvram_read_fn)(unsigned char *buf,
+                                  uint16_t length,
+                                  void *user_data);
+
+/*
+ * Like `xtpm_write_nvram`, but pulls the `size` bytes to write from `read_fn`.
+ *
+ * The next chunk is fetched from `read_fn` while the TPM is still processing
+ * the previous NV_Write, so slow sources (files, sockets) overlap with TPM time
+ * on transports that don't block in transmit.
+ */
+TSS2_RC
+xtpm_write_nvram_stream(xtpm_nvram_read_fn read_fn,
+                        void *user_data,
+                        uint16_t size,
+                        TPM2_HANDLE index,
+                        TPMI_RH_NV_AUTH auth_handle,
+                        TSS2_SYS_CONTEXT *sapi_context);
+
+/*
+ * Incremental reader for an NV index, for objects too large to buffer whole.
+ *
+ * Treat the fields as private, except `size` (the total size of the index),
+ * which is valid after a successful `xtpm_nv_reader_open`.
+ */
+struct xtpm_nv_reader {
+    TSS2_SYS_CONTEXT *sapi_context;
+    TPM2_HANDLE index;
+    uint16_t size;
+    uint16_t offset;
+    int in_flight;
+    TPM2B_MAX_NV_BUFFER chunk;
+};
+
+/*
+ * Start reading NV index `index`, authorized with an empty password on the index itself.
+ *
+ * The read of the first chunk is sent before returning.
+ * Until the reader is closed, `sapi_context` must not be used for anything else.
+ */
+TSS2_RC
+xtpm_nv_reader_open(struct xtpm_nv_reader *reader,
+                    TPM2_HANDLE index,
+                    TSS2_SYS_CONTEXT *sapi_context);
+
+/*
+ * Get the next chunk (at most TPM2_MAX_NV_BUFFER_SIZE bytes) of the index.
+ *
+ * `*chunk_out` points into `reader` and is valid until the next call.
+ * The read of the following chunk is sent before returning,
+ * so the TPM works on it while the caller consumes this one.
+ *
+ * At the end of the index, `*chunk_length_out` is set to 0.
+ */
+TSS2_RC
+xtpm_nv_reader_next(struct xtpm_nv_reader *reader,
+                    const unsigned char **chunk_out,
+                    uint16_t *chunk_length_out);
+
+/*
+ * Stop reading, collecting the response to any read still outstanding.
+ *
+ * Must be called even if `xtpm_nv_reader_next` returned an error.
+ */
+TSS2_RC
+xtpm_nv_reader_close(struct xtpm_nv_reader *reader);
+
 TSS2_RC
 xtpm_get_nvram_size(uint16_t *size_out,
                     TPM2_HANDLE index,
@@ -0,0 +1,94 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TPM_PROVISION_H
+#define XAPTUM_TPM_PROVISION_H
+#pragma once
+
+#include <tss2/tss2_sys.h>
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * One NV index to provision.
+ *
+ * `attributes` are the TPMA_NV bits to define the index with
+ * (the state bits, e.g. TPMA_NV_WRITTEN, are ignored).
+ * The index is defined with a size of `data_size` and no auth value.
+ */
+struct xtpm_nv_entry {
+    TPMI_RH_NV_INDEX index;
+    TPMA_NV attributes;
+    const unsigned char *data;
+    uint16_t data_size;
+};
+
+/*
+ * What `xtpm_provision_nvram` did with each entry.
+ */
+enum xtpm_provision_action {
+    XTPM_PROVISION_UNCHANGED,   // already defined with the same contents
+    XTPM_PROVISION_DEFINED,     // index didn't exist, so was defined and written
+    XTPM_PROVISION_REDEFINED,   // attributes or size differed, so was undefined, defined and written
+    XTPM_PROVISION_WRITTEN,     // attributes matched but contents didn't, so was re-written
+};
+
+/*
+ * Define and write each of the `count` NV indices in `entries`.
+ *
+ * Indices that already exist with the same attributes, size, and contents
+ * are left untouched, so provisioning can safely be re-run.
+ *
+ * Indices are defined (and undefined, if necessary) under `auth_handle`
+ * (TPM2_RH_OWNER or TPM2_RH_PLATFORM), authorized with `password`.
+ * Indices are written under `auth_handle` if they have the matching
+ * TPMA_NV_OWNERWRITE / TPMA_NV_PPWRITE attribute, and otherwise
+ * with the (empty) auth of the index itself.
+ * Contents are likewise read under `auth_handle` if the index has the matching
+ * TPMA_NV_OWNERREAD / TPMA_NV_PPREAD attribute, and otherwise under its own auth,
+ * which needs TPMA_NV_AUTHREAD. An entry readable neither way fails the call
+ * with TSS2_BASE_RC_BAD_VALUE, before anything is provisioned.
+ *
+ * If `actions_out` is non-NULL, it must hold `count` elements
+ * and is filled with what was done with each entry.
+ *
+ * Processing stops at the first failure.
+ *
+ * Default parameters:
+ *  - auth_handle = TPM2_RH_OWNER (set to 0 to use default)
+ *  - password = empty auth
+ *  - password_length = 0 (set to 0 to use empty password)
+ */
+TSS2_RC
+xtpm_provision_nvram(const struct xtpm_nv_entry *entries,
+                     size_t count,
+                     TPMI_RH_PROVISION auth_handle,
+                     const char *password,
+                     size_t password_length,
+                     enum xtpm_provision_action *actions_out,
+                     TSS2_SYS_CONTEXT *sapi_context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,192 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TPM_SERVICE_H
+#define XAPTUM_TPM_SERVICE_H
+#pragma once
+
+#include <xaptum-tpm/keys.h>
+
+#include <tss2/tss2_tcti.h>
+#include <tss2/tss2_sys.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Runs TPM jobs (signing, NV reads and key generation) on a dedicated thread,
+ * so the threads submitting them don't block on the TPM.
+ *
+ * Jobs run one at a time, in the order they were submitted.
+ */
+struct xtpm_service;
+
+struct xtpm_job;
+
+/*
+ * Called on the service thread when `job` has finished.
+ *
+ * It may submit more jobs, but must not wait for any.
+ */
+typedef void (*xtpm_job_callback)(struct xtpm_job *job, void *user_data);
+
+/*
+ * A submitted job.
+ *
+ * Allocated by the caller, and must stay valid (as must the inputs and outputs
+ * given when submitting it) until it has finished.
+ * Treat the fields as private, except `rc` (the job's result),
+ * and the CLOCK_MONOTONIC times (in ns) it was submitted, started and finished at,
+ * which are valid once `xtpm_job_done` returns non-zero
+ * (or `xtpm_job_wait` returns, or the callback is called).
+ */
+struct xtpm_job {
+    TSS2_RC rc;
+    uint64_t submit_ns;
+    uint64_t start_ns;
+    uint64_t finish_ns;
+
+    struct xtpm_job *next;
+    struct xtpm_service *service;
+    int type;
+    int done;
+    xtpm_job_callback callback;
+    void *user_data;
+    union {
+        struct {
+            const struct xtpm_key *key;
+            const TPM2B_DIGEST *digest;
+            TPMT_SIGNATURE *signature_out;
+        } sign;
+        struct {
+            TPM2_HANDLE index;
+            unsigned char *out;
+            uint16_t size;
+        } read_nvram;
+        struct {
+            TPM2_HANDLE parent_handle;
+            TPMI_RH_HIERARCHY hierarchy;
+            const char *hierarchy_password;
+            size_t hierarchy_password_length;
+            struct xtpm_key *out;
+        } gen_key;
+    } args;
+};
+
+struct xtpm_service_stats {
+    uint64_t submitted;
+    uint64_t completed;
+    uint32_t queue_depth;       // submitted, but not started
+    uint32_t max_queue_depth;
+    uint64_t total_wait_ns;     // from submitted to started, over all completed jobs
+    uint64_t max_wait_ns;
+    uint64_t total_run_ns;      // from started to finished, over all completed jobs
+};
+
+/*
+ * Start a service, which takes over `tcti_ctx`.
+ *
+ * Until the service is destroyed, `tcti_ctx` must not be used by anything else.
+ *
+ * If `cpu` is non-negative, the service thread is pinned to that CPU
+ * (returning TSS2_BASE_RC_NOT_SUPPORTED where pinning isn't available).
+ *
+ * If `max_queue_depth` is non-zero, submitting a job while that many are waiting
+ * fails with TSS2_BASE_RC_TRY_AGAIN.
+ *
+ * The service is allocated, and freed by `xtpm_service_destroy`.
+ */
+TSS2_RC
+xtpm_service_create(struct xtpm_service **service_out,
+                    TSS2_TCTI_CONTEXT *tcti_ctx,
+                    int cpu,
+                    uint32_t max_queue_depth);
+
+/*
+ * Finish the jobs already submitted, then stop the service.
+ *
+ * `tcti_ctx` is left as-is, for the caller to finalize.
+ */
+void
+xtpm_service_destroy(struct xtpm_service *service);
+
+/*
+ * Submit a job, as `xtpm_sign`.
+ *
+ * `callback` may be NULL, in which case use `xtpm_job_wait`.
+ */
+TSS2_RC
+xtpm_service_sign(struct xtpm_service *service,
+                  struct xtpm_job *job,
+                  const struct xtpm_key *key,
+                  const TPM2B_DIGEST *digest,
+                  TPMT_SIGNATURE *signature_out,
+                  xtpm_job_callback callback,
+                  void *user_data);
+
+/*
+ * Submit a job, as `xtpm_read_nvram`.
+ */
+TSS2_RC
+xtpm_service_read_nvram(struct xtpm_service *service,
+                        struct xtpm_job *job,
+                        unsigned char *out,
+                        uint16_t size,
+                        TPM2_HANDLE index,
+                        xtpm_job_callback callback,
+                        void *user_data);
+
+/*
+ * Submit a job, as `xtpm_gen_key` (with the same defaults).
+ */
+TSS2_RC
+xtpm_service_gen_key(struct xtpm_service *service,
+                     struct xtpm_job *job,
+                     TPM2_HANDLE parent_handle,
+                     TPMI_RH_HIERARCHY hierarchy,
+                     const char *hierarchy_password,
+                     size_t hierarchy_password_length,
+                     struct xtpm_key *out,
+                     xtpm_job_callback callback,
+                     void *user_data);
+
+/*
+ * Non-zero once `job` has finished.
+ */
+int
+xtpm_job_done(const struct xtpm_job *job);
+
+/*
+ * Wait for `job` to finish, and return its result.
+ */
+TSS2_RC
+xtpm_job_wait(struct xtpm_job *job);
+
+void
+xtpm_service_get_stats(struct xtpm_service *service,
+                       struct xtpm_service_stats *stats_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
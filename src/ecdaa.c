@@ -0,0 +1,349 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <xaptum-tpm/ecdaa.h>
+#include <xaptum-tpm/nvram.h>
+
+#include <tss2/tss2_sys.h>
+
+#include <string.h>
+
+// Format-one TPM response codes (Part 2, Sec. 6.6)
+#define RC_FMT1_ERROR_MASK 0x03F
+#define RC_FMT1_P 0x040
+#define RC_FMT1_N_MASK 0xF00
+#define RC_FMT1_N_SHIFT 8
+#define RC_VALUE 0x004
+
+// Sign's parameter holding the commit's counter
+#define SIGN_IN_SCHEME_PARAMETER 2
+
+// What the TPM returns for a Sign whose commit it no longer has:
+// TPM_RC_VALUE, either unnumbered (as from the reference implementation's CryptSign)
+// or for the `inScheme` parameter.
+// A TPM_RC_VALUE for a handle, session or other parameter is a different problem.
+static
+int
+is_stale_commit_error(TSS2_RC ret)
+{
+    if ((ret & ~(TSS2_RC)0xFFF) != TSS2_TPM_RC_LEVEL ||
+        !(ret & RC_FMT1) ||
+        (ret & RC_FMT1_ERROR_MASK) != RC_VALUE)
+        return 0;
+
+    unsigned n = (ret & RC_FMT1_N_MASK) >> RC_FMT1_N_SHIFT;
+    if (ret & RC_FMT1_P)
+        return SIGN_IN_SCHEME_PARAMETER == n;
+    return 0 == n;
+}
+
+static
+void
+init_password_auth(TSS2L_SYS_AUTH_COMMAND *sessionsData)
+{
+    *sessionsData = (TSS2L_SYS_AUTH_COMMAND){};
+    sessionsData->auths[0].sessionHandle = TPM2_RS_PW;
+    sessionsData->count = 1;
+}
+
+static
+struct xtpm_ecdaa_commit *
+pool_entry(struct xtpm_ecdaa_commit_pool *pool,
+           unsigned i)
+{
+    return &pool->commits[(pool->first + i) % XTPM_ECDAA_COMMIT_POOL_SIZE];
+}
+
+static
+void
+pop_oldest(struct xtpm_ecdaa_commit_pool *pool,
+           struct xtpm_ecdaa_commit *commit_out)
+{
+    *commit_out = *pool_entry(pool, 0);
+    pool->first = (pool->first + 1) % XTPM_ECDAA_COMMIT_POOL_SIZE;
+    pool->count--;
+}
+
+// Put back a commit taken with `pop_oldest`, which is older than any still pooled.
+static
+void
+push_oldest(struct xtpm_ecdaa_commit_pool *pool,
+            const struct xtpm_ecdaa_commit *commit_in)
+{
+    if (pool->count == XTPM_ECDAA_COMMIT_POOL_SIZE)
+        return;
+
+    pool->first = (pool->first + XTPM_ECDAA_COMMIT_POOL_SIZE - 1) % XTPM_ECDAA_COMMIT_POOL_SIZE;
+    pool->count++;
+    *pool_entry(pool, 0) = *commit_in;
+}
+
+// Make a new commit, and drop any pooled ones it shows to be unusable.
+static
+TSS2_RC
+commit(struct xtpm_ecdaa_commit_pool *pool,
+       TSS2_SYS_CONTEXT *sapi_ctx,
+       struct xtpm_ecdaa_commit *commit_out)
+{
+    TSS2L_SYS_AUTH_COMMAND sessionsData;
+    init_password_auth(&sessionsData);
+
+    TSS2_RC ret = Tss2_Sys_Commit(sapi_ctx,
+                                  pool->key_handle,
+                                  &sessionsData,
+                                  &pool->P1,
+                                  &pool->s2,
+                                  &pool->y2,
+                                  &commit_out->K,
+                                  &commit_out->L,
+                                  &commit_out->E,
+                                  &commit_out->counter,
+                                  NULL);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    // A counter that went backwards means the TPM lost its commits (e.g. it was restarted).
+    uint16_t advance = commit_out->counter - pool->newest_counter;
+    if (pool->have_newest && advance >= 0x8000)
+        xtpm_ecdaa_commit_pool_clear(pool);
+
+    pool->have_newest = 1;
+    pool->newest_counter = commit_out->counter;
+
+    // Counters only increase, so the oldest commits are at the front.
+    while (pool->count > 0) {
+        uint16_t age = pool->newest_counter - pool_entry(pool, 0)->counter;
+        if (age < XTPM_ECDAA_COMMIT_WINDOW)
+            break;
+        struct xtpm_ecdaa_commit stale;
+        pop_oldest(pool, &stale);
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+// Sign the digest `challenge_fn` computes for `commit_in` (or `msg_digest` itself).
+static
+TSS2_RC
+sign_with_commit(struct xtpm_ecdaa_commit_pool *pool,
+                 TSS2_SYS_CONTEXT *sapi_ctx,
+                 xtpm_ecdaa_challenge_fn challenge_fn,
+                 void *challenge_user_data,
+                 const TPM2B_DIGEST *msg_digest,
+                 const struct xtpm_ecdaa_commit *commit_in,
+                 TPMT_SIGNATURE *signature_out)
+{
+    const TPM2B_DIGEST *digest = msg_digest;
+    TPM2B_DIGEST challenge;
+    if (NULL != challenge_fn) {
+        if (0 != challenge_fn(commit_in, msg_digest, &challenge, challenge_user_data))
+            return TSS2_BASE_RC_GENERAL_FAILURE;
+        digest = &challenge;
+    }
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData;
+    init_password_auth(&sessionsData);
+
+    TPMT_SIG_SCHEME inScheme = {.scheme = TPM2_ALG_ECDAA};
+    inScheme.details.ecdaa.hashAlg = TPM2_ALG_SHA256;
+    inScheme.details.ecdaa.count = commit_in->counter;
+
+    // Hash was *not* generated by TPM, so pass a "NULL ticket".
+    TPMT_TK_HASHCHECK validation = {.tag = TPM2_ST_HASHCHECK,
+                                    .hierarchy = TPM2_RH_NULL};
+
+    return Tss2_Sys_Sign(sapi_ctx,
+                         pool->key_handle,
+                         &sessionsData,
+                         digest,
+                         &inScheme,
+                         &validation,
+                         signature_out,
+                         NULL);
+}
+
+static
+TSS2_RC
+pool_sign(struct xtpm_ecdaa_commit_pool *pool,
+          TSS2_SYS_CONTEXT *sapi_ctx,
+          xtpm_ecdaa_challenge_fn challenge_fn,
+          void *challenge_user_data,
+          const TPM2B_DIGEST *msg_digest,
+          struct xtpm_ecdaa_commit *commit_out,
+          TPMT_SIGNATURE *signature_out)
+{
+    TSS2_RC ret;
+
+    if (pool->count > 0) {
+        pop_oldest(pool, commit_out);
+
+        ret = sign_with_commit(pool, sapi_ctx, challenge_fn, challenge_user_data, msg_digest, commit_out, signature_out);
+        if (TSS2_RC_SUCCESS == ret)
+            return ret;
+
+        if (!is_stale_commit_error(ret)) {
+            // The commit may still be good (if the TPM did use it, the next Sign finds out).
+            push_oldest(pool, commit_out);
+            return ret;
+        }
+
+        // The TPM forgot this commit, so it likely forgot the rest too.
+        xtpm_ecdaa_commit_pool_clear(pool);
+    }
+
+    ret = commit(pool, sapi_ctx, commit_out);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    ret = sign_with_commit(pool, sapi_ctx, challenge_fn, challenge_user_data, msg_digest, commit_out, signature_out);
+    if (TSS2_RC_SUCCESS != ret && !is_stale_commit_error(ret))
+        push_oldest(pool, commit_out);
+
+    return ret;
+}
+
+void
+xtpm_ecdaa_commit_pool_init(struct xtpm_ecdaa_commit_pool *pool,
+                            TPM2_HANDLE key_handle,
+                            const TPM2B_ECC_POINT *P1,
+                            const TPM2B_SENSITIVE_DATA *s2,
+                            const TPM2B_ECC_PARAMETER *y2)
+{
+    memset(pool, 0, sizeof(struct xtpm_ecdaa_commit_pool));
+
+    pool->key_handle = key_handle;
+    if (NULL != P1)
+        pool->P1 = *P1;
+    if (NULL != s2)
+        pool->s2 = *s2;
+    if (NULL != y2)
+        pool->y2 = *y2;
+}
+
+TSS2_RC
+xtpm_ecdaa_commit_pool_fill(struct xtpm_ecdaa_commit_pool *pool,
+                            TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    while (pool->count < XTPM_ECDAA_COMMIT_POOL_SIZE) {
+        struct xtpm_ecdaa_commit new_commit;
+        TSS2_RC ret = commit(pool, sapi_ctx, &new_commit);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        *pool_entry(pool, pool->count) = new_commit;
+        pool->count++;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+unsigned
+xtpm_ecdaa_commit_pool_count(const struct xtpm_ecdaa_commit_pool *pool)
+{
+    return pool->count;
+}
+
+void
+xtpm_ecdaa_commit_pool_clear(struct xtpm_ecdaa_commit_pool *pool)
+{
+    pool->first = 0;
+    pool->count = 0;
+}
+
+TSS2_RC
+xtpm_ecdaa_commit_pool_sign(struct xtpm_ecdaa_commit_pool *pool,
+                            TSS2_SYS_CONTEXT *sapi_ctx,
+                            xtpm_ecdaa_challenge_fn challenge_fn,
+                            void *challenge_user_data,
+                            const TPM2B_DIGEST *msg_digest,
+                            struct xtpm_ecdaa_commit *commit_out,
+                            TPMT_SIGNATURE *signature_out)
+{
+    if (NULL == challenge_fn)
+        return TSS2_BASE_RC_BAD_REFERENCE;
+
+    return pool_sign(pool, sapi_ctx, challenge_fn, challenge_user_data, msg_digest, commit_out, signature_out);
+}
+
+TSS2_RC
+xtpm_ecdaa_ctx_init(struct xtpm_ecdaa_ctx *ctx,
+                    TSS2_SYS_CONTEXT *sapi_ctx,
+                    const TPM2B_ECC_PARAMETER *basename_y,
+                    xtpm_ecdaa_challenge_fn challenge_fn,
+                    void *challenge_user_data)
+{
+    memset(ctx, 0, sizeof(struct xtpm_ecdaa_ctx));
+
+    ctx->sapi_ctx = sapi_ctx;
+    ctx->challenge_fn = challenge_fn;
+    ctx->challenge_user_data = challenge_user_data;
+
+    TSS2_RC ret = Tss2_Sys_ReadPublic(sapi_ctx,
+                                      xtpm_ecdaa_key_handle(),
+                                      NULL,
+                                      &ctx->public_key,
+                                      NULL,
+                                      NULL,
+                                      NULL);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    // Signing always asks for ECDAA with SHA-256, which a key with any other scheme refuses.
+    const TPMT_ECC_SCHEME *scheme = &ctx->public_key.publicArea.parameters.eccDetail.scheme;
+    if (TPM2_ALG_ECC != ctx->public_key.publicArea.type)
+        return TSS2_BASE_RC_BAD_VALUE;
+    if (TPM2_ALG_NULL != scheme->scheme
+            && (TPM2_ALG_ECDAA != scheme->scheme || TPM2_ALG_SHA256 != scheme->details.ecdaa.hashAlg))
+        return TSS2_BASE_RC_BAD_VALUE;
+
+    ret = xtpm_read_object(ctx->basename.buffer,
+                           sizeof(ctx->basename.buffer),
+                           &ctx->basename.size,
+                           XTPM_BASENAME,
+                           sapi_ctx);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    if (NULL != basename_y)
+        xtpm_ecdaa_commit_pool_init(&ctx->pool, xtpm_ecdaa_key_handle(), NULL, &ctx->basename, basename_y);
+    else
+        xtpm_ecdaa_commit_pool_init(&ctx->pool, xtpm_ecdaa_key_handle(), NULL, NULL, NULL);
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+xtpm_ecdaa_precommit(struct xtpm_ecdaa_ctx *ctx)
+{
+    return xtpm_ecdaa_commit_pool_fill(&ctx->pool, ctx->sapi_ctx);
+}
+
+TSS2_RC
+xtpm_ecdaa_sign(struct xtpm_ecdaa_ctx *ctx,
+                const TPM2B_DIGEST *msg_digest,
+                struct xtpm_ecdaa_commit *commit_out,
+                TPMT_SIGNATURE *signature_out)
+{
+    return pool_sign(&ctx->pool,
+                     ctx->sapi_ctx,
+                     ctx->challenge_fn,
+                     ctx->challenge_user_data,
+                     msg_digest,
+                     commit_out,
+                     signature_out);
+}
@@ -0,0 +1,239 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <xaptum-tpm/hash.h>
+
+#include "internal/keys-impl.h"
+
+#include <string.h>
+
+static
+void
+init_password_auth(TSS2L_SYS_AUTH_COMMAND *sessionsData)
+{
+    *sessionsData = (TSS2L_SYS_AUTH_COMMAND){};
+    sessionsData->auths[0].sessionHandle = TPM2_RS_PW;
+    sessionsData->count = 1;
+}
+
+// Receive the response to the SequenceUpdate in flight.
+static
+TSS2_RC
+finish_update(struct xtpm_hash_sequence *seq)
+{
+    seq->update_pending = 0;
+
+    TSS2_RC ret = Tss2_Sys_ExecuteFinish(seq->sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut;
+    sessionsDataOut.count = 1;
+    ret = Tss2_Sys_GetRspAuths(seq->sapi_ctx, &sessionsDataOut);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    return Tss2_Sys_SequenceUpdate_Complete(seq->sapi_ctx);
+}
+
+// Send the buffered chunk, without waiting for the TPM to hash it.
+static
+TSS2_RC
+send_update(struct xtpm_hash_sequence *seq)
+{
+    TSS2_RC ret;
+
+    if (seq->update_pending) {
+        ret = finish_update(seq);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+    }
+
+    ret = Tss2_Sys_SequenceUpdate_Prepare(seq->sapi_ctx,
+                                          seq->handle,
+                                          &seq->buffer);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData;
+    init_password_auth(&sessionsData);
+    ret = Tss2_Sys_SetCmdAuths(seq->sapi_ctx, &sessionsData);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    ret = Tss2_Sys_ExecuteAsync(seq->sapi_ctx);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    // The chunk is now out of the SAPI buffer, so the next one can be gathered.
+    seq->update_pending = 1;
+    seq->buffer.size = 0;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+xtpm_hash_sequence_init(struct xtpm_hash_sequence *seq,
+                        TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    memset(seq, 0, sizeof(struct xtpm_hash_sequence));
+
+    seq->sapi_ctx = sapi_ctx;
+
+    TPMI_YES_NO more_data;
+    TPMS_CAPABILITY_DATA capability_data;
+    TSS2_RC ret = Tss2_Sys_GetCapability(sapi_ctx,
+                                         NULL,
+                                         TPM2_CAP_TPM_PROPERTIES,
+                                         TPM2_PT_INPUT_BUFFER,
+                                         1,
+                                         &more_data,
+                                         &capability_data,
+                                         NULL);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    // A TPM may accept less than the TPM2B_MAX_BUFFER we can send, but not more.
+    seq->chunk_size = sizeof(seq->buffer.buffer);
+    const TPML_TAGGED_TPM_PROPERTY *properties = &capability_data.data.tpmProperties;
+    if (1 == properties->count &&
+            TPM2_PT_INPUT_BUFFER == properties->tpmProperty[0].property &&
+            0 != properties->tpmProperty[0].value &&
+            properties->tpmProperty[0].value < seq->chunk_size)
+        seq->chunk_size = properties->tpmProperty[0].value;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+xtpm_hash_sequence_start(struct xtpm_hash_sequence *seq)
+{
+    seq->update_pending = 0;
+    seq->buffer.size = 0;
+
+    TPM2B_AUTH auth = {.size = 0};
+    return Tss2_Sys_HashSequenceStart(seq->sapi_ctx,
+                                      NULL,
+                                      &auth,
+                                      TPM2_ALG_SHA256,
+                                      &seq->handle,
+                                      NULL);
+}
+
+TSS2_RC
+xtpm_hash_sequence_update(struct xtpm_hash_sequence *seq,
+                          const void *data,
+                          size_t length)
+{
+    const uint8_t *in = data;
+
+    while (length > 0) {
+        // A full chunk is only sent once there's more data,
+        // so SequenceComplete always has something to carry.
+        if (seq->buffer.size == seq->chunk_size) {
+            TSS2_RC ret = send_update(seq);
+            if (TSS2_RC_SUCCESS != ret)
+                return ret;
+        }
+
+        size_t copy_length = seq->chunk_size - seq->buffer.size;
+        if (copy_length > length)
+            copy_length = length;
+
+        memcpy(seq->buffer.buffer + seq->buffer.size, in, copy_length);
+        seq->buffer.size += copy_length;
+        in += copy_length;
+        length -= copy_length;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+xtpm_hash_sequence_complete(struct xtpm_hash_sequence *seq,
+                            TPMI_RH_HIERARCHY hierarchy,
+                            TPM2B_DIGEST *digest_out,
+                            TPMT_TK_HASHCHECK *ticket_out)
+{
+    TSS2_RC ret;
+
+    if (seq->update_pending) {
+        ret = finish_update(seq);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+    }
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData;
+    init_password_auth(&sessionsData);
+
+    ret = Tss2_Sys_SequenceComplete(seq->sapi_ctx,
+                                    seq->handle,
+                                    &sessionsData,
+                                    &seq->buffer,
+                                    hierarchy,
+                                    digest_out,
+                                    ticket_out,
+                                    NULL);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    // SequenceComplete flushed the sequence.
+    seq->handle = 0;
+    seq->buffer.size = 0;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+xtpm_hash_sequence_sign(struct xtpm_hash_sequence *seq,
+                        TPM2_HANDLE key_handle,
+                        TPMT_SIGNATURE *signature_out)
+{
+    TPM2B_DIGEST digest = {.size = 0};
+    TPMT_TK_HASHCHECK ticket;
+    TSS2_RC ret = xtpm_hash_sequence_complete(seq,
+                                              TPM2_RH_OWNER,
+                                              &digest,
+                                              &ticket);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    return sign_with_ticket(seq->sapi_ctx,
+                            key_handle,
+                            &digest,
+                            &ticket,
+                            signature_out);
+}
+
+TSS2_RC
+xtpm_hash_sequence_abort(struct xtpm_hash_sequence *seq)
+{
+    if (0 == seq->handle)
+        return TSS2_RC_SUCCESS;
+
+    // The SAPI context can't flush with an update still in flight.
+    if (seq->update_pending)
+        (void)finish_update(seq);
+
+    TSS2_RC ret = Tss2_Sys_FlushContext(seq->sapi_ctx, seq->handle);
+
+    seq->handle = 0;
+    seq->buffer.size = 0;
+
+    return ret;
+}
@@ -17,24 +17,29 @@
  *****************************************************************************/
 
 #include "keys-impl.h"
+#include "sha256.h"
+
+#ifdef XTPM_BUNDLED_TSS2
+#include <tss2/tss2_sys_view.h>
+#endif
 
 #include <string.h>
 
+#define DEFAULT_PARENT_KEY 0x81000001
+#define DEFAULT_HIERARCHY TPM2_RH_OWNER
 
 TSS2_RC
 check_parent(TSS2_SYS_CONTEXT *sapi_ctx,
              TPM2_HANDLE parent_handle)
 {
     TPM2B_PUBLIC outPublic = {};
-    TPM2B_NAME name = {};
-    TPM2B_NAME qualifiedName = {};
 
     TSS2_RC ret = Tss2_Sys_ReadPublic(sapi_ctx,
                                       parent_handle,
                                       NULL,
                                       &outPublic,
-                                      &name,
-                                      &qualifiedName,
+                                      NULL,
+                                      NULL,
                                       NULL);
 
     if (TSS2_RC_SUCCESS != ret)
@@ -65,8 +70,6 @@ create_primary(TSS2_SYS_CONTEXT *sapi_ctx,
         memcpy(sessionsData.auths[0].hmac.buffer, hierarchy_password, hierarchy_password_length);
     }
 
-    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
-
     // Nb. no auth set for key
     TPM2B_SENSITIVE_CREATE inSensitive = {};
 
@@ -103,13 +106,6 @@ create_primary(TSS2_SYS_CONTEXT *sapi_ctx,
 
     TPM2B_DATA outsideInfo = {};
     TPML_PCR_SELECTION creationPCR = {};
-    TPM2B_CREATION_DATA creationData = {};
-    TPM2B_DIGEST creationHash = {};
-    TPMT_TK_CREATION creationTicket = {};
-    TPM2B_NAME name = {};
-
-    TPM2B_PUBLIC public_key = {};
-
     TPM2_HANDLE tmp_primary_handle;
 
     TSS2_RC ret = Tss2_Sys_CreatePrimary(sapi_ctx,
@@ -120,12 +116,12 @@ create_primary(TSS2_SYS_CONTEXT *sapi_ctx,
                                          &outsideInfo,
                                          &creationPCR,
                                          &tmp_primary_handle,
-                                         &public_key,
-                                         &creationData,
-                                         &creationHash,
-                                         &creationTicket,
-                                         &name,
-                                         &sessionsDataOut);
+                                         NULL,
+                                         NULL,
+                                         NULL,
+                                         NULL,
+                                         NULL,
+                                         NULL);
 
     if (TSS2_RC_SUCCESS != ret)
         return ret;
@@ -157,8 +153,6 @@ create_child(TSS2_SYS_CONTEXT *sapi_ctx,
     sessionsData.auths[0].sessionHandle = TPM2_RS_PW;
     sessionsData.count = 1;
 
-    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
-
     // Nb. No auth set on key
     TPM2B_SENSITIVE_CREATE inSensitive = {};
 
@@ -194,10 +188,6 @@ create_child(TSS2_SYS_CONTEXT *sapi_ctx,
 
     TPML_PCR_SELECTION creationPCR = {};
 
-    TPM2B_CREATION_DATA creationData = {};
-    TPM2B_DIGEST creationHash = {};
-    TPMT_TK_CREATION creationTicket = {};
-
     return Tss2_Sys_Create(sapi_ctx,
                            parent_handle,
                            &sessionsData,
@@ -207,10 +197,10 @@ create_child(TSS2_SYS_CONTEXT *sapi_ctx,
                            &creationPCR,
                            private_key_blob_out,
                            public_key_out,
-                           &creationData,
-                           &creationHash,
-                           &creationTicket,
-                           &sessionsDataOut);
+                           NULL,
+                           NULL,
+                           NULL,
+                           NULL);
 }
 
 TSS2_RC
@@ -224,18 +214,14 @@ load_key(TSS2_SYS_CONTEXT *sapi_ctx,
     sessionsData.auths[0].sessionHandle = TPM2_RS_PW;
     sessionsData.count = 1;
 
-    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
-
-    TPM2B_NAME name = {};
-
     return Tss2_Sys_Load(sapi_ctx,
                          parent_handle,
                          &sessionsData,
                          private_key_blob,
                          public_key,
                          handle_out,
-                         &name,
-                         &sessionsDataOut);
+                         NULL,
+                         NULL);
 }
 
 TSS2_RC
@@ -256,14 +242,52 @@ evict_control(TSS2_SYS_CONTEXT *sapi_ctx,
         memcpy(sessionsData.auths[0].hmac.buffer, hierarchy_password, hierarchy_password_length);
     }
 
-    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
-
     return Tss2_Sys_EvictControl(sapi_ctx,
                                  hierarchy,
                                  current_handle,
                                  &sessionsData,
                                  persistent_handle,
-                                 &sessionsDataOut);
+                                 NULL);
+}
+
+// Password session with empty auth, ECDSA-with-SHA256, and a NULL hash-check ticket.
+static
+void
+init_sign_parameters(TSS2L_SYS_AUTH_COMMAND *sessionsData,
+                     TPMT_SIG_SCHEME *inScheme,
+                     TPMT_TK_HASHCHECK *validation)
+{
+    *sessionsData = (TSS2L_SYS_AUTH_COMMAND){};
+    sessionsData->auths[0].sessionHandle = TPM2_RS_PW;
+    sessionsData->count = 1;
+
+    *inScheme = (TPMT_SIG_SCHEME){};
+    inScheme->scheme = TPM2_ALG_ECDSA;
+    inScheme->details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+
+    // Hash was *not* generated by TPM,
+    // so tell TPM not to check it (i.e. pass a "NULL ticket").
+    *validation = (TPMT_TK_HASHCHECK){};
+    validation->tag = TPM2_ST_HASHCHECK;
+    validation->hierarchy = TPM2_RH_NULL;
+}
+
+// Write the big-endian scalar `in` as XTPM_RAW_SIGNATURE_SIZE/2 bytes, left-padded with zeros.
+static
+TSS2_RC
+write_scalar(const uint8_t *in,
+             uint16_t size,
+             uint8_t *out)
+{
+    const size_t scalar_size = XTPM_RAW_SIGNATURE_SIZE / 2;
+
+    if (size > scalar_size)
+        return TSS2_BASE_RC_BAD_VALUE;
+
+    memset(out, 0, scalar_size - size);
+    memcpy(out + scalar_size - size, in, size);
+
+    return TSS2_RC_SUCCESS;
 }
 
 TSS2_RC
@@ -272,28 +296,289 @@ sign(TSS2_SYS_CONTEXT *sapi_ctx,
      const TPM2B_DIGEST *digest,
      TPMT_SIGNATURE *signature_out)
 {
-    TSS2L_SYS_AUTH_COMMAND sessionsData = {};
-    sessionsData.auths[0].sessionHandle = TPM2_RS_PW;
-    sessionsData.count = 1;
-
-    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
-
-    TPMT_SIG_SCHEME inScheme = {};
-    inScheme.scheme = TPM2_ALG_ECDSA;
-	inScheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+    return sign_with_ticket(sapi_ctx,
+                            key_handle,
+                            digest,
+                            NULL,
+                            signature_out);
+}
 
-    // Hash was *not* generated by TPM,
-    // so tell TPM not to check it (i.e. pass a "NULL ticket").
-    TPMT_TK_HASHCHECK validation = {};
-	validation.tag = TPM2_ST_HASHCHECK;
-	validation.hierarchy = TPM2_RH_NULL;
+TSS2_RC
+sign_with_ticket(TSS2_SYS_CONTEXT *sapi_ctx,
+                 TPM2_HANDLE key_handle,
+                 const TPM2B_DIGEST *digest,
+                 const TPMT_TK_HASHCHECK *validation,
+                 TPMT_SIGNATURE *signature_out)
+{
+    TSS2L_SYS_AUTH_COMMAND sessionsData;
+    TPMT_SIG_SCHEME inScheme;
+    TPMT_TK_HASHCHECK null_ticket;
+    init_sign_parameters(&sessionsData, &inScheme, &null_ticket);
 
     return Tss2_Sys_Sign(sapi_ctx,
                          key_handle,
                          &sessionsData,
                          digest,
                          &inScheme,
-                         &validation,
+                         NULL != validation ? validation : &null_ticket,
                          signature_out,
-                         &sessionsDataOut);
+                         NULL);
+}
+
+TSS2_RC
+sign_raw(TSS2_SYS_CONTEXT *sapi_ctx,
+         TPM2_HANDLE key_handle,
+         const TPM2B_DIGEST *digest,
+         uint8_t *signature_out)
+{
+    TSS2_RC ret;
+
+#ifdef XTPM_BUNDLED_TSS2
+    TSS2L_SYS_AUTH_COMMAND sessionsData;
+    TPMT_SIG_SCHEME inScheme;
+    TPMT_TK_HASHCHECK validation;
+    init_sign_parameters(&sessionsData, &inScheme, &validation);
+
+    // r and s are copied just once, straight out of the response.
+    struct xtpm_signature_view signature;
+    ret = Tss2_Sys_Sign_View(sapi_ctx,
+                             key_handle,
+                             &sessionsData,
+                             digest,
+                             &inScheme,
+                             &validation,
+                             &signature,
+                             NULL);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    const uint8_t *r = signature.r.data;
+    uint16_t r_size = signature.r.size;
+    const uint8_t *s = signature.s.data;
+    uint16_t s_size = signature.s.size;
+#else
+    TPMT_SIGNATURE signature;
+    ret = sign(sapi_ctx, key_handle, digest, &signature);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    const uint8_t *r = signature.signature.ecdsa.signatureR.buffer;
+    uint16_t r_size = signature.signature.ecdsa.signatureR.size;
+    const uint8_t *s = signature.signature.ecdsa.signatureS.buffer;
+    uint16_t s_size = signature.signature.ecdsa.signatureS.size;
+#endif
+
+    ret = write_scalar(r, r_size, signature_out);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    return write_scalar(s, s_size, signature_out + XTPM_RAW_SIGNATURE_SIZE / 2);
+}
+
+TSS2_RC
+gen_key(TSS2_SYS_CONTEXT *sapi_ctx,
+        TPM2_HANDLE parent_handle_in,
+        TPMI_RH_HIERARCHY hierarchy_in,
+        const char *hierarchy_password,
+        size_t hierarchy_password_length,
+        struct xtpm_key *out)
+{
+    TSS2_RC ret;
+
+    TPMI_RH_HIERARCHY hierarchy;
+    if (0 == hierarchy_in) {
+        hierarchy = DEFAULT_HIERARCHY;
+    } else {
+        hierarchy = hierarchy_in;
+    }
+
+    TPM2_HANDLE parent_handle;
+    if (0 == parent_handle_in) {
+        parent_handle = DEFAULT_PARENT_KEY;
+    } else {
+        parent_handle = parent_handle_in;
+    }
+
+    if (TSS2_RC_SUCCESS != check_parent(sapi_ctx, parent_handle)) {
+        ret = create_primary(sapi_ctx,
+                             hierarchy,
+                             parent_handle,
+                             hierarchy_password,
+                             hierarchy_password_length);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+    }
+
+    out->parent_handle = parent_handle;
+    return create_child(sapi_ctx,
+                        parent_handle,
+                        &out->public_key,
+                        &out->private_key_blob);
+}
+
+// Load `key`, sign `digest` with it into whichever of the outputs is set, and flush it.
+static
+TSS2_RC
+load_sign_flush(TSS2_SYS_CONTEXT *sapi_ctx,
+                const struct xtpm_key *key,
+                const TPM2B_DIGEST *digest,
+                TPMT_SIGNATURE *signature_out,
+                uint8_t *raw_signature_out)
+{
+    TPM2_HANDLE loaded_key;
+    TSS2_RC ret = load_key(sapi_ctx,
+                           key->parent_handle,
+                           &key->public_key,
+                           &key->private_key_blob,
+                           &loaded_key);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    if (NULL != signature_out) {
+        ret = sign(sapi_ctx,
+                   loaded_key,
+                   digest,
+                   signature_out);
+    } else {
+        ret = sign_raw(sapi_ctx,
+                       loaded_key,
+                       digest,
+                       raw_signature_out);
+    }
+
+    // Report a failure to sign over a failure to flush.
+    TSS2_RC flush_ret = Tss2_Sys_FlushContext(sapi_ctx,
+                                              loaded_key);
+    if (TSS2_RC_SUCCESS == ret)
+        ret = flush_ret;
+
+    return ret;
+}
+
+TSS2_RC
+sign_with_key(TSS2_SYS_CONTEXT *sapi_ctx,
+              const struct xtpm_key *key,
+              const TPM2B_DIGEST *digest,
+              TPMT_SIGNATURE *signature_out)
+{
+    return load_sign_flush(sapi_ctx,
+                           key,
+                           digest,
+                           signature_out,
+                           NULL);
+}
+
+TSS2_RC
+sign_raw_with_key(TSS2_SYS_CONTEXT *sapi_ctx,
+                  const struct xtpm_key *key,
+                  const TPM2B_DIGEST *digest,
+                  uint8_t *signature_out)
+{
+    return load_sign_flush(sapi_ctx,
+                           key,
+                           digest,
+                           NULL,
+                           signature_out);
+}
+
+// Sign the SHA-256 digest of each message with `key_handle`, as `sign_messages_with_key`.
+static
+TSS2_RC
+sign_messages(TSS2_SYS_CONTEXT *sapi_ctx,
+              TPM2_HANDLE key_handle,
+              const uint8_t *const *messages,
+              const size_t *lengths,
+              size_t count,
+              TPMT_SIGNATURE *signatures_out)
+{
+    TSS2_RC ret;
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData;
+    TPMT_SIG_SCHEME inScheme;
+    TPMT_TK_HASHCHECK validation;
+    init_sign_parameters(&sessionsData, &inScheme, &validation);
+
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut;
+    sessionsDataOut.count = 1;
+
+    // A ring of digests, SHA256_LANES ahead of the signing: the first messages
+    // are hashed together, and each later one while the TPM signs an earlier one.
+    uint8_t digests[SHA256_LANES][SHA256_DIGEST_SIZE];
+    sha256_many(messages, lengths, count < SHA256_LANES ? count : SHA256_LANES, digests);
+
+    TPM2B_DIGEST digest = {.size = SHA256_DIGEST_SIZE};
+    for (size_t i = 0; i < count; i++) {
+        memcpy(digest.buffer, digests[i % SHA256_LANES], SHA256_DIGEST_SIZE);
+
+        ret = Tss2_Sys_Sign_Prepare(sapi_ctx,
+                                    key_handle,
+                                    &digest,
+                                    &inScheme,
+                                    &validation);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        ret = Tss2_Sys_SetCmdAuths(sapi_ctx, &sessionsData);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        ret = Tss2_Sys_ExecuteAsync(sapi_ctx);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        // This digest is now in the command buffer, so its slot takes the next one.
+        size_t next = i + SHA256_LANES;
+        if (next < count)
+            sha256(messages[next], lengths[next], digests[i % SHA256_LANES]);
+
+        ret = Tss2_Sys_ExecuteFinish(sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        ret = Tss2_Sys_GetRspAuths(sapi_ctx, &sessionsDataOut);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        ret = Tss2_Sys_Sign_Complete(sapi_ctx, &signatures_out[i]);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+sign_messages_with_key(TSS2_SYS_CONTEXT *sapi_ctx,
+                       const struct xtpm_key *key,
+                       const uint8_t *const *messages,
+                       const size_t *lengths,
+                       size_t count,
+                       TPMT_SIGNATURE *signatures_out)
+{
+    if (0 == count)
+        return TSS2_RC_SUCCESS;
+
+    TPM2_HANDLE loaded_key;
+    TSS2_RC ret = load_key(sapi_ctx,
+                           key->parent_handle,
+                           &key->public_key,
+                           &key->private_key_blob,
+                           &loaded_key);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    ret = sign_messages(sapi_ctx,
+                        loaded_key,
+                        messages,
+                        lengths,
+                        count,
+                        signatures_out);
+
+    // Report a failure to sign over a failure to flush.
+    TSS2_RC flush_ret = Tss2_Sys_FlushContext(sapi_ctx,
+                                              loaded_key);
+    if (TSS2_RC_SUCCESS == ret)
+        ret = flush_ret;
+
+    return ret;
 }
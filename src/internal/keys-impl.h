@@ -20,6 +20,8 @@
 #define XAPTUM_TPM_INTERNAL_KEYSIMPL_H
 #pragma once
 
+#include <xaptum-tpm/keys.h>
+
 #include <tss2/tss2_tcti.h>
 #include <tss2/tss2_sys.h>
 
@@ -106,6 +108,74 @@ sign(TSS2_SYS_CONTEXT *sapi_ctx,
      const TPM2B_DIGEST *digest,
      TPMT_SIGNATURE *signature_out);
 
+/*
+ * As `sign`, but with the hashcheck ticket `validation` for `digest`
+ * (from SequenceComplete), as a restricted key needs.
+ *
+ * If `validation` is NULL, a NULL ticket is passed, as by `sign`.
+ */
+TSS2_RC
+sign_with_ticket(TSS2_SYS_CONTEXT *sapi_ctx,
+                 TPM2_HANDLE key_handle,
+                 const TPM2B_DIGEST *digest,
+                 const TPMT_TK_HASHCHECK *validation,
+                 TPMT_SIGNATURE *signature_out);
+
+/*
+ * As `sign`, but write the signature as r || s to the
+ * `XTPM_RAW_SIGNATURE_SIZE` bytes at `signature_out`.
+ */
+TSS2_RC
+sign_raw(TSS2_SYS_CONTEXT *sapi_ctx,
+         TPM2_HANDLE key_handle,
+         const TPM2B_DIGEST *digest,
+         uint8_t *signature_out);
+
+/*
+ * Create a new child key, as `xtpm_gen_key` (including its defaults).
+ */
+TSS2_RC
+gen_key(TSS2_SYS_CONTEXT *sapi_ctx,
+        TPM2_HANDLE parent_handle,
+        TPMI_RH_HIERARCHY hierarchy,
+        const char *hierarchy_password,
+        size_t hierarchy_password_length,
+        struct xtpm_key *out);
+
+/*
+ * Load `key`, sign `digest` with it, and flush it again.
+ */
+TSS2_RC
+sign_with_key(TSS2_SYS_CONTEXT *sapi_ctx,
+              const struct xtpm_key *key,
+              const TPM2B_DIGEST *digest,
+              TPMT_SIGNATURE *signature_out);
+
+/*
+ * Load `key`, sign `digest` with it as `sign_raw`, and flush it again.
+ */
+TSS2_RC
+sign_raw_with_key(TSS2_SYS_CONTEXT *sapi_ctx,
+                  const struct xtpm_key *key,
+                  const TPM2B_DIGEST *digest,
+                  uint8_t *signature_out);
+
+/*
+ * Load `key`, sign the SHA-256 digest of each of the `count` messages with it
+ * into the corresponding `signatures_out`, and flush it.
+ *
+ * The first SHA256_LANES messages are hashed at once; after that, each
+ * ExecuteAsync is followed by hashing the message SHA256_LANES ahead,
+ * while the TPM signs.
+ */
+TSS2_RC
+sign_messages_with_key(TSS2_SYS_CONTEXT *sapi_ctx,
+                       const struct xtpm_key *key,
+                       const uint8_t *const *messages,
+                       const size_t *lengths,
+                       size_t count,
+                       TPMT_SIGNATURE *signatures_out);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,171 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include "nvram-impl.h"
+
+#include <string.h>
+
+TSS2_RC
+set_password_auth(TSS2L_SYS_AUTH_COMMAND *sessionsData,
+                  const char *password,
+                  size_t password_length)
+{
+    memset(sessionsData, 0, sizeof(TSS2L_SYS_AUTH_COMMAND));
+    sessionsData->auths[0].sessionHandle = TPM2_RS_PW;
+    sessionsData->count = 1;
+
+    if (0 != password_length) {
+        if (password_length > sizeof(sessionsData->auths[0].hmac.buffer))
+            return TSS2_BASE_RC_INSUFFICIENT_BUFFER;
+        sessionsData->auths[0].hmac.size = password_length;
+        memcpy(sessionsData->auths[0].hmac.buffer, password, password_length);
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+int
+read_from_memory(unsigned char *buf,
+                 uint16_t length,
+                 void *user_data)
+{
+    struct memory_source *source = user_data;
+
+    memcpy(buf, source->next, length);
+    source->next += length;
+
+    return 0;
+}
+
+TSS2_RC
+write_nvram(TSS2_SYS_CONTEXT *sapi_ctx,
+            TPMI_RH_NV_AUTH auth_handle,
+            TPMI_RH_NV_INDEX index,
+            const TSS2L_SYS_AUTH_COMMAND *sessionsData,
+            xtpm_nvram_read_fn read_fn,
+            void *user_data,
+            uint16_t size)
+{
+    TSS2_RC ret = TSS2_RC_SUCCESS;
+
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut;
+    sessionsDataOut.count = 1;
+
+    TPM2B_MAX_NV_BUFFER chunk = {.size = 0};
+
+    uint16_t data_offset = 0;
+    uint16_t bytes_left = size;
+
+    if (bytes_left > 0) {
+        chunk.size = bytes_left < sizeof(chunk.buffer) ? bytes_left : sizeof(chunk.buffer);
+        if (0 != read_fn(chunk.buffer, chunk.size, user_data))
+            return TSS2_BASE_RC_IO_ERROR;
+    }
+
+    while (bytes_left > 0) {
+        ret = Tss2_Sys_NV_Write_Prepare(sapi_ctx,
+                                        auth_handle,
+                                        index,
+                                        &chunk,
+                                        data_offset);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        ret = Tss2_Sys_SetCmdAuths(sapi_ctx, sessionsData);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        ret = Tss2_Sys_ExecuteAsync(sapi_ctx);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        data_offset += chunk.size;
+        bytes_left -= chunk.size;
+
+        // The command is now out of the SAPI buffer,
+        // so fetch the next chunk while the TPM works on this one.
+        TSS2_RC read_ret = TSS2_RC_SUCCESS;
+        if (bytes_left > 0) {
+            chunk.size = bytes_left < sizeof(chunk.buffer) ? bytes_left : sizeof(chunk.buffer);
+            if (0 != read_fn(chunk.buffer, chunk.size, user_data))
+                read_ret = TSS2_BASE_RC_IO_ERROR;
+        }
+
+        ret = Tss2_Sys_ExecuteFinish(sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        ret = Tss2_Sys_GetRspAuths(sapi_ctx, &sessionsDataOut);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        ret = Tss2_Sys_NV_Write_Complete(sapi_ctx);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        if (TSS2_RC_SUCCESS != read_ret)
+            return read_ret;
+    }
+
+    return ret;
+}
+
+TSS2_RC
+compare_nvram(TSS2_SYS_CONTEXT *sapi_ctx,
+              TPMI_RH_NV_AUTH auth_handle,
+              TPMI_RH_NV_INDEX index,
+              const TSS2L_SYS_AUTH_COMMAND *sessionsData,
+              const unsigned char *expected,
+              uint16_t size,
+              int *matches_out)
+{
+    *matches_out = 0;
+
+    uint16_t data_offset = 0;
+
+    while (data_offset < size) {
+        uint16_t bytes_left = size - data_offset;
+        uint16_t bytes_to_read = bytes_left < TPM2_MAX_NV_BUFFER_SIZE ? bytes_left : TPM2_MAX_NV_BUFFER_SIZE;
+
+        TPM2B_MAX_NV_BUFFER nv_data = {.size=0};
+
+        TSS2_RC ret = Tss2_Sys_NV_Read(sapi_ctx,
+                                       auth_handle,
+                                       index,
+                                       sessionsData,
+                                       bytes_to_read,
+                                       data_offset,
+                                       &nv_data,
+                                       NULL);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        if (0 == nv_data.size || nv_data.size > bytes_to_read)
+            return TSS2_BASE_RC_MALFORMED_RESPONSE;
+
+        // Stop at the first differing chunk: the rest will be rewritten anyway.
+        if (0 != memcmp(expected + data_offset, nv_data.buffer, nv_data.size))
+            return TSS2_RC_SUCCESS;
+
+        data_offset += nv_data.size;
+    }
+
+    *matches_out = 1;
+
+    return TSS2_RC_SUCCESS;
+}
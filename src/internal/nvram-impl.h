@@ -0,0 +1,87 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TPM_INTERNAL_NVRAMIMPL_H
+#define XAPTUM_TPM_INTERNAL_NVRAMIMPL_H
+#pragma once
+
+#include <xaptum-tpm/nvram.h>
+
+#include <tss2/tss2_sys.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fill `sessionsData` with a single password authorization.
+ *
+ * An empty password is used if `password_length` is 0.
+ */
+TSS2_RC
+set_password_auth(TSS2L_SYS_AUTH_COMMAND *sessionsData,
+                  const char *password,
+                  size_t password_length);
+
+/*
+ * `xtpm_nvram_read_fn` source that copies sequentially out of a buffer.
+ */
+struct memory_source {
+    const unsigned char *next;
+};
+
+int
+read_from_memory(unsigned char *buf,
+                 uint16_t length,
+                 void *user_data);
+
+/*
+ * Write `size` bytes, pulled from `read_fn`, to the start of NV `index`.
+ *
+ * Each chunk is at most TPM2_MAX_NV_BUFFER_SIZE bytes,
+ * and the next chunk is read while the TPM processes the previous one.
+ */
+TSS2_RC
+write_nvram(TSS2_SYS_CONTEXT *sapi_ctx,
+            TPMI_RH_NV_AUTH auth_handle,
+            TPMI_RH_NV_INDEX index,
+            const TSS2L_SYS_AUTH_COMMAND *sessionsData,
+            xtpm_nvram_read_fn read_fn,
+            void *user_data,
+            uint16_t size);
+
+/*
+ * Check whether the first `size` bytes of NV `index` equal `expected`.
+ *
+ * `*matches_out` is set to 1 if so, or 0 if not.
+ * Reading stops at the first differing chunk.
+ */
+TSS2_RC
+compare_nvram(TSS2_SYS_CONTEXT *sapi_ctx,
+              TPMI_RH_NV_AUTH auth_handle,
+              TPMI_RH_NV_INDEX index,
+              const TSS2L_SYS_AUTH_COMMAND *sessionsData,
+              const unsigned char *expected,
+              uint16_t size,
+              int *matches_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,622 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include "sha256.h"
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHA256_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static const uint32_t K[64] __attribute__((aligned(32))) = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static inline
+uint32_t
+load_be32(const uint8_t *in)
+{
+    return ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) | ((uint32_t)in[2] << 8) | in[3];
+}
+
+static inline
+void
+store_be32(uint32_t value,
+           uint8_t *out)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
+
+/*
+ * Portable C
+ */
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static
+void
+blocks_generic(uint32_t state[8],
+               const uint8_t *data,
+               size_t block_count)
+{
+    for (; block_count > 0; block_count--, data += SHA256_BLOCK_SIZE) {
+        uint32_t w[64];
+        for (int t = 0; t < 16; t++)
+            w[t] = load_be32(data + 4 * t);
+        for (int t = 16; t < 64; t++) {
+            uint32_t s0 = ROTR(w[t - 15], 7) ^ ROTR(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            uint32_t s1 = ROTR(w[t - 2], 17) ^ ROTR(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int t = 0; t < 64; t++) {
+            uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[t] + w[t];
+            uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#ifdef SHA256_X86
+/*
+ * x86 SHA extensions
+ */
+
+__attribute__((target("sha,sse4.1")))
+static
+void
+blocks_shani(uint32_t state[8],
+             const uint8_t *data,
+             size_t block_count)
+{
+    const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bull, 0x0405060700010203ull);
+
+    // The instructions want the state as ABEF and CDGH.
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);     // CDAB
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);  // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);                                      // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);                                           // CDGH
+
+    for (; block_count > 0; block_count--, data += SHA256_BLOCK_SIZE) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+
+        // Message words 4i..4i+3, for the last 4 groups
+        __m128i w[4];
+
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++) {
+            if (i < 4) {
+                w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), byte_swap);
+            } else {
+                __m128i next = _mm_sha256msg1_epu32(w[i % 4], w[(i + 1) % 4]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(i + 3) % 4], w[(i + 2) % 4], 4));
+                w[i % 4] = _mm_sha256msg2_epu32(next, w[(i + 3) % 4]);
+            }
+
+            __m128i msg = _mm_add_epi32(w[i % 4], _mm_load_si128((const __m128i*)&K[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);          // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);       // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);    // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);       // HGFE
+
+    _mm_storeu_si128((__m128i*)&state[0], state0);
+    _mm_storeu_si128((__m128i*)&state[4], state1);
+}
+
+/*
+ * AVX2, SHA256_LANES independent messages at once
+ *
+ * The work is split into small functions (inlined when optimizing),
+ * to keep the stack frames small in unoptimized builds.
+ */
+
+__attribute__((target("avx2")))
+static inline
+__m256i
+rotr_x8(__m256i x,
+        int n)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - n));
+}
+
+// ROTR(x, a) ^ ROTR(x, b) ^ ROTR(x, c)
+__attribute__((target("avx2")))
+static inline
+__m256i
+big_sigma_x8(__m256i x,
+             int a,
+             int b,
+             int c)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(rotr_x8(x, a), rotr_x8(x, b)), rotr_x8(x, c));
+}
+
+// ROTR(x, a) ^ ROTR(x, b) ^ (x >> shift)
+__attribute__((target("avx2")))
+static inline
+__m256i
+small_sigma_x8(__m256i x,
+               int a,
+               int b,
+               int shift)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(rotr_x8(x, a), rotr_x8(x, b)), _mm256_srli_epi32(x, shift));
+}
+
+// Interleave the words of row pairs (step = 1) or word pairs of row pairs (step = 2),
+// the first two steps of a transpose.
+__attribute__((target("avx2")))
+static
+void
+interleave_x8(__m256i r[8],
+              int step)
+{
+    for (int i = 0; i < 8; i += 4) {
+        __m256i lo0, hi0, lo1, hi1;
+        if (1 == step) {
+            lo0 = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+            hi0 = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+            lo1 = _mm256_unpacklo_epi32(r[i + 2], r[i + 3]);
+            hi1 = _mm256_unpackhi_epi32(r[i + 2], r[i + 3]);
+        } else {
+            lo0 = _mm256_unpacklo_epi64(r[i], r[i + 2]);
+            hi0 = _mm256_unpackhi_epi64(r[i], r[i + 2]);
+            lo1 = _mm256_unpacklo_epi64(r[i + 1], r[i + 3]);
+            hi1 = _mm256_unpackhi_epi64(r[i + 1], r[i + 3]);
+        }
+        r[i] = lo0;
+        r[i + 1] = hi0;
+        r[i + 2] = lo1;
+        r[i + 3] = hi1;
+    }
+}
+
+// Load 8 words from each lane's block, starting at `offset`, as 8 vectors of one word each,
+// in host byte order.
+__attribute__((target("avx2")))
+static
+void
+load_words_x8(__m256i w[8],
+              const uint8_t *const blocks[SHA256_LANES],
+              size_t offset)
+{
+    const __m256i byte_swap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                              12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+
+    for (int lane = 0; lane < SHA256_LANES; lane++)
+        w[lane] = _mm256_loadu_si256((const __m256i*)(blocks[lane] + offset));
+
+    // Then, for i < 4, w[i] holds word i of lanes 0..3 in its low half and word i + 4
+    // in its high half, and w[i + 4] the same for lanes 4..7.
+    interleave_x8(w, 1);
+    interleave_x8(w, 2);
+
+    __m256i rows[8];
+    for (int i = 0; i < 4; i++) {
+        rows[i] = _mm256_permute2x128_si256(w[i], w[i + 4], 0x20);
+        rows[i + 4] = _mm256_permute2x128_si256(w[i], w[i + 4], 0x31);
+    }
+
+    for (int i = 0; i < 8; i++)
+        w[i] = _mm256_shuffle_epi8(rows[i], byte_swap);
+}
+
+// One round, with `s` holding a..h
+__attribute__((target("avx2")))
+static inline
+void
+round_x8(__m256i s[8],
+         __m256i k_plus_w)
+{
+    __m256i ch = _mm256_xor_si256(_mm256_and_si256(s[4], s[5]), _mm256_andnot_si256(s[4], s[6]));
+    __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(s[7], big_sigma_x8(s[4], 6, 11, 25)),
+                                  _mm256_add_epi32(ch, k_plus_w));
+
+    __m256i maj = _mm256_or_si256(_mm256_and_si256(s[0], s[1]), _mm256_and_si256(s[2], _mm256_or_si256(s[0], s[1])));
+    __m256i t2 = _mm256_add_epi32(big_sigma_x8(s[0], 2, 13, 22), maj);
+
+    s[7] = s[6];
+    s[6] = s[5];
+    s[5] = s[4];
+    s[4] = _mm256_add_epi32(s[3], t1);
+    s[3] = s[2];
+    s[2] = s[1];
+    s[1] = s[0];
+    s[0] = _mm256_add_epi32(t1, t2);
+}
+
+// Hash one block per lane: `state[i]` holds word i of each lane's state.
+__attribute__((target("avx2")))
+static
+void
+block_x8_avx2(uint32_t state[8][SHA256_LANES],
+              const uint8_t *const blocks[SHA256_LANES])
+{
+    __m256i w[16];
+    load_words_x8(&w[0], blocks, 0);
+    load_words_x8(&w[8], blocks, 32);
+
+    __m256i s[8];
+    for (int i = 0; i < 8; i++)
+        s[i] = _mm256_loadu_si256((const __m256i*)state[i]);
+
+    for (int t = 0; t < 64; t++) {
+        if (t >= 16) {
+            __m256i sum = _mm256_add_epi32(small_sigma_x8(w[(t - 15) & 15], 7, 18, 3),
+                                           small_sigma_x8(w[(t - 2) & 15], 17, 19, 10));
+            w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], w[(t - 7) & 15]), sum);
+        }
+
+        round_x8(s, _mm256_add_epi32(_mm256_set1_epi32(K[t]), w[t & 15]));
+    }
+
+    for (int i = 0; i < 8; i++) {
+        __m256i *out = (__m256i*)state[i];
+        _mm256_storeu_si256(out, _mm256_add_epi32(s[i], _mm256_loadu_si256(out)));
+    }
+}
+
+#define CPU_CHECKED 0x1
+#define CPU_SHANI   0x2
+#define CPU_AVX2    0x4
+
+static
+int
+cpu_features(void)
+{
+    static int features = 0;
+
+    int cached = __atomic_load_n(&features, __ATOMIC_RELAXED);
+    if (cached)
+        return cached;
+
+    int found = CPU_CHECKED;
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        int sse41 = (ecx & bit_SSE4_1) != 0;
+        int osxsave = (ecx & bit_OSXSAVE) != 0;
+
+        // AVX state must also be enabled by the OS.
+        int avx_enabled = 0;
+        if (osxsave && (ecx & bit_AVX)) {
+            uint32_t xcr0_lo, xcr0_hi;
+            __asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+            avx_enabled = (xcr0_lo & 0x6) == 0x6;
+        }
+
+        if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+            if (sse41 && (ebx & bit_SHA))
+                found |= CPU_SHANI;
+            if (avx_enabled && (ebx & bit_AVX2))
+                found |= CPU_AVX2;
+        }
+    }
+
+    __atomic_store_n(&features, found, __ATOMIC_RELAXED);
+    return found;
+}
+#endif
+
+int
+sha256_impl_supported(enum sha256_impl impl)
+{
+    switch (impl) {
+        case SHA256_IMPL_AUTO:
+        case SHA256_IMPL_GENERIC:
+            return 1;
+#ifdef SHA256_X86
+        case SHA256_IMPL_SHANI:
+            return (cpu_features() & CPU_SHANI) != 0;
+        case SHA256_IMPL_AVX2:
+            return (cpu_features() & CPU_AVX2) != 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+// The one-message-at-a-time implementation for `impl`
+static
+void
+blocks_impl(enum sha256_impl impl,
+            uint32_t state[8],
+            const uint8_t *data,
+            size_t block_count)
+{
+#ifdef SHA256_X86
+    if (SHA256_IMPL_SHANI == impl || (SHA256_IMPL_AUTO == impl && (cpu_features() & CPU_SHANI))) {
+        blocks_shani(state, data, block_count);
+        return;
+    }
+#else
+    (void)impl;
+#endif
+    blocks_generic(state, data, block_count);
+}
+
+void
+sha256_init_state(uint32_t state[8])
+{
+    memcpy(state, IV, sizeof(IV));
+}
+
+void
+sha256_blocks(uint32_t state[8],
+              const uint8_t *data,
+              size_t block_count)
+{
+    blocks_impl(SHA256_IMPL_AUTO, state, data, block_count);
+}
+
+// Write the padding for a message of `total_length` bytes ending in the `tail_length`
+// bytes at `tail`, into `out` (room for two blocks). Returns the number of blocks.
+static
+size_t
+pad(uint64_t total_length,
+    const uint8_t *tail,
+    size_t tail_length,
+    uint8_t *out)
+{
+    size_t block_count = (tail_length + 1 + 8 > SHA256_BLOCK_SIZE) ? 2 : 1;
+
+    memcpy(out, tail, tail_length);
+    out[tail_length] = 0x80;
+    memset(out + tail_length + 1, 0, block_count * SHA256_BLOCK_SIZE - tail_length - 1 - 8);
+
+    uint64_t bit_length = total_length * 8;
+    uint8_t *length_out = out + block_count * SHA256_BLOCK_SIZE - 8;
+    store_be32(bit_length >> 32, length_out);
+    store_be32((uint32_t)bit_length, length_out + 4);
+
+    return block_count;
+}
+
+static
+void
+finish_impl(enum sha256_impl impl,
+            uint32_t state[8],
+            uint64_t total_length,
+            const uint8_t *tail,
+            size_t tail_length,
+            uint8_t *digest_out)
+{
+    uint8_t last[2 * SHA256_BLOCK_SIZE];
+    size_t block_count = pad(total_length, tail, tail_length, last);
+
+    blocks_impl(impl, state, last, block_count);
+
+    for (int i = 0; i < 8; i++)
+        store_be32(state[i], digest_out + 4 * i);
+}
+
+void
+sha256_finish(uint32_t state[8],
+              uint64_t total_length,
+              const uint8_t *tail,
+              size_t tail_length,
+              uint8_t *digest_out)
+{
+    finish_impl(SHA256_IMPL_AUTO, state, total_length, tail, tail_length, digest_out);
+}
+
+static
+void
+digest_impl(enum sha256_impl impl,
+            const uint8_t *data,
+            size_t length,
+            uint8_t *digest_out)
+{
+    uint32_t state[8];
+    sha256_init_state(state);
+
+    size_t block_count = length / SHA256_BLOCK_SIZE;
+    blocks_impl(impl, state, data, block_count);
+
+    size_t done = block_count * SHA256_BLOCK_SIZE;
+    finish_impl(impl, state, length, data + done, length - done, digest_out);
+}
+
+void
+sha256(const uint8_t *data,
+       size_t length,
+       uint8_t *digest_out)
+{
+    digest_impl(SHA256_IMPL_AUTO, data, length, digest_out);
+}
+
+#ifdef SHA256_X86
+struct lane {
+    const uint8_t *message;
+    size_t length;
+    size_t index;           // of the message, in the caller's arrays
+    size_t block;           // next one to hash
+    size_t full_blocks;     // of the message itself, before the padding
+    size_t block_count;     // including the padding
+};
+
+// Write the lane's next block, one of the (one or two) with the padding, to `out`.
+static
+void
+padding_block(const struct lane *lane,
+              uint8_t *out)
+{
+    size_t tail_length = lane->length - lane->full_blocks * SHA256_BLOCK_SIZE;
+    size_t start = (lane->block - lane->full_blocks) * SHA256_BLOCK_SIZE;  // in the padded tail
+
+    memset(out, 0, SHA256_BLOCK_SIZE);
+    if (start < tail_length)
+        memcpy(out, lane->message + lane->full_blocks * SHA256_BLOCK_SIZE + start, tail_length - start);
+    if (tail_length >= start && tail_length < start + SHA256_BLOCK_SIZE)
+        out[tail_length - start] = 0x80;
+
+    if (lane->block + 1 == lane->block_count) {
+        uint64_t bit_length = (uint64_t)lane->length * 8;
+        store_be32(bit_length >> 32, out + SHA256_BLOCK_SIZE - 8);
+        store_be32((uint32_t)bit_length, out + SHA256_BLOCK_SIZE - 4);
+    }
+}
+
+static
+void
+many_avx2(const uint8_t *const *messages,
+          const size_t *lengths,
+          size_t count,
+          uint8_t (*digests_out)[SHA256_DIGEST_SIZE])
+{
+    static const uint8_t idle_block[SHA256_BLOCK_SIZE] = {0};
+
+    struct lane lanes[SHA256_LANES];
+    uint8_t padding[SHA256_LANES][SHA256_BLOCK_SIZE];
+    int active[SHA256_LANES] = {0};
+    uint32_t state[8][SHA256_LANES];
+    size_t next_message = 0;
+
+    for (;;) {
+        int active_count = 0;
+        const uint8_t *blocks[SHA256_LANES];
+
+        for (int i = 0; i < SHA256_LANES; i++) {
+            // A lane that finished its message takes the next one.
+            if (!active[i] && next_message < count) {
+                struct lane *lane = &lanes[i];
+                lane->message = messages[next_message];
+                lane->length = lengths[next_message];
+                lane->index = next_message;
+                lane->block = 0;
+                lane->full_blocks = lane->length / SHA256_BLOCK_SIZE;
+
+                // The 0x80 byte and the 8-byte length may need a second block.
+                size_t tail_length = lane->length % SHA256_BLOCK_SIZE;
+                lane->block_count = lane->full_blocks + ((tail_length + 1 + 8 > SHA256_BLOCK_SIZE) ? 2 : 1);
+
+                for (int word = 0; word < 8; word++)
+                    state[word][i] = IV[word];
+
+                active[i] = 1;
+                next_message++;
+            }
+
+            if (active[i]) {
+                struct lane *lane = &lanes[i];
+                if (lane->block < lane->full_blocks) {
+                    blocks[i] = lane->message + lane->block * SHA256_BLOCK_SIZE;
+                } else {
+                    padding_block(lane, padding[i]);
+                    blocks[i] = padding[i];
+                }
+                active_count++;
+            } else {
+                blocks[i] = idle_block;
+            }
+        }
+
+        if (0 == active_count)
+            break;
+
+        block_x8_avx2(state, blocks);
+
+        for (int i = 0; i < SHA256_LANES; i++) {
+            if (!active[i])
+                continue;
+
+            struct lane *lane = &lanes[i];
+            lane->block++;
+            if (lane->block == lane->block_count) {
+                for (int word = 0; word < 8; word++)
+                    store_be32(state[word][i], digests_out[lane->index] + 4 * word);
+                active[i] = 0;
+            }
+        }
+    }
+}
+#endif
+
+void
+sha256_many_impl(enum sha256_impl impl,
+                 const uint8_t *const *messages,
+                 const size_t *lengths,
+                 size_t count,
+                 uint8_t (*digests_out)[SHA256_DIGEST_SIZE])
+{
+#ifdef SHA256_X86
+    // The SHA extensions beat AVX2 lanes, so only use those without them.
+    if (SHA256_IMPL_AUTO == impl && count > 1 && (cpu_features() & (CPU_SHANI | CPU_AVX2)) == CPU_AVX2)
+        impl = SHA256_IMPL_AVX2;
+
+    if (SHA256_IMPL_AVX2 == impl) {
+        many_avx2(messages, lengths, count, digests_out);
+        return;
+    }
+#endif
+
+    for (size_t i = 0; i < count; i++)
+        digest_impl(impl, messages[i], lengths[i], digests_out[i]);
+}
+
+void
+sha256_many(const uint8_t *const *messages,
+            const size_t *lengths,
+            size_t count,
+            uint8_t (*digests_out)[SHA256_DIGEST_SIZE])
+{
+    sha256_many_impl(SHA256_IMPL_AUTO, messages, lengths, count, digests_out);
+}
@@ -0,0 +1,112 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TPM_INTERNAL_SHA256_H
+#define XAPTUM_TPM_INTERNAL_SHA256_H
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+
+/*
+ * Number of messages `sha256_many` hashes at once with AVX2.
+ */
+#define SHA256_LANES 8
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum sha256_impl {
+    SHA256_IMPL_AUTO,       // the fastest this CPU has
+    SHA256_IMPL_GENERIC,    // portable C
+    SHA256_IMPL_SHANI,      // x86 SHA extensions, one message at a time
+    SHA256_IMPL_AVX2,       // AVX2, SHA256_LANES messages at a time
+};
+
+/*
+ * Returns non-zero if this CPU (and build) supports `impl`.
+ */
+int
+sha256_impl_supported(enum sha256_impl impl);
+
+/*
+ * Set `state` to the SHA-256 initial hash value.
+ */
+void
+sha256_init_state(uint32_t state[8]);
+
+/*
+ * Hash `block_count` whole blocks from `data` into `state`.
+ */
+void
+sha256_blocks(uint32_t state[8],
+              const uint8_t *data,
+              size_t block_count);
+
+/*
+ * Pad and hash the last `tail_length` (< SHA256_BLOCK_SIZE) bytes of a message
+ * of `total_length` bytes into `state`, and write the digest to `digest_out`.
+ */
+void
+sha256_finish(uint32_t state[8],
+              uint64_t total_length,
+              const uint8_t *tail,
+              size_t tail_length,
+              uint8_t *digest_out);
+
+/*
+ * Hash the `length` bytes at `data` into `digest_out`.
+ */
+void
+sha256(const uint8_t *data,
+       size_t length,
+       uint8_t *digest_out);
+
+/*
+ * Hash each of the `count` messages, into the corresponding `digests_out`.
+ *
+ * With AVX2 (and no SHA extensions, which are faster still),
+ * SHA256_LANES messages are hashed at once, each lane taking the next message
+ * as soon as it finishes one.
+ */
+void
+sha256_many(const uint8_t *const *messages,
+            const size_t *lengths,
+            size_t count,
+            uint8_t (*digests_out)[SHA256_DIGEST_SIZE]);
+
+/*
+ * As `sha256_many`, but with the given implementation (which must be supported),
+ * for tests and benchmarks.
+ */
+void
+sha256_many_impl(enum sha256_impl impl,
+                 const uint8_t *const *messages,
+                 const size_t *lengths,
+                 size_t count,
+                 uint8_t (*digests_out)[SHA256_DIGEST_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
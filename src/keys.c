@@ -16,19 +16,22 @@
  *
  *****************************************************************************/
 
-#include "internal/asn1.h"
 #include "internal/keys-impl.h"
+#include "internal/sha256.h"
+#ifndef XTPM_NO_HEAP
+#include "internal/asn1.h"
 #include "internal/pem.h"
 #include "internal/sapi.h"
+#endif
 
 #include <xaptum-tpm/keys.h>
 
+#ifndef XTPM_NO_HEAP
 #include <stdlib.h>
+#endif
 #include <string.h>
 
-#define DEFAULT_PARENT_KEY 0x81000001
-#define DEFAULT_HIERARCHY TPM2_RH_OWNER
-
+#ifndef XTPM_NO_HEAP
 TSS2_RC
 xtpm_gen_key(TSS2_TCTI_CONTEXT *tcti_ctx,
              TPM2_HANDLE parent_handle_in,
@@ -41,42 +44,17 @@ xtpm_gen_key(TSS2_TCTI_CONTEXT *tcti_ctx,
 
     TSS2_RC ret;
 
-    TPMI_RH_HIERARCHY hierarchy;
-    if (0 == hierarchy_in) {
-        hierarchy = DEFAULT_HIERARCHY;
-    } else {
-        hierarchy = hierarchy_in;
-    }
-
-    TPM2_HANDLE parent_handle;
-    if (0 == parent_handle_in) {
-        parent_handle = DEFAULT_PARENT_KEY;
-    } else {
-        parent_handle = parent_handle_in;
-    }
-
     TSS2_SYS_CONTEXT *sapi_ctx = NULL;
     ret = init_sapi(&sapi_ctx, tcti_ctx);
     if (TSS2_RC_SUCCESS != ret)
         goto finish;
 
-    if (TSS2_RC_SUCCESS != check_parent(sapi_ctx, parent_handle)) {
-        ret = create_primary(sapi_ctx,
-                             hierarchy,
-                             parent_handle,
-                             hierarchy_password,
-                             hierarchy_password_length);
-        if (TSS2_RC_SUCCESS != ret)
-            goto finish;
-    }
-
-    out->parent_handle = parent_handle;
-    ret = create_child(sapi_ctx,
-                       parent_handle,
-                       &out->public_key,
-                       &out->private_key_blob);
-    if (TSS2_RC_SUCCESS != ret)
-        goto finish;
+    ret = xtpm_gen_key_sapi(sapi_ctx,
+                            parent_handle_in,
+                            hierarchy_in,
+                            hierarchy_password,
+                            hierarchy_password_length,
+                            out);
 
 finish:
     if (sapi_ctx) {
@@ -99,11 +77,9 @@ xtpm_load_key(TSS2_TCTI_CONTEXT *tcti_ctx,
     if (TSS2_RC_SUCCESS != ret)
         goto finish;
 
-    ret = load_key(sapi_ctx,
-                   key->parent_handle,
-                   &key->public_key,
-                   &key->private_key_blob,
-                   handle_out);
+    ret = xtpm_load_key_sapi(sapi_ctx,
+                             key,
+                             handle_out);
 
 finish:
     if (sapi_ctx) {
@@ -125,8 +101,8 @@ xtpm_flush_key(TSS2_TCTI_CONTEXT *tcti_ctx,
     if (TSS2_RC_SUCCESS != ret)
         goto finish;
 
-    ret = Tss2_Sys_FlushContext(sapi_ctx,
-                                handle);
+    ret = xtpm_flush_key_sapi(sapi_ctx,
+                              handle);
 
 finish:
     if (sapi_ctx) {
@@ -153,6 +129,7 @@ xtpm_write_key(const struct xtpm_key *key,
 
     return TSS2_RC_SUCCESS;
 }
+#endif
 
 TSS2_RC
 xtpm_get_public_key(const struct xtpm_key *key,
@@ -173,6 +150,7 @@ xtpm_get_public_key(const struct xtpm_key *key,
     return TSS2_RC_SUCCESS;
 }
 
+#ifndef XTPM_NO_HEAP
 TSS2_RC
 xtpm_sign(TSS2_TCTI_CONTEXT *tcti_ctx,
           const struct xtpm_key *key,
@@ -188,25 +166,97 @@ xtpm_sign(TSS2_TCTI_CONTEXT *tcti_ctx,
     if (TSS2_RC_SUCCESS != ret)
         goto finish;
 
-    TPM2_HANDLE loaded_key;
-    ret = load_key(sapi_ctx,
-                   key->parent_handle,
-                   &key->public_key,
-                   &key->private_key_blob,
-                   &loaded_key);
+    ret = xtpm_sign_sapi(sapi_ctx,
+                         key,
+                         digest,
+                         signature_out);
+
+finish:
+    if (sapi_ctx) {
+        Tss2_Sys_Finalize(sapi_ctx);
+        free(sapi_ctx);
+    }
+
+    return ret;
+}
+
+TSS2_RC
+xtpm_sign_raw(TSS2_TCTI_CONTEXT *tcti_ctx,
+              const struct xtpm_key *key,
+              const TPM2B_DIGEST *digest,
+              uint8_t *signature_out)
+{
+    TSS2_RC ret;
+
+    TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+    ret = init_sapi(&sapi_ctx, tcti_ctx);
+    if (TSS2_RC_SUCCESS != ret)
+        goto finish;
+
+    ret = xtpm_sign_raw_sapi(sapi_ctx,
+                             key,
+                             digest,
+                             signature_out);
+
+finish:
+    if (sapi_ctx) {
+        Tss2_Sys_Finalize(sapi_ctx);
+        free(sapi_ctx);
+    }
+
+    return ret;
+}
 
+TSS2_RC
+xtpm_sign_final(TSS2_TCTI_CONTEXT *tcti_ctx,
+                const struct xtpm_key *key,
+                struct xtpm_sign_ctx *ctx,
+                TPMT_SIGNATURE *signature_out)
+{
+    memset(signature_out, 0, sizeof(TPMT_SIGNATURE));
+
+    TSS2_RC ret;
+
+    TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+    ret = init_sapi(&sapi_ctx, tcti_ctx);
     if (TSS2_RC_SUCCESS != ret)
         goto finish;
 
-    ret = sign(sapi_ctx,
-               loaded_key,
-               digest,
-               signature_out);
+    ret = xtpm_sign_final_sapi(sapi_ctx,
+                               key,
+                               ctx,
+                               signature_out);
+
+finish:
+    if (sapi_ctx) {
+        Tss2_Sys_Finalize(sapi_ctx);
+        free(sapi_ctx);
+    }
+
+    return ret;
+}
+
+TSS2_RC
+xtpm_sign_message_batch(TSS2_TCTI_CONTEXT *tcti_ctx,
+                        const struct xtpm_key *key,
+                        const uint8_t *const *messages,
+                        const size_t *lengths,
+                        size_t count,
+                        TPMT_SIGNATURE *signatures_out)
+{
+    TSS2_RC ret;
 
-    TSS2_RC flush_ret = Tss2_Sys_FlushContext(sapi_ctx,
-                                              loaded_key);
+    TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+    ret = init_sapi(&sapi_ctx, tcti_ctx);
     if (TSS2_RC_SUCCESS != ret)
-        ret = flush_ret;
+        goto finish;
+
+    ret = xtpm_sign_message_batch_sapi(sapi_ctx,
+                                       key,
+                                       messages,
+                                       lengths,
+                                       count,
+                                       signatures_out);
 
 finish:
     if (sapi_ctx) {
@@ -216,3 +266,146 @@ finish:
 
     return ret;
 }
+#endif
+
+void
+xtpm_sign_init(struct xtpm_sign_ctx *ctx)
+{
+    sha256_init_state(ctx->hash_state);
+    ctx->hashed_length = 0;
+}
+
+void
+xtpm_sign_update(struct xtpm_sign_ctx *ctx,
+                 const void *data,
+                 size_t length)
+{
+    const uint8_t *in = data;
+    size_t buffered = ctx->hashed_length % XTPM_SIGN_BLOCK_SIZE;
+    ctx->hashed_length += length;
+
+    // Top up a partial block left over from the last update.
+    if (buffered > 0) {
+        size_t fill = XTPM_SIGN_BLOCK_SIZE - buffered;
+        if (length < fill) {
+            memcpy(ctx->partial_block + buffered, in, length);
+            return;
+        }
+
+        memcpy(ctx->partial_block + buffered, in, fill);
+        sha256_blocks(ctx->hash_state, ctx->partial_block, 1);
+        in += fill;
+        length -= fill;
+    }
+
+    // Whole blocks are hashed straight from the caller's buffer.
+    size_t block_count = length / XTPM_SIGN_BLOCK_SIZE;
+    sha256_blocks(ctx->hash_state, in, block_count);
+    in += block_count * XTPM_SIGN_BLOCK_SIZE;
+    length -= block_count * XTPM_SIGN_BLOCK_SIZE;
+
+    memcpy(ctx->partial_block, in, length);
+}
+
+TSS2_RC
+xtpm_gen_key_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                  TPM2_HANDLE parent_handle_in,
+                  TPMI_RH_HIERARCHY hierarchy_in,
+                  const char *hierarchy_password,
+                  size_t hierarchy_password_length,
+                  struct xtpm_key *out)
+{
+    memset(out, 0, sizeof(struct xtpm_key));
+
+    return gen_key(sapi_ctx,
+                   parent_handle_in,
+                   hierarchy_in,
+                   hierarchy_password,
+                   hierarchy_password_length,
+                   out);
+}
+
+TSS2_RC
+xtpm_load_key_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                   const struct xtpm_key *key,
+                   TPM2_HANDLE *handle_out)
+{
+    return load_key(sapi_ctx,
+                    key->parent_handle,
+                    &key->public_key,
+                    &key->private_key_blob,
+                    handle_out);
+}
+
+TSS2_RC
+xtpm_flush_key_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                    TPM2_HANDLE handle)
+{
+    return Tss2_Sys_FlushContext(sapi_ctx,
+                                 handle);
+}
+
+TSS2_RC
+xtpm_sign_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+               const struct xtpm_key *key,
+               const TPM2B_DIGEST *digest,
+               TPMT_SIGNATURE *signature_out)
+{
+    memset(signature_out, 0, sizeof(TPMT_SIGNATURE));
+
+    return sign_with_key(sapi_ctx,
+                         key,
+                         digest,
+                         signature_out);
+}
+
+TSS2_RC
+xtpm_sign_raw_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                   const struct xtpm_key *key,
+                   const TPM2B_DIGEST *digest,
+                   uint8_t *signature_out)
+{
+    return sign_raw_with_key(sapi_ctx,
+                             key,
+                             digest,
+                             signature_out);
+}
+
+TSS2_RC
+xtpm_sign_final_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                     const struct xtpm_key *key,
+                     struct xtpm_sign_ctx *ctx,
+                     TPMT_SIGNATURE *signature_out)
+{
+    memset(signature_out, 0, sizeof(TPMT_SIGNATURE));
+
+    TPM2B_DIGEST digest = {.size = SHA256_DIGEST_SIZE};
+    sha256_finish(ctx->hash_state,
+                  ctx->hashed_length,
+                  ctx->partial_block,
+                  ctx->hashed_length % XTPM_SIGN_BLOCK_SIZE,
+                  digest.buffer);
+
+    return sign_with_key(sapi_ctx,
+                         key,
+                         &digest,
+                         signature_out);
+}
+
+TSS2_RC
+xtpm_sign_message_batch_sapi(TSS2_SYS_CONTEXT *sapi_ctx,
+                             const struct xtpm_key *key,
+                             const uint8_t *const *messages,
+                             const size_t *lengths,
+                             size_t count,
+                             TPMT_SIGNATURE *signatures_out)
+{
+    memset(signatures_out, 0, count * sizeof(TPMT_SIGNATURE));
+
+    return sign_messages_with_key(sapi_ctx,
+                                  key,
+                                  messages,
+                                  lengths,
+                                  count,
+                                  signatures_out);
+}
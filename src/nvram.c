@@ -16,6 +16,8 @@
  *
  *****************************************************************************/
 
+#include "internal/nvram-impl.h"
+
 #include <xaptum-tpm/nvram.h>
 
 #include <tss2/tss2_sys.h>
@@ -126,13 +128,10 @@ xtpm_read_nvram(unsigned char *out,
         .count = 1
     };
 
-    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut;
-    sessionsDataOut.count = 1;
-
     uint16_t data_offset = 0;
 
     while (size > 0) {
-        uint16_t bytes_to_read = size;
+        uint16_t bytes_to_read = size < TPM2_MAX_NV_BUFFER_SIZE ? size : TPM2_MAX_NV_BUFFER_SIZE;
 
         TPM2B_MAX_NV_BUFFER nv_data = {.size=0};
 
@@ -143,7 +142,7 @@ xtpm_read_nvram(unsigned char *out,
                                bytes_to_read,
                                data_offset,
                                &nv_data,
-                               &sessionsDataOut);
+                               NULL);
 
         if (ret != TSS2_RC_SUCCESS) {
             return ret;
@@ -158,6 +157,174 @@ xtpm_read_nvram(unsigned char *out,
     return ret;
 }
 
+TSS2_RC
+xtpm_write_nvram(const unsigned char *in,
+                 uint16_t size,
+                 TPM2_HANDLE index,
+                 TPMI_RH_NV_AUTH auth_handle,
+                 TSS2_SYS_CONTEXT *sapi_context)
+{
+    struct memory_source source = {.next = in};
+
+    return xtpm_write_nvram_stream(read_from_memory,
+                                   &source,
+                                   size,
+                                   index,
+                                   auth_handle,
+                                   sapi_context);
+}
+
+TSS2_RC
+xtpm_write_nvram_stream(xtpm_nvram_read_fn read_fn,
+                        void *user_data,
+                        uint16_t size,
+                        TPM2_HANDLE index,
+                        TPMI_RH_NV_AUTH auth_handle,
+                        TSS2_SYS_CONTEXT *sapi_context)
+{
+    // Assume no password required.
+    TSS2L_SYS_AUTH_COMMAND sessionsData = {
+        .auths[0] = {.sessionHandle = TPM2_RS_PW,
+            .nonce = {.size = 0},
+            .sessionAttributes = 0,
+            .hmac = {.size = 0}
+        },
+        .count = 1
+    };
+
+    return write_nvram(sapi_context,
+                       auth_handle,
+                       index,
+                       &sessionsData,
+                       read_fn,
+                       user_data,
+                       size);
+}
+
+static
+TSS2_RC
+send_read(struct xtpm_nv_reader *reader)
+{
+    // Assume no password required.
+    TSS2L_SYS_AUTH_COMMAND sessionsData = {
+        .auths[0] = {.sessionHandle = TPM2_RS_PW,
+            .nonce = {.size = 0},
+            .sessionAttributes = 0,
+            .hmac = {.size = 0}
+        },
+        .count = 1
+    };
+
+    uint16_t bytes_left = reader->size - reader->offset;
+    uint16_t bytes_to_read = bytes_left < TPM2_MAX_NV_BUFFER_SIZE ? bytes_left : TPM2_MAX_NV_BUFFER_SIZE;
+
+    TSS2_RC ret = Tss2_Sys_NV_Read_Prepare(reader->sapi_context,
+                                           reader->index,
+                                           reader->index,
+                                           bytes_to_read,
+                                           reader->offset);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    ret = Tss2_Sys_SetCmdAuths(reader->sapi_context, &sessionsData);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    ret = Tss2_Sys_ExecuteAsync(reader->sapi_context);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    reader->in_flight = 1;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+receive_read(struct xtpm_nv_reader *reader)
+{
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut;
+    sessionsDataOut.count = 1;
+
+    reader->in_flight = 0;
+
+    TSS2_RC ret = Tss2_Sys_ExecuteFinish(reader->sapi_context, TSS2_TCTI_TIMEOUT_BLOCK);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    ret = Tss2_Sys_GetRspAuths(reader->sapi_context, &sessionsDataOut);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    return Tss2_Sys_NV_Read_Complete(reader->sapi_context, &reader->chunk);
+}
+
+TSS2_RC
+xtpm_nv_reader_open(struct xtpm_nv_reader *reader,
+                    TPM2_HANDLE index,
+                    TSS2_SYS_CONTEXT *sapi_context)
+{
+    memset(reader, 0, sizeof(struct xtpm_nv_reader));
+    reader->sapi_context = sapi_context;
+    reader->index = index;
+
+    TSS2_RC ret = xtpm_get_nvram_size(&reader->size, index, sapi_context);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    if (0 == reader->size)
+        return TSS2_RC_SUCCESS;
+
+    return send_read(reader);
+}
+
+TSS2_RC
+xtpm_nv_reader_next(struct xtpm_nv_reader *reader,
+                    const unsigned char **chunk_out,
+                    uint16_t *chunk_length_out)
+{
+    *chunk_out = reader->chunk.buffer;
+    *chunk_length_out = 0;
+
+    if (!reader->in_flight)
+        return TSS2_RC_SUCCESS;
+
+    TSS2_RC ret = receive_read(reader);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    if (0 == reader->chunk.size ||
+            reader->chunk.size > sizeof(reader->chunk.buffer) ||
+            reader->chunk.size > reader->size - reader->offset)
+        return TSS2_BASE_RC_MALFORMED_RESPONSE;
+
+    reader->offset += reader->chunk.size;
+
+    if (reader->offset < reader->size) {
+        ret = send_read(reader);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+    }
+
+    *chunk_length_out = reader->chunk.size;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+xtpm_nv_reader_close(struct xtpm_nv_reader *reader)
+{
+    TSS2_RC ret = TSS2_RC_SUCCESS;
+
+    // Drain the outstanding response, so the SAPI context is usable again.
+    if (reader->in_flight)
+        ret = receive_read(reader);
+
+    memset(reader, 0, sizeof(struct xtpm_nv_reader));
+
+    return ret;
+}
+
 TSS2_RC
 xtpm_get_nvram_size(uint16_t *size_out,
                     TPM2_HANDLE index,
@@ -165,13 +332,11 @@ xtpm_get_nvram_size(uint16_t *size_out,
 {
     TPM2B_NV_PUBLIC nv_public = {0};
 
-    TPM2B_NAME nv_name = {0};
-
     TSS2_RC rval = Tss2_Sys_NV_ReadPublic(sapi_context,
                                           index,
                                           NULL,
                                           &nv_public,
-                                          &nv_name,
+                                          NULL,
                                           NULL);
 
     if (rval == TSS2_RC_SUCCESS) {
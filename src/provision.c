@@ -0,0 +1,274 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include "internal/nvram-impl.h"
+
+#include <xaptum-tpm/provision.h>
+
+#include <tss2/tss2_sys.h>
+
+#include <string.h>
+
+#define DEFAULT_AUTH_HANDLE TPM2_RH_OWNER
+
+// Format-one TPM response codes (Part 2, Sec. 6.6)
+#define RC_FMT1 0x080
+#define RC_FMT1_ERROR_MASK 0x03F
+#define RC_HANDLE 0x00B
+
+// Attributes set by the TPM, rather than at definition time
+#define NV_STATE_ATTRIBUTES (TPMA_NV_WRITELOCKED | TPMA_NV_READLOCKED | TPMA_NV_WRITTEN)
+
+struct nv_state {
+    int defined;
+    TPMA_NV attributes;
+    uint16_t data_size;
+};
+
+static
+int
+is_handle_error(TSS2_RC ret)
+{
+    return (ret & ~(TSS2_RC)0xFFF) == TSS2_TPM_RC_LEVEL &&
+        (ret & RC_FMT1) &&
+        (ret & RC_FMT1_ERROR_MASK) == RC_HANDLE;
+}
+
+static
+TSS2_RC
+read_state(TSS2_SYS_CONTEXT *sapi_ctx,
+           TPMI_RH_NV_INDEX index,
+           struct nv_state *state_out)
+{
+    TPM2B_NV_PUBLIC nv_public = {0};
+    TSS2_RC ret = Tss2_Sys_NV_ReadPublic(sapi_ctx,
+                                         index,
+                                         NULL,
+                                         &nv_public,
+                                         NULL,
+                                         NULL);
+    if (is_handle_error(ret)) {
+        state_out->defined = 0;
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    state_out->defined = 1;
+    state_out->attributes = nv_public.nvPublic.attributes;
+    state_out->data_size = nv_public.nvPublic.dataSize;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+define_index(TSS2_SYS_CONTEXT *sapi_ctx,
+             TPMI_RH_PROVISION auth_handle,
+             const TSS2L_SYS_AUTH_COMMAND *hierarchy_auth,
+             const struct xtpm_nv_entry *entry)
+{
+    TPM2B_AUTH nv_auth = {.size = 0};
+
+    TPM2B_NV_PUBLIC public_info = {0};
+    public_info.nvPublic.nvIndex = entry->index;
+    public_info.nvPublic.nameAlg = TPM2_ALG_SHA256;
+    public_info.nvPublic.attributes = entry->attributes & ~NV_STATE_ATTRIBUTES;
+    public_info.nvPublic.dataSize = entry->data_size;
+
+    return Tss2_Sys_NV_DefineSpace(sapi_ctx,
+                                   auth_handle,
+                                   hierarchy_auth,
+                                   &nv_auth,
+                                   &public_info,
+                                   NULL);
+}
+
+static
+TSS2_RC
+undefine_index(TSS2_SYS_CONTEXT *sapi_ctx,
+               TPMI_RH_PROVISION auth_handle,
+               const TSS2L_SYS_AUTH_COMMAND *hierarchy_auth,
+               TPMI_RH_NV_INDEX index)
+{
+    return Tss2_Sys_NV_UndefineSpace(sapi_ctx,
+                                     auth_handle,
+                                     index,
+                                     hierarchy_auth,
+                                     NULL);
+}
+
+// Read under the hierarchy if the index allows it, otherwise under the index's own auth.
+// Returns 0 if neither is allowed.
+static
+int
+select_read_auth(TPMI_RH_PROVISION auth_handle,
+                 const TSS2L_SYS_AUTH_COMMAND *hierarchy_auth,
+                 const TSS2L_SYS_AUTH_COMMAND *index_auth,
+                 const struct xtpm_nv_entry *entry,
+                 TPMI_RH_NV_AUTH *read_handle_out,
+                 const TSS2L_SYS_AUTH_COMMAND **read_auth_out)
+{
+    if ((TPM2_RH_OWNER == auth_handle && (entry->attributes & TPMA_NV_OWNERREAD)) ||
+        (TPM2_RH_PLATFORM == auth_handle && (entry->attributes & TPMA_NV_PPREAD))) {
+        *read_handle_out = auth_handle;
+        *read_auth_out = hierarchy_auth;
+        return 1;
+    }
+
+    if (entry->attributes & TPMA_NV_AUTHREAD) {
+        *read_handle_out = entry->index;
+        *read_auth_out = index_auth;
+        return 1;
+    }
+
+    return 0;
+}
+
+static
+TSS2_RC
+provision_entry(TSS2_SYS_CONTEXT *sapi_ctx,
+                TPMI_RH_PROVISION auth_handle,
+                const TSS2L_SYS_AUTH_COMMAND *hierarchy_auth,
+                const TSS2L_SYS_AUTH_COMMAND *index_auth,
+                const struct xtpm_nv_entry *entry,
+                enum xtpm_provision_action *action_out)
+{
+    struct nv_state state = {0};
+    TSS2_RC ret = read_state(sapi_ctx, entry->index, &state);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    TPMA_NV wanted_attributes = entry->attributes & ~NV_STATE_ATTRIBUTES;
+
+    if (!state.defined) {
+        *action_out = XTPM_PROVISION_DEFINED;
+    } else if ((state.attributes & ~NV_STATE_ATTRIBUTES) != wanted_attributes ||
+               state.data_size != entry->data_size) {
+        ret = undefine_index(sapi_ctx, auth_handle, hierarchy_auth, entry->index);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        *action_out = XTPM_PROVISION_REDEFINED;
+    } else {
+        if (state.attributes & TPMA_NV_WRITTEN) {
+            TPMI_RH_NV_AUTH read_handle;
+            const TSS2L_SYS_AUTH_COMMAND *read_auth;
+            if (!select_read_auth(auth_handle, hierarchy_auth, index_auth, entry, &read_handle, &read_auth))
+                return TSS2_BASE_RC_BAD_VALUE;
+
+            int matches = 0;
+            ret = compare_nvram(sapi_ctx,
+                                read_handle,
+                                entry->index,
+                                read_auth,
+                                entry->data,
+                                entry->data_size,
+                                &matches);
+            if (TSS2_RC_SUCCESS != ret)
+                return ret;
+
+            if (matches) {
+                *action_out = XTPM_PROVISION_UNCHANGED;
+                return TSS2_RC_SUCCESS;
+            }
+        }
+
+        *action_out = XTPM_PROVISION_WRITTEN;
+    }
+
+    if (XTPM_PROVISION_WRITTEN != *action_out) {
+        ret = define_index(sapi_ctx, auth_handle, hierarchy_auth, entry);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+    }
+
+    // Write under the hierarchy if the index allows it,
+    // since the hierarchy may be the only thing permitted to write.
+    TPMI_RH_NV_AUTH write_handle = entry->index;
+    const TSS2L_SYS_AUTH_COMMAND *write_auth = index_auth;
+    if ((TPM2_RH_OWNER == auth_handle && (wanted_attributes & TPMA_NV_OWNERWRITE)) ||
+        (TPM2_RH_PLATFORM == auth_handle && (wanted_attributes & TPMA_NV_PPWRITE))) {
+        write_handle = auth_handle;
+        write_auth = hierarchy_auth;
+    }
+
+    struct memory_source source = {.next = entry->data};
+
+    return write_nvram(sapi_ctx,
+                       write_handle,
+                       entry->index,
+                       write_auth,
+                       read_from_memory,
+                       &source,
+                       entry->data_size);
+}
+
+TSS2_RC
+xtpm_provision_nvram(const struct xtpm_nv_entry *entries,
+                     size_t count,
+                     TPMI_RH_PROVISION auth_handle_in,
+                     const char *password,
+                     size_t password_length,
+                     enum xtpm_provision_action *actions_out,
+                     TSS2_SYS_CONTEXT *sapi_context)
+{
+    TPMI_RH_PROVISION auth_handle;
+    if (0 == auth_handle_in) {
+        auth_handle = DEFAULT_AUTH_HANDLE;
+    } else {
+        auth_handle = auth_handle_in;
+    }
+
+    TSS2L_SYS_AUTH_COMMAND hierarchy_auth;
+    TSS2_RC ret = set_password_auth(&hierarchy_auth, password, password_length);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    // Indices are defined with an empty auth value.
+    TSS2L_SYS_AUTH_COMMAND index_auth;
+    ret = set_password_auth(&index_auth, NULL, 0);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    // Check every entry can be compared before changing anything.
+    for (size_t i = 0; i < count; i++) {
+        TPMI_RH_NV_AUTH read_handle;
+        const TSS2L_SYS_AUTH_COMMAND *read_auth;
+        if (!select_read_auth(auth_handle, &hierarchy_auth, &index_auth, &entries[i], &read_handle, &read_auth))
+            return TSS2_BASE_RC_BAD_VALUE;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        enum xtpm_provision_action action;
+        ret = provision_entry(sapi_context,
+                              auth_handle,
+                              &hierarchy_auth,
+                              &index_auth,
+                              &entries[i],
+                              &action);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        if (actions_out)
+            actions_out[i] = action;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
@@ -0,0 +1,372 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifdef __linux__
+#define _GNU_SOURCE     // for pthread_setaffinity_np
+#endif
+
+#include "internal/keys-impl.h"
+#include "internal/sapi.h"
+
+#include <xaptum-tpm/service.h>
+#include <xaptum-tpm/nvram.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum job_type {
+    JOB_SIGN,
+    JOB_READ_NVRAM,
+    JOB_GEN_KEY,
+};
+
+struct xtpm_service {
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;   // a job was queued, or the service is stopping
+    pthread_cond_t done_cond;   // a job finished
+
+    // Protected by `lock`
+    struct xtpm_job *head;
+    struct xtpm_job *tail;
+    int stopping;
+    uint32_t max_queue_depth;
+    struct xtpm_service_stats stats;
+};
+
+static
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static
+TSS2_RC
+run_job(struct xtpm_service *service,
+        struct xtpm_job *job)
+{
+    switch (job->type) {
+        case JOB_SIGN:
+            return sign_with_key(service->sapi_ctx,
+                                 job->args.sign.key,
+                                 job->args.sign.digest,
+                                 job->args.sign.signature_out);
+        case JOB_READ_NVRAM:
+            return xtpm_read_nvram(job->args.read_nvram.out,
+                                   job->args.read_nvram.size,
+                                   job->args.read_nvram.index,
+                                   service->sapi_ctx);
+        case JOB_GEN_KEY:
+            memset(job->args.gen_key.out, 0, sizeof(struct xtpm_key));
+            return gen_key(service->sapi_ctx,
+                           job->args.gen_key.parent_handle,
+                           job->args.gen_key.hierarchy,
+                           job->args.gen_key.hierarchy_password,
+                           job->args.gen_key.hierarchy_password_length,
+                           job->args.gen_key.out);
+    }
+
+    return TSS2_BASE_RC_BAD_VALUE;
+}
+
+static
+void *
+service_main(void *arg)
+{
+    struct xtpm_service *service = arg;
+
+    pthread_mutex_lock(&service->lock);
+    for (;;) {
+        while (NULL == service->head && !service->stopping)
+            pthread_cond_wait(&service->work_cond, &service->lock);
+
+        // Only stop once the queue is empty.
+        struct xtpm_job *job = service->head;
+        if (NULL == job)
+            break;
+
+        service->head = job->next;
+        if (NULL == service->head)
+            service->tail = NULL;
+        service->stats.queue_depth--;
+        pthread_mutex_unlock(&service->lock);
+
+        job->start_ns = now_ns();
+        job->rc = run_job(service, job);
+        job->finish_ns = now_ns();
+
+        pthread_mutex_lock(&service->lock);
+        uint64_t wait_ns = job->start_ns - job->submit_ns;
+        service->stats.completed++;
+        service->stats.total_wait_ns += wait_ns;
+        if (wait_ns > service->stats.max_wait_ns)
+            service->stats.max_wait_ns = wait_ns;
+        service->stats.total_run_ns += job->finish_ns - job->start_ns;
+        pthread_mutex_unlock(&service->lock);
+
+        // The job may be freed as soon as it's marked done, so call back first.
+        if (NULL != job->callback)
+            job->callback(job, job->user_data);
+
+        pthread_mutex_lock(&service->lock);
+        __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&service->done_cond);
+    }
+    pthread_mutex_unlock(&service->lock);
+
+    return NULL;
+}
+
+TSS2_RC
+xtpm_service_create(struct xtpm_service **service_out,
+                    TSS2_TCTI_CONTEXT *tcti_ctx,
+                    int cpu,
+                    uint32_t max_queue_depth)
+{
+    TSS2_RC ret;
+
+#ifndef __linux__
+    if (0 <= cpu)
+        return TSS2_BASE_RC_NOT_SUPPORTED;
+#endif
+
+    struct xtpm_service *service = calloc(1, sizeof(struct xtpm_service));
+    if (NULL == service)
+        return TSS2_BASE_RC_GENERAL_FAILURE;
+
+    service->max_queue_depth = max_queue_depth;
+
+    ret = init_sapi(&service->sapi_ctx, tcti_ctx);
+    if (TSS2_RC_SUCCESS != ret)
+        goto free_service;
+
+    ret = TSS2_BASE_RC_GENERAL_FAILURE;
+    if (0 != pthread_mutex_init(&service->lock, NULL))
+        goto free_sapi;
+    if (0 != pthread_cond_init(&service->work_cond, NULL))
+        goto free_lock;
+    if (0 != pthread_cond_init(&service->done_cond, NULL))
+        goto free_work_cond;
+
+    if (0 != pthread_create(&service->thread, NULL, service_main, service))
+        goto free_done_cond;
+
+#ifdef __linux__
+    if (0 <= cpu) {
+        if (cpu >= CPU_SETSIZE) {
+            xtpm_service_destroy(service);
+            return TSS2_BASE_RC_BAD_VALUE;
+        }
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (0 != pthread_setaffinity_np(service->thread, sizeof(cpu_set_t), &cpus)) {
+            ret = TSS2_BASE_RC_BAD_VALUE;
+            xtpm_service_destroy(service);
+            return ret;
+        }
+    }
+#endif
+
+    *service_out = service;
+
+    return TSS2_RC_SUCCESS;
+
+free_done_cond:
+    pthread_cond_destroy(&service->done_cond);
+free_work_cond:
+    pthread_cond_destroy(&service->work_cond);
+free_lock:
+    pthread_mutex_destroy(&service->lock);
+free_sapi:
+    Tss2_Sys_Finalize(service->sapi_ctx);
+    free(service->sapi_ctx);
+free_service:
+    free(service);
+
+    return ret;
+}
+
+void
+xtpm_service_destroy(struct xtpm_service *service)
+{
+    if (NULL == service)
+        return;
+
+    pthread_mutex_lock(&service->lock);
+    service->stopping = 1;
+    pthread_cond_signal(&service->work_cond);
+    pthread_mutex_unlock(&service->lock);
+
+    pthread_join(service->thread, NULL);
+
+    pthread_cond_destroy(&service->done_cond);
+    pthread_cond_destroy(&service->work_cond);
+    pthread_mutex_destroy(&service->lock);
+
+    Tss2_Sys_Finalize(service->sapi_ctx);
+    free(service->sapi_ctx);
+
+    free(service);
+}
+
+static
+TSS2_RC
+submit(struct xtpm_service *service,
+       struct xtpm_job *job,
+       enum job_type type,
+       xtpm_job_callback callback,
+       void *user_data)
+{
+    job->rc = TSS2_RC_SUCCESS;
+    job->start_ns = 0;
+    job->finish_ns = 0;
+    job->next = NULL;
+    job->service = service;
+    job->type = type;
+    job->done = 0;
+    job->callback = callback;
+    job->user_data = user_data;
+
+    pthread_mutex_lock(&service->lock);
+
+    if (service->stopping) {
+        pthread_mutex_unlock(&service->lock);
+        return TSS2_BASE_RC_BAD_SEQUENCE;
+    }
+
+    if (0 != service->max_queue_depth && service->stats.queue_depth >= service->max_queue_depth) {
+        pthread_mutex_unlock(&service->lock);
+        return TSS2_BASE_RC_TRY_AGAIN;
+    }
+
+    job->submit_ns = now_ns();
+
+    if (NULL == service->tail)
+        service->head = job;
+    else
+        service->tail->next = job;
+    service->tail = job;
+
+    service->stats.submitted++;
+    service->stats.queue_depth++;
+    if (service->stats.queue_depth > service->stats.max_queue_depth)
+        service->stats.max_queue_depth = service->stats.queue_depth;
+
+    pthread_cond_signal(&service->work_cond);
+    pthread_mutex_unlock(&service->lock);
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+xtpm_service_sign(struct xtpm_service *service,
+                  struct xtpm_job *job,
+                  const struct xtpm_key *key,
+                  const TPM2B_DIGEST *digest,
+                  TPMT_SIGNATURE *signature_out,
+                  xtpm_job_callback callback,
+                  void *user_data)
+{
+    if (NULL == job || NULL == key || NULL == digest || NULL == signature_out)
+        return TSS2_BASE_RC_BAD_REFERENCE;
+
+    job->args.sign.key = key;
+    job->args.sign.digest = digest;
+    job->args.sign.signature_out = signature_out;
+
+    return submit(service, job, JOB_SIGN, callback, user_data);
+}
+
+TSS2_RC
+xtpm_service_read_nvram(struct xtpm_service *service,
+                        struct xtpm_job *job,
+                        unsigned char *out,
+                        uint16_t size,
+                        TPM2_HANDLE index,
+                        xtpm_job_callback callback,
+                        void *user_data)
+{
+    if (NULL == job || NULL == out)
+        return TSS2_BASE_RC_BAD_REFERENCE;
+
+    job->args.read_nvram.index = index;
+    job->args.read_nvram.out = out;
+    job->args.read_nvram.size = size;
+
+    return submit(service, job, JOB_READ_NVRAM, callback, user_data);
+}
+
+TSS2_RC
+xtpm_service_gen_key(struct xtpm_service *service,
+                     struct xtpm_job *job,
+                     TPM2_HANDLE parent_handle,
+                     TPMI_RH_HIERARCHY hierarchy,
+                     const char *hierarchy_password,
+                     size_t hierarchy_password_length,
+                     struct xtpm_key *out,
+                     xtpm_job_callback callback,
+                     void *user_data)
+{
+    if (NULL == job || NULL == out)
+        return TSS2_BASE_RC_BAD_REFERENCE;
+
+    job->args.gen_key.parent_handle = parent_handle;
+    job->args.gen_key.hierarchy = hierarchy;
+    job->args.gen_key.hierarchy_password = hierarchy_password;
+    job->args.gen_key.hierarchy_password_length = hierarchy_password_length;
+    job->args.gen_key.out = out;
+
+    return submit(service, job, JOB_GEN_KEY, callback, user_data);
+}
+
+int
+xtpm_job_done(const struct xtpm_job *job)
+{
+    return __atomic_load_n(&job->done, __ATOMIC_ACQUIRE);
+}
+
+TSS2_RC
+xtpm_job_wait(struct xtpm_job *job)
+{
+    struct xtpm_service *service = job->service;
+
+    pthread_mutex_lock(&service->lock);
+    while (!job->done)
+        pthread_cond_wait(&service->done_cond, &service->lock);
+    pthread_mutex_unlock(&service->lock);
+
+    return job->rc;
+}
+
+void
+xtpm_service_get_stats(struct xtpm_service *service,
+                       struct xtpm_service_stats *stats_out)
+{
+    pthread_mutex_lock(&service->lock);
+    *stats_out = service->stats;
+    pthread_mutex_unlock(&service->lock);
+}
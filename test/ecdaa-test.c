@@ -0,0 +1,581 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <xaptum-tpm/ecdaa.h>
+#include <xaptum-tpm/nvram.h>
+#include <xaptum-tpm/provision.h>
+
+#include "test-utils.h"
+
+void create_ecdaa_key(TSS2_SYS_CONTEXT *sapi_ctx, TPMI_RH_HIERARCHY hierarchy, TPM2_HANDLE *handle_out);
+
+void provision_ecdaa_key(TSS2_SYS_CONTEXT *sapi_ctx, const unsigned char *basename, uint16_t basename_size);
+
+void ctx_sign_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In ecdaa-test::ctx_sign_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    unsigned char basename[] = {'b', 'a', 's', 'e', 'n', 'a', 'm', 'e'};
+    provision_ecdaa_key(sapi_ctx, basename, sizeof(basename));
+
+    struct xtpm_ecdaa_ctx ctx;
+    TSS2_RC ret = xtpm_ecdaa_ctx_init(&ctx, sapi_ctx, NULL, NULL, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(sizeof(basename) == ctx.basename.size);
+    TEST_ASSERT(0 == memcmp(basename, ctx.basename.buffer, sizeof(basename)));
+    TEST_ASSERT(TPM2_ALG_ECDAA == ctx.public_key.publicArea.parameters.eccDetail.scheme.scheme);
+
+    TPM2B_DIGEST msg_digest = {.size = 32};
+    memset(msg_digest.buffer, 0x3C, msg_digest.size);
+
+    // Without precommitting, each signature makes its own commit.
+    struct xtpm_ecdaa_commit commit_used;
+    TPMT_SIGNATURE signature = {};
+    ret = xtpm_ecdaa_sign(&ctx, &msg_digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(TPM2_ALG_ECDAA == signature.sigAlg);
+
+    ret = xtpm_ecdaa_precommit(&ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    for (unsigned i = 0; i < XTPM_ECDAA_COMMIT_POOL_SIZE; i++) {
+        ret = xtpm_ecdaa_sign(&ctx, &msg_digest, &commit_used, &signature);
+        TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    }
+    TEST_ASSERT(0 == xtpm_ecdaa_commit_pool_count(&ctx.pool));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+struct challenge_state {
+    unsigned calls;
+    uint16_t last_counter;
+};
+
+static
+int challenge(const struct xtpm_ecdaa_commit *commit,
+              const TPM2B_DIGEST *msg_digest,
+              TPM2B_DIGEST *digest_out,
+              void *user_data)
+{
+    struct challenge_state *state = user_data;
+    state->calls++;
+    state->last_counter = commit->counter;
+
+    // Stands in for hashing the commit's points with the message.
+    *digest_out = *msg_digest;
+    digest_out->buffer[0] ^= (uint8_t)commit->counter;
+
+    return 0;
+}
+
+void ctx_challenge_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In ecdaa-test::ctx_challenge_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    unsigned char basename[] = {'b', 'a', 's', 'e', 'n', 'a', 'm', 'e'};
+    provision_ecdaa_key(sapi_ctx, basename, sizeof(basename));
+
+    struct challenge_state state = {0};
+    struct xtpm_ecdaa_ctx ctx;
+    TSS2_RC ret = xtpm_ecdaa_ctx_init(&ctx, sapi_ctx, NULL, challenge, &state);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_ecdaa_precommit(&ctx));
+
+    TPM2B_DIGEST msg_digest = {.size = 32};
+    struct xtpm_ecdaa_commit commit_used;
+    TPMT_SIGNATURE signature = {};
+    ret = xtpm_ecdaa_sign(&ctx, &msg_digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(1 == state.calls);
+    TEST_ASSERT(commit_used.counter == state.last_counter);
+
+    // When the TPM rejects a pooled commit (here, used up behind the context's back),
+    // the challenge is computed again for a new one.
+    uint16_t stale_counter = ctx.pool.commits[ctx.pool.first].counter;
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    TPMT_SIG_SCHEME inScheme = {.scheme = TPM2_ALG_ECDAA};
+    inScheme.details.ecdaa.hashAlg = TPM2_ALG_SHA256;
+    inScheme.details.ecdaa.count = stale_counter;
+    TPMT_TK_HASHCHECK validation = {.tag = TPM2_ST_HASHCHECK, .hierarchy = TPM2_RH_NULL};
+    ret = Tss2_Sys_Sign(sapi_ctx, XTPM_ECDAA_KEY_HANDLE, &sessionsData, &msg_digest, &inScheme, &validation, &signature, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    ret = xtpm_ecdaa_sign(&ctx, &msg_digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(3 == state.calls);
+    TEST_ASSERT(stale_counter != state.last_counter);
+    TEST_ASSERT(commit_used.counter == state.last_counter);
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void long_basename_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In ecdaa-test::long_basename_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    // Longer than a P-256 key, which the XTPM_ECC_ONLY profile sizes most buffers for.
+    unsigned char basename[100];
+    memset(basename, 0xB5, sizeof(basename));
+    provision_ecdaa_key(sapi_ctx, basename, sizeof(basename));
+
+    TPM2B_ECC_PARAMETER basename_y = {.size = 32};
+    memset(basename_y.buffer, 0x7E, basename_y.size);
+
+    struct xtpm_ecdaa_ctx ctx;
+    TSS2_RC ret = xtpm_ecdaa_ctx_init(&ctx, sapi_ctx, &basename_y, NULL, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(sizeof(basename) == ctx.basename.size);
+    TEST_ASSERT(0 == memcmp(basename, ctx.basename.buffer, sizeof(basename)));
+
+    // Each commit passes the whole basename.
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_ecdaa_precommit(&ctx));
+
+    TPM2B_DIGEST msg_digest = {.size = 32};
+    struct xtpm_ecdaa_commit commit_used;
+    TPMT_SIGNATURE signature = {};
+    ret = xtpm_ecdaa_sign(&ctx, &msg_digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(TPM2_ALG_ECDAA == signature.sigAlg);
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void provision_ecdaa_key(TSS2_SYS_CONTEXT *sapi_ctx, const unsigned char *basename, uint16_t basename_size)
+{
+    // Platform-hierarchy objects survive CLEAR, so remove any left by an earlier run.
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    Tss2_Sys_EvictControl(sapi_ctx,
+                          TPM2_RH_PLATFORM,
+                          XTPM_ECDAA_KEY_HANDLE,
+                          &sessionsData,
+                          XTPM_ECDAA_KEY_HANDLE,
+                          NULL);
+
+    TPM2_HANDLE key_handle;
+    create_ecdaa_key(sapi_ctx, TPM2_RH_PLATFORM, &key_handle);
+
+    TSS2_RC ret = Tss2_Sys_EvictControl(sapi_ctx,
+                                        TPM2_RH_PLATFORM,
+                                        key_handle,
+                                        &sessionsData,
+                                        XTPM_ECDAA_KEY_HANDLE,
+                                        NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(sapi_ctx, key_handle));
+
+    struct xtpm_nv_entry entries[] = {
+        {XTPM_BASENAME_HANDLE, TPMA_NV_PPWRITE | TPMA_NV_AUTHREAD | TPMA_NV_PLATFORMCREATE, basename, basename_size},
+    };
+    enum xtpm_provision_action actions[1];
+    ret = xtpm_provision_nvram(entries, 1, TPM2_RH_PLATFORM, NULL, 0, actions, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+}
+
+TSS2_RC commit(TSS2_SYS_CONTEXT *sapi_ctx, TPM2_HANDLE key_handle, uint16_t *counter_out);
+
+void pool_sign_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void empty_pool_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void used_commit_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void window_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void failed_sign_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void ctx_sign_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void ctx_challenge_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void long_basename_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+int main()
+{
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    init_tcti(&tcti_ctx);
+
+    clear(tcti_ctx);
+    pool_sign_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    empty_pool_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    used_commit_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    window_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    failed_sign_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    ctx_sign_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    ctx_challenge_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    long_basename_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    free_tcti(tcti_ctx);
+}
+
+void pool_sign_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In ecdaa-test::pool_sign_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    TPM2_HANDLE key_handle;
+    create_ecdaa_key(sapi_ctx, TPM2_RH_OWNER, &key_handle);
+
+    struct xtpm_ecdaa_commit_pool pool;
+    xtpm_ecdaa_commit_pool_init(&pool, key_handle, NULL, NULL, NULL);
+    TEST_ASSERT(0 == xtpm_ecdaa_commit_pool_count(&pool));
+
+    TSS2_RC ret = xtpm_ecdaa_commit_pool_fill(&pool, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(XTPM_ECDAA_COMMIT_POOL_SIZE == xtpm_ecdaa_commit_pool_count(&pool));
+
+    TPM2B_DIGEST digest = {.size = 32};
+    memset(digest.buffer, 0x5A, digest.size);
+    struct challenge_state state = {0};
+
+    // The oldest commits are used first.
+    uint16_t previous_counter = 0;
+    for (unsigned i = 0; i < 3; i++) {
+        struct xtpm_ecdaa_commit commit_used;
+        TPMT_SIGNATURE signature = {};
+        ret = xtpm_ecdaa_commit_pool_sign(&pool, sapi_ctx, challenge, &state, &digest, &commit_used, &signature);
+        TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+        TEST_ASSERT(TPM2_ALG_ECDAA == signature.sigAlg);
+        TEST_ASSERT(0 != signature.signature.ecdaa.signatureS.size);
+        TEST_ASSERT(0 != commit_used.E.size);
+        TEST_ASSERT(i + 1 == state.calls);
+        TEST_ASSERT(commit_used.counter == state.last_counter);
+        if (i > 0)
+            TEST_ASSERT((uint16_t)(previous_counter + 1) == commit_used.counter);
+        previous_counter = commit_used.counter;
+    }
+    TEST_ASSERT(XTPM_ECDAA_COMMIT_POOL_SIZE - 3 == xtpm_ecdaa_commit_pool_count(&pool));
+
+    // Topping up only makes the missing commits.
+    ret = xtpm_ecdaa_commit_pool_fill(&pool, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(XTPM_ECDAA_COMMIT_POOL_SIZE == xtpm_ecdaa_commit_pool_count(&pool));
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(sapi_ctx, key_handle));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void empty_pool_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In ecdaa-test::empty_pool_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    TPM2_HANDLE key_handle;
+    create_ecdaa_key(sapi_ctx, TPM2_RH_OWNER, &key_handle);
+
+    struct xtpm_ecdaa_commit_pool pool;
+    xtpm_ecdaa_commit_pool_init(&pool, key_handle, NULL, NULL, NULL);
+
+    TPM2B_DIGEST digest = {.size = 32};
+    memset(digest.buffer, 0x5A, digest.size);
+    struct challenge_state state = {0};
+
+    // With nothing pooled, a commit is made on the spot.
+    struct xtpm_ecdaa_commit commit_used;
+    TPMT_SIGNATURE signature = {};
+    TSS2_RC ret = xtpm_ecdaa_commit_pool_sign(&pool, sapi_ctx, challenge, &state, &digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(TPM2_ALG_ECDAA == signature.sigAlg);
+    TEST_ASSERT(0 == xtpm_ecdaa_commit_pool_count(&pool));
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(sapi_ctx, key_handle));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void used_commit_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In ecdaa-test::used_commit_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    TPM2_HANDLE key_handle;
+    create_ecdaa_key(sapi_ctx, TPM2_RH_OWNER, &key_handle);
+
+    struct xtpm_ecdaa_commit_pool pool;
+    xtpm_ecdaa_commit_pool_init(&pool, key_handle, NULL, NULL, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_ecdaa_commit_pool_fill(&pool, sapi_ctx));
+
+    TPM2B_DIGEST digest = {.size = 32};
+    memset(digest.buffer, 0x5A, digest.size);
+    struct challenge_state state = {0};
+
+    // Use up the oldest pooled commit behind the pool's back.
+    uint16_t stolen_counter = pool.commits[pool.first].counter;
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    TPMT_SIG_SCHEME inScheme = {.scheme = TPM2_ALG_ECDAA};
+    inScheme.details.ecdaa.hashAlg = TPM2_ALG_SHA256;
+    inScheme.details.ecdaa.count = stolen_counter;
+    TPMT_TK_HASHCHECK validation = {.tag = TPM2_ST_HASHCHECK, .hierarchy = TPM2_RH_NULL};
+    TPMT_SIGNATURE signature = {};
+    TSS2_RC ret = Tss2_Sys_Sign(sapi_ctx, key_handle, &sessionsData, &digest, &inScheme, &validation, &signature, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // The pool notices, drops its commits, and signs with a new one.
+    struct xtpm_ecdaa_commit commit_used;
+    ret = xtpm_ecdaa_commit_pool_sign(&pool, sapi_ctx, challenge, &state, &digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(stolen_counter != commit_used.counter);
+    TEST_ASSERT(0 == xtpm_ecdaa_commit_pool_count(&pool));
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(sapi_ctx, key_handle));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void window_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In ecdaa-test::window_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    TPM2_HANDLE key_handle;
+    create_ecdaa_key(sapi_ctx, TPM2_RH_OWNER, &key_handle);
+
+    struct xtpm_ecdaa_commit_pool pool;
+    xtpm_ecdaa_commit_pool_init(&pool, key_handle, NULL, NULL, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_ecdaa_commit_pool_fill(&pool, sapi_ctx));
+
+    TPM2B_DIGEST digest = {.size = 32};
+    memset(digest.buffer, 0x5A, digest.size);
+    struct challenge_state state = {0};
+
+    struct xtpm_ecdaa_commit commit_used;
+    TPMT_SIGNATURE signature = {};
+    TSS2_RC ret = xtpm_ecdaa_commit_pool_sign(&pool, sapi_ctx, challenge, &state, &digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // Someone else's commits push the pooled ones out of the TPM's window.
+    uint16_t newest_counter = 0;
+    for (unsigned i = 0; i < XTPM_ECDAA_COMMIT_WINDOW; i++)
+        TEST_ASSERT(TSS2_RC_SUCCESS == commit(sapi_ctx, key_handle, &newest_counter));
+
+    // Topping up discards them, without using them.
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_ecdaa_commit_pool_fill(&pool, sapi_ctx));
+    TEST_ASSERT(0 < xtpm_ecdaa_commit_pool_count(&pool));
+
+    ret = xtpm_ecdaa_commit_pool_sign(&pool, sapi_ctx, challenge, &state, &digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT((uint16_t)(commit_used.counter - newest_counter) < 0x8000);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(sapi_ctx, key_handle));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+static
+int
+failing_challenge(const struct xtpm_ecdaa_commit *commit,
+                  const TPM2B_DIGEST *msg_digest,
+                  TPM2B_DIGEST *digest_out,
+                  void *user_data)
+{
+    struct challenge_state *state = user_data;
+    state->calls++;
+    state->last_counter = commit->counter;
+    (void)msg_digest;
+    (void)digest_out;
+
+    return -1;
+}
+
+static
+int
+oversized_challenge(const struct xtpm_ecdaa_commit *commit,
+                    const TPM2B_DIGEST *msg_digest,
+                    TPM2B_DIGEST *digest_out,
+                    void *user_data)
+{
+    struct challenge_state *state = user_data;
+    state->calls++;
+    state->last_counter = commit->counter;
+
+    // Fails to marshal, so the Sign never reaches the TPM.
+    *digest_out = *msg_digest;
+    digest_out->size = sizeof(digest_out->buffer) + 1;
+
+    return 0;
+}
+
+void failed_sign_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In ecdaa-test::failed_sign_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    TPM2_HANDLE key_handle;
+    create_ecdaa_key(sapi_ctx, TPM2_RH_OWNER, &key_handle);
+
+    struct xtpm_ecdaa_commit_pool pool;
+    xtpm_ecdaa_commit_pool_init(&pool, key_handle, NULL, NULL, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_ecdaa_commit_pool_fill(&pool, sapi_ctx));
+
+    TPM2B_DIGEST digest = {.size = 32};
+    memset(digest.buffer, 0x5A, digest.size);
+    struct challenge_state state = {0};
+    uint16_t oldest_counter = pool.commits[pool.first].counter;
+
+    // The challenge is required.
+    struct xtpm_ecdaa_commit commit_used;
+    TPMT_SIGNATURE signature = {};
+    TSS2_RC ret = xtpm_ecdaa_commit_pool_sign(&pool, sapi_ctx, NULL, NULL, &digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_BASE_RC_BAD_REFERENCE == ret);
+    TEST_ASSERT(XTPM_ECDAA_COMMIT_POOL_SIZE == xtpm_ecdaa_commit_pool_count(&pool));
+
+    // A failure other than a rejected commit puts the commit back, as the oldest.
+    ret = xtpm_ecdaa_commit_pool_sign(&pool, sapi_ctx, failing_challenge, &state, &digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS != ret);
+    TEST_ASSERT(oldest_counter == state.last_counter);
+    TEST_ASSERT(XTPM_ECDAA_COMMIT_POOL_SIZE == xtpm_ecdaa_commit_pool_count(&pool));
+
+    ret = xtpm_ecdaa_commit_pool_sign(&pool, sapi_ctx, oversized_challenge, &state, &digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS != ret);
+    TEST_ASSERT(oldest_counter == state.last_counter);
+    TEST_ASSERT(XTPM_ECDAA_COMMIT_POOL_SIZE == xtpm_ecdaa_commit_pool_count(&pool));
+
+    // The TPM still has the commit, so it's the one used next.
+    ret = xtpm_ecdaa_commit_pool_sign(&pool, sapi_ctx, challenge, &state, &digest, &commit_used, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(oldest_counter == commit_used.counter);
+    TEST_ASSERT(XTPM_ECDAA_COMMIT_POOL_SIZE - 1 == xtpm_ecdaa_commit_pool_count(&pool));
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(sapi_ctx, key_handle));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+TSS2_RC commit(TSS2_SYS_CONTEXT *sapi_ctx, TPM2_HANDLE key_handle, uint16_t *counter_out)
+{
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+    TPM2B_ECC_POINT P1 = {};
+    TPM2B_SENSITIVE_DATA s2 = {};
+    TPM2B_ECC_PARAMETER y2 = {};
+    TPM2B_ECC_POINT K = {};
+    TPM2B_ECC_POINT L = {};
+    TPM2B_ECC_POINT E = {};
+
+    return Tss2_Sys_Commit(sapi_ctx,
+                           key_handle,
+                           &sessionsData,
+                           &P1,
+                           &s2,
+                           &y2,
+                           &K,
+                           &L,
+                           &E,
+                           counter_out,
+                           NULL);
+}
+
+void create_ecdaa_key(TSS2_SYS_CONTEXT *sapi_ctx, TPMI_RH_HIERARCHY hierarchy, TPM2_HANDLE *handle_out)
+{
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+    TPM2B_SENSITIVE_CREATE inSensitive = {};
+
+    TPMA_OBJECT obj_attrs = TPMA_OBJECT_FIXEDTPM |
+                            TPMA_OBJECT_FIXEDPARENT |
+                            TPMA_OBJECT_SENSITIVEDATAORIGIN |
+                            TPMA_OBJECT_USERWITHAUTH |
+                            TPMA_OBJECT_SIGN_ENCRYPT;
+    TPM2B_PUBLIC in_public = {.publicArea = {.type=TPM2_ALG_ECC,
+                                             .nameAlg=TPM2_ALG_SHA256,
+                                             .objectAttributes=obj_attrs}};
+    in_public.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_ECDAA;
+    in_public.publicArea.parameters.eccDetail.scheme.details.ecdaa.hashAlg = TPM2_ALG_SHA256;
+    in_public.publicArea.parameters.eccDetail.scheme.details.ecdaa.count = 1;
+    in_public.publicArea.parameters.eccDetail.curveID = TPM2_ECC_BN_P256;
+    in_public.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+
+    TPM2B_DATA outsideInfo = {};
+    TPML_PCR_SELECTION creationPCR = {};
+    TPM2B_PUBLIC public_key = {};
+    TPM2B_CREATION_DATA creationData = {};
+    TPM2B_DIGEST creationHash = {};
+    TPMT_TK_CREATION creationTicket = {};
+    TPM2B_NAME name = {};
+
+    TSS2_RC ret = Tss2_Sys_CreatePrimary(sapi_ctx,
+                                         hierarchy,
+                                         &sessionsData,
+                                         &inSensitive,
+                                         &in_public,
+                                         &outsideInfo,
+                                         &creationPCR,
+                                         handle_out,
+                                         &public_key,
+                                         &creationData,
+                                         &creationHash,
+                                         &creationTicket,
+                                         &name,
+                                         NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+}
@@ -0,0 +1,319 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <xaptum-tpm/keys.h>
+#include <xaptum-tpm/nvram.h>
+#include <xaptum-tpm/provision.h>
+
+#include "test-utils.h"
+
+#include <pthread.h>
+
+/*
+ * Reports the stack and heap used by each API call,
+ * with a SAPI context in caller-owned (static) storage.
+ *
+ * The stack is measured by running each call on a thread whose stack
+ * was filled with a pattern, and finding how much of the pattern was overwritten.
+ * This includes the TCTI's stack (with the loopback TCTI, the whole simulated TPM).
+ *
+ * The heap is measured by counting calls to malloc and friends on that thread.
+ * With XTPM_NO_HEAP, there must be none.
+ *
+ * Each call's stack must stay within its cap below, which bounds the worst case
+ * for an unoptimized build with the loopback TCTI (other TCTIs use less).
+ */
+
+#define OP_STACK_SIZE (256 * 1024)
+#define STACK_PATTERN 0xA5
+
+// Leaves out e.g. the sanitizers, which replace malloc themselves.
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define COUNT_HEAP 1
+#endif
+
+// The sanitizers also grow the stack well past the caps.
+#if !defined(__SANITIZE_ADDRESS__)
+#define CHECK_STACK 1
+#endif
+
+struct footprint {
+    size_t stack_bytes;
+    size_t heap_allocs;
+    size_t heap_bytes;
+};
+
+struct op_state {
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    struct xtpm_key key;
+    TPM2_HANDLE key_handle;
+    unsigned char nv_data[1500];
+};
+
+typedef TSS2_RC (*op_fn)(struct op_state *state);
+
+struct op_thread_args {
+    op_fn fn;
+    struct op_state *state;
+    TSS2_RC ret;
+    struct footprint footprint;
+};
+
+static uint8_t op_stack_g[OP_STACK_SIZE] __attribute__((aligned(4096)));
+
+static uint8_t sapi_storage_g[8192] __attribute__((aligned(16)));
+
+#ifdef COUNT_HEAP
+static __thread int counting_g = 0;
+static __thread struct footprint *heap_footprint_g = NULL;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static
+void count_alloc(size_t size)
+{
+    if (counting_g) {
+        heap_footprint_g->heap_allocs++;
+        heap_footprint_g->heap_bytes += size;
+    }
+}
+
+void *malloc(size_t size)
+{
+    count_alloc(size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    count_alloc(count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count_alloc(size);
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+void footprint_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+int main()
+{
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    init_tcti(&tcti_ctx);
+
+    clear(tcti_ctx);
+    footprint_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    free_tcti(tcti_ctx);
+}
+
+static
+void *op_thread(void *arg)
+{
+    struct op_thread_args *args = arg;
+
+#ifdef COUNT_HEAP
+    heap_footprint_g = &args->footprint;
+    counting_g = 1;
+#endif
+
+    args->ret = args->fn(args->state);
+
+#ifdef COUNT_HEAP
+    counting_g = 0;
+#endif
+
+    return NULL;
+}
+
+static
+TSS2_RC run_op(op_fn fn, struct op_state *state, struct footprint *footprint_out)
+{
+    struct op_thread_args args = {.fn = fn, .state = state};
+
+    memset(op_stack_g, STACK_PATTERN, sizeof(op_stack_g));
+
+    pthread_attr_t attr;
+    TEST_ASSERT(0 == pthread_attr_init(&attr));
+    TEST_ASSERT(0 == pthread_attr_setstack(&attr, op_stack_g, sizeof(op_stack_g)));
+
+    pthread_t thread;
+    TEST_ASSERT(0 == pthread_create(&thread, &attr, op_thread, &args));
+    TEST_ASSERT(0 == pthread_join(thread, NULL));
+    pthread_attr_destroy(&attr);
+
+    // The stack grows down, so the lowest overwritten byte marks the deepest call.
+    size_t untouched = 0;
+    while (untouched < sizeof(op_stack_g) && STACK_PATTERN == op_stack_g[untouched])
+        untouched++;
+    TEST_ASSERT(untouched > 0);     // else the stack may have overflowed
+
+    args.footprint.stack_bytes = sizeof(op_stack_g) - untouched;
+    *footprint_out = args.footprint;
+
+    return args.ret;
+}
+
+static
+TSS2_RC nop_op(struct op_state *state)
+{
+    (void)state;
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC gen_key_op(struct op_state *state)
+{
+    return xtpm_gen_key_sapi(state->sapi_ctx, 0, 0, NULL, 0, &state->key);
+}
+
+static
+TSS2_RC load_key_op(struct op_state *state)
+{
+    return xtpm_load_key_sapi(state->sapi_ctx, &state->key, &state->key_handle);
+}
+
+static
+TSS2_RC flush_key_op(struct op_state *state)
+{
+    return xtpm_flush_key_sapi(state->sapi_ctx, state->key_handle);
+}
+
+static
+TSS2_RC sign_op(struct op_state *state)
+{
+    TPM2B_DIGEST digest = {.size = 32};
+    memset(digest.buffer, 0x5C, digest.size);
+
+    TPMT_SIGNATURE signature;
+    TSS2_RC ret = xtpm_sign_sapi(state->sapi_ctx, &state->key, &digest, &signature);
+    if (TSS2_RC_SUCCESS == ret && TPM2_ALG_ECDSA != signature.sigAlg)
+        return TSS2_BASE_RC_GENERAL_FAILURE;
+    return ret;
+}
+
+static
+TSS2_RC sign_raw_op(struct op_state *state)
+{
+    TPM2B_DIGEST digest = {.size = 32};
+    memset(digest.buffer, 0x5C, digest.size);
+
+    uint8_t signature[XTPM_RAW_SIGNATURE_SIZE];
+    return xtpm_sign_raw_sapi(state->sapi_ctx, &state->key, &digest, signature);
+}
+
+static
+TSS2_RC provision_nvram_op(struct op_state *state)
+{
+    struct xtpm_nv_entry entry = {
+        .index = XTPM_ROOT_XTTCERT_HANDLE,
+        .attributes = TPMA_NV_PPWRITE | TPMA_NV_AUTHREAD | TPMA_NV_PLATFORMCREATE,
+        .data = state->nv_data,
+        .data_size = sizeof(state->nv_data),
+    };
+
+    return xtpm_provision_nvram(&entry, 1, TPM2_RH_PLATFORM, NULL, 0, NULL, state->sapi_ctx);
+}
+
+static
+TSS2_RC write_nvram_op(struct op_state *state)
+{
+    return xtpm_write_nvram(state->nv_data,
+                            sizeof(state->nv_data),
+                            XTPM_ROOT_XTTCERT_HANDLE,
+                            TPM2_RH_PLATFORM,
+                            state->sapi_ctx);
+}
+
+static
+TSS2_RC read_nvram_op(struct op_state *state)
+{
+    unsigned char buf[sizeof(state->nv_data)];
+    TSS2_RC ret = xtpm_read_nvram(buf, sizeof(buf), XTPM_ROOT_XTTCERT_HANDLE, state->sapi_ctx);
+    if (TSS2_RC_SUCCESS == ret && 0 != memcmp(buf, state->nv_data, sizeof(buf)))
+        return TSS2_BASE_RC_GENERAL_FAILURE;
+    return ret;
+}
+
+void footprint_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In footprint-test::footprint_test...\n");
+
+    struct op_state state = {};
+
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    TEST_ASSERT(sapi_ctx_size <= sizeof(sapi_storage_g));
+
+    state.sapi_ctx = (TSS2_SYS_CONTEXT*)sapi_storage_g;
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_Initialize(state.sapi_ctx, sapi_ctx_size, tcti_ctx, &abi_version));
+
+    for (size_t i = 0; i < sizeof(state.nv_data); i++)
+        state.nv_data[i] = (unsigned char)i;
+
+    const struct {
+        const char *name;
+        op_fn fn;
+        size_t max_stack_bytes;
+    } ops[] = {
+        {"gen_key", gen_key_op, 8192},      // also creates the parent
+        {"gen_key", gen_key_op, 8192},
+        {"load_key", load_key_op, 5120},
+        {"flush_key", flush_key_op, 4096},
+        {"sign", sign_op, 6144},
+        {"sign_raw", sign_raw_op, 5632},
+        {"provision_nvram", provision_nvram_op, 7168},
+        {"write_nvram", write_nvram_op, 4096},
+        {"read_nvram", read_nvram_op, 7680},    // including its 1500-byte buffer
+    };
+
+    // The stack used by the thread itself, before calling the op.
+    struct footprint baseline;
+    TEST_ASSERT(TSS2_RC_SUCCESS == run_op(nop_op, &state, &baseline));
+
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        struct footprint footprint;
+        TSS2_RC ret = run_op(ops[i].fn, &state, &footprint);
+        TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+        footprint.stack_bytes -= baseline.stack_bytes;
+
+        printf("{\"op\":\"%s\",\"stack_bytes\":%zu", ops[i].name, footprint.stack_bytes);
+#ifdef COUNT_HEAP
+        printf(",\"heap_allocs\":%zu,\"heap_bytes\":%zu", footprint.heap_allocs, footprint.heap_bytes);
+#endif
+        printf("}\n");
+
+#if defined(COUNT_HEAP) && defined(XTPM_NO_HEAP)
+        TEST_ASSERT(0 == footprint.heap_allocs);
+#endif
+#ifdef CHECK_STACK
+        TEST_ASSERT(footprint.stack_bytes <= ops[i].max_stack_bytes);
+#endif
+    }
+
+    Tss2_Sys_Finalize(state.sapi_ctx);
+
+    printf("ok\n");
+}
@@ -0,0 +1,308 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <xaptum-tpm/hash.h>
+
+#include "test-utils.h"
+
+#define MESSAGE_LENGTH (3 * TPM2_MAX_DIGEST_BUFFER + 100)
+
+#define RC_FMT1_ERROR_MASK 0x03F
+#define RC_TICKET 0x016
+
+static uint8_t message[MESSAGE_LENGTH];
+
+void create_restricted_key(TSS2_SYS_CONTEXT *sapi_ctx, TPM2_HANDLE *handle_out);
+
+unsigned transient_count(TSS2_SYS_CONTEXT *sapi_ctx);
+
+void chunking_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void restricted_sign_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void generated_value_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void abort_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+int main()
+{
+    for (size_t i = 0; i < sizeof(message); i++)
+        message[i] = (uint8_t)(i * 7);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    init_tcti(&tcti_ctx);
+
+    clear(tcti_ctx);
+    chunking_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    restricted_sign_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    generated_value_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    abort_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    Tss2_Tcti_Finalize(tcti_ctx);
+    free(tcti_ctx);
+}
+
+void chunking_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In hash-test::chunking_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    struct xtpm_hash_sequence seq;
+    TSS2_RC ret = xtpm_hash_sequence_init(&seq, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(0 < seq.chunk_size && seq.chunk_size <= TPM2_MAX_DIGEST_BUFFER);
+
+    // The whole message at once
+    ret = xtpm_hash_sequence_start(&seq);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = xtpm_hash_sequence_update(&seq, message, sizeof(message));
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TPM2B_DIGEST expected = {.size = 0};
+    TPMT_TK_HASHCHECK expected_ticket = {};
+    ret = xtpm_hash_sequence_complete(&seq, TPM2_RH_OWNER, &expected, &expected_ticket);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(32 == expected.size);
+    TEST_ASSERT(TPM2_RH_OWNER == expected_ticket.hierarchy);
+
+    // Pieces that don't line up with the chunks, with empty ones in between
+    const size_t piece_lengths[] = {1, 63, 1000, 2048, 5};
+    for (size_t p = 0; p < sizeof(piece_lengths) / sizeof(piece_lengths[0]); p++) {
+        ret = xtpm_hash_sequence_start(&seq);
+        TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+        size_t offset = 0;
+        while (offset < sizeof(message)) {
+            size_t length = piece_lengths[p];
+            if (length > sizeof(message) - offset)
+                length = sizeof(message) - offset;
+            ret = xtpm_hash_sequence_update(&seq, message + offset, length);
+            TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+            ret = xtpm_hash_sequence_update(&seq, message, 0);
+            TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+            offset += length;
+        }
+
+        TPM2B_DIGEST digest = {.size = 0};
+        TPMT_TK_HASHCHECK ticket = {};
+        ret = xtpm_hash_sequence_complete(&seq, TPM2_RH_OWNER, &digest, &ticket);
+        TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+        TEST_ASSERT(expected.size == digest.size);
+        TEST_ASSERT(0 == memcmp(expected.buffer, digest.buffer, digest.size));
+        TEST_ASSERT(expected_ticket.digest.size == ticket.digest.size);
+        TEST_ASSERT(0 == memcmp(expected_ticket.digest.buffer, ticket.digest.buffer, ticket.digest.size));
+    }
+
+    // An empty message differs.
+    ret = xtpm_hash_sequence_start(&seq);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TPM2B_DIGEST empty = {.size = 0};
+    TPMT_TK_HASHCHECK empty_ticket = {};
+    ret = xtpm_hash_sequence_complete(&seq, TPM2_RH_OWNER, &empty, &empty_ticket);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(0 != memcmp(expected.buffer, empty.buffer, empty.size));
+
+    // Each completed sequence was flushed.
+    TEST_ASSERT(0 == transient_count(sapi_ctx));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void restricted_sign_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In hash-test::restricted_sign_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    TPM2_HANDLE key_handle;
+    create_restricted_key(sapi_ctx, &key_handle);
+
+    struct xtpm_hash_sequence seq;
+    TSS2_RC ret = xtpm_hash_sequence_init(&seq, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    ret = xtpm_hash_sequence_start(&seq);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = xtpm_hash_sequence_update(&seq, message, sizeof(message));
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TPMT_SIGNATURE signature = {};
+    ret = xtpm_hash_sequence_sign(&seq, key_handle, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(TPM2_ALG_ECDSA == signature.sigAlg);
+    TEST_ASSERT(0 != signature.signature.ecdsa.signatureR.size);
+
+    // The same digest, without its ticket, is refused.
+    ret = xtpm_hash_sequence_start(&seq);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = xtpm_hash_sequence_update(&seq, message, sizeof(message));
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TPM2B_DIGEST digest = {.size = 0};
+    ret = xtpm_hash_sequence_complete(&seq, TPM2_RH_NULL, &digest, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    TPMT_SIG_SCHEME inScheme = {.scheme = TPM2_ALG_ECDSA};
+    inScheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+    TPMT_TK_HASHCHECK null_ticket = {.tag = TPM2_ST_HASHCHECK, .hierarchy = TPM2_RH_NULL};
+    ret = Tss2_Sys_Sign(sapi_ctx, key_handle, &sessionsData, &digest, &inScheme, &null_ticket, &signature, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS != ret);
+    TEST_ASSERT(RC_TICKET == (ret & RC_FMT1_ERROR_MASK));
+
+    ret = Tss2_Sys_FlushContext(sapi_ctx, key_handle);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void generated_value_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In hash-test::generated_value_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    TPM2_HANDLE key_handle;
+    create_restricted_key(sapi_ctx, &key_handle);
+
+    struct xtpm_hash_sequence seq;
+    TSS2_RC ret = xtpm_hash_sequence_init(&seq, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // A message that looks like an attestation gets a NULL ticket, even split up,
+    // so a restricted key won't sign it.
+    const uint8_t generated[] = {0xff, 'T', 'C', 'G'};   // TPM2_GENERATED_VALUE
+    ret = xtpm_hash_sequence_start(&seq);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = xtpm_hash_sequence_update(&seq, generated, 1);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = xtpm_hash_sequence_update(&seq, generated + 1, sizeof(generated) - 1);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = xtpm_hash_sequence_update(&seq, message, sizeof(message));
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TPMT_SIGNATURE signature = {};
+    ret = xtpm_hash_sequence_sign(&seq, key_handle, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS != ret);
+    TEST_ASSERT(RC_TICKET == (ret & RC_FMT1_ERROR_MASK));
+
+    ret = Tss2_Sys_FlushContext(sapi_ctx, key_handle);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void abort_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In hash-test::abort_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    struct xtpm_hash_sequence seq;
+    TSS2_RC ret = xtpm_hash_sequence_init(&seq, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // Nothing to abort
+    ret = xtpm_hash_sequence_abort(&seq);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // Aborted with an update still in flight
+    ret = xtpm_hash_sequence_start(&seq);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(1 == transient_count(sapi_ctx));
+    ret = xtpm_hash_sequence_update(&seq, message, sizeof(message));
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(seq.update_pending);
+    ret = xtpm_hash_sequence_abort(&seq);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(0 == transient_count(sapi_ctx));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+unsigned transient_count(TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    TPMS_CAPABILITY_DATA capability_data;
+    TPMI_YES_NO more_data;
+    TSS2_RC ret = Tss2_Sys_GetCapability(sapi_ctx, NULL, TPM2_CAP_HANDLES, TPM2_HR_TRANSIENT, 8, &more_data, &capability_data, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    return capability_data.data.handles.count;
+}
+
+void create_restricted_key(TSS2_SYS_CONTEXT *sapi_ctx, TPM2_HANDLE *handle_out)
+{
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+    TPM2B_SENSITIVE_CREATE inSensitive = {};
+
+    TPMA_OBJECT obj_attrs = TPMA_OBJECT_FIXEDTPM |
+                            TPMA_OBJECT_FIXEDPARENT |
+                            TPMA_OBJECT_SENSITIVEDATAORIGIN |
+                            TPMA_OBJECT_USERWITHAUTH |
+                            TPMA_OBJECT_RESTRICTED |
+                            TPMA_OBJECT_SIGN_ENCRYPT;
+    TPM2B_PUBLIC in_public = {.publicArea = {.type=TPM2_ALG_ECC,
+                                             .nameAlg=TPM2_ALG_SHA256,
+                                             .objectAttributes=obj_attrs}};
+    in_public.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_ECDSA;
+    in_public.publicArea.parameters.eccDetail.scheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+    in_public.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    in_public.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+
+    TPM2B_DATA outsideInfo = {};
+    TPML_PCR_SELECTION creationPCR = {};
+    TPM2B_PUBLIC public_key = {};
+    TPM2B_CREATION_DATA creationData = {};
+    TPM2B_DIGEST creationHash = {};
+    TPMT_TK_CREATION creationTicket = {};
+    TPM2B_NAME name = {};
+
+    TSS2_RC ret = Tss2_Sys_CreatePrimary(sapi_ctx,
+                                         TPM2_RH_OWNER,
+                                         &sessionsData,
+                                         &inSensitive,
+                                         &in_public,
+                                         &outsideInfo,
+                                         &creationPCR,
+                                         handle_out,
+                                         &public_key,
+                                         &creationData,
+                                         &creationHash,
+                                         &creationTicket,
+                                         &name,
+                                         NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+}
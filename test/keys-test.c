@@ -20,6 +20,12 @@
 
 #include "test-utils.h"
 
+#ifdef XTPM_BUNDLED_TSS2
+#include "../src/internal/sha256.h"
+
+#include <tss2/tss2_sys_trace.h>
+#endif
+
 #include <stdbool.h>
 
 void default_parent_test(TSS2_TCTI_CONTEXT *tcti_ctx);
@@ -36,12 +42,18 @@ void flush_test(TSS2_TCTI_CONTEXT *tcti_ctx);
 
 void sign_test(TSS2_TCTI_CONTEXT *tcti_ctx);
 
+void sign_raw_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
 void multiple_gens_test(TSS2_TCTI_CONTEXT *tcti_ctx);
 
 void multiple_gens_diffparent_test(TSS2_TCTI_CONTEXT *tcti_ctx);
 
 void multiple_signs_test(TSS2_TCTI_CONTEXT *tcti_ctx);
 
+void sign_stream_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void sign_batch_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
 int main()
 {
     TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
@@ -65,6 +77,9 @@ int main()
     clear(tcti_ctx);
     sign_test(tcti_ctx);
 
+    clear(tcti_ctx);
+    sign_raw_test(tcti_ctx);
+
     clear(tcti_ctx);
     flush_test(tcti_ctx);
 
@@ -77,6 +92,12 @@ int main()
     clear(tcti_ctx);
     multiple_signs_test(tcti_ctx);
 
+    clear(tcti_ctx);
+    sign_stream_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    sign_batch_test(tcti_ctx);
+
     clear(tcti_ctx);
     Tss2_Tcti_Finalize(tcti_ctx);
     free(tcti_ctx);
@@ -193,6 +214,30 @@ void sign_test(TSS2_TCTI_CONTEXT *tcti_ctx)
     printf("ok\n");
 }
 
+void sign_raw_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In keys-test::sign_raw_test...\n");
+
+    struct xtpm_key key = {};
+
+    TSS2_RC ret = xtpm_gen_key(tcti_ctx, 0, 0, NULL, 0, &key);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TPM2B_DIGEST digest = {.size=32, .buffer={0xb5, 0xbb, 0x9d, 0x80}};
+    uint8_t signature[XTPM_RAW_SIGNATURE_SIZE];
+    memset(signature, 0, sizeof(signature));
+    ret = xtpm_sign_raw(tcti_ctx, &key, &digest, signature);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    uint8_t zeroes[XTPM_RAW_SIGNATURE_SIZE / 2] = {0};
+    TEST_ASSERT(0 != memcmp(zeroes, signature, sizeof(zeroes)));
+    TEST_ASSERT(0 != memcmp(zeroes, signature + sizeof(zeroes), sizeof(zeroes)));
+
+    printf("ok\n");
+}
+
 void flush_test(TSS2_TCTI_CONTEXT *tcti_ctx)
 {
     printf("In keys-test::flush_test...\n");
@@ -280,3 +325,143 @@ void multiple_signs_test(TSS2_TCTI_CONTEXT *tcti_ctx)
 
     printf("ok\n");
 }
+
+void sign_stream_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In keys-test::sign_stream_test...\n");
+
+    struct xtpm_key key = {};
+
+    TSS2_RC ret = xtpm_gen_key(tcti_ctx, 0, 0, NULL, 0, &key);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    uint8_t message[1000];
+    for (size_t i = 0; i < sizeof(message); i++)
+        message[i] = i;
+
+    // Pieces that straddle block boundaries, and an empty one
+    struct xtpm_sign_ctx ctx;
+    xtpm_sign_init(&ctx);
+    xtpm_sign_update(&ctx, message, 3);
+    xtpm_sign_update(&ctx, message + 3, 0);
+    xtpm_sign_update(&ctx, message + 3, 200);
+    xtpm_sign_update(&ctx, message + 203, sizeof(message) - 203);
+
+    TPMT_SIGNATURE signature;
+    ret = xtpm_sign_final(tcti_ctx, &key, &ctx, &signature);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TEST_ASSERT(signature.sigAlg == TPM2_ALG_ECDSA);
+    TEST_ASSERT(signature.signature.ecdsa.hash == TPM2_ALG_SHA256);
+    TEST_ASSERT(signature.signature.ecdsa.signatureR.size == 32);
+    TEST_ASSERT(signature.signature.ecdsa.signatureS.size == 32);
+
+    // An empty message
+    xtpm_sign_init(&ctx);
+    ret = xtpm_sign_final(tcti_ctx, &key, &ctx, &signature);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    printf("ok\n");
+}
+
+#ifdef XTPM_BUNDLED_TSS2
+struct signed_digests {
+    size_t count;
+    uint8_t digests[32][SHA256_DIGEST_SIZE];
+};
+
+// Collect the digest of each Sign command.
+static
+void
+collect_signed_digest(const struct xtpm_trace_event *event,
+                      void *user_data)
+{
+    struct signed_digests *signed_digests = user_data;
+    if (XTPM_TRACE_COMMAND != event->direction || TPM2_CC_Sign != event->command_code)
+        return;
+
+    // header, keyHandle, authorizationSize, authorization area, then digest
+    const uint8_t *auth_size = event->buffer + 10 + 4;
+    size_t digest_offset = 10 + 4 + 4 +
+        ((size_t)auth_size[0] << 24 | (size_t)auth_size[1] << 16 | (size_t)auth_size[2] << 8 | auth_size[3]);
+    TEST_ASSERT(digest_offset + 2 + SHA256_DIGEST_SIZE <= event->length);
+    TEST_ASSERT(signed_digests->count < sizeof(signed_digests->digests) / sizeof(signed_digests->digests[0]));
+    memcpy(signed_digests->digests[signed_digests->count++],
+           event->buffer + digest_offset + 2,
+           SHA256_DIGEST_SIZE);
+}
+#endif
+
+void sign_batch_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In keys-test::sign_batch_test...\n");
+
+    struct xtpm_key key = {};
+
+    TSS2_RC ret = xtpm_gen_key(tcti_ctx, 0, 0, NULL, 0, &key);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // Enough for several groups of hashes, the last one partial
+    enum { COUNT = 21 };
+    static uint8_t data[COUNT][300];
+    const uint8_t *messages[COUNT];
+    size_t lengths[COUNT];
+    for (size_t i = 0; i < COUNT; i++) {
+        memset(data[i], i, sizeof(data[i]));
+        messages[i] = data[i];
+        lengths[i] = (i * 41) % sizeof(data[i]);
+    }
+
+    TPMT_SIGNATURE signatures[COUNT];
+    ret = xtpm_sign_message_batch(tcti_ctx, &key, messages, lengths, COUNT, signatures);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    for (size_t i = 0; i < COUNT; i++) {
+        TEST_ASSERT(signatures[i].sigAlg == TPM2_ALG_ECDSA);
+        TEST_ASSERT(signatures[i].signature.ecdsa.hash == TPM2_ALG_SHA256);
+        TEST_ASSERT(signatures[i].signature.ecdsa.signatureR.size == 32);
+        TEST_ASSERT(signatures[i].signature.ecdsa.signatureS.size == 32);
+    }
+
+    // The key was flushed afterwards.
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+    TPMS_CAPABILITY_DATA capability_data;
+    TPMI_YES_NO more_data;
+    ret = Tss2_Sys_GetCapability(sapi_ctx, NULL, TPM2_CAP_HANDLES, TPM2_HR_TRANSIENT, 8, &more_data, &capability_data, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(0 == capability_data.data.handles.count);
+
+#ifdef XTPM_BUNDLED_TSS2
+    // Each message is signed with its own digest, however far ahead it was hashed.
+    struct signed_digests signed_digests = {0};
+    struct xtpm_trace_hook hook = {.fn = collect_signed_digest, .user_data = &signed_digests, .layers = XTPM_TRACE_LAYER_SAPI};
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_SetTraceHook(sapi_ctx, &hook));
+
+    ret = xtpm_sign_message_batch_sapi(sapi_ctx, &key, messages, lengths, COUNT, signatures);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(COUNT == signed_digests.count);
+
+    for (size_t i = 0; i < COUNT; i++) {
+        uint8_t expected[SHA256_DIGEST_SIZE];
+        sha256(messages[i], lengths[i], expected);
+        TEST_ASSERT(0 == memcmp(expected, signed_digests.digests[i], SHA256_DIGEST_SIZE));
+    }
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_SetTraceHook(sapi_ctx, NULL));
+#endif
+
+    free_sapi(sapi_ctx);
+
+    // Nothing to sign
+    ret = xtpm_sign_message_batch(tcti_ctx, &key, messages, lengths, 0, signatures);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    printf("ok\n");
+}
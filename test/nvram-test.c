@@ -33,6 +33,12 @@ void constants_test(void);
 
 void read_object_test(TSS2_TCTI_CONTEXT *tcti_ctx);
 
+void write_nvram_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void write_nvram_stream_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void nv_reader_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
 int main()
 {
     TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
@@ -43,6 +49,15 @@ int main()
     clear(tcti_ctx);
     read_object_test(tcti_ctx);
 
+    clear(tcti_ctx);
+    write_nvram_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    write_nvram_stream_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    nv_reader_test(tcti_ctx);
+
     clear(tcti_ctx);
     free_tcti(tcti_ctx);
 }
@@ -77,6 +92,151 @@ void read_object_test(TSS2_TCTI_CONTEXT *tcti_ctx)
     printf("ok\n");
 }
 
+void write_nvram_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In nvram-test::write_nvram_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    undefine_nv(sapi_ctx, XTPM_ROOT_XTTCERT_HANDLE);
+
+    // Larger than one NV_Write, to exercise the chunking
+    uint8_t data[1500];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)i;
+
+    int define_ret = define_nv(sapi_ctx, XTPM_ROOT_XTTCERT_HANDLE, sizeof(data));
+    TEST_ASSERT(define_ret == 0);
+
+    TSS2_RC write_ret = xtpm_write_nvram(data, sizeof(data), XTPM_ROOT_XTTCERT_HANDLE, TPM2_RH_PLATFORM, sapi_ctx);
+    TEST_ASSERT(write_ret == TSS2_RC_SUCCESS);
+
+    unsigned char buf[sizeof(data)];
+    TSS2_RC read_ret = xtpm_read_nvram(buf, sizeof(buf), XTPM_ROOT_XTTCERT_HANDLE, sapi_ctx);
+    TEST_ASSERT(read_ret == TSS2_RC_SUCCESS);
+    TEST_ASSERT(0 == memcmp(data, buf, sizeof(data)));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+struct counting_source {
+    uint8_t next_byte;
+    int calls;
+};
+
+static
+int read_counting(unsigned char *buf, uint16_t length, void *user_data)
+{
+    struct counting_source *source = user_data;
+
+    for (uint16_t i = 0; i < length; i++)
+        buf[i] = source->next_byte++;
+    source->calls++;
+
+    return 0;
+}
+
+void write_nvram_stream_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In nvram-test::write_nvram_stream_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    undefine_nv(sapi_ctx, XTPM_ROOT_XTTCERT_HANDLE);
+
+    uint16_t size = 1500;
+    int define_ret = define_nv(sapi_ctx, XTPM_ROOT_XTTCERT_HANDLE, size);
+    TEST_ASSERT(define_ret == 0);
+
+    struct counting_source source = {.next_byte = 7, .calls = 0};
+    TSS2_RC write_ret = xtpm_write_nvram_stream(read_counting,
+                                                &source,
+                                                size,
+                                                XTPM_ROOT_XTTCERT_HANDLE,
+                                                TPM2_RH_PLATFORM,
+                                                sapi_ctx);
+    TEST_ASSERT(write_ret == TSS2_RC_SUCCESS);
+    TEST_ASSERT(source.calls == (size + TPM2_MAX_NV_BUFFER_SIZE - 1) / TPM2_MAX_NV_BUFFER_SIZE);
+
+    unsigned char buf[1500];
+    TSS2_RC read_ret = xtpm_read_nvram(buf, size, XTPM_ROOT_XTTCERT_HANDLE, sapi_ctx);
+    TEST_ASSERT(read_ret == TSS2_RC_SUCCESS);
+    for (uint16_t i = 0; i < size; i++)
+        TEST_ASSERT(buf[i] == (uint8_t)(7 + i));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void nv_reader_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In nvram-test::nv_reader_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    undefine_nv(sapi_ctx, XTPM_ROOT_XTTCERT_HANDLE);
+
+    uint8_t data[1500];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)(i * 5);
+
+    int define_ret = define_nv(sapi_ctx, XTPM_ROOT_XTTCERT_HANDLE, sizeof(data));
+    TEST_ASSERT(define_ret == 0);
+
+    TSS2_RC write_ret = xtpm_write_nvram(data, sizeof(data), XTPM_ROOT_XTTCERT_HANDLE, TPM2_RH_PLATFORM, sapi_ctx);
+    TEST_ASSERT(write_ret == TSS2_RC_SUCCESS);
+
+    struct xtpm_nv_reader reader;
+    TSS2_RC ret = xtpm_nv_reader_open(&reader, XTPM_ROOT_XTTCERT_HANDLE, sapi_ctx);
+    TEST_ASSERT(ret == TSS2_RC_SUCCESS);
+    TEST_ASSERT(reader.size == sizeof(data));
+
+    size_t total = 0;
+    int chunks = 0;
+    const unsigned char *chunk;
+    uint16_t chunk_length;
+    do {
+        ret = xtpm_nv_reader_next(&reader, &chunk, &chunk_length);
+        TEST_ASSERT(ret == TSS2_RC_SUCCESS);
+        TEST_ASSERT(chunk_length <= TPM2_MAX_NV_BUFFER_SIZE);
+        TEST_ASSERT(total + chunk_length <= sizeof(data));
+        TEST_ASSERT(0 == memcmp(data + total, chunk, chunk_length));
+
+        total += chunk_length;
+        if (chunk_length)
+            chunks++;
+    } while (chunk_length > 0);
+
+    TEST_ASSERT(total == sizeof(data));
+    TEST_ASSERT(chunks == (sizeof(data) + TPM2_MAX_NV_BUFFER_SIZE - 1) / TPM2_MAX_NV_BUFFER_SIZE);
+
+    ret = xtpm_nv_reader_close(&reader);
+    TEST_ASSERT(ret == TSS2_RC_SUCCESS);
+
+    // Closing early must leave the SAPI context usable.
+    ret = xtpm_nv_reader_open(&reader, XTPM_ROOT_XTTCERT_HANDLE, sapi_ctx);
+    TEST_ASSERT(ret == TSS2_RC_SUCCESS);
+    ret = xtpm_nv_reader_next(&reader, &chunk, &chunk_length);
+    TEST_ASSERT(ret == TSS2_RC_SUCCESS);
+    ret = xtpm_nv_reader_close(&reader);
+    TEST_ASSERT(ret == TSS2_RC_SUCCESS);
+
+    unsigned char buf[sizeof(data)];
+    TSS2_RC read_ret = xtpm_read_nvram(buf, sizeof(buf), XTPM_ROOT_XTTCERT_HANDLE, sapi_ctx);
+    TEST_ASSERT(read_ret == TSS2_RC_SUCCESS);
+    TEST_ASSERT(0 == memcmp(data, buf, sizeof(data)));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
 void constants_test(void)
 {
     printf("In nvram-test::constants_test...\n");
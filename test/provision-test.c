@@ -0,0 +1,199 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <xaptum-tpm/nvram.h>
+#include <xaptum-tpm/provision.h>
+
+#include "test-utils.h"
+
+#define ATTRIBUTES (TPMA_NV_PPWRITE | TPMA_NV_AUTHREAD | TPMA_NV_PLATFORMCREATE)
+
+void undefine_nv(TSS2_SYS_CONTEXT *sapi_ctx, TPMI_RH_NV_INDEX index);
+
+void provision_fresh_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void provision_rerun_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void hierarchy_read_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+int main()
+{
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    init_tcti(&tcti_ctx);
+
+    clear(tcti_ctx);
+    provision_fresh_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    provision_rerun_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    hierarchy_read_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    free_tcti(tcti_ctx);
+}
+
+void provision_fresh_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In provision-test::provision_fresh_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    // Platform-hierarchy indices survive CLEAR, so start from scratch.
+    undefine_nv(sapi_ctx, XTPM_BASENAME_HANDLE);
+    undefine_nv(sapi_ctx, XTPM_ROOT_XTTCERT_HANDLE);
+
+    unsigned char basename[] = {'b', 'a', 's', 'e', 'n', 'a', 'm', 'e'};
+    unsigned char cert[1500];
+    for (size_t i = 0; i < sizeof(cert); i++)
+        cert[i] = (unsigned char)(i * 3);
+
+    struct xtpm_nv_entry entries[] = {
+        {XTPM_BASENAME_HANDLE, ATTRIBUTES, basename, sizeof(basename)},
+        {XTPM_ROOT_XTTCERT_HANDLE, ATTRIBUTES, cert, sizeof(cert)},
+    };
+    enum xtpm_provision_action actions[2];
+
+    TSS2_RC ret = xtpm_provision_nvram(entries, 2, TPM2_RH_PLATFORM, NULL, 0, actions, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(XTPM_PROVISION_DEFINED == actions[0]);
+    TEST_ASSERT(XTPM_PROVISION_DEFINED == actions[1]);
+
+    unsigned char buf[sizeof(cert)];
+    ret = xtpm_read_nvram(buf, sizeof(basename), XTPM_BASENAME_HANDLE, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(0 == memcmp(basename, buf, sizeof(basename)));
+
+    ret = xtpm_read_nvram(buf, sizeof(cert), XTPM_ROOT_XTTCERT_HANDLE, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(0 == memcmp(cert, buf, sizeof(cert)));
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void provision_rerun_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In provision-test::provision_rerun_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    undefine_nv(sapi_ctx, XTPM_GPK_HANDLE);
+    undefine_nv(sapi_ctx, XTPM_CRED_HANDLE);
+    undefine_nv(sapi_ctx, XTPM_SERVER_ID_HANDLE);
+
+    unsigned char gpk[258];
+    memset(gpk, 0x11, sizeof(gpk));
+    unsigned char cred[260];
+    memset(cred, 0x22, sizeof(cred));
+    unsigned char server_id[16];
+    memset(server_id, 0x33, sizeof(server_id));
+
+    struct xtpm_nv_entry entries[] = {
+        {XTPM_GPK_HANDLE, ATTRIBUTES, gpk, sizeof(gpk)},
+        {XTPM_CRED_HANDLE, ATTRIBUTES, cred, sizeof(cred)},
+        {XTPM_SERVER_ID_HANDLE, ATTRIBUTES, server_id, sizeof(server_id)},
+    };
+    enum xtpm_provision_action actions[3];
+
+    TSS2_RC ret = xtpm_provision_nvram(entries, 3, TPM2_RH_PLATFORM, NULL, 0, actions, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // Change the contents of one entry and the size of another.
+    cred[100] = 0x44;
+    entries[2].data_size = 8;
+
+    ret = xtpm_provision_nvram(entries, 3, TPM2_RH_PLATFORM, NULL, 0, actions, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(XTPM_PROVISION_UNCHANGED == actions[0]);
+    TEST_ASSERT(XTPM_PROVISION_WRITTEN == actions[1]);
+    TEST_ASSERT(XTPM_PROVISION_REDEFINED == actions[2]);
+
+    unsigned char buf[sizeof(cred)];
+    ret = xtpm_read_nvram(buf, sizeof(cred), XTPM_CRED_HANDLE, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(0 == memcmp(cred, buf, sizeof(cred)));
+
+    uint16_t size = 0;
+    ret = xtpm_get_nvram_size(&size, XTPM_SERVER_ID_HANDLE, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(8 == size);
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void hierarchy_read_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In provision-test::hierarchy_read_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(tcti_ctx, &sapi_ctx);
+
+    // Left over as a platform index by an earlier test
+    undefine_nv(sapi_ctx, XTPM_SERVER_ID_HANDLE);
+
+    unsigned char server_id[16];
+    memset(server_id, 0x55, sizeof(server_id));
+
+    // Only the owner may read (and write) it, not the index's own auth.
+    struct xtpm_nv_entry entries[] = {
+        {XTPM_SERVER_ID_HANDLE, TPMA_NV_OWNERWRITE | TPMA_NV_OWNERREAD, server_id, sizeof(server_id)},
+    };
+    enum xtpm_provision_action actions[1];
+
+    TSS2_RC ret = xtpm_provision_nvram(entries, 1, TPM2_RH_OWNER, NULL, 0, actions, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(XTPM_PROVISION_DEFINED == actions[0]);
+
+    ret = xtpm_provision_nvram(entries, 1, TPM2_RH_OWNER, NULL, 0, actions, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(XTPM_PROVISION_UNCHANGED == actions[0]);
+
+    server_id[0] = 0x66;
+    ret = xtpm_provision_nvram(entries, 1, TPM2_RH_OWNER, NULL, 0, actions, sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(XTPM_PROVISION_WRITTEN == actions[0]);
+
+    // Under the platform, nothing could read it back.
+    ret = xtpm_provision_nvram(entries, 1, TPM2_RH_PLATFORM, NULL, 0, actions, sapi_ctx);
+    TEST_ASSERT(TSS2_BASE_RC_BAD_VALUE == ret);
+
+    free_sapi(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void undefine_nv(TSS2_SYS_CONTEXT *sapi_ctx, TPMI_RH_NV_INDEX index)
+{
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    // Ignore failure: the index may not be defined.
+    (void)Tss2_Sys_NV_UndefineSpace(sapi_ctx,
+                                    TPM2_RH_PLATFORM,
+                                    index,
+                                    &sessionsData,
+                                    &sessionsDataOut);
+}
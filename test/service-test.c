@@ -0,0 +1,254 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <xaptum-tpm/service.h>
+
+#include "test-utils.h"
+
+#define JOB_COUNT 16
+
+// digest = sha-256("foo")
+static const TPM2B_DIGEST digest_g = {.size=32,
+                                      .buffer={0xb5, 0xbb, 0x9d, 0x80, 0x14, 0xa0, 0xf9, 0xb1, 0xd6, 0x1e, 0x21, 0xe7, 0x96, 0xd7, 0x8d, 0xcc,
+                                               0xdf, 0x13, 0x52, 0xf2, 0x3c, 0xd3, 0x28, 0x12, 0xf4, 0x85, 0x0b, 0x87, 0x8a, 0xe4, 0x94, 0x4c}};
+
+void sign_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void callback_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void read_nvram_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void queue_depth_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+void destroy_test(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+int main()
+{
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    init_tcti(&tcti_ctx);
+
+    clear(tcti_ctx);
+    sign_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    callback_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    read_nvram_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    queue_depth_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    destroy_test(tcti_ctx);
+
+    clear(tcti_ctx);
+    Tss2_Tcti_Finalize(tcti_ctx);
+    free(tcti_ctx);
+}
+
+static
+void gen_key(struct xtpm_service *service, struct xtpm_key *key)
+{
+    struct xtpm_job job;
+    TSS2_RC ret = xtpm_service_gen_key(service, &job, 0, 0, NULL, 0, key, NULL, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    ret = xtpm_job_wait(&job);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(xtpm_job_done(&job));
+    TEST_ASSERT(job.submit_ns <= job.start_ns && job.start_ns <= job.finish_ns);
+}
+
+void sign_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In service-test::sign_test...\n");
+
+    struct xtpm_service *service = NULL;
+    TSS2_RC ret = xtpm_service_create(&service, tcti_ctx, -1, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    struct xtpm_key key = {};
+    gen_key(service, &key);
+
+    struct xtpm_job jobs[JOB_COUNT];
+    TPMT_SIGNATURE signatures[JOB_COUNT];
+    for (int i = 0; i < JOB_COUNT; i++) {
+        ret = xtpm_service_sign(service, &jobs[i], &key, &digest_g, &signatures[i], NULL, NULL);
+        TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    }
+
+    for (int i = 0; i < JOB_COUNT; i++) {
+        ret = xtpm_job_wait(&jobs[i]);
+        TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+        TEST_ASSERT(signatures[i].sigAlg == TPM2_ALG_ECDSA);
+        TEST_ASSERT(signatures[i].signature.ecdsa.signatureR.size == 32);
+    }
+
+    struct xtpm_service_stats stats;
+    xtpm_service_get_stats(service, &stats);
+    TEST_ASSERT(1 + JOB_COUNT == stats.submitted);
+    TEST_ASSERT(1 + JOB_COUNT == stats.completed);
+    TEST_ASSERT(0 == stats.queue_depth);
+    TEST_ASSERT(1 <= stats.max_queue_depth);
+    TEST_ASSERT(stats.max_wait_ns <= stats.total_wait_ns);
+
+    xtpm_service_destroy(service);
+
+    printf("ok\n");
+}
+
+struct callback_state {
+    int calls;
+    TSS2_RC rc;
+};
+
+static
+void count_callback(struct xtpm_job *job, void *user_data)
+{
+    struct callback_state *state = user_data;
+    state->calls++;
+    state->rc = job->rc;
+}
+
+void callback_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In service-test::callback_test...\n");
+
+    // Pinned to CPU 0, where supported
+    struct xtpm_service *service = NULL;
+    TSS2_RC ret = xtpm_service_create(&service, tcti_ctx, 0, 0);
+    if (TSS2_BASE_RC_NOT_SUPPORTED == ret)
+        ret = xtpm_service_create(&service, tcti_ctx, -1, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    struct xtpm_key key = {};
+    gen_key(service, &key);
+
+    struct callback_state state = {.calls = 0, .rc = TSS2_BASE_RC_GENERAL_FAILURE};
+    struct xtpm_job job;
+    TPMT_SIGNATURE signature;
+    ret = xtpm_service_sign(service, &job, &key, &digest_g, &signature, count_callback, &state);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // The callback has run by the time the job is done.
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_job_wait(&job));
+    TEST_ASSERT(1 == state.calls);
+    TEST_ASSERT(TSS2_RC_SUCCESS == state.rc);
+
+    xtpm_service_destroy(service);
+
+    printf("ok\n");
+}
+
+void read_nvram_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In service-test::read_nvram_test...\n");
+
+    struct xtpm_service *service = NULL;
+    TSS2_RC ret = xtpm_service_create(&service, tcti_ctx, -1, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // The index isn't defined, so this fails, but on the TPM.
+    unsigned char out[32];
+    struct xtpm_job job;
+    ret = xtpm_service_read_nvram(service, &job, out, sizeof(out), 0x1500000, NULL, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(TSS2_RC_SUCCESS != xtpm_job_wait(&job));
+
+    xtpm_service_destroy(service);
+
+    printf("ok\n");
+}
+
+struct submit_state {
+    struct xtpm_service *service;
+    const struct xtpm_key *key;
+    struct xtpm_job jobs[2];
+    TPMT_SIGNATURE signatures[2];
+    TSS2_RC submit_rcs[2];
+};
+
+static
+void submit_callback(struct xtpm_job *job, void *user_data)
+{
+    (void)job;
+
+    // Nothing else is queued while the service thread is here,
+    // so the first submit fills the queue and the second fails.
+    struct submit_state *state = user_data;
+    for (int i = 0; i < 2; i++)
+        state->submit_rcs[i] = xtpm_service_sign(state->service, &state->jobs[i], state->key,
+                                                 &digest_g, &state->signatures[i], NULL, NULL);
+}
+
+void queue_depth_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In service-test::queue_depth_test...\n");
+
+    struct xtpm_service *service = NULL;
+    TSS2_RC ret = xtpm_service_create(&service, tcti_ctx, -1, 1);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    struct xtpm_key key = {};
+    gen_key(service, &key);
+
+    struct submit_state state = {.service = service, .key = &key};
+    struct xtpm_job job;
+    TPMT_SIGNATURE signature;
+    ret = xtpm_service_sign(service, &job, &key, &digest_g, &signature, submit_callback, &state);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_job_wait(&job));
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == state.submit_rcs[0]);
+    TEST_ASSERT(TSS2_BASE_RC_TRY_AGAIN == state.submit_rcs[1]);
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_job_wait(&state.jobs[0]));
+
+    xtpm_service_destroy(service);
+
+    printf("ok\n");
+}
+
+void destroy_test(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    printf("In service-test::destroy_test...\n");
+
+    struct xtpm_service *service = NULL;
+    TSS2_RC ret = xtpm_service_create(&service, tcti_ctx, -1, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    struct xtpm_key key = {};
+    gen_key(service, &key);
+
+    struct xtpm_job jobs[JOB_COUNT];
+    TPMT_SIGNATURE signatures[JOB_COUNT];
+    for (int i = 0; i < JOB_COUNT; i++) {
+        ret = xtpm_service_sign(service, &jobs[i], &key, &digest_g, &signatures[i], NULL, NULL);
+        TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    }
+
+    // Queued jobs are finished before stopping.
+    xtpm_service_destroy(service);
+
+    for (int i = 0; i < JOB_COUNT; i++) {
+        TEST_ASSERT(xtpm_job_done(&jobs[i]));
+        TEST_ASSERT(TSS2_RC_SUCCESS == jobs[i].rc);
+    }
+
+    printf("ok\n");
+}
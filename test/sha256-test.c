@@ -0,0 +1,192 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <xaptum-tpm/keys.h>
+
+#include "../src/internal/sha256.h"
+
+#include "test-utils.h"
+
+static const enum sha256_impl impls[] = {SHA256_IMPL_GENERIC, SHA256_IMPL_SHANI, SHA256_IMPL_AVX2, SHA256_IMPL_AUTO};
+
+static void from_hex(const char *hex, uint8_t *out);
+
+void vectors_test();
+
+void streaming_test();
+
+void many_test();
+
+void sign_update_test();
+
+int main()
+{
+    vectors_test();
+
+    streaming_test();
+
+    many_test();
+
+    sign_update_test();
+}
+
+static
+void from_hex(const char *hex, uint8_t *out)
+{
+    for (size_t i = 0; hex[2 * i]; i++) {
+        unsigned byte;
+        sscanf(hex + 2 * i, "%2x", &byte);
+        out[i] = byte;
+    }
+}
+
+void vectors_test()
+{
+    printf("In sha256-test::vectors_test...\n");
+
+    static uint8_t million_a[1000000];
+    memset(million_a, 'a', sizeof(million_a));
+
+    const struct {
+        const uint8_t *message;
+        size_t length;
+        const char *digest;
+    } vectors[] = {
+        {(const uint8_t*)"abc", 3,
+         "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {(const uint8_t*)"", 0,
+         "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {(const uint8_t*)"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56,
+         "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {million_a, sizeof(million_a),
+         "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (!sha256_impl_supported(impls[i])) {
+            printf("\timplementation %d not supported, skipping\n", impls[i]);
+            continue;
+        }
+
+        for (size_t v = 0; v < sizeof(vectors) / sizeof(vectors[0]); v++) {
+            uint8_t expected[SHA256_DIGEST_SIZE];
+            from_hex(vectors[v].digest, expected);
+
+            uint8_t digest[1][SHA256_DIGEST_SIZE];
+            sha256_many_impl(impls[i], &vectors[v].message, &vectors[v].length, 1, digest);
+            TEST_ASSERT(0 == memcmp(expected, digest[0], SHA256_DIGEST_SIZE));
+        }
+    }
+
+    printf("ok\n");
+}
+
+void streaming_test()
+{
+    printf("In sha256-test::streaming_test...\n");
+
+    uint8_t message[300];
+    for (size_t i = 0; i < sizeof(message); i++)
+        message[i] = i * 7;
+
+    // Every split into full blocks and a tail gives the one-shot digest.
+    for (size_t length = 0; length <= sizeof(message); length += 13) {
+        uint8_t expected[SHA256_DIGEST_SIZE];
+        sha256(message, length, expected);
+
+        uint32_t state[8];
+        sha256_init_state(state);
+        size_t full = length / SHA256_BLOCK_SIZE;
+        for (size_t block = 0; block < full; block++)
+            sha256_blocks(state, message + block * SHA256_BLOCK_SIZE, 1);
+
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256_finish(state, length, message + full * SHA256_BLOCK_SIZE, length % SHA256_BLOCK_SIZE, digest);
+        TEST_ASSERT(0 == memcmp(expected, digest, SHA256_DIGEST_SIZE));
+    }
+
+    printf("ok\n");
+}
+
+void many_test()
+{
+    printf("In sha256-test::many_test...\n");
+
+    // More messages than lanes, with lengths around the padding boundaries,
+    // so lanes finish at different times and get refilled.
+    enum { COUNT = 3 * SHA256_LANES + 5 };
+    static uint8_t data[COUNT][600];
+    const uint8_t *messages[COUNT];
+    size_t lengths[COUNT];
+    const size_t boundary_lengths[] = {0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 600};
+    for (size_t i = 0; i < COUNT; i++) {
+        for (size_t j = 0; j < sizeof(data[i]); j++)
+            data[i][j] = i + 3 * j;
+        messages[i] = data[i];
+        lengths[i] = (i < sizeof(boundary_lengths) / sizeof(boundary_lengths[0])) ? boundary_lengths[i] : (i * 37) % 600;
+    }
+
+    uint8_t expected[COUNT][SHA256_DIGEST_SIZE];
+    sha256_many_impl(SHA256_IMPL_GENERIC, messages, lengths, COUNT, expected);
+
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (!sha256_impl_supported(impls[i]))
+            continue;
+
+        uint8_t digests[COUNT][SHA256_DIGEST_SIZE];
+        memset(digests, 0, sizeof(digests));
+        sha256_many_impl(impls[i], messages, lengths, COUNT, digests);
+        TEST_ASSERT(0 == memcmp(expected, digests, sizeof(digests)));
+    }
+
+    // Fewer messages than lanes
+    uint8_t digests[3][SHA256_DIGEST_SIZE];
+    sha256_many(messages, lengths, 3, digests);
+    TEST_ASSERT(0 == memcmp(expected, digests, sizeof(digests)));
+
+    printf("ok\n");
+}
+
+void sign_update_test()
+{
+    printf("In sha256-test::sign_update_test...\n");
+
+    uint8_t message[500];
+    for (size_t i = 0; i < sizeof(message); i++)
+        message[i] = i * 11;
+
+    uint8_t expected[SHA256_DIGEST_SIZE];
+    sha256(message, sizeof(message), expected);
+
+    // The digest doesn't depend on how the message is split up.
+    const size_t piece_sizes[] = {1, 7, 63, 64, 65, 130, sizeof(message)};
+    for (size_t p = 0; p < sizeof(piece_sizes) / sizeof(piece_sizes[0]); p++) {
+        struct xtpm_sign_ctx ctx;
+        xtpm_sign_init(&ctx);
+        for (size_t done = 0; done < sizeof(message); done += piece_sizes[p]) {
+            size_t left = sizeof(message) - done;
+            xtpm_sign_update(&ctx, message + done, left < piece_sizes[p] ? left : piece_sizes[p]);
+        }
+
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        sha256_finish(ctx.hash_state, ctx.hashed_length, ctx.partial_block, ctx.hashed_length % SHA256_BLOCK_SIZE, digest);
+        TEST_ASSERT(0 == memcmp(expected, digest, SHA256_DIGEST_SIZE));
+    }
+
+    printf("ok\n");
+}
@@ -20,8 +20,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <tss2/tss2_tcti_mssim.h>
-#include <tss2/tss2_tcti_device.h>
 #include <tss2/tss2_sys.h>
 
 char *mssim_conf_g = "host=localhost,port=2321";
@@ -50,33 +48,8 @@ char *handle_filename_g = "handle.txt";
     .count = 1                          \
 }
 
-static inline
-void init_tcti(TSS2_TCTI_CONTEXT **tcti_ctx)
-{
-    TSS2_RC init_ret;
-
-#ifdef USE_TCP_TPM
-    size_t ctx_size;
-    init_ret = Tss2_Tcti_Mssim_Init(NULL, &ctx_size, mssim_conf_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-
-    *tcti_ctx = calloc(ctx_size, 1);
-    TEST_ASSERT(NULL != *tcti_ctx);
-
-    init_ret = Tss2_Tcti_Mssim_Init(*tcti_ctx, &ctx_size, mssim_conf_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-#else
-    size_t ctx_size;
-    init_ret = Tss2_Tcti_Device_Init(NULL, &ctx_size, mssim_conf_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-
-    *tcti_ctx = calloc(ctx_size, 1);
-    TEST_ASSERT(NULL != *tcti_ctx);
-
-    init_ret = Tss2_Tcti_Device_Init(*tcti_ctx, &ctx_size, dev_file_path_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-#endif
-}
+#define TCTI_UTILS_ASSERT TEST_ASSERT
+#include "../tss2/test/tcti-utils.h"
 
 static inline
 void free_tcti(TSS2_TCTI_CONTEXT *tcti_ctx)
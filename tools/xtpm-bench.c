@@ -0,0 +1,683 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+/*
+ * Throughput and latency of the xtpm_* operations, and of raw Tss2_Sys_* calls.
+ *
+ * Usage: xtpm-bench [-d device_path | -m mssim_conf | -l loopback_conf]
+ *                   [-t threads] [-s seconds] [-o op[,op...]]
+ *                   [-b baseline.json] [-r max_regression_percent]
+ *
+ * Each operation is run for `seconds` on each of `threads` threads,
+ * each with its own TCTI. Results are written to stdout as JSON,
+ * which can be saved and passed back with -b as the baseline for a later run.
+ * With -b, the exit status is 2 if any operation's ops/sec dropped
+ * by more than `max_regression_percent` (default 10) from the baseline.
+ *
+ * Setup (outside the timed region) creates the parent key, if missing,
+ * and defines the group public key NV index, if missing (undefining it afterwards).
+ */
+
+#include <xaptum-tpm/keys.h>
+#include <xaptum-tpm/nvram.h>
+#include <xaptum-tpm/provision.h>
+
+#include <tss2/tss2_tcti_device.h>
+#include <tss2/tss2_tcti_mssim.h>
+#ifdef TCTI_LOOPBACK
+#include <tss2/tss2_tcti_loopback.h>
+#endif
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+#define DEFAULT_SECONDS 5
+#define DEFAULT_MAX_REGRESSION_PERCENT 10.0
+#define GPK_SIZE 258
+#define GPK_ATTRIBUTES (TPMA_NV_PPWRITE | TPMA_NV_AUTHREAD | TPMA_NV_PLATFORMCREATE)
+
+enum tcti_type {
+    TCTI_TYPE_DEVICE,
+    TCTI_TYPE_MSSIM,
+    TCTI_TYPE_LOOPBACK,
+};
+
+static const char *tcti_names[] = {
+    [TCTI_TYPE_DEVICE] = "device",
+    [TCTI_TYPE_MSSIM] = "mssim",
+    [TCTI_TYPE_LOOPBACK] = "loopback",
+};
+
+struct bench_config {
+    enum tcti_type tcti;
+    const char *tcti_conf;
+    const char *password;
+};
+
+struct worker;
+
+struct op_info {
+    const char *name;
+    int (*fn)(struct worker *);
+    void (*after)(struct worker *);     // untimed, e.g. to free TPM resources
+};
+
+// Per-thread state, set up before any timing starts.
+struct worker {
+    const struct bench_config *config;
+    TSS2_TCTI_CONTEXT *tcti_ctx;
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    struct xtpm_key key;
+    int defined_gpk;        // whether setup defined the GPK index, so cleanup should undefine it
+
+    // Results of the operation being run
+    const struct op_info *op;
+    uint64_t end_ns;
+    TPM2_HANDLE loaded_handle;
+    uint64_t *samples;      // latencies, in ns, of successful calls
+    size_t sample_count;
+    size_t sample_capacity;
+    uint64_t errors;
+    TSS2_RC last_error;
+};
+
+
+static
+uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static
+void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-d device_path | -m mssim_conf | -l loopback_conf] [-t threads] [-s seconds]\n"
+                    "       %*s [-o op[,op...]] [-b baseline.json] [-r max_regression_percent]\n",
+                    prog, (int)strlen(prog), "");
+}
+
+/*
+ * Operations. Each returns 0 on success,
+ * and is timed from the start to the end of the call.
+ */
+
+static
+int
+op_gen_key(struct worker *w)
+{
+    struct xtpm_key key;
+    TSS2_RC ret = xtpm_gen_key(w->tcti_ctx, 0, 0, w->config->password, strlen(w->config->password), &key);
+    w->last_error = ret;
+    return TSS2_RC_SUCCESS != ret;
+}
+
+static
+int
+op_load_key(struct worker *w)
+{
+    TPM2_HANDLE handle;
+    TSS2_RC ret = xtpm_load_key(w->tcti_ctx, &w->key, &handle);
+    w->last_error = ret;
+    if (TSS2_RC_SUCCESS != ret)
+        return 1;
+
+    w->loaded_handle = handle;
+
+    return 0;
+}
+
+static
+void
+flush_loaded_key(struct worker *w)
+{
+    xtpm_flush_key(w->tcti_ctx, w->loaded_handle);
+}
+
+static
+int
+op_sign(struct worker *w)
+{
+    TPM2B_DIGEST digest = {.size = 32};
+    memset(digest.buffer, 0x5A, digest.size);
+
+    TPMT_SIGNATURE signature;
+    TSS2_RC ret = xtpm_sign(w->tcti_ctx, &w->key, &digest, &signature);
+    w->last_error = ret;
+    return TSS2_RC_SUCCESS != ret;
+}
+
+static
+int
+op_read_object(struct worker *w)
+{
+    unsigned char buffer[GPK_SIZE];
+    uint16_t length;
+    TSS2_RC ret = xtpm_read_object(buffer, sizeof(buffer), &length, XTPM_GROUP_PUBLIC_KEY, w->sapi_ctx);
+    w->last_error = ret;
+    return TSS2_RC_SUCCESS != ret;
+}
+
+static
+int
+op_sys_readpublic(struct worker *w)
+{
+    TPM2B_PUBLIC public_area = {.size = 0};
+    TPM2B_NAME name = {.size = 0};
+    TPM2B_NAME qualified_name = {.size = 0};
+
+    TSS2_RC ret = Tss2_Sys_ReadPublic(w->sapi_ctx,
+                                      w->key.parent_handle,
+                                      NULL,
+                                      &public_area,
+                                      &name,
+                                      &qualified_name,
+                                      NULL);
+    w->last_error = ret;
+    return TSS2_RC_SUCCESS != ret;
+}
+
+static
+int
+op_sys_nv_readpublic(struct worker *w)
+{
+    TPM2B_NV_PUBLIC nv_public = {.size = 0};
+    TPM2B_NAME nv_name = {.size = 0};
+
+    TSS2_RC ret = Tss2_Sys_NV_ReadPublic(w->sapi_ctx,
+                                         XTPM_GPK_HANDLE,
+                                         NULL,
+                                         &nv_public,
+                                         &nv_name,
+                                         NULL);
+    w->last_error = ret;
+    return TSS2_RC_SUCCESS != ret;
+}
+
+static const struct op_info ops[] = {
+    {"gen_key",             op_gen_key,             NULL},
+    {"load_key",            op_load_key,            flush_loaded_key},
+    {"sign",                op_sign,                NULL},
+    {"read_object",         op_read_object,         NULL},
+    {"sys_readpublic",      op_sys_readpublic,      NULL},
+    {"sys_nv_readpublic",   op_sys_nv_readpublic,   NULL},
+};
+
+#define OP_COUNT (sizeof(ops) / sizeof(ops[0]))
+
+/*
+ * Setup and cleanup.
+ */
+
+static
+TSS2_RC
+init_tcti(const struct bench_config *config,
+          TSS2_TCTI_CONTEXT **tcti_ctx)
+{
+    TSS2_RC ret;
+    size_t ctx_size;
+
+    switch (config->tcti) {
+        case TCTI_TYPE_MSSIM:
+            ret = Tss2_Tcti_Mssim_Init(NULL, &ctx_size, config->tcti_conf);
+            if (TSS2_RC_SUCCESS != ret)
+                return ret;
+
+            *tcti_ctx = calloc(ctx_size, 1);
+            if (NULL == *tcti_ctx)
+                return TSS2_BASE_RC_GENERAL_FAILURE;
+
+            return Tss2_Tcti_Mssim_Init(*tcti_ctx, &ctx_size, config->tcti_conf);
+#ifdef TCTI_LOOPBACK
+        case TCTI_TYPE_LOOPBACK:
+            ret = Tss2_Tcti_Loopback_Init(NULL, &ctx_size, config->tcti_conf);
+            if (TSS2_RC_SUCCESS != ret)
+                return ret;
+
+            *tcti_ctx = calloc(ctx_size, 1);
+            if (NULL == *tcti_ctx)
+                return TSS2_BASE_RC_GENERAL_FAILURE;
+
+            return Tss2_Tcti_Loopback_Init(*tcti_ctx, &ctx_size, config->tcti_conf);
+#endif
+        default:
+            ret = Tss2_Tcti_Device_Init(NULL, &ctx_size, config->tcti_conf);
+            if (TSS2_RC_SUCCESS != ret)
+                return ret;
+
+            *tcti_ctx = calloc(ctx_size, 1);
+            if (NULL == *tcti_ctx)
+                return TSS2_BASE_RC_GENERAL_FAILURE;
+
+            return Tss2_Tcti_Device_Init(*tcti_ctx, &ctx_size, config->tcti_conf);
+    }
+}
+
+static
+TSS2_RC
+setup_worker(struct worker *w)
+{
+    TSS2_RC ret = init_tcti(w->config, &w->tcti_ctx);
+    if (TSS2_RC_SUCCESS != ret) {
+        fprintf(stderr, "Error initializing TCTI: 0x%x\n", ret);
+        return ret;
+    }
+
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    w->sapi_ctx = calloc(sapi_ctx_size, 1);
+    if (NULL == w->sapi_ctx)
+        return TSS2_BASE_RC_GENERAL_FAILURE;
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    ret = Tss2_Sys_Initialize(w->sapi_ctx, sapi_ctx_size, w->tcti_ctx, &abi_version);
+    if (TSS2_RC_SUCCESS != ret) {
+        fprintf(stderr, "Error initializing SAPI: 0x%x\n", ret);
+        free(w->sapi_ctx);
+        w->sapi_ctx = NULL;
+        return ret;
+    }
+
+    // Creates the parent, too, if it doesn't exist yet.
+    ret = xtpm_gen_key(w->tcti_ctx, 0, 0, w->config->password, strlen(w->config->password), &w->key);
+    if (TSS2_RC_SUCCESS != ret) {
+        fprintf(stderr, "Error creating key: 0x%x\n", ret);
+        return ret;
+    }
+
+    // Only define the GPK if it's missing: never overwrite a provisioned one.
+    uint16_t gpk_size;
+    if (TSS2_RC_SUCCESS != xtpm_get_nvram_size(&gpk_size, XTPM_GPK_HANDLE, w->sapi_ctx)) {
+        unsigned char gpk[GPK_SIZE];
+        memset(gpk, 0xA0, sizeof(gpk));
+
+        struct xtpm_nv_entry entry = {XTPM_GPK_HANDLE, GPK_ATTRIBUTES, gpk, sizeof(gpk)};
+        enum xtpm_provision_action action;
+        ret = xtpm_provision_nvram(&entry, 1, TPM2_RH_PLATFORM, NULL, 0, &action, w->sapi_ctx);
+        if (TSS2_RC_SUCCESS != ret) {
+            fprintf(stderr, "Error defining group public key index: 0x%x\n", ret);
+            return ret;
+        }
+        w->defined_gpk = 1;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+void
+cleanup_worker(struct worker *w)
+{
+    if (w->defined_gpk) {
+        TSS2L_SYS_AUTH_COMMAND auth_cmd = {
+            .auths[0] = {.sessionHandle = TPM2_RS_PW},
+            .count = 1
+        };
+        TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+        (void)Tss2_Sys_NV_UndefineSpace(w->sapi_ctx, TPM2_RH_PLATFORM, XTPM_GPK_HANDLE, &auth_cmd, &auth_rsp);
+    }
+
+    if (w->sapi_ctx) {
+        Tss2_Sys_Finalize(w->sapi_ctx);
+        free(w->sapi_ctx);
+    }
+
+    if (w->tcti_ctx) {
+        Tss2_Tcti_Finalize(w->tcti_ctx);
+        free(w->tcti_ctx);
+    }
+
+    free(w->samples);
+}
+
+/*
+ * Running and reporting.
+ */
+
+static
+void*
+run_worker(void *arg)
+{
+    struct worker *w = arg;
+
+    while (now_ns() < w->end_ns) {
+        uint64_t start = now_ns();
+        int failed = w->op->fn(w);
+        uint64_t end = now_ns();
+
+        if (failed) {
+            w->errors++;
+            continue;
+        }
+
+        if (w->op->after)
+            w->op->after(w);
+
+        if (w->sample_count == w->sample_capacity) {
+            size_t capacity = w->sample_capacity ? 2 * w->sample_capacity : 1024;
+            uint64_t *samples = realloc(w->samples, capacity * sizeof(uint64_t));
+            if (NULL == samples) {
+                w->errors++;
+                break;
+            }
+            w->samples = samples;
+            w->sample_capacity = capacity;
+        }
+        w->samples[w->sample_count++] = end - start;
+    }
+
+    return NULL;
+}
+
+static
+int
+compare_uint64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// The `p`-th quantile of `sorted`, in microseconds.
+static
+double
+percentile_us(const uint64_t *sorted, size_t count, double p)
+{
+    if (0 == count)
+        return 0.0;
+
+    size_t rank = (size_t)(p * count);
+    if (rank >= count)
+        rank = count - 1;
+
+    return (double)sorted[rank] / 1e3;
+}
+
+// Find the ops/sec recorded for `op` in a file written by this tool.
+static
+int
+baseline_ops_per_sec(const char *baseline, const char *op, double *out)
+{
+    char key[64];
+    snprintf(key, sizeof(key), "\"op\": \"%s\"", op);
+
+    const char *entry = strstr(baseline, key);
+    if (NULL == entry)
+        return -1;
+
+    const char *end = strchr(entry, '}');
+    const char *value = strstr(entry, "\"ops_per_sec\":");
+    if (NULL == value || (NULL != end && value > end))
+        return -1;
+
+    return 1 == sscanf(value, "\"ops_per_sec\": %lf", out) ? 0 : -1;
+}
+
+static
+char*
+read_baseline(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (NULL == file) {
+        fprintf(stderr, "Unable to open baseline '%s'\n", filename);
+        return NULL;
+    }
+
+    char *contents = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    size_t read;
+    char chunk[4096];
+    while (0 != (read = fread(chunk, 1, sizeof(chunk), file))) {
+        if (length + read + 1 > capacity) {
+            capacity = 2 * (length + read + 1);
+            char *grown = realloc(contents, capacity);
+            if (NULL == grown) {
+                free(contents);
+                fclose(file);
+                return NULL;
+            }
+            contents = grown;
+        }
+        memcpy(contents + length, chunk, read);
+        length += read;
+    }
+    fclose(file);
+
+    if (NULL != contents)
+        contents[length] = '\0';
+
+    return contents;
+}
+
+static
+int
+select_ops(char *list, int *selected)
+{
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(list, ",", &saveptr); NULL != tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        size_t i;
+        for (i = 0; i < OP_COUNT; i++) {
+            if (0 == strcmp(tok, ops[i].name)) {
+                selected[i] = 1;
+                break;
+            }
+        }
+        if (OP_COUNT == i) {
+            fprintf(stderr, "Unknown operation '%s'. Known operations:", tok);
+            for (i = 0; i < OP_COUNT; i++)
+                fprintf(stderr, " %s", ops[i].name);
+            fprintf(stderr, "\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct bench_config config = {.tcti = TCTI_TYPE_DEVICE, .tcti_conf = NULL, .password = ""};
+    int thread_count = 1;
+    double seconds = DEFAULT_SECONDS;
+    const char *baseline_filename = NULL;
+    double max_regression_percent = DEFAULT_MAX_REGRESSION_PERCENT;
+    int selected[OP_COUNT] = {0};
+    int any_selected = 0;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "d:m:l:t:s:o:b:r:p:h"))) {
+        switch (opt) {
+            case 'd':
+                config.tcti = TCTI_TYPE_DEVICE;
+                config.tcti_conf = optarg;
+                break;
+            case 'm':
+                config.tcti = TCTI_TYPE_MSSIM;
+                config.tcti_conf = optarg;
+                break;
+            case 'l':
+#ifdef TCTI_LOOPBACK
+                config.tcti = TCTI_TYPE_LOOPBACK;
+                config.tcti_conf = '\0' == optarg[0] ? NULL : optarg;
+                break;
+#else
+                fprintf(stderr, "The loopback TCTI requires building with BUILD_TSS2=ON\n");
+                return 1;
+#endif
+            case 't':
+                thread_count = atoi(optarg);
+                break;
+            case 's':
+                seconds = atof(optarg);
+                break;
+            case 'o':
+                if (0 != select_ops(optarg, selected))
+                    return 1;
+                any_selected = 1;
+                break;
+            case 'b':
+                baseline_filename = optarg;
+                break;
+            case 'r':
+                max_regression_percent = atof(optarg);
+                break;
+            case 'p':
+                config.password = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc || thread_count < 1 || thread_count > MAX_THREADS || seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (!any_selected) {
+        for (size_t i = 0; i < OP_COUNT; i++)
+            selected[i] = 1;
+    }
+
+    char *baseline = NULL;
+    if (NULL != baseline_filename) {
+        baseline = read_baseline(baseline_filename);
+        if (NULL == baseline)
+            return 1;
+    }
+
+    int exit_code = 1;
+
+    static struct worker workers[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+
+    // Serially, so only the first worker creates anything on a shared TPM.
+    for (int t = 0; t < thread_count; t++) {
+        workers[t].config = &config;
+        if (TSS2_RC_SUCCESS != setup_worker(&workers[t]))
+            goto finish;
+    }
+
+    printf("{\n");
+    printf("  \"tcti\": \"%s\",\n", tcti_names[config.tcti]);
+    printf("  \"threads\": %d,\n", thread_count);
+    printf("  \"duration_s\": %.3f,\n", seconds);
+    printf("  \"results\": [");
+
+    int regressed = 0;
+    int first = 1;
+    for (size_t i = 0; i < OP_COUNT; i++) {
+        if (!selected[i])
+            continue;
+
+        uint64_t start = now_ns();
+        uint64_t end = start + (uint64_t)(seconds * 1e9);
+        for (int t = 0; t < thread_count; t++) {
+            workers[t].op = &ops[i];
+            workers[t].end_ns = end;
+            workers[t].sample_count = 0;
+            workers[t].errors = 0;
+            workers[t].last_error = TSS2_RC_SUCCESS;
+            if (0 != pthread_create(&threads[t], NULL, run_worker, &workers[t])) {
+                fprintf(stderr, "Error creating thread\n");
+                for (int j = 0; j < t; j++)
+                    pthread_join(threads[j], NULL);
+                goto finish;
+            }
+        }
+
+        for (int t = 0; t < thread_count; t++)
+            pthread_join(threads[t], NULL);
+        double elapsed = (double)(now_ns() - start) / 1e9;
+
+        size_t count = 0;
+        uint64_t errors = 0;
+        TSS2_RC last_error = TSS2_RC_SUCCESS;
+        for (int t = 0; t < thread_count; t++) {
+            count += workers[t].sample_count;
+            errors += workers[t].errors;
+            if (workers[t].errors)
+                last_error = workers[t].last_error;
+        }
+
+        uint64_t *all = malloc((count ? count : 1) * sizeof(uint64_t));
+        if (NULL == all)
+            goto finish;
+        size_t offset = 0;
+        for (int t = 0; t < thread_count; t++) {
+            memcpy(all + offset, workers[t].samples, workers[t].sample_count * sizeof(uint64_t));
+            offset += workers[t].sample_count;
+        }
+        qsort(all, count, sizeof(uint64_t), compare_uint64);
+
+        double ops_per_sec = (double)count / elapsed;
+
+        printf("%s\n    {\"op\": \"%s\", \"ops\": %zu, \"errors\": %llu, \"ops_per_sec\": %.1f, "
+               "\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f",
+               first ? "" : ",",
+               ops[i].name,
+               count,
+               (unsigned long long)errors,
+               ops_per_sec,
+               percentile_us(all, count, 0.50),
+               percentile_us(all, count, 0.99),
+               percentile_us(all, count, 0.999));
+        first = 0;
+
+        free(all);
+
+        if (errors)
+            printf(", \"last_error\": \"0x%x\"", last_error);
+
+        double baseline_value;
+        if (NULL != baseline && 0 == baseline_ops_per_sec(baseline, ops[i].name, &baseline_value) && baseline_value > 0) {
+            double change_percent = 100.0 * (ops_per_sec - baseline_value) / baseline_value;
+            printf(", \"baseline_ops_per_sec\": %.1f, \"change_percent\": %.1f", baseline_value, change_percent);
+            if (change_percent < -max_regression_percent) {
+                printf(", \"regressed\": true");
+                regressed = 1;
+            }
+        }
+
+        printf("}");
+        fflush(stdout);
+    }
+
+    printf("\n  ]\n}\n");
+
+    exit_code = regressed ? 2 : 0;
+
+finish:
+    for (int t = thread_count - 1; t >= 0; t--)
+        cleanup_worker(&workers[t]);
+
+    free(baseline);
+
+    return exit_code;
+}
@@ -0,0 +1,439 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+/*
+ * Share one TPM between processes, through a user-space resource manager
+ * (tss2-tcti-broker) served on a UNIX socket.
+ *
+ * Usage: xtpm-broker [-d device_path | -m mssim_conf | -l loopback_conf] [-s socket_path] [-n max_clients]
+ *
+ * Clients talk the Microsoft simulator's protocol, so the mssim TCTI
+ * can connect with e.g. `path=/run/xtpm-broker.sock`.
+ * Each connection is one broker client: its transient objects get virtual handles,
+ * are swapped out when the TPM runs out of room, and are flushed when it disconnects.
+ */
+
+#include <tss2/tss2_tcti_broker.h>
+#include <tss2/tss2_tcti_device.h>
+#include <tss2/tss2_tcti_mssim.h>
+#include <tss2/tss2_tcti_loopback.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define DEFAULT_SOCKET_PATH "/run/xtpm-broker.sock"
+#define DEFAULT_MAX_CLIENTS 64
+
+#define SIMULATOR_SEND_COMMAND 8
+#define SIMULATOR_SESSION_END 20
+
+#define TPM_HEADER_SIZE 10
+
+enum tcti_type {
+    TCTI_TYPE_DEVICE,
+    TCTI_TYPE_MSSIM,
+    TCTI_TYPE_LOOPBACK,
+};
+
+struct connection {
+    int sock;
+    TSS2_TCTI_BROKER_CONTEXT *broker_ctx;
+};
+
+static pthread_mutex_t client_count_lock = PTHREAD_MUTEX_INITIALIZER;
+static int client_count;
+static int max_clients = DEFAULT_MAX_CLIENTS;
+
+static const char *socket_path = DEFAULT_SOCKET_PATH;
+
+static
+void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-d device_path | -m mssim_conf | -l loopback_conf] [-s socket_path] [-n max_clients]\n",
+                    prog);
+}
+
+static
+void
+on_signal(int signum)
+{
+    (void)signum;
+    unlink(socket_path);
+    _exit(0);
+}
+
+static
+TSS2_RC
+init_tcti(enum tcti_type type, const char *conf, TSS2_TCTI_CONTEXT **tcti_ctx)
+{
+    TSS2_RC ret;
+    size_t ctx_size;
+
+    switch (type) {
+        case TCTI_TYPE_MSSIM:
+            ret = Tss2_Tcti_Mssim_Init(NULL, &ctx_size, conf);
+            if (TSS2_RC_SUCCESS != ret)
+                return ret;
+
+            *tcti_ctx = calloc(ctx_size, 1);
+            if (NULL == *tcti_ctx)
+                return TSS2_BASE_RC_GENERAL_FAILURE;
+
+            return Tss2_Tcti_Mssim_Init(*tcti_ctx, &ctx_size, conf);
+        case TCTI_TYPE_LOOPBACK:
+            ret = Tss2_Tcti_Loopback_Init(NULL, &ctx_size, conf);
+            if (TSS2_RC_SUCCESS != ret)
+                return ret;
+
+            *tcti_ctx = calloc(ctx_size, 1);
+            if (NULL == *tcti_ctx)
+                return TSS2_BASE_RC_GENERAL_FAILURE;
+
+            return Tss2_Tcti_Loopback_Init(*tcti_ctx, &ctx_size, conf);
+        default:
+            ret = Tss2_Tcti_Device_Init(NULL, &ctx_size, conf);
+            if (TSS2_RC_SUCCESS != ret)
+                return ret;
+
+            *tcti_ctx = calloc(ctx_size, 1);
+            if (NULL == *tcti_ctx)
+                return TSS2_BASE_RC_GENERAL_FAILURE;
+
+            return Tss2_Tcti_Device_Init(*tcti_ctx, &ctx_size, conf);
+    }
+}
+
+static
+int
+read_all(int sock, uint8_t *buf, size_t size)
+{
+    while (size > 0) {
+        ssize_t ret = recv(sock, buf, size, 0);
+        if (ret < 0 && EINTR == errno)
+            continue;
+        if (ret <= 0)
+            return -1;
+        buf += ret;
+        size -= (size_t)ret;
+    }
+
+    return 0;
+}
+
+static
+int
+write_all(int sock, const uint8_t *buf, size_t size)
+{
+    while (size > 0) {
+        ssize_t ret = send(sock, buf, size, 0);
+        if (ret < 0 && EINTR == errno)
+            continue;
+        if (ret <= 0)
+            return -1;
+        buf += ret;
+        size -= (size_t)ret;
+    }
+
+    return 0;
+}
+
+static
+uint32_t
+get_uint32(const uint8_t *buf)
+{
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | (uint32_t)buf[3];
+}
+
+static
+void
+put_uint32(uint32_t value, uint8_t *buf)
+{
+    buf[0] = (uint8_t)(value >> 24);
+    buf[1] = (uint8_t)(value >> 16);
+    buf[2] = (uint8_t)(value >> 8);
+    buf[3] = (uint8_t)value;
+}
+
+static
+size_t
+error_response(TSS2_RC rc, uint8_t *response)
+{
+    response[0] = 0x80;     // TPM2_ST_NO_SESSIONS
+    response[1] = 0x01;
+    put_uint32(TPM_HEADER_SIZE, response + 2);
+    put_uint32(rc, response + 6);
+    return TPM_HEADER_SIZE;
+}
+
+/*
+ * Run one client's commands until it ends the session or disconnects.
+ */
+static
+void
+serve(TSS2_TCTI_CONTEXT *tcti_ctx, int sock)
+{
+    uint8_t command[TPM2_MAX_COMMAND_SIZE];
+    uint8_t response[TPM2_MAX_RESPONSE_SIZE];
+
+    for (;;) {
+        uint8_t header[4];
+        if (0 != read_all(sock, header, sizeof(header)))
+            return;
+
+        uint32_t type = get_uint32(header);
+        if (SIMULATOR_SEND_COMMAND != type)
+            return;     // SIMULATOR_SESSION_END, or something we don't support
+
+        uint8_t locality;
+        if (0 != read_all(sock, &locality, 1) || 0 != read_all(sock, header, sizeof(header)))
+            return;
+
+        uint32_t command_size = get_uint32(header);
+        if (command_size < TPM_HEADER_SIZE || command_size > sizeof(command))
+            return;
+
+        if (0 != read_all(sock, command, command_size))
+            return;
+
+        size_t response_size = sizeof(response);
+        TSS2_RC ret = Tss2_Tcti_Transmit(tcti_ctx, command_size, command);
+        if (TSS2_RC_SUCCESS == ret)
+            ret = Tss2_Tcti_Receive(tcti_ctx, &response_size, response, TSS2_TCTI_TIMEOUT_BLOCK);
+        if (TSS2_RC_SUCCESS != ret)
+            response_size = error_response(ret, response);
+
+        uint8_t trailer[4];
+        put_uint32((uint32_t)response_size, header);
+        put_uint32(0, trailer);
+        if (0 != write_all(sock, header, sizeof(header)) ||
+            0 != write_all(sock, response, response_size) ||
+            0 != write_all(sock, trailer, sizeof(trailer)))
+            return;
+    }
+}
+
+static
+void *
+connection_thread(void *arg)
+{
+    struct connection *conn = arg;
+
+    size_t ctx_size;
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    TSS2_RC ret = Tss2_Tcti_Broker_Client_Init(NULL, &ctx_size, conn->broker_ctx);
+    if (TSS2_RC_SUCCESS != ret)
+        goto finish;
+
+    tcti_ctx = calloc(ctx_size, 1);
+    if (NULL == tcti_ctx)
+        goto finish;
+
+    ret = Tss2_Tcti_Broker_Client_Init(tcti_ctx, &ctx_size, conn->broker_ctx);
+    if (TSS2_RC_SUCCESS != ret) {
+        free(tcti_ctx);
+        tcti_ctx = NULL;
+        goto finish;
+    }
+
+    serve(tcti_ctx, conn->sock);
+
+finish:
+    if (TSS2_RC_SUCCESS != ret)
+        fprintf(stderr, "Error initializing broker client: 0x%x\n", ret);
+
+    if (tcti_ctx) {
+        Tss2_Tcti_Finalize(tcti_ctx);
+        free(tcti_ctx);
+    }
+
+    close(conn->sock);
+    free(conn);
+
+    pthread_mutex_lock(&client_count_lock);
+    client_count--;
+    pthread_mutex_unlock(&client_count_lock);
+
+    return NULL;
+}
+
+static
+int
+open_listen_socket(const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == sock) {
+        perror("socket");
+        return -1;
+    }
+
+    unlink(path);
+    if (0 != bind(sock, (struct sockaddr*)&addr, sizeof(addr)) || 0 != listen(sock, SOMAXCONN)) {
+        perror(path);
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+int
+main(int argc, char *argv[])
+{
+    enum tcti_type tcti = TCTI_TYPE_DEVICE;
+    const char *tcti_conf = NULL;
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "d:m:l:s:n:h"))) {
+        switch (opt) {
+            case 'd':
+                tcti = TCTI_TYPE_DEVICE;
+                tcti_conf = optarg;
+                break;
+            case 'm':
+                tcti = TCTI_TYPE_MSSIM;
+                tcti_conf = optarg;
+                break;
+            case 'l':
+                tcti = TCTI_TYPE_LOOPBACK;
+                tcti_conf = '\0' == optarg[0] ? NULL : optarg;
+                break;
+            case 's':
+                socket_path = optarg;
+                break;
+            case 'n':
+                max_clients = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind != argc || max_clients < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int exit_code = 1;
+    int listen_sock = -1;
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    TSS2_TCTI_BROKER_CONTEXT *broker_ctx = NULL;
+
+    TSS2_RC ret = init_tcti(tcti, tcti_conf, &tcti_ctx);
+    if (TSS2_RC_SUCCESS != ret) {
+        fprintf(stderr, "Error initializing TCTI: 0x%x\n", ret);
+        goto finish;
+    }
+
+    size_t ctx_size;
+    ret = Tss2_Tcti_Broker_Init(NULL, &ctx_size, tcti_ctx);
+    if (TSS2_RC_SUCCESS != ret)
+        goto finish;
+
+    broker_ctx = calloc(ctx_size, 1);
+    if (NULL == broker_ctx)
+        goto finish;
+
+    ret = Tss2_Tcti_Broker_Init(broker_ctx, &ctx_size, tcti_ctx);
+    if (TSS2_RC_SUCCESS != ret) {
+        fprintf(stderr, "Error initializing broker: 0x%x\n", ret);
+        free(broker_ctx);
+        broker_ctx = NULL;
+        goto finish;
+    }
+
+    listen_sock = open_listen_socket(socket_path);
+    if (-1 == listen_sock)
+        goto finish;
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    for (;;) {
+        int sock = accept(listen_sock, NULL, NULL);
+        if (-1 == sock) {
+            if (EINTR == errno || ECONNABORTED == errno)
+                continue;
+            perror("accept");
+            goto finish;
+        }
+
+        pthread_mutex_lock(&client_count_lock);
+        int accepted = client_count < max_clients;
+        if (accepted)
+            client_count++;
+        pthread_mutex_unlock(&client_count_lock);
+
+        if (!accepted) {
+            fprintf(stderr, "Refusing client: already serving %d\n", max_clients);
+            close(sock);
+            continue;
+        }
+
+        struct connection *conn = malloc(sizeof(struct connection));
+        pthread_t thread;
+        if (NULL == conn) {
+            close(sock);
+        } else {
+            *conn = (struct connection){.sock = sock, .broker_ctx = broker_ctx};
+            if (0 == pthread_create(&thread, NULL, connection_thread, conn)) {
+                pthread_detach(thread);
+                continue;
+            }
+            close(sock);
+            free(conn);
+        }
+
+        pthread_mutex_lock(&client_count_lock);
+        client_count--;
+        pthread_mutex_unlock(&client_count_lock);
+    }
+
+finish:
+    if (-1 != listen_sock) {
+        close(listen_sock);
+        unlink(socket_path);
+    }
+
+    if (broker_ctx) {
+        // Finalizes tcti_ctx too
+        Tss2_Tcti_Broker_Finalize(broker_ctx);
+        free(broker_ctx);
+    } else if (tcti_ctx) {
+        Tss2_Tcti_Finalize(tcti_ctx);
+    }
+    free(tcti_ctx);
+
+    return exit_code;
+}
@@ -0,0 +1,386 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+/*
+ * Define and write a set of NV indices, as listed in a manifest file.
+ *
+ * Usage: xtpm-provision [-d device_path | -m mssim_conf] [-a owner|platform] [-p password] <manifest>
+ *
+ * Each non-blank manifest line not starting with '#' has the form
+ *
+ *      <index> <attributes> <data file>
+ *
+ * where `attributes` is either a number (e.g. 0x20004002),
+ * or a '|'-separated list of TPMA_NV_* names without the prefix
+ * (e.g. ppwrite|authread|platformcreate).
+ *
+ * Indices whose attributes, size, and contents already match are skipped,
+ * so the tool can be re-run on a partially-provisioned device.
+ * To compare contents, each index needs `authread`, or the read attribute
+ * of the hierarchy given with -a (`ownerread` or `ppread`).
+ */
+
+#include <xaptum-tpm/provision.h>
+
+#include <tss2/tss2_tcti_device.h>
+#include <tss2/tss2_tcti_mssim.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define MAX_ENTRIES 64
+#define MAX_LINE_LENGTH 1024
+
+struct attribute_name {
+    const char *name;
+    TPMA_NV value;
+};
+
+static const struct attribute_name attribute_names[] = {
+    {"ppwrite",         TPMA_NV_PPWRITE},
+    {"ownerwrite",      TPMA_NV_OWNERWRITE},
+    {"authwrite",       TPMA_NV_AUTHWRITE},
+    {"policywrite",     TPMA_NV_POLICYWRITE},
+    {"policy_delete",   TPMA_NV_POLICY_DELETE},
+    {"writeall",        TPMA_NV_WRITEALL},
+    {"writedefine",     TPMA_NV_WRITEDEFINE},
+    {"write_stclear",   TPMA_NV_WRITE_STCLEAR},
+    {"globallock",      TPMA_NV_GLOBALLOCK},
+    {"ppread",          TPMA_NV_PPREAD},
+    {"ownerread",       TPMA_NV_OWNERREAD},
+    {"authread",        TPMA_NV_AUTHREAD},
+    {"policyread",      TPMA_NV_POLICYREAD},
+    {"no_da",           TPMA_NV_NO_DA},
+    {"orderly",         TPMA_NV_ORDERLY},
+    {"clear_stclear",   TPMA_NV_CLEAR_STCLEAR},
+    {"read_stclear",    TPMA_NV_READ_STCLEAR},
+    {"platformcreate",  TPMA_NV_PLATFORMCREATE},
+};
+
+static const char *action_names[] = {
+    [XTPM_PROVISION_UNCHANGED] = "unchanged",
+    [XTPM_PROVISION_DEFINED] = "defined",
+    [XTPM_PROVISION_REDEFINED] = "redefined",
+    [XTPM_PROVISION_WRITTEN] = "written",
+};
+
+static
+void
+usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-d device_path | -m mssim_conf] [-a owner|platform] [-p password] <manifest>\n", prog);
+}
+
+static
+int
+parse_attributes(char *str, TPMA_NV *out)
+{
+    char *end;
+    unsigned long value = strtoul(str, &end, 0);
+    if (end != str && '\0' == *end) {
+        *out = (TPMA_NV)value;
+        return 0;
+    }
+
+    *out = 0;
+
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(str, "|", &saveptr); NULL != tok; tok = strtok_r(NULL, "|", &saveptr)) {
+        size_t i;
+        for (i = 0; i < sizeof(attribute_names) / sizeof(attribute_names[0]); i++) {
+            if (0 == strcasecmp(tok, attribute_names[i].name)) {
+                *out |= attribute_names[i].value;
+                break;
+            }
+        }
+        if (sizeof(attribute_names) / sizeof(attribute_names[0]) == i) {
+            fprintf(stderr, "Unknown NV attribute '%s'\n", tok);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static
+int
+read_file(const char *filename, unsigned char **data_out, uint16_t *size_out)
+{
+    FILE *file = fopen(filename, "rb");
+    if (NULL == file) {
+        fprintf(stderr, "Unable to open '%s'\n", filename);
+        return -1;
+    }
+
+    int ret = -1;
+
+    if (0 != fseek(file, 0, SEEK_END))
+        goto finish;
+
+    long size = ftell(file);
+    if (size <= 0 || size > UINT16_MAX) {
+        fprintf(stderr, "Size of '%s' must be between 1 and %u bytes\n", filename, UINT16_MAX);
+        goto finish;
+    }
+
+    rewind(file);
+
+    *data_out = malloc(size);
+    if (NULL == *data_out)
+        goto finish;
+
+    if ((size_t)size != fread(*data_out, 1, size, file)) {
+        fprintf(stderr, "Error reading '%s'\n", filename);
+        free(*data_out);
+        *data_out = NULL;
+        goto finish;
+    }
+
+    *size_out = (uint16_t)size;
+    ret = 0;
+
+finish:
+    fclose(file);
+
+    return ret;
+}
+
+static
+int
+parse_manifest(const char *filename, struct xtpm_nv_entry *entries, size_t *count_out)
+{
+    FILE *file = fopen(filename, "r");
+    if (NULL == file) {
+        fprintf(stderr, "Unable to open manifest '%s'\n", filename);
+        return -1;
+    }
+
+    int ret = 0;
+    size_t count = 0;
+    int line_number = 0;
+    char line[MAX_LINE_LENGTH];
+
+    while (0 == ret && NULL != fgets(line, sizeof(line), file)) {
+        line_number++;
+
+        char *saveptr = NULL;
+        char *index_str = strtok_r(line, " \t\r\n", &saveptr);
+        if (NULL == index_str || '#' == index_str[0])
+            continue;
+
+        char *attributes_str = strtok_r(NULL, " \t\r\n", &saveptr);
+        char *data_filename = strtok_r(NULL, " \t\r\n", &saveptr);
+        if (NULL == attributes_str || NULL == data_filename) {
+            fprintf(stderr, "%s:%d: expected '<index> <attributes> <data file>'\n", filename, line_number);
+            ret = -1;
+            break;
+        }
+
+        if (MAX_ENTRIES == count) {
+            fprintf(stderr, "%s:%d: more than %d entries\n", filename, line_number, MAX_ENTRIES);
+            ret = -1;
+            break;
+        }
+
+        struct xtpm_nv_entry *entry = &entries[count];
+
+        char *end;
+        entry->index = (TPMI_RH_NV_INDEX)strtoul(index_str, &end, 0);
+        if (end == index_str || '\0' != *end) {
+            fprintf(stderr, "%s:%d: bad index '%s'\n", filename, line_number, index_str);
+            ret = -1;
+            break;
+        }
+
+        if (0 != parse_attributes(attributes_str, &entry->attributes)) {
+            fprintf(stderr, "%s:%d: bad attributes\n", filename, line_number);
+            ret = -1;
+            break;
+        }
+
+        unsigned char *data = NULL;
+        if (0 != read_file(data_filename, &data, &entry->data_size)) {
+            ret = -1;
+            break;
+        }
+        entry->data = data;
+
+        count++;
+    }
+
+    fclose(file);
+
+    *count_out = count;
+
+    return ret;
+}
+
+static
+TSS2_RC
+init_tcti(const char *dev_file_path,
+          const char *mssim_conf,
+          TSS2_TCTI_CONTEXT **tcti_ctx)
+{
+    TSS2_RC ret;
+    size_t ctx_size;
+
+    if (NULL != mssim_conf) {
+        ret = Tss2_Tcti_Mssim_Init(NULL, &ctx_size, mssim_conf);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        *tcti_ctx = calloc(ctx_size, 1);
+        if (NULL == *tcti_ctx)
+            return TSS2_BASE_RC_GENERAL_FAILURE;
+
+        return Tss2_Tcti_Mssim_Init(*tcti_ctx, &ctx_size, mssim_conf);
+    }
+
+    ret = Tss2_Tcti_Device_Init(NULL, &ctx_size, dev_file_path);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    *tcti_ctx = calloc(ctx_size, 1);
+    if (NULL == *tcti_ctx)
+        return TSS2_BASE_RC_GENERAL_FAILURE;
+
+    return Tss2_Tcti_Device_Init(*tcti_ctx, &ctx_size, dev_file_path);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *dev_file_path = NULL;   // use default device
+    const char *mssim_conf = NULL;
+    TPMI_RH_PROVISION auth_handle = TPM2_RH_OWNER;
+    const char *password = "";
+
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "d:m:a:p:h"))) {
+        switch (opt) {
+            case 'd':
+                dev_file_path = optarg;
+                break;
+            case 'm':
+                mssim_conf = optarg;
+                break;
+            case 'a':
+                if (0 == strcmp(optarg, "owner")) {
+                    auth_handle = TPM2_RH_OWNER;
+                } else if (0 == strcmp(optarg, "platform")) {
+                    auth_handle = TPM2_RH_PLATFORM;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'p':
+                password = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind + 1 != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int exit_code = 1;
+
+    struct xtpm_nv_entry entries[MAX_ENTRIES] = {0};
+    enum xtpm_provision_action actions[MAX_ENTRIES];
+    size_t count = 0;
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    TSS2_SYS_CONTEXT *sapi_ctx = NULL;
+
+    if (0 != parse_manifest(argv[optind], entries, &count))
+        goto finish;
+
+    // Re-runs compare contents, so each index must be readable.
+    TPMA_NV hierarchy_read = TPM2_RH_PLATFORM == auth_handle ? TPMA_NV_PPREAD : TPMA_NV_OWNERREAD;
+    for (size_t i = 0; i < count; i++) {
+        if (!(entries[i].attributes & (hierarchy_read | TPMA_NV_AUTHREAD))) {
+            fprintf(stderr, "0x%08x: needs authread, or %s with -a %s\n",
+                    entries[i].index,
+                    TPM2_RH_PLATFORM == auth_handle ? "ppread" : "ownerread",
+                    TPM2_RH_PLATFORM == auth_handle ? "platform" : "owner");
+            goto finish;
+        }
+    }
+
+    TSS2_RC ret = init_tcti(dev_file_path, mssim_conf, &tcti_ctx);
+    if (TSS2_RC_SUCCESS != ret) {
+        fprintf(stderr, "Error initializing TCTI: 0x%x\n", ret);
+        goto finish;
+    }
+
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    sapi_ctx = calloc(sapi_ctx_size, 1);
+    if (NULL == sapi_ctx)
+        goto finish;
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    ret = Tss2_Sys_Initialize(sapi_ctx, sapi_ctx_size, tcti_ctx, &abi_version);
+    if (TSS2_RC_SUCCESS != ret) {
+        fprintf(stderr, "Error initializing SAPI: 0x%x\n", ret);
+        free(sapi_ctx);
+        sapi_ctx = NULL;
+        goto finish;
+    }
+
+    ret = xtpm_provision_nvram(entries,
+                               count,
+                               auth_handle,
+                               password,
+                               strlen(password),
+                               actions,
+                               sapi_ctx);
+
+    if (TSS2_RC_SUCCESS != ret) {
+        fprintf(stderr, "Error provisioning NV indices: 0x%x\n", ret);
+        goto finish;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        printf("0x%08x %5u bytes  %s\n", entries[i].index, entries[i].data_size, action_names[actions[i]]);
+
+    exit_code = 0;
+
+finish:
+    if (sapi_ctx) {
+        Tss2_Sys_Finalize(sapi_ctx);
+        free(sapi_ctx);
+    }
+
+    if (tcti_ctx) {
+        Tss2_Tcti_Finalize(tcti_ctx);
+        free(tcti_ctx);
+    }
+
+    for (size_t i = 0; i < count; i++)
+        free((unsigned char*)entries[i].data);
+
+    return exit_code;
+}
@@ -33,7 +33,13 @@ typedef struct {
     uint32_t tssVersion;
 } TSS2_ABI_VERSION;
 
-#define TSS2_ABI_VERSION_CURRENT {1, 1, 1, 1}
+// The XTPM_ECC_ONLY profile (see tss2_tpm2_types.h) changes the layout of the TPM2 types.
+// Versions 1 and 2 had room for 8 PCRs in a TPMS_PCR_SELECTION, rather than 24.
+#ifdef XTPM_ECC_ONLY
+#define TSS2_ABI_VERSION_CURRENT {1, 1, 1, 4}
+#else
+#define TSS2_ABI_VERSION_CURRENT {1, 1, 1, 3}
+#endif
 
 typedef uint32_t TSS2_RC;
 
@@ -139,14 +145,54 @@ typedef uint32_t TSS2_RC;
             TSS2_BASE_RC_INCOMPATIBLE_TCTI))
 #define TSS2_SYS_RC_BAD_TCTI_STRUCTURE ((TSS2_RC)(TSS2_SYS_ERROR_LEVEL | \
             TSS2_BASE_RC_BAD_TCTI_STRUCTURE))
+#define TSS2_SYS_RC_NOT_PERMITTED ((TSS2_RC)(TSS2_SYS_ERROR_LEVEL | \
+            TSS2_BASE_RC_NOT_PERMITTED))
 
 #define TSS2_SYS_PART2_RC_LEVEL 9 << TSS2_RC_LEVEL_SHIFT
 
 // TPM errors
 #define TSS2_TPM_RC_LEVEL 0
 
+#define RC_VER1 0x100
+#define RC_FMT1 0x080
 #define RC_WARN 0x900
-#define TPM_RC_RETRY RC_WARN + 0x022
+
+#define TPM_RC_BAD_TAG 0x01E
+#define TPM_RC_AUTH_MISSING (RC_VER1 + 0x025)
+#define TPM_RC_COMMAND_SIZE (RC_VER1 + 0x042)
+#define TPM_RC_COMMAND_CODE (RC_VER1 + 0x043)
+#define TPM_RC_NV_RANGE (RC_VER1 + 0x046)
+#define TPM_RC_NV_AUTHORIZATION (RC_VER1 + 0x049)
+#define TPM_RC_NV_UNINITIALIZED (RC_VER1 + 0x04A)
+#define TPM_RC_NV_SPACE (RC_VER1 + 0x04B)
+#define TPM_RC_NV_DEFINED (RC_VER1 + 0x04C)
+
+#define TPM_RC_ATTRIBUTES (RC_FMT1 + 0x002)
+#define TPM_RC_HASH (RC_FMT1 + 0x003)
+#define TPM_RC_VALUE (RC_FMT1 + 0x004)
+#define TPM_RC_HIERARCHY (RC_FMT1 + 0x005)
+#define TPM_RC_TYPE (RC_FMT1 + 0x00A)
+#define TPM_RC_HANDLE (RC_FMT1 + 0x00B)
+#define TPM_RC_RANGE (RC_FMT1 + 0x00D)
+#define TPM_RC_AUTH_FAIL (RC_FMT1 + 0x00E)
+#define TPM_RC_SCHEME (RC_FMT1 + 0x012)
+#define TPM_RC_SIZE (RC_FMT1 + 0x015)
+#define TPM_RC_TICKET (RC_FMT1 + 0x016)
+#define TPM_RC_INSUFFICIENT (RC_FMT1 + 0x01A)
+#define TPM_RC_KEY (RC_FMT1 + 0x01C)
+#define TPM_RC_INTEGRITY (RC_FMT1 + 0x01F)
+
+// A format-one error refers to the handle, parameter or session
+// numbered (rc >> TPM_RC_N_SHIFT) & 0xF
+#define TPM_RC_H 0x000
+#define TPM_RC_P 0x040
+#define TPM_RC_S 0x800
+#define TPM_RC_N_SHIFT 8
+
+#define TPM_RC_OBJECT_MEMORY (RC_WARN + 0x002)
+#define TPM_RC_YIELDED (RC_WARN + 0x008)
+#define TPM_RC_TESTING (RC_WARN + 0x00A)
+#define TPM_RC_RETRY (RC_WARN + 0x022)
 
 #ifdef __cplusplus
 }
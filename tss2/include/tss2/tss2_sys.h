@@ -49,6 +49,15 @@ typedef struct {
 // Command context allocation functions
 //
 
+/*
+ * Size of a context whose command/response buffer holds `maxCommandResponseSize` bytes
+ * (TPM2_MAX_COMMAND_SIZE if 0, and at least 64).
+ * E.g. a TPM with a 1280-byte I/O buffer (like the SLB9670) can't take larger commands anyway.
+ *
+ * `Tss2_Sys_Initialize` sizes the buffer from its `contextSize`.
+ * Commands that don't fit fail with TSS2_SYS_RC_INSUFFICIENT_CONTEXT before anything is sent,
+ * and responses that don't fit with the TCTI's TSS2_TCTI_RC_INSUFFICIENT_BUFFER.
+ */
 size_t
 Tss2_Sys_GetContextSize(size_t maxCommandResponseSize);
 
@@ -58,6 +67,18 @@ Tss2_Sys_Initialize(TSS2_SYS_CONTEXT *sysContext,
                     TSS2_TCTI_CONTEXT *tctiContext,
                     TSS2_ABI_VERSION *abiVersion);
 
+/*
+ * As `Tss2_Sys_Initialize`, but for a "dry run" context, with no TCTI:
+ * commands are marshaled as usual, but instead of being sent
+ * the execute step fails with TSS2_SYS_RC_NOT_PERMITTED.
+ * The marshaled command is then available from `Tss2_Sys_GetCommandBuffer`.
+ * (This is an extension, for measuring marshaling cost without a TPM.)
+ */
+TSS2_RC
+Tss2_Sys_InitializeDryRun(TSS2_SYS_CONTEXT *sysContext,
+                          size_t contextSize,
+                          TSS2_ABI_VERSION *abiVersion);
+
 TSS2_RC
 Tss2_Sys_Finalize(TSS2_SYS_CONTEXT *sysContext);
 
@@ -65,6 +86,84 @@ TSS2_RC
 Tss2_Sys_GetTctiContext(TSS2_SYS_CONTEXT *sysContext,
                         TSS2_TCTI_CONTEXT **tctiContext);
 
+//
+// Command execution functions
+//
+// A command may also be run in stages:
+//   Tss2_Sys_XXX_Prepare -> Tss2_Sys_SetCmdAuths -> Tss2_Sys_ExecuteAsync
+//     -> Tss2_Sys_ExecuteFinish -> Tss2_Sys_GetRspAuths -> Tss2_Sys_XXX_Complete
+// which lets the caller do other work while the TPM processes the command.
+//
+// `rspAuthsArray`, and outputs the caller doesn't need (the creation data,
+// hash and ticket, and the names), may be NULL; they're then skipped over
+// in the response rather than copied out.
+//
+
+TSS2_RC
+Tss2_Sys_SetCmdAuths(TSS2_SYS_CONTEXT *sysContext,
+                     const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray);
+
+TSS2_RC
+Tss2_Sys_ExecuteAsync(TSS2_SYS_CONTEXT *sysContext);
+
+/*
+ * The marshaled command, after a `_Prepare` (and `Tss2_Sys_SetCmdAuths`),
+ * or after a command was sent (or, in a dry-run context, would have been).
+ *
+ * `*cmdBuffer` points into the context, and is valid until the next command.
+ */
+TSS2_RC
+Tss2_Sys_GetCommandBuffer(TSS2_SYS_CONTEXT *sysContext,
+                          size_t *cmdBufferSize,
+                          const uint8_t **cmdBuffer);
+
+TSS2_RC
+Tss2_Sys_ExecuteFinish(TSS2_SYS_CONTEXT *sysContext,
+                       int32_t timeout);
+
+TSS2_RC
+Tss2_Sys_GetRspAuths(TSS2_SYS_CONTEXT *sysContext,
+                     TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+//
+// Retry of warning responses
+//
+// Commands that get a TPM_RC_RETRY, TPM_RC_YIELDED, or TPM_RC_TESTING response
+// are resent automatically, after an exponentially-increasing delay.
+// Only when waiting is allowed: `Tss2_Sys_ExecuteFinish` with a timeout other than
+// TSS2_TCTI_TIMEOUT_BLOCK returns the warning instead.
+// The starting delay adapts per command code, to what worked last time,
+// for the few command codes retried most recently (whose counters are also kept).
+// These are extensions, not part of the TSS2 SAPI specification.
+//
+
+typedef struct {
+    uint32_t maxRetries;        // 0 disables retrying
+    uint32_t initialDelayUs;
+    uint32_t maxDelayUs;
+} TSS2_SYS_RETRY_POLICY;
+
+#define TSS2_SYS_RETRY_DEFAULT_MAX_RETRIES 8
+#define TSS2_SYS_RETRY_DEFAULT_INITIAL_DELAY_US 1000
+#define TSS2_SYS_RETRY_DEFAULT_MAX_DELAY_US 256000
+
+typedef struct {
+    uint32_t retries;           // times a command was resent
+    uint32_t exhausted;         // times a command was still getting warnings after maxRetries
+} TSS2_SYS_RETRY_COUNTERS;
+
+TSS2_RC
+Tss2_Sys_SetRetryPolicy(TSS2_SYS_CONTEXT *sysContext,
+                        const TSS2_SYS_RETRY_POLICY *policy);
+
+/*
+ * Counters of a command code that hasn't been retried lately read as zero.
+ */
+TSS2_RC
+Tss2_Sys_GetRetryCounters(TSS2_SYS_CONTEXT *sysContext,
+                          TPM2_CC commandCode,
+                          TSS2_SYS_RETRY_COUNTERS *counters);
+
 //
 // Part 3 Functions
 //
@@ -123,6 +222,17 @@ Tss2_Sys_Sign(TSS2_SYS_CONTEXT *sysContext,
               TPMT_SIGNATURE *signature,
               TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
 
+TSS2_RC
+Tss2_Sys_Sign_Prepare(TSS2_SYS_CONTEXT *sysContext,
+                      TPMI_DH_OBJECT keyHandle,
+                      const TPM2B_DIGEST *digest,
+                      const TPMT_SIG_SCHEME *inScheme,
+                      const TPMT_TK_HASHCHECK *validation);
+
+TSS2_RC
+Tss2_Sys_Sign_Complete(TSS2_SYS_CONTEXT *sysContext,
+                       TPMT_SIGNATURE *signature);
+
 TSS2_RC
 Tss2_Sys_NV_DefineSpace(TSS2_SYS_CONTEXT *sysContext,
                         TPMI_RH_PROVISION authHandle,
@@ -140,6 +250,16 @@ Tss2_Sys_NV_Write(TSS2_SYS_CONTEXT *sysContext,
                   uint16_t offset,
                   TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
 
+TSS2_RC
+Tss2_Sys_NV_Write_Prepare(TSS2_SYS_CONTEXT *sysContext,
+                          TPMI_RH_NV_AUTH authHandle,
+                          TPMI_RH_NV_INDEX nvIndex,
+                          const TPM2B_MAX_NV_BUFFER *data,
+                          uint16_t offset);
+
+TSS2_RC
+Tss2_Sys_NV_Write_Complete(TSS2_SYS_CONTEXT *sysContext);
+
 TSS2_RC
 Tss2_Sys_NV_Read(TSS2_SYS_CONTEXT *sysContext,
                  TPMI_RH_NV_AUTH authHandle,
@@ -150,6 +270,17 @@ Tss2_Sys_NV_Read(TSS2_SYS_CONTEXT *sysContext,
                  TPM2B_MAX_NV_BUFFER *data,
                  TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
 
+TSS2_RC
+Tss2_Sys_NV_Read_Prepare(TSS2_SYS_CONTEXT *sysContext,
+                         TPMI_RH_NV_AUTH authHandle,
+                         TPMI_RH_NV_INDEX nvIndex,
+                         uint16_t size,
+                         uint16_t offset);
+
+TSS2_RC
+Tss2_Sys_NV_Read_Complete(TSS2_SYS_CONTEXT *sysContext,
+                          TPM2B_MAX_NV_BUFFER *data);
+
 TSS2_RC
 Tss2_Sys_NV_ReadPublic(TSS2_SYS_CONTEXT *sysContext,
                        TPMI_RH_NV_INDEX nvIndex,
@@ -209,6 +340,110 @@ TSS2_RC
 Tss2_Sys_FlushContext(TSS2_SYS_CONTEXT *sysContext,
                       TPMI_DH_CONTEXT flushHandle);
 
+TSS2_RC
+Tss2_Sys_ContextSave(TSS2_SYS_CONTEXT *sysContext,
+                     TPMI_DH_CONTEXT saveHandle,
+                     TPMS_CONTEXT *context);
+
+TSS2_RC
+Tss2_Sys_ContextLoad(TSS2_SYS_CONTEXT *sysContext,
+                     const TPMS_CONTEXT *context,
+                     TPMI_DH_CONTEXT *loadedHandle);
+
+TSS2_RC
+Tss2_Sys_CreateLoaded(TSS2_SYS_CONTEXT *sysContext,
+                      TPMI_DH_OBJECT parentHandle,
+                      const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                      const TPM2B_SENSITIVE_CREATE *inSensitive,
+                      const TPM2B_TEMPLATE *inPublic,
+                      TPM2_HANDLE *objectHandle,
+                      TPM2B_PRIVATE *outPrivate,
+                      TPM2B_PUBLIC *outPublic,
+                      TPM2B_NAME *name,
+                      TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+/*
+ * Marshal `inPublic`'s public area into `outTemplate`, for `Tss2_Sys_CreateLoaded`.
+ * (This is an extension, standing in for the TSS2 marshaling library.)
+ */
+TSS2_RC
+Tss2_Sys_SetTemplate(const TPM2B_PUBLIC *inPublic,
+                     TPM2B_TEMPLATE *outTemplate);
+
+/*
+ * Only TPM2_CAP_HANDLES and TPM2_CAP_TPM_PROPERTIES are supported,
+ * and `propertyCount` should be at most TPM2_MAX_CAP_HANDLES or TPM2_MAX_TPM_PROPERTIES:
+ * other capabilities, or longer lists, fail with TSS2_SYS_RC_MALFORMED_RESPONSE.
+ */
+TSS2_RC
+Tss2_Sys_GetCapability(TSS2_SYS_CONTEXT *sysContext,
+                       const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                       TPM2_CAP capability,
+                       uint32_t property,
+                       uint32_t propertyCount,
+                       TPMI_YES_NO *moreData,
+                       TPMS_CAPABILITY_DATA *capabilityData,
+                       TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+TSS2_RC
+Tss2_Sys_GetRandom(TSS2_SYS_CONTEXT *sysContext,
+                   const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                   uint16_t bytesRequested,
+                   TPM2B_DIGEST *randomBytes,
+                   TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+TSS2_RC
+Tss2_Sys_HashSequenceStart(TSS2_SYS_CONTEXT *sysContext,
+                           const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                           const TPM2B_AUTH *auth,
+                           TPMI_ALG_HASH hashAlg,
+                           TPMI_DH_OBJECT *sequenceHandle,
+                           TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+TSS2_RC
+Tss2_Sys_SequenceUpdate(TSS2_SYS_CONTEXT *sysContext,
+                        TPMI_DH_OBJECT sequenceHandle,
+                        const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                        const TPM2B_MAX_BUFFER *buffer,
+                        TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+TSS2_RC
+Tss2_Sys_SequenceUpdate_Prepare(TSS2_SYS_CONTEXT *sysContext,
+                                TPMI_DH_OBJECT sequenceHandle,
+                                const TPM2B_MAX_BUFFER *buffer);
+
+TSS2_RC
+Tss2_Sys_SequenceUpdate_Complete(TSS2_SYS_CONTEXT *sysContext);
+
+/*
+ * `validation` may be NULL if the caller has no use for the hashcheck ticket.
+ */
+TSS2_RC
+Tss2_Sys_SequenceComplete(TSS2_SYS_CONTEXT *sysContext,
+                          TPMI_DH_OBJECT sequenceHandle,
+                          const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                          const TPM2B_MAX_BUFFER *buffer,
+                          TPMI_RH_HIERARCHY hierarchy,
+                          TPM2B_DIGEST *result,
+                          TPMT_TK_HASHCHECK *validation,
+                          TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+TSS2_RC
+Tss2_Sys_PCR_Read(TSS2_SYS_CONTEXT *sysContext,
+                  const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                  const TPML_PCR_SELECTION *pcrSelectionIn,
+                  uint32_t *pcrUpdateCounter,
+                  TPML_PCR_SELECTION *pcrSelectionOut,
+                  TPML_DIGEST *pcrValues,
+                  TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+TSS2_RC
+Tss2_Sys_PCR_Extend(TSS2_SYS_CONTEXT *sysContext,
+                    TPMI_DH_PCR pcrHandle,
+                    const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                    const TPML_DIGEST_VALUES *digests,
+                    TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
 #ifdef __cplusplus
 }
 #endif
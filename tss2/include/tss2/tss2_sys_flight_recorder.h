@@ -0,0 +1,89 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2_SYS_FLIGHT_RECORDER_H
+#define XAPTUM_TSS2_SYS_FLIGHT_RECORDER_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "tss2_tpm2_types.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Flight recorder of the most recent TPM round trips.
+ *
+ * Every command sent through this SAPI (including resends of a retried command)
+ * takes the next entry of a process-wide ring of XTPM_FLIGHT_RECORDER_SIZE entries
+ * when it's transmitted, and fills in its result when its response is received.
+ * Entries with `end_ns` of 0 are still in flight.
+ *
+ * Recording is always on, and takes no locks.
+ *
+ * This is an extension available only in this SAPI implementation.
+ */
+
+#define XTPM_FLIGHT_RECORDER_SIZE 256   // must be a power of 2
+
+struct xtpm_flight_entry {
+    uint64_t sequence;          // counts up from 0 over the life of the process
+    TPM2_CC command_code;
+    TPM2_HANDLE handle;         // first handle of the command, or 0 if it has none
+    TSS2_RC rc;                 // response code or TCTI error (0 while in flight)
+    uint64_t start_ns;          // CLOCK_MONOTONIC, when transmit started
+    uint64_t end_ns;            // CLOCK_MONOTONIC, when receive finished, or 0 while in flight
+};
+
+/*
+ * Copy up to `max_entries` of the most recent entries to `out`, oldest first.
+ *
+ * Returns the number of entries copied.
+ * Entries being written at the time of the call are skipped.
+ */
+size_t
+xtpm_flight_recorder_snapshot(struct xtpm_flight_entry *out,
+                              size_t max_entries);
+
+/*
+ * Write the recorded entries as text, one per line, oldest first, to file descriptor `fd`.
+ *
+ * This is async-signal-safe, so may be called from a signal handler.
+ * Returns 0 on success, or -1 on a write error.
+ */
+int
+xtpm_flight_recorder_dump(int fd);
+
+/*
+ * Install a handler for signal `signum` (e.g. SIGUSR1)
+ * that calls `xtpm_flight_recorder_dump(fd)`.
+ *
+ * Returns 0 on success, or -1 (with errno set) on failure.
+ */
+int
+xtpm_flight_recorder_install_signal_handler(int signum,
+                                            int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
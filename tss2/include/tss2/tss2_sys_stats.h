@@ -0,0 +1,130 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2_SYS_STATS_H
+#define XAPTUM_TSS2_SYS_STATS_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "tss2_tpm2_types.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Per-command-code TPM latency and error metrics.
+ *
+ * Every round trip to the TPM made through this SAPI
+ * (including resends of a retried command) is counted against its command code,
+ * with its latency split into:
+ *  - transmit: sending the command to the TCTI
+ *  - TPM wait: from the end of transmit until the response starts to arrive
+ *  - receive: reading the response
+ * (With a TCTI from another library, the whole receive is counted as TPM wait).
+ *
+ * Counters are kept per thread, so recording takes no locks,
+ * and are summed across threads by `xtpm_stats_snapshot`.
+ * A thread's counters outlive it: when it exits, the next thread to send
+ * a command takes them over, so memory grows with concurrent threads only.
+ * With `XTPM_NO_HEAP`, the stats are compiled out (nothing is counted)
+ * unless `XTPM_STATS_STATIC_BLOCKS` is defined when building the library:
+ * the per-thread counters then come from a static pool of that many blocks
+ * (each a `struct xtpm_stats`, about 77 KB), and threads running while
+ * it's all taken aren't counted.
+ *
+ * This is an extension available only in this SAPI implementation.
+ */
+
+#if defined(XTPM_NO_HEAP) && !defined(XTPM_STATS_STATIC_BLOCKS)
+#define XTPM_STATS_STATIC_BLOCKS 0
+#endif
+
+#define XTPM_STATS_CC_FIRST 0x0000011F
+#define XTPM_STATS_CC_COUNT 0x80
+
+// Bucket 0 counts latencies under 1us; bucket i, latencies in [2^(i-1), 2^i) us.
+// The last bucket also counts everything longer.
+#define XTPM_STATS_HISTOGRAM_BUCKETS 24
+
+enum xtpm_stats_phase {
+    XTPM_STATS_TRANSMIT,
+    XTPM_STATS_TPM_WAIT,
+    XTPM_STATS_RECEIVE,
+    XTPM_STATS_PHASE_COUNT,
+};
+
+struct xtpm_stats_histogram {
+    uint64_t total_ns;
+    uint64_t buckets[XTPM_STATS_HISTOGRAM_BUCKETS];
+};
+
+struct xtpm_cc_stats {
+    uint64_t calls;
+    uint64_t errors;    // TCTI failures, or responses other than TPM2_RC_SUCCESS
+    struct xtpm_stats_histogram latency[XTPM_STATS_PHASE_COUNT];
+};
+
+struct xtpm_stats {
+    // Indexed by (command code - XTPM_STATS_CC_FIRST).
+    // Command codes outside that range are not counted.
+    struct xtpm_cc_stats commands[XTPM_STATS_CC_COUNT];
+};
+
+/*
+ * Sum the counters of all threads into `out`.
+ *
+ * Counters are cumulative since process start;
+ * subtract two snapshots to get the counts for an interval.
+ */
+void
+xtpm_stats_snapshot(struct xtpm_stats *out);
+
+/*
+ * Get the stats for command code `command_code` from `stats`,
+ * or NULL if that command code is not tracked.
+ */
+const struct xtpm_cc_stats*
+xtpm_stats_for_command(const struct xtpm_stats *stats,
+                       TPM2_CC command_code);
+
+/*
+ * Estimate the `percentile` (0 to 100) latency of `histogram`, in microseconds.
+ *
+ * The result is the upper bound of the bucket holding that percentile.
+ */
+uint64_t
+xtpm_stats_percentile_us(const struct xtpm_stats_histogram *histogram,
+                         double percentile);
+
+/*
+ * Write a one-line-per-command-code text summary of `stats` to `out`.
+ *
+ * Returns 0 on success, or -1 on a write error.
+ */
+int
+xtpm_stats_dump(const struct xtpm_stats *stats,
+                FILE *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
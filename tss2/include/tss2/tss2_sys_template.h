@@ -0,0 +1,133 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2_SYS_TEMPLATE_H
+#define XAPTUM_TSS2_SYS_TEMPLATE_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "tss2_sys.h"
+
+#include <stdint.h>
+
+/*
+ * Pre-marshaled commands, for sending the same command over and over.
+ *
+ * A command is marshaled once, as usual (with a `_Prepare`
+ * and `Tss2_Sys_SetCmdAuths`, e.g. in a dry-run context),
+ * and saved with `Tss2_Sys_SaveTemplate`. Before each run, only the fields that change
+ * (the handles, a Sign digest, or an NV_Read size and offset) are patched in the template,
+ * which is then copied into a context by `Tss2_Sys_LoadTemplate` in place of a `_Prepare`,
+ * or run in one call by `Tss2_Sys_Sign_FromTemplate` or `Tss2_Sys_NV_Read_FromTemplate`.
+ *
+ * The authorization area is sent as saved, so this suits password sessions
+ * (or none), not HMAC sessions.
+ *
+ * This is an extension available only in this SAPI implementation.
+ */
+
+// The largest command a template holds:
+// e.g. a Sign with a password session and a 64-byte password takes 137.
+#define XTPM_TEMPLATE_MAX_SIZE 256
+
+/*
+ * A saved command. Treat the fields as private.
+ *
+ * The functions below return TSS2_SYS_RC_BAD_VALUE for a template whose
+ * fields point outside the saved command.
+ */
+struct xtpm_command_template {
+    uint16_t size;
+    uint16_t parameters_offset;
+    uint8_t handle_count;       // that may be patched, i.e. 0 for unknown command codes
+    uint8_t cmd_auths_count;
+    uint8_t buffer[XTPM_TEMPLATE_MAX_SIZE];
+};
+
+/*
+ * Save the command prepared in `sysContext` (after a `_Prepare`,
+ * and `Tss2_Sys_SetCmdAuths`) to `tmpl`.
+ *
+ * Returns TSS2_SYS_RC_INSUFFICIENT_BUFFER if it's larger than `XTPM_TEMPLATE_MAX_SIZE`.
+ */
+TSS2_RC
+Tss2_Sys_SaveTemplate(TSS2_SYS_CONTEXT *sysContext,
+                      struct xtpm_command_template *tmpl);
+
+/*
+ * Copy the command in `tmpl` into `sysContext`, as its `_Prepare` would marshal it,
+ * ready for `Tss2_Sys_ExecuteAsync`.
+ */
+TSS2_RC
+Tss2_Sys_LoadTemplate(TSS2_SYS_CONTEXT *sysContext,
+                      const struct xtpm_command_template *tmpl);
+
+/*
+ * Patch handle number `index` (0 for the first) of the command in `tmpl`.
+ *
+ * Handles can be patched only in Sign and NV_Read commands.
+ */
+TSS2_RC
+xtpm_template_set_handle(struct xtpm_command_template *tmpl,
+                         unsigned index,
+                         TPM2_HANDLE handle);
+
+/*
+ * Patch the digest of the Sign command in `tmpl`.
+ *
+ * The new digest must be the same size as the one the template was saved with
+ * (TSS2_SYS_RC_BAD_SIZE otherwise), since nothing after it is moved.
+ */
+TSS2_RC
+xtpm_template_set_digest(struct xtpm_command_template *tmpl,
+                         const TPM2B_DIGEST *digest);
+
+/*
+ * Patch the size and offset of the NV_Read command in `tmpl`.
+ */
+TSS2_RC
+xtpm_template_set_nv_range(struct xtpm_command_template *tmpl,
+                           uint16_t size,
+                           uint16_t offset);
+
+/*
+ * Run the Sign command in `tmpl`, like `Tss2_Sys_Sign`.
+ */
+TSS2_RC
+Tss2_Sys_Sign_FromTemplate(TSS2_SYS_CONTEXT *sysContext,
+                           const struct xtpm_command_template *tmpl,
+                           TPMT_SIGNATURE *signature,
+                           TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+/*
+ * Run the NV_Read command in `tmpl`, like `Tss2_Sys_NV_Read`.
+ */
+TSS2_RC
+Tss2_Sys_NV_Read_FromTemplate(TSS2_SYS_CONTEXT *sysContext,
+                              const struct xtpm_command_template *tmpl,
+                              TPM2B_MAX_NV_BUFFER *data,
+                              TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,180 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2_SYS_TRACE_H
+#define XAPTUM_TSS2_SYS_TRACE_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "tss2_sys.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Runtime tracing of the commands and responses exchanged with the TPM.
+ *
+ * A hook registered on a SAPI context with `Tss2_Sys_SetTraceHook`
+ * is called once per command sent and once per response received,
+ * from the SAPI layer (whole commands, including resends of a retried command),
+ * from the TCTI layer (as written to / read from the transport), or both.
+ * With no hook registered, the only cost is a NULL check.
+ *
+ * The hook runs on the thread executing the command, before the command completes,
+ * so it should be quick: copy what it needs and return.
+ *
+ * This is an extension available only in this SAPI implementation.
+ * The TCTI layer is traced only for this library's TCTIs,
+ * and only for transfers that succeed.
+ */
+
+enum xtpm_trace_layer {
+    XTPM_TRACE_LAYER_SAPI = 0x1,
+    XTPM_TRACE_LAYER_TCTI = 0x2,
+};
+
+enum xtpm_trace_direction {
+    XTPM_TRACE_COMMAND,
+    XTPM_TRACE_RESPONSE,
+};
+
+struct xtpm_trace_event {
+    uint8_t layer;                  // enum xtpm_trace_layer
+    uint8_t direction;              // enum xtpm_trace_direction
+    TPM2_CC command_code;           // for a response, of the command it answers
+    TSS2_RC rc;                     // TCTI result, or for a SAPI-layer response, the response code
+    const uint8_t *buffer;          // valid only for the duration of the hook call
+    size_t length;                  // 0 if nothing was received
+    uint64_t start_ns;              // CLOCK_MONOTONIC, when the transfer started
+    uint64_t end_ns;                // CLOCK_MONOTONIC, when the transfer finished
+};
+
+typedef void (*xtpm_trace_fn)(const struct xtpm_trace_event *event,
+                              void *user_data);
+
+struct xtpm_trace_hook {
+    xtpm_trace_fn fn;
+    void *user_data;
+    unsigned layers;                // bitwise-or of enum xtpm_trace_layer
+};
+
+/*
+ * Register `hook` (or, if NULL, unregister the current hook)
+ * on `sysContext` and, if `hook->layers` includes XTPM_TRACE_LAYER_TCTI, on its TCTI.
+ *
+ * `hook` is not copied, and must stay valid until unregistered.
+ * Must not be called while a command is in flight on `sysContext`.
+ */
+TSS2_RC
+Tss2_Sys_SetTraceHook(TSS2_SYS_CONTEXT *sysContext,
+                      const struct xtpm_trace_hook *hook);
+
+/*
+ * Trace sink writing each event as a line of hex to the `FILE*` passed as `user_data`.
+ *
+ * Meant for debugging: formatting every byte is slow.
+ */
+void
+xtpm_trace_print(const struct xtpm_trace_event *event,
+                 void *user_data);
+
+/*
+ * Trace sink recording events in a compact binary form in a fixed-size ring buffer.
+ *
+ * When the ring is full, the oldest records are overwritten.
+ * The sink may be shared by hooks on several contexts, in several threads.
+ *
+ * Treat the fields as private.
+ */
+struct xtpm_trace_ring {
+    uint8_t *buffer;
+    size_t capacity;
+    size_t snap_length;
+    uint64_t head;
+    uint64_t tail;
+    uint64_t overwritten;
+    char lock;
+};
+
+/*
+ * Header of each record in an `xtpm_trace_ring`.
+ *
+ * In the ring, it's followed by `captured_length` bytes of the traced buffer,
+ * padded to a multiple of 8 bytes.
+ */
+struct xtpm_trace_record {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint32_t command_code;
+    uint32_t rc;
+    uint16_t length;                // of the traced buffer
+    uint16_t captured_length;       // at most the ring's `snap_length`
+    uint8_t layer;
+    uint8_t direction;
+    uint16_t reserved;
+};
+
+/*
+ * Set up `ring` to record into the `capacity` bytes at `buffer`.
+ *
+ * At most `snap_length` bytes of each traced buffer are kept
+ * (the header alone is enough to see what ran and for how long).
+ *
+ * Returns TSS2_BASE_RC_INSUFFICIENT_BUFFER if `capacity` can't hold
+ * even one record of `snap_length` bytes.
+ */
+TSS2_RC
+xtpm_trace_ring_init(struct xtpm_trace_ring *ring,
+                     void *buffer,
+                     size_t capacity,
+                     size_t snap_length);
+
+/*
+ * Trace hook function recording into the `struct xtpm_trace_ring*` passed as `user_data`.
+ */
+void
+xtpm_trace_ring_record(const struct xtpm_trace_event *event,
+                       void *user_data);
+
+/*
+ * Remove the oldest record from `ring`,
+ * copying its header to `record_out` and up to `data_size` bytes of its data to `data`.
+ *
+ * Returns 1 if a record was removed, or 0 if the ring is empty.
+ */
+int
+xtpm_trace_ring_pop(struct xtpm_trace_ring *ring,
+                    struct xtpm_trace_record *record_out,
+                    uint8_t *data,
+                    size_t data_size);
+
+/*
+ * Get the number of records overwritten (so lost) to make room for newer ones.
+ */
+uint64_t
+xtpm_trace_ring_overwritten(struct xtpm_trace_ring *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
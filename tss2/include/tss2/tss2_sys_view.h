@@ -0,0 +1,107 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2_SYS_VIEW_H
+#define XAPTUM_TSS2_SYS_VIEW_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "tss2_sys.h"
+
+#include <stdint.h>
+
+/*
+ * Zero-copy access to command outputs.
+ *
+ * Rather than copying the response into the (large) output structs,
+ * the `_View` variants of a command check that the response is well-formed and
+ * return the fields the caller is likely to want, with each TPM2B given as
+ * a span of the response still held in the SAPI context.
+ * The spans are valid only until the next command is prepared on that context.
+ *
+ * Only ECC keys and signatures are supported (TSS2_SYS_RC_MALFORMED_RESPONSE otherwise),
+ * like the rest of this SAPI.
+ *
+ * This is an extension available only in this SAPI implementation.
+ */
+
+struct xtpm_span {
+    const uint8_t *data;
+    uint16_t size;
+};
+
+struct xtpm_signature_view {
+    TPMI_ALG_SIG_SCHEME sigAlg;
+    TPMI_ALG_HASH hash;
+    struct xtpm_span r;
+    struct xtpm_span s;
+};
+
+struct xtpm_public_view {
+    TPMI_ALG_PUBLIC type;
+    TPMI_ALG_HASH nameAlg;
+    TPMA_OBJECT objectAttributes;
+    TPMI_ECC_CURVE curveID;
+    struct xtpm_span x;
+    struct xtpm_span y;
+};
+
+TSS2_RC
+Tss2_Sys_Sign_View(TSS2_SYS_CONTEXT *sysContext,
+                   TPMI_DH_OBJECT keyHandle,
+                   const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                   const TPM2B_DIGEST *digest,
+                   const TPMT_SIG_SCHEME *inScheme,
+                   const TPMT_TK_HASHCHECK *validation,
+                   struct xtpm_signature_view *signature,
+                   TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+TSS2_RC
+Tss2_Sys_Sign_CompleteView(TSS2_SYS_CONTEXT *sysContext,
+                           struct xtpm_signature_view *signature);
+
+TSS2_RC
+Tss2_Sys_NV_Read_View(TSS2_SYS_CONTEXT *sysContext,
+                      TPMI_RH_NV_AUTH authHandle,
+                      TPMI_RH_NV_INDEX nvIndex,
+                      const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                      uint16_t size,
+                      uint16_t offset,
+                      struct xtpm_span *data,
+                      TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray);
+
+TSS2_RC
+Tss2_Sys_NV_Read_CompleteView(TSS2_SYS_CONTEXT *sysContext,
+                              struct xtpm_span *data);
+
+/*
+ * Like `Tss2_Sys_ReadPublic`, without the names.
+ */
+TSS2_RC
+Tss2_Sys_ReadPublic_View(TSS2_SYS_CONTEXT *sysContext,
+                         TPMI_DH_OBJECT objectHandle,
+                         struct xtpm_public_view *outPublic);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2_TCTI_BROKER_H
+#define XAPTUM_TSS2_TCTI_BROKER_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <tss2/tss2_tcti.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct TSS2_TCTI_BROKER_CONTEXT TSS2_TCTI_BROKER_CONTEXT;
+
+typedef struct {
+    uint64_t commands;      // run for clients
+    uint64_t evictions;     // objects swapped out (ContextSave, if needed, then FlushContext)
+    uint64_t reloads;       // objects swapped back in (ContextLoad)
+} TSS2_TCTI_BROKER_STATS;
+
+/*
+ * A user-space resource manager: shares `inner_context` (e.g. a device TCTI on /dev/tpm0,
+ * or the mssim TCTI) between clients that each think they have the TPM to themselves.
+ *
+ * Each client (see `Tss2_Tcti_Broker_Client_Init`) sees only the transient objects it loaded,
+ * under virtual handles. When the TPM runs out of object memory, the least-recently-used
+ * object not needed by the current command is saved (ContextSave) and flushed,
+ * and it's loaded back (ContextLoad) when its client next uses it.
+ * So clients together may have more objects loaded than the TPM has room for.
+ *
+ * Commands are run one at a time. Only password authorizations are supported
+ * (as by this SAPI), so sessions aren't virtualized.
+ *
+ * `xtpm-broker` serves a broker to other processes, over a UNIX socket.
+ *
+ * Like the TCTI init functions, if `broker_context` is NULL this only sets `*size`
+ * to the number of bytes the caller must allocate for it.
+ */
+TSS2_RC
+Tss2_Tcti_Broker_Init(TSS2_TCTI_BROKER_CONTEXT *broker_context,
+                      size_t *size,
+                      TSS2_TCTI_CONTEXT *inner_context);
+
+/*
+ * Finalizes `inner_context`. All clients must have been finalized first.
+ *
+ * The caller still owns (and must free) the memory of both contexts.
+ */
+void
+Tss2_Tcti_Broker_Finalize(TSS2_TCTI_BROKER_CONTEXT *broker_context);
+
+/*
+ * A TCTI that sends its commands through `broker_context`.
+ *
+ * A client must only be used by one thread at a time,
+ * but any number of clients may share the broker.
+ *
+ * `transmit` only checks and copies the command. `receive` runs it,
+ * waiting for commands of other clients to finish first,
+ * and only supports TSS2_TCTI_TIMEOUT_BLOCK.
+ * Commands this broker doesn't know the handles of get a TPM_RC_COMMAND_CODE response.
+ *
+ * Finalizing the client flushes its objects.
+ * `cancel`, `getPollHandles` and `setLocality` are not supported.
+ */
+TSS2_RC
+Tss2_Tcti_Broker_Client_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                             size_t *size,
+                             TSS2_TCTI_BROKER_CONTEXT *broker_context);
+
+void
+Tss2_Tcti_Broker_GetStats(TSS2_TCTI_BROKER_CONTEXT *broker_context,
+                          TSS2_TCTI_BROKER_STATS *stats_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,109 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2_TCTI_DEVICE_POOL_H
+#define XAPTUM_TSS2_TCTI_DEVICE_POOL_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <tss2/tss2_tcti.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TSS2_TCTI_DEVICE_POOL_MAX_FDS 32
+
+typedef struct TSS2_TCTI_DEVICE_POOL TSS2_TCTI_DEVICE_POOL;
+
+/*
+ * When a client holds a file descriptor of the pool.
+ *
+ * PER_COMMAND: from `transmit` until the response has been received.
+ *   Commands from different clients then run on different fds, so one client's
+ *   marshaling and unmarshaling overlaps with another's TPM time (the kernel queues
+ *   the commands themselves). But consecutive commands of a client may go to different fds,
+ *   and the resource manager gives each fd its own handle space: this is only for commands
+ *   that don't use transient objects or sessions created by earlier ones
+ *   (e.g. signing with a persistent key, NV reads).
+ *
+ * PER_CLIENT: from the first `transmit` until the client is finalized.
+ *   The fd is then closed, so the kernel flushes whatever the client left loaded,
+ *   and the next client starts with an empty handle space.
+ */
+enum tss2_tcti_device_pool_lease {
+    TSS2_TCTI_DEVICE_POOL_LEASE_PER_COMMAND,
+    TSS2_TCTI_DEVICE_POOL_LEASE_PER_CLIENT,
+};
+
+typedef struct {
+    size_t open_fds;
+    size_t leased_fds;
+    uint64_t leases;    // total, since the pool was initialized
+    uint64_t waits;     // leases that had to wait for a fd to be returned
+} TSS2_TCTI_DEVICE_POOL_STATS;
+
+/*
+ * A bounded set of fds to a resource-managed TPM device (default "/dev/tpmrm0"),
+ * leased to client TCTIs (see `Tss2_Tcti_Device_Pool_Client_Init`).
+ *
+ * Up to `max_fds` (at most TSS2_TCTI_DEVICE_POOL_MAX_FDS) are opened, as they're needed.
+ * The first is opened here, so a bad `dev_file_path` is reported as TSS2_TCTI_RC_IO_ERROR.
+ *
+ * Like the TCTI init functions, if `pool` is NULL this only sets `*size`
+ * to the number of bytes the caller must allocate for it.
+ */
+TSS2_RC
+Tss2_Tcti_Device_Pool_Init(TSS2_TCTI_DEVICE_POOL *pool,
+                           size_t *size,
+                           const char *dev_file_path,
+                           size_t max_fds);
+
+/*
+ * Closes all fds. All clients must have been finalized first.
+ */
+void
+Tss2_Tcti_Device_Pool_Finalize(TSS2_TCTI_DEVICE_POOL *pool);
+
+/*
+ * A TCTI that sends its commands over an fd leased from `pool`, as given by `lease`.
+ *
+ * A client must only be used by one thread at a time,
+ * but any number of clients may share the pool.
+ * If all `max_fds` fds are leased, `transmit` blocks until one is returned.
+ *
+ * Like the device TCTI, `receive` only supports TSS2_TCTI_TIMEOUT_BLOCK.
+ * `cancel`, `getPollHandles` and `setLocality` are not supported.
+ */
+TSS2_RC
+Tss2_Tcti_Device_Pool_Client_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                                  size_t *size,
+                                  TSS2_TCTI_DEVICE_POOL *pool,
+                                  enum tss2_tcti_device_pool_lease lease);
+
+void
+Tss2_Tcti_Device_Pool_GetStats(TSS2_TCTI_DEVICE_POOL *pool,
+                               TSS2_TCTI_DEVICE_POOL_STATS *stats_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
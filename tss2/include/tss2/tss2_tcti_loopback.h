@@ -0,0 +1,78 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2_TCTI_LOOPBACK_H
+#define XAPTUM_TSS2_TCTI_LOOPBACK_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <tss2/tss2_tcti.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * In-process stand-in for a TPM, for measuring host-side overhead
+ * (marshaling, SAPI context handling, etc.) without the TPM's own latency.
+ *
+ * Implements the commands supported by this SAPI:
+ * CreatePrimary, Create, Load, Sign, Commit, ReadPublic, EvictControl,
+ * FlushContext, Clear, HierarchyChangeAuth, the NV_* commands,
+ * ContextSave and ContextLoad (of objects), CreateLoaded (under a storage key),
+ * GetRandom, GetCapability (handles and a few fixed TPM properties),
+ * PCR_Read and PCR_Extend (of a single SHA-256 bank of 24 PCRs),
+ * and SHA-256 hash sequences (HashSequenceStart, SequenceUpdate, SequenceComplete).
+ * A restricted signing key only signs digests with a hashcheck ticket from SequenceComplete.
+ * Like a small TPM, it only has room for 3 loaded transient objects.
+ * As in the reference TPM, an ECDAA Sign must use one of the last 128 commits, once.
+ * Hierarchy auths, transient and persistent objects, and NV indices are kept
+ * in the context, and password authorizations are checked against them.
+ * Each context starts out as a freshly-cleared TPM, with empty hierarchy auths.
+ *
+ * There is NO real cryptography: public keys, signatures, commit points
+ * and sequence digests are deterministic placeholders of the right sizes,
+ * and will not verify (nor match a real SHA-256).
+ *
+ * `conf` may be NULL, or "latency_us=<n>" to delay every response by n microseconds
+ * (see also `Tss2_Tcti_Loopback_SetLatency`).
+ */
+TSS2_RC
+Tss2_Tcti_Loopback_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                        size_t *size,
+                        const char *conf);
+
+/*
+ * Make each `command_code` command take (at least) `latency_us`,
+ * from the start of its transmit to the end of its receive.
+ *
+ * A `command_code` of 0 sets the latency of ALL commands.
+ */
+TSS2_RC
+Tss2_Tcti_Loopback_SetLatency(TSS2_TCTI_CONTEXT *tcti_context,
+                              TPM2_CC command_code,
+                              uint32_t latency_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -36,6 +36,10 @@ extern "C" {
 
 #include <stddef.h>
 
+/*
+ * `conf` is "host=<host>,port=<port>" to connect over TCP (e.g. to the simulator),
+ * or "path=<path>" to connect to a UNIX socket (e.g. served by `xtpm-broker`).
+ */
 TSS2_RC
 Tss2_Tcti_Mssim_Init(TSS2_TCTI_CONTEXT *tcti_context,
                      size_t *size,
@@ -0,0 +1,78 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2_TCTI_MUX_H
+#define XAPTUM_TSS2_TCTI_MUX_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <tss2/tss2_tcti.h>
+
+#include <stddef.h>
+
+typedef struct TSS2_TCTI_MUX_CONTEXT TSS2_TCTI_MUX_CONTEXT;
+
+/*
+ * Shares `inner_context` (any TCTI, e.g. device or mssim) between threads.
+ *
+ * Each thread talks to the TPM through its own client TCTI (see `Tss2_Tcti_Mux_Client_Init`).
+ * Commands from all clients go onto one lock-free queue, and are sent to `inner_context`
+ * one at a time, each followed by its response, by whichever client currently owns the queue.
+ *
+ * Like the TCTI init functions, if `mux_context` is NULL this only sets `*size`
+ * to the number of bytes the caller must allocate for it.
+ */
+TSS2_RC
+Tss2_Tcti_Mux_Init(TSS2_TCTI_MUX_CONTEXT *mux_context,
+                   size_t *size,
+                   TSS2_TCTI_CONTEXT *inner_context);
+
+/*
+ * Finalizes `inner_context`. All clients must have been finalized first.
+ *
+ * The caller still owns (and must free) the memory of both contexts.
+ */
+void
+Tss2_Tcti_Mux_Finalize(TSS2_TCTI_MUX_CONTEXT *mux_context);
+
+/*
+ * A TCTI that sends its commands through `mux_context`.
+ *
+ * A client must only be used by one thread at a time,
+ * but any number of clients may share the mux.
+ *
+ * `transmit` only queues the command, and never blocks.
+ * `receive` sends queued commands (of any client) if no other client is doing so,
+ * and otherwise waits up to `timeout` for this client's response to be delivered.
+ * Once a client has started sending, it finishes, regardless of `timeout`.
+ *
+ * `cancel`, `getPollHandles` and `setLocality` are not supported.
+ */
+TSS2_RC
+Tss2_Tcti_Mux_Client_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                          size_t *size,
+                          TSS2_TCTI_MUX_CONTEXT *mux_context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
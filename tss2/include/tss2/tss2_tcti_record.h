@@ -0,0 +1,51 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2_TCTI_RECORD_H
+#define XAPTUM_TSS2_TCTI_RECORD_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <tss2/tss2_tcti.h>
+
+#include <stddef.h>
+
+/*
+ * Wrapper TCTI that passes everything through to `inner_context`
+ * (any TCTI, e.g. device or mssim),
+ * logging each command, its response, and how long the round trip took to the file `path`.
+ *
+ * The file can be served back by the replay TCTI (see tss2_tcti_replay.h).
+ *
+ * Finalizing this TCTI also finalizes `inner_context`,
+ * but the caller still owns (and must free) the memory of both.
+ */
+TSS2_RC
+Tss2_Tcti_Record_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                      size_t *size,
+                      TSS2_TCTI_CONTEXT *inner_context,
+                      const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2_TCTI_REPLAY_H
+#define XAPTUM_TSS2_TCTI_REPLAY_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <tss2/tss2_tcti.h>
+
+#include <stddef.h>
+
+/*
+ * TCTI that serves the responses in a file written by the record TCTI
+ * (see tss2_tcti_record.h), in order, without a TPM.
+ *
+ * `conf` is a comma-separated list of:
+ *  - file=<path>: the recording to serve (required)
+ *  - timing=original: delay each response by as long as the recorded round trip took
+ *    (by default, responses are served immediately)
+ *
+ * Each command transmitted must be identical to the one recorded at that point,
+ * otherwise transmit fails with TSS2_TCTI_RC_GENERAL_FAILURE.
+ * Running past the end of the recording fails with TSS2_TCTI_RC_IO_ERROR.
+ *
+ * This implementation is blocking ONLY.
+ */
+TSS2_RC
+Tss2_Tcti_Replay_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                      size_t *size,
+                      const char *conf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
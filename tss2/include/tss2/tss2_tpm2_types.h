@@ -29,14 +29,34 @@ extern "C" {
 #endif
 
 // TODO: Make sure these make sense (they should work well with an Infineon SLB9670)
-//  MAX_[COMMAND,RESPONSE]_SIZE are probably too big. SLB9670 has an I/O buffer of 1280 B
+//  MAX_[COMMAND,RESPONSE]_SIZE are probably too big. SLB9670 has an I/O buffer of 1280 B,
+//  so SAPI contexts for it can be made smaller with Tss2_Sys_GetContextSize(1280).
 #define TPM2_MAX_COMMAND_SIZE  4096
 #define TPM2_MAX_RESPONSE_SIZE 4096
+
+/*
+ * Algorithm profile.
+ *
+ * By default, the unions and buffers below are sized for every algorithm in this subset.
+ * With XTPM_ECC_ONLY defined (the CMake option of the same name), they're sized
+ * for P-256 ECDSA/ECDAA keys with SHA-256 only, e.g. a TPM2B_DIGEST holds 32 bytes
+ * instead of 64.
+ * TPM2_MAX_SYM_DATA is the TPM's limit in either profile, since a TPM2B_SENSITIVE_DATA
+ * also carries Commit's `s2` (an ECDAA basename), which isn't tied to the key size.
+ *
+ * This changes the layout of the types, so everything using them must be built
+ * with the same profile (TSS2_ABI_VERSION_CURRENT differs, to catch mismatches).
+ * TPM responses with larger values then fail with TSS2_SYS_RC_MALFORMED_RESPONSE.
+ */
 #define TPM2_MAX_SYM_DATA 128
 #define TPM2_MAX_ECC_KEY_BYTES 32
 #define TPM2_MAX_NV_BUFFER_SIZE 768
+#define TPM2_MAX_DIGEST_BUFFER 1024
 #define TPM2_NUM_PCR_BANKS 1
-#define TPM2_PCR_SELECT_MAX 1
+#define TPM2_PCR_SELECT_MAX 3     // 24 PCRs, the minimum a TPM accepts in a selection
+#define TPM2_MAX_CONTEXT_SIZE 2048
+#define TPM2_MAX_CAP_HANDLES 32
+#define TPM2_MAX_TPM_PROPERTIES 32
 
 #define TPM2_SHA256_DIGEST_SIZE 32
 #define TPM2_SHA512_DIGEST_SIZE 64
@@ -45,11 +65,36 @@ typedef	uint16_t TPM2_ST;
 #define TPM2_ST_CREATION 0x8021
 #define TPM2_ST_HASHCHECK 0x8024
 
+// Starts the data the TPM itself generates (e.g. quotes), which a hash
+// sequence therefore gives no hash-check ticket for
+#define TPM2_GENERATED_VALUE 0xff544347
+
 typedef TPM2_ST TPMI_ST_COMMAND_TAG;
 #define TPM2_ST_NO_SESSIONS 0x8001
 #define TPM2_ST_SESSIONS 0x8002
 
 typedef uint32_t TPM2_HANDLE;
+#define TPM2_HR_NV_INDEX 0x01000000
+#define TPM2_HR_TRANSIENT 0x80000000
+#define TPM2_HR_PERSISTENT 0x81000000
+
+typedef uint8_t TPMI_YES_NO;
+#define TPM2_NO 0
+#define TPM2_YES 1
+
+typedef uint32_t TPM2_CAP;
+#define TPM2_CAP_HANDLES 0x00000001
+#define TPM2_CAP_TPM_PROPERTIES 0x00000006
+
+typedef uint32_t TPM2_PT;
+#define TPM2_PT_FIXED 0x00000100
+#define TPM2_PT_MANUFACTURER 0x00000105
+#define TPM2_PT_INPUT_BUFFER 0x0000010D
+#define TPM2_PT_HR_TRANSIENT_MIN 0x0000010E
+#define TPM2_PT_MAX_COMMAND_SIZE 0x0000011E
+#define TPM2_PT_MAX_RESPONSE_SIZE 0x0000011F
+#define TPM2_PT_MAX_DIGEST 0x00000120
+#define TPM2_PT_NV_BUFFER_MAX 0x0000012C
 
 typedef uint16_t TPM2_KEY_BITS;
 
@@ -71,6 +116,30 @@ typedef uint32_t TPM2_CC;
 #define TPM2_CC_EvictControl 0x00000120
 #define TPM2_CC_Clear 0x00000126
 #define TPM2_CC_ClearControl 0x00000127
+#define TPM2_CC_IncrementalSelfTest 0x00000142
+#define TPM2_CC_SelfTest 0x00000143
+#define TPM2_CC_Startup 0x00000144
+#define TPM2_CC_Shutdown 0x00000145
+#define TPM2_CC_StirRandom 0x00000146
+#define TPM2_CC_ContextLoad 0x00000161
+#define TPM2_CC_ContextSave 0x00000162
+#define TPM2_CC_FlushContext 0x00000165
+#define TPM2_CC_LoadExternal 0x00000167
+#define TPM2_CC_ECC_Parameters 0x00000178
+#define TPM2_CC_FirmwareRead 0x00000179
+#define TPM2_CC_GetRandom 0x0000017B
+#define TPM2_CC_GetTestResult 0x0000017C
+#define TPM2_CC_Hash 0x0000017D
+#define TPM2_CC_PCR_Read 0x0000017E
+#define TPM2_CC_ReadClock 0x00000181
+#define TPM2_CC_HashSequenceStart 0x00000186
+#define TPM2_CC_SequenceComplete 0x0000013E
+#define TPM2_CC_SequenceUpdate 0x0000015C
+#define TPM2_CC_VerifySignature 0x00000177
+#define TPM2_CC_PCR_Extend 0x00000182
+#define TPM2_CC_CreateLoaded 0x00000191
+#define TPM2_CC_TestParms 0x0000018A
+#define TPM2_CC_EC_Ephemeral 0x0000018E
 
 // Only password-authorizations are supported
 typedef	TPM2_HANDLE TPMI_SH_AUTH_SESSION;
@@ -79,6 +148,8 @@ typedef	TPM2_HANDLE TPMI_SH_AUTH_SESSION;
 typedef TPM2_HANDLE TPMI_DH_OBJECT;
 typedef TPM2_HANDLE TPMI_DH_PERSISTENT;
 typedef TPM2_HANDLE TPMI_DH_CONTEXT;
+typedef TPM2_HANDLE TPMI_DH_SAVED;
+typedef TPM2_HANDLE TPMI_DH_PCR;
 
 typedef	TPM2_HANDLE TPMI_RH_HIERARCHY;
 typedef	TPM2_HANDLE TPMI_RH_PROVISION;
@@ -145,7 +216,9 @@ typedef struct {
 
 typedef	union {
 	uint8_t sha256[TPM2_SHA256_DIGEST_SIZE];
+#ifndef XTPM_ECC_ONLY
 	uint8_t sha512[TPM2_SHA512_DIGEST_SIZE];
+#endif
 } TPMU_HA;
 
 typedef struct {
@@ -153,6 +226,11 @@ typedef struct {
     TPMU_HA digest;
 } TPMT_HA;
 
+typedef struct {
+    uint32_t count;
+    TPMT_HA digests[TPM2_NUM_PCR_BANKS];
+} TPML_DIGEST_VALUES;
+
 typedef struct {
     uint16_t size;
     uint8_t buffer[sizeof(TPMU_HA)];
@@ -160,6 +238,12 @@ typedef struct {
 
 typedef	TPM2B_DIGEST TPM2B_NONCE;
 
+// PCR_Read returns at most 8 digests
+typedef struct {
+    uint32_t count;
+    TPM2B_DIGEST digests[8];
+} TPML_DIGEST;
+
 typedef TPM2B_DIGEST TPM2B_AUTH;
 
 typedef uint8_t TPMA_SESSION;
@@ -309,6 +393,12 @@ typedef struct {
     TPMT_PUBLIC publicArea;
 } TPM2B_PUBLIC;
 
+// A marshaled TPMT_PUBLIC, for CreateLoaded
+typedef struct {
+    uint16_t size;
+    uint8_t buffer[sizeof(TPMT_PUBLIC)];
+} TPM2B_TEMPLATE;
+
 typedef struct {
     uint16_t size;
     uint8_t buffer[sizeof(TPMU_HA)];
@@ -433,6 +523,49 @@ typedef struct {
     uint8_t buffer[TPM2_MAX_NV_BUFFER_SIZE];
 } TPM2B_MAX_NV_BUFFER;
 
+typedef struct {
+    uint16_t size;
+    uint8_t buffer[TPM2_MAX_DIGEST_BUFFER];
+} TPM2B_MAX_BUFFER;
+
+typedef struct {
+    uint16_t size;
+    uint8_t buffer[TPM2_MAX_CONTEXT_SIZE];
+} TPM2B_CONTEXT_DATA;
+
+typedef struct {
+    uint64_t sequence;
+    TPMI_DH_SAVED savedHandle;
+    TPMI_RH_HIERARCHY hierarchy;
+    TPM2B_CONTEXT_DATA contextBlob;
+} TPMS_CONTEXT;
+
+typedef struct {
+    uint32_t count;
+    TPM2_HANDLE handle[TPM2_MAX_CAP_HANDLES];
+} TPML_HANDLE;
+
+typedef struct {
+    TPM2_PT property;
+    uint32_t value;
+} TPMS_TAGGED_PROPERTY;
+
+typedef struct {
+    uint32_t count;
+    TPMS_TAGGED_PROPERTY tpmProperty[TPM2_MAX_TPM_PROPERTIES];
+} TPML_TAGGED_TPM_PROPERTY;
+
+// Only these capabilities are supported (GetCapability fails on others)
+typedef union {
+    TPML_HANDLE handles;
+    TPML_TAGGED_TPM_PROPERTY tpmProperties;
+} TPMU_CAPABILITIES;
+
+typedef struct {
+    TPM2_CAP capability;
+    TPMU_CAPABILITIES data;
+} TPMS_CAPABILITY_DATA;
+
 #ifdef __cplusplus
 }
 #endif
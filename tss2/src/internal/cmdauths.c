@@ -20,8 +20,23 @@
 
 #include <tss2/tss2_sys.h>
 
+#include "command_utils.h"
 #include "marshal.h"
 
+#include <string.h>
+
+// Size of the authorization area, including its leading authorizationSize
+static
+size_t
+cmdauths_size(const TSS2L_SYS_AUTH_COMMAND *cmd_auths_array)
+{
+    size_t auths_size = sizeof(uint32_t);
+    for (unsigned i=0; i < cmd_auths_array->count; i++)
+        auths_size += marshaled_size_tpms_authcommand(&cmd_auths_array->auths[i]);
+
+    return auths_size;
+}
+
 TSS2_RC
 set_cmdauths(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
              const TSS2L_SYS_AUTH_COMMAND *cmd_auths_array)
@@ -29,6 +44,13 @@ set_cmdauths(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
     if (NULL == cmd_auths_array || 0 == cmd_auths_array->count)
         return TSS2_RC_SUCCESS;
 
+    if (cmd_auths_array->count > TSS2_SYS_MAX_SESSIONS)
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    TSS2_RC ret = check_command_room(sys_context, cmdauths_size(cmd_auths_array));
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
     sys_context->cmd_auths_count = cmd_auths_array->count;
 
     uint8_t *size_ptr = sys_context->ptr;
@@ -46,16 +68,54 @@ set_cmdauths(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
     return TSS2_RC_SUCCESS;
 }
 
+TSS2_RC
+insert_cmdauths(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                const TSS2L_SYS_AUTH_COMMAND *cmd_auths_array)
+{
+    if (0 == sys_context->cp_offset)
+        return TSS2_SYS_RC_BAD_SEQUENCE;
+
+    if (NULL == cmd_auths_array || 0 == cmd_auths_array->count)
+        return TSS2_RC_SUCCESS;
+
+    if (cmd_auths_array->count > TSS2_SYS_MAX_SESSIONS)
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    size_t auths_size = cmdauths_size(cmd_auths_array);
+
+    uint8_t *cp_buffer = sys_context->buffer + sys_context->cp_offset;
+    size_t params_size = sys_context->ptr - cp_buffer;
+    TSS2_RC ret = check_command_room(sys_context, auths_size);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    // Shift the already-marshaled parameters up, to make room for the auths.
+    memmove(cp_buffer + auths_size, cp_buffer, params_size);
+
+    uint8_t *tag_ptr = sys_context->buffer;
+    marshal_uint16(TPM2_ST_SESSIONS, &tag_ptr);
+
+    sys_context->ptr = cp_buffer;
+    ret = set_cmdauths(sys_context, cmd_auths_array);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    sys_context->cp_offset = sys_context->ptr - sys_context->buffer;
+    sys_context->ptr += params_size;
+
+    set_command_size(sys_context);
+
+    return TSS2_RC_SUCCESS;
+}
+
 TSS2_RC
 get_rspauths(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
              TSS2L_SYS_AUTH_RESPONSE *rsp_auths_array)
 {
-    if (NULL == rsp_auths_array || 0 == rsp_auths_array->count)
+    // Without command auths, the response has no 'parameter_size' either.
+    if (0 == sys_context->cmd_auths_count)
         return TSS2_RC_SUCCESS;
 
-    if (rsp_auths_array->count != sys_context->cmd_auths_count)
-        return TSS2_SYS_RC_INVALID_SESSIONS;
-
     // Get the 'parameter_size' (the length of the parameters after the handles and before the rsp_auths_array),
     // and make sure it's not too long for the response buffer.
     uint32_t parameter_size;
@@ -64,6 +124,15 @@ get_rspauths(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
     if ((sys_context->ptr + parameter_size) > (sys_context->buffer + sys_context->response_length))
         return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
+    // The caller doesn't want the rsp_auths_array, so leave just the parameters.
+    if (NULL == rsp_auths_array || 0 == rsp_auths_array->count) {
+        sys_context->remaining_response = parameter_size;
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (rsp_auths_array->count != sys_context->cmd_auths_count)
+        return TSS2_SYS_RC_INVALID_SESSIONS;
+
     // Skip over the parameters, to the rsp_auths_array.
     uint8_t *rsp_auths_ptr = sys_context->ptr + parameter_size;
 
@@ -32,6 +32,14 @@ TSS2_RC
 set_cmdauths(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
              const TSS2L_SYS_AUTH_COMMAND *cmd_auths_array);
 
+/*
+ * Add `cmd_auths_array` to a command already marshaled by a `_Prepare` function,
+ * moving the command parameters to make room for it.
+ */
+TSS2_RC
+insert_cmdauths(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                const TSS2L_SYS_AUTH_COMMAND *cmd_auths_array);
+
 TSS2_RC
 get_rspauths(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
              TSS2L_SYS_AUTH_RESPONSE *rsp_auths_array);
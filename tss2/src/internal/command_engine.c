@@ -0,0 +1,489 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include "command_engine.h"
+
+#include "command_utils.h"
+#include "cmdauths.h"
+#include "execute.h"
+#include "marshal.h"
+
+#include <assert.h>
+
+// Whether a TPM2B's size is within its buffer
+#define TPM2B_FITS(tpm2b, field) ((tpm2b)->size <= sizeof((tpm2b)->field))
+
+static
+int
+is_sized(enum param_kind kind)
+{
+    switch (kind) {
+        case PARAM_TPM2B_DIGEST:
+        case PARAM_TPM2B_DATA:
+        case PARAM_TPM2B_NAME:
+        case PARAM_TPM2B_PRIVATE:
+        case PARAM_TPM2B_SENSITIVE_DATA:
+        case PARAM_TPM2B_ECC_PARAMETER:
+        case PARAM_TPM2B_ECC_POINT:
+        case PARAM_TPM2B_MAX_NV_BUFFER:
+        case PARAM_TPM2B_MAX_BUFFER:
+        case PARAM_TPM2B_SENSITIVE_CREATE:
+        case PARAM_TPM2B_PUBLIC:
+        case PARAM_TPM2B_TEMPLATE:
+        case PARAM_TPM2B_NV_PUBLIC:
+        case PARAM_TPM2B_CREATION_DATA:
+        case PARAM_TPMT_TK_CREATION:
+        case PARAM_TPMT_TK_HASHCHECK:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Whether an input parameter fits in its type, so marshaling it reads only its own bytes
+static
+TSS2_RC
+check_param(enum param_kind kind,
+            const void *param)
+{
+    int fits = 1;
+
+    switch (kind) {
+        case PARAM_TPM2B_DIGEST:
+            fits = TPM2B_FITS((const TPM2B_DIGEST*)param, buffer);
+            break;
+        case PARAM_TPM2B_DATA:
+            fits = TPM2B_FITS((const TPM2B_DATA*)param, buffer);
+            break;
+        case PARAM_TPM2B_PRIVATE:
+            fits = TPM2B_FITS((const TPM2B_PRIVATE*)param, buffer);
+            break;
+        case PARAM_TPM2B_SENSITIVE_DATA:
+            fits = TPM2B_FITS((const TPM2B_SENSITIVE_DATA*)param, buffer);
+            break;
+        case PARAM_TPM2B_ECC_PARAMETER:
+            fits = TPM2B_FITS((const TPM2B_ECC_PARAMETER*)param, buffer);
+            break;
+        case PARAM_TPM2B_MAX_NV_BUFFER:
+            fits = TPM2B_FITS((const TPM2B_MAX_NV_BUFFER*)param, buffer);
+            break;
+        case PARAM_TPM2B_MAX_BUFFER:
+            fits = TPM2B_FITS((const TPM2B_MAX_BUFFER*)param, buffer);
+            break;
+        case PARAM_TPM2B_TEMPLATE:
+            fits = TPM2B_FITS((const TPM2B_TEMPLATE*)param, buffer);
+            break;
+        case PARAM_TPM2B_ECC_POINT: {
+            const TPMS_ECC_POINT *point = &((const TPM2B_ECC_POINT*)param)->point;
+            fits = TPM2B_FITS(&point->x, buffer) && TPM2B_FITS(&point->y, buffer);
+            break;
+        }
+        case PARAM_TPM2B_SENSITIVE_CREATE: {
+            const TPMS_SENSITIVE_CREATE *sensitive = &((const TPM2B_SENSITIVE_CREATE*)param)->sensitive;
+            fits = TPM2B_FITS(&sensitive->userAuth, buffer) && TPM2B_FITS(&sensitive->data, buffer);
+            break;
+        }
+        case PARAM_TPM2B_PUBLIC: {
+            const TPMT_PUBLIC *public_area = &((const TPM2B_PUBLIC*)param)->publicArea;
+            fits = TPM2B_FITS(&public_area->authPolicy, buffer)
+                   && TPM2B_FITS(&public_area->unique.ecc.x, buffer)
+                   && TPM2B_FITS(&public_area->unique.ecc.y, buffer);
+            break;
+        }
+        case PARAM_TPM2B_NV_PUBLIC:
+            fits = TPM2B_FITS(&((const TPM2B_NV_PUBLIC*)param)->nvPublic.authPolicy, buffer);
+            break;
+        case PARAM_TPMT_TK_HASHCHECK:
+            fits = TPM2B_FITS(&((const TPMT_TK_HASHCHECK*)param)->digest, buffer);
+            break;
+        case PARAM_TPMS_CONTEXT:
+            fits = TPM2B_FITS(&((const TPMS_CONTEXT*)param)->contextBlob, buffer);
+            break;
+        case PARAM_TPML_PCR_SELECTION: {
+            const TPML_PCR_SELECTION *selection = param;
+            fits = selection->count <= TPM2_NUM_PCR_BANKS;
+            for (unsigned i = 0; fits && i < selection->count; i++)
+                fits = selection->pcrSelections[i].sizeofSelect <= TPM2_PCR_SELECT_MAX;
+            break;
+        }
+        case PARAM_TPML_DIGEST_VALUES: {
+            const TPML_DIGEST_VALUES *digests = param;
+            if (digests->count > TPM2_NUM_PCR_BANKS)
+                return TSS2_SYS_RC_BAD_SIZE;
+            for (unsigned i = 0; i < digests->count; i++) {
+                if (0 == digest_size(digests->digests[i].hashAlg))
+                    return TSS2_SYS_RC_BAD_VALUE;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    return fits ? TSS2_RC_SUCCESS : TSS2_SYS_RC_BAD_SIZE;
+}
+
+static
+size_t
+marshaled_size_param(enum param_kind kind,
+                     const void *param)
+{
+    switch (kind) {
+        case PARAM_UINT8:
+            return sizeof(uint8_t);
+        case PARAM_UINT16:
+            return sizeof(uint16_t);
+        case PARAM_UINT32:
+            return sizeof(uint32_t);
+        case PARAM_TPM2B_DIGEST:
+            return marshaled_size_tpm2b_digest(param);
+        case PARAM_TPM2B_DATA:
+            return marshaled_size_tpm2b_data(param);
+        case PARAM_TPM2B_PRIVATE:
+            return marshaled_size_tpm2b_private(param);
+        case PARAM_TPM2B_SENSITIVE_DATA:
+            return marshaled_size_tpm2b_sensitivedata(param);
+        case PARAM_TPM2B_ECC_PARAMETER:
+            return marshaled_size_tpm2b_eccparameter(param);
+        case PARAM_TPM2B_ECC_POINT:
+            return marshaled_size_tpm2b_eccpoint(param);
+        case PARAM_TPM2B_MAX_NV_BUFFER:
+            return marshaled_size_tpm2b_maxnvbuffer(param);
+        case PARAM_TPM2B_MAX_BUFFER:
+            return marshaled_size_tpm2b_maxbuffer(param);
+        case PARAM_TPM2B_SENSITIVE_CREATE:
+            return marshaled_size_tpm2b_sensitivecreate(param);
+        case PARAM_TPM2B_PUBLIC:
+            return marshaled_size_tpm2b_public(param);
+        case PARAM_TPM2B_TEMPLATE:
+            return marshaled_size_tpm2b_template(param);
+        case PARAM_TPM2B_NV_PUBLIC:
+            return marshaled_size_tpm2b_nvpublic(param);
+        case PARAM_TPMT_TK_HASHCHECK:
+            return marshaled_size_tpmt_tkhashcheck(param);
+        case PARAM_TPMT_SIG_SCHEME:
+            return marshaled_size_tpmt_sigscheme(param);
+        case PARAM_TPML_PCR_SELECTION:
+            return marshaled_size_tpml_pcrselection(param);
+        case PARAM_TPML_DIGEST_VALUES:
+            return marshaled_size_tpml_digestvalues(param);
+        case PARAM_TPMS_CONTEXT:
+            return marshaled_size_tpms_context(param);
+        default:
+            assert(0 && "not a command parameter");
+            return 0;
+    }
+}
+
+static
+void
+marshal_param(enum param_kind kind,
+              const void *param,
+              uint8_t **out)
+{
+    switch (kind) {
+        case PARAM_UINT8:
+            **out = *(const uint8_t*)param;
+            *out += sizeof(uint8_t);
+            break;
+        case PARAM_UINT16:
+            marshal_uint16(*(const uint16_t*)param, out);
+            break;
+        case PARAM_UINT32:
+            marshal_uint32(*(const uint32_t*)param, out);
+            break;
+        case PARAM_TPM2B_DIGEST:
+            marshal_tpm2b_digest(param, out);
+            break;
+        case PARAM_TPM2B_DATA:
+            marshal_tpm2b_data(param, out);
+            break;
+        case PARAM_TPM2B_PRIVATE:
+            marshal_tpm2b_private(param, out);
+            break;
+        case PARAM_TPM2B_SENSITIVE_DATA:
+            marshal_tpm2b_sensitivedata(param, out);
+            break;
+        case PARAM_TPM2B_ECC_PARAMETER:
+            marshal_tpm2b_eccparameter(param, out);
+            break;
+        case PARAM_TPM2B_ECC_POINT:
+            marshal_tpm2b_eccpoint(param, out);
+            break;
+        case PARAM_TPM2B_MAX_NV_BUFFER:
+            marshal_tpm2b_maxnvbuffer(param, out);
+            break;
+        case PARAM_TPM2B_MAX_BUFFER:
+            marshal_tpm2b_maxbuffer(param, out);
+            break;
+        case PARAM_TPM2B_SENSITIVE_CREATE:
+            marshal_tpm2b_sensitivecreate(param, out);
+            break;
+        case PARAM_TPM2B_PUBLIC:
+            marshal_tpm2b_public(param, out);
+            break;
+        case PARAM_TPM2B_TEMPLATE:
+            marshal_tpm2b_template(param, out);
+            break;
+        case PARAM_TPM2B_NV_PUBLIC:
+            marshal_tpm2b_nvpublic(param, out);
+            break;
+        case PARAM_TPMT_TK_HASHCHECK:
+            marshal_tpmt_tkhashcheck(param, out);
+            break;
+        case PARAM_TPMT_SIG_SCHEME:
+            marshal_tpmt_sigscheme(param, out);
+            break;
+        case PARAM_TPML_PCR_SELECTION:
+            marshal_tpml_pcrselection(param, out);
+            break;
+        case PARAM_TPML_DIGEST_VALUES:
+            marshal_tpml_digestvalues(param, out);
+            break;
+        case PARAM_TPMS_CONTEXT:
+            marshal_tpms_context(param, out);
+            break;
+        default:
+            assert(0 && "not a command parameter");
+            break;
+    }
+}
+
+static
+int
+unmarshal_param(enum param_kind kind,
+                uint8_t **in,
+                uint32_t *in_max_length,
+                void *param)
+{
+    if (NULL == param && PARAM_TPMT_TK_CREATION != kind && PARAM_TPMT_TK_HASHCHECK != kind)
+        return skip_tpm2b(in, in_max_length);
+
+    switch (kind) {
+        case PARAM_UINT8:
+            return unmarshal_uint8(in, in_max_length, param);
+        case PARAM_UINT16:
+            return unmarshal_uint16(in, in_max_length, param);
+        case PARAM_UINT32:
+            return unmarshal_uint32(in, in_max_length, param);
+        case PARAM_TPM2B_DIGEST:
+            return unmarshal_tpm2b_digest(in, in_max_length, param);
+        case PARAM_TPM2B_NAME:
+            return unmarshal_tpm2b_name(in, in_max_length, param);
+        case PARAM_TPM2B_PRIVATE:
+            return unmarshal_tpm2b_private(in, in_max_length, param);
+        case PARAM_TPM2B_ECC_POINT:
+            return unmarshal_tpm2b_eccpoint(in, in_max_length, param);
+        case PARAM_TPM2B_MAX_NV_BUFFER:
+            return unmarshal_tpm2b_maxnvbuffer(in, in_max_length, param);
+        case PARAM_TPM2B_PUBLIC:
+            return unmarshal_tpm2b_public(in, in_max_length, param);
+        case PARAM_TPM2B_NV_PUBLIC:
+            return unmarshal_tpm2b_nvpublic(in, in_max_length, param);
+        case PARAM_TPM2B_CREATION_DATA:
+            return unmarshal_tpm2b_creationdata(in, in_max_length, param);
+        case PARAM_TPMT_TK_CREATION:
+            return unmarshal_tpmt_tkcreation(in, in_max_length, param);
+        case PARAM_TPMT_TK_HASHCHECK:
+            return unmarshal_tpmt_tkhashcheck(in, in_max_length, param);
+        case PARAM_TPMT_SIGNATURE:
+            return unmarshal_tpmt_signature(in, in_max_length, param);
+        case PARAM_TPML_PCR_SELECTION:
+            return unmarshal_tpml_pcrselection(in, in_max_length, param);
+        case PARAM_TPML_DIGEST:
+            return unmarshal_tpml_digest(in, in_max_length, param);
+        case PARAM_TPMS_CONTEXT:
+            return unmarshal_tpms_context(in, in_max_length, param);
+        case PARAM_TPMS_CAPABILITY_DATA:
+            return unmarshal_tpms_capabilitydata(in, in_max_length, param);
+        default:
+            assert(0 && "not a response parameter");
+            return -1;
+    }
+}
+
+// Check the input parameters, and return the room they need.
+static
+TSS2_RC
+check_params(const struct command_desc *desc,
+             const void *const *in,
+             size_t *size_out)
+{
+    *size_out = 0;
+
+    for (unsigned i = 0; i < COMMAND_MAX_PARAMS && PARAM_NONE != desc->in[i]; i++) {
+        if (NULL == in[i])
+            return TSS2_SYS_RC_BAD_REFERENCE;
+
+        TSS2_RC ret = check_param(desc->in[i], in[i]);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        *size_out += marshaled_size_param(desc->in[i], in[i]);
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+void
+marshal_params(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+               const struct command_desc *desc,
+               const void *const *in)
+{
+    for (unsigned i = 0; i < COMMAND_MAX_PARAMS && PARAM_NONE != desc->in[i]; i++)
+        marshal_param(desc->in[i], in[i], &sys_context->ptr);
+
+    set_command_size(sys_context);
+}
+
+TSS2_RC
+execute_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                const struct command_desc *desc,
+                const TPM2_HANDLE *handles,
+                const TSS2L_SYS_AUTH_COMMAND *cmd_auths_array,
+                const void *const *in,
+                TPM2_HANDLE *handle_out,
+                TSS2L_SYS_AUTH_RESPONSE *rsp_auths_array)
+{
+    if ((desc->flags & COMMAND_AUTHS_REQUIRED) && NULL == cmd_auths_array)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    if ((desc->flags & COMMAND_RETURNS_HANDLE) && NULL == handle_out)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    size_t params_size;
+    TSS2_RC ret = check_params(desc, in, &params_size);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    int sessions = (desc->flags & COMMAND_AUTHS_REQUIRED)
+                   || (NULL != cmd_auths_array && 0 != cmd_auths_array->count);
+    build_command_header(sys_context, desc->code, sessions ? TPM2_ST_SESSIONS : TPM2_ST_NO_SESSIONS);
+
+    for (unsigned i = 0; i < desc->handle_count; i++)
+        marshal_uint32(handles[i], &sys_context->ptr);
+
+    ret = set_cmdauths(sys_context, cmd_auths_array);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    ret = check_command_room(sys_context, params_size);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    marshal_params(sys_context, desc, in);
+
+    ret = Tss2_Sys_Execute(sys_context);
+    if (ret)
+        return ret;
+
+    if (desc->flags & COMMAND_RETURNS_HANDLE) {
+        if (0 != unmarshal_uint32(&sys_context->ptr, &sys_context->remaining_response, handle_out))
+            return TSS2_SYS_RC_MALFORMED_RESPONSE;
+    }
+
+    return get_rspauths(sys_context, rsp_auths_array);
+}
+
+TSS2_RC
+unmarshal_response(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                   const struct command_desc *desc,
+                   void *const *out)
+{
+    for (unsigned i = 0; i < COMMAND_MAX_PARAMS && PARAM_NONE != desc->out[i]; i++) {
+        if (0 != unmarshal_param(desc->out[i], &sys_context->ptr, &sys_context->remaining_response, out[i]))
+            return TSS2_SYS_RC_MALFORMED_RESPONSE;
+    }
+
+    if (0 != sys_context->remaining_response)
+        return TSS2_SYS_RC_MALFORMED_RESPONSE;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+run_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+            const struct command_desc *desc,
+            const TPM2_HANDLE *handles,
+            const TSS2L_SYS_AUTH_COMMAND *cmd_auths_array,
+            const void *const *in,
+            TPM2_HANDLE *handle_out,
+            void *const *out,
+            TSS2L_SYS_AUTH_RESPONSE *rsp_auths_array)
+{
+    // Only the TPM2Bs (and tickets) can be skipped over without somewhere to put them.
+    for (unsigned i = 0; i < COMMAND_MAX_PARAMS && PARAM_NONE != desc->out[i]; i++) {
+        if (NULL == out[i] && !is_sized(desc->out[i]))
+            return TSS2_SYS_RC_BAD_REFERENCE;
+    }
+
+    TSS2_RC ret = execute_command(sys_context, desc, handles, cmd_auths_array, in, handle_out, rsp_auths_array);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    return unmarshal_response(sys_context, desc, out);
+}
+
+TSS2_RC
+prepare_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                const struct command_desc *desc,
+                const TPM2_HANDLE *handles,
+                const void *const *in)
+{
+    size_t params_size;
+    TSS2_RC ret = check_params(desc, in, &params_size);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    build_command_header(sys_context, desc->code, TPM2_ST_NO_SESSIONS);
+
+    for (unsigned i = 0; i < desc->handle_count; i++)
+        marshal_uint32(handles[i], &sys_context->ptr);
+
+    sys_context->cp_offset = sys_context->ptr - sys_context->buffer;
+
+    ret = check_command_room(sys_context, params_size);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    marshal_params(sys_context, desc, in);
+
+    sys_context->previous_stage = CMD_STAGE_PREPARE;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+complete_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                 const struct command_desc *desc,
+                 void *const *out)
+{
+    if (CMD_STAGE_RECEIVE_RESPONSE != sys_context->previous_stage)
+        return TSS2_SYS_RC_BAD_SEQUENCE;
+
+    if (TSS2_RC_SUCCESS != sys_context->response_code)
+        return sys_context->response_code;
+
+    for (unsigned i = 0; i < COMMAND_MAX_PARAMS && PARAM_NONE != desc->out[i]; i++) {
+        if (NULL == out[i] && !is_sized(desc->out[i]))
+            return TSS2_SYS_RC_BAD_REFERENCE;
+    }
+
+    return unmarshal_response(sys_context, desc, out);
+}
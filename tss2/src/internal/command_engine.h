@@ -0,0 +1,154 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2INTERNAL_COMMAND_ENGINE_H
+#define XAPTUM_TSS2INTERNAL_COMMAND_ENGINE_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <tss2/tss2_sys.h>
+
+#include "sys_context_common.h"
+
+/*
+ * Types of command and response parameters.
+ * Each is (un)marshaled by the marshal.c functions for that type.
+ */
+enum param_kind {
+    PARAM_NONE = 0,     // ends a parameter list
+    PARAM_UINT8,
+    PARAM_UINT16,
+    PARAM_UINT32,
+    PARAM_TPM2B_DIGEST,     // also TPM2B_AUTH
+    PARAM_TPM2B_DATA,
+    PARAM_TPM2B_NAME,
+    PARAM_TPM2B_PRIVATE,
+    PARAM_TPM2B_SENSITIVE_DATA,
+    PARAM_TPM2B_ECC_PARAMETER,
+    PARAM_TPM2B_ECC_POINT,
+    PARAM_TPM2B_MAX_NV_BUFFER,
+    PARAM_TPM2B_MAX_BUFFER,
+    PARAM_TPM2B_SENSITIVE_CREATE,
+    PARAM_TPM2B_PUBLIC,
+    PARAM_TPM2B_TEMPLATE,
+    PARAM_TPM2B_NV_PUBLIC,
+    PARAM_TPM2B_CREATION_DATA,
+    PARAM_TPMT_TK_CREATION,
+    PARAM_TPMT_TK_HASHCHECK,
+    PARAM_TPMT_SIG_SCHEME,
+    PARAM_TPMT_SIGNATURE,
+    PARAM_TPML_PCR_SELECTION,
+    PARAM_TPML_DIGEST,
+    PARAM_TPML_DIGEST_VALUES,
+    PARAM_TPMS_CONTEXT,
+    PARAM_TPMS_CAPABILITY_DATA,
+};
+
+#define COMMAND_MAX_PARAMS 5
+
+// The command fails with TSS2_SYS_RC_BAD_REFERENCE if it's given no cmdAuthsArray.
+#define COMMAND_AUTHS_REQUIRED 0x01
+// The response has a handle, before its parameters.
+#define COMMAND_RETURNS_HANDLE 0x02
+
+/*
+ * How to marshal a command and unmarshal its response.
+ *
+ * Each command's `Tss2_Sys_*` functions have a static one of these,
+ * and pass their arguments to the functions below in arrays, in the order listed here.
+ */
+struct command_desc {
+    TPM2_CC code;
+    uint8_t handle_count;   // in the handle area (so before the authorizations)
+    uint8_t flags;
+    uint8_t in[COMMAND_MAX_PARAMS];     // enum param_kind, up to the first PARAM_NONE
+    uint8_t out[COMMAND_MAX_PARAMS];
+};
+
+/*
+ * Marshal and send `desc`'s command, and receive its response.
+ *
+ * The input parameters in `in` must all be non-NULL, and their TPM2Bs and lists
+ * within their capacities (or this returns TSS2_SYS_RC_BAD_SIZE before sending anything).
+ *
+ * On success, `*handle_out` is the response handle (for a COMMAND_RETURNS_HANDLE command),
+ * `rsp_auths_array` (if not NULL) the response authorizations,
+ * and `sys_context->ptr` points at the response parameters.
+ */
+TSS2_RC
+execute_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                const struct command_desc *desc,
+                const TPM2_HANDLE *handles,
+                const TSS2L_SYS_AUTH_COMMAND *cmd_auths_array,
+                const void *const *in,
+                TPM2_HANDLE *handle_out,
+                TSS2L_SYS_AUTH_RESPONSE *rsp_auths_array);
+
+/*
+ * Unmarshal the response parameters that `execute_command` (or `Tss2_Sys_ExecuteFinish`)
+ * left at `sys_context->ptr` into `out`.
+ *
+ * TPM2B outputs, and tickets, may be NULL to skip them.
+ * Returns TSS2_SYS_RC_MALFORMED_RESPONSE if anything's left over.
+ */
+TSS2_RC
+unmarshal_response(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                   const struct command_desc *desc,
+                   void *const *out);
+
+/*
+ * `execute_command` then `unmarshal_response`: all of a one-call `Tss2_Sys_*` function.
+ *
+ * Outputs that may not be NULL are checked before anything's sent.
+ */
+TSS2_RC
+run_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+            const struct command_desc *desc,
+            const TPM2_HANDLE *handles,
+            const TSS2L_SYS_AUTH_COMMAND *cmd_auths_array,
+            const void *const *in,
+            TPM2_HANDLE *handle_out,
+            void *const *out,
+            TSS2L_SYS_AUTH_RESPONSE *rsp_auths_array);
+
+/*
+ * Marshal `desc`'s command without authorizations, for a `_Prepare` function.
+ * (`Tss2_Sys_SetCmdAuths` can add them.)
+ */
+TSS2_RC
+prepare_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                const struct command_desc *desc,
+                const TPM2_HANDLE *handles,
+                const void *const *in);
+
+/*
+ * Check that a response has arrived, then `unmarshal_response`, for a `_Complete` function.
+ */
+TSS2_RC
+complete_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                 const struct command_desc *desc,
+                 void *const *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -38,3 +38,13 @@ set_command_size(TSS2_SYS_CONTEXT_OPAQUE *sys_context)
     uint8_t *size_ptr = sys_context->buffer + sizeof(uint16_t); // command size is after command tag
     marshal_uint32(sys_context->ptr - sys_context->buffer, &size_ptr);
 }
+
+TSS2_RC
+check_command_room(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                   size_t size)
+{
+    if (size > sys_context->buffer_size - (size_t)(sys_context->ptr - sys_context->buffer))
+        return TSS2_SYS_RC_INSUFFICIENT_CONTEXT;
+
+    return TSS2_RC_SUCCESS;
+}
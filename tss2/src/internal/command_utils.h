@@ -36,6 +36,14 @@ build_command_header(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
 void
 set_command_size(TSS2_SYS_CONTEXT_OPAQUE *sys_context);
 
+/*
+ * Returns TSS2_SYS_RC_INSUFFICIENT_CONTEXT if `size` more bytes
+ * won't fit in the command buffer.
+ */
+TSS2_RC
+check_command_room(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                   size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -19,32 +19,199 @@
 #include <tss2/tss2_sys.h>
 #include <tss2/tss2_tcti.h>
 
+#include "execute.h"
 #include "sys_context_common.h"
 
+#include "flight_recorder.h"
 #include "marshal.h"
+#include "stats.h"
+#include "tcti_common.h"
 
-#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+static
+int
+is_retryable(TSS2_RC ret)
+{
+    return TPM_RC_RETRY == ret || TPM_RC_YIELDED == ret || TPM_RC_TESTING == ret;
+}
+
+static
+void
+sleep_us(uint32_t delay_us)
+{
+    struct timespec ts = {.tv_sec = delay_us / 1000000,
+                          .tv_nsec = (delay_us % 1000000) * 1000};
+    while (0 != nanosleep(&ts, &ts))
+        ;
+}
+
+static
+TPM2_CC
+get_command_code(TSS2_SYS_CONTEXT_OPAQUE *sys_context)
+{
+    uint8_t *cc_ptr = sys_context->command_header + sizeof(TPMI_ST_COMMAND_TAG) + sizeof(uint32_t);
+    uint32_t remaining = sizeof(TPM2_CC);
+    TPM2_CC command_code = 0;
+    (void)unmarshal_uint32(&cc_ptr, &remaining, &command_code);
+
+    return command_code;
+}
+
+// First handle of the command in the buffer, or 0 if it has none.
+static
+TPM2_HANDLE
+get_first_handle(TSS2_SYS_CONTEXT_OPAQUE *sys_context)
+{
+    switch (get_command_code(sys_context)) {
+        case TPM2_CC_IncrementalSelfTest:
+        case TPM2_CC_SelfTest:
+        case TPM2_CC_Startup:
+        case TPM2_CC_Shutdown:
+        case TPM2_CC_StirRandom:
+        case TPM2_CC_ContextLoad:
+        case TPM2_CC_LoadExternal:
+        case TPM2_CC_ECC_Parameters:
+        case TPM2_CC_FirmwareRead:
+        case TPM2_CC_GetCapability:
+        case TPM2_CC_GetRandom:
+        case TPM2_CC_GetTestResult:
+        case TPM2_CC_Hash:
+        case TPM2_CC_PCR_Read:
+        case TPM2_CC_ReadClock:
+        case TPM2_CC_HashSequenceStart:
+        case TPM2_CC_TestParms:
+        case TPM2_CC_EC_Ephemeral:
+            return 0;
+    }
+
+    uint8_t *handle_ptr = sys_context->buffer + COMMAND_HEADER_SIZE;
+    uint32_t remaining = sys_context->ptr - handle_ptr;
+    TPM2_HANDLE handle = 0;
+    (void)unmarshal_uint32(&handle_ptr, &remaining, &handle);
+
+    return handle;
+}
+
+static inline
+void
+trace(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+      enum xtpm_trace_direction direction,
+      TSS2_RC rc,
+      size_t length,
+      uint64_t start_ns,
+      uint64_t end_ns)
+{
+    const struct xtpm_trace_hook *hook = sys_context->trace_hook;
+    if (NULL == hook || !(hook->layers & XTPM_TRACE_LAYER_SAPI))
+        return;
+
+    struct xtpm_trace_event event = {.layer = XTPM_TRACE_LAYER_SAPI,
+                                     .direction = direction,
+                                     .command_code = get_command_code(sys_context),
+                                     .rc = rc,
+                                     .buffer = sys_context->buffer,
+                                     .length = length,
+                                     .start_ns = start_ns,
+                                     .end_ns = end_ns};
+    hook->fn(&event, hook->user_data);
+}
+
+// The retry state of the command in the buffer, moved to the front of the slots.
+// If it has none and `claim` is set, the least recently retried command's slot is taken.
+static
+struct retry_state*
+get_retry_state(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                int claim)
+{
+    TPM2_CC command_code = get_command_code(sys_context);
+
+    if (command_code < RETRY_CC_FIRST || command_code - RETRY_CC_FIRST >= RETRY_CC_COUNT)
+        return NULL;
+
+    uint8_t slot_cc = command_code - RETRY_CC_FIRST + 1;
+
+    unsigned i = 0;
+    while (i < RETRY_STATE_SLOTS - 1 && sys_context->retry_ccs[i] != slot_cc)
+        i++;
+
+    struct retry_state state = sys_context->retry_states[i];
+    if (sys_context->retry_ccs[i] != slot_cc) {
+        if (!claim)
+            return NULL;
+        state = (struct retry_state){0};
+    }
+
+    memmove(&sys_context->retry_states[1], &sys_context->retry_states[0], i * sizeof(struct retry_state));
+    memmove(&sys_context->retry_ccs[1], &sys_context->retry_ccs[0], i);
+    sys_context->retry_states[0] = state;
+    sys_context->retry_ccs[0] = slot_cc;
+
+    return &sys_context->retry_states[0];
+}
 
 TSS2_RC
 Tss2_Sys_Execute(TSS2_SYS_CONTEXT_OPAQUE *sys_context)
 {
     TSS2_RC ret;
 
+    ret = send_command(sys_context);
+    if (ret)
+        return ret;
+
+    return finish_command(sys_context, TSS2_TCTI_TIMEOUT_BLOCK);
+}
+
+TSS2_RC
+send_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context)
+{
+    TSS2_RC ret;
+
+    // A dry-run context only marshals, leaving the command in the buffer.
+    if (NULL == sys_context->tcti_context) {
+        sys_context->previous_stage = CMD_STAGE_PREPARE;
+        return TSS2_SYS_RC_NOT_PERMITTED;
+    }
+
+    // A warning response overwrites only the header, so that's all that needs saving to resend.
+    memcpy(sys_context->command_header, sys_context->buffer, COMMAND_HEADER_SIZE);
+
+    sys_context->transmit_start_ns = tcti_now_ns();
+
+    sys_context->flight_ticket = flight_begin(get_command_code(sys_context),
+                                              get_first_handle(sys_context),
+                                              sys_context->transmit_start_ns);
+
     ret = Tss2_Tcti_Transmit(sys_context->tcti_context,
                              sys_context->ptr - sys_context->buffer,
                              sys_context->buffer);
-    if (ret)
-        return ret;
 
-    size_t response_size = sizeof(sys_context->buffer);
-    assert(TPM2_MAX_COMMAND_SIZE == sizeof(sys_context->buffer));
+    sys_context->transmit_end_ns = tcti_now_ns();
 
-    ret = Tss2_Tcti_Receive(sys_context->tcti_context,
-                            &response_size,
-                            sys_context->buffer,
-                            TSS2_TCTI_TIMEOUT_BLOCK);
-    if (ret)
+    trace(sys_context, XTPM_TRACE_COMMAND, ret, sys_context->ptr - sys_context->buffer,
+          sys_context->transmit_start_ns, sys_context->transmit_end_ns);
+
+    if (ret) {
+        flight_end(sys_context->flight_ticket, ret, sys_context->transmit_end_ns);
+        record_command(get_command_code(sys_context), ret,
+                       sys_context->transmit_start_ns, sys_context->transmit_end_ns, 0, 0);
         return ret;
+    }
+
+    sys_context->previous_stage = CMD_STAGE_SEND_COMMAND;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+parse_response_header(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                      size_t response_size)
+{
+    TSS2_RC ret;
+
+    sys_context->previous_stage = CMD_STAGE_RECEIVE_RESPONSE;
 
     if (response_size < (sizeof(TPMI_ST_COMMAND_TAG) + sizeof(uint32_t) + sizeof(uint32_t)))
         return TSS2_SYS_RC_INSUFFICIENT_RESPONSE;
@@ -65,5 +232,121 @@ Tss2_Sys_Execute(TSS2_SYS_CONTEXT_OPAQUE *sys_context)
     if (0 != unmarshal_uint32(&sys_context->ptr, &sys_context->remaining_response, &ret))
         return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
+    sys_context->response_code = ret;
+
+    return ret;
+}
+
+TSS2_RC
+receive_response(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                 int32_t timeout)
+{
+    TSS2_RC ret;
+
+    // The TCTI fails with TSS2_TCTI_RC_INSUFFICIENT_BUFFER if the response doesn't fit.
+    size_t response_size = sys_context->buffer_size;
+
+    ret = Tss2_Tcti_Receive(sys_context->tcti_context,
+                            &response_size,
+                            sys_context->buffer,
+                            timeout);
+
+    uint64_t receive_end_ns = tcti_now_ns();
+
+    // Only this library's TCTIs report when the response started arriving.
+    uint64_t response_start_ns = receive_end_ns;
+    TSS2_TCTI_CONTEXT_COMMON_XAPTUM *tcti = (TSS2_TCTI_CONTEXT_COMMON_XAPTUM*)sys_context->tcti_context;
+    if (TCTI_MAGIC == tcti->v1.magic &&
+            tcti->response_start_ns >= sys_context->transmit_end_ns &&
+            tcti->response_start_ns <= receive_end_ns)
+        response_start_ns = tcti->response_start_ns;
+
+    // A non-blocking poll found no response yet; the command is still in flight.
+    if (TSS2_TCTI_RC_TRY_AGAIN == ret)
+        return ret;
+
+    size_t received_size = 0;
+    if (!ret) {
+        received_size = response_size;
+        ret = parse_response_header(sys_context, response_size);
+    }
+
+    trace(sys_context, XTPM_TRACE_RESPONSE, ret, received_size, response_start_ns, receive_end_ns);
+
+    flight_end(sys_context->flight_ticket, ret, receive_end_ns);
+
+    record_command(get_command_code(sys_context),
+                   ret,
+                   sys_context->transmit_start_ns,
+                   sys_context->transmit_end_ns,
+                   response_start_ns,
+                   receive_end_ns);
+
+    return ret;
+}
+
+TSS2_RC
+finish_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+               int32_t timeout)
+{
+    TSS2_RC ret = receive_response(sys_context, timeout);
+
+    const TSS2_SYS_RETRY_POLICY *policy = &sys_context->retry_policy;
+    if (0 == policy->maxRetries || TSS2_TCTI_RC_TRY_AGAIN == ret)
+        return ret;
+
+    // Retrying sleeps, so a caller that won't block gets the warning to handle itself.
+    if (TSS2_TCTI_TIMEOUT_BLOCK != timeout && is_retryable(ret))
+        return ret;
+
+    struct retry_state *state = get_retry_state(sys_context, is_retryable(ret));
+
+    uint32_t delay_us = policy->initialDelayUs;
+    if (NULL != state && state->learned_delay_us > delay_us)
+        delay_us = state->learned_delay_us;
+
+    uint32_t retries = 0;
+    while (is_retryable(ret) &&
+            COMMAND_HEADER_SIZE == sys_context->response_length &&
+            retries < policy->maxRetries) {
+        sleep_us(delay_us);
+
+        // Restore the command header (overwritten by the response) and resend.
+        memcpy(sys_context->buffer, sys_context->command_header, COMMAND_HEADER_SIZE);
+        uint8_t *size_ptr = sys_context->command_header + sizeof(TPMI_ST_COMMAND_TAG);
+        uint32_t remaining = sizeof(uint32_t);
+        uint32_t command_size;
+        if (0 != unmarshal_uint32(&size_ptr, &remaining, &command_size))
+            return TSS2_SYS_RC_GENERAL_FAILURE;
+        sys_context->ptr = sys_context->buffer + command_size;
+
+        ret = send_command(sys_context);
+        if (ret)
+            return ret;
+
+        retries++;
+        if (NULL != state)
+            state->counters.retries++;
+
+        ret = receive_response(sys_context, timeout);
+        if (is_retryable(ret))
+            delay_us = delay_us > policy->maxDelayUs / 2 ? policy->maxDelayUs : delay_us * 2;
+    }
+
+    // The resent command is still in flight, so nothing is known about the delay yet.
+    if (NULL == state || TSS2_TCTI_RC_TRY_AGAIN == ret)
+        return ret;
+
+    if (is_retryable(ret)) {
+        if (retries == policy->maxRetries)
+            state->counters.exhausted++;
+    } else if (0 != retries) {
+        // Start the next retry of this command from the delay that worked.
+        state->learned_delay_us = delay_us;
+    } else {
+        // No contention this time, so back off from the learned delay.
+        state->learned_delay_us /= 2;
+    }
+
     return ret;
 }
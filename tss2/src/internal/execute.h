@@ -28,9 +28,40 @@ extern "C" {
 
 #include "sys_context_common.h"
 
+/*
+ * Send the command marshaled in `sys_context` and wait for its response.
+ *
+ * Returns the TPM response code, or an error from the TCTI or from parsing
+ * the response header.
+ */
 TSS2_RC
 Tss2_Sys_Execute(TSS2_SYS_CONTEXT_OPAQUE *sys_context);
 
+/*
+ * Transmit the command marshaled in `sys_context`, without waiting for the response.
+ */
+TSS2_RC
+send_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context);
+
+/*
+ * Receive the response to a command previously sent with `send_command`,
+ * and parse its header.
+ *
+ * On return, `sys_context->ptr` points just past the response code.
+ */
+TSS2_RC
+receive_response(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+                 int32_t timeout);
+
+/*
+ * Receive the response to a command previously sent with `send_command`,
+ * resending it (per `sys_context->retry_policy`) while the TPM answers
+ * with a retryable warning.
+ */
+TSS2_RC
+finish_command(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+               int32_t timeout);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,53 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2INTERNAL_FLIGHT_RECORDER_H
+#define XAPTUM_TSS2INTERNAL_FLIGHT_RECORDER_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <tss2/tss2_sys_flight_recorder.h>
+#include <tss2/tss2_common.h>
+
+/*
+ * Record that a round trip of `command_code` (on `handle`) started at `start_ns`.
+ *
+ * Returns the ticket to pass to `flight_end` once it finishes.
+ */
+uint64_t
+flight_begin(TPM2_CC command_code,
+             TPM2_HANDLE handle,
+             uint64_t start_ns);
+
+/*
+ * Record the result of the round trip with ticket `ticket`
+ * (unless its entry has since been reused).
+ */
+void
+flight_end(uint64_t ticket,
+           TSS2_RC rc,
+           uint64_t end_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -36,6 +36,42 @@ typedef struct {
     uint8_t buffer[TPM2_SHA512_DIGEST_SIZE];
 } TPM2B_SIMPLE;
 
+// C99 has no _Static_assert, but an array can't have a negative size.
+#define STATIC_ASSERT(cond, name) typedef char static_assert_##name[(cond) ? 1 : -1]
+
+// Every TPM2B is (un)marshaled through a cast to TPM2B_SIMPLE,
+// so its bytes must start where TPM2B_SIMPLE's do.
+#define TPM2B_OFFSET_MATCHES(type, field) \
+    (offsetof(type, field) == offsetof(TPM2B_SIMPLE, buffer))
+STATIC_ASSERT(TPM2B_OFFSET_MATCHES(TPM2B_DIGEST, buffer), digest_layout);
+STATIC_ASSERT(TPM2B_OFFSET_MATCHES(TPM2B_DATA, buffer), data_layout);
+STATIC_ASSERT(TPM2B_OFFSET_MATCHES(TPM2B_NAME, name), name_layout);
+STATIC_ASSERT(TPM2B_OFFSET_MATCHES(TPM2B_ECC_PARAMETER, buffer), ecc_parameter_layout);
+STATIC_ASSERT(TPM2B_OFFSET_MATCHES(TPM2B_SENSITIVE_DATA, buffer), sensitive_data_layout);
+STATIC_ASSERT(TPM2B_OFFSET_MATCHES(TPM2B_PRIVATE, buffer), private_layout);
+STATIC_ASSERT(TPM2B_OFFSET_MATCHES(TPM2B_MAX_NV_BUFFER, buffer), max_nv_buffer_layout);
+STATIC_ASSERT(TPM2B_OFFSET_MATCHES(TPM2B_MAX_BUFFER, buffer), max_buffer_layout);
+STATIC_ASSERT(TPM2B_OFFSET_MATCHES(TPM2B_CONTEXT_DATA, buffer), context_data_layout);
+STATIC_ASSERT(TPM2B_OFFSET_MATCHES(TPM2B_TEMPLATE, buffer), template_layout);
+
+// Whatever the algorithm profile, the buffers must hold what a P-256 key with SHA-256 produces:
+// its digests, names (the name algorithm, then the digest), coordinates, and private blobs
+// (two integrity values, and the sensitive area's type, auth, seed, and private value).
+#define TPM2B_CAPACITY(type, field) sizeof(((type*)NULL)->field)
+STATIC_ASSERT(TPM2B_CAPACITY(TPM2B_DIGEST, buffer) >= TPM2_SHA256_DIGEST_SIZE, digest_fits_sha256);
+STATIC_ASSERT(TPM2B_CAPACITY(TPM2B_NAME, name) >= sizeof(TPM2_ALG_ID) + TPM2_SHA256_DIGEST_SIZE, name_fits_sha256);
+STATIC_ASSERT(TPM2B_CAPACITY(TPM2B_ECC_PARAMETER, buffer) >= TPM2_MAX_ECC_KEY_BYTES, ecc_parameter_fits_p256);
+STATIC_ASSERT(TPM2B_CAPACITY(TPM2B_SENSITIVE_DATA, buffer) >= TPM2_MAX_ECC_KEY_BYTES, sensitive_fits_p256);
+STATIC_ASSERT(TPM2B_CAPACITY(TPM2B_PRIVATE, buffer)
+                  >= 2 * (sizeof(uint16_t) + TPM2_SHA256_DIGEST_SIZE)
+                     + sizeof(uint16_t) + sizeof(TPM2_ALG_ID)
+                     + 3 * (sizeof(uint16_t) + TPM2_SHA256_DIGEST_SIZE),
+              private_fits_p256);
+
+// Unmarshal a TPM2B into `out` (or skip it, if NULL), failing if it's too large for `field`.
+#define UNMARSHAL_TPM2B(in, in_max_length, out, field) \
+    unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)(out), sizeof((out)->field))
+
 int unmarshal_uint32(uint8_t **in, uint32_t *in_max_length, uint32_t *out)
 {
     if (*in_max_length < sizeof(uint32_t))
@@ -84,6 +120,38 @@ void marshal_uint16(uint16_t in, uint8_t **out)
     *out += sizeof(uint16_t);
 }
 
+int unmarshal_uint64(uint8_t **in, uint32_t *in_max_length, uint64_t *out)
+{
+    uint32_t high, low;
+    if (0 != unmarshal_uint32(in, in_max_length, &high))
+        return -1;
+    if (0 != unmarshal_uint32(in, in_max_length, &low))
+        return -1;
+
+    *out = ((uint64_t)high << 32) | low;
+
+    return 0;
+}
+
+void marshal_uint64(uint64_t in, uint8_t **out)
+{
+    marshal_uint32((uint32_t)(in >> 32), out);
+    marshal_uint32((uint32_t)in, out);
+}
+
+int unmarshal_uint8(uint8_t **in, uint32_t *in_max_length, uint8_t *out)
+{
+    if (*in_max_length < sizeof(uint8_t))
+        return -1;
+
+    *out = **in;
+
+    *in += sizeof(uint8_t);
+    *in_max_length -= sizeof(uint8_t);
+
+    return 0;
+}
+
 void marshal_tpmi_alg_id(TPM2_ALG_ID in, uint8_t **out)
 {
     marshal_uint16(in, out);
@@ -185,13 +253,47 @@ void marshal_tpm2b_simple(const TPM2B_SIMPLE *in, uint8_t **out)
     *out += in->size;
 }
 
-int unmarshal_tpm2b_simple(uint8_t **in, uint32_t *in_max_length, TPM2B_SIMPLE *out)
+int skip_tpm2b(uint8_t **in, uint32_t *in_max_length)
+{
+    uint16_t size;
+    if (0 != unmarshal_uint16(in, in_max_length, &size))
+        return -1;
+
+    if (*in_max_length < size)
+        return -1;
+
+    *in += size;
+    *in_max_length -= size;
+
+    return 0;
+}
+
+int view_tpm2b(uint8_t **in, uint32_t *in_max_length, struct xtpm_span *out)
 {
     if (0 != unmarshal_uint16(in, in_max_length, &out->size))
         return -1;
 
     if (*in_max_length < out->size)
         return -1;
+
+    out->data = *in;
+
+    *in += out->size;
+    *in_max_length -= out->size;
+
+    return 0;
+}
+
+int unmarshal_tpm2b_simple(uint8_t **in, uint32_t *in_max_length, TPM2B_SIMPLE *out, size_t capacity)
+{
+    if (NULL == out)
+        return skip_tpm2b(in, in_max_length);
+
+    if (0 != unmarshal_uint16(in, in_max_length, &out->size))
+        return -1;
+
+    if (*in_max_length < out->size || capacity < out->size)
+        return -1;
     memcpy(out->buffer, *in, out->size);
 
     *in += out->size;
@@ -321,10 +423,10 @@ void marshal_tpms_ecc_point(const TPMS_ECC_POINT *in, uint8_t **out)
 
 int unmarshal_tpms_ecc_point(uint8_t **in, uint32_t *in_max_length, TPMS_ECC_POINT *out)
 {
-    if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)&out->x))
+    if (0 != UNMARSHAL_TPM2B(in, in_max_length, &out->x, buffer))
         return -1;
 
-    if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)&out->y))
+    if (0 != UNMARSHAL_TPM2B(in, in_max_length, &out->y, buffer))
         return -1;
 
     return 0;
@@ -356,6 +458,9 @@ void marshal_tpm2b_public(const TPM2B_PUBLIC *in, uint8_t **out)
 
 int unmarshal_tpm2b_public(uint8_t **in, uint32_t *in_max_length, TPM2B_PUBLIC *out)
 {
+    if (NULL == out)
+        return skip_tpm2b(in, in_max_length);
+
     if (0 != unmarshal_uint16(in, in_max_length, &out->size))
         return -1;
     if (*in_max_length < out->size)
@@ -370,7 +475,7 @@ int unmarshal_tpm2b_public(uint8_t **in, uint32_t *in_max_length, TPM2B_PUBLIC *
     if (0 != unmarshal_tpma_object(in, in_max_length, &out->publicArea.objectAttributes))
         return -1;
 
-    if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)&out->publicArea.authPolicy))
+    if (0 != UNMARSHAL_TPM2B(in, in_max_length, &out->publicArea.authPolicy, buffer))
         return -1;
 
     switch (out->publicArea.type) {
@@ -388,6 +493,51 @@ int unmarshal_tpm2b_public(uint8_t **in, uint32_t *in_max_length, TPM2B_PUBLIC *
     return 0;
 }
 
+int view_tpm2b_public(uint8_t **in, uint32_t *in_max_length, struct xtpm_public_view *out)
+{
+    uint16_t size;
+    if (0 != unmarshal_uint16(in, in_max_length, &size))
+        return -1;
+    if (*in_max_length < size)
+        return -1;
+
+    // Parse only within the TPM2B, and insist it's all used.
+    uint32_t remaining = size;
+
+    if (0 != unmarshal_tpmi_alg_id(in, &remaining, &out->type))
+        return -1;
+
+    if (0 != unmarshal_tpmi_alg_id(in, &remaining, &out->nameAlg))
+        return -1;
+
+    if (0 != unmarshal_tpma_object(in, &remaining, &out->objectAttributes))
+        return -1;
+
+    if (0 != skip_tpm2b(in, &remaining))
+        return -1;
+
+    if (TPM2_ALG_ECC != out->type)
+        return -2;
+
+    TPMS_ECC_PARMS parameters;
+    if (0 != unmarshal_tpms_ecc_parms(in, &remaining, &parameters))
+        return -1;
+    out->curveID = parameters.curveID;
+
+    if (0 != view_tpm2b(in, &remaining, &out->x))
+        return -1;
+
+    if (0 != view_tpm2b(in, &remaining, &out->y))
+        return -1;
+
+    if (0 != remaining)
+        return -1;
+
+    *in_max_length -= size;
+
+    return 0;
+}
+
 void marshal_tpm2b_data(const TPM2B_DATA *in, uint8_t **out)
 {
     marshal_tpm2b_simple((TPM2B_SIMPLE*)in, out);
@@ -413,6 +563,9 @@ int unmarshal_tpml_pcrselection(uint8_t **in, uint32_t *in_max_length, TPML_PCR_
     if (0 != unmarshal_uint32(in, in_max_length, &out->count))
         return -1;
 
+    if (out->count > TPM2_NUM_PCR_BANKS)
+        return -1;
+
     for (unsigned i=0; i < out->count; i++) {
         if (0 != unmarshal_tpmi_alg_id(in, in_max_length, &out->pcrSelections[i].hash))
             return -1;
@@ -423,7 +576,8 @@ int unmarshal_tpml_pcrselection(uint8_t **in, uint32_t *in_max_length, TPML_PCR_
         *in += 1;
         *in_max_length -= 1;
 
-        if (*in_max_length < out->pcrSelections[i].sizeofSelect)
+        if (*in_max_length < out->pcrSelections[i].sizeofSelect ||
+                TPM2_PCR_SELECT_MAX < out->pcrSelections[i].sizeofSelect)
             return -1;
         memcpy(out->pcrSelections[i].pcrSelect, *in, out->pcrSelections[i].sizeofSelect);
         *in += out->pcrSelections[i].sizeofSelect;
@@ -496,13 +650,13 @@ void marshal_tpms_authcommand(const TPMS_AUTH_COMMAND *in, uint8_t **out)
 
 int unmarshal_tpms_authresponse(uint8_t **in, uint32_t *in_max_length, TPMS_AUTH_RESPONSE *out)
 {
-    if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)&out->nonce))
+    if (0 != UNMARSHAL_TPM2B(in, in_max_length, &out->nonce, buffer))
         return -1;
 
     if (0 != unmarshal_tpma_session(in, in_max_length, &out->sessionAttributes))
         return -1;
 
-    if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)&out->hmac))
+    if (0 != UNMARSHAL_TPM2B(in, in_max_length, &out->hmac, buffer))
         return -1;
 
     return 0;
@@ -523,6 +677,9 @@ void marshal_tpm2b_sensitivecreate(const TPM2B_SENSITIVE_CREATE *in, uint8_t **o
 
 int unmarshal_tpm2b_creationdata(uint8_t **in, uint32_t *in_max_length, TPM2B_CREATION_DATA *out)
 {
+    if (NULL == out)
+        return skip_tpm2b(in, in_max_length);
+
     if (0 != unmarshal_uint16(in, in_max_length, &out->size))
         return -1;
     if (*in_max_length < out->size)
@@ -549,7 +706,7 @@ int unmarshal_tpm2b_creationdata(uint8_t **in, uint32_t *in_max_length, TPM2B_CR
     if (0 != unmarshal_tpm2b_name(in, in_max_length, &out->creationData.parentQualifiedName))
         return -1;
 
-    if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)&out->creationData.outsideInfo))
+    if (0 != UNMARSHAL_TPM2B(in, in_max_length, &out->creationData.outsideInfo, buffer))
         return -1;
 
     return 0;
@@ -562,7 +719,7 @@ void marshal_tpm2b_digest(const TPM2B_DIGEST *in, uint8_t **out)
 
 int unmarshal_tpm2b_digest(uint8_t **in, uint32_t *in_max_length, TPM2B_DIGEST *out)
 {
-    if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)out))
+    if (0 != UNMARSHAL_TPM2B(in, in_max_length, out, buffer))
         return -1;
 
     return 0;
@@ -570,6 +727,15 @@ int unmarshal_tpm2b_digest(uint8_t **in, uint32_t *in_max_length, TPM2B_DIGEST *
 
 int unmarshal_tpmt_tkcreation(uint8_t **in, uint32_t *in_max_length, TPMT_TK_CREATION *out)
 {
+    if (NULL == out) {
+        // tag and hierarchy, then the digest
+        if (*in_max_length < sizeof(uint16_t) + sizeof(uint32_t))
+            return -1;
+        *in += sizeof(uint16_t) + sizeof(uint32_t);
+        *in_max_length -= sizeof(uint16_t) + sizeof(uint32_t);
+        return skip_tpm2b(in, in_max_length);
+    }
+
     if (0 != unmarshal_uint16(in, in_max_length, &out->tag))
         return -1;
 
@@ -584,7 +750,7 @@ int unmarshal_tpmt_tkcreation(uint8_t **in, uint32_t *in_max_length, TPMT_TK_CRE
 
 int unmarshal_tpm2b_name(uint8_t **in, uint32_t *in_max_length, TPM2B_NAME *out)
 {
-    if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)out))
+    if (0 != UNMARSHAL_TPM2B(in, in_max_length, out, name))
         return -1;
 
     return 0;
@@ -648,6 +814,29 @@ void marshal_tpmt_tkhashcheck(const TPMT_TK_HASHCHECK *in, uint8_t **out)
     marshal_tpm2b_digest(&in->digest, out);
 }
 
+int unmarshal_tpmt_tkhashcheck(uint8_t **in, uint32_t *in_max_length, TPMT_TK_HASHCHECK *out)
+{
+    if (NULL == out) {
+        // tag and hierarchy, then the digest
+        if (*in_max_length < sizeof(uint16_t) + sizeof(uint32_t))
+            return -1;
+        *in += sizeof(uint16_t) + sizeof(uint32_t);
+        *in_max_length -= sizeof(uint16_t) + sizeof(uint32_t);
+        return skip_tpm2b(in, in_max_length);
+    }
+
+    if (0 != unmarshal_uint16(in, in_max_length, &out->tag))
+        return -1;
+
+    if (0 != unmarshal_uint32(in, in_max_length, &out->hierarchy))
+        return -1;
+
+    if (0 != unmarshal_tpm2b_digest(in, in_max_length, &out->digest))
+        return -1;
+
+    return 0;
+}
+
 int unmarshal_tpmt_signature(uint8_t **in, uint32_t *in_max_length, TPMT_SIGNATURE *out)
 {
     if (0 != unmarshal_tpmi_alg_id(in, in_max_length, &out->sigAlg))
@@ -658,10 +847,10 @@ int unmarshal_tpmt_signature(uint8_t **in, uint32_t *in_max_length, TPMT_SIGNATU
             if (0 != unmarshal_tpmi_alg_id(in, in_max_length, &out->signature.ecdaa.hash))
                 return -1;
 
-            if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)&out->signature.ecdaa.signatureR))
+            if (0 != UNMARSHAL_TPM2B(in, in_max_length, &out->signature.ecdaa.signatureR, buffer))
                 return -1;
 
-            if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)&out->signature.ecdaa.signatureS))
+            if (0 != UNMARSHAL_TPM2B(in, in_max_length, &out->signature.ecdaa.signatureS, buffer))
                 return -1;
 
             break;
@@ -670,10 +859,10 @@ int unmarshal_tpmt_signature(uint8_t **in, uint32_t *in_max_length, TPMT_SIGNATU
             if (0 != unmarshal_tpmi_alg_id(in, in_max_length, &out->signature.ecdsa.hash))
                 return -1;
 
-            if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)&out->signature.ecdsa.signatureR))
+            if (0 != UNMARSHAL_TPM2B(in, in_max_length, &out->signature.ecdsa.signatureR, buffer))
                 return -1;
 
-            if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)&out->signature.ecdsa.signatureS))
+            if (0 != UNMARSHAL_TPM2B(in, in_max_length, &out->signature.ecdsa.signatureS, buffer))
                 return -1;
 
             break;
@@ -685,6 +874,26 @@ int unmarshal_tpmt_signature(uint8_t **in, uint32_t *in_max_length, TPMT_SIGNATU
     return 0;
 }
 
+int view_tpmt_signature(uint8_t **in, uint32_t *in_max_length, struct xtpm_signature_view *out)
+{
+    if (0 != unmarshal_tpmi_alg_id(in, in_max_length, &out->sigAlg))
+        return -1;
+
+    if (TPM2_ALG_ECDAA != out->sigAlg && TPM2_ALG_ECDSA != out->sigAlg)
+        return -2;
+
+    if (0 != unmarshal_tpmi_alg_id(in, in_max_length, &out->hash))
+        return -1;
+
+    if (0 != view_tpm2b(in, in_max_length, &out->r))
+        return -1;
+
+    if (0 != view_tpm2b(in, in_max_length, &out->s))
+        return -1;
+
+    return 0;
+}
+
 void marshal_tpm2b_auth(const TPM2B_AUTH *in, uint8_t **out)
 {
     marshal_tpm2b_simple((TPM2B_SIMPLE*)in, out);
@@ -869,12 +1078,17 @@ void marshal_tpm2b_maxnvbuffer(const TPM2B_MAX_NV_BUFFER *in, uint8_t **out)
 
 int unmarshal_tpm2b_maxnvbuffer(uint8_t **in, uint32_t *in_max_length, TPM2B_MAX_NV_BUFFER *out)
 {
-    if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)out))
+    if (0 != UNMARSHAL_TPM2B(in, in_max_length, out, buffer))
         return -1;
 
     return 0;
 }
 
+void marshal_tpm2b_maxbuffer(const TPM2B_MAX_BUFFER *in, uint8_t **out)
+{
+    marshal_tpm2b_simple((TPM2B_SIMPLE*)in, out);
+}
+
 void marshal_tpm2b_private(const TPM2B_PRIVATE *in, uint8_t **out)
 {
     marshal_tpm2b_simple((TPM2B_SIMPLE*)in, out);
@@ -882,8 +1096,305 @@ void marshal_tpm2b_private(const TPM2B_PRIVATE *in, uint8_t **out)
 
 int unmarshal_tpm2b_private(uint8_t **in, uint32_t *in_max_length, TPM2B_PRIVATE *out)
 {
-    if (0 != unmarshal_tpm2b_simple(in, in_max_length, (TPM2B_SIMPLE*)out))
+    if (0 != UNMARSHAL_TPM2B(in, in_max_length, out, buffer))
+        return -1;
+
+    return 0;
+}
+
+void marshal_tpm2b_template(const TPM2B_TEMPLATE *in, uint8_t **out)
+{
+    marshal_tpm2b_simple((TPM2B_SIMPLE*)in, out);
+}
+
+void marshal_tpms_context(const TPMS_CONTEXT *in, uint8_t **out)
+{
+    marshal_uint64(in->sequence, out);
+    marshal_uint32(in->savedHandle, out);
+    marshal_uint32(in->hierarchy, out);
+    marshal_tpm2b_simple((TPM2B_SIMPLE*)&in->contextBlob, out);
+}
+
+int unmarshal_tpms_context(uint8_t **in, uint32_t *in_max_length, TPMS_CONTEXT *out)
+{
+    if (0 != unmarshal_uint64(in, in_max_length, &out->sequence))
+        return -1;
+
+    if (0 != unmarshal_uint32(in, in_max_length, &out->savedHandle))
+        return -1;
+
+    if (0 != unmarshal_uint32(in, in_max_length, &out->hierarchy))
+        return -1;
+
+    if (0 != UNMARSHAL_TPM2B(in, in_max_length, &out->contextBlob, buffer))
+        return -1;
+
+    return 0;
+}
+
+int unmarshal_tpml_digest(uint8_t **in, uint32_t *in_max_length, TPML_DIGEST *out)
+{
+    if (0 != unmarshal_uint32(in, in_max_length, &out->count))
+        return -1;
+
+    if (out->count > sizeof(out->digests) / sizeof(out->digests[0]))
+        return -1;
+
+    for (unsigned i=0; i < out->count; i++) {
+        if (0 != unmarshal_tpm2b_digest(in, in_max_length, &out->digests[i]))
+            return -1;
+    }
+
+    return 0;
+}
+
+size_t digest_size(TPMI_ALG_HASH hash_alg)
+{
+    switch (hash_alg) {
+        case TPM2_ALG_SHA256:
+            return TPM2_SHA256_DIGEST_SIZE;
+#ifndef XTPM_ECC_ONLY
+        case TPM2_ALG_SHA512:
+            return TPM2_SHA512_DIGEST_SIZE;
+#endif
+        default:
+            return 0;
+    }
+}
+
+void marshal_tpml_digestvalues(const TPML_DIGEST_VALUES *in, uint8_t **out)
+{
+    marshal_uint32(in->count, out);
+
+    for (unsigned i=0; i < in->count; i++) {
+        size_t size = digest_size(in->digests[i].hashAlg);
+
+        marshal_tpmi_alg_id(in->digests[i].hashAlg, out);
+        memcpy(*out, &in->digests[i].digest, size);
+        *out += size;
+    }
+}
+
+static int unmarshal_tpml_handle(uint8_t **in, uint32_t *in_max_length, TPML_HANDLE *out)
+{
+    if (0 != unmarshal_uint32(in, in_max_length, &out->count))
         return -1;
 
+    if (out->count > TPM2_MAX_CAP_HANDLES)
+        return -1;
+
+    for (unsigned i=0; i < out->count; i++) {
+        if (0 != unmarshal_uint32(in, in_max_length, &out->handle[i]))
+            return -1;
+    }
+
     return 0;
 }
+
+static int unmarshal_tpml_taggedtpmproperty(uint8_t **in, uint32_t *in_max_length, TPML_TAGGED_TPM_PROPERTY *out)
+{
+    if (0 != unmarshal_uint32(in, in_max_length, &out->count))
+        return -1;
+
+    if (out->count > TPM2_MAX_TPM_PROPERTIES)
+        return -1;
+
+    for (unsigned i=0; i < out->count; i++) {
+        if (0 != unmarshal_uint32(in, in_max_length, &out->tpmProperty[i].property))
+            return -1;
+
+        if (0 != unmarshal_uint32(in, in_max_length, &out->tpmProperty[i].value))
+            return -1;
+    }
+
+    return 0;
+}
+
+int unmarshal_tpms_capabilitydata(uint8_t **in, uint32_t *in_max_length, TPMS_CAPABILITY_DATA *out)
+{
+    if (0 != unmarshal_uint32(in, in_max_length, &out->capability))
+        return -1;
+
+    switch (out->capability) {
+        case TPM2_CAP_HANDLES:
+            return unmarshal_tpml_handle(in, in_max_length, &out->data.handles);
+        case TPM2_CAP_TPM_PROPERTIES:
+            return unmarshal_tpml_taggedtpmproperty(in, in_max_length, &out->data.tpmProperties);
+        default:
+            return -2;
+    }
+}
+
+static size_t marshaled_size_tpm2b_simple(const TPM2B_SIMPLE *in)
+{
+    return sizeof(uint16_t) + in->size;
+}
+
+static size_t marshaled_size_tpmt_sym_def_object(const TPMT_SYM_DEF_OBJECT *in)
+{
+    switch (in->algorithm) {
+        case TPM2_ALG_NULL:
+            return sizeof(uint16_t);
+        case TPM2_ALG_AES:
+            return 3 * sizeof(uint16_t);
+    }
+
+    return 0;
+}
+
+static size_t marshaled_size_tpmt_ecc_scheme(const TPMT_ECC_SCHEME *in)
+{
+    switch (in->scheme) {
+        case TPM2_ALG_ECDAA:
+            return 3 * sizeof(uint16_t);
+        case TPM2_ALG_ECDSA:
+            return 2 * sizeof(uint16_t);
+    }
+
+    return sizeof(uint16_t);
+}
+
+static size_t marshaled_size_tpms_ecc_point(const TPMS_ECC_POINT *in)
+{
+    return marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)&in->x)
+           + marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)&in->y);
+}
+
+size_t marshaled_size_tpm2b_public(const TPM2B_PUBLIC *in)
+{
+    size_t size = sizeof(uint16_t)
+                  + 2 * sizeof(uint16_t)    // type, nameAlg
+                  + 4                       // objectAttributes
+                  + marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)&in->publicArea.authPolicy);
+
+    switch (in->publicArea.type) {
+        case TPM2_ALG_ECC:
+            size += marshaled_size_tpmt_sym_def_object(&in->publicArea.parameters.eccDetail.symmetric)
+                    + marshaled_size_tpmt_ecc_scheme(&in->publicArea.parameters.eccDetail.scheme)
+                    + 2 * sizeof(uint16_t)  // curveID, kdf
+                    + marshaled_size_tpms_ecc_point(&in->publicArea.unique.ecc);
+            break;
+    }
+
+    return size;
+}
+
+size_t marshaled_size_tpm2b_data(const TPM2B_DATA *in)
+{
+    return marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)in);
+}
+
+size_t marshaled_size_tpml_pcrselection(const TPML_PCR_SELECTION *in)
+{
+    size_t size = sizeof(uint32_t);
+
+    for (unsigned i=0; i < in->count; i++)
+        size += sizeof(uint16_t) + 1 + in->pcrSelections[i].sizeofSelect;
+
+    return size;
+}
+
+size_t marshaled_size_tpms_authcommand(const TPMS_AUTH_COMMAND *in)
+{
+    return sizeof(uint32_t)
+           + marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)&in->nonce)
+           + sizeof(uint8_t)
+           + marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)&in->hmac);
+}
+
+size_t marshaled_size_tpm2b_sensitivecreate(const TPM2B_SENSITIVE_CREATE *in)
+{
+    return sizeof(uint16_t)
+           + marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)&in->sensitive.userAuth)
+           + marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)&in->sensitive.data);
+}
+
+size_t marshaled_size_tpm2b_digest(const TPM2B_DIGEST *in)
+{
+    return marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)in);
+}
+
+size_t marshaled_size_tpm2b_eccpoint(const TPM2B_ECC_POINT *in)
+{
+    return sizeof(uint16_t) + marshaled_size_tpms_ecc_point(&in->point);
+}
+
+size_t marshaled_size_tpm2b_sensitivedata(const TPM2B_SENSITIVE_DATA *in)
+{
+    return marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)in);
+}
+
+size_t marshaled_size_tpm2b_eccparameter(const TPM2B_ECC_PARAMETER *in)
+{
+    return marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)in);
+}
+
+size_t marshaled_size_tpmt_sigscheme(const TPMT_SIG_SCHEME *in)
+{
+    switch (in->scheme) {
+        case TPM2_ALG_ECDAA:
+            return 3 * sizeof(uint16_t);
+        case TPM2_ALG_ECDSA:
+            return 2 * sizeof(uint16_t);
+    }
+
+    return sizeof(uint16_t);
+}
+
+size_t marshaled_size_tpmt_tkhashcheck(const TPMT_TK_HASHCHECK *in)
+{
+    return sizeof(uint16_t) + sizeof(uint32_t) + marshaled_size_tpm2b_digest(&in->digest);
+}
+
+size_t marshaled_size_tpm2b_auth(const TPM2B_AUTH *in)
+{
+    return marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)in);
+}
+
+size_t marshaled_size_tpm2b_nvpublic(const TPM2B_NV_PUBLIC *in)
+{
+    return sizeof(uint16_t)
+           + sizeof(uint32_t)       // nvIndex
+           + sizeof(uint16_t)       // nameAlg
+           + 4                      // attributes
+           + marshaled_size_tpm2b_digest(&in->nvPublic.authPolicy)
+           + sizeof(uint16_t);      // dataSize
+}
+
+size_t marshaled_size_tpm2b_maxnvbuffer(const TPM2B_MAX_NV_BUFFER *in)
+{
+    return marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)in);
+}
+
+size_t marshaled_size_tpm2b_maxbuffer(const TPM2B_MAX_BUFFER *in)
+{
+    return marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)in);
+}
+
+size_t marshaled_size_tpm2b_private(const TPM2B_PRIVATE *in)
+{
+    return marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)in);
+}
+
+size_t marshaled_size_tpm2b_template(const TPM2B_TEMPLATE *in)
+{
+    return marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)in);
+}
+
+size_t marshaled_size_tpms_context(const TPMS_CONTEXT *in)
+{
+    return sizeof(uint64_t)
+           + sizeof(uint32_t)       // savedHandle
+           + sizeof(uint32_t)       // hierarchy
+           + marshaled_size_tpm2b_simple((TPM2B_SIMPLE*)&in->contextBlob);
+}
+
+size_t marshaled_size_tpml_digestvalues(const TPML_DIGEST_VALUES *in)
+{
+    size_t size = sizeof(uint32_t);
+
+    for (unsigned i=0; i < in->count; i++)
+        size += sizeof(uint16_t) + digest_size(in->digests[i].hashAlg);
+
+    return size;
+}
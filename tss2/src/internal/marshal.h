@@ -21,11 +21,13 @@
 #pragma once
 
 #include <tss2/tss2_tpm2_types.h>
+#include <tss2/tss2_sys_view.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 int unmarshal_uint32(uint8_t **in, uint32_t *in_max_length, uint32_t *out);
@@ -34,14 +36,37 @@ void marshal_uint32(uint32_t in, uint8_t **out);
 int unmarshal_uint16(uint8_t **in, uint32_t *in_max_length, uint16_t *out);
 void marshal_uint16(uint16_t in, uint8_t **out);
 
+int unmarshal_uint64(uint8_t **in, uint32_t *in_max_length, uint64_t *out);
+void marshal_uint64(uint64_t in, uint8_t **out);
+
+int unmarshal_uint8(uint8_t **in, uint32_t *in_max_length, uint8_t *out);
+
 void marshal_tpms_ecc_point(const TPMS_ECC_POINT *in, uint8_t **out);
 
+/*
+ * Step over a TPM2B without copying it out.
+ *
+ * The unmarshal_* functions for the TPM2B types, and for TPMT_TK_CREATION,
+ * do this when `out` is NULL, so commands can leave outputs they don't need NULL.
+ */
+int skip_tpm2b(uint8_t **in, uint32_t *in_max_length);
+
+/*
+ * Point `out` at a TPM2B's contents where they are, rather than copying them out.
+ */
+int view_tpm2b(uint8_t **in, uint32_t *in_max_length, struct xtpm_span *out);
+
+int view_tpm2b_public(uint8_t **in, uint32_t *in_max_length, struct xtpm_public_view *out);
+
+int view_tpmt_signature(uint8_t **in, uint32_t *in_max_length, struct xtpm_signature_view *out);
+
 int unmarshal_tpm2b_public(uint8_t **in, uint32_t *in_max_length, TPM2B_PUBLIC *out);
 void marshal_tpm2b_public(const TPM2B_PUBLIC *in, uint8_t **out);
 
 void marshal_tpm2b_data(const TPM2B_DATA *in, uint8_t **out);
 
 void marshal_tpml_pcrselection(const TPML_PCR_SELECTION *in, uint8_t **out);
+int unmarshal_tpml_pcrselection(uint8_t **in, uint32_t *in_max_length, TPML_PCR_SELECTION *out);
 
 void marshal_tpms_authcommand(const TPMS_AUTH_COMMAND *in, uint8_t **out);
 
@@ -71,6 +96,8 @@ void marshal_tpmt_sigscheme(const TPMT_SIG_SCHEME *in, uint8_t **out);
 
 void marshal_tpmt_tkhashcheck(const TPMT_TK_HASHCHECK *in, uint8_t **out);
 
+int unmarshal_tpmt_tkhashcheck(uint8_t **in, uint32_t *in_max_length, TPMT_TK_HASHCHECK *out);
+
 int unmarshal_tpmt_signature(uint8_t **in, uint32_t *in_max_length, TPMT_SIGNATURE *out);
 
 void marshal_tpm2b_auth(const TPM2B_AUTH *in, uint8_t **out);
@@ -83,10 +110,74 @@ void marshal_tpm2b_maxnvbuffer(const TPM2B_MAX_NV_BUFFER *in, uint8_t **out);
 
 int unmarshal_tpm2b_maxnvbuffer(uint8_t **in, uint32_t *in_max_length, TPM2B_MAX_NV_BUFFER *out);
 
+void marshal_tpm2b_maxbuffer(const TPM2B_MAX_BUFFER *in, uint8_t **out);
+
 void marshal_tpm2b_private(const TPM2B_PRIVATE *in, uint8_t **out);
 
 int unmarshal_tpm2b_private(uint8_t **in, uint32_t *in_max_length, TPM2B_PRIVATE *out);
 
+void marshal_tpm2b_template(const TPM2B_TEMPLATE *in, uint8_t **out);
+
+void marshal_tpms_context(const TPMS_CONTEXT *in, uint8_t **out);
+
+int unmarshal_tpms_context(uint8_t **in, uint32_t *in_max_length, TPMS_CONTEXT *out);
+
+int unmarshal_tpml_digest(uint8_t **in, uint32_t *in_max_length, TPML_DIGEST *out);
+
+/*
+ * Size of a `hash_alg` digest, or 0 if this profile doesn't support `hash_alg`.
+ */
+size_t digest_size(TPMI_ALG_HASH hash_alg);
+
+void marshal_tpml_digestvalues(const TPML_DIGEST_VALUES *in, uint8_t **out);
+
+/*
+ * Returns -2 for a capability other than TPM2_CAP_HANDLES or TPM2_CAP_TPM_PROPERTIES.
+ */
+int unmarshal_tpms_capabilitydata(uint8_t **in, uint32_t *in_max_length, TPMS_CAPABILITY_DATA *out);
+
+/*
+ * Number of bytes the corresponding marshal_* function will write,
+ * so callers can check for room first.
+ */
+size_t marshaled_size_tpm2b_public(const TPM2B_PUBLIC *in);
+
+size_t marshaled_size_tpm2b_data(const TPM2B_DATA *in);
+
+size_t marshaled_size_tpml_pcrselection(const TPML_PCR_SELECTION *in);
+
+size_t marshaled_size_tpms_authcommand(const TPMS_AUTH_COMMAND *in);
+
+size_t marshaled_size_tpm2b_sensitivecreate(const TPM2B_SENSITIVE_CREATE *in);
+
+size_t marshaled_size_tpm2b_digest(const TPM2B_DIGEST *in);
+
+size_t marshaled_size_tpm2b_eccpoint(const TPM2B_ECC_POINT *in);
+
+size_t marshaled_size_tpm2b_sensitivedata(const TPM2B_SENSITIVE_DATA *in);
+
+size_t marshaled_size_tpm2b_eccparameter(const TPM2B_ECC_PARAMETER *in);
+
+size_t marshaled_size_tpmt_sigscheme(const TPMT_SIG_SCHEME *in);
+
+size_t marshaled_size_tpmt_tkhashcheck(const TPMT_TK_HASHCHECK *in);
+
+size_t marshaled_size_tpm2b_auth(const TPM2B_AUTH *in);
+
+size_t marshaled_size_tpm2b_nvpublic(const TPM2B_NV_PUBLIC *in);
+
+size_t marshaled_size_tpm2b_maxnvbuffer(const TPM2B_MAX_NV_BUFFER *in);
+
+size_t marshaled_size_tpm2b_maxbuffer(const TPM2B_MAX_BUFFER *in);
+
+size_t marshaled_size_tpm2b_private(const TPM2B_PRIVATE *in);
+
+size_t marshaled_size_tpm2b_template(const TPM2B_TEMPLATE *in);
+
+size_t marshaled_size_tpms_context(const TPMS_CONTEXT *in);
+
+size_t marshaled_size_tpml_digestvalues(const TPML_DIGEST_VALUES *in);
+
 #ifdef __cplusplus
 }
 #endif
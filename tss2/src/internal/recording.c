@@ -0,0 +1,124 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include "recording.h"
+
+#include "marshal.h"
+
+#include <string.h>
+
+static
+int
+write_uint32(FILE *file,
+             uint32_t value)
+{
+    uint8_t buffer[sizeof(uint32_t)];
+    uint8_t *ptr = buffer;
+    marshal_uint32(value, &ptr);
+
+    return 1 == fwrite(buffer, sizeof(buffer), 1, file) ? 0 : -1;
+}
+
+static
+int
+read_uint32(FILE *file,
+            uint32_t *value_out)
+{
+    uint8_t buffer[sizeof(uint32_t)];
+    if (1 != fread(buffer, sizeof(buffer), 1, file))
+        return -1;
+
+    uint8_t *ptr = buffer;
+    uint32_t remaining = sizeof(buffer);
+    return unmarshal_uint32(&ptr, &remaining, value_out);
+}
+
+int
+write_recording_header(FILE *file)
+{
+    return 1 == fwrite(RECORDING_MAGIC, RECORDING_MAGIC_LENGTH, 1, file) ? 0 : -1;
+}
+
+int
+read_recording_header(FILE *file)
+{
+    char magic[RECORDING_MAGIC_LENGTH];
+    if (1 != fread(magic, sizeof(magic), 1, file))
+        return -1;
+
+    return 0 == memcmp(magic, RECORDING_MAGIC, RECORDING_MAGIC_LENGTH) ? 0 : -1;
+}
+
+int
+write_recording_entry(FILE *file,
+                      const uint8_t *command,
+                      uint32_t command_size,
+                      TSS2_RC rc,
+                      const uint8_t *response,
+                      uint32_t response_size,
+                      uint64_t latency_ns)
+{
+    if (0 != write_uint32(file, command_size) ||
+            1 != fwrite(command, command_size, 1, file))
+        return -1;
+
+    if (0 != write_uint32(file, rc) ||
+            0 != write_uint32(file, response_size))
+        return -1;
+
+    if (0 != response_size && 1 != fwrite(response, response_size, 1, file))
+        return -1;
+
+    if (0 != write_uint32(file, (uint32_t)(latency_ns >> 32)) ||
+            0 != write_uint32(file, (uint32_t)latency_ns))
+        return -1;
+
+    return 0;
+}
+
+int
+read_recording_entry(FILE *file,
+                     struct recording_entry *entry)
+{
+    // A clean end of file can only come before an entry.
+    int next = fgetc(file);
+    if (EOF == next)
+        return feof(file) ? 1 : -1;
+    ungetc(next, file);
+
+    if (0 != read_uint32(file, &entry->command_size) ||
+            entry->command_size > sizeof(entry->command) ||
+            1 != fread(entry->command, entry->command_size, 1, file))
+        return -1;
+
+    if (0 != read_uint32(file, &entry->rc) ||
+            0 != read_uint32(file, &entry->response_size) ||
+            entry->response_size > sizeof(entry->response))
+        return -1;
+
+    if (0 != entry->response_size && 1 != fread(entry->response, entry->response_size, 1, file))
+        return -1;
+
+    uint32_t latency_high, latency_low;
+    if (0 != read_uint32(file, &latency_high) ||
+            0 != read_uint32(file, &latency_low))
+        return -1;
+    entry->latency_ns = ((uint64_t)latency_high << 32) | latency_low;
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2INTERNAL_RECORDING_H
+#define XAPTUM_TSS2INTERNAL_RECORDING_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <tss2/tss2_tpm2_types.h>
+#include <tss2/tss2_common.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * File format shared by the record and replay TCTIs.
+ *
+ * The file starts with RECORDING_MAGIC, followed by one entry per round trip
+ * (all integers big-endian):
+ *  - uint32 command size, then the command
+ *  - uint32 TCTI receive result
+ *  - uint32 response size (0 if the receive failed), then the response
+ *  - uint64 round-trip time in ns, from the start of transmit to the end of receive
+ */
+
+#define RECORDING_MAGIC "XTPMREC1"
+#define RECORDING_MAGIC_LENGTH 8
+
+struct recording_entry {
+    uint32_t command_size;
+    uint8_t command[TPM2_MAX_COMMAND_SIZE];
+    TSS2_RC rc;
+    uint32_t response_size;
+    uint8_t response[TPM2_MAX_RESPONSE_SIZE];
+    uint64_t latency_ns;
+};
+
+// Return 0 on success, or -1 on failure.
+int
+write_recording_header(FILE *file);
+
+// Return 0 on success, or -1 on failure (including a bad magic).
+int
+read_recording_header(FILE *file);
+
+// Return 0 on success, or -1 on failure.
+int
+write_recording_entry(FILE *file,
+                      const uint8_t *command,
+                      uint32_t command_size,
+                      TSS2_RC rc,
+                      const uint8_t *response,
+                      uint32_t response_size,
+                      uint64_t latency_ns);
+
+// Return 0 on success, 1 at the end of the file, or -1 on failure.
+int
+read_recording_entry(FILE *file,
+                     struct recording_entry *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
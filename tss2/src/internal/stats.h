@@ -0,0 +1,48 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#ifndef XAPTUM_TSS2INTERNAL_STATS_H
+#define XAPTUM_TSS2INTERNAL_STATS_H
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <tss2/tss2_sys_stats.h>
+#include <tss2/tss2_common.h>
+
+/*
+ * Count one round trip of `command_code` in the calling thread's counters.
+ *
+ * The timestamps (CLOCK_MONOTONIC, in ns) mark the start and end of transmit,
+ * the start of the response arriving, and the end of receive.
+ */
+void
+record_command(TPM2_CC command_code,
+               TSS2_RC ret,
+               uint64_t transmit_start_ns,
+               uint64_t transmit_end_ns,
+               uint64_t response_start_ns,
+               uint64_t receive_end_ns);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
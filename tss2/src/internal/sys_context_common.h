@@ -25,15 +25,57 @@ extern "C" {
 #endif
 
 #include <tss2/tss2_sys.h>
+#include <tss2/tss2_sys_trace.h>
 
+// Where a context is in the Prepare -> ExecuteAsync -> ExecuteFinish -> Complete sequence.
+enum cmd_stage {
+    CMD_STAGE_INITIALIZE,
+    CMD_STAGE_PREPARE,
+    CMD_STAGE_SEND_COMMAND,
+    CMD_STAGE_RECEIVE_RESPONSE,
+};
+
+#define COMMAND_HEADER_SIZE (sizeof(TPMI_ST_COMMAND_TAG) + sizeof(uint32_t) + sizeof(TPM2_CC))
+
+// The smallest command/response buffer a context may have.
+// A command's header and handles are marshaled without checking for room,
+// so this must hold them (and a response header).
+#define MIN_COMMAND_BUFFER_SIZE 64
+
+// Command codes with retry counters: TPM2_CC_FIRST (0x11F) up to the
+// last Part 3 command, with room to spare.
+#define RETRY_CC_FIRST 0x0000011F
+#define RETRY_CC_COUNT 0x80
+
+// Only the most recently retried command codes keep their retry state,
+// so the context doesn't grow by a slot for every command code.
+#define RETRY_STATE_SLOTS 4
+
+struct retry_state {
+    TSS2_SYS_RETRY_COUNTERS counters;
+    uint32_t learned_delay_us;      // backoff to start from next time this command is retried
+};
+
+// The fields are ordered largest first, so the fixed part of a context has no padding.
 typedef struct {
-    uint8_t buffer[TPM2_MAX_COMMAND_SIZE];
     TSS2_TCTI_CONTEXT *tcti_context;
     uint8_t *ptr;
+    const struct xtpm_trace_hook *trace_hook;
+    uint64_t transmit_start_ns;
+    uint64_t transmit_end_ns;
+    uint64_t flight_ticket;     // of the command in flight, in the flight recorder
     TSS2_RC response_code;
     uint32_t response_length;
     uint32_t remaining_response;
+    uint32_t buffer_size;
+    uint32_t cp_offset;     // of the command parameters in buffer (set by the _Prepare functions), 0 before
+    TSS2_SYS_RETRY_POLICY retry_policy;
+    struct retry_state retry_states[RETRY_STATE_SLOTS];   // most recently retried first
+    uint8_t retry_ccs[RETRY_STATE_SLOTS];   // command code - RETRY_CC_FIRST + 1 of each slot, 0 if it's free
     uint8_t cmd_auths_count;
+    uint8_t previous_stage;
+    uint8_t command_header[COMMAND_HEADER_SIZE];   // as sent, to resend after a retryable warning
+    uint8_t buffer[];   // for both the command and the response, sized by the caller's contextSize
 } TSS2_SYS_CONTEXT_OPAQUE;
 
 inline
@@ -46,10 +88,12 @@ inline
 void reset_sys_context(TSS2_SYS_CONTEXT_OPAQUE *sys_context)
 {
     sys_context->ptr = sys_context->buffer;
+    sys_context->cp_offset = 0;
     sys_context->response_code = TSS2_RC_SUCCESS;
     sys_context->response_length = 0;
     sys_context->remaining_response = 0;
     sys_context->cmd_auths_count = 0;
+    sys_context->previous_stage = CMD_STAGE_INITIALIZE;
 }
 
 #ifdef __cplusplus
@@ -20,8 +20,71 @@
 #define XAPTUM_TSS2TCTI_COMMON_H
 #pragma once
 
+#include <tss2/tss2_tcti.h>
+#include <tss2/tss2_sys_trace.h>
+
+#include <stdint.h>
+#include <time.h>
+
 #define TCTI_MAGIC 0x4f53f5e96e674088
 #define TCTI_VERSION 0x1
 
+/*
+ * Leading fields of every TCTI context in this library (identified by TCTI_MAGIC):
+ * the V1 function table, then the CLOCK_MONOTONIC time (in ns) at which
+ * the most recent response started to arrive, then the trace hook (if any).
+ *
+ * The SAPI uses the time to split the time spent waiting on the TPM
+ * from the time spent reading its response, and sets the trace hook.
+ */
+typedef struct {
+    TSS2_TCTI_CONTEXT_COMMON_V1 v1;
+    uint64_t response_start_ns;
+    const struct xtpm_trace_hook *trace_hook;
+} TSS2_TCTI_CONTEXT_COMMON_XAPTUM;
+
+static inline
+uint64_t
+tcti_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Command code of a marshalled command, or 0 if it's too short to have one.
+static inline
+TPM2_CC
+tcti_command_code(const uint8_t *command,
+                  size_t size)
+{
+    if (size < sizeof(TPM2_ST) + sizeof(uint32_t) + sizeof(TPM2_CC))
+        return 0;
+
+    const uint8_t *cc = command + sizeof(TPM2_ST) + sizeof(uint32_t);
+    return ((TPM2_CC)cc[0] << 24) | ((TPM2_CC)cc[1] << 16) | ((TPM2_CC)cc[2] << 8) | (TPM2_CC)cc[3];
+}
+
+static inline
+void
+tcti_trace(const struct xtpm_trace_hook *hook,
+           enum xtpm_trace_direction direction,
+           TPM2_CC command_code,
+           const uint8_t *buffer,
+           size_t length,
+           uint64_t start_ns,
+           uint64_t end_ns)
+{
+    struct xtpm_trace_event event = {.layer = XTPM_TRACE_LAYER_TCTI,
+                                     .direction = direction,
+                                     .command_code = command_code,
+                                     .rc = TSS2_RC_SUCCESS,
+                                     .buffer = buffer,
+                                     .length = length,
+                                     .start_ns = start_ns,
+                                     .end_ns = end_ns};
+    hook->fn(&event, hook->user_data);
+}
+
 #endif
 
@@ -18,13 +18,16 @@
 
 #include <tss2/tss2_sys.h>
 
-#include "internal/command_utils.h"
+#include "internal/command_engine.h"
 #include "internal/sys_context_common.h"
-#include "internal/marshal.h"
-#include "internal/execute.h"
-#include "internal/cmdauths.h"
 
-#include <assert.h>
+static const struct command_desc commit_desc = {
+    .code = TPM2_CC_Commit,
+    .handle_count = 1,
+    .flags = COMMAND_AUTHS_REQUIRED,
+    .in = {PARAM_TPM2B_ECC_POINT, PARAM_TPM2B_SENSITIVE_DATA, PARAM_TPM2B_ECC_PARAMETER},
+    .out = {PARAM_TPM2B_ECC_POINT, PARAM_TPM2B_ECC_POINT, PARAM_TPM2B_ECC_POINT, PARAM_UINT16},
+};
 
 TSS2_RC
 Tss2_Sys_Commit(TSS2_SYS_CONTEXT *sysContext,
@@ -39,50 +42,13 @@ Tss2_Sys_Commit(TSS2_SYS_CONTEXT *sysContext,
                 uint16_t *counter,
                 TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
 {
-    if (NULL == sysContext || NULL == cmdAuthsArray)
+    if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
+    const void *in[] = {P1, s2, y2};
+    void *out[] = {K, L, E, counter};
 
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
-
-    build_command_header(sys_context, TPM2_CC_Commit, TPM2_ST_SESSIONS);
-
-    marshal_uint32(signHandle, &sys_context->ptr);
-
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
-        return ret;
-
-    marshal_tpm2b_eccpoint(P1, &sys_context->ptr);
-
-    marshal_tpm2b_sensitivedata(s2, &sys_context->ptr);
-
-    marshal_tpm2b_eccparameter(y2, &sys_context->ptr);
-
-    set_command_size(sys_context);
-
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
-
-    ret = get_rspauths(sys_context, rspAuthsArray);
-    if (ret)
-        return ret;
-
-    if (0 != unmarshal_tpm2b_eccpoint(&sys_context->ptr, &sys_context->remaining_response, K))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    if (0 != unmarshal_tpm2b_eccpoint(&sys_context->ptr, &sys_context->remaining_response, L))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    if (0 != unmarshal_tpm2b_eccpoint(&sys_context->ptr, &sys_context->remaining_response, E))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    if (0 != unmarshal_uint16(&sys_context->ptr, &sys_context->remaining_response, counter))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    assert(sys_context->remaining_response == 0);
-
-    return ret;
+    return run_command(down_cast(sysContext), &commit_desc,
+                       &signHandle, cmdAuthsArray, in,
+                       NULL, out, rspAuthsArray);
 }
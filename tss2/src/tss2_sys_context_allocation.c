@@ -20,35 +20,43 @@
 
 #include "internal/sys_context_common.h"
 
+#include <stdint.h>
+#include <string.h>
+
 #define TSSWG_INTEROP 1
 #define TSS_SAPI_FIRST_FAMILY 1
 #define TSS_SAPI_FIRST_LEVEL 1
-#define TSS_SAPI_FIRST_VERSION 1
+#ifdef XTPM_ECC_ONLY
+#define TSS_SAPI_FIRST_VERSION 4
+#else
+#define TSS_SAPI_FIRST_VERSION 3
+#endif
 
 size_t
 Tss2_Sys_GetContextSize(size_t maxCommandResponseSize)
 {
-    if (maxCommandResponseSize == 0) {
-        return sizeof(TSS2_SYS_CONTEXT_OPAQUE);
-    } else {
-        return TSS2_TCTI_RC_NOT_IMPLEMENTED;
-    }
+    if (0 == maxCommandResponseSize)
+        maxCommandResponseSize = TPM2_MAX_COMMAND_SIZE;
+    else if (maxCommandResponseSize < MIN_COMMAND_BUFFER_SIZE)
+        maxCommandResponseSize = MIN_COMMAND_BUFFER_SIZE;
+
+    return sizeof(TSS2_SYS_CONTEXT_OPAQUE) + maxCommandResponseSize;
 }
 
+// Set up a context for `tctiContext`, or a dry-run one if it's NULL.
+static
 TSS2_RC
-Tss2_Sys_Initialize(TSS2_SYS_CONTEXT *sysContext,
-                    size_t contextSize,
-                    TSS2_TCTI_CONTEXT *tctiContext,
-                    TSS2_ABI_VERSION *abiVersion)
+initialize(TSS2_SYS_CONTEXT *sysContext,
+           size_t contextSize,
+           TSS2_TCTI_CONTEXT *tctiContext,
+           TSS2_ABI_VERSION *abiVersion)
 {
-    if (!sysContext || !tctiContext || !abiVersion)
-        return TSS2_SYS_RC_BAD_REFERENCE;
-
-    if (contextSize < sizeof(TSS2_SYS_CONTEXT_OPAQUE))
+    if (contextSize < sizeof(TSS2_SYS_CONTEXT_OPAQUE) + MIN_COMMAND_BUFFER_SIZE)
         return TSS2_SYS_RC_INSUFFICIENT_CONTEXT;
 
-    if (NULL == ((TSS2_TCTI_CONTEXT_COMMON_V1 *)tctiContext)->transmit ||
-            NULL == ((TSS2_TCTI_CONTEXT_COMMON_V1 *)tctiContext)->receive) {
+    if (NULL != tctiContext &&
+            (NULL == ((TSS2_TCTI_CONTEXT_COMMON_V1 *)tctiContext)->transmit ||
+             NULL == ((TSS2_TCTI_CONTEXT_COMMON_V1 *)tctiContext)->receive)) {
         return TSS2_SYS_RC_BAD_TCTI_STRUCTURE;
     }
 
@@ -61,11 +69,45 @@ Tss2_Sys_Initialize(TSS2_SYS_CONTEXT *sysContext,
 
     TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
     sys_context->tcti_context = tctiContext;
+    // Room beyond what any command or response needs is just left unused.
+    size_t buffer_size = contextSize - sizeof(TSS2_SYS_CONTEXT_OPAQUE);
+    sys_context->buffer_size = buffer_size > UINT32_MAX ? UINT32_MAX : (uint32_t)buffer_size;
     reset_sys_context(sys_context);
 
+    sys_context->retry_policy.maxRetries = TSS2_SYS_RETRY_DEFAULT_MAX_RETRIES;
+    sys_context->retry_policy.initialDelayUs = TSS2_SYS_RETRY_DEFAULT_INITIAL_DELAY_US;
+    sys_context->retry_policy.maxDelayUs = TSS2_SYS_RETRY_DEFAULT_MAX_DELAY_US;
+    memset(sys_context->retry_states, 0, sizeof(sys_context->retry_states));
+    memset(sys_context->retry_ccs, 0, sizeof(sys_context->retry_ccs));
+
+    sys_context->trace_hook = NULL;
+
     return TSS2_RC_SUCCESS;
 }
 
+TSS2_RC
+Tss2_Sys_Initialize(TSS2_SYS_CONTEXT *sysContext,
+                    size_t contextSize,
+                    TSS2_TCTI_CONTEXT *tctiContext,
+                    TSS2_ABI_VERSION *abiVersion)
+{
+    if (!sysContext || !tctiContext || !abiVersion)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    return initialize(sysContext, contextSize, tctiContext, abiVersion);
+}
+
+TSS2_RC
+Tss2_Sys_InitializeDryRun(TSS2_SYS_CONTEXT *sysContext,
+                          size_t contextSize,
+                          TSS2_ABI_VERSION *abiVersion)
+{
+    if (!sysContext || !abiVersion)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    return initialize(sysContext, contextSize, NULL, abiVersion);
+}
+
 TSS2_RC
 Tss2_Sys_Finalize(TSS2_SYS_CONTEXT *sysContext)
 {
@@ -84,3 +126,42 @@ Tss2_Sys_GetTctiContext(TSS2_SYS_CONTEXT *sysContext,
 
     return TSS2_RC_SUCCESS;
 }
+
+TSS2_RC
+Tss2_Sys_SetRetryPolicy(TSS2_SYS_CONTEXT *sysContext,
+                        const TSS2_SYS_RETRY_POLICY *policy)
+{
+    if (NULL == sysContext || NULL == policy)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    if (policy->initialDelayUs > policy->maxDelayUs)
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+
+    sys_context->retry_policy = *policy;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+Tss2_Sys_GetRetryCounters(TSS2_SYS_CONTEXT *sysContext,
+                          TPM2_CC commandCode,
+                          TSS2_SYS_RETRY_COUNTERS *counters)
+{
+    if (NULL == sysContext || NULL == counters)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    if (commandCode < RETRY_CC_FIRST || commandCode - RETRY_CC_FIRST >= RETRY_CC_COUNT)
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+
+    *counters = (TSS2_SYS_RETRY_COUNTERS){0};
+    for (unsigned i = 0; i < RETRY_STATE_SLOTS; i++) {
+        if (sys_context->retry_ccs[i] == commandCode - RETRY_CC_FIRST + 1)
+            *counters = sys_context->retry_states[i].counters;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
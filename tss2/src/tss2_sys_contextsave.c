@@ -0,0 +1,43 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+
+#include "internal/command_engine.h"
+#include "internal/sys_context_common.h"
+
+static const struct command_desc context_save_desc = {
+    .code = TPM2_CC_ContextSave,
+    .handle_count = 1,
+    .out = {PARAM_TPMS_CONTEXT},
+};
+
+TSS2_RC
+Tss2_Sys_ContextSave(TSS2_SYS_CONTEXT *sysContext,
+                     TPMI_DH_CONTEXT saveHandle,
+                     TPMS_CONTEXT *context)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    void *out[] = {context};
+
+    return run_command(down_cast(sysContext), &context_save_desc,
+                       &saveHandle, NULL, NULL,
+                       NULL, out, NULL);
+}
@@ -0,0 +1,78 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+
+#include "internal/command_engine.h"
+#include "internal/sys_context_common.h"
+#include "internal/marshal.h"
+
+#include <string.h>
+
+static const struct command_desc create_loaded_desc = {
+    .code = TPM2_CC_CreateLoaded,
+    .handle_count = 1,
+    .flags = COMMAND_AUTHS_REQUIRED | COMMAND_RETURNS_HANDLE,
+    .in = {PARAM_TPM2B_SENSITIVE_CREATE, PARAM_TPM2B_TEMPLATE},
+    .out = {PARAM_TPM2B_PRIVATE, PARAM_TPM2B_PUBLIC, PARAM_TPM2B_NAME},
+};
+
+TSS2_RC
+Tss2_Sys_CreateLoaded(TSS2_SYS_CONTEXT *sysContext,
+                      TPMI_DH_OBJECT parentHandle,
+                      const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                      const TPM2B_SENSITIVE_CREATE *inSensitive,
+                      const TPM2B_TEMPLATE *inPublic,
+                      TPM2_HANDLE *objectHandle,
+                      TPM2B_PRIVATE *outPrivate,
+                      TPM2B_PUBLIC *outPublic,
+                      TPM2B_NAME *name,
+                      TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    const void *in[] = {inSensitive, inPublic};
+    void *out[] = {outPrivate, outPublic, name};
+
+    return run_command(down_cast(sysContext), &create_loaded_desc,
+                       &parentHandle, cmdAuthsArray, in,
+                       objectHandle, out, rspAuthsArray);
+}
+
+TSS2_RC
+Tss2_Sys_SetTemplate(const TPM2B_PUBLIC *inPublic,
+                     TPM2B_TEMPLATE *outTemplate)
+{
+    if (NULL == inPublic || NULL == outTemplate)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    // A TPM2B_TEMPLATE's contents are a marshaled TPMT_PUBLIC,
+    // i.e. a marshaled TPM2B_PUBLIC without its size.
+    uint8_t marshaled[sizeof(uint16_t) + sizeof(outTemplate->buffer)];
+    if (marshaled_size_tpm2b_public(inPublic) > sizeof(marshaled))
+        return TSS2_SYS_RC_BAD_SIZE;
+
+    uint8_t *ptr = marshaled;
+    marshal_tpm2b_public(inPublic, &ptr);
+
+    outTemplate->size = ptr - marshaled - sizeof(uint16_t);
+    memcpy(outTemplate->buffer, marshaled + sizeof(uint16_t), outTemplate->size);
+
+    return TSS2_RC_SUCCESS;
+}
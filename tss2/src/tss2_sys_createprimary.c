@@ -18,13 +18,16 @@
 
 #include <tss2/tss2_sys.h>
 
-#include "internal/command_utils.h"
+#include "internal/command_engine.h"
 #include "internal/sys_context_common.h"
-#include "internal/marshal.h"
-#include "internal/execute.h"
-#include "internal/cmdauths.h"
 
-#include <assert.h>
+static const struct command_desc create_primary_desc = {
+    .code = TPM2_CC_CreatePrimary,
+    .handle_count = 1,
+    .flags = COMMAND_AUTHS_REQUIRED | COMMAND_RETURNS_HANDLE,
+    .in = {PARAM_TPM2B_SENSITIVE_CREATE, PARAM_TPM2B_PUBLIC, PARAM_TPM2B_DATA, PARAM_TPML_PCR_SELECTION},
+    .out = {PARAM_TPM2B_PUBLIC, PARAM_TPM2B_CREATION_DATA, PARAM_TPM2B_DIGEST, PARAM_TPMT_TK_CREATION, PARAM_TPM2B_NAME},
+};
 
 TSS2_RC
 Tss2_Sys_CreatePrimary(TSS2_SYS_CONTEXT *sysContext,
@@ -42,58 +45,13 @@ Tss2_Sys_CreatePrimary(TSS2_SYS_CONTEXT *sysContext,
                        TPM2B_NAME *name,
                        TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
 {
-    if (NULL == sysContext || NULL == creationPCR || NULL == cmdAuthsArray)
+    if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
+    const void *in[] = {inSensitive, inPublic, outsideInfo, creationPCR};
+    void *out[] = {outPublic, creationData, creationHash, creationTicket, name};
 
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
-
-    build_command_header(sys_context, TPM2_CC_CreatePrimary, TPM2_ST_SESSIONS);
-
-    marshal_uint32(primaryHandle, &sys_context->ptr);
-
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
-        return ret;
-
-    marshal_tpm2b_sensitivecreate(inSensitive, &sys_context->ptr);
-
-    marshal_tpm2b_public(inPublic, &sys_context->ptr);
-
-    marshal_tpm2b_data(outsideInfo, &sys_context->ptr);
-
-    marshal_tpml_pcrselection(creationPCR, &sys_context->ptr);
-
-    set_command_size(sys_context);
-
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
-
-    if (0 != unmarshal_uint32(&sys_context->ptr, &sys_context->remaining_response, objectHandle))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    ret = get_rspauths(sys_context, rspAuthsArray);
-    if (ret)
-        return ret;
-
-    if (0 != unmarshal_tpm2b_public(&sys_context->ptr, &sys_context->remaining_response, outPublic))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    if (0 != unmarshal_tpm2b_creationdata(&sys_context->ptr, &sys_context->remaining_response, creationData))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    if (0 != unmarshal_tpm2b_digest(&sys_context->ptr, &sys_context->remaining_response, creationHash))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    if (0 != unmarshal_tpmt_tkcreation(&sys_context->ptr, &sys_context->remaining_response, creationTicket))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    if (0 != unmarshal_tpm2b_name(&sys_context->ptr, &sys_context->remaining_response, name))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    assert(sys_context->remaining_response == 0);
-
-    return ret;
+    return run_command(down_cast(sysContext), &create_primary_desc,
+                       &primaryHandle, cmdAuthsArray, in,
+                       objectHandle, out, rspAuthsArray);
 }
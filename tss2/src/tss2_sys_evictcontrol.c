@@ -18,14 +18,15 @@
 
 #include <tss2/tss2_sys.h>
 
-#include "internal/command_utils.h"
+#include "internal/command_engine.h"
 #include "internal/sys_context_common.h"
-#include "internal/marshal.h"
-#include "internal/execute.h"
-#include "internal/cmdauths.h"
-
-#include <assert.h>
 
+static const struct command_desc evict_control_desc = {
+    .code = TPM2_CC_EvictControl,
+    .handle_count = 2,
+    .flags = COMMAND_AUTHS_REQUIRED,
+    .in = {PARAM_UINT32},
+};
 
 TSS2_RC
 Tss2_Sys_EvictControl(TSS2_SYS_CONTEXT *sysContext,
@@ -35,36 +36,13 @@ Tss2_Sys_EvictControl(TSS2_SYS_CONTEXT *sysContext,
                       TPMI_DH_PERSISTENT persistentHandle,
                       TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
 {
-    if (NULL == sysContext || NULL == cmdAuthsArray)
+    if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
-
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
-
-    build_command_header(sys_context, TPM2_CC_EvictControl, TPM2_ST_SESSIONS);
-
-    marshal_uint32(auth, &sys_context->ptr);
-
-    marshal_uint32(objectHandle, &sys_context->ptr);
-
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
-        return ret;
-
-    marshal_uint32(persistentHandle, &sys_context->ptr);
-
-    set_command_size(sys_context);
-
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
-
-    ret = get_rspauths(sys_context, rspAuthsArray);
-    if (ret)
-        return ret;
-
-    assert(sys_context->remaining_response == 0);
+    const TPM2_HANDLE handles[] = {auth, objectHandle};
+    const void *in[] = {&persistentHandle};
 
-    return ret;
+    return run_command(down_cast(sysContext), &evict_control_desc,
+                       handles, cmdAuthsArray, in,
+                       NULL, NULL, rspAuthsArray);
 }
@@ -0,0 +1,104 @@
+/******************************************************************************
+ *
+ * Copyright 2017 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+
+#include "internal/sys_context_common.h"
+#include "internal/execute.h"
+#include "internal/cmdauths.h"
+
+TSS2_RC
+Tss2_Sys_SetCmdAuths(TSS2_SYS_CONTEXT *sysContext,
+                     const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray)
+{
+    if (NULL == sysContext || NULL == cmdAuthsArray)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+
+    if (CMD_STAGE_PREPARE != sys_context->previous_stage)
+        return TSS2_SYS_RC_BAD_SEQUENCE;
+
+    return insert_cmdauths(sys_context, cmdAuthsArray);
+}
+
+TSS2_RC
+Tss2_Sys_ExecuteAsync(TSS2_SYS_CONTEXT *sysContext)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+
+    if (CMD_STAGE_PREPARE != sys_context->previous_stage)
+        return TSS2_SYS_RC_BAD_SEQUENCE;
+
+    return send_command(sys_context);
+}
+
+TSS2_RC
+Tss2_Sys_GetCommandBuffer(TSS2_SYS_CONTEXT *sysContext,
+                          size_t *cmdBufferSize,
+                          const uint8_t **cmdBuffer)
+{
+    if (NULL == sysContext || NULL == cmdBufferSize || NULL == cmdBuffer)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+
+    // Once the response arrives, it has overwritten the command.
+    if (CMD_STAGE_PREPARE != sys_context->previous_stage &&
+            CMD_STAGE_SEND_COMMAND != sys_context->previous_stage)
+        return TSS2_SYS_RC_BAD_SEQUENCE;
+
+    *cmdBufferSize = sys_context->ptr - sys_context->buffer;
+    *cmdBuffer = sys_context->buffer;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+Tss2_Sys_ExecuteFinish(TSS2_SYS_CONTEXT *sysContext,
+                       int32_t timeout)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+
+    if (CMD_STAGE_SEND_COMMAND != sys_context->previous_stage)
+        return TSS2_SYS_RC_BAD_SEQUENCE;
+
+    return finish_command(sys_context, timeout);
+}
+
+TSS2_RC
+Tss2_Sys_GetRspAuths(TSS2_SYS_CONTEXT *sysContext,
+                     TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext || NULL == rspAuthsArray)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+
+    if (CMD_STAGE_RECEIVE_RESPONSE != sys_context->previous_stage ||
+            TSS2_RC_SUCCESS != sys_context->response_code)
+        return TSS2_SYS_RC_BAD_SEQUENCE;
+
+    return get_rspauths(sys_context, rspAuthsArray);
+}
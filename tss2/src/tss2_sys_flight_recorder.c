@@ -0,0 +1,268 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+// For SA_RESTART
+#define _XOPEN_SOURCE 600
+
+#include <tss2/tss2_sys_flight_recorder.h>
+
+#include "internal/flight_recorder.h"
+#include "internal/tcti_common.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SLOT_MASK (XTPM_FLIGHT_RECORDER_SIZE - 1)
+
+// One entry of the ring, guarded by a per-entry sequence lock:
+// `lock` is 2*ticket+1 while the entry for `ticket` is being written, 2*ticket+2 once written,
+// and 0 if never written.
+// All fields are accessed atomically, so readers (even signal handlers) never block writers.
+struct slot {
+    uint64_t lock;
+    uint32_t command_code;
+    uint32_t handle;
+    uint32_t rc;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+static struct slot slots_g[XTPM_FLIGHT_RECORDER_SIZE];
+
+static uint64_t next_ticket_g = 0;
+
+static int dump_fd_g = -1;
+
+uint64_t
+flight_begin(TPM2_CC command_code,
+             TPM2_HANDLE handle,
+             uint64_t start_ns)
+{
+    uint64_t ticket = __atomic_fetch_add(&next_ticket_g, 1, __ATOMIC_RELAXED);
+    struct slot *slot = &slots_g[ticket & SLOT_MASK];
+
+    __atomic_store_n(&slot->lock, 2 * ticket + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&slot->command_code, command_code, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->handle, handle, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->rc, TSS2_RC_SUCCESS, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->start_ns, start_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->end_ns, 0, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->lock, 2 * ticket + 2, __ATOMIC_RELEASE);
+
+    return ticket;
+}
+
+void
+flight_end(uint64_t ticket,
+           TSS2_RC rc,
+           uint64_t end_ns)
+{
+    struct slot *slot = &slots_g[ticket & SLOT_MASK];
+
+    // Take the entry in one step, so that a `flight_begin` lapping the slot
+    // (after XTPM_FLIGHT_RECORDER_SIZE newer round trips) is never overwritten.
+    uint64_t expected = 2 * ticket + 2;
+    if (!__atomic_compare_exchange_n(&slot->lock, &expected, 2 * ticket + 1,
+                                     0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&slot->rc, rc, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->end_ns, end_ns, __ATOMIC_RELAXED);
+
+    // Likewise, don't publish over a lap that started meanwhile.
+    expected = 2 * ticket + 1;
+    __atomic_compare_exchange_n(&slot->lock, &expected, 2 * ticket + 2,
+                                0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+// Read the entry for `ticket`, returning 0 if it's being written or has been overwritten.
+static
+int
+read_entry(uint64_t ticket,
+           struct xtpm_flight_entry *out)
+{
+    const struct slot *slot = &slots_g[ticket & SLOT_MASK];
+
+    uint64_t lock = __atomic_load_n(&slot->lock, __ATOMIC_ACQUIRE);
+    if (2 * ticket + 2 != lock)
+        return 0;
+
+    out->sequence = ticket;
+    out->command_code = __atomic_load_n(&slot->command_code, __ATOMIC_RELAXED);
+    out->handle = __atomic_load_n(&slot->handle, __ATOMIC_RELAXED);
+    out->rc = __atomic_load_n(&slot->rc, __ATOMIC_RELAXED);
+    out->start_ns = __atomic_load_n(&slot->start_ns, __ATOMIC_RELAXED);
+    out->end_ns = __atomic_load_n(&slot->end_ns, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return lock == __atomic_load_n(&slot->lock, __ATOMIC_RELAXED);
+}
+
+size_t
+xtpm_flight_recorder_snapshot(struct xtpm_flight_entry *out,
+                              size_t max_entries)
+{
+    uint64_t end = __atomic_load_n(&next_ticket_g, __ATOMIC_RELAXED);
+    uint64_t count = end < XTPM_FLIGHT_RECORDER_SIZE ? end : XTPM_FLIGHT_RECORDER_SIZE;
+    if (count > max_entries)
+        count = max_entries;
+
+    size_t copied = 0;
+    for (uint64_t ticket = end - count; ticket < end; ticket++) {
+        if (read_entry(ticket, &out[copied]))
+            copied++;
+    }
+
+    return copied;
+}
+
+// Formatting for `xtpm_flight_recorder_dump`, which can't use stdio from a signal handler.
+
+static
+char*
+append_string(char *out,
+              const char *string)
+{
+    while (*string)
+        *out++ = *string++;
+    return out;
+}
+
+static
+char*
+append_decimal(char *out,
+               uint64_t value)
+{
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+
+    while (count > 0)
+        *out++ = digits[--count];
+    return out;
+}
+
+static
+char*
+append_hex32(char *out,
+             uint32_t value)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    out = append_string(out, "0x");
+    for (int shift = 28; shift >= 0; shift -= 4)
+        *out++ = hex[(value >> shift) & 0xF];
+    return out;
+}
+
+static
+int
+write_all(int fd,
+          const char *buffer,
+          size_t length)
+{
+    while (length > 0) {
+        ssize_t written = write(fd, buffer, length);
+        if (-1 == written) {
+            if (EINTR == errno)
+                continue;
+            return -1;
+        }
+        buffer += written;
+        length -= (size_t)written;
+    }
+
+    return 0;
+}
+
+int
+xtpm_flight_recorder_dump(int fd)
+{
+    uint64_t now_ns = tcti_now_ns();
+
+    uint64_t end = __atomic_load_n(&next_ticket_g, __ATOMIC_RELAXED);
+    uint64_t count = end < XTPM_FLIGHT_RECORDER_SIZE ? end : XTPM_FLIGHT_RECORDER_SIZE;
+
+    for (uint64_t ticket = end - count; ticket < end; ticket++) {
+        struct xtpm_flight_entry entry;
+        if (!read_entry(ticket, &entry))
+            continue;
+
+        char line[160];
+        char *next = line;
+        next = append_string(next, "seq=");
+        next = append_decimal(next, entry.sequence);
+        next = append_string(next, " cc=");
+        next = append_hex32(next, entry.command_code);
+        next = append_string(next, " handle=");
+        next = append_hex32(next, entry.handle);
+        if (0 == entry.end_ns) {
+            next = append_string(next, " in_flight_us=");
+            next = append_decimal(next, (now_ns - entry.start_ns) / 1000);
+        } else {
+            next = append_string(next, " rc=");
+            next = append_hex32(next, entry.rc);
+            next = append_string(next, " duration_us=");
+            next = append_decimal(next, (entry.end_ns - entry.start_ns) / 1000);
+        }
+        next = append_string(next, " start_ns=");
+        next = append_decimal(next, entry.start_ns);
+        *next++ = '\n';
+
+        if (0 != write_all(fd, line, (size_t)(next - line)))
+            return -1;
+    }
+
+    return 0;
+}
+
+static
+void
+dump_on_signal(int signum)
+{
+    (void)signum;
+
+    int saved_errno = errno;
+    (void)xtpm_flight_recorder_dump(dump_fd_g);
+    errno = saved_errno;
+}
+
+int
+xtpm_flight_recorder_install_signal_handler(int signum,
+                                            int fd)
+{
+    dump_fd_g = fd;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+    action.sa_handler = dump_on_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    return sigaction(signum, &action, NULL);
+}
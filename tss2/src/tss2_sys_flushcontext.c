@@ -18,13 +18,14 @@
 
 #include <tss2/tss2_sys.h>
 
-#include "internal/command_utils.h"
+#include "internal/command_engine.h"
 #include "internal/sys_context_common.h"
-#include "internal/marshal.h"
-#include "internal/execute.h"
-#include "internal/cmdauths.h"
 
-#include <assert.h>
+// The handle to flush is a parameter, not in the handle area.
+static const struct command_desc flush_context_desc = {
+    .code = TPM2_CC_FlushContext,
+    .in = {PARAM_UINT32},
+};
 
 TSS2_RC
 Tss2_Sys_FlushContext(TSS2_SYS_CONTEXT *sysContext,
@@ -33,21 +34,9 @@ Tss2_Sys_FlushContext(TSS2_SYS_CONTEXT *sysContext,
     if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
+    const void *in[] = {&flushHandle};
 
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
-
-    build_command_header(sys_context, TPM2_CC_NV_FlushContext, TPM2_ST_NO_SESSIONS);
-
-    marshal_uint32(flushHandle, &sys_context->ptr);
-
-    set_command_size(sys_context);
-
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
-
-    assert(sys_context->remaining_response == 0);
-
-    return ret;
+    return run_command(down_cast(sysContext), &flush_context_desc,
+                       NULL, NULL, in,
+                       NULL, NULL, NULL);
 }
@@ -0,0 +1,49 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+
+#include "internal/command_engine.h"
+#include "internal/sys_context_common.h"
+
+static const struct command_desc get_capability_desc = {
+    .code = TPM2_CC_GetCapability,
+    .in = {PARAM_UINT32, PARAM_UINT32, PARAM_UINT32},
+    .out = {PARAM_UINT8, PARAM_TPMS_CAPABILITY_DATA},
+};
+
+TSS2_RC
+Tss2_Sys_GetCapability(TSS2_SYS_CONTEXT *sysContext,
+                       const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                       TPM2_CAP capability,
+                       uint32_t property,
+                       uint32_t propertyCount,
+                       TPMI_YES_NO *moreData,
+                       TPMS_CAPABILITY_DATA *capabilityData,
+                       TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    const void *in[] = {&capability, &property, &propertyCount};
+    void *out[] = {moreData, capabilityData};
+
+    return run_command(down_cast(sysContext), &get_capability_desc,
+                       NULL, cmdAuthsArray, in,
+                       NULL, out, rspAuthsArray);
+}
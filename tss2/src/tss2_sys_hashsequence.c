@@ -0,0 +1,121 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+
+#include "internal/command_engine.h"
+#include "internal/sys_context_common.h"
+
+static const struct command_desc hash_sequence_start_desc = {
+    .code = TPM2_CC_HashSequenceStart,
+    .flags = COMMAND_RETURNS_HANDLE,
+    .in = {PARAM_TPM2B_DIGEST, PARAM_UINT16},
+};
+
+static const struct command_desc sequence_update_desc = {
+    .code = TPM2_CC_SequenceUpdate,
+    .handle_count = 1,
+    .flags = COMMAND_AUTHS_REQUIRED,
+    .in = {PARAM_TPM2B_MAX_BUFFER},
+};
+
+static const struct command_desc sequence_complete_desc = {
+    .code = TPM2_CC_SequenceComplete,
+    .handle_count = 1,
+    .flags = COMMAND_AUTHS_REQUIRED,
+    .in = {PARAM_TPM2B_MAX_BUFFER, PARAM_UINT32},
+    .out = {PARAM_TPM2B_DIGEST, PARAM_TPMT_TK_HASHCHECK},
+};
+
+TSS2_RC
+Tss2_Sys_HashSequenceStart(TSS2_SYS_CONTEXT *sysContext,
+                           const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                           const TPM2B_AUTH *auth,
+                           TPMI_ALG_HASH hashAlg,
+                           TPMI_DH_OBJECT *sequenceHandle,
+                           TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext || NULL == sequenceHandle)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    const void *in[] = {auth, &hashAlg};
+
+    return run_command(down_cast(sysContext), &hash_sequence_start_desc,
+                       NULL, cmdAuthsArray, in,
+                       sequenceHandle, NULL, rspAuthsArray);
+}
+
+TSS2_RC
+Tss2_Sys_SequenceUpdate(TSS2_SYS_CONTEXT *sysContext,
+                        TPMI_DH_OBJECT sequenceHandle,
+                        const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                        const TPM2B_MAX_BUFFER *buffer,
+                        TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    const void *in[] = {buffer};
+
+    return run_command(down_cast(sysContext), &sequence_update_desc,
+                       &sequenceHandle, cmdAuthsArray, in,
+                       NULL, NULL, rspAuthsArray);
+}
+
+TSS2_RC
+Tss2_Sys_SequenceUpdate_Prepare(TSS2_SYS_CONTEXT *sysContext,
+                                TPMI_DH_OBJECT sequenceHandle,
+                                const TPM2B_MAX_BUFFER *buffer)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    const void *in[] = {buffer};
+
+    return prepare_command(down_cast(sysContext), &sequence_update_desc, &sequenceHandle, in);
+}
+
+TSS2_RC
+Tss2_Sys_SequenceUpdate_Complete(TSS2_SYS_CONTEXT *sysContext)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    return complete_command(down_cast(sysContext), &sequence_update_desc, NULL);
+}
+
+TSS2_RC
+Tss2_Sys_SequenceComplete(TSS2_SYS_CONTEXT *sysContext,
+                          TPMI_DH_OBJECT sequenceHandle,
+                          const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                          const TPM2B_MAX_BUFFER *buffer,
+                          TPMI_RH_HIERARCHY hierarchy,
+                          TPM2B_DIGEST *result,
+                          TPMT_TK_HASHCHECK *validation,
+                          TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    const void *in[] = {buffer, &hierarchy};
+    void *out[] = {result, validation};
+
+    return run_command(down_cast(sysContext), &sequence_complete_desc,
+                       &sequenceHandle, cmdAuthsArray, in,
+                       NULL, out, rspAuthsArray);
+}
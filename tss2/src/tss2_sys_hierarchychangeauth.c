@@ -18,13 +18,15 @@
 
 #include <tss2/tss2_sys.h>
 
-#include "internal/command_utils.h"
+#include "internal/command_engine.h"
 #include "internal/sys_context_common.h"
-#include "internal/marshal.h"
-#include "internal/execute.h"
-#include "internal/cmdauths.h"
 
-#include <assert.h>
+static const struct command_desc hierarchy_change_auth_desc = {
+    .code = TPM2_CC_HierarchyChangeAuth,
+    .handle_count = 1,
+    .flags = COMMAND_AUTHS_REQUIRED,
+    .in = {PARAM_TPM2B_DIGEST},
+};
 
 TSS2_RC
 Tss2_Sys_HierarchyChangeAuth(TSS2_SYS_CONTEXT *sysContext,
@@ -33,34 +35,12 @@ Tss2_Sys_HierarchyChangeAuth(TSS2_SYS_CONTEXT *sysContext,
                              TPM2B_AUTH *newAuth,
                              TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
 {
-    if (NULL == sysContext || NULL == cmdAuthsArray)
+    if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
+    const void *in[] = {newAuth};
 
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
-
-    build_command_header(sys_context, TPM2_CC_HierarchyChangeAuth, TPM2_ST_SESSIONS);
-
-    marshal_uint32(authHandle, &sys_context->ptr);
-
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
-        return ret;
-
-    marshal_tpm2b_auth(newAuth, &sys_context->ptr);
-
-    set_command_size(sys_context);
-
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
-
-    ret = get_rspauths(sys_context, rspAuthsArray);
-    if (ret)
-        return ret;
-
-    assert(sys_context->remaining_response == 0);
-
-    return ret;
+    return run_command(down_cast(sysContext), &hierarchy_change_auth_desc,
+                       &authHandle, cmdAuthsArray, in,
+                       NULL, NULL, rspAuthsArray);
 }
@@ -18,13 +18,16 @@
 
 #include <tss2/tss2_sys.h>
 
-#include "internal/command_utils.h"
+#include "internal/command_engine.h"
 #include "internal/sys_context_common.h"
-#include "internal/marshal.h"
-#include "internal/execute.h"
-#include "internal/cmdauths.h"
 
-#include <assert.h>
+static const struct command_desc load_desc = {
+    .code = TPM2_CC_Load,
+    .handle_count = 1,
+    .flags = COMMAND_AUTHS_REQUIRED | COMMAND_RETURNS_HANDLE,
+    .in = {PARAM_TPM2B_PRIVATE, PARAM_TPM2B_PUBLIC},
+    .out = {PARAM_TPM2B_NAME},
+};
 
 TSS2_RC
 Tss2_Sys_Load(TSS2_SYS_CONTEXT *sysContext,
@@ -36,42 +39,13 @@ Tss2_Sys_Load(TSS2_SYS_CONTEXT *sysContext,
               TPM2B_NAME *name,
               TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
 {
-    if (NULL == sysContext || NULL == cmdAuthsArray)
+    if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
+    const void *in[] = {inPrivate, inPublic};
+    void *out[] = {name};
 
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
-
-    build_command_header(sys_context, TPM2_CC_Load, TPM2_ST_SESSIONS);
-
-    marshal_uint32(parentHandle, &sys_context->ptr);
-
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
-        return ret;
-
-    marshal_tpm2b_private(inPrivate, &sys_context->ptr);
-
-    marshal_tpm2b_public(inPublic, &sys_context->ptr);
-
-    set_command_size(sys_context);
-
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
-
-    if (0 != unmarshal_uint32(&sys_context->ptr, &sys_context->remaining_response, objectHandle))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    ret = get_rspauths(sys_context, rspAuthsArray);
-    if (ret)
-        return ret;
-
-    if (0 != unmarshal_tpm2b_name(&sys_context->ptr, &sys_context->remaining_response, name))
-        return TSS2_SYS_RC_MALFORMED_RESPONSE;
-
-    assert(sys_context->remaining_response == 0);
-
-    return ret;
+    return run_command(down_cast(sysContext), &load_desc,
+                       &parentHandle, cmdAuthsArray, in,
+                       objectHandle, out, rspAuthsArray);
 }
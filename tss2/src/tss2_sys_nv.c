@@ -17,15 +17,45 @@
  *****************************************************************************/
 
 #include <tss2/tss2_sys.h>
+#include <tss2/tss2_sys_view.h>
 
-#include "internal/command_utils.h"
+#include "internal/command_engine.h"
 #include "internal/sys_context_common.h"
 #include "internal/marshal.h"
-#include "internal/execute.h"
-#include "internal/cmdauths.h"
-
-#include <assert.h>
 
+static const struct command_desc nv_define_space_desc = {
+    .code = TPM2_CC_NV_DefineSpace,
+    .handle_count = 1,
+    .flags = COMMAND_AUTHS_REQUIRED,
+    .in = {PARAM_TPM2B_DIGEST, PARAM_TPM2B_NV_PUBLIC},
+};
+
+static const struct command_desc nv_undefine_space_desc = {
+    .code = TPM2_CC_NV_UndefineSpace,
+    .handle_count = 2,
+    .flags = COMMAND_AUTHS_REQUIRED,
+};
+
+static const struct command_desc nv_write_desc = {
+    .code = TPM2_CC_NV_Write,
+    .handle_count = 2,
+    .flags = COMMAND_AUTHS_REQUIRED,
+    .in = {PARAM_TPM2B_MAX_NV_BUFFER, PARAM_UINT16},
+};
+
+static const struct command_desc nv_read_desc = {
+    .code = TPM2_CC_NV_Read,
+    .handle_count = 2,
+    .flags = COMMAND_AUTHS_REQUIRED,
+    .in = {PARAM_UINT16, PARAM_UINT16},
+    .out = {PARAM_TPM2B_MAX_NV_BUFFER},
+};
+
+static const struct command_desc nv_read_public_desc = {
+    .code = TPM2_CC_NV_ReadPublic,
+    .handle_count = 1,
+    .out = {PARAM_TPM2B_NV_PUBLIC, PARAM_TPM2B_NAME},
+};
 
 TSS2_RC
 Tss2_Sys_NV_DefineSpace(TSS2_SYS_CONTEXT *sysContext,
@@ -35,38 +65,14 @@ Tss2_Sys_NV_DefineSpace(TSS2_SYS_CONTEXT *sysContext,
                         const TPM2B_NV_PUBLIC *publicInfo,
                         TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
 {
-    if (NULL == sysContext || NULL == cmdAuthsArray)
+    if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
-
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
-
-    build_command_header(sys_context, TPM2_CC_NV_DefineSpace, TPM2_ST_SESSIONS);
-
-    marshal_uint32(authHandle, &sys_context->ptr);
-
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
-        return ret;
+    const void *in[] = {auth, publicInfo};
 
-    marshal_tpm2b_auth(auth, &sys_context->ptr);
-
-    marshal_tpm2b_nvpublic(publicInfo, &sys_context->ptr);
-
-    set_command_size(sys_context);
-
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
-
-    ret = get_rspauths(sys_context, rspAuthsArray);
-    if (ret)
-        return ret;
-
-    assert(sys_context->remaining_response == 0);
-
-    return ret;
+    return run_command(down_cast(sysContext), &nv_define_space_desc,
+                       &authHandle, cmdAuthsArray, in,
+                       NULL, NULL, rspAuthsArray);
 }
 
 TSS2_RC
@@ -76,36 +82,14 @@ Tss2_Sys_NV_UndefineSpace(TSS2_SYS_CONTEXT *sysContext,
                           const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
                           TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
 {
-    if (NULL == sysContext || NULL == cmdAuthsArray)
+    if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
-
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
-
-    build_command_header(sys_context, TPM2_CC_NV_UndefineSpace, TPM2_ST_SESSIONS);
-
-    marshal_uint32(authHandle, &sys_context->ptr);
+    const TPM2_HANDLE handles[] = {authHandle, nvIndex};
 
-    marshal_uint32(nvIndex, &sys_context->ptr);
-
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
-        return ret;
-
-    set_command_size(sys_context);
-
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
-
-    ret = get_rspauths(sys_context, rspAuthsArray);
-    if (ret)
-        return ret;
-
-    assert(sys_context->remaining_response == 0);
-
-    return ret;
+    return run_command(down_cast(sysContext), &nv_undefine_space_desc,
+                       handles, cmdAuthsArray, NULL,
+                       NULL, NULL, rspAuthsArray);
 }
 
 TSS2_RC
@@ -117,40 +101,40 @@ Tss2_Sys_NV_Write(TSS2_SYS_CONTEXT *sysContext,
                   uint16_t offset,
                   TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
 {
-    if (NULL == sysContext || NULL == cmdAuthsArray)
+    if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
-
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
-
-    build_command_header(sys_context, TPM2_CC_NV_Write, TPM2_ST_SESSIONS);
-
-    marshal_uint32(authHandle, &sys_context->ptr);
-
-    marshal_uint32(nvIndex, &sys_context->ptr);
-
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
-        return ret;
-
-    marshal_tpm2b_maxnvbuffer(data, &sys_context->ptr);
+    const TPM2_HANDLE handles[] = {authHandle, nvIndex};
+    const void *in[] = {data, &offset};
 
-    marshal_uint16(offset, &sys_context->ptr);
+    return run_command(down_cast(sysContext), &nv_write_desc,
+                       handles, cmdAuthsArray, in,
+                       NULL, NULL, rspAuthsArray);
+}
 
-    set_command_size(sys_context);
+TSS2_RC
+Tss2_Sys_NV_Write_Prepare(TSS2_SYS_CONTEXT *sysContext,
+                          TPMI_RH_NV_AUTH authHandle,
+                          TPMI_RH_NV_INDEX nvIndex,
+                          const TPM2B_MAX_NV_BUFFER *data,
+                          uint16_t offset)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
 
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
+    const TPM2_HANDLE handles[] = {authHandle, nvIndex};
+    const void *in[] = {data, &offset};
 
-    ret = get_rspauths(sys_context, rspAuthsArray);
-    if (ret)
-        return ret;
+    return prepare_command(down_cast(sysContext), &nv_write_desc, handles, in);
+}
 
-    assert(sys_context->remaining_response == 0);
+TSS2_RC
+Tss2_Sys_NV_Write_Complete(TSS2_SYS_CONTEXT *sysContext)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
 
-    return ret;
+    return complete_command(down_cast(sysContext), &nv_write_desc, NULL);
 }
 
 TSS2_RC
@@ -163,83 +147,117 @@ Tss2_Sys_NV_Read(TSS2_SYS_CONTEXT *sysContext,
                  TPM2B_MAX_NV_BUFFER *data,
                  TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
 {
-    if (NULL == sysContext || NULL == cmdAuthsArray)
+    if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
-
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
-
-    build_command_header(sys_context, TPM2_CC_NV_Read, TPM2_ST_SESSIONS);
+    const TPM2_HANDLE handles[] = {authHandle, nvIndex};
+    const void *in[] = {&size, &offset};
+    void *out[] = {data};
 
-    marshal_uint32(authHandle, &sys_context->ptr);
-
-    marshal_uint32(nvIndex, &sys_context->ptr);
-
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
-        return ret;
-
-    marshal_uint16(size, &sys_context->ptr);
+    return run_command(down_cast(sysContext), &nv_read_desc,
+                       handles, cmdAuthsArray, in,
+                       NULL, out, rspAuthsArray);
+}
 
-    marshal_uint16(offset, &sys_context->ptr);
+TSS2_RC
+Tss2_Sys_NV_Read_View(TSS2_SYS_CONTEXT *sysContext,
+                      TPMI_RH_NV_AUTH authHandle,
+                      TPMI_RH_NV_INDEX nvIndex,
+                      const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                      uint16_t size,
+                      uint16_t offset,
+                      struct xtpm_span *data,
+                      TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext || NULL == data)
+        return TSS2_SYS_RC_BAD_REFERENCE;
 
-    set_command_size(sys_context);
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
 
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
+    const TPM2_HANDLE handles[] = {authHandle, nvIndex};
+    const void *in[] = {&size, &offset};
 
-    ret = get_rspauths(sys_context, rspAuthsArray);
+    TSS2_RC ret = execute_command(sys_context, &nv_read_desc,
+                                  handles, cmdAuthsArray, in,
+                                  NULL, rspAuthsArray);
     if (ret)
         return ret;
 
-    if (0 != unmarshal_tpm2b_maxnvbuffer(&sys_context->ptr, &sys_context->remaining_response, data))
+    if (0 != view_tpm2b(&sys_context->ptr, &sys_context->remaining_response, data))
         return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
-    assert(sys_context->remaining_response == 0);
+    if (0 != sys_context->remaining_response)
+        return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
     return ret;
 }
 
 TSS2_RC
-Tss2_Sys_NV_ReadPublic(TSS2_SYS_CONTEXT *sysContext,
-                       TPMI_RH_NV_INDEX nvIndex,
-                       const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
-                       TPM2B_NV_PUBLIC *nvPublic,
-                       TPM2B_NAME *nvName,
-                       TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+Tss2_Sys_NV_Read_Prepare(TSS2_SYS_CONTEXT *sysContext,
+                         TPMI_RH_NV_AUTH authHandle,
+                         TPMI_RH_NV_INDEX nvIndex,
+                         uint16_t size,
+                         uint16_t offset)
 {
-    (void)rspAuthsArray;    // auths can't be specified, so they won't be in response
-
     if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
+    const TPM2_HANDLE handles[] = {authHandle, nvIndex};
+    const void *in[] = {&size, &offset};
 
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+    return prepare_command(down_cast(sysContext), &nv_read_desc, handles, in);
+}
 
-    build_command_header(sys_context, TPM2_CC_NV_ReadPublic, TPM2_ST_NO_SESSIONS);
+TSS2_RC
+Tss2_Sys_NV_Read_Complete(TSS2_SYS_CONTEXT *sysContext,
+                          TPM2B_MAX_NV_BUFFER *data)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
 
-    marshal_uint32(nvIndex, &sys_context->ptr);
+    void *out[] = {data};
 
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
-        return ret;
+    return complete_command(down_cast(sysContext), &nv_read_desc, out);
+}
+
+TSS2_RC
+Tss2_Sys_NV_Read_CompleteView(TSS2_SYS_CONTEXT *sysContext,
+                              struct xtpm_span *data)
+{
+    if (NULL == sysContext || NULL == data)
+        return TSS2_SYS_RC_BAD_REFERENCE;
 
-    set_command_size(sys_context);
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
 
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
+    if (CMD_STAGE_RECEIVE_RESPONSE != sys_context->previous_stage)
+        return TSS2_SYS_RC_BAD_SEQUENCE;
+
+    if (TSS2_RC_SUCCESS != sys_context->response_code)
+        return sys_context->response_code;
 
-    if (0 != unmarshal_tpm2b_nvpublic(&sys_context->ptr, &sys_context->remaining_response, nvPublic))
+    if (0 != view_tpm2b(&sys_context->ptr, &sys_context->remaining_response, data))
         return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
-    if (0 != unmarshal_tpm2b_name(&sys_context->ptr, &sys_context->remaining_response, nvName))
+    if (0 != sys_context->remaining_response)
         return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
-    assert(sys_context->remaining_response == 0);
+    return TSS2_RC_SUCCESS;
+}
 
-    return ret;
+TSS2_RC
+Tss2_Sys_NV_ReadPublic(TSS2_SYS_CONTEXT *sysContext,
+                       TPMI_RH_NV_INDEX nvIndex,
+                       const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                       TPM2B_NV_PUBLIC *nvPublic,
+                       TPM2B_NAME *nvName,
+                       TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    void *out[] = {nvPublic, nvName};
+
+    return run_command(down_cast(sysContext), &nv_read_public_desc,
+                       &nvIndex, cmdAuthsArray, NULL,
+                       NULL, out, rspAuthsArray);
 }
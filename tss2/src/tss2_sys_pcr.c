@@ -0,0 +1,72 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+
+#include "internal/command_engine.h"
+#include "internal/sys_context_common.h"
+
+static const struct command_desc pcr_read_desc = {
+    .code = TPM2_CC_PCR_Read,
+    .in = {PARAM_TPML_PCR_SELECTION},
+    .out = {PARAM_UINT32, PARAM_TPML_PCR_SELECTION, PARAM_TPML_DIGEST},
+};
+
+static const struct command_desc pcr_extend_desc = {
+    .code = TPM2_CC_PCR_Extend,
+    .handle_count = 1,
+    .flags = COMMAND_AUTHS_REQUIRED,
+    .in = {PARAM_TPML_DIGEST_VALUES},
+};
+
+TSS2_RC
+Tss2_Sys_PCR_Read(TSS2_SYS_CONTEXT *sysContext,
+                  const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                  const TPML_PCR_SELECTION *pcrSelectionIn,
+                  uint32_t *pcrUpdateCounter,
+                  TPML_PCR_SELECTION *pcrSelectionOut,
+                  TPML_DIGEST *pcrValues,
+                  TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    const void *in[] = {pcrSelectionIn};
+    void *out[] = {pcrUpdateCounter, pcrSelectionOut, pcrValues};
+
+    return run_command(down_cast(sysContext), &pcr_read_desc,
+                       NULL, cmdAuthsArray, in,
+                       NULL, out, rspAuthsArray);
+}
+
+TSS2_RC
+Tss2_Sys_PCR_Extend(TSS2_SYS_CONTEXT *sysContext,
+                    TPMI_DH_PCR pcrHandle,
+                    const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                    const TPML_DIGEST_VALUES *digests,
+                    TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    const void *in[] = {digests};
+
+    return run_command(down_cast(sysContext), &pcr_extend_desc,
+                       &pcrHandle, cmdAuthsArray, in,
+                       NULL, NULL, rspAuthsArray);
+}
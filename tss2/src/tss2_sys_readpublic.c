@@ -17,14 +17,17 @@
  *****************************************************************************/
 
 #include <tss2/tss2_sys.h>
+#include <tss2/tss2_sys_view.h>
 
-#include "internal/command_utils.h"
+#include "internal/command_engine.h"
 #include "internal/sys_context_common.h"
 #include "internal/marshal.h"
-#include "internal/execute.h"
-#include "internal/cmdauths.h"
 
-#include <assert.h>
+static const struct command_desc read_public_desc = {
+    .code = TPM2_CC_ReadPublic,
+    .handle_count = 1,
+    .out = {PARAM_TPM2B_PUBLIC, PARAM_TPM2B_NAME, PARAM_TPM2B_NAME},
+};
 
 TSS2_RC
 Tss2_Sys_ReadPublic(TSS2_SYS_CONTEXT *sysContext,
@@ -35,44 +38,43 @@ Tss2_Sys_ReadPublic(TSS2_SYS_CONTEXT *sysContext,
                     TPM2B_NAME *qualifiedName,
                     TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
 {
-    if (NULL == sysContext ||
-        NULL == outPublic ||
-        NULL ==  name ||
-        NULL == qualifiedName)
+    if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
+    void *out[] = {outPublic, name, qualifiedName};
 
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
-
-    build_command_header(sys_context, TPM2_CC_ReadPublic, TPM2_ST_NO_SESSIONS);
-
-    marshal_uint32(objectHandle, &sys_context->ptr);
-
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
-        return ret;
+    return run_command(down_cast(sysContext), &read_public_desc,
+                       &objectHandle, cmdAuthsArray, NULL,
+                       NULL, out, rspAuthsArray);
+}
 
-    set_command_size(sys_context);
+TSS2_RC
+Tss2_Sys_ReadPublic_View(TSS2_SYS_CONTEXT *sysContext,
+                         TPMI_DH_OBJECT objectHandle,
+                         struct xtpm_public_view *outPublic)
+{
+    if (NULL == sysContext || NULL == outPublic)
+        return TSS2_SYS_RC_BAD_REFERENCE;
 
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
 
-    ret = get_rspauths(sys_context, rspAuthsArray);
+    TSS2_RC ret = execute_command(sys_context, &read_public_desc,
+                                  &objectHandle, NULL, NULL,
+                                  NULL, NULL);
     if (ret)
         return ret;
 
-    if (0 != unmarshal_tpm2b_public(&sys_context->ptr, &sys_context->remaining_response, outPublic))
+    if (0 != view_tpm2b_public(&sys_context->ptr, &sys_context->remaining_response, outPublic))
         return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
-    if (0 != unmarshal_tpm2b_name(&sys_context->ptr, &sys_context->remaining_response, name))
+    if (0 != skip_tpm2b(&sys_context->ptr, &sys_context->remaining_response))
         return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
-    if (0 != unmarshal_tpm2b_name(&sys_context->ptr, &sys_context->remaining_response, qualifiedName))
+    if (0 != skip_tpm2b(&sys_context->ptr, &sys_context->remaining_response))
         return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
-    assert(sys_context->remaining_response == 0);
+    if (0 != sys_context->remaining_response)
+        return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
     return ret;
 }
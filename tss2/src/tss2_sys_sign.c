@@ -17,14 +17,19 @@
  *****************************************************************************/
 
 #include <tss2/tss2_sys.h>
+#include <tss2/tss2_sys_view.h>
 
-#include "internal/command_utils.h"
+#include "internal/command_engine.h"
 #include "internal/sys_context_common.h"
 #include "internal/marshal.h"
-#include "internal/execute.h"
-#include "internal/cmdauths.h"
 
-#include <assert.h>
+static const struct command_desc sign_desc = {
+    .code = TPM2_CC_Sign,
+    .handle_count = 1,
+    .flags = COMMAND_AUTHS_REQUIRED,
+    .in = {PARAM_TPM2B_DIGEST, PARAM_TPMT_SIG_SCHEME, PARAM_TPMT_TK_HASHCHECK},
+    .out = {PARAM_TPMT_SIGNATURE},
+};
 
 TSS2_RC
 Tss2_Sys_Sign(TSS2_SYS_CONTEXT *sysContext,
@@ -36,41 +41,96 @@ Tss2_Sys_Sign(TSS2_SYS_CONTEXT *sysContext,
               TPMT_SIGNATURE *signature,
               TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
 {
-    if (NULL == sysContext || NULL == cmdAuthsArray)
+    if (NULL == sysContext)
         return TSS2_SYS_RC_BAD_REFERENCE;
 
-    TSS2_RC ret = TSS2_RC_SUCCESS;
+    const void *in[] = {digest, inScheme, validation};
+    void *out[] = {signature};
 
-    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+    return run_command(down_cast(sysContext), &sign_desc,
+                       &keyHandle, cmdAuthsArray, in,
+                       NULL, out, rspAuthsArray);
+}
+
+TSS2_RC
+Tss2_Sys_Sign_View(TSS2_SYS_CONTEXT *sysContext,
+                   TPMI_DH_OBJECT keyHandle,
+                   const TSS2L_SYS_AUTH_COMMAND *cmdAuthsArray,
+                   const TPM2B_DIGEST *digest,
+                   const TPMT_SIG_SCHEME *inScheme,
+                   const TPMT_TK_HASHCHECK *validation,
+                   struct xtpm_signature_view *signature,
+                   TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext || NULL == signature)
+        return TSS2_SYS_RC_BAD_REFERENCE;
 
-    build_command_header(sys_context, TPM2_CC_Sign, TPM2_ST_SESSIONS);
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
 
-    marshal_uint32(keyHandle, &sys_context->ptr);
+    const void *in[] = {digest, inScheme, validation};
 
-    ret = set_cmdauths(sys_context, cmdAuthsArray);
-    if (TSS2_RC_SUCCESS != ret)
+    TSS2_RC ret = execute_command(sys_context, &sign_desc,
+                                  &keyHandle, cmdAuthsArray, in,
+                                  NULL, rspAuthsArray);
+    if (ret)
         return ret;
 
-    marshal_tpm2b_digest(digest, &sys_context->ptr);
+    if (0 != view_tpmt_signature(&sys_context->ptr, &sys_context->remaining_response, signature))
+        return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
-    marshal_tpmt_sigscheme(inScheme, &sys_context->ptr);
+    if (0 != sys_context->remaining_response)
+        return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
-    marshal_tpmt_tkhashcheck(validation, &sys_context->ptr);
+    return ret;
+}
 
-    set_command_size(sys_context);
+TSS2_RC
+Tss2_Sys_Sign_Prepare(TSS2_SYS_CONTEXT *sysContext,
+                      TPMI_DH_OBJECT keyHandle,
+                      const TPM2B_DIGEST *digest,
+                      const TPMT_SIG_SCHEME *inScheme,
+                      const TPMT_TK_HASHCHECK *validation)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
 
-    ret = Tss2_Sys_Execute(sys_context);
-    if (ret)
-        return ret;
+    const void *in[] = {digest, inScheme, validation};
 
-    ret = get_rspauths(sys_context, rspAuthsArray);
-    if (ret)
-        return ret;
+    return prepare_command(down_cast(sysContext), &sign_desc, &keyHandle, in);
+}
+
+TSS2_RC
+Tss2_Sys_Sign_Complete(TSS2_SYS_CONTEXT *sysContext,
+                       TPMT_SIGNATURE *signature)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    void *out[] = {signature};
+
+    return complete_command(down_cast(sysContext), &sign_desc, out);
+}
+
+TSS2_RC
+Tss2_Sys_Sign_CompleteView(TSS2_SYS_CONTEXT *sysContext,
+                           struct xtpm_signature_view *signature)
+{
+    if (NULL == sysContext || NULL == signature)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
 
-    if (0 != unmarshal_tpmt_signature(&sys_context->ptr, &sys_context->remaining_response, signature))
+    if (CMD_STAGE_RECEIVE_RESPONSE != sys_context->previous_stage)
+        return TSS2_SYS_RC_BAD_SEQUENCE;
+
+    if (TSS2_RC_SUCCESS != sys_context->response_code)
+        return sys_context->response_code;
+
+    if (0 != view_tpmt_signature(&sys_context->ptr, &sys_context->remaining_response, signature))
         return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
-    assert(sys_context->remaining_response == 0);
+    if (0 != sys_context->remaining_response)
+        return TSS2_SYS_RC_MALFORMED_RESPONSE;
 
-    return ret;
+    return TSS2_RC_SUCCESS;
 }
@@ -0,0 +1,289 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys_stats.h>
+
+#include "internal/stats.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// One thread's counters.
+// Only the owning thread writes them, so plain (relaxed) loads and stores suffice.
+// When the thread exits its block is released, not freed: a snapshot keeps counting it,
+// and the next new thread takes it over, so there are only as many blocks as concurrent threads.
+struct stats_block {
+    struct xtpm_stats stats;
+    int in_use;
+    struct stats_block *next;
+};
+
+static struct stats_block *all_blocks_g = NULL;
+
+#if defined(XTPM_NO_HEAP) && 0 == XTPM_STATS_STATIC_BLOCKS
+
+// Compiled out: no blocks, so snapshots are all zero.
+void
+record_command(TPM2_CC command_code,
+               TSS2_RC ret,
+               uint64_t transmit_start_ns,
+               uint64_t transmit_end_ns,
+               uint64_t response_start_ns,
+               uint64_t receive_end_ns)
+{
+    (void)command_code;
+    (void)ret;
+    (void)transmit_start_ns;
+    (void)transmit_end_ns;
+    (void)response_start_ns;
+    (void)receive_end_ns;
+}
+
+#else
+
+static __thread struct stats_block *thread_block_g = NULL;
+
+static pthread_once_t release_key_once_g = PTHREAD_ONCE_INIT;
+static pthread_key_t release_key_g;
+static int release_key_ok_g = 0;
+
+#ifdef XTPM_NO_HEAP
+static struct stats_block static_blocks_g[XTPM_STATS_STATIC_BLOCKS];
+static unsigned static_blocks_used_g = 0;
+#endif
+
+static
+void
+release_block(void *block)
+{
+    // Publish this thread's last counts to whichever thread claims the block next.
+    __atomic_store_n(&((struct stats_block*)block)->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static
+void
+create_release_key(void)
+{
+    release_key_ok_g = (0 == pthread_key_create(&release_key_g, release_block));
+}
+
+static
+struct stats_block*
+claim_released_block(void)
+{
+    for (struct stats_block *block = __atomic_load_n(&all_blocks_g, __ATOMIC_ACQUIRE);
+            NULL != block;
+            block = block->next) {
+        int released = 0;
+        if (__atomic_compare_exchange_n(&block->in_use, &released, 1,
+                                        0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return block;
+    }
+
+    return NULL;
+}
+
+static
+struct stats_block*
+get_thread_block(void)
+{
+    if (NULL != thread_block_g)
+        return thread_block_g;
+
+    // Without a way to release the block at thread exit, don't take one.
+    pthread_once(&release_key_once_g, create_release_key);
+    if (!release_key_ok_g)
+        return NULL;
+
+    struct stats_block *block = claim_released_block();
+    if (NULL == block) {
+#ifdef XTPM_NO_HEAP
+        // Take the next block of a fixed pool; threads beyond it go uncounted.
+        unsigned index = __atomic_fetch_add(&static_blocks_used_g, 1, __ATOMIC_RELAXED);
+        if (index >= XTPM_STATS_STATIC_BLOCKS)
+            return NULL;
+        block = &static_blocks_g[index];
+#else
+        block = calloc(1, sizeof(struct stats_block));
+        if (NULL == block)
+            return NULL;
+#endif
+        block->in_use = 1;
+
+        // Lock-free push onto the list of all blocks.
+        block->next = __atomic_load_n(&all_blocks_g, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&all_blocks_g, &block->next, block,
+                                            1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+
+    if (0 != pthread_setspecific(release_key_g, block)) {
+        release_block(block);
+        return NULL;
+    }
+
+    thread_block_g = block;
+
+    return block;
+}
+
+static inline
+void
+add(uint64_t *counter, uint64_t amount)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + amount, __ATOMIC_RELAXED);
+}
+
+static
+void
+add_sample(struct xtpm_stats_histogram *histogram, uint64_t latency_ns)
+{
+    uint64_t latency_us = latency_ns / 1000;
+
+    unsigned bucket = 0;
+    while (latency_us > 0 && bucket < XTPM_STATS_HISTOGRAM_BUCKETS - 1) {
+        latency_us >>= 1;
+        bucket++;
+    }
+
+    add(&histogram->total_ns, latency_ns);
+    add(&histogram->buckets[bucket], 1);
+}
+
+void
+record_command(TPM2_CC command_code,
+               TSS2_RC ret,
+               uint64_t transmit_start_ns,
+               uint64_t transmit_end_ns,
+               uint64_t response_start_ns,
+               uint64_t receive_end_ns)
+{
+    if (command_code < XTPM_STATS_CC_FIRST || command_code - XTPM_STATS_CC_FIRST >= XTPM_STATS_CC_COUNT)
+        return;
+
+    struct stats_block *block = get_thread_block();
+    if (NULL == block)
+        return;
+
+    struct xtpm_cc_stats *cc_stats = &block->stats.commands[command_code - XTPM_STATS_CC_FIRST];
+
+    add(&cc_stats->calls, 1);
+    if (TSS2_RC_SUCCESS != ret)
+        add(&cc_stats->errors, 1);
+
+    add_sample(&cc_stats->latency[XTPM_STATS_TRANSMIT], transmit_end_ns - transmit_start_ns);
+
+    // Nothing was received if transmit failed.
+    if (receive_end_ns < transmit_end_ns)
+        return;
+
+    add_sample(&cc_stats->latency[XTPM_STATS_TPM_WAIT], response_start_ns - transmit_end_ns);
+    add_sample(&cc_stats->latency[XTPM_STATS_RECEIVE], receive_end_ns - response_start_ns);
+}
+
+#endif
+
+void
+xtpm_stats_snapshot(struct xtpm_stats *out)
+{
+    memset(out, 0, sizeof(struct xtpm_stats));
+
+    uint64_t *out_counters = (uint64_t*)out;
+    size_t counter_count = sizeof(struct xtpm_stats) / sizeof(uint64_t);
+
+    for (struct stats_block *block = __atomic_load_n(&all_blocks_g, __ATOMIC_ACQUIRE);
+            NULL != block;
+            block = block->next) {
+        uint64_t *block_counters = (uint64_t*)&block->stats;
+        for (size_t i = 0; i < counter_count; i++)
+            out_counters[i] += __atomic_load_n(&block_counters[i], __ATOMIC_RELAXED);
+    }
+}
+
+const struct xtpm_cc_stats*
+xtpm_stats_for_command(const struct xtpm_stats *stats,
+                       TPM2_CC command_code)
+{
+    if (command_code < XTPM_STATS_CC_FIRST || command_code - XTPM_STATS_CC_FIRST >= XTPM_STATS_CC_COUNT)
+        return NULL;
+
+    return &stats->commands[command_code - XTPM_STATS_CC_FIRST];
+}
+
+uint64_t
+xtpm_stats_percentile_us(const struct xtpm_stats_histogram *histogram,
+                         double percentile)
+{
+    uint64_t count = 0;
+    for (unsigned i = 0; i < XTPM_STATS_HISTOGRAM_BUCKETS; i++)
+        count += histogram->buckets[i];
+
+    if (0 == count)
+        return 0;
+
+    // Rank of the sample at this percentile, rounding up.
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)count);
+    if ((double)rank < percentile / 100.0 * (double)count)
+        rank++;
+    if (0 == rank)
+        rank = 1;
+
+    uint64_t seen = 0;
+    unsigned bucket;
+    for (bucket = 0; bucket < XTPM_STATS_HISTOGRAM_BUCKETS - 1; bucket++) {
+        seen += histogram->buckets[bucket];
+        if (seen >= rank)
+            break;
+    }
+
+    return (uint64_t)1 << bucket;
+}
+
+int
+xtpm_stats_dump(const struct xtpm_stats *stats,
+                FILE *out)
+{
+    if (0 > fprintf(out, "%-10s %10s %8s %12s %12s %12s %12s\n",
+                    "cc", "calls", "errors", "mean_tx_us", "mean_wait_us", "mean_rx_us", "p99_wait_us"))
+        return -1;
+
+    for (unsigned i = 0; i < XTPM_STATS_CC_COUNT; i++) {
+        const struct xtpm_cc_stats *cc_stats = &stats->commands[i];
+        if (0 == cc_stats->calls)
+            continue;
+
+        double mean_us[XTPM_STATS_PHASE_COUNT];
+        for (unsigned phase = 0; phase < XTPM_STATS_PHASE_COUNT; phase++)
+            mean_us[phase] = (double)cc_stats->latency[phase].total_ns / 1000.0 / (double)cc_stats->calls;
+
+        uint64_t p99_us = xtpm_stats_percentile_us(&cc_stats->latency[XTPM_STATS_TPM_WAIT], 99.0);
+
+        if (0 > fprintf(out, "0x%08x %10llu %8llu %12.1f %12.1f %12.1f %12llu\n",
+                        XTPM_STATS_CC_FIRST + i,
+                        (unsigned long long)cc_stats->calls,
+                        (unsigned long long)cc_stats->errors,
+                        mean_us[XTPM_STATS_TRANSMIT],
+                        mean_us[XTPM_STATS_TPM_WAIT],
+                        mean_us[XTPM_STATS_RECEIVE],
+                        (unsigned long long)p99_us))
+            return -1;
+    }
+
+    return 0;
+}
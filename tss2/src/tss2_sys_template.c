@@ -0,0 +1,253 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys_template.h>
+
+#include "internal/sys_context_common.h"
+#include "internal/marshal.h"
+#include "internal/execute.h"
+#include "internal/cmdauths.h"
+
+#include <string.h>
+
+static
+TPM2_CC
+template_command_code(const struct xtpm_command_template *tmpl)
+{
+    uint8_t *cc_ptr = (uint8_t*)tmpl->buffer + sizeof(TPMI_ST_COMMAND_TAG) + sizeof(uint32_t);
+    uint32_t remaining = sizeof(TPM2_CC);
+    TPM2_CC command_code = 0;
+    (void)unmarshal_uint32(&cc_ptr, &remaining, &command_code);
+
+    return command_code;
+}
+
+// Handles that may be patched. With sessions, where the handles end can't be
+// told from the marshaled command, so only commands known here have any.
+static
+uint8_t
+template_handle_count(TPM2_CC command_code)
+{
+    switch (command_code) {
+        case TPM2_CC_Sign:
+            return 1;
+        case TPM2_CC_NV_Read:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+// Whether `length` bytes at `offset` lie within the command saved in `tmpl`
+// (a template's fields are the caller's, so they may be garbage).
+static
+int
+template_has(const struct xtpm_command_template *tmpl,
+             size_t offset,
+             size_t length)
+{
+    return tmpl->size <= sizeof(tmpl->buffer) &&
+        offset <= tmpl->size &&
+        length <= tmpl->size - offset;
+}
+
+static
+TSS2_RC
+load_template(TSS2_SYS_CONTEXT_OPAQUE *sys_context,
+              const struct xtpm_command_template *tmpl)
+{
+    if (!template_has(tmpl, 0, COMMAND_HEADER_SIZE) || tmpl->parameters_offset > tmpl->size)
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    if (tmpl->size > sys_context->buffer_size)
+        return TSS2_SYS_RC_INSUFFICIENT_CONTEXT;
+
+    reset_sys_context(sys_context);
+
+    memcpy(sys_context->buffer, tmpl->buffer, tmpl->size);
+
+    sys_context->ptr = sys_context->buffer + tmpl->size;
+    sys_context->cp_offset = tmpl->parameters_offset;
+    sys_context->cmd_auths_count = tmpl->cmd_auths_count;
+    sys_context->previous_stage = CMD_STAGE_PREPARE;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+Tss2_Sys_SaveTemplate(TSS2_SYS_CONTEXT *sysContext,
+                      struct xtpm_command_template *tmpl)
+{
+    if (NULL == sysContext || NULL == tmpl)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+
+    if (CMD_STAGE_PREPARE != sys_context->previous_stage || 0 == sys_context->cp_offset)
+        return TSS2_SYS_RC_BAD_SEQUENCE;
+
+    size_t size = sys_context->ptr - sys_context->buffer;
+    if (size > sizeof(tmpl->buffer))
+        return TSS2_SYS_RC_INSUFFICIENT_BUFFER;
+
+    memcpy(tmpl->buffer, sys_context->buffer, size);
+
+    tmpl->size = size;
+    tmpl->parameters_offset = sys_context->cp_offset;
+    tmpl->handle_count = template_handle_count(template_command_code(tmpl));
+    tmpl->cmd_auths_count = sys_context->cmd_auths_count;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+Tss2_Sys_LoadTemplate(TSS2_SYS_CONTEXT *sysContext,
+                      const struct xtpm_command_template *tmpl)
+{
+    if (NULL == sysContext || NULL == tmpl)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    return load_template(down_cast(sysContext), tmpl);
+}
+
+TSS2_RC
+xtpm_template_set_handle(struct xtpm_command_template *tmpl,
+                         unsigned index,
+                         TPM2_HANDLE handle)
+{
+    if (NULL == tmpl)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    if (index >= tmpl->handle_count)
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    size_t handle_offset = COMMAND_HEADER_SIZE + index * sizeof(TPM2_HANDLE);
+    if (!template_has(tmpl, handle_offset, sizeof(TPM2_HANDLE)))
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    uint8_t *handle_ptr = tmpl->buffer + handle_offset;
+    marshal_uint32(handle, &handle_ptr);
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+xtpm_template_set_digest(struct xtpm_command_template *tmpl,
+                         const TPM2B_DIGEST *digest)
+{
+    if (NULL == tmpl || NULL == digest)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    if (!template_has(tmpl, 0, COMMAND_HEADER_SIZE) || TPM2_CC_Sign != template_command_code(tmpl))
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    // The digest is the first parameter.
+    if (!template_has(tmpl, tmpl->parameters_offset, sizeof(uint16_t)))
+        return TSS2_SYS_RC_BAD_VALUE;
+    uint8_t *size_ptr = tmpl->buffer + tmpl->parameters_offset;
+    uint32_t remaining = sizeof(uint16_t);
+    uint16_t size = 0;
+    (void)unmarshal_uint16(&size_ptr, &remaining, &size);
+    if (digest->size != size)
+        return TSS2_SYS_RC_BAD_SIZE;
+    if (!template_has(tmpl, tmpl->parameters_offset + sizeof(uint16_t), size))
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    memcpy(size_ptr, digest->buffer, size);
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+xtpm_template_set_nv_range(struct xtpm_command_template *tmpl,
+                           uint16_t size,
+                           uint16_t offset)
+{
+    if (NULL == tmpl)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    if (!template_has(tmpl, 0, COMMAND_HEADER_SIZE) || TPM2_CC_NV_Read != template_command_code(tmpl))
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    if (!template_has(tmpl, tmpl->parameters_offset, 2 * sizeof(uint16_t)))
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    uint8_t *param_ptr = tmpl->buffer + tmpl->parameters_offset;
+    marshal_uint16(size, &param_ptr);
+    marshal_uint16(offset, &param_ptr);
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+Tss2_Sys_Sign_FromTemplate(TSS2_SYS_CONTEXT *sysContext,
+                           const struct xtpm_command_template *tmpl,
+                           TPMT_SIGNATURE *signature,
+                           TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext || NULL == tmpl)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    if (TPM2_CC_Sign != template_command_code(tmpl))
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+
+    TSS2_RC ret = load_template(sys_context, tmpl);
+    if (ret)
+        return ret;
+
+    ret = Tss2_Sys_Execute(sys_context);
+    if (ret)
+        return ret;
+
+    ret = get_rspauths(sys_context, rspAuthsArray);
+    if (ret)
+        return ret;
+
+    return Tss2_Sys_Sign_Complete(sysContext, signature);
+}
+
+TSS2_RC
+Tss2_Sys_NV_Read_FromTemplate(TSS2_SYS_CONTEXT *sysContext,
+                              const struct xtpm_command_template *tmpl,
+                              TPM2B_MAX_NV_BUFFER *data,
+                              TSS2L_SYS_AUTH_RESPONSE *rspAuthsArray)
+{
+    if (NULL == sysContext || NULL == tmpl)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    if (TPM2_CC_NV_Read != template_command_code(tmpl))
+        return TSS2_SYS_RC_BAD_VALUE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+
+    TSS2_RC ret = load_template(sys_context, tmpl);
+    if (ret)
+        return ret;
+
+    ret = Tss2_Sys_Execute(sys_context);
+    if (ret)
+        return ret;
+
+    ret = get_rspauths(sys_context, rspAuthsArray);
+    if (ret)
+        return ret;
+
+    return Tss2_Sys_NV_Read_Complete(sysContext, data);
+}
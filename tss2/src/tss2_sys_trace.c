@@ -0,0 +1,218 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys_trace.h>
+
+#include "internal/sys_context_common.h"
+#include "internal/tcti_common.h"
+
+#include <string.h>
+
+// Records are padded to this, so headers stay aligned unless they wrap.
+#define RECORD_ALIGNMENT 8
+
+TSS2_RC
+Tss2_Sys_SetTraceHook(TSS2_SYS_CONTEXT *sysContext,
+                      const struct xtpm_trace_hook *hook)
+{
+    if (NULL == sysContext)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    if (NULL != hook && NULL == hook->fn)
+        return TSS2_SYS_RC_BAD_REFERENCE;
+
+    TSS2_SYS_CONTEXT_OPAQUE *sys_context = down_cast(sysContext);
+
+    sys_context->trace_hook = hook;
+
+    // Only this library's TCTIs have a hook to set.
+    TSS2_TCTI_CONTEXT_COMMON_XAPTUM *tcti = (TSS2_TCTI_CONTEXT_COMMON_XAPTUM*)sys_context->tcti_context;
+    if (NULL != tcti && TCTI_MAGIC == tcti->v1.magic) {
+        if (NULL != hook && (hook->layers & XTPM_TRACE_LAYER_TCTI))
+            tcti->trace_hook = hook;
+        else
+            tcti->trace_hook = NULL;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+void
+xtpm_trace_print(const struct xtpm_trace_event *event,
+                 void *user_data)
+{
+    FILE *out = user_data;
+
+    fprintf(out, "%s %s cc=0x%08x rc=0x%08x start_ns=%llu duration_ns=%llu size=%zu data=",
+            XTPM_TRACE_LAYER_SAPI == event->layer ? "sapi" : "tcti",
+            XTPM_TRACE_COMMAND == event->direction ? "command" : "response",
+            event->command_code,
+            event->rc,
+            (unsigned long long)event->start_ns,
+            (unsigned long long)(event->end_ns - event->start_ns),
+            event->length);
+    for (size_t i = 0; i < event->length; i++)
+        fprintf(out, "%02x", event->buffer[i]);
+    fputc('\n', out);
+}
+
+static
+size_t
+padded_length(size_t length)
+{
+    return (length + RECORD_ALIGNMENT - 1) & ~(size_t)(RECORD_ALIGNMENT - 1);
+}
+
+static
+void
+lock_ring(struct xtpm_trace_ring *ring)
+{
+    while (__atomic_test_and_set(&ring->lock, __ATOMIC_ACQUIRE))
+        ;
+}
+
+static
+void
+unlock_ring(struct xtpm_trace_ring *ring)
+{
+    __atomic_clear(&ring->lock, __ATOMIC_RELEASE);
+}
+
+// Copy `length` bytes into the ring at (unwrapped) position `position`.
+static
+void
+copy_in(struct xtpm_trace_ring *ring,
+        uint64_t position,
+        const void *in,
+        size_t length)
+{
+    size_t offset = position % ring->capacity;
+    size_t first = ring->capacity - offset < length ? ring->capacity - offset : length;
+
+    memcpy(ring->buffer + offset, in, first);
+    memcpy(ring->buffer, (const uint8_t*)in + first, length - first);
+}
+
+// Copy `length` bytes out of the ring from (unwrapped) position `position`.
+static
+void
+copy_out(const struct xtpm_trace_ring *ring,
+         uint64_t position,
+         void *out,
+         size_t length)
+{
+    size_t offset = position % ring->capacity;
+    size_t first = ring->capacity - offset < length ? ring->capacity - offset : length;
+
+    memcpy(out, ring->buffer + offset, first);
+    memcpy((uint8_t*)out + first, ring->buffer, length - first);
+}
+
+TSS2_RC
+xtpm_trace_ring_init(struct xtpm_trace_ring *ring,
+                     void *buffer,
+                     size_t capacity,
+                     size_t snap_length)
+{
+    if (NULL == ring || NULL == buffer)
+        return TSS2_BASE_RC_BAD_REFERENCE;
+
+    if (snap_length > UINT16_MAX)
+        snap_length = UINT16_MAX;
+
+    if (capacity < sizeof(struct xtpm_trace_record) + padded_length(snap_length))
+        return TSS2_BASE_RC_INSUFFICIENT_BUFFER;
+
+    memset(ring, 0, sizeof(struct xtpm_trace_ring));
+    ring->buffer = buffer;
+    ring->capacity = capacity;
+    ring->snap_length = snap_length;
+
+    return TSS2_RC_SUCCESS;
+}
+
+void
+xtpm_trace_ring_record(const struct xtpm_trace_event *event,
+                       void *user_data)
+{
+    struct xtpm_trace_ring *ring = user_data;
+
+    size_t length = event->length < UINT16_MAX ? event->length : UINT16_MAX;
+    size_t captured_length = length < ring->snap_length ? length : ring->snap_length;
+
+    struct xtpm_trace_record record = {.start_ns = event->start_ns,
+                                       .end_ns = event->end_ns,
+                                       .command_code = event->command_code,
+                                       .rc = event->rc,
+                                       .length = (uint16_t)length,
+                                       .captured_length = (uint16_t)captured_length,
+                                       .layer = event->layer,
+                                       .direction = event->direction};
+    size_t record_size = sizeof(struct xtpm_trace_record) + padded_length(captured_length);
+
+    lock_ring(ring);
+
+    // Make room by dropping the oldest records.
+    while (ring->capacity - (ring->head - ring->tail) < record_size) {
+        struct xtpm_trace_record oldest;
+        copy_out(ring, ring->tail, &oldest, sizeof(struct xtpm_trace_record));
+        ring->tail += sizeof(struct xtpm_trace_record) + padded_length(oldest.captured_length);
+        ring->overwritten++;
+    }
+
+    copy_in(ring, ring->head, &record, sizeof(struct xtpm_trace_record));
+    copy_in(ring, ring->head + sizeof(struct xtpm_trace_record), event->buffer, captured_length);
+    ring->head += record_size;
+
+    unlock_ring(ring);
+}
+
+int
+xtpm_trace_ring_pop(struct xtpm_trace_ring *ring,
+                    struct xtpm_trace_record *record_out,
+                    uint8_t *data,
+                    size_t data_size)
+{
+    lock_ring(ring);
+
+    if (ring->head == ring->tail) {
+        unlock_ring(ring);
+        return 0;
+    }
+
+    copy_out(ring, ring->tail, record_out, sizeof(struct xtpm_trace_record));
+
+    size_t copy_length = record_out->captured_length < data_size ? record_out->captured_length : data_size;
+    copy_out(ring, ring->tail + sizeof(struct xtpm_trace_record), data, copy_length);
+
+    ring->tail += sizeof(struct xtpm_trace_record) + padded_length(record_out->captured_length);
+
+    unlock_ring(ring);
+
+    return 1;
+}
+
+uint64_t
+xtpm_trace_ring_overwritten(struct xtpm_trace_ring *ring)
+{
+    lock_ring(ring);
+    uint64_t overwritten = ring->overwritten;
+    unlock_ring(ring);
+
+    return overwritten;
+}
@@ -0,0 +1,817 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_tcti_broker.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "internal/tcti_common.h"
+#include "internal/marshal.h"
+
+#include <pthread.h>
+
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#define MAX_CLIENT_OBJECTS 16
+#define MAX_SAVED_CONTEXT_SIZE 2048     // a marshaled TPMS_CONTEXT, of an ECC or RSA-2048 key
+
+#define HEADER_SIZE (sizeof(TPM2_ST) + sizeof(uint32_t) + sizeof(TPM2_CC))
+#define HANDLE_TYPE_TRANSIENT 0x80
+
+// Virtual handles are in a range a TPM doesn't use, so mix-ups are easy to spot.
+#define VIRTUAL_HANDLE_FIRST 0x80ff0000
+
+#define HANDLE_ERROR(rc, n) ((rc) + TPM_RC_H + ((n) << TPM_RC_N_SHIFT))
+#define PARAMETER_ERROR(rc, n) ((rc) + TPM_RC_P + ((n) << TPM_RC_N_SHIFT))
+
+/*
+ * A client's transient object, as it's seen by the TPM.
+ *
+ * An object the TPM has no room for is swapped out: `physical` is 0,
+ * and `context` holds what ContextSave returned for it.
+ */
+struct broker_object {
+    int in_use;
+    int is_sequence;        // a hash sequence, which changes as it's used
+    int pinned;             // used by the command being run, so can't be swapped out
+    TPM2_HANDLE physical;
+    uint64_t last_used;
+    size_t context_size;    // 0 if `context` is out of date
+    uint8_t context[MAX_SAVED_CONTEXT_SIZE];
+};
+
+typedef struct broker_client {
+    uint64_t magic;
+    uint32_t version;
+    TSS2_RC (*transmit)( TSS2_TCTI_CONTEXT *tctiContext, size_t size,
+            uint8_t *command);
+    TSS2_RC (*receive) (TSS2_TCTI_CONTEXT *tctiContext, size_t *size,
+            uint8_t *response, int32_t timeout);
+    TSS2_RC (*finalize) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*cancel) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*getPollHandles) (TSS2_TCTI_CONTEXT *tctiContext,
+            TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles);
+    TSS2_RC (*setLocality) (TSS2_TCTI_CONTEXT *tctiContext, uint8_t locality);
+    uint64_t response_start_ns;     // see TSS2_TCTI_CONTEXT_COMMON_XAPTUM
+    const struct xtpm_trace_hook *trace_hook;
+    TPM2_CC trace_command_code;     // of the last command sent, for tracing its response
+
+    TSS2_TCTI_BROKER_CONTEXT *broker;
+    struct broker_client *next;     // in the broker's list of clients
+    int in_flight;      // a command was transmitted, and its response not yet collected
+    int ran;            // ... and it has been run
+    size_t command_size;
+    uint8_t command[TPM2_MAX_COMMAND_SIZE];
+    size_t response_size;
+    uint8_t response[TPM2_MAX_RESPONSE_SIZE];
+    struct broker_object objects[MAX_CLIENT_OBJECTS];   // virtual handle VIRTUAL_HANDLE_FIRST + i
+} TSS2_TCTI_CONTEXT_OPAQUE_BROKER;
+
+struct TSS2_TCTI_BROKER_CONTEXT {
+    pthread_mutex_t lock;       // held while a command is run, and guards everything below
+    TSS2_TCTI_CONTEXT *inner_context;
+    struct broker_client *clients;
+    uint64_t clock;             // counts commands, to find the least-recently-used object
+    TSS2_TCTI_BROKER_STATS stats;
+    uint8_t command[TPM2_MAX_COMMAND_SIZE];     // for the broker's own ContextLoads
+    uint8_t response[TPM2_MAX_RESPONSE_SIZE];
+    uint8_t evict_response[TPM2_MAX_RESPONSE_SIZE];
+};
+
+struct command_info {
+    TPM2_CC code;
+    unsigned handle_count;
+    int returns_handle;
+};
+
+// Startup and Shutdown are left out: they'd flush every client's objects.
+static const struct command_info commands[] = {
+    // code                         handles returns handle
+    {TPM2_CC_EvictControl,          2,      0},
+    {TPM2_CC_NV_UndefineSpace,      2,      0},
+    {TPM2_CC_Clear,                 1,      0},
+    {TPM2_CC_ClearControl,          1,      0},
+    {TPM2_CC_HierarchyChangeAuth,   1,      0},
+    {TPM2_CC_NV_DefineSpace,        1,      0},
+    {TPM2_CC_CreatePrimary,         1,      1},
+    {TPM2_CC_NV_Write,              2,      0},
+    {TPM2_CC_SequenceComplete,      1,      0},
+    {TPM2_CC_IncrementalSelfTest,   0,      0},
+    {TPM2_CC_SelfTest,              0,      0},
+    {TPM2_CC_StirRandom,            0,      0},
+    {TPM2_CC_NV_Read,               2,      0},
+    {TPM2_CC_Create,                1,      0},
+    {TPM2_CC_Load,                  1,      1},
+    {TPM2_CC_SequenceUpdate,        1,      0},
+    {TPM2_CC_Sign,                  1,      0},
+    {TPM2_CC_ContextLoad,           0,      1},
+    {TPM2_CC_ContextSave,           1,      0},
+    {TPM2_CC_FlushContext,          0,      0},
+    {TPM2_CC_LoadExternal,          0,      1},
+    {TPM2_CC_NV_ReadPublic,         1,      0},
+    {TPM2_CC_ReadPublic,            1,      0},
+    {TPM2_CC_VerifySignature,       1,      0},
+    {TPM2_CC_ECC_Parameters,        0,      0},
+    {TPM2_CC_FirmwareRead,          0,      0},
+    {TPM2_CC_GetCapability,         0,      0},
+    {TPM2_CC_GetRandom,             0,      0},
+    {TPM2_CC_GetTestResult,         0,      0},
+    {TPM2_CC_Hash,                  0,      0},
+    {TPM2_CC_PCR_Read,              0,      0},
+    {TPM2_CC_ReadClock,             0,      0},
+    {TPM2_CC_PCR_Extend,            1,      0},
+    {TPM2_CC_HashSequenceStart,     0,      1},
+    {TPM2_CC_TestParms,             0,      0},
+    {TPM2_CC_Commit,                1,      0},
+    {TPM2_CC_EC_Ephemeral,          0,      0},
+    {TPM2_CC_CreateLoaded,          1,      1},
+};
+
+static
+TSS2_RC transmit_broker(TSS2_TCTI_CONTEXT *tcti_context,
+                        size_t size,
+                        uint8_t *command);
+
+static
+TSS2_RC receive_broker(TSS2_TCTI_CONTEXT *tcti_context,
+                       size_t *size,
+                       uint8_t *response,
+                       int32_t timeout);
+
+static
+TSS2_RC finalize_broker(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC cancel_broker(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC
+getPollHandles_broker(TSS2_TCTI_CONTEXT *tcti_context,
+                      TSS2_TCTI_POLL_HANDLE *handles,
+                      size_t *num_handles);
+
+static
+TSS2_RC
+setLocality_broker(TSS2_TCTI_CONTEXT *tcti_context,
+                   uint8_t locality);
+
+static
+TSS2_RC run_command(TSS2_TCTI_BROKER_CONTEXT *broker, struct broker_client *client);
+
+static
+TSS2_RC flush_physical(TSS2_TCTI_BROKER_CONTEXT *broker, TPM2_HANDLE handle, TSS2_RC *rc_out);
+
+TSS2_RC
+Tss2_Tcti_Broker_Init(TSS2_TCTI_BROKER_CONTEXT *broker_context,
+                      size_t *size,
+                      TSS2_TCTI_CONTEXT *inner_context)
+{
+    if (NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (NULL == broker_context) {
+        *size = sizeof(TSS2_TCTI_BROKER_CONTEXT);
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (NULL == inner_context)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    memset(broker_context, 0, sizeof(TSS2_TCTI_BROKER_CONTEXT));
+    broker_context->inner_context = inner_context;
+    broker_context->clients = NULL;
+
+    if (0 != pthread_mutex_init(&broker_context->lock, NULL))
+        return TSS2_TCTI_RC_GENERAL_FAILURE;
+
+    return TSS2_RC_SUCCESS;
+}
+
+void
+Tss2_Tcti_Broker_Finalize(TSS2_TCTI_BROKER_CONTEXT *broker_context)
+{
+    if (NULL == broker_context)
+        return;
+
+    pthread_mutex_destroy(&broker_context->lock);
+
+    Tss2_Tcti_Finalize(broker_context->inner_context);
+}
+
+void
+Tss2_Tcti_Broker_GetStats(TSS2_TCTI_BROKER_CONTEXT *broker_context,
+                          TSS2_TCTI_BROKER_STATS *stats_out)
+{
+    pthread_mutex_lock(&broker_context->lock);
+    *stats_out = broker_context->stats;
+    pthread_mutex_unlock(&broker_context->lock);
+}
+
+TSS2_RC
+Tss2_Tcti_Broker_Client_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                             size_t *size,
+                             TSS2_TCTI_BROKER_CONTEXT *broker_context)
+{
+    if (NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (NULL == tcti_context) {
+        *size = sizeof(TSS2_TCTI_CONTEXT_OPAQUE_BROKER);
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (NULL == broker_context)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    TSS2_TCTI_CONTEXT_OPAQUE_BROKER *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_BROKER*)tcti_context;
+
+    cast_context->magic = TCTI_MAGIC;
+    cast_context->version = TCTI_VERSION;
+    cast_context->transmit = transmit_broker;
+    cast_context->receive = receive_broker;
+    cast_context->finalize = finalize_broker;
+    cast_context->cancel = cancel_broker;
+    cast_context->getPollHandles = getPollHandles_broker;
+    cast_context->setLocality = setLocality_broker;
+    cast_context->response_start_ns = 0;
+    cast_context->trace_hook = NULL;
+    cast_context->trace_command_code = 0;
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_BROKER, response_start_ns) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, response_start_ns));
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_BROKER, trace_hook) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, trace_hook));
+
+    cast_context->broker = broker_context;
+    cast_context->in_flight = 0;
+    cast_context->ran = 0;
+    for (unsigned i = 0; i < MAX_CLIENT_OBJECTS; i++)
+        cast_context->objects[i].in_use = 0;
+
+    pthread_mutex_lock(&broker_context->lock);
+    cast_context->next = broker_context->clients;
+    broker_context->clients = cast_context;
+    pthread_mutex_unlock(&broker_context->lock);
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC transmit_broker(TSS2_TCTI_CONTEXT *tcti_context,
+                        size_t size,
+                        uint8_t *command)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_BROKER *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_BROKER*)tcti_context;
+
+    if (NULL == command)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (cast_context->in_flight)
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+
+    if (size > sizeof(cast_context->command))
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+
+    uint64_t start_ns = cast_context->trace_hook ? tcti_now_ns() : 0;
+
+    memcpy(cast_context->command, command, size);
+    cast_context->command_size = size;
+    cast_context->in_flight = 1;
+    cast_context->ran = 0;
+
+    if (cast_context->trace_hook) {
+        cast_context->trace_command_code = tcti_command_code(command, size);
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_COMMAND, cast_context->trace_command_code,
+                   command, size, start_ns, tcti_now_ns());
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC receive_broker(TSS2_TCTI_CONTEXT *tcti_context,
+                       size_t *size,
+                       uint8_t *response,
+                       int32_t timeout)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_BROKER *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_BROKER*)tcti_context;
+
+    if (NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (!cast_context->in_flight)
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+
+    if (TSS2_TCTI_TIMEOUT_BLOCK != timeout)
+        return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+
+    if (!cast_context->ran) {
+        TSS2_TCTI_BROKER_CONTEXT *broker = cast_context->broker;
+
+        pthread_mutex_lock(&broker->lock);
+        TSS2_RC ret = run_command(broker, cast_context);
+        pthread_mutex_unlock(&broker->lock);
+
+        if (TSS2_RC_SUCCESS != ret) {
+            cast_context->in_flight = 0;
+            return ret;
+        }
+        cast_context->ran = 1;
+    }
+
+    // Leave the response for a retry with a big enough buffer.
+    if (NULL == response) {
+        *size = cast_context->response_size;
+        return TSS2_RC_SUCCESS;
+    }
+    if (*size < cast_context->response_size)
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+
+    memcpy(response, cast_context->response, cast_context->response_size);
+    *size = cast_context->response_size;
+    cast_context->in_flight = 0;
+
+    if (cast_context->trace_hook)
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_RESPONSE, cast_context->trace_command_code,
+                   response, *size, cast_context->response_start_ns, tcti_now_ns());
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC finalize_broker(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_BROKER *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_BROKER*)tcti_context;
+    TSS2_TCTI_BROKER_CONTEXT *broker = cast_context->broker;
+
+    pthread_mutex_lock(&broker->lock);
+
+    // Flush whatever the client left loaded. Its swapped-out objects just go away.
+    for (unsigned i = 0; i < MAX_CLIENT_OBJECTS; i++) {
+        struct broker_object *object = &cast_context->objects[i];
+        if (object->in_use && 0 != object->physical) {
+            TSS2_RC rc;
+            flush_physical(broker, object->physical, &rc);
+        }
+        object->in_use = 0;
+    }
+
+    for (struct broker_client **link = &broker->clients; NULL != *link; link = &(*link)->next) {
+        if (*link == cast_context) {
+            *link = cast_context->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&broker->lock);
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC cancel_broker(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    (void)tcti_context;
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+TSS2_RC
+getPollHandles_broker(TSS2_TCTI_CONTEXT *tcti_context,
+                      TSS2_TCTI_POLL_HANDLE *handles,
+                      size_t *num_handles)
+{
+    (void)tcti_context;
+    (void)handles;
+    (void)num_handles;
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+TSS2_RC
+setLocality_broker(TSS2_TCTI_CONTEXT *tcti_context,
+                   uint8_t locality)
+{
+    (void)tcti_context;
+    (void)locality;
+
+    // The locality would apply to every client's commands.
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+/*
+ * Talking to the TPM.
+ *
+ * These return TCTI errors. The TPM's response code is left in the response.
+ */
+
+static
+TSS2_RC
+response_code(const uint8_t *response)
+{
+    return ((TSS2_RC)response[6] << 24) | ((TSS2_RC)response[7] << 16) |
+           ((TSS2_RC)response[8] << 8) | (TSS2_RC)response[9];
+}
+
+static
+TPM2_HANDLE
+read_handle(const uint8_t *buffer)
+{
+    return ((TPM2_HANDLE)buffer[0] << 24) | ((TPM2_HANDLE)buffer[1] << 16) |
+           ((TPM2_HANDLE)buffer[2] << 8) | (TPM2_HANDLE)buffer[3];
+}
+
+static
+void
+write_header(uint8_t *buffer, uint32_t size, uint32_t code)
+{
+    marshal_uint16(TPM2_ST_NO_SESSIONS, &buffer);
+    marshal_uint32(size, &buffer);
+    marshal_uint32(code, &buffer);
+}
+
+static
+TSS2_RC
+execute(TSS2_TCTI_BROKER_CONTEXT *broker,
+        uint8_t *command,
+        size_t command_size,
+        uint8_t *response,
+        size_t *response_size)
+{
+    TSS2_RC ret = Tss2_Tcti_Transmit(broker->inner_context, command_size, command);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    *response_size = TPM2_MAX_RESPONSE_SIZE;
+    ret = Tss2_Tcti_Receive(broker->inner_context, response_size, response, TSS2_TCTI_TIMEOUT_BLOCK);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    if (*response_size < HEADER_SIZE)
+        return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+flush_physical(TSS2_TCTI_BROKER_CONTEXT *broker,
+               TPM2_HANDLE handle,
+               TSS2_RC *rc_out)
+{
+    uint8_t command[HEADER_SIZE + sizeof(TPM2_HANDLE)];
+    write_header(command, sizeof(command), TPM2_CC_FlushContext);
+    uint8_t *ptr = command + HEADER_SIZE;
+    marshal_uint32(handle, &ptr);
+
+    size_t response_size;
+    TSS2_RC ret = execute(broker, command, sizeof(command), broker->evict_response, &response_size);
+    if (TSS2_RC_SUCCESS == ret)
+        *rc_out = response_code(broker->evict_response);
+
+    return ret;
+}
+
+// Swap out the least-recently-used loaded object that isn't pinned.
+// Sets `*rc_out` to TPM_RC_OBJECT_MEMORY if there is none.
+static
+TSS2_RC
+evict_one(TSS2_TCTI_BROKER_CONTEXT *broker,
+          TSS2_RC *rc_out)
+{
+    struct broker_object *victim = NULL;
+    for (struct broker_client *client = broker->clients; NULL != client; client = client->next) {
+        for (unsigned i = 0; i < MAX_CLIENT_OBJECTS; i++) {
+            struct broker_object *object = &client->objects[i];
+            if (object->in_use && 0 != object->physical && !object->pinned &&
+                    (NULL == victim || object->last_used < victim->last_used))
+                victim = object;
+        }
+    }
+
+    if (NULL == victim) {
+        *rc_out = TPM_RC_OBJECT_MEMORY;
+        return TSS2_RC_SUCCESS;
+    }
+
+    // Objects don't change once loaded, so a context saved earlier can be loaded again.
+    if (0 == victim->context_size) {
+        uint8_t command[HEADER_SIZE + sizeof(TPM2_HANDLE)];
+        write_header(command, sizeof(command), TPM2_CC_ContextSave);
+        uint8_t *ptr = command + HEADER_SIZE;
+        marshal_uint32(victim->physical, &ptr);
+
+        size_t response_size;
+        TSS2_RC ret = execute(broker, command, sizeof(command), broker->evict_response, &response_size);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        *rc_out = response_code(broker->evict_response);
+        if (TSS2_RC_SUCCESS != *rc_out)
+            return TSS2_RC_SUCCESS;
+
+        if (response_size - HEADER_SIZE > sizeof(victim->context))
+            return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+
+        victim->context_size = response_size - HEADER_SIZE;
+        memcpy(victim->context, broker->evict_response + HEADER_SIZE, victim->context_size);
+    }
+
+    TSS2_RC ret = flush_physical(broker, victim->physical, rc_out);
+    if (TSS2_RC_SUCCESS != ret || TSS2_RC_SUCCESS != *rc_out)
+        return ret;
+
+    victim->physical = 0;
+    broker->stats.evictions++;
+
+    return TSS2_RC_SUCCESS;
+}
+
+// Run a command, swapping out other objects for as long as the TPM is out of object memory.
+static
+TSS2_RC
+execute_evicting(TSS2_TCTI_BROKER_CONTEXT *broker,
+                 uint8_t *command,
+                 size_t command_size,
+                 uint8_t *response,
+                 size_t *response_size)
+{
+    for (;;) {
+        TSS2_RC ret = execute(broker, command, command_size, response, response_size);
+        if (TSS2_RC_SUCCESS != ret || TPM_RC_OBJECT_MEMORY != response_code(response))
+            return ret;
+
+        TSS2_RC evict_rc;
+        ret = evict_one(broker, &evict_rc);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+
+        // Nothing left to swap out: the client gets the TPM's TPM_RC_OBJECT_MEMORY.
+        if (TSS2_RC_SUCCESS != evict_rc)
+            return TSS2_RC_SUCCESS;
+    }
+}
+
+static
+TSS2_RC
+reload(TSS2_TCTI_BROKER_CONTEXT *broker,
+       struct broker_object *object,
+       TSS2_RC *rc_out)
+{
+    size_t command_size = HEADER_SIZE + object->context_size;
+    write_header(broker->command, command_size, TPM2_CC_ContextLoad);
+    memcpy(broker->command + HEADER_SIZE, object->context, object->context_size);
+
+    size_t response_size;
+    TSS2_RC ret = execute_evicting(broker, broker->command, command_size, broker->response, &response_size);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    *rc_out = response_code(broker->response);
+    if (TSS2_RC_SUCCESS != *rc_out)
+        return TSS2_RC_SUCCESS;
+
+    if (response_size < HEADER_SIZE + sizeof(TPM2_HANDLE))
+        return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+
+    object->physical = read_handle(broker->response + HEADER_SIZE);
+    broker->stats.reloads++;
+
+    return TSS2_RC_SUCCESS;
+}
+
+/*
+ * Running clients' commands.
+ */
+
+static
+const struct command_info*
+find_command(TPM2_CC code)
+{
+    for (unsigned i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (commands[i].code == code)
+            return &commands[i];
+    }
+
+    return NULL;
+}
+
+static
+int
+is_transient(TPM2_HANDLE handle)
+{
+    return HANDLE_TYPE_TRANSIENT == (handle >> 24);
+}
+
+static
+struct broker_object*
+find_object(struct broker_client *client,
+            TPM2_HANDLE virtual_handle)
+{
+    if (virtual_handle < VIRTUAL_HANDLE_FIRST || virtual_handle >= VIRTUAL_HANDLE_FIRST + MAX_CLIENT_OBJECTS)
+        return NULL;
+
+    struct broker_object *object = &client->objects[virtual_handle - VIRTUAL_HANDLE_FIRST];
+    return object->in_use ? object : NULL;
+}
+
+// A response made up by the broker, rather than the TPM
+static
+void
+set_response(struct broker_client *client,
+             TSS2_RC rc)
+{
+    write_header(client->response, HEADER_SIZE, rc);
+    client->response_size = HEADER_SIZE;
+}
+
+static
+TSS2_RC
+run_flush_context(TSS2_TCTI_BROKER_CONTEXT *broker,
+                  struct broker_client *client)
+{
+    if (client->command_size < HEADER_SIZE + sizeof(TPM2_HANDLE)) {
+        set_response(client, TPM_RC_COMMAND_SIZE);
+        return TSS2_RC_SUCCESS;
+    }
+
+    // Anything but an object (i.e. a session) is passed through.
+    TPM2_HANDLE flush_handle = read_handle(client->command + HEADER_SIZE);
+    if (!is_transient(flush_handle))
+        return execute(broker, client->command, client->command_size, client->response, &client->response_size);
+
+    struct broker_object *object = find_object(client, flush_handle);
+    if (NULL == object) {
+        set_response(client, PARAMETER_ERROR(TPM_RC_HANDLE, 1));
+        return TSS2_RC_SUCCESS;
+    }
+
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+    if (0 != object->physical) {
+        TSS2_RC ret = flush_physical(broker, object->physical, &rc);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+    }
+
+    object->in_use = 0;
+    set_response(client, rc);
+
+    return TSS2_RC_SUCCESS;
+}
+
+// Give the object the TPM just loaded for `client` a virtual handle.
+static
+TSS2_RC
+add_object(TSS2_TCTI_BROKER_CONTEXT *broker,
+           struct broker_client *client,
+           TPM2_CC command_code)
+{
+    if (client->response_size < HEADER_SIZE + sizeof(TPM2_HANDLE))
+        return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+
+    uint8_t *handle_ptr = client->response + HEADER_SIZE;
+    TPM2_HANDLE physical = read_handle(handle_ptr);
+
+    struct broker_object *object = NULL;
+    unsigned i;
+    for (i = 0; i < MAX_CLIENT_OBJECTS; i++) {
+        if (!client->objects[i].in_use) {
+            object = &client->objects[i];
+            break;
+        }
+    }
+
+    if (NULL == object) {
+        TSS2_RC rc;
+        TSS2_RC ret = flush_physical(broker, physical, &rc);
+        set_response(client, TPM_RC_OBJECT_MEMORY);
+        return ret;
+    }
+
+    object->in_use = 1;
+    object->is_sequence = (TPM2_CC_HashSequenceStart == command_code);
+    object->pinned = 0;
+    object->physical = physical;
+    object->last_used = broker->clock;
+    object->context_size = 0;
+
+    marshal_uint32(VIRTUAL_HANDLE_FIRST + i, &handle_ptr);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+run_with_objects(TSS2_TCTI_BROKER_CONTEXT *broker,
+                 struct broker_client *client,
+                 const struct command_info *info,
+                 struct broker_object **objects)
+{
+    uint8_t *handle_ptr = client->command + HEADER_SIZE;
+
+    // Swap in the objects the command uses, and give the TPM their real handles.
+    for (unsigned i = 0; i < info->handle_count; i++, handle_ptr += sizeof(TPM2_HANDLE)) {
+        struct broker_object *object = objects[i];
+        if (NULL == object)
+            continue;
+
+        if (0 == object->physical) {
+            TSS2_RC rc;
+            TSS2_RC ret = reload(broker, object, &rc);
+            if (TSS2_RC_SUCCESS != ret)
+                return ret;
+            if (TSS2_RC_SUCCESS != rc) {
+                set_response(client, rc);
+                return TSS2_RC_SUCCESS;
+            }
+        }
+
+        uint8_t *ptr = handle_ptr;
+        marshal_uint32(object->physical, &ptr);
+        object->last_used = broker->clock;
+
+        // A hash sequence will have changed, so must be saved again.
+        if (object->is_sequence)
+            object->context_size = 0;
+    }
+
+    TSS2_RC ret = execute_evicting(broker, client->command, client->command_size,
+                                   client->response, &client->response_size);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    TSS2_TCTI_CONTEXT_COMMON_XAPTUM *inner = (TSS2_TCTI_CONTEXT_COMMON_XAPTUM*)broker->inner_context;
+    client->response_start_ns = (TCTI_MAGIC == inner->v1.magic) ? inner->response_start_ns : tcti_now_ns();
+
+    if (TSS2_RC_SUCCESS != response_code(client->response))
+        return TSS2_RC_SUCCESS;
+
+    // A completed sequence is flushed by the TPM.
+    if (TPM2_CC_SequenceComplete == info->code && NULL != objects[0])
+        objects[0]->in_use = 0;
+
+    if (info->returns_handle)
+        return add_object(broker, client, info->code);
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+run_command(TSS2_TCTI_BROKER_CONTEXT *broker,
+            struct broker_client *client)
+{
+    broker->stats.commands++;
+    broker->clock++;
+
+    TPM2_CC command_code = tcti_command_code(client->command, client->command_size);
+    const struct command_info *info = find_command(command_code);
+    if (NULL == info) {
+        set_response(client, TPM_RC_COMMAND_CODE);
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (client->command_size < HEADER_SIZE + info->handle_count * sizeof(TPM2_HANDLE)) {
+        set_response(client, TPM_RC_COMMAND_SIZE);
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (TPM2_CC_FlushContext == command_code)
+        return run_flush_context(broker, client);
+
+    // Look up, and pin, the client's objects the command uses.
+    TSS2_RC ret = TSS2_RC_SUCCESS;
+    struct broker_object *objects[2] = {NULL, NULL};
+    const uint8_t *handle_ptr = client->command + HEADER_SIZE;
+    for (unsigned i = 0; i < info->handle_count; i++, handle_ptr += sizeof(TPM2_HANDLE)) {
+        TPM2_HANDLE handle = read_handle(handle_ptr);
+        if (!is_transient(handle))
+            continue;
+
+        objects[i] = find_object(client, handle);
+        if (NULL == objects[i]) {
+            set_response(client, HANDLE_ERROR(TPM_RC_HANDLE, i + 1));
+            goto finish;
+        }
+        objects[i]->pinned = 1;
+    }
+
+    ret = run_with_objects(broker, client, info, objects);
+
+finish:
+    for (unsigned i = 0; i < 2; i++) {
+        if (NULL != objects[i])
+            objects[i]->pinned = 0;
+    }
+
+    return ret;
+}
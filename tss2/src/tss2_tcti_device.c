@@ -25,8 +25,10 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
@@ -51,6 +53,9 @@ typedef struct {
     TSS2_RC (*getPollHandles) (TSS2_TCTI_CONTEXT *tctiContext,
             TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles);
     TSS2_RC (*setLocality) (TSS2_TCTI_CONTEXT *tctiContext, uint8_t locality);
+    uint64_t response_start_ns;     // see TSS2_TCTI_CONTEXT_COMMON_XAPTUM
+    const struct xtpm_trace_hook *trace_hook;
+    TPM2_CC trace_command_code;     // of the last command sent, for tracing its response
 
     char dev_file_path[MAX_DEV_FILE_PATH_LENGTH];
     int file_fd;
@@ -122,6 +127,13 @@ Tss2_Tcti_Device_Init(TSS2_TCTI_CONTEXT *tcti_context,
     cast_context->cancel = cancel_device;
     cast_context->getPollHandles = getPollHandles_device;
     cast_context->setLocality = setLocality_device;
+    cast_context->response_start_ns = 0;
+    cast_context->trace_hook = NULL;
+    cast_context->trace_command_code = 0;
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_DEVICE, response_start_ns) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, response_start_ns));
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_DEVICE, trace_hook) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, trace_hook));
 
     cast_context->file_fd = -1;
 
@@ -167,6 +179,9 @@ TSS2_RC transmit_device(TSS2_TCTI_CONTEXT *tcti_context,
     TSS2_TCTI_CONTEXT_OPAQUE_DEVICE *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_DEVICE*)tcti_context;
     TSS2_RC send_ret = TSS2_RC_SUCCESS;
 
+    const struct xtpm_trace_hook *trace_hook = cast_context->trace_hook;
+    uint64_t start_ns = trace_hook ? tcti_now_ns() : 0;
+
     // Send the command.
     send_ret = send_all(cast_context->file_fd,
                         command,
@@ -174,14 +189,12 @@ TSS2_RC transmit_device(TSS2_TCTI_CONTEXT *tcti_context,
     if (send_ret != TSS2_RC_SUCCESS) {
         return send_ret;
     }
-#ifdef TCTI_VERBOSE_LOGGING
-    printf("tcti_device::transmit - size=%zu, command={", size);
-    for (size_t i=0; i < size; i++) {
-        printf("%#X", command[i]);
-        if (i != (size-1)) printf(", ");
+
+    if (trace_hook) {
+        cast_context->trace_command_code = tcti_command_code(command, size);
+        tcti_trace(trace_hook, XTPM_TRACE_COMMAND, cast_context->trace_command_code,
+                   command, size, start_ns, tcti_now_ns());
     }
-    printf("}\n");
-#endif
 
     return send_ret;
 }
@@ -204,6 +217,13 @@ TSS2_RC receive_device(TSS2_TCTI_CONTEXT *tcti_context,
         return TSS2_BASE_RC_BAD_REFERENCE;
     }
 
+    // Wait for the response to be ready, so the read below only times the transfer.
+    // (If the driver doesn't support polling, this returns immediately).
+    struct pollfd poll_fd = {.fd = cast_context->file_fd, .events = POLLIN};
+    while (-1 == poll(&poll_fd, 1, -1) && EINTR == errno)
+        ;
+    cast_context->response_start_ns = tcti_now_ns();
+
     ssize_t read_ret = read(cast_context->file_fd, response, *size);
     if (-1 == read_ret) {
 #ifdef TCTI_VERBOSE_LOGGING
@@ -233,14 +253,9 @@ TSS2_RC receive_device(TSS2_TCTI_CONTEXT *tcti_context,
 
     *size = (size_t)read_ret;
 
-#ifdef TCTI_VERBOSE_LOGGING
-    printf("tcti_device:receive - size=%zu, response={", *size);
-    for (size_t i=0; i < *size; i++) {
-        printf("%#X", response[i]);
-        if (i != (*size-1)) printf(", ");
-    }
-    printf("}\n");
-#endif
+    if (cast_context->trace_hook)
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_RESPONSE, cast_context->trace_command_code,
+                   response, *size, cast_context->response_start_ns, tcti_now_ns());
 
     return TSS2_RC_SUCCESS;
 
@@ -0,0 +1,441 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_tcti_device_pool.h>
+#include <tss2/tss2_tcti_device.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "internal/tcti_common.h"
+
+#include <pthread.h>
+
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#define MAX_DEV_FILE_PATH_LENGTH 64     // as in the device TCTI
+
+static const char* DEFAULT_DEV_FILE_PATH = "/dev/tpmrm0";
+
+struct pool_slot {
+    struct pool_slot *next_free;
+    TSS2_TCTI_CONTEXT *device;      // a device TCTI context, valid if `open`
+    int open;
+};
+
+struct TSS2_TCTI_DEVICE_POOL {
+    pthread_mutex_t lock;
+    pthread_cond_t returned;
+    char dev_file_path[MAX_DEV_FILE_PATH_LENGTH];
+    size_t max_fds;
+    struct pool_slot *free_slots;   // open, and not leased
+    TSS2_TCTI_DEVICE_POOL_STATS stats;
+    struct pool_slot slots[TSS2_TCTI_DEVICE_POOL_MAX_FDS];
+    uint64_t device_contexts[];     // `max_fds` device TCTI contexts, one per slot
+};
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    TSS2_RC (*transmit)( TSS2_TCTI_CONTEXT *tctiContext, size_t size,
+            uint8_t *command);
+    TSS2_RC (*receive) (TSS2_TCTI_CONTEXT *tctiContext, size_t *size,
+            uint8_t *response, int32_t timeout);
+    TSS2_RC (*finalize) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*cancel) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*getPollHandles) (TSS2_TCTI_CONTEXT *tctiContext,
+            TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles);
+    TSS2_RC (*setLocality) (TSS2_TCTI_CONTEXT *tctiContext, uint8_t locality);
+    uint64_t response_start_ns;     // see TSS2_TCTI_CONTEXT_COMMON_XAPTUM
+    const struct xtpm_trace_hook *trace_hook;
+    TPM2_CC trace_command_code;     // of the last command sent, for tracing its response
+
+    TSS2_TCTI_DEVICE_POOL *pool;
+    enum tss2_tcti_device_pool_lease lease;
+    struct pool_slot *slot;     // leased, or NULL
+    int in_flight;              // command sent, and its response not yet read
+} TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL;
+
+static
+TSS2_RC transmit_device_pool(TSS2_TCTI_CONTEXT *tcti_context,
+                             size_t size,
+                             uint8_t *command);
+
+static
+TSS2_RC receive_device_pool(TSS2_TCTI_CONTEXT *tcti_context,
+                            size_t *size,
+                            uint8_t *response,
+                            int32_t timeout);
+
+static
+TSS2_RC finalize_device_pool(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC cancel_device_pool(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC
+getPollHandles_device_pool(TSS2_TCTI_CONTEXT *tcti_context,
+                           TSS2_TCTI_POLL_HANDLE *handles,
+                           size_t *num_handles);
+
+static
+TSS2_RC
+setLocality_device_pool(TSS2_TCTI_CONTEXT *tcti_context,
+                        uint8_t locality);
+
+static
+TSS2_RC lease_slot(TSS2_TCTI_DEVICE_POOL *pool, struct pool_slot **slot_out);
+
+static
+void return_slot(TSS2_TCTI_DEVICE_POOL *pool, struct pool_slot *slot, int close_fd);
+
+static
+size_t device_context_size(void)
+{
+    size_t size = 0;
+    Tss2_Tcti_Device_Init(NULL, &size, NULL);
+
+    // Keep each context 8-byte aligned.
+    return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+TSS2_RC
+Tss2_Tcti_Device_Pool_Init(TSS2_TCTI_DEVICE_POOL *pool,
+                           size_t *size,
+                           const char *dev_file_path,
+                           size_t max_fds)
+{
+    if (NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (0 == max_fds || max_fds > TSS2_TCTI_DEVICE_POOL_MAX_FDS)
+        return TSS2_TCTI_RC_BAD_VALUE;
+
+    size_t device_size = device_context_size();
+
+    if (NULL == pool) {
+        *size = sizeof(TSS2_TCTI_DEVICE_POOL) + max_fds * device_size;
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (NULL == dev_file_path)
+        dev_file_path = DEFAULT_DEV_FILE_PATH;
+    if (strlen(dev_file_path) >= MAX_DEV_FILE_PATH_LENGTH)
+        return TSS2_TCTI_RC_BAD_VALUE;
+
+    memset(pool, 0, sizeof(TSS2_TCTI_DEVICE_POOL));
+    strcpy(pool->dev_file_path, dev_file_path);
+    pool->max_fds = max_fds;
+    pool->free_slots = NULL;
+
+    for (size_t i = 0; i < max_fds; i++) {
+        pool->slots[i].device = (TSS2_TCTI_CONTEXT*)((uint8_t*)pool->device_contexts + i * device_size);
+        pool->slots[i].open = 0;
+    }
+
+    if (0 != pthread_mutex_init(&pool->lock, NULL))
+        return TSS2_TCTI_RC_GENERAL_FAILURE;
+
+    if (0 != pthread_cond_init(&pool->returned, NULL)) {
+        pthread_mutex_destroy(&pool->lock);
+        return TSS2_TCTI_RC_GENERAL_FAILURE;
+    }
+
+    // Open the first fd now, to report a bad path early.
+    struct pool_slot *slot = NULL;
+    TSS2_RC ret = lease_slot(pool, &slot);
+    if (TSS2_RC_SUCCESS != ret) {
+        pthread_cond_destroy(&pool->returned);
+        pthread_mutex_destroy(&pool->lock);
+        return ret;
+    }
+    return_slot(pool, slot, 0);
+    pool->stats.leases = 0;
+
+    return TSS2_RC_SUCCESS;
+}
+
+void
+Tss2_Tcti_Device_Pool_Finalize(TSS2_TCTI_DEVICE_POOL *pool)
+{
+    if (NULL == pool)
+        return;
+
+    for (size_t i = 0; i < pool->max_fds; i++) {
+        if (pool->slots[i].open) {
+            Tss2_Tcti_Finalize(pool->slots[i].device);
+            pool->slots[i].open = 0;
+        }
+    }
+
+    pthread_cond_destroy(&pool->returned);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+void
+Tss2_Tcti_Device_Pool_GetStats(TSS2_TCTI_DEVICE_POOL *pool,
+                               TSS2_TCTI_DEVICE_POOL_STATS *stats_out)
+{
+    pthread_mutex_lock(&pool->lock);
+    *stats_out = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+TSS2_RC
+Tss2_Tcti_Device_Pool_Client_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                                  size_t *size,
+                                  TSS2_TCTI_DEVICE_POOL *pool,
+                                  enum tss2_tcti_device_pool_lease lease)
+{
+    if (NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (NULL == tcti_context) {
+        *size = sizeof(TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL);
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (NULL == pool)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (TSS2_TCTI_DEVICE_POOL_LEASE_PER_COMMAND != lease &&
+            TSS2_TCTI_DEVICE_POOL_LEASE_PER_CLIENT != lease)
+        return TSS2_TCTI_RC_BAD_VALUE;
+
+    TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL*)tcti_context;
+
+    cast_context->magic = TCTI_MAGIC;
+    cast_context->version = TCTI_VERSION;
+    cast_context->transmit = transmit_device_pool;
+    cast_context->receive = receive_device_pool;
+    cast_context->finalize = finalize_device_pool;
+    cast_context->cancel = cancel_device_pool;
+    cast_context->getPollHandles = getPollHandles_device_pool;
+    cast_context->setLocality = setLocality_device_pool;
+    cast_context->response_start_ns = 0;
+    cast_context->trace_hook = NULL;
+    cast_context->trace_command_code = 0;
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL, response_start_ns) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, response_start_ns));
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL, trace_hook) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, trace_hook));
+
+    cast_context->pool = pool;
+    cast_context->lease = lease;
+    cast_context->slot = NULL;
+    cast_context->in_flight = 0;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC transmit_device_pool(TSS2_TCTI_CONTEXT *tcti_context,
+                             size_t size,
+                             uint8_t *command)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL*)tcti_context;
+
+    if (cast_context->in_flight)
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+
+    uint64_t start_ns = cast_context->trace_hook ? tcti_now_ns() : 0;
+
+    if (NULL == cast_context->slot) {
+        TSS2_RC ret = lease_slot(cast_context->pool, &cast_context->slot);
+        if (TSS2_RC_SUCCESS != ret)
+            return ret;
+    }
+
+    TSS2_RC ret = Tss2_Tcti_Transmit(cast_context->slot->device, size, command);
+    if (TSS2_RC_SUCCESS != ret) {
+        // The fd may hold part of the command.
+        return_slot(cast_context->pool, cast_context->slot, 1);
+        cast_context->slot = NULL;
+        return ret;
+    }
+
+    cast_context->in_flight = 1;
+
+    if (cast_context->trace_hook) {
+        cast_context->trace_command_code = tcti_command_code(command, size);
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_COMMAND, cast_context->trace_command_code,
+                   command, size, start_ns, tcti_now_ns());
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC receive_device_pool(TSS2_TCTI_CONTEXT *tcti_context,
+                            size_t *size,
+                            uint8_t *response,
+                            int32_t timeout)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL*)tcti_context;
+
+    if (!cast_context->in_flight)
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+
+    // Checked here, so that the response is still there to be read on a retry.
+    if (TSS2_TCTI_TIMEOUT_BLOCK != timeout)
+        return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+    if (NULL == response || NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    TSS2_TCTI_CONTEXT *device = cast_context->slot->device;
+
+    TSS2_RC ret = Tss2_Tcti_Receive(device, size, response, timeout);
+    cast_context->in_flight = 0;
+    cast_context->response_start_ns = ((TSS2_TCTI_CONTEXT_COMMON_XAPTUM*)device)->response_start_ns;
+
+    // Either way, the response has been consumed. But after a read error, the fd can't be trusted.
+    int failed = (TSS2_RC_SUCCESS != ret && TSS2_TCTI_RC_INSUFFICIENT_BUFFER != ret);
+    if (failed || TSS2_TCTI_DEVICE_POOL_LEASE_PER_COMMAND == cast_context->lease) {
+        return_slot(cast_context->pool, cast_context->slot, failed);
+        cast_context->slot = NULL;
+    }
+
+    if (TSS2_RC_SUCCESS == ret && cast_context->trace_hook)
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_RESPONSE, cast_context->trace_command_code,
+                   response, *size, cast_context->response_start_ns, tcti_now_ns());
+
+    return ret;
+}
+
+TSS2_RC finalize_device_pool(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_DEVICE_POOL*)tcti_context;
+
+    // Close the fd if a response is still pending on it, or if it holds this client's objects.
+    if (NULL != cast_context->slot) {
+        int close_fd = (cast_context->in_flight ||
+                        TSS2_TCTI_DEVICE_POOL_LEASE_PER_CLIENT == cast_context->lease);
+        return_slot(cast_context->pool, cast_context->slot, close_fd);
+        cast_context->slot = NULL;
+        cast_context->in_flight = 0;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC cancel_device_pool(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    (void)tcti_context;
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+TSS2_RC
+getPollHandles_device_pool(TSS2_TCTI_CONTEXT *tcti_context,
+                           TSS2_TCTI_POLL_HANDLE *handles,
+                           size_t *num_handles)
+{
+    (void)tcti_context;
+    (void)handles;
+    (void)num_handles;
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+TSS2_RC
+setLocality_device_pool(TSS2_TCTI_CONTEXT *tcti_context,
+                        uint8_t locality)
+{
+    (void)tcti_context;
+    (void)locality;
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+/*
+ * Take a free fd, or else open a new one if fewer than `max_fds` are open,
+ * or else wait for one to be returned.
+ *
+ * Opening happens under the lock, but only up to `max_fds` times over the life of the pool
+ * (plus once per fd closed after an error).
+ */
+TSS2_RC lease_slot(TSS2_TCTI_DEVICE_POOL *pool, struct pool_slot **slot_out)
+{
+    TSS2_RC ret = TSS2_RC_SUCCESS;
+    struct pool_slot *slot = NULL;
+    int waited = 0;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (NULL == slot) {
+        if (NULL != pool->free_slots) {
+            slot = pool->free_slots;
+            pool->free_slots = slot->next_free;
+            break;
+        }
+
+        for (size_t i = 0; i < pool->max_fds; i++) {
+            if (pool->slots[i].open)
+                continue;
+
+            size_t device_size = 0;
+            ret = Tss2_Tcti_Device_Init(pool->slots[i].device, &device_size, pool->dev_file_path);
+            if (TSS2_RC_SUCCESS == ret) {
+                pool->slots[i].open = 1;
+                pool->stats.open_fds++;
+                slot = &pool->slots[i];
+            }
+            break;
+        }
+        if (NULL != slot)
+            break;
+
+        // If we can't open any fd, there's nothing to wait for.
+        if (0 == pool->stats.open_fds)
+            goto finish;
+
+        waited = 1;
+        pthread_cond_wait(&pool->returned, &pool->lock);
+    }
+
+    ret = TSS2_RC_SUCCESS;
+    pool->stats.leased_fds++;
+    pool->stats.leases++;
+    if (waited)
+        pool->stats.waits++;
+    *slot_out = slot;
+
+finish:
+    pthread_mutex_unlock(&pool->lock);
+
+    return ret;
+}
+
+void return_slot(TSS2_TCTI_DEVICE_POOL *pool, struct pool_slot *slot, int close_fd)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    pool->stats.leased_fds--;
+
+    if (close_fd) {
+        Tss2_Tcti_Finalize(slot->device);
+        slot->open = 0;
+        pool->stats.open_fds--;
+    } else {
+        slot->next_free = pool->free_slots;
+        pool->free_slots = slot;
+    }
+
+    pthread_cond_signal(&pool->returned);
+
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,2283 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_tcti_loopback.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "internal/tcti_common.h"
+#include "internal/marshal.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#define MAX_TRANSIENT_OBJECTS 3
+#define MAX_PERSISTENT_OBJECTS 8
+#define MAX_NV_INDICES 8
+#define COMMIT_WINDOW 128   // outstanding commits, as in the reference TPM's commitArray
+#define MAX_NV_INDEX_SIZE 4096
+#define PCR_COUNT 24
+#define SECRET_SIZE 32
+#define INTEGRITY_SIZE 16
+
+#define TRANSIENT_FIRST 0x80000000
+#define PERSISTENT_OWNER_FIRST 0x81000000
+#define PERSISTENT_PLATFORM_FIRST 0x81800000
+#define PERSISTENT_LAST 0x81FFFFFF
+#define NV_INDEX_FIRST 0x01000000
+#define NV_INDEX_LAST 0x01FFFFFF
+
+// Command codes with a latency setting
+#define CC_FIRST 0x11F
+#define CC_LAST 0x193
+
+#define COMMAND_HEADER_SIZE (sizeof(TPM2_ST) + sizeof(uint32_t) + sizeof(TPM2_CC))
+
+#define HANDLE_ERROR(rc, n) ((rc) + TPM_RC_H + ((n) << TPM_RC_N_SHIFT))
+#define PARAMETER_ERROR(rc, n) ((rc) + TPM_RC_P + ((n) << TPM_RC_N_SHIFT))
+#define SESSION_ERROR(rc, n) ((rc) + TPM_RC_S + ((n) << TPM_RC_N_SHIFT))
+
+// Labels, so placeholders derived from the same input differ
+enum derive_label {
+    LABEL_PRIMARY = 1,
+    LABEL_CREATE,
+    LABEL_PUBLIC_X,
+    LABEL_PUBLIC_Y,
+    LABEL_INTEGRITY,
+    LABEL_NAME,
+    LABEL_CREATION,
+    LABEL_SIGNATURE_R,
+    LABEL_SIGNATURE_S,
+    LABEL_COMMIT,
+    LABEL_CONTEXT,
+    LABEL_RANDOM,
+    LABEL_PCR,
+    LABEL_SEQUENCE,
+    LABEL_TICKET,
+};
+
+struct loopback_object {
+    TPM2_HANDLE handle;     // 0 if the slot is free
+    TPMI_RH_HIERARCHY hierarchy;
+    TPM2B_PUBLIC public_area;
+    TPM2B_AUTH auth;
+    uint8_t secret[SECRET_SIZE];    // stands in for the private key
+    int sequence;                   // a hash sequence, rather than a key
+    uint64_t sequence_state;        // of derive_update, over the data so far
+    uint64_t sequence_length;
+    uint32_t sequence_prefix;       // the data's first 4 bytes, big-endian
+};
+
+struct loopback_nv_index {
+    TPM2B_NV_PUBLIC public_info;    // nvIndex is 0 if the slot is free
+    TPM2B_AUTH auth;
+    uint8_t data[MAX_NV_INDEX_SIZE];
+};
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    TSS2_RC (*transmit)( TSS2_TCTI_CONTEXT *tctiContext, size_t size,
+            uint8_t *command);
+    TSS2_RC (*receive) (TSS2_TCTI_CONTEXT *tctiContext, size_t *size,
+            uint8_t *response, int32_t timeout);
+    TSS2_RC (*finalize) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*cancel) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*getPollHandles) (TSS2_TCTI_CONTEXT *tctiContext,
+            TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles);
+    TSS2_RC (*setLocality) (TSS2_TCTI_CONTEXT *tctiContext, uint8_t locality);
+    uint64_t response_start_ns;     // see TSS2_TCTI_CONTEXT_COMMON_XAPTUM
+    const struct xtpm_trace_hook *trace_hook;
+    TPM2_CC trace_command_code;     // of the last command sent, for tracing its response
+
+    uint32_t latency_us[CC_LAST - CC_FIRST + 1];
+    int pending;
+    uint64_t response_due_ns;
+    size_t response_size;
+    uint8_t response[TPM2_MAX_RESPONSE_SIZE];
+
+    // TPM state
+    TPM2B_AUTH owner_auth;
+    TPM2B_AUTH endorsement_auth;
+    TPM2B_AUTH platform_auth;
+    TPM2B_AUTH lockout_auth;
+    uint64_t seed_generation;   // changed by Clear, so primary keys change too
+    uint64_t key_count;         // of keys from Create, so each is different
+    uint16_t commit_count;
+    uint8_t commit_array[COMMIT_WINDOW / 8];    // which commits are still unused
+    uint64_t context_count;     // sequence number of saved contexts
+    uint64_t sign_count;        // stands in for ECDSA's random nonce
+    uint64_t random_count;      // of GetRandom calls, so each answer is different
+    uint32_t pcr_update_count;
+    uint8_t pcrs[PCR_COUNT][TPM2_SHA256_DIGEST_SIZE];   // a SHA-256 bank only
+    struct loopback_object transient[MAX_TRANSIENT_OBJECTS];
+    struct loopback_object persistent[MAX_PERSISTENT_OBJECTS];
+    struct loopback_nv_index nv[MAX_NV_INDICES];
+} TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK;
+
+// A parsed command
+struct command {
+    TPM2_CC code;
+    int sessions;               // tag was TPM2_ST_SESSIONS
+    TPM2_HANDLE handles[2];
+    unsigned auth_count;
+    TPMS_AUTH_COMMAND auth;     // the first authorization
+    uint8_t *params;
+    uint32_t params_length;
+};
+
+typedef TSS2_RC (*command_fn)(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+                              struct command *cmd,
+                              TPM2_HANDLE *handle_out,
+                              uint8_t **out);
+
+struct command_info {
+    TPM2_CC code;
+    unsigned handle_count;
+    int returns_handle;
+    int authorized;             // handles[0] must be authorized
+    command_fn fn;
+};
+
+static
+TSS2_RC transmit_loopback(TSS2_TCTI_CONTEXT *tcti_context,
+                          size_t size,
+                          uint8_t *command);
+
+static
+TSS2_RC receive_loopback(TSS2_TCTI_CONTEXT *tcti_context,
+                         size_t *size,
+                         uint8_t *response,
+                         int32_t timeout);
+
+static
+TSS2_RC finalize_loopback(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC cancel_loopback(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC
+getPollHandles_loopback(TSS2_TCTI_CONTEXT *tcti_context,
+                        TSS2_TCTI_POLL_HANDLE *handles,
+                        size_t *num_handles);
+
+static
+TSS2_RC
+setLocality_loopback(TSS2_TCTI_CONTEXT *tcti_context,
+                     uint8_t locality);
+
+TSS2_RC
+Tss2_Tcti_Loopback_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                        size_t *size,
+                        const char *conf)
+{
+    if (NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (NULL == tcti_context) {
+        *size = sizeof(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK);
+        return TSS2_RC_SUCCESS;
+    }
+
+    uint32_t latency_us = 0;
+    if (NULL != conf) {
+        const char *prefix = "latency_us=";
+        if (0 != strncmp(conf, prefix, strlen(prefix)))
+            return TSS2_TCTI_RC_BAD_VALUE;
+
+        const char *value = conf + strlen(prefix);
+        char *end = NULL;
+        unsigned long parsed = strtoul(value, &end, 10);
+        if (end == value || 0 != *end || parsed > UINT32_MAX)
+            return TSS2_TCTI_RC_BAD_VALUE;
+        latency_us = (uint32_t)parsed;
+    }
+
+    TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK*)tcti_context;
+
+    memset(cast_context, 0, sizeof(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK));
+
+    cast_context->magic = TCTI_MAGIC;
+    cast_context->version = TCTI_VERSION;
+    cast_context->transmit = transmit_loopback;
+    cast_context->receive = receive_loopback;
+    cast_context->finalize = finalize_loopback;
+    cast_context->cancel = cancel_loopback;
+    cast_context->getPollHandles = getPollHandles_loopback;
+    cast_context->setLocality = setLocality_loopback;
+    cast_context->response_start_ns = 0;
+    cast_context->trace_hook = NULL;
+    cast_context->trace_command_code = 0;
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK, response_start_ns) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, response_start_ns));
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK, trace_hook) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, trace_hook));
+
+    return Tss2_Tcti_Loopback_SetLatency(tcti_context, 0, latency_us);
+}
+
+TSS2_RC
+Tss2_Tcti_Loopback_SetLatency(TSS2_TCTI_CONTEXT *tcti_context,
+                              TPM2_CC command_code,
+                              uint32_t latency_us)
+{
+    if (NULL == tcti_context)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK*)tcti_context;
+
+    if (TCTI_MAGIC != cast_context->magic || transmit_loopback != cast_context->transmit)
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+
+    if (0 == command_code) {
+        for (unsigned i = 0; i < sizeof(cast_context->latency_us) / sizeof(cast_context->latency_us[0]); i++)
+            cast_context->latency_us[i] = latency_us;
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (command_code < CC_FIRST || command_code > CC_LAST)
+        return TSS2_TCTI_RC_BAD_VALUE;
+
+    cast_context->latency_us[command_code - CC_FIRST] = latency_us;
+
+    return TSS2_RC_SUCCESS;
+}
+
+/*
+ * Placeholder "crypto".
+ */
+
+// NOT cryptographic: only spreads its input over the output,
+// so placeholders derived from different inputs differ.
+// FNV-1a over the input, then splitmix64 to expand it;
+// derive_start/update/finish take the input in pieces, as hash sequences need.
+static
+uint64_t
+derive_start(enum derive_label label)
+{
+    return 0xcbf29ce484222325ull ^ (uint64_t)label;
+}
+
+static
+uint64_t
+derive_update(uint64_t state,
+              const uint8_t *in,
+              size_t in_length)
+{
+    for (size_t i = 0; i < in_length; i++) {
+        state ^= in[i];
+        state *= 0x100000001b3ull;
+    }
+
+    return state;
+}
+
+static
+void
+derive_finish(uint64_t state,
+              uint8_t *out,
+              size_t out_length)
+{
+    for (size_t i = 0; i < out_length; i++) {
+        state += 0x9e3779b97f4a7c15ull;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        out[i] = (uint8_t)(z ^ (z >> 31));
+    }
+}
+
+static
+void
+derive(uint8_t *out,
+       size_t out_length,
+       enum derive_label label,
+       const uint8_t *in,
+       size_t in_length)
+{
+    derive_finish(derive_update(derive_start(label), in, in_length), out, out_length);
+}
+
+static
+void
+set_public_point(struct loopback_object *object)
+{
+    TPMS_ECC_POINT *point = &object->public_area.publicArea.unique.ecc;
+
+    point->x.size = TPM2_MAX_ECC_KEY_BYTES;
+    derive(point->x.buffer, point->x.size, LABEL_PUBLIC_X, object->secret, sizeof(object->secret));
+
+    point->y.size = TPM2_MAX_ECC_KEY_BYTES;
+    derive(point->y.buffer, point->y.size, LABEL_PUBLIC_Y, object->secret, sizeof(object->secret));
+}
+
+static
+void
+object_name(const TPM2B_PUBLIC *public_area,
+            TPM2B_NAME *name_out)
+{
+    uint8_t marshaled[sizeof(TPM2B_PUBLIC)];
+    uint8_t *ptr = marshaled;
+    marshal_tpm2b_public(public_area, &ptr);
+
+    uint8_t *name_ptr = name_out->name;
+    marshal_uint16(public_area->publicArea.nameAlg, &name_ptr);
+    derive(name_ptr, TPM2_SHA256_DIGEST_SIZE, LABEL_NAME, marshaled, ptr - marshaled);
+    name_out->size = sizeof(uint16_t) + TPM2_SHA256_DIGEST_SIZE;
+}
+
+static
+void
+nv_name(const TPM2B_NV_PUBLIC *public_info,
+        TPM2B_NAME *name_out)
+{
+    uint8_t marshaled[sizeof(TPM2B_NV_PUBLIC)];
+    uint8_t *ptr = marshaled;
+    marshal_tpm2b_nvpublic(public_info, &ptr);
+
+    uint8_t *name_ptr = name_out->name;
+    marshal_uint16(public_info->nvPublic.nameAlg, &name_ptr);
+    derive(name_ptr, TPM2_SHA256_DIGEST_SIZE, LABEL_NAME, marshaled, ptr - marshaled);
+    name_out->size = sizeof(uint16_t) + TPM2_SHA256_DIGEST_SIZE;
+}
+
+// Integrity value of a private blob, binding it to its parent and public area
+static
+void
+integrity(const struct loopback_object *parent,
+          const uint8_t *secret,
+          const TPM2B_AUTH *auth,
+          const TPM2B_PUBLIC *public_area,
+          uint8_t *out)
+{
+    uint8_t in[SECRET_SIZE + SECRET_SIZE + sizeof(TPM2B_AUTH) + sizeof(TPM2B_PUBLIC)];
+    uint8_t *ptr = in;
+
+    memcpy(ptr, parent->secret, SECRET_SIZE);
+    ptr += SECRET_SIZE;
+    memcpy(ptr, secret, SECRET_SIZE);
+    ptr += SECRET_SIZE;
+    marshal_tpm2b_auth(auth, &ptr);
+    marshal_tpm2b_public(public_area, &ptr);
+
+    derive(out, INTEGRITY_SIZE, LABEL_INTEGRITY, in, ptr - in);
+}
+
+/*
+ * (Un)marshaling helpers.
+ */
+
+static
+int
+read_tpm2b(uint8_t **in,
+           uint32_t *remaining,
+           uint16_t *size_out,
+           uint8_t *buffer,
+           size_t buffer_size)
+{
+    if (0 != unmarshal_uint16(in, remaining, size_out))
+        return -1;
+
+    if (*size_out > buffer_size || *size_out > *remaining)
+        return -1;
+
+    memcpy(buffer, *in, *size_out);
+    *in += *size_out;
+    *remaining -= *size_out;
+
+    return 0;
+}
+
+static
+int
+skip_bytes(uint8_t **in,
+           uint32_t *remaining,
+           uint32_t length)
+{
+    if (*remaining < length)
+        return -1;
+
+    *in += length;
+    *remaining -= length;
+
+    return 0;
+}
+
+static
+int
+skip_pcr_selection(uint8_t **in,
+                   uint32_t *remaining)
+{
+    uint32_t count;
+    if (0 != unmarshal_uint32(in, remaining, &count))
+        return -1;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (0 != skip_bytes(in, remaining, sizeof(TPMI_ALG_HASH)) || 0 == *remaining)
+            return -1;
+
+        uint8_t size_of_select = **in;
+        if (0 != skip_bytes(in, remaining, 1 + size_of_select))
+            return -1;
+    }
+
+    return 0;
+}
+
+static
+void
+write_tpm2b(const uint8_t *buffer,
+            uint16_t size,
+            uint8_t **out)
+{
+    marshal_uint16(size, out);
+    memcpy(*out, buffer, size);
+    *out += size;
+}
+
+static
+void
+write_ecc_point(const uint8_t *secret,
+                uint16_t count,
+                uint8_t tag,
+                uint8_t **out)
+{
+    uint8_t in[SECRET_SIZE + sizeof(count) + sizeof(tag)];
+    memcpy(in, secret, SECRET_SIZE);
+    memcpy(in + SECRET_SIZE, &count, sizeof(count));
+    in[sizeof(in) - 1] = tag;
+
+    TPM2B_ECC_POINT point = {.size = 0};
+    point.point.x.size = TPM2_MAX_ECC_KEY_BYTES;
+    derive(point.point.x.buffer, point.point.x.size, LABEL_COMMIT, in, sizeof(in));
+    in[sizeof(in) - 1] ^= 0xFF;
+    point.point.y.size = TPM2_MAX_ECC_KEY_BYTES;
+    derive(point.point.y.buffer, point.point.y.size, LABEL_COMMIT, in, sizeof(in));
+
+    marshal_tpm2b_eccpoint(&point, out);
+}
+
+// creationData, creationHash and creationTicket, for CreatePrimary and Create
+static
+void
+write_creation(TPMI_RH_HIERARCHY hierarchy,
+               const TPM2B_NAME *parent_name,
+               const TPM2B_DATA *outside_info,
+               uint8_t **out)
+{
+    uint8_t *creation_data = *out;
+    uint8_t *size_ptr = *out;
+    *out += sizeof(uint16_t);
+
+    marshal_uint32(0, out);                     // pcrSelect
+    marshal_uint16(0, out);                     // pcrDigest
+    **out = TPMA_LOCALITY_TPM2_LOC_ZERO;
+    *out += 1;
+    if (parent_name->size == sizeof(TPM2_HANDLE))
+        marshal_uint16(TPM2_ALG_NULL, out);     // parent is a hierarchy
+    else
+        marshal_uint16(TPM2_ALG_SHA256, out);
+    write_tpm2b(parent_name->name, parent_name->size, out);
+    write_tpm2b(parent_name->name, parent_name->size, out);
+    write_tpm2b(outside_info->buffer, outside_info->size, out);
+
+    uint16_t size = *out - size_ptr - sizeof(uint16_t);
+    marshal_uint16(size, &size_ptr);
+
+    uint8_t creation_hash[TPM2_SHA256_DIGEST_SIZE];
+    derive(creation_hash, sizeof(creation_hash), LABEL_CREATION, creation_data, *out - creation_data);
+    write_tpm2b(creation_hash, sizeof(creation_hash), out);
+
+    marshal_uint16(TPM2_ST_CREATION, out);
+    marshal_uint32(hierarchy, out);
+    uint8_t ticket[TPM2_SHA256_DIGEST_SIZE];
+    derive(ticket, sizeof(ticket), LABEL_CREATION, creation_hash, sizeof(creation_hash));
+    write_tpm2b(ticket, sizeof(ticket), out);
+}
+
+// The digest of a hashcheck ticket for `digest`, which (like a real TPM's) doesn't survive Clear
+static
+void
+hashcheck_ticket(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+                 TPMI_RH_HIERARCHY hierarchy,
+                 const uint8_t *digest,
+                 uint8_t *out)
+{
+    uint8_t in[sizeof(TPM2_HANDLE) + sizeof(uint64_t) + TPM2_SHA256_DIGEST_SIZE];
+    uint8_t *ptr = in;
+    marshal_uint32(hierarchy, &ptr);
+    marshal_uint32((uint32_t)(ctx->seed_generation >> 32), &ptr);
+    marshal_uint32((uint32_t)ctx->seed_generation, &ptr);
+    memcpy(ptr, digest, TPM2_SHA256_DIGEST_SIZE);
+    ptr += TPM2_SHA256_DIGEST_SIZE;
+
+    derive(out, TPM2_SHA256_DIGEST_SIZE, LABEL_TICKET, in, ptr - in);
+}
+
+static
+void
+write_name(const TPM2B_NAME *name,
+           uint8_t **out)
+{
+    write_tpm2b(name->name, name->size, out);
+}
+
+/*
+ * TPM state.
+ */
+
+static
+TPM2B_AUTH*
+hierarchy_auth(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+               TPM2_HANDLE handle)
+{
+    switch (handle) {
+        case TPM2_RH_OWNER:
+            return &ctx->owner_auth;
+        case TPM2_RH_ENDORSEMENT:
+            return &ctx->endorsement_auth;
+        case TPM2_RH_PLATFORM:
+            return &ctx->platform_auth;
+        case TPM2_RH_LOCKOUT:
+            return &ctx->lockout_auth;
+        default:
+            return NULL;
+    }
+}
+
+static
+struct loopback_object*
+find_object(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+            TPM2_HANDLE handle)
+{
+    if (handle >= TRANSIENT_FIRST && handle < TRANSIENT_FIRST + MAX_TRANSIENT_OBJECTS) {
+        struct loopback_object *object = &ctx->transient[handle - TRANSIENT_FIRST];
+        return object->handle == handle ? object : NULL;
+    }
+
+    if (handle >= PERSISTENT_OWNER_FIRST && handle <= PERSISTENT_LAST) {
+        for (unsigned i = 0; i < MAX_PERSISTENT_OBJECTS; i++) {
+            if (ctx->persistent[i].handle == handle)
+                return &ctx->persistent[i];
+        }
+    }
+
+    return NULL;
+}
+
+static
+struct loopback_object*
+new_transient_object(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx)
+{
+    for (unsigned i = 0; i < MAX_TRANSIENT_OBJECTS; i++) {
+        if (0 == ctx->transient[i].handle) {
+            memset(&ctx->transient[i], 0, sizeof(struct loopback_object));
+            ctx->transient[i].handle = TRANSIENT_FIRST + i;
+            return &ctx->transient[i];
+        }
+    }
+
+    return NULL;
+}
+
+static
+struct loopback_nv_index*
+find_nv_index(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+              TPM2_HANDLE handle)
+{
+    if (handle < NV_INDEX_FIRST || handle > NV_INDEX_LAST)
+        return NULL;
+
+    for (unsigned i = 0; i < MAX_NV_INDICES; i++) {
+        if (ctx->nv[i].public_info.nvPublic.nvIndex == handle)
+            return &ctx->nv[i];
+    }
+
+    return NULL;
+}
+
+// The auth value of the entity at `handle`, or NULL if there is none
+static
+const TPM2B_AUTH*
+entity_auth(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+            TPM2_HANDLE handle)
+{
+    static const TPM2B_AUTH empty_auth = {.size = 0};
+
+    if (TPM2_RH_NULL == handle || handle < PCR_COUNT)
+        return &empty_auth;
+
+    const TPM2B_AUTH *auth = hierarchy_auth(ctx, handle);
+    if (NULL != auth)
+        return auth;
+
+    struct loopback_object *object = find_object(ctx, handle);
+    if (NULL != object)
+        return &object->auth;
+
+    struct loopback_nv_index *nv = find_nv_index(ctx, handle);
+    if (NULL != nv)
+        return &nv->auth;
+
+    return NULL;
+}
+
+static
+TSS2_RC
+check_nv_access(const struct loopback_nv_index *nv,
+                TPM2_HANDLE auth_handle,
+                int write)
+{
+    TPMA_NV attributes = nv->public_info.nvPublic.attributes;
+    TPMA_NV required;
+
+    if (auth_handle == nv->public_info.nvPublic.nvIndex)
+        required = write ? TPMA_NV_AUTHWRITE : TPMA_NV_AUTHREAD;
+    else if (TPM2_RH_OWNER == auth_handle)
+        required = write ? TPMA_NV_OWNERWRITE : TPMA_NV_OWNERREAD;
+    else if (TPM2_RH_PLATFORM == auth_handle)
+        required = write ? TPMA_NV_PPWRITE : TPMA_NV_PPREAD;
+    else
+        return TPM_RC_NV_AUTHORIZATION;
+
+    return (attributes & required) ? TSS2_RC_SUCCESS : TPM_RC_NV_AUTHORIZATION;
+}
+
+/*
+ * Commands.
+ */
+
+static
+int
+parse_sensitive_create(uint8_t **in,
+                       uint32_t *remaining,
+                       TPM2B_AUTH *auth_out)
+{
+    uint16_t size;
+    if (0 != unmarshal_uint16(in, remaining, &size) || size > *remaining)
+        return -1;
+
+    TPM2B_SENSITIVE_DATA data;
+    if (0 != read_tpm2b(in, remaining, &auth_out->size, auth_out->buffer, TPM2_SHA256_DIGEST_SIZE) ||
+            0 != read_tpm2b(in, remaining, &data.size, data.buffer, sizeof(data.buffer)))
+        return -1;
+
+    return 0;
+}
+
+static
+TSS2_RC
+parse_create_params(struct command *cmd,
+                    TPM2B_AUTH *auth_out,
+                    TPM2B_PUBLIC *public_out,
+                    TPM2B_DATA *outside_info_out)
+{
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    if (0 != parse_sensitive_create(&ptr, &remaining, auth_out))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    int ret = unmarshal_tpm2b_public(&ptr, &remaining, public_out);
+    if (-2 == ret)
+        return PARAMETER_ERROR(TPM_RC_TYPE, 2);
+    if (0 != ret)
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 2);
+
+    if (0 != read_tpm2b(&ptr, &remaining, &outside_info_out->size, outside_info_out->buffer, sizeof(outside_info_out->buffer)))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 3);
+
+    if (0 != skip_pcr_selection(&ptr, &remaining))
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 4);
+
+    TPMS_ECC_PARMS *parms = &public_out->publicArea.parameters.eccDetail;
+    if (TPM2_ECC_NIST_P256 != parms->curveID && TPM2_ECC_BN_P256 != parms->curveID)
+        return PARAMETER_ERROR(TPM_RC_KEY, 2);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+create_primary(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+               struct command *cmd,
+               TPM2_HANDLE *handle_out,
+               uint8_t **out)
+{
+    TPMI_RH_HIERARCHY hierarchy = cmd->handles[0];
+    if (TPM2_RH_OWNER != hierarchy && TPM2_RH_ENDORSEMENT != hierarchy &&
+            TPM2_RH_PLATFORM != hierarchy && TPM2_RH_NULL != hierarchy)
+        return HANDLE_ERROR(TPM_RC_HIERARCHY, 1);
+
+    TPM2B_AUTH auth;
+    TPM2B_PUBLIC public_area;
+    TPM2B_DATA outside_info;
+    TSS2_RC ret = parse_create_params(cmd, &auth, &public_area, &outside_info);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    struct loopback_object *object = new_transient_object(ctx);
+    if (NULL == object)
+        return TPM_RC_OBJECT_MEMORY;
+
+    object->hierarchy = hierarchy;
+    object->public_area = public_area;
+    object->auth = auth;
+
+    // Primary keys are determined by their hierarchy's seed and their template.
+    uint8_t in[sizeof(TPM2_HANDLE) + sizeof(uint64_t) + sizeof(TPM2B_PUBLIC)];
+    uint8_t *ptr = in;
+    marshal_uint32(hierarchy, &ptr);
+    marshal_uint32((uint32_t)(ctx->seed_generation >> 32), &ptr);
+    marshal_uint32((uint32_t)ctx->seed_generation, &ptr);
+    marshal_tpm2b_public(&public_area, &ptr);
+    derive(object->secret, sizeof(object->secret), LABEL_PRIMARY, in, ptr - in);
+
+    set_public_point(object);
+
+    *handle_out = object->handle;
+
+    TPM2B_NAME parent_name = {.size = 0};
+    uint8_t *name_ptr = parent_name.name;
+    marshal_uint32(hierarchy, &name_ptr);
+    parent_name.size = sizeof(TPM2_HANDLE);
+
+    TPM2B_NAME name;
+    object_name(&object->public_area, &name);
+
+    marshal_tpm2b_public(&object->public_area, out);
+    write_creation(hierarchy, &parent_name, &outside_info, out);
+    write_name(&name, out);
+
+    return TSS2_RC_SUCCESS;
+}
+
+// Make `object` a new key under `parent`, and its private blob
+static
+void
+create_child(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+             const struct loopback_object *parent,
+             const TPM2B_AUTH *auth,
+             struct loopback_object *object,
+             TPM2B_PRIVATE *private_out)
+{
+    uint8_t in[SECRET_SIZE + sizeof(uint64_t)];
+    memcpy(in, parent->secret, SECRET_SIZE);
+    memcpy(in + SECRET_SIZE, &ctx->key_count, sizeof(uint64_t));
+    ctx->key_count++;
+    derive(object->secret, sizeof(object->secret), LABEL_CREATE, in, sizeof(in));
+
+    set_public_point(object);
+
+    // The private blob is the secret and auth in the clear, plus an integrity value.
+    uint8_t *private_ptr = private_out->buffer;
+    memcpy(private_ptr, object->secret, SECRET_SIZE);
+    private_ptr += SECRET_SIZE;
+    marshal_tpm2b_auth(auth, &private_ptr);
+    integrity(parent, object->secret, auth, &object->public_area, private_ptr);
+    private_ptr += INTEGRITY_SIZE;
+    private_out->size = private_ptr - private_out->buffer;
+}
+
+static
+TSS2_RC
+create(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+       struct command *cmd,
+       TPM2_HANDLE *handle_out,
+       uint8_t **out)
+{
+    (void)handle_out;
+
+    struct loopback_object *parent = find_object(ctx, cmd->handles[0]);
+    if (NULL == parent)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    TPMA_OBJECT parent_attributes = parent->public_area.publicArea.objectAttributes;
+    if (!(parent_attributes & TPMA_OBJECT_RESTRICTED) || !(parent_attributes & TPMA_OBJECT_DECRYPT))
+        return HANDLE_ERROR(TPM_RC_TYPE, 1);
+
+    TPM2B_AUTH auth;
+    TPM2B_PUBLIC public_area;
+    TPM2B_DATA outside_info;
+    TSS2_RC ret = parse_create_params(cmd, &auth, &public_area, &outside_info);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    struct loopback_object object = {.handle = 0};
+    object.public_area = public_area;
+
+    TPM2B_PRIVATE private_blob;
+    create_child(ctx, parent, &auth, &object, &private_blob);
+
+    TPM2B_NAME parent_name;
+    object_name(&parent->public_area, &parent_name);
+
+    marshal_tpm2b_private(&private_blob, out);
+    marshal_tpm2b_public(&object.public_area, out);
+    write_creation(parent->hierarchy, &parent_name, &outside_info, out);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+load(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+     struct command *cmd,
+     TPM2_HANDLE *handle_out,
+     uint8_t **out)
+{
+    struct loopback_object *parent = find_object(ctx, cmd->handles[0]);
+    if (NULL == parent)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    TPM2B_PRIVATE private_blob;
+    if (0 != read_tpm2b(&ptr, &remaining, &private_blob.size, private_blob.buffer, sizeof(private_blob.buffer)))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    TPM2B_PUBLIC public_area;
+    int unmarshal_ret = unmarshal_tpm2b_public(&ptr, &remaining, &public_area);
+    if (-2 == unmarshal_ret)
+        return PARAMETER_ERROR(TPM_RC_TYPE, 2);
+    if (0 != unmarshal_ret)
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 2);
+
+    // Unpack, and check, the private blob made by `create`
+    uint8_t *private_ptr = private_blob.buffer;
+    uint32_t private_remaining = private_blob.size;
+    uint8_t secret[SECRET_SIZE];
+    TPM2B_AUTH auth;
+    if (private_remaining < SECRET_SIZE)
+        return PARAMETER_ERROR(TPM_RC_INTEGRITY, 1);
+    memcpy(secret, private_ptr, SECRET_SIZE);
+    private_ptr += SECRET_SIZE;
+    private_remaining -= SECRET_SIZE;
+    if (0 != read_tpm2b(&private_ptr, &private_remaining, &auth.size, auth.buffer, TPM2_SHA256_DIGEST_SIZE) ||
+            INTEGRITY_SIZE != private_remaining)
+        return PARAMETER_ERROR(TPM_RC_INTEGRITY, 1);
+
+    uint8_t expected_integrity[INTEGRITY_SIZE];
+    integrity(parent, secret, &auth, &public_area, expected_integrity);
+    if (0 != memcmp(expected_integrity, private_ptr, INTEGRITY_SIZE))
+        return PARAMETER_ERROR(TPM_RC_INTEGRITY, 1);
+
+    struct loopback_object *object = new_transient_object(ctx);
+    if (NULL == object)
+        return TPM_RC_OBJECT_MEMORY;
+
+    object->hierarchy = parent->hierarchy;
+    object->public_area = public_area;
+    object->auth = auth;
+    memcpy(object->secret, secret, SECRET_SIZE);
+
+    *handle_out = object->handle;
+
+    TPM2B_NAME name;
+    object_name(&object->public_area, &name);
+    write_name(&name, out);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+sign(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+     struct command *cmd,
+     TPM2_HANDLE *handle_out,
+     uint8_t **out)
+{
+    (void)handle_out;
+
+    struct loopback_object *key = find_object(ctx, cmd->handles[0]);
+    if (NULL == key)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    if (!(key->public_area.publicArea.objectAttributes & TPMA_OBJECT_SIGN_ENCRYPT))
+        return HANDLE_ERROR(TPM_RC_KEY, 1);
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    TPM2B_DIGEST digest;
+    if (0 != read_tpm2b(&ptr, &remaining, &digest.size, digest.buffer, sizeof(digest.buffer)))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    TPMI_ALG_SIG_SCHEME scheme;
+    TPMI_ALG_HASH hash_alg = TPM2_ALG_NULL;
+    uint16_t commit_counter = 0;
+    if (0 != unmarshal_uint16(&ptr, &remaining, &scheme))
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 2);
+    if (TPM2_ALG_ECDSA == scheme || TPM2_ALG_ECDAA == scheme) {
+        if (0 != unmarshal_uint16(&ptr, &remaining, &hash_alg))
+            return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 2);
+        if (TPM2_ALG_ECDAA == scheme && 0 != unmarshal_uint16(&ptr, &remaining, &commit_counter))
+            return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 2);
+    } else if (TPM2_ALG_NULL != scheme) {
+        return PARAMETER_ERROR(TPM_RC_SCHEME, 2);
+    }
+
+    // validation ticket: tag, hierarchy, digest
+    TPM2_ST ticket_tag;
+    TPMI_RH_HIERARCHY ticket_hierarchy;
+    TPM2B_DIGEST ticket_digest;
+    if (0 != unmarshal_uint16(&ptr, &remaining, &ticket_tag) ||
+            0 != unmarshal_uint32(&ptr, &remaining, &ticket_hierarchy) ||
+            0 != read_tpm2b(&ptr, &remaining, &ticket_digest.size, ticket_digest.buffer, sizeof(ticket_digest.buffer)))
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 3);
+
+    // A restricted key only signs digests the TPM computed itself, as its ticket shows.
+    if (key->public_area.publicArea.objectAttributes & TPMA_OBJECT_RESTRICTED) {
+        uint8_t expected[TPM2_SHA256_DIGEST_SIZE];
+        if (TPM2_ST_HASHCHECK != ticket_tag || TPM2_RH_NULL == ticket_hierarchy ||
+                TPM2_SHA256_DIGEST_SIZE != digest.size || sizeof(expected) != ticket_digest.size)
+            return PARAMETER_ERROR(TPM_RC_TICKET, 3);
+        hashcheck_ticket(ctx, ticket_hierarchy, digest.buffer, expected);
+        if (0 != memcmp(expected, ticket_digest.buffer, sizeof(expected)))
+            return PARAMETER_ERROR(TPM_RC_TICKET, 3);
+    }
+
+    // The key's own scheme, if any, must be used.
+    const TPMT_ECC_SCHEME *key_scheme = &key->public_area.publicArea.parameters.eccDetail.scheme;
+    if (TPM2_ALG_NULL != key_scheme->scheme) {
+        if (TPM2_ALG_NULL != scheme && key_scheme->scheme != scheme)
+            return PARAMETER_ERROR(TPM_RC_SCHEME, 2);
+        if (TPM2_ALG_NULL == scheme && TPM2_ALG_ECDAA == key_scheme->scheme)
+            commit_counter = key_scheme->details.ecdaa.count;
+        scheme = key_scheme->scheme;
+        hash_alg = key_scheme->details.ecdsa.hashAlg;
+    }
+    if (TPM2_ALG_NULL == scheme)
+        return PARAMETER_ERROR(TPM_RC_SCHEME, 2);
+
+    // An ECDAA signature uses up a commit, which must be recent and unused.
+    if (TPM2_ALG_ECDAA == scheme) {
+        uint16_t age = ctx->commit_count - commit_counter;
+        unsigned bit = commit_counter % COMMIT_WINDOW;
+        if (0 == age || age > COMMIT_WINDOW || !(ctx->commit_array[bit / 8] & (1 << (bit % 8))))
+            return TPM_RC_VALUE;
+        ctx->commit_array[bit / 8] &= ~(1 << (bit % 8));
+    }
+
+    uint8_t in[SECRET_SIZE + sizeof(uint64_t) + sizeof(digest.buffer)];
+    uint8_t *in_ptr = in;
+    memcpy(in_ptr, key->secret, SECRET_SIZE);
+    in_ptr += SECRET_SIZE;
+    memcpy(in_ptr, &ctx->sign_count, sizeof(uint64_t));
+    in_ptr += sizeof(uint64_t);
+    ctx->sign_count++;
+    memcpy(in_ptr, digest.buffer, digest.size);
+    in_ptr += digest.size;
+
+    uint8_t r[TPM2_MAX_ECC_KEY_BYTES];
+    uint8_t s[TPM2_MAX_ECC_KEY_BYTES];
+    derive(r, sizeof(r), LABEL_SIGNATURE_R, in, in_ptr - in);
+    derive(s, sizeof(s), LABEL_SIGNATURE_S, in, in_ptr - in);
+
+    marshal_uint16(scheme, out);
+    marshal_uint16(hash_alg, out);
+    write_tpm2b(r, sizeof(r), out);
+    write_tpm2b(s, sizeof(s), out);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+commit(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+       struct command *cmd,
+       TPM2_HANDLE *handle_out,
+       uint8_t **out)
+{
+    (void)handle_out;
+
+    struct loopback_object *key = find_object(ctx, cmd->handles[0]);
+    if (NULL == key)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    if (!(key->public_area.publicArea.objectAttributes & TPMA_OBJECT_SIGN_ENCRYPT) ||
+            TPM2_ALG_ECDAA != key->public_area.publicArea.parameters.eccDetail.scheme.scheme)
+        return HANDLE_ERROR(TPM_RC_SCHEME, 1);
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    TPM2B_ECC_POINT p1;
+    if (0 != unmarshal_uint16(&ptr, &remaining, &p1.size) ||
+            0 != skip_bytes(&ptr, &remaining, p1.size))
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 1);
+
+    TPM2B_SENSITIVE_DATA s2;
+    if (0 != read_tpm2b(&ptr, &remaining, &s2.size, s2.buffer, sizeof(s2.buffer)))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 2);
+
+    TPM2B_ECC_PARAMETER y2;
+    if (0 != read_tpm2b(&ptr, &remaining, &y2.size, y2.buffer, sizeof(y2.buffer)))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 3);
+
+    uint16_t counter = ctx->commit_count++;
+    ctx->commit_array[(counter % COMMIT_WINDOW) / 8] |= 1 << (counter % 8);
+
+    write_ecc_point(key->secret, counter, 'K', out);
+    write_ecc_point(key->secret, counter, 'L', out);
+    write_ecc_point(key->secret, counter, 'E', out);
+    marshal_uint16(counter, out);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+read_public(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+            struct command *cmd,
+            TPM2_HANDLE *handle_out,
+            uint8_t **out)
+{
+    (void)handle_out;
+
+    struct loopback_object *object = find_object(ctx, cmd->handles[0]);
+    if (NULL == object)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    TPM2B_NAME name;
+    object_name(&object->public_area, &name);
+
+    marshal_tpm2b_public(&object->public_area, out);
+    write_name(&name, out);
+    write_name(&name, out);     // qualifiedName
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+evict_control(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+              struct command *cmd,
+              TPM2_HANDLE *handle_out,
+              uint8_t **out)
+{
+    (void)handle_out;
+    (void)out;
+
+    TPMI_RH_PROVISION auth = cmd->handles[0];
+    if (TPM2_RH_OWNER != auth && TPM2_RH_PLATFORM != auth)
+        return HANDLE_ERROR(TPM_RC_HIERARCHY, 1);
+
+    struct loopback_object *object = find_object(ctx, cmd->handles[1]);
+    if (NULL == object)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 2);
+    if (object->sequence)
+        return HANDLE_ERROR(TPM_RC_TYPE, 2);
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    TPMI_DH_PERSISTENT persistent_handle;
+    if (0 != unmarshal_uint32(&ptr, &remaining, &persistent_handle))
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 1);
+
+    // The owner controls the lower half of the persistent range, the platform the upper half.
+    TPM2_HANDLE range_first = TPM2_RH_OWNER == auth ? PERSISTENT_OWNER_FIRST : PERSISTENT_PLATFORM_FIRST;
+    TPM2_HANDLE range_last = TPM2_RH_OWNER == auth ? PERSISTENT_PLATFORM_FIRST - 1 : PERSISTENT_LAST;
+    if (persistent_handle < range_first || persistent_handle > range_last)
+        return PARAMETER_ERROR(TPM_RC_RANGE, 1);
+
+    if (TPM2_RH_PLATFORM == object->hierarchy && TPM2_RH_PLATFORM != auth)
+        return HANDLE_ERROR(TPM_RC_HIERARCHY, 2);
+
+    if (object->handle >= TRANSIENT_FIRST && object->handle < TRANSIENT_FIRST + MAX_TRANSIENT_OBJECTS) {
+        if (NULL != find_object(ctx, persistent_handle))
+            return TPM_RC_NV_DEFINED;
+
+        for (unsigned i = 0; i < MAX_PERSISTENT_OBJECTS; i++) {
+            if (0 == ctx->persistent[i].handle) {
+                ctx->persistent[i] = *object;
+                ctx->persistent[i].handle = persistent_handle;
+                return TSS2_RC_SUCCESS;
+            }
+        }
+
+        return TPM_RC_NV_SPACE;
+    }
+
+    // A persistent object is evicted.
+    if (persistent_handle != object->handle)
+        return PARAMETER_ERROR(TPM_RC_HANDLE, 1);
+
+    memset(object, 0, sizeof(struct loopback_object));
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+flush_context(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+              struct command *cmd,
+              TPM2_HANDLE *handle_out,
+              uint8_t **out)
+{
+    (void)handle_out;
+    (void)out;
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    TPMI_DH_CONTEXT flush_handle;
+    if (0 != unmarshal_uint32(&ptr, &remaining, &flush_handle))
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 1);
+
+    if (flush_handle < TRANSIENT_FIRST || flush_handle >= TRANSIENT_FIRST + MAX_TRANSIENT_OBJECTS)
+        return PARAMETER_ERROR(TPM_RC_HANDLE, 1);
+
+    struct loopback_object *object = find_object(ctx, flush_handle);
+    if (NULL == object)
+        return PARAMETER_ERROR(TPM_RC_HANDLE, 1);
+
+    memset(object, 0, sizeof(struct loopback_object));
+
+    return TSS2_RC_SUCCESS;
+}
+
+// Integrity value of a saved context, which (like a real TPM's) doesn't survive Clear
+static
+void
+context_integrity(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+                  const uint8_t *blob,
+                  size_t blob_length,
+                  uint8_t *out)
+{
+    uint8_t in[sizeof(uint64_t) + SECRET_SIZE + sizeof(TPM2B_AUTH) + sizeof(TPM2B_PUBLIC)];
+    uint8_t *ptr = in;
+    marshal_uint32((uint32_t)(ctx->seed_generation >> 32), &ptr);
+    marshal_uint32((uint32_t)ctx->seed_generation, &ptr);
+    memcpy(ptr, blob, blob_length);
+    ptr += blob_length;
+
+    derive(out, INTEGRITY_SIZE, LABEL_CONTEXT, in, ptr - in);
+}
+
+static
+TSS2_RC
+context_save(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+             struct command *cmd,
+             TPM2_HANDLE *handle_out,
+             uint8_t **out)
+{
+    (void)handle_out;
+
+    // Only objects can be saved (there are no sessions to save).
+    TPM2_HANDLE handle = cmd->handles[0];
+    if (handle < TRANSIENT_FIRST || handle >= TRANSIENT_FIRST + MAX_TRANSIENT_OBJECTS)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    struct loopback_object *object = find_object(ctx, handle);
+    if (NULL == object)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    // A sequence's state isn't part of the context blob.
+    if (object->sequence)
+        return HANDLE_ERROR(TPM_RC_TYPE, 1);
+
+    // The context blob is the object in the clear, plus an integrity value.
+    uint8_t blob[SECRET_SIZE + sizeof(TPM2B_AUTH) + sizeof(TPM2B_PUBLIC) + INTEGRITY_SIZE];
+    uint8_t *blob_ptr = blob;
+    memcpy(blob_ptr, object->secret, SECRET_SIZE);
+    blob_ptr += SECRET_SIZE;
+    marshal_tpm2b_auth(&object->auth, &blob_ptr);
+    marshal_tpm2b_public(&object->public_area, &blob_ptr);
+    context_integrity(ctx, blob, blob_ptr - blob, blob_ptr);
+    blob_ptr += INTEGRITY_SIZE;
+
+    // TPMS_CONTEXT
+    ctx->context_count++;
+    marshal_uint32((uint32_t)(ctx->context_count >> 32), out);
+    marshal_uint32((uint32_t)ctx->context_count, out);
+    marshal_uint32(TRANSIENT_FIRST, out);
+    marshal_uint32(object->hierarchy, out);
+    write_tpm2b(blob, blob_ptr - blob, out);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+context_load(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+             struct command *cmd,
+             TPM2_HANDLE *handle_out,
+             uint8_t **out)
+{
+    (void)out;
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    uint32_t sequence_high, sequence_low;
+    TPM2_HANDLE saved_handle;
+    TPMI_RH_HIERARCHY hierarchy;
+    uint8_t blob[SECRET_SIZE + sizeof(TPM2B_AUTH) + sizeof(TPM2B_PUBLIC) + INTEGRITY_SIZE];
+    uint16_t blob_length;
+    if (0 != unmarshal_uint32(&ptr, &remaining, &sequence_high) ||
+            0 != unmarshal_uint32(&ptr, &remaining, &sequence_low) ||
+            0 != unmarshal_uint32(&ptr, &remaining, &saved_handle) ||
+            0 != unmarshal_uint32(&ptr, &remaining, &hierarchy) ||
+            0 != read_tpm2b(&ptr, &remaining, &blob_length, blob, sizeof(blob)))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    if (TRANSIENT_FIRST != saved_handle)
+        return PARAMETER_ERROR(TPM_RC_HANDLE, 1);
+
+    // Unpack, and check, the blob made by `context_save`
+    uint8_t *blob_ptr = blob;
+    uint32_t blob_remaining = blob_length;
+    struct loopback_object object = {.handle = 0};
+    if (blob_remaining < SECRET_SIZE + INTEGRITY_SIZE)
+        return PARAMETER_ERROR(TPM_RC_INTEGRITY, 1);
+    memcpy(object.secret, blob_ptr, SECRET_SIZE);
+    blob_ptr += SECRET_SIZE;
+    blob_remaining -= SECRET_SIZE;
+    if (0 != read_tpm2b(&blob_ptr, &blob_remaining, &object.auth.size, object.auth.buffer, TPM2_SHA256_DIGEST_SIZE) ||
+            0 != unmarshal_tpm2b_public(&blob_ptr, &blob_remaining, &object.public_area) ||
+            INTEGRITY_SIZE != blob_remaining)
+        return PARAMETER_ERROR(TPM_RC_INTEGRITY, 1);
+
+    uint8_t expected_integrity[INTEGRITY_SIZE];
+    context_integrity(ctx, blob, blob_ptr - blob, expected_integrity);
+    if (0 != memcmp(expected_integrity, blob_ptr, INTEGRITY_SIZE))
+        return PARAMETER_ERROR(TPM_RC_INTEGRITY, 1);
+
+    struct loopback_object *loaded = new_transient_object(ctx);
+    if (NULL == loaded)
+        return TPM_RC_OBJECT_MEMORY;
+
+    object.handle = loaded->handle;
+    object.hierarchy = hierarchy;
+    *loaded = object;
+
+    *handle_out = loaded->handle;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+clear(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+      struct command *cmd,
+      TPM2_HANDLE *handle_out,
+      uint8_t **out)
+{
+    (void)handle_out;
+    (void)out;
+
+    if (TPM2_RH_LOCKOUT != cmd->handles[0] && TPM2_RH_PLATFORM != cmd->handles[0])
+        return HANDLE_ERROR(TPM_RC_HIERARCHY, 1);
+
+    // Everything not belonging to the platform goes.
+    for (unsigned i = 0; i < MAX_TRANSIENT_OBJECTS; i++) {
+        if (TPM2_RH_PLATFORM != ctx->transient[i].hierarchy)
+            memset(&ctx->transient[i], 0, sizeof(struct loopback_object));
+    }
+    for (unsigned i = 0; i < MAX_PERSISTENT_OBJECTS; i++) {
+        if (TPM2_RH_PLATFORM != ctx->persistent[i].hierarchy)
+            memset(&ctx->persistent[i], 0, sizeof(struct loopback_object));
+    }
+    for (unsigned i = 0; i < MAX_NV_INDICES; i++) {
+        if (!(ctx->nv[i].public_info.nvPublic.attributes & TPMA_NV_PLATFORMCREATE))
+            memset(&ctx->nv[i], 0, sizeof(struct loopback_nv_index));
+    }
+
+    ctx->owner_auth.size = 0;
+    ctx->endorsement_auth.size = 0;
+    ctx->lockout_auth.size = 0;
+    ctx->seed_generation++;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+hierarchy_change_auth(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+                      struct command *cmd,
+                      TPM2_HANDLE *handle_out,
+                      uint8_t **out)
+{
+    (void)handle_out;
+    (void)out;
+
+    TPM2B_AUTH *auth = hierarchy_auth(ctx, cmd->handles[0]);
+    if (NULL == auth)
+        return HANDLE_ERROR(TPM_RC_HIERARCHY, 1);
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    TPM2B_AUTH new_auth;
+    if (0 != read_tpm2b(&ptr, &remaining, &new_auth.size, new_auth.buffer, TPM2_SHA256_DIGEST_SIZE))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    *auth = new_auth;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+nv_define_space(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+                struct command *cmd,
+                TPM2_HANDLE *handle_out,
+                uint8_t **out)
+{
+    (void)handle_out;
+    (void)out;
+
+    TPMI_RH_PROVISION auth_handle = cmd->handles[0];
+    if (TPM2_RH_OWNER != auth_handle && TPM2_RH_PLATFORM != auth_handle)
+        return HANDLE_ERROR(TPM_RC_HIERARCHY, 1);
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    TPM2B_AUTH auth;
+    if (0 != read_tpm2b(&ptr, &remaining, &auth.size, auth.buffer, TPM2_SHA256_DIGEST_SIZE))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    TPM2B_NV_PUBLIC public_info;
+    if (0 != unmarshal_tpm2b_nvpublic(&ptr, &remaining, &public_info))
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 2);
+
+    TPMS_NV_PUBLIC *nv_public = &public_info.nvPublic;
+    if (nv_public->nvIndex < NV_INDEX_FIRST || nv_public->nvIndex > NV_INDEX_LAST)
+        return PARAMETER_ERROR(TPM_RC_VALUE, 2);
+
+    int platform_create = !!(nv_public->attributes & TPMA_NV_PLATFORMCREATE);
+    if (platform_create != (TPM2_RH_PLATFORM == auth_handle) ||
+            (nv_public->attributes & TPMA_NV_WRITTEN))
+        return PARAMETER_ERROR(TPM_RC_ATTRIBUTES, 2);
+
+    if (nv_public->dataSize > MAX_NV_INDEX_SIZE)
+        return PARAMETER_ERROR(TPM_RC_SIZE, 2);
+
+    if (NULL != find_nv_index(ctx, nv_public->nvIndex))
+        return TPM_RC_NV_DEFINED;
+
+    for (unsigned i = 0; i < MAX_NV_INDICES; i++) {
+        if (0 == ctx->nv[i].public_info.nvPublic.nvIndex) {
+            memset(&ctx->nv[i], 0, sizeof(struct loopback_nv_index));
+            ctx->nv[i].public_info = public_info;
+            ctx->nv[i].auth = auth;
+            return TSS2_RC_SUCCESS;
+        }
+    }
+
+    return TPM_RC_NV_SPACE;
+}
+
+static
+TSS2_RC
+nv_undefine_space(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+                  struct command *cmd,
+                  TPM2_HANDLE *handle_out,
+                  uint8_t **out)
+{
+    (void)handle_out;
+    (void)out;
+
+    struct loopback_nv_index *nv = find_nv_index(ctx, cmd->handles[1]);
+    if (NULL == nv)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 2);
+
+    TPMI_RH_PROVISION required = (nv->public_info.nvPublic.attributes & TPMA_NV_PLATFORMCREATE) ?
+                                 TPM2_RH_PLATFORM : TPM2_RH_OWNER;
+    if (required != cmd->handles[0])
+        return TPM_RC_NV_AUTHORIZATION;
+
+    memset(nv, 0, sizeof(struct loopback_nv_index));
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+nv_write(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+         struct command *cmd,
+         TPM2_HANDLE *handle_out,
+         uint8_t **out)
+{
+    (void)handle_out;
+    (void)out;
+
+    struct loopback_nv_index *nv = find_nv_index(ctx, cmd->handles[1]);
+    if (NULL == nv)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 2);
+
+    TSS2_RC ret = check_nv_access(nv, cmd->handles[0], 1);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    TPM2B_MAX_NV_BUFFER data;
+    if (0 != read_tpm2b(&ptr, &remaining, &data.size, data.buffer, sizeof(data.buffer)))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    uint16_t offset;
+    if (0 != unmarshal_uint16(&ptr, &remaining, &offset))
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 2);
+
+    if ((uint32_t)offset + data.size > nv->public_info.nvPublic.dataSize)
+        return TPM_RC_NV_RANGE;
+
+    memcpy(nv->data + offset, data.buffer, data.size);
+    nv->public_info.nvPublic.attributes |= TPMA_NV_WRITTEN;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+nv_read(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+        struct command *cmd,
+        TPM2_HANDLE *handle_out,
+        uint8_t **out)
+{
+    (void)handle_out;
+
+    struct loopback_nv_index *nv = find_nv_index(ctx, cmd->handles[1]);
+    if (NULL == nv)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 2);
+
+    TSS2_RC ret = check_nv_access(nv, cmd->handles[0], 0);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    uint16_t size;
+    uint16_t offset;
+    if (0 != unmarshal_uint16(&ptr, &remaining, &size) ||
+            0 != unmarshal_uint16(&ptr, &remaining, &offset))
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 1);
+
+    if (!(nv->public_info.nvPublic.attributes & TPMA_NV_WRITTEN))
+        return TPM_RC_NV_UNINITIALIZED;
+
+    if (size > TPM2_MAX_NV_BUFFER_SIZE ||
+            (uint32_t)offset + size > nv->public_info.nvPublic.dataSize)
+        return TPM_RC_NV_RANGE;
+
+    write_tpm2b(nv->data + offset, size, out);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+nv_read_public(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+               struct command *cmd,
+               TPM2_HANDLE *handle_out,
+               uint8_t **out)
+{
+    (void)handle_out;
+
+    struct loopback_nv_index *nv = find_nv_index(ctx, cmd->handles[0]);
+    if (NULL == nv)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    TPM2B_NAME name;
+    nv_name(&nv->public_info, &name);
+
+    marshal_tpm2b_nvpublic(&nv->public_info, out);
+    write_name(&name, out);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+create_loaded(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+              struct command *cmd,
+              TPM2_HANDLE *handle_out,
+              uint8_t **out)
+{
+    // Only keys under a storage key: primary keys come from CreatePrimary here.
+    struct loopback_object *parent = find_object(ctx, cmd->handles[0]);
+    if (NULL == parent)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    TPMA_OBJECT parent_attributes = parent->public_area.publicArea.objectAttributes;
+    if (!(parent_attributes & TPMA_OBJECT_RESTRICTED) || !(parent_attributes & TPMA_OBJECT_DECRYPT))
+        return HANDLE_ERROR(TPM_RC_TYPE, 1);
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    TPM2B_AUTH auth;
+    if (0 != parse_sensitive_create(&ptr, &remaining, &auth))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    // A TPM2B_TEMPLATE holding a TPMT_PUBLIC is marshaled just like a TPM2B_PUBLIC.
+    TPM2B_PUBLIC public_area;
+    int unmarshal_ret = unmarshal_tpm2b_public(&ptr, &remaining, &public_area);
+    if (-2 == unmarshal_ret)
+        return PARAMETER_ERROR(TPM_RC_TYPE, 2);
+    if (0 != unmarshal_ret)
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 2);
+
+    TPMS_ECC_PARMS *parms = &public_area.publicArea.parameters.eccDetail;
+    if (TPM2_ECC_NIST_P256 != parms->curveID && TPM2_ECC_BN_P256 != parms->curveID)
+        return PARAMETER_ERROR(TPM_RC_KEY, 2);
+
+    struct loopback_object *object = new_transient_object(ctx);
+    if (NULL == object)
+        return TPM_RC_OBJECT_MEMORY;
+
+    object->hierarchy = parent->hierarchy;
+    object->public_area = public_area;
+    object->auth = auth;
+
+    TPM2B_PRIVATE private_blob;
+    create_child(ctx, parent, &auth, object, &private_blob);
+
+    *handle_out = object->handle;
+
+    TPM2B_NAME name;
+    object_name(&object->public_area, &name);
+
+    marshal_tpm2b_private(&private_blob, out);
+    marshal_tpm2b_public(&object->public_area, out);
+    write_name(&name, out);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+get_random(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+           struct command *cmd,
+           TPM2_HANDLE *handle_out,
+           uint8_t **out)
+{
+    (void)handle_out;
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    uint16_t bytes_requested;
+    if (0 != unmarshal_uint16(&ptr, &remaining, &bytes_requested))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    // Like a TPM, return at most a digest's worth.
+    if (bytes_requested > TPM2_SHA256_DIGEST_SIZE)
+        bytes_requested = TPM2_SHA256_DIGEST_SIZE;
+
+    uint8_t in[sizeof(uint64_t)];
+    memcpy(in, &ctx->random_count, sizeof(uint64_t));
+    ctx->random_count++;
+
+    uint8_t random_bytes[TPM2_SHA256_DIGEST_SIZE];
+    derive(random_bytes, bytes_requested, LABEL_RANDOM, in, sizeof(in));
+    write_tpm2b(random_bytes, bytes_requested, out);
+
+    return TSS2_RC_SUCCESS;
+}
+
+struct loopback_property {
+    TPM2_PT property;
+    uint32_t value;
+};
+
+// In increasing order, as GetCapability returns them
+static const struct loopback_property properties[] = {
+    {TPM2_PT_MANUFACTURER,      0x58505455},    // "XPTU"
+    {TPM2_PT_INPUT_BUFFER,      TPM2_MAX_DIGEST_BUFFER},
+    {TPM2_PT_HR_TRANSIENT_MIN,  MAX_TRANSIENT_OBJECTS},
+    {TPM2_PT_MAX_COMMAND_SIZE,  TPM2_MAX_COMMAND_SIZE},
+    {TPM2_PT_MAX_RESPONSE_SIZE, TPM2_MAX_RESPONSE_SIZE},
+    {TPM2_PT_MAX_DIGEST,        TPM2_SHA256_DIGEST_SIZE},
+    {TPM2_PT_NV_BUFFER_MAX,     TPM2_MAX_NV_BUFFER_SIZE},
+};
+
+// Write up to `count` of the handles at or after `first`, in the same range as it
+static
+void
+write_handles(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+              TPM2_HANDLE first,
+              uint32_t count,
+              uint8_t **out)
+{
+    TPM2_HANDLE handles[MAX_TRANSIENT_OBJECTS + MAX_PERSISTENT_OBJECTS + MAX_NV_INDICES];
+    uint32_t found = 0;
+
+    switch (first & 0xFF000000) {
+        case TPM2_HR_TRANSIENT:
+            for (unsigned i = 0; i < MAX_TRANSIENT_OBJECTS; i++) {
+                if (0 != ctx->transient[i].handle)
+                    handles[found++] = ctx->transient[i].handle;
+            }
+            break;
+        case TPM2_HR_PERSISTENT:
+            for (unsigned i = 0; i < MAX_PERSISTENT_OBJECTS; i++) {
+                if (0 != ctx->persistent[i].handle)
+                    handles[found++] = ctx->persistent[i].handle;
+            }
+            break;
+        case TPM2_HR_NV_INDEX:
+            for (unsigned i = 0; i < MAX_NV_INDICES; i++) {
+                if (0 != ctx->nv[i].public_info.nvPublic.nvIndex)
+                    handles[found++] = ctx->nv[i].public_info.nvPublic.nvIndex;
+            }
+            break;
+    }
+
+    // Sort them (there are only a few), then skip those before `first`.
+    for (uint32_t i = 1; i < found; i++) {
+        for (uint32_t j = i; j > 0 && handles[j - 1] > handles[j]; j--) {
+            TPM2_HANDLE swap = handles[j];
+            handles[j] = handles[j - 1];
+            handles[j - 1] = swap;
+        }
+    }
+    uint32_t start = 0;
+    while (start < found && handles[start] < first)
+        start++;
+
+    uint32_t written = found - start < count ? found - start : count;
+
+    **out = (start + written < found) ? TPM2_YES : TPM2_NO;    // moreData
+    *out += 1;
+    marshal_uint32(TPM2_CAP_HANDLES, out);
+    marshal_uint32(written, out);
+    for (uint32_t i = 0; i < written; i++)
+        marshal_uint32(handles[start + i], out);
+}
+
+static
+TSS2_RC
+get_capability(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+               struct command *cmd,
+               TPM2_HANDLE *handle_out,
+               uint8_t **out)
+{
+    (void)handle_out;
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    TPM2_CAP capability;
+    uint32_t property;
+    uint32_t count;
+    if (0 != unmarshal_uint32(&ptr, &remaining, &capability) ||
+            0 != unmarshal_uint32(&ptr, &remaining, &property) ||
+            0 != unmarshal_uint32(&ptr, &remaining, &count))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    if (TPM2_CAP_HANDLES == capability) {
+        write_handles(ctx, property, count, out);
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (TPM2_CAP_TPM_PROPERTIES != capability)
+        return PARAMETER_ERROR(TPM_RC_VALUE, 1);
+
+    const size_t property_count = sizeof(properties) / sizeof(properties[0]);
+    size_t start = 0;
+    while (start < property_count && properties[start].property < property)
+        start++;
+
+    size_t written = property_count - start < count ? property_count - start : count;
+
+    **out = (start + written < property_count) ? TPM2_YES : TPM2_NO;   // moreData
+    *out += 1;
+    marshal_uint32(TPM2_CAP_TPM_PROPERTIES, out);
+    marshal_uint32(written, out);
+    for (size_t i = start; i < start + written; i++) {
+        marshal_uint32(properties[i].property, out);
+        marshal_uint32(properties[i].value, out);
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+pcr_read(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+         struct command *cmd,
+         TPM2_HANDLE *handle_out,
+         uint8_t **out)
+{
+    (void)handle_out;
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    uint32_t count;
+    if (0 != unmarshal_uint32(&ptr, &remaining, &count))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    // Only the SHA-256 bank exists, and (like a TPM) at most 8 PCRs are read at a time.
+    uint8_t select[PCR_COUNT / 8] = {0};
+    unsigned selected[8];
+    unsigned selected_count = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        TPMI_ALG_HASH hash;
+        uint8_t size_of_select;
+        if (0 != unmarshal_uint16(&ptr, &remaining, &hash) ||
+                0 != unmarshal_uint8(&ptr, &remaining, &size_of_select) ||
+                size_of_select > remaining)
+            return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+        for (unsigned pcr = 0; TPM2_ALG_SHA256 == hash && pcr < 8u * size_of_select && pcr < PCR_COUNT; pcr++) {
+            if ((ptr[pcr / 8] & (1 << (pcr % 8))) && selected_count < 8) {
+                select[pcr / 8] |= 1 << (pcr % 8);
+                selected[selected_count++] = pcr;
+            }
+        }
+        ptr += size_of_select;
+        remaining -= size_of_select;
+    }
+
+    marshal_uint32(ctx->pcr_update_count, out);
+
+    marshal_uint32(selected_count ? 1 : 0, out);
+    if (selected_count) {
+        marshal_uint16(TPM2_ALG_SHA256, out);
+        **out = sizeof(select);
+        *out += 1;
+        memcpy(*out, select, sizeof(select));
+        *out += sizeof(select);
+    }
+
+    marshal_uint32(selected_count, out);
+    for (unsigned i = 0; i < selected_count; i++)
+        write_tpm2b(ctx->pcrs[selected[i]], TPM2_SHA256_DIGEST_SIZE, out);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+pcr_extend(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+           struct command *cmd,
+           TPM2_HANDLE *handle_out,
+           uint8_t **out)
+{
+    (void)handle_out;
+    (void)out;
+
+    TPM2_HANDLE pcr = cmd->handles[0];
+    if (pcr >= PCR_COUNT)
+        return HANDLE_ERROR(TPM_RC_VALUE, 1);
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    uint32_t count;
+    if (0 != unmarshal_uint32(&ptr, &remaining, &count))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    for (uint32_t i = 0; i < count; i++) {
+        TPMI_ALG_HASH hash;
+        if (0 != unmarshal_uint16(&ptr, &remaining, &hash))
+            return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+        size_t size = digest_size(hash);
+        if (0 == size)
+            return PARAMETER_ERROR(TPM_RC_HASH, 1);
+        if (size > remaining)
+            return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+        // Other banks aren't allocated, so their digests are ignored.
+        if (TPM2_ALG_SHA256 == hash) {
+            uint8_t in[2 * TPM2_SHA256_DIGEST_SIZE];
+            memcpy(in, ctx->pcrs[pcr], TPM2_SHA256_DIGEST_SIZE);
+            memcpy(in + TPM2_SHA256_DIGEST_SIZE, ptr, TPM2_SHA256_DIGEST_SIZE);
+            derive(ctx->pcrs[pcr], TPM2_SHA256_DIGEST_SIZE, LABEL_PCR, in, sizeof(in));
+        }
+
+        ptr += size;
+        remaining -= size;
+    }
+
+    ctx->pcr_update_count++;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+struct loopback_object*
+find_sequence(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+              TPM2_HANDLE handle)
+{
+    struct loopback_object *object = find_object(ctx, handle);
+    return (NULL != object && object->sequence) ? object : NULL;
+}
+
+// Read a TPM2B_MAX_BUFFER in place, without copying it.
+static
+int
+read_max_buffer(uint8_t **in,
+                uint32_t *remaining,
+                const uint8_t **data_out,
+                uint16_t *size_out)
+{
+    if (0 != unmarshal_uint16(in, remaining, size_out) || *size_out > TPM2_MAX_DIGEST_BUFFER)
+        return -1;
+
+    *data_out = *in;
+    return skip_bytes(in, remaining, *size_out);
+}
+
+static
+void
+sequence_hash(struct loopback_object *sequence,
+              const uint8_t *data,
+              uint16_t size)
+{
+    for (uint16_t i = 0; i < size && sequence->sequence_length + i < sizeof(uint32_t); i++)
+        sequence->sequence_prefix = (sequence->sequence_prefix << 8) | data[i];
+
+    sequence->sequence_state = derive_update(sequence->sequence_state, data, size);
+    sequence->sequence_length += size;
+}
+
+static
+TSS2_RC
+hash_sequence_start(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+                    struct command *cmd,
+                    TPM2_HANDLE *handle_out,
+                    uint8_t **out)
+{
+    (void)out;
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    TPM2B_AUTH auth;
+    if (0 != read_tpm2b(&ptr, &remaining, &auth.size, auth.buffer, sizeof(auth.buffer)))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    // Only the SHA-256 bank is implemented, so only SHA-256 sequences are.
+    TPMI_ALG_HASH hash_alg;
+    if (0 != unmarshal_uint16(&ptr, &remaining, &hash_alg))
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 2);
+    if (TPM2_ALG_SHA256 != hash_alg)
+        return PARAMETER_ERROR(TPM_RC_HASH, 2);
+
+    struct loopback_object *sequence = new_transient_object(ctx);
+    if (NULL == sequence)
+        return TPM_RC_OBJECT_MEMORY;
+
+    sequence->hierarchy = TPM2_RH_NULL;
+    sequence->auth = auth;
+    sequence->sequence = 1;
+    sequence->sequence_state = derive_start(LABEL_SEQUENCE);
+
+    *handle_out = sequence->handle;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+sequence_update(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+                struct command *cmd,
+                TPM2_HANDLE *handle_out,
+                uint8_t **out)
+{
+    (void)handle_out;
+    (void)out;
+
+    struct loopback_object *sequence = find_sequence(ctx, cmd->handles[0]);
+    if (NULL == sequence)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    const uint8_t *data;
+    uint16_t size;
+    if (0 != read_max_buffer(&ptr, &remaining, &data, &size))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    sequence_hash(sequence, data, size);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+sequence_complete(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+                  struct command *cmd,
+                  TPM2_HANDLE *handle_out,
+                  uint8_t **out)
+{
+    (void)handle_out;
+
+    struct loopback_object *sequence = find_sequence(ctx, cmd->handles[0]);
+    if (NULL == sequence)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    uint8_t *ptr = cmd->params;
+    uint32_t remaining = cmd->params_length;
+
+    const uint8_t *data;
+    uint16_t size;
+    if (0 != read_max_buffer(&ptr, &remaining, &data, &size))
+        return PARAMETER_ERROR(TPM_RC_SIZE, 1);
+
+    TPMI_RH_HIERARCHY hierarchy;
+    if (0 != unmarshal_uint32(&ptr, &remaining, &hierarchy))
+        return PARAMETER_ERROR(TPM_RC_INSUFFICIENT, 2);
+    if (TPM2_RH_OWNER != hierarchy && TPM2_RH_ENDORSEMENT != hierarchy &&
+            TPM2_RH_PLATFORM != hierarchy && TPM2_RH_NULL != hierarchy)
+        return PARAMETER_ERROR(TPM_RC_HIERARCHY, 2);
+
+    sequence_hash(sequence, data, size);
+
+    uint8_t digest[TPM2_SHA256_DIGEST_SIZE];
+    derive_finish(sequence->sequence_state, digest, sizeof(digest));
+    write_tpm2b(digest, sizeof(digest), out);
+
+    // As in a real TPM, data that starts like a TPM-generated structure gets a NULL ticket,
+    // so a restricted key can't be made to sign something that looks like an attestation.
+    marshal_uint16(TPM2_ST_HASHCHECK, out);
+    if (TPM2_RH_NULL == hierarchy ||
+            (sequence->sequence_length >= sizeof(uint32_t) && TPM2_GENERATED_VALUE == sequence->sequence_prefix)) {
+        marshal_uint32(TPM2_RH_NULL, out);
+        marshal_uint16(0, out);
+    } else {
+        uint8_t ticket[TPM2_SHA256_DIGEST_SIZE];
+        hashcheck_ticket(ctx, hierarchy, digest, ticket);
+        marshal_uint32(hierarchy, out);
+        write_tpm2b(ticket, sizeof(ticket), out);
+    }
+
+    memset(sequence, 0, sizeof(struct loopback_object));
+
+    return TSS2_RC_SUCCESS;
+}
+
+static const struct command_info commands[] = {
+    // code                         handles returns handle  authorized  fn
+    {TPM2_CC_CreatePrimary,         1,      1,              1,          create_primary},
+    {TPM2_CC_Create,                1,      0,              1,          create},
+    {TPM2_CC_Load,                  1,      1,              1,          load},
+    {TPM2_CC_Sign,                  1,      0,              1,          sign},
+    {TPM2_CC_Commit,                1,      0,              1,          commit},
+    {TPM2_CC_ReadPublic,            1,      0,              0,          read_public},
+    {TPM2_CC_EvictControl,          2,      0,              1,          evict_control},
+    {TPM2_CC_NV_FlushContext,       0,      0,              0,          flush_context},
+    {TPM2_CC_ContextSave,           1,      0,              0,          context_save},
+    {TPM2_CC_ContextLoad,           0,      1,              0,          context_load},
+    {TPM2_CC_Clear,                 1,      0,              1,          clear},
+    {TPM2_CC_HierarchyChangeAuth,   1,      0,              1,          hierarchy_change_auth},
+    {TPM2_CC_NV_DefineSpace,        1,      0,              1,          nv_define_space},
+    {TPM2_CC_NV_UndefineSpace,      2,      0,              1,          nv_undefine_space},
+    {TPM2_CC_NV_Write,              2,      0,              1,          nv_write},
+    {TPM2_CC_NV_Read,               2,      0,              1,          nv_read},
+    {TPM2_CC_NV_ReadPublic,         1,      0,              0,          nv_read_public},
+    {TPM2_CC_CreateLoaded,          1,      1,              1,          create_loaded},
+    {TPM2_CC_GetRandom,             0,      0,              0,          get_random},
+    {TPM2_CC_GetCapability,         0,      0,              0,          get_capability},
+    {TPM2_CC_PCR_Read,              0,      0,              0,          pcr_read},
+    {TPM2_CC_PCR_Extend,            1,      0,              1,          pcr_extend},
+    {TPM2_CC_HashSequenceStart,     0,      1,              0,          hash_sequence_start},
+    {TPM2_CC_SequenceUpdate,        1,      0,              1,          sequence_update},
+    {TPM2_CC_SequenceComplete,      1,      0,              1,          sequence_complete},
+};
+
+static
+const struct command_info*
+find_command(TPM2_CC code)
+{
+    for (unsigned i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (commands[i].code == code)
+            return &commands[i];
+    }
+
+    return NULL;
+}
+
+// Parse the header, handles and authorization area of `command`.
+static
+TSS2_RC
+parse_command(uint8_t *command,
+              size_t size,
+              const struct command_info **info_out,
+              struct command *cmd)
+{
+    uint8_t *ptr = command;
+    uint32_t remaining = size;
+
+    TPM2_ST tag;
+    uint32_t command_size;
+    if (0 != unmarshal_uint16(&ptr, &remaining, &tag) ||
+            0 != unmarshal_uint32(&ptr, &remaining, &command_size) ||
+            0 != unmarshal_uint32(&ptr, &remaining, &cmd->code))
+        return TPM_RC_COMMAND_SIZE;
+
+    if (command_size != size)
+        return TPM_RC_COMMAND_SIZE;
+
+    if (TPM2_ST_SESSIONS != tag && TPM2_ST_NO_SESSIONS != tag)
+        return TPM_RC_BAD_TAG;
+    cmd->sessions = (TPM2_ST_SESSIONS == tag);
+
+    *info_out = find_command(cmd->code);
+    if (NULL == *info_out)
+        return TPM_RC_COMMAND_CODE;
+
+    for (unsigned i = 0; i < (*info_out)->handle_count; i++) {
+        if (0 != unmarshal_uint32(&ptr, &remaining, &cmd->handles[i]))
+            return TPM_RC_COMMAND_SIZE;
+    }
+
+    cmd->auth_count = 0;
+    if (cmd->sessions) {
+        uint32_t auth_size;
+        if (0 != unmarshal_uint32(&ptr, &remaining, &auth_size) || auth_size > remaining)
+            return TPM_RC_COMMAND_SIZE;
+
+        uint8_t *auth_ptr = ptr;
+        uint32_t auth_remaining = auth_size;
+        while (auth_remaining > 0) {
+            TPMS_AUTH_COMMAND auth;
+            if (0 != unmarshal_uint32(&auth_ptr, &auth_remaining, &auth.sessionHandle) ||
+                    0 != read_tpm2b(&auth_ptr, &auth_remaining, &auth.nonce.size, auth.nonce.buffer, sizeof(auth.nonce.buffer)) ||
+                    0 != skip_bytes(&auth_ptr, &auth_remaining, sizeof(TPMA_SESSION)) ||
+                    0 != read_tpm2b(&auth_ptr, &auth_remaining, &auth.hmac.size, auth.hmac.buffer, sizeof(auth.hmac.buffer)))
+                return SESSION_ERROR(TPM_RC_SIZE, cmd->auth_count + 1);
+
+            if (0 == cmd->auth_count)
+                cmd->auth = auth;
+            if (++cmd->auth_count > 3)
+                return TPM_RC_COMMAND_SIZE;
+        }
+
+        ptr += auth_size;
+        remaining -= auth_size;
+    }
+
+    cmd->params = ptr;
+    cmd->params_length = remaining;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC
+authorize(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+          const struct command *cmd)
+{
+    if (0 == cmd->auth_count)
+        return TPM_RC_AUTH_MISSING;
+
+    const TPM2B_AUTH *auth = entity_auth(ctx, cmd->handles[0]);
+    if (NULL == auth)
+        return HANDLE_ERROR(TPM_RC_HANDLE, 1);
+
+    // Only password authorizations are supported.
+    if (TPM2_RS_PW != cmd->auth.sessionHandle)
+        return SESSION_ERROR(TPM_RC_HANDLE, 1);
+
+    if (auth->size != cmd->auth.hmac.size ||
+            0 != memcmp(auth->buffer, cmd->auth.hmac.buffer, auth->size))
+        return SESSION_ERROR(TPM_RC_AUTH_FAIL, 1);
+
+    return TSS2_RC_SUCCESS;
+}
+
+// Run `command`, leaving the response in the context.
+static
+void
+process_command(TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *ctx,
+                uint8_t *command,
+                size_t size)
+{
+    const struct command_info *info = NULL;
+    struct command cmd;
+
+    TSS2_RC ret = parse_command(command, size, &info, &cmd);
+
+    if (TSS2_RC_SUCCESS == ret && info->authorized)
+        ret = authorize(ctx, &cmd);
+
+    // The response is laid out as: header, [handle], [parameterSize], parameters, [auths]
+    uint8_t *handle_ptr = ctx->response + COMMAND_HEADER_SIZE;
+    uint8_t *parameter_size_ptr = handle_ptr;
+    if (TSS2_RC_SUCCESS == ret && info->returns_handle)
+        parameter_size_ptr += sizeof(TPM2_HANDLE);
+    uint8_t *params_ptr = parameter_size_ptr;
+    if (TSS2_RC_SUCCESS == ret && cmd.sessions)
+        params_ptr += sizeof(uint32_t);
+
+    uint8_t *ptr = params_ptr;
+    TPM2_HANDLE handle_out = 0;
+    if (TSS2_RC_SUCCESS == ret)
+        ret = info->fn(ctx, &cmd, &handle_out, &ptr);
+
+    TPM2_ST tag = TPM2_ST_NO_SESSIONS;
+    if (TSS2_RC_SUCCESS == ret) {
+        if (info->returns_handle)
+            marshal_uint32(handle_out, &handle_ptr);
+
+        if (cmd.sessions) {
+            tag = TPM2_ST_SESSIONS;
+            marshal_uint32(ptr - params_ptr, &parameter_size_ptr);
+
+            for (unsigned i = 0; i < cmd.auth_count; i++) {
+                marshal_uint16(0, &ptr);    // nonce
+                *ptr++ = TPMA_SESSION_CONTINUESESSION;
+                marshal_uint16(0, &ptr);    // hmac
+            }
+        }
+    } else {
+        ptr = ctx->response + COMMAND_HEADER_SIZE;
+    }
+
+    ctx->response_size = ptr - ctx->response;
+
+    ptr = ctx->response;
+    marshal_uint16(tag, &ptr);
+    marshal_uint32(ctx->response_size, &ptr);
+    marshal_uint32(ret, &ptr);
+}
+
+TSS2_RC
+getPollHandles_loopback(TSS2_TCTI_CONTEXT *tcti_context,
+                        TSS2_TCTI_POLL_HANDLE *handles,
+                        size_t *num_handles)
+{
+    (void)tcti_context;
+    (void)handles;
+    (void)num_handles;
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+TSS2_RC
+setLocality_loopback(TSS2_TCTI_CONTEXT *tcti_context,
+                     uint8_t locality)
+{
+    (void)tcti_context;
+    (void)locality;
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+TSS2_RC transmit_loopback(TSS2_TCTI_CONTEXT *tcti_context,
+                          size_t size,
+                          uint8_t *command)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK*)tcti_context;
+
+    if (NULL == command)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (cast_context->pending)
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+
+    uint64_t transmit_start_ns = tcti_now_ns();
+
+    TPM2_CC command_code = tcti_command_code(command, size);
+    uint32_t latency_us = 0;
+    if (command_code >= CC_FIRST && command_code <= CC_LAST)
+        latency_us = cast_context->latency_us[command_code - CC_FIRST];
+    cast_context->response_due_ns = transmit_start_ns + (uint64_t)latency_us * 1000;
+
+    process_command(cast_context, command, size);
+
+    cast_context->pending = 1;
+
+    if (cast_context->trace_hook) {
+        cast_context->trace_command_code = command_code;
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_COMMAND, cast_context->trace_command_code,
+                   command, size, transmit_start_ns, tcti_now_ns());
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+void
+sleep_ns(uint64_t delay_ns)
+{
+    struct timespec ts = {.tv_sec = delay_ns / 1000000000,
+                          .tv_nsec = delay_ns % 1000000000};
+    while (0 != nanosleep(&ts, &ts))
+        ;
+}
+
+TSS2_RC receive_loopback(TSS2_TCTI_CONTEXT *tcti_context,
+                         size_t *size,
+                         uint8_t *response,
+                         int32_t timeout)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_LOOPBACK*)tcti_context;
+
+    if (NULL == response || NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (!cast_context->pending)
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+
+    // Wait out the injected latency, or as much of it as `timeout` allows.
+    uint64_t now_ns = tcti_now_ns();
+    if (now_ns < cast_context->response_due_ns) {
+        uint64_t wait_ns = cast_context->response_due_ns - now_ns;
+        if (TSS2_TCTI_TIMEOUT_BLOCK != timeout && (uint64_t)timeout * 1000000 < wait_ns) {
+            sleep_ns((uint64_t)timeout * 1000000);
+            return TSS2_TCTI_RC_TRY_AGAIN;
+        }
+        sleep_ns(wait_ns);
+    }
+
+    if (*size < cast_context->response_size)
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+
+    cast_context->response_start_ns = tcti_now_ns();
+
+    memcpy(response, cast_context->response, cast_context->response_size);
+    *size = cast_context->response_size;
+
+    cast_context->pending = 0;
+
+    if (cast_context->trace_hook)
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_RESPONSE, cast_context->trace_command_code,
+                   response, *size, cast_context->response_start_ns, tcti_now_ns());
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC finalize_loopback(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    (void)tcti_context;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC cancel_loopback(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    (void)tcti_context;
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
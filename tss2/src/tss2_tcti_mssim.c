@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -32,6 +33,7 @@
 #ifndef NDEBUG
 #include <stdio.h>
 #endif
+#include <stddef.h>
 #include <string.h>
 #include <assert.h>
 
@@ -52,6 +54,9 @@ typedef struct {
     TSS2_RC (*getPollHandles) (TSS2_TCTI_CONTEXT *tctiContext,
             TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles);
     TSS2_RC (*setLocality) (TSS2_TCTI_CONTEXT *tctiContext, uint8_t locality);
+    uint64_t response_start_ns;     // see TSS2_TCTI_CONTEXT_COMMON_XAPTUM
+    const struct xtpm_trace_hook *trace_hook;
+    TPM2_CC trace_command_code;     // of the last command sent, for tracing its response
 
     int sock;
 } TSS2_TCTI_CONTEXT_OPAQUE_SOCKET;
@@ -93,6 +98,10 @@ int
 open_socket(const char* hostname,
             const char* port);
 
+static
+int
+open_unix_socket(const char* path);
+
 static
 TSS2_RC
 recv_all(int sock,
@@ -128,9 +137,17 @@ Tss2_Tcti_Mssim_Init(TSS2_TCTI_CONTEXT *tcti_context,
     cast_context->cancel = cancel_socket;
     cast_context->getPollHandles = getPollHandles_socket;
     cast_context->setLocality = setLocality_socket;
+    cast_context->response_start_ns = 0;
+    cast_context->trace_hook = NULL;
+    cast_context->trace_command_code = 0;
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_SOCKET, response_start_ns) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, response_start_ns));
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_SOCKET, trace_hook) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, trace_hook));
 
     char *hostname = NULL;
     char *port = NULL;
+    char *path = NULL;
     char conf_buf[256] = {};
     strncpy(conf_buf, conf, sizeof(conf_buf));
     if (0 != conf_buf[sizeof(conf_buf) - 1])
@@ -145,11 +162,21 @@ Tss2_Tcti_Mssim_Init(TSS2_TCTI_CONTEXT *tcti_context,
             hostname = equals + 1;
         } else if (0 == strncmp(key, "port", 4)) {
             port = equals + 1;
+        } else if (0 == strncmp(key, "path", 4)) {
+            path = equals + 1;
         } else {
             return TSS2_BASE_RC_BAD_VALUE;
         }
     }
 
+    if (NULL != path) {
+        if (NULL != hostname || NULL != port)
+            return TSS2_BASE_RC_BAD_VALUE;
+
+        cast_context->sock = open_unix_socket(path);
+        return (BAD_SOCKET != cast_context->sock) ? TSS2_RC_SUCCESS : TSS2_TCTI_RC_IO_ERROR;
+    }
+
     if (NULL == hostname || NULL == port)
         return TSS2_BASE_RC_BAD_VALUE;
 
@@ -191,6 +218,9 @@ TSS2_RC transmit_socket(TSS2_TCTI_CONTEXT *tcti_context,
     TSS2_TCTI_CONTEXT_OPAQUE_SOCKET *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_SOCKET*)tcti_context;
     TSS2_RC send_ret;
 
+    const struct xtpm_trace_hook *trace_hook = cast_context->trace_hook;
+    uint64_t start_ns = trace_hook ? tcti_now_ns() : 0;
+
     // Send SIMULATOR_SEND_COMMAND.
     // We're assuming we're talking to the Microsoft simulator.
     // A proxy that is passing these commands to a real TPM can just ignore this
@@ -201,14 +231,6 @@ TSS2_RC transmit_socket(TSS2_TCTI_CONTEXT *tcti_context,
     if (send_ret != TSS2_RC_SUCCESS) {
         return send_ret;
     }
-#ifdef TCTI_VERBOSE_LOGGING
-    printf("tcti: transmit_socket: [simulator_send_command={ ");
-    for (size_t i=0; i < sizeof(send_command); i++) {
-        printf("%#X", send_command[i]);
-        if (i != (sizeof(send_command)-1)) printf(", ");
-    }
-    printf("}, ");
-#endif
 
     // Send locality.
     // Again, this is for the Micrsoft simulator.
@@ -217,9 +239,6 @@ TSS2_RC transmit_socket(TSS2_TCTI_CONTEXT *tcti_context,
     if (send_ret != TSS2_RC_SUCCESS) {
         return send_ret;
     }
-#ifdef TCTI_VERBOSE_LOGGING
-    printf("locality=%u, ", locality);
-#endif
 
     // Send total command size
     uint8_t *size_buffer = command + sizeof(TPM2_ST);    // skip the ST_SESSIONS code
@@ -229,14 +248,6 @@ TSS2_RC transmit_socket(TSS2_TCTI_CONTEXT *tcti_context,
     if (send_ret != TSS2_RC_SUCCESS) {
         return send_ret;
     }
-#ifdef TCTI_VERBOSE_LOGGING
-    printf("size={");
-    for (size_t i=0; i < sizeof(uint32_t); i++) {
-        printf("%#X", size_buffer[i]);
-        if (i != (sizeof(uint32_t)-1)) printf(", ");
-    }
-    printf("}, ");
-#endif
 
     // Send the command.
     send_ret = send_all(cast_context->sock,
@@ -245,14 +256,12 @@ TSS2_RC transmit_socket(TSS2_TCTI_CONTEXT *tcti_context,
     if (send_ret != TSS2_RC_SUCCESS) {
         return send_ret;
     }
-#ifdef TCTI_VERBOSE_LOGGING
-    printf("command={");
-    for (size_t i=0; i < size; i++) {
-        printf("%#X", command[i]);
-        if (i != (size-1)) printf(", ");
+
+    if (trace_hook) {
+        cast_context->trace_command_code = tcti_command_code(command, size);
+        tcti_trace(trace_hook, XTPM_TRACE_COMMAND, cast_context->trace_command_code,
+                   command, size, start_ns, tcti_now_ns());
     }
-    printf("}]\n");
-#endif
 
     return TSS2_RC_SUCCESS;
 }
@@ -277,6 +286,7 @@ TSS2_RC receive_socket(TSS2_TCTI_CONTEXT *tcti_context,
     if (recv_ret != TSS2_RC_SUCCESS) {
         return recv_ret;
     }
+    cast_context->response_start_ns = tcti_now_ns();
     uint32_t size_from_response;
     uint8_t *size_ptr = response;
     uint32_t trash = sizeof(uint32_t);
@@ -300,23 +310,15 @@ TSS2_RC receive_socket(TSS2_TCTI_CONTEXT *tcti_context,
 
     *size = (size_t)size_from_response;
 
-#ifdef TCTI_VERBOSE_LOGGING
-    printf("tcti: receive_socket: [size=%zu, ", *size);
-#endif
-
     // Read the rest of the response
     recv_ret = recv_all(cast_context->sock, response, *size);
     if (recv_ret != TSS2_RC_SUCCESS) {
         return recv_ret;
     }
-#ifdef TCTI_VERBOSE_LOGGING
-    printf("response={");
-    for (size_t i=0; i < *size; i++) {
-        printf("%#X", response[i]);
-        if (i != (*size-1)) printf(", ");
-    }
-    printf("}]\n");
-#endif
+
+    if (cast_context->trace_hook)
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_RESPONSE, cast_context->trace_command_code,
+                   response, *size, cast_context->response_start_ns, tcti_now_ns());
 
     // Read 4 bytes of zeroes (and just ignore them).
     // The Microsoft simulator appends these, so we assume them.
@@ -416,6 +418,29 @@ open_socket(const char* hostname,
     return sock;
 }
 
+int
+open_unix_socket(const char* path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return BAD_SOCKET;
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == sock)
+        return BAD_SOCKET;
+
+    if (-1 == connect(sock, (struct sockaddr*)&addr, sizeof(addr))) {
+#ifndef NDEBUG
+        perror("failed to connect to TPM server");
+#endif
+        close(sock);
+        return BAD_SOCKET;
+    }
+
+    return sock;
+}
+
 TSS2_RC
 recv_all(int sock,
          uint8_t *out,
@@ -425,6 +450,8 @@ recv_all(int sock,
     size_t bytes_read = 0;
     while (bytes_read < out_length) {
         ssize_t recv_ret = recv(sock, (char*)&(out[bytes_read]), length_left, 0);
+        if (0 == recv_ret)
+            return TSS2_TCTI_RC_IO_ERROR;   // the server went away
         if (-1 == recv_ret) {
 #ifndef NDEBUG
             perror("recv_all");
@@ -0,0 +1,488 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_tcti_mux.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "internal/tcti_common.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+
+#define CACHE_LINE_SIZE 64
+#define SPIN_LIMIT 64   // times to yield, waiting for a response, before sleeping
+
+/*
+ * A queued command, and then its response.
+ *
+ * Embedded in the client context, so queueing never allocates.
+ */
+struct mux_request {
+    struct mux_request *next;
+    int done;       // response (or error) delivered, set under `lock`
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    TSS2_RC rc;
+    uint64_t response_start_ns;
+    size_t size;
+    uint8_t buffer[TPM2_MAX_RESPONSE_SIZE];     // the command, then the response
+};
+
+/*
+ * Intrusive multi-producer single-consumer queue (D. Vyukov's):
+ * producers only swap `tail`, and the single consumer (the current owner) owns `head`.
+ * The queue is empty when both point to `stub`.
+ *
+ * The fields written by producers and by the owner are kept on separate cache lines.
+ */
+struct TSS2_TCTI_MUX_CONTEXT {
+    struct mux_request *tail;
+    char pad0[CACHE_LINE_SIZE - sizeof(struct mux_request*)];
+    int owned;
+    char pad1[CACHE_LINE_SIZE - sizeof(int)];
+    struct mux_request *head;
+    struct mux_request stub;
+    TSS2_TCTI_CONTEXT *inner_context;
+};
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    TSS2_RC (*transmit)( TSS2_TCTI_CONTEXT *tctiContext, size_t size,
+            uint8_t *command);
+    TSS2_RC (*receive) (TSS2_TCTI_CONTEXT *tctiContext, size_t *size,
+            uint8_t *response, int32_t timeout);
+    TSS2_RC (*finalize) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*cancel) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*getPollHandles) (TSS2_TCTI_CONTEXT *tctiContext,
+            TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles);
+    TSS2_RC (*setLocality) (TSS2_TCTI_CONTEXT *tctiContext, uint8_t locality);
+    uint64_t response_start_ns;     // see TSS2_TCTI_CONTEXT_COMMON_XAPTUM
+    const struct xtpm_trace_hook *trace_hook;
+    TPM2_CC trace_command_code;     // of the last command sent, for tracing its response
+
+    TSS2_TCTI_MUX_CONTEXT *mux;
+    int in_flight;      // `request` is queued, or its response not yet collected
+    uint64_t transmit_start_ns;
+    struct mux_request request;
+} TSS2_TCTI_CONTEXT_OPAQUE_MUX;
+
+static
+TSS2_RC transmit_mux(TSS2_TCTI_CONTEXT *tcti_context,
+                     size_t size,
+                     uint8_t *command);
+
+static
+TSS2_RC receive_mux(TSS2_TCTI_CONTEXT *tcti_context,
+                    size_t *size,
+                    uint8_t *response,
+                    int32_t timeout);
+
+static
+TSS2_RC finalize_mux(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC cancel_mux(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC
+getPollHandles_mux(TSS2_TCTI_CONTEXT *tcti_context,
+                   TSS2_TCTI_POLL_HANDLE *handles,
+                   size_t *num_handles);
+
+static
+TSS2_RC
+setLocality_mux(TSS2_TCTI_CONTEXT *tcti_context,
+                uint8_t locality);
+
+static
+void push(TSS2_TCTI_MUX_CONTEXT *mux, struct mux_request *request);
+
+static
+struct mux_request *pop(TSS2_TCTI_MUX_CONTEXT *mux);
+
+static
+void drain(TSS2_TCTI_MUX_CONTEXT *mux);
+
+static
+int wait_done(struct mux_request *request, int32_t timeout);
+
+TSS2_RC
+Tss2_Tcti_Mux_Init(TSS2_TCTI_MUX_CONTEXT *mux_context,
+                   size_t *size,
+                   TSS2_TCTI_CONTEXT *inner_context)
+{
+    if (NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (NULL == mux_context) {
+        *size = sizeof(TSS2_TCTI_MUX_CONTEXT);
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (NULL == inner_context)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    memset(mux_context, 0, sizeof(TSS2_TCTI_MUX_CONTEXT));
+    mux_context->tail = &mux_context->stub;
+    mux_context->head = &mux_context->stub;
+    mux_context->owned = 0;
+    mux_context->inner_context = inner_context;
+
+    return TSS2_RC_SUCCESS;
+}
+
+void
+Tss2_Tcti_Mux_Finalize(TSS2_TCTI_MUX_CONTEXT *mux_context)
+{
+    if (NULL == mux_context)
+        return;
+
+    Tss2_Tcti_Finalize(mux_context->inner_context);
+}
+
+TSS2_RC
+Tss2_Tcti_Mux_Client_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                          size_t *size,
+                          TSS2_TCTI_MUX_CONTEXT *mux_context)
+{
+    if (NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (NULL == tcti_context) {
+        *size = sizeof(TSS2_TCTI_CONTEXT_OPAQUE_MUX);
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (NULL == mux_context)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    TSS2_TCTI_CONTEXT_OPAQUE_MUX *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_MUX*)tcti_context;
+
+    cast_context->magic = TCTI_MAGIC;
+    cast_context->version = TCTI_VERSION;
+    cast_context->transmit = transmit_mux;
+    cast_context->receive = receive_mux;
+    cast_context->finalize = finalize_mux;
+    cast_context->cancel = cancel_mux;
+    cast_context->getPollHandles = getPollHandles_mux;
+    cast_context->setLocality = setLocality_mux;
+    cast_context->response_start_ns = 0;
+    cast_context->trace_hook = NULL;
+    cast_context->trace_command_code = 0;
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_MUX, response_start_ns) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, response_start_ns));
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_MUX, trace_hook) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, trace_hook));
+
+    cast_context->mux = mux_context;
+    cast_context->in_flight = 0;
+    cast_context->transmit_start_ns = 0;
+
+    struct mux_request *request = &cast_context->request;
+    request->next = NULL;
+    request->done = 0;
+    request->size = 0;
+
+    if (0 != pthread_mutex_init(&request->lock, NULL))
+        return TSS2_TCTI_RC_GENERAL_FAILURE;
+
+    if (0 != pthread_cond_init(&request->cond, NULL)) {
+        pthread_mutex_destroy(&request->lock);
+        return TSS2_TCTI_RC_GENERAL_FAILURE;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC transmit_mux(TSS2_TCTI_CONTEXT *tcti_context,
+                     size_t size,
+                     uint8_t *command)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_MUX *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_MUX*)tcti_context;
+
+    if (cast_context->in_flight)
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+
+    struct mux_request *request = &cast_context->request;
+
+    if (size > sizeof(request->buffer))
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+
+    cast_context->transmit_start_ns = tcti_now_ns();
+
+    memcpy(request->buffer, command, size);
+    request->size = size;
+    __atomic_store_n(&request->done, 0, __ATOMIC_RELAXED);
+    cast_context->in_flight = 1;
+
+    push(cast_context->mux, request);
+
+    if (cast_context->trace_hook) {
+        cast_context->trace_command_code = tcti_command_code(command, size);
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_COMMAND, cast_context->trace_command_code,
+                   command, size, cast_context->transmit_start_ns, tcti_now_ns());
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC receive_mux(TSS2_TCTI_CONTEXT *tcti_context,
+                    size_t *size,
+                    uint8_t *response,
+                    int32_t timeout)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_MUX *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_MUX*)tcti_context;
+
+    if (NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (!cast_context->in_flight)
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+
+    struct mux_request *request = &cast_context->request;
+
+    // Send our command ourselves, unless some other client is already sending.
+    // Responses are often quick, so keep checking for a while before sleeping.
+    for (int spins = 0; spins < SPIN_LIMIT && !__atomic_load_n(&request->done, __ATOMIC_ACQUIRE); spins++) {
+        if (0 == timeout && 0 != spins)
+            break;
+        drain(cast_context->mux);
+        if (!__atomic_load_n(&request->done, __ATOMIC_ACQUIRE))
+            sched_yield();
+    }
+
+    if (0 != wait_done(request, timeout))
+        return TSS2_TCTI_RC_TRY_AGAIN;
+
+    if (TSS2_RC_SUCCESS != request->rc) {
+        cast_context->in_flight = 0;
+        return request->rc;
+    }
+
+    // Leave the response for a retry with a big enough buffer.
+    if (NULL == response) {
+        *size = request->size;
+        return TSS2_RC_SUCCESS;
+    }
+    if (*size < request->size)
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+
+    memcpy(response, request->buffer, request->size);
+    *size = request->size;
+    cast_context->response_start_ns = request->response_start_ns;
+    cast_context->in_flight = 0;
+
+    if (cast_context->trace_hook)
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_RESPONSE, cast_context->trace_command_code,
+                   response, *size, cast_context->response_start_ns, tcti_now_ns());
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC finalize_mux(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_MUX *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_MUX*)tcti_context;
+
+    struct mux_request *request = &cast_context->request;
+
+    // The request can't leave the queue while it's still in it.
+    if (cast_context->in_flight) {
+        if (!__atomic_load_n(&request->done, __ATOMIC_ACQUIRE))
+            drain(cast_context->mux);
+        wait_done(request, TSS2_TCTI_TIMEOUT_BLOCK);
+        cast_context->in_flight = 0;
+    }
+
+    pthread_cond_destroy(&request->cond);
+    pthread_mutex_destroy(&request->lock);
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC cancel_mux(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    (void)tcti_context;
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+TSS2_RC
+getPollHandles_mux(TSS2_TCTI_CONTEXT *tcti_context,
+                   TSS2_TCTI_POLL_HANDLE *handles,
+                   size_t *num_handles)
+{
+    (void)tcti_context;
+    (void)handles;
+    (void)num_handles;
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+TSS2_RC
+setLocality_mux(TSS2_TCTI_CONTEXT *tcti_context,
+                uint8_t locality)
+{
+    (void)tcti_context;
+    (void)locality;
+
+    // The locality would apply to every client's commands.
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+void push(TSS2_TCTI_MUX_CONTEXT *mux, struct mux_request *request)
+{
+    __atomic_store_n(&request->next, NULL, __ATOMIC_RELAXED);
+
+    struct mux_request *prev = __atomic_exchange_n(&mux->tail, request, __ATOMIC_SEQ_CST);
+
+    // Until this store, the consumer sees `prev` as the last request.
+    __atomic_store_n(&prev->next, request, __ATOMIC_RELEASE);
+}
+
+// Only called by the owner. Returns NULL if the queue is empty, or a push is half-done.
+struct mux_request *pop(TSS2_TCTI_MUX_CONTEXT *mux)
+{
+    struct mux_request *head = mux->head;
+    struct mux_request *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+    if (&mux->stub == head) {
+        if (NULL == next)
+            return NULL;
+        mux->head = next;
+        head = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (NULL != next) {
+        mux->head = next;
+        return head;
+    }
+
+    if (head != __atomic_load_n(&mux->tail, __ATOMIC_SEQ_CST))
+        return NULL;
+
+    // `head` is the last request: put the stub behind it, so it can be taken.
+    push(mux, &mux->stub);
+
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (NULL != next) {
+        mux->head = next;
+        return head;
+    }
+
+    return NULL;
+}
+
+/*
+ * Hand the response back to its client.
+ *
+ * This is the only lock taken, and it's the client's own: once the client sees `done`
+ * under it, the owner is finished with the request, so the client may reuse or finalize it.
+ */
+static
+void deliver(struct mux_request *request)
+{
+    pthread_mutex_lock(&request->lock);
+    __atomic_store_n(&request->done, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&request->cond);
+    pthread_mutex_unlock(&request->lock);
+}
+
+static
+void send_request(TSS2_TCTI_CONTEXT *inner_context, struct mux_request *request)
+{
+    request->rc = Tss2_Tcti_Transmit(inner_context, request->size, request->buffer);
+    if (TSS2_RC_SUCCESS == request->rc) {
+        request->size = sizeof(request->buffer);
+        request->rc = Tss2_Tcti_Receive(inner_context, &request->size, request->buffer, TSS2_TCTI_TIMEOUT_BLOCK);
+    }
+
+    // Pass on when the response started arriving, if the inner TCTI knows.
+    TSS2_TCTI_CONTEXT_COMMON_XAPTUM *inner = (TSS2_TCTI_CONTEXT_COMMON_XAPTUM*)inner_context;
+    if (TCTI_MAGIC == inner->v1.magic)
+        request->response_start_ns = inner->response_start_ns;
+    else
+        request->response_start_ns = tcti_now_ns();
+}
+
+/*
+ * Send every queued request, if no other client is already doing so.
+ *
+ * A request pushed while the owner is giving up ownership is not lost:
+ * either the owner sees it in `tail` after releasing, and tries to take ownership again,
+ * or the client that pushed it finds the queue unowned in its own call to `drain`.
+ */
+void drain(TSS2_TCTI_MUX_CONTEXT *mux)
+{
+    do {
+        if (__atomic_load_n(&mux->owned, __ATOMIC_SEQ_CST) ||
+                __atomic_exchange_n(&mux->owned, 1, __ATOMIC_SEQ_CST))
+            return;
+
+        for (;;) {
+            struct mux_request *request = pop(mux);
+            if (NULL != request) {
+                send_request(mux->inner_context, request);
+                deliver(request);
+            } else if (mux->head == __atomic_load_n(&mux->tail, __ATOMIC_SEQ_CST)) {
+                break;
+            }
+            // else: a push is half-done, so spin until it's finished
+        }
+
+        __atomic_store_n(&mux->owned, 0, __ATOMIC_SEQ_CST);
+    } while (&mux->stub != __atomic_load_n(&mux->tail, __ATOMIC_SEQ_CST));
+}
+
+// Returns non-zero if `timeout` (in ms) expired first.
+int wait_done(struct mux_request *request, int32_t timeout)
+{
+    struct timespec deadline;
+    if (0 < timeout) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long)(timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    int expired = 0;
+
+    pthread_mutex_lock(&request->lock);
+    while (!request->done && !expired) {
+        if (0 == timeout)
+            expired = 1;
+        else if (TSS2_TCTI_TIMEOUT_BLOCK == timeout)
+            pthread_cond_wait(&request->cond, &request->lock);
+        else
+            expired = (ETIMEDOUT == pthread_cond_timedwait(&request->cond, &request->lock, &deadline));
+    }
+    int done = request->done;
+    pthread_mutex_unlock(&request->lock);
+
+    return !done;
+}
@@ -0,0 +1,241 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_tcti_record.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "internal/tcti_common.h"
+#include "internal/recording.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    TSS2_RC (*transmit)( TSS2_TCTI_CONTEXT *tctiContext, size_t size,
+            uint8_t *command);
+    TSS2_RC (*receive) (TSS2_TCTI_CONTEXT *tctiContext, size_t *size,
+            uint8_t *response, int32_t timeout);
+    TSS2_RC (*finalize) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*cancel) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*getPollHandles) (TSS2_TCTI_CONTEXT *tctiContext,
+            TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles);
+    TSS2_RC (*setLocality) (TSS2_TCTI_CONTEXT *tctiContext, uint8_t locality);
+    uint64_t response_start_ns;     // see TSS2_TCTI_CONTEXT_COMMON_XAPTUM
+    const struct xtpm_trace_hook *trace_hook;
+    TPM2_CC trace_command_code;     // of the last command sent, for tracing its response
+
+    TSS2_TCTI_CONTEXT *inner_context;
+    FILE *file;
+    uint64_t transmit_start_ns;
+    uint32_t command_size;
+    uint8_t command[TPM2_MAX_COMMAND_SIZE];  // last command sent, to record with its response
+} TSS2_TCTI_CONTEXT_OPAQUE_RECORD;
+
+static
+TSS2_RC transmit_record(TSS2_TCTI_CONTEXT *tcti_context,
+                        size_t size,
+                        uint8_t *command);
+
+static
+TSS2_RC receive_record(TSS2_TCTI_CONTEXT *tcti_context,
+                       size_t *size,
+                       uint8_t *response,
+                       int32_t timeout);
+
+static
+TSS2_RC finalize_record(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC cancel_record(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC
+getPollHandles_record(TSS2_TCTI_CONTEXT *tcti_context,
+                      TSS2_TCTI_POLL_HANDLE *handles,
+                      size_t *num_handles);
+
+static
+TSS2_RC
+setLocality_record(TSS2_TCTI_CONTEXT *tcti_context,
+                   uint8_t locality);
+
+TSS2_RC
+Tss2_Tcti_Record_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                      size_t *size,
+                      TSS2_TCTI_CONTEXT *inner_context,
+                      const char *path)
+{
+    if (NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (NULL == tcti_context) {
+        *size = sizeof(TSS2_TCTI_CONTEXT_OPAQUE_RECORD);
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (NULL == inner_context || NULL == path)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    TSS2_TCTI_CONTEXT_OPAQUE_RECORD *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_RECORD*)tcti_context;
+
+    cast_context->magic = TCTI_MAGIC;
+    cast_context->version = TCTI_VERSION;
+    cast_context->transmit = transmit_record;
+    cast_context->receive = receive_record;
+    cast_context->finalize = finalize_record;
+    cast_context->cancel = cancel_record;
+    cast_context->getPollHandles = getPollHandles_record;
+    cast_context->setLocality = setLocality_record;
+    cast_context->response_start_ns = 0;
+    cast_context->trace_hook = NULL;
+    cast_context->trace_command_code = 0;
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_RECORD, response_start_ns) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, response_start_ns));
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_RECORD, trace_hook) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, trace_hook));
+
+    cast_context->inner_context = inner_context;
+    cast_context->transmit_start_ns = 0;
+    cast_context->command_size = 0;
+
+    cast_context->file = fopen(path, "wb");
+    if (NULL == cast_context->file)
+        return TSS2_TCTI_RC_IO_ERROR;
+
+    if (0 != write_recording_header(cast_context->file)) {
+        fclose(cast_context->file);
+        cast_context->file = NULL;
+        return TSS2_TCTI_RC_IO_ERROR;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+getPollHandles_record(TSS2_TCTI_CONTEXT *tcti_context,
+                      TSS2_TCTI_POLL_HANDLE *handles,
+                      size_t *num_handles)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_RECORD *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_RECORD*)tcti_context;
+
+    return Tss2_Tcti_GetPollHandles(cast_context->inner_context, handles, num_handles);
+}
+
+TSS2_RC
+setLocality_record(TSS2_TCTI_CONTEXT *tcti_context,
+                   uint8_t locality)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_RECORD *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_RECORD*)tcti_context;
+
+    return Tss2_Tcti_SetLocality(cast_context->inner_context, locality);
+}
+
+TSS2_RC transmit_record(TSS2_TCTI_CONTEXT *tcti_context,
+                        size_t size,
+                        uint8_t *command)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_RECORD *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_RECORD*)tcti_context;
+
+    if (size > sizeof(cast_context->command))
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+
+    memcpy(cast_context->command, command, size);
+    cast_context->command_size = (uint32_t)size;
+
+    cast_context->transmit_start_ns = tcti_now_ns();
+
+    TSS2_RC ret = Tss2_Tcti_Transmit(cast_context->inner_context, size, command);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    if (cast_context->trace_hook) {
+        cast_context->trace_command_code = tcti_command_code(command, size);
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_COMMAND, cast_context->trace_command_code,
+                   command, size, cast_context->transmit_start_ns, tcti_now_ns());
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC receive_record(TSS2_TCTI_CONTEXT *tcti_context,
+                       size_t *size,
+                       uint8_t *response,
+                       int32_t timeout)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_RECORD *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_RECORD*)tcti_context;
+
+    TSS2_RC ret = Tss2_Tcti_Receive(cast_context->inner_context, size, response, timeout);
+
+    // Not ready yet: the response will be recorded when it is.
+    if (TSS2_TCTI_RC_TRY_AGAIN == ret)
+        return ret;
+
+    uint64_t receive_end_ns = tcti_now_ns();
+
+    // Pass on when the response started arriving, if the inner TCTI knows.
+    TSS2_TCTI_CONTEXT_COMMON_XAPTUM *inner = (TSS2_TCTI_CONTEXT_COMMON_XAPTUM*)cast_context->inner_context;
+    if (TCTI_MAGIC == inner->v1.magic)
+        cast_context->response_start_ns = inner->response_start_ns;
+    else
+        cast_context->response_start_ns = receive_end_ns;
+
+    uint32_t response_size = TSS2_RC_SUCCESS == ret ? (uint32_t)*size : 0;
+
+    if (0 != write_recording_entry(cast_context->file,
+                                   cast_context->command,
+                                   cast_context->command_size,
+                                   ret,
+                                   response,
+                                   response_size,
+                                   receive_end_ns - cast_context->transmit_start_ns))
+        return TSS2_TCTI_RC_IO_ERROR;
+
+    if (TSS2_RC_SUCCESS == ret && cast_context->trace_hook)
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_RESPONSE, cast_context->trace_command_code,
+                   response, *size, cast_context->response_start_ns, receive_end_ns);
+
+    return ret;
+}
+
+TSS2_RC finalize_record(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_RECORD *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_RECORD*)tcti_context;
+
+    TSS2_RC ret = TSS2_RC_SUCCESS;
+
+    if (NULL != cast_context->file) {
+        if (0 != fclose(cast_context->file))
+            ret = TSS2_TCTI_RC_IO_ERROR;
+        cast_context->file = NULL;
+    }
+
+    Tss2_Tcti_Finalize(cast_context->inner_context);
+
+    return ret;
+}
+
+TSS2_RC cancel_record(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_RECORD *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_RECORD*)tcti_context;
+
+    return Tss2_Tcti_Cancel(cast_context->inner_context);
+}
@@ -0,0 +1,284 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_tcti_replay.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "internal/tcti_common.h"
+#include "internal/recording.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#define MAX_PATH_LENGTH 256
+
+typedef struct {
+    uint64_t magic;
+    uint32_t version;
+    TSS2_RC (*transmit)( TSS2_TCTI_CONTEXT *tctiContext, size_t size,
+            uint8_t *command);
+    TSS2_RC (*receive) (TSS2_TCTI_CONTEXT *tctiContext, size_t *size,
+            uint8_t *response, int32_t timeout);
+    TSS2_RC (*finalize) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*cancel) (TSS2_TCTI_CONTEXT *tctiContext);
+    TSS2_RC (*getPollHandles) (TSS2_TCTI_CONTEXT *tctiContext,
+            TSS2_TCTI_POLL_HANDLE *handles, size_t *num_handles);
+    TSS2_RC (*setLocality) (TSS2_TCTI_CONTEXT *tctiContext, uint8_t locality);
+    uint64_t response_start_ns;     // see TSS2_TCTI_CONTEXT_COMMON_XAPTUM
+    const struct xtpm_trace_hook *trace_hook;
+    TPM2_CC trace_command_code;     // of the last command sent, for tracing its response
+
+    FILE *file;
+    int original_timing;
+    int pending;                    // `entry` has been matched by transmit but not yet received
+    uint64_t transmit_start_ns;
+    struct recording_entry entry;
+} TSS2_TCTI_CONTEXT_OPAQUE_REPLAY;
+
+static
+TSS2_RC transmit_replay(TSS2_TCTI_CONTEXT *tcti_context,
+                        size_t size,
+                        uint8_t *command);
+
+static
+TSS2_RC receive_replay(TSS2_TCTI_CONTEXT *tcti_context,
+                       size_t *size,
+                       uint8_t *response,
+                       int32_t timeout);
+
+static
+TSS2_RC finalize_replay(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC cancel_replay(TSS2_TCTI_CONTEXT *tcti_context);
+
+static
+TSS2_RC
+getPollHandles_replay(TSS2_TCTI_CONTEXT *tcti_context,
+                      TSS2_TCTI_POLL_HANDLE *handles,
+                      size_t *num_handles);
+
+static
+TSS2_RC
+setLocality_replay(TSS2_TCTI_CONTEXT *tcti_context,
+                   uint8_t locality);
+
+TSS2_RC
+Tss2_Tcti_Replay_Init(TSS2_TCTI_CONTEXT *tcti_context,
+                      size_t *size,
+                      const char *conf)
+{
+    if (NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (NULL == tcti_context) {
+        *size = sizeof(TSS2_TCTI_CONTEXT_OPAQUE_REPLAY);
+        return TSS2_RC_SUCCESS;
+    }
+
+    if (NULL == conf)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    TSS2_TCTI_CONTEXT_OPAQUE_REPLAY *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_REPLAY*)tcti_context;
+
+    cast_context->magic = TCTI_MAGIC;
+    cast_context->version = TCTI_VERSION;
+    cast_context->transmit = transmit_replay;
+    cast_context->receive = receive_replay;
+    cast_context->finalize = finalize_replay;
+    cast_context->cancel = cancel_replay;
+    cast_context->getPollHandles = getPollHandles_replay;
+    cast_context->setLocality = setLocality_replay;
+    cast_context->response_start_ns = 0;
+    cast_context->trace_hook = NULL;
+    cast_context->trace_command_code = 0;
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_REPLAY, response_start_ns) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, response_start_ns));
+    assert(offsetof(TSS2_TCTI_CONTEXT_OPAQUE_REPLAY, trace_hook) ==
+            offsetof(TSS2_TCTI_CONTEXT_COMMON_XAPTUM, trace_hook));
+
+    cast_context->file = NULL;
+    cast_context->original_timing = 0;
+    cast_context->pending = 0;
+    cast_context->transmit_start_ns = 0;
+
+    char *path = NULL;
+    char conf_buf[MAX_PATH_LENGTH + 32];
+    if (strlen(conf) >= sizeof(conf_buf))
+        return TSS2_TCTI_RC_BAD_VALUE;
+    strcpy(conf_buf, conf);
+
+    for (char *key = strtok(conf_buf, ","); key; key = strtok(NULL, ",")) {
+        char *equals = strchr(key, '=');
+        if (NULL == equals)
+            return TSS2_TCTI_RC_BAD_VALUE;
+        *equals = 0;
+        if (0 == strcmp(key, "file")) {
+            path = equals + 1;
+        } else if (0 == strcmp(key, "timing")) {
+            if (0 != strcmp(equals + 1, "original"))
+                return TSS2_TCTI_RC_BAD_VALUE;
+            cast_context->original_timing = 1;
+        } else {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+    }
+
+    if (NULL == path)
+        return TSS2_TCTI_RC_BAD_VALUE;
+
+    cast_context->file = fopen(path, "rb");
+    if (NULL == cast_context->file)
+        return TSS2_TCTI_RC_IO_ERROR;
+
+    if (0 != read_recording_header(cast_context->file)) {
+        fclose(cast_context->file);
+        cast_context->file = NULL;
+        return TSS2_TCTI_RC_IO_ERROR;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+getPollHandles_replay(TSS2_TCTI_CONTEXT *tcti_context,
+                      TSS2_TCTI_POLL_HANDLE *handles,
+                      size_t *num_handles)
+{
+    (void)tcti_context;
+    (void)handles;
+    (void)num_handles;
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+TSS2_RC
+setLocality_replay(TSS2_TCTI_CONTEXT *tcti_context,
+                   uint8_t locality)
+{
+    (void)tcti_context;
+    (void)locality;
+
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
+
+TSS2_RC transmit_replay(TSS2_TCTI_CONTEXT *tcti_context,
+                        size_t size,
+                        uint8_t *command)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_REPLAY *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_REPLAY*)tcti_context;
+
+    if (cast_context->pending)
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+
+    cast_context->transmit_start_ns = tcti_now_ns();
+
+    if (0 != read_recording_entry(cast_context->file, &cast_context->entry))
+        return TSS2_TCTI_RC_IO_ERROR;
+
+    // The caller has diverged from the recording, so its responses no longer apply.
+    if (size != cast_context->entry.command_size ||
+            0 != memcmp(command, cast_context->entry.command, size))
+        return TSS2_TCTI_RC_GENERAL_FAILURE;
+
+    cast_context->pending = 1;
+
+    if (cast_context->trace_hook) {
+        cast_context->trace_command_code = tcti_command_code(command, size);
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_COMMAND, cast_context->trace_command_code,
+                   command, size, cast_context->transmit_start_ns, tcti_now_ns());
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+void
+sleep_until_ns(uint64_t deadline_ns)
+{
+    uint64_t now_ns = tcti_now_ns();
+    if (now_ns >= deadline_ns)
+        return;
+
+    uint64_t delay_ns = deadline_ns - now_ns;
+    struct timespec ts = {.tv_sec = delay_ns / 1000000000,
+                          .tv_nsec = delay_ns % 1000000000};
+    while (0 != nanosleep(&ts, &ts))
+        ;
+}
+
+TSS2_RC receive_replay(TSS2_TCTI_CONTEXT *tcti_context,
+                       size_t *size,
+                       uint8_t *response,
+                       int32_t timeout)
+{
+    (void)timeout;
+
+    TSS2_TCTI_CONTEXT_OPAQUE_REPLAY *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_REPLAY*)tcti_context;
+
+    if (NULL == response || NULL == size)
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+
+    if (!cast_context->pending)
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+
+    cast_context->pending = 0;
+
+    if (cast_context->original_timing)
+        sleep_until_ns(cast_context->transmit_start_ns + cast_context->entry.latency_ns);
+
+    cast_context->response_start_ns = tcti_now_ns();
+
+    if (TSS2_RC_SUCCESS != cast_context->entry.rc)
+        return cast_context->entry.rc;
+
+    if (*size < cast_context->entry.response_size) {
+        *size = 0;
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+    }
+
+    memcpy(response, cast_context->entry.response, cast_context->entry.response_size);
+    *size = cast_context->entry.response_size;
+
+    if (cast_context->trace_hook)
+        tcti_trace(cast_context->trace_hook, XTPM_TRACE_RESPONSE, cast_context->trace_command_code,
+                   response, *size, cast_context->response_start_ns, tcti_now_ns());
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC finalize_replay(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    TSS2_TCTI_CONTEXT_OPAQUE_REPLAY *cast_context = (TSS2_TCTI_CONTEXT_OPAQUE_REPLAY*)tcti_context;
+
+    if (NULL != cast_context->file) {
+        fclose(cast_context->file);
+        cast_context->file = NULL;
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC cancel_replay(TSS2_TCTI_CONTEXT *tcti_context)
+{
+    (void)tcti_context;
+    return TSS2_TCTI_RC_NOT_IMPLEMENTED;
+}
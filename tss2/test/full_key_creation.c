@@ -27,8 +27,7 @@ struct test_context {
     TPM2_HANDLE persistent_key_handle;
     TPM2B_PUBLIC out_public;
     TPM2B_PRIVATE out_private;
-    unsigned char tcti_buffer[256];
-    unsigned char sapi_buffer[4200];
+    unsigned char sapi_buffer[4608];
 
 };
 
@@ -73,47 +72,10 @@ int main()
 
 void initialize(struct test_context *ctx)
 {
-    const char *mssim_conf = "host=localhost,port=2321";
-    const char *device_conf = "/dev/tpm0";
-
     int init_ret;
 
-    TSS2_TCTI_CONTEXT *tcti_ctx = (TSS2_TCTI_CONTEXT*)ctx->tcti_buffer;
-#ifdef USE_TCP_TPM
-    (void)device_conf;
-    size_t size;
-    init_ret = Tss2_Tcti_Mssim_Init(NULL, &size, mssim_conf);
-    if (TSS2_RC_SUCCESS != init_ret) {
-        printf("Error: failed to get allocation size for tcti context\n");
-        exit(1);
-    }
-    if (size > sizeof(ctx->tcti_buffer)) {
-        printf("Error: socket TCTI context size larger than pre-allocated buffer\n");
-        exit(1);
-    }
-    init_ret = Tss2_Tcti_Mssim_Init(tcti_ctx, &size, mssim_conf);
-    if (TSS2_RC_SUCCESS != init_ret) {
-        printf("Error: Unable to initialize socket TCTI context\n");
-        exit(1);
-    }
-#else
-    (void)mssim_conf;
-    size_t size;
-    init_ret = Tss2_Tcti_Device_Init(NULL, &size, device_conf);
-    if (TSS2_RC_SUCCESS != init_ret) {
-        printf("Failed to get allocation size for tcti context\n");
-        exit(1);
-    }
-    if (size > sizeof(ctx->tcti_buffer)) {
-        printf("Error: device TCTI context size larger than pre-allocated buffer\n");
-        exit(1);
-    }
-    init_ret = Tss2_Tcti_Device_Init(tcti_ctx, &size, device_conf);
-    if (TSS2_RC_SUCCESS != init_ret) {
-        printf("Error: Unable to initialize device TCTI context\n");
-        exit(1);
-    }
-#endif
+    TSS2_TCTI_CONTEXT *tcti_ctx;
+    init_tcti(&tcti_ctx);
 
     ctx->sapi_ctx = (TSS2_SYS_CONTEXT*)ctx->sapi_buffer;
     size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
@@ -139,6 +101,7 @@ void cleanup(struct test_context *ctx)
         TEST_ASSERT(TSS2_RC_SUCCESS == rc);
 
         Tss2_Tcti_Finalize(tcti_context);
+        free(tcti_context);
 
         Tss2_Sys_Finalize(ctx->sapi_ctx);
     }
@@ -0,0 +1,155 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+/*
+ * TCTI selection shared by the tests and the benchmarks.
+ *
+ * The including file defines TCTI_UTILS_ASSERT (its own assert macro) and the
+ * mssim_conf_g and dev_file_path_g globals before including this header.
+ */
+
+#ifndef XAPTUM_TPM_TCTI_UTILS_H
+#define XAPTUM_TPM_TCTI_UTILS_H
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tss2_tcti_mssim.h>
+#include <tss2/tss2_tcti_device.h>
+#ifdef USE_LOOPBACK_TPM
+#include <tss2/tss2_tcti_loopback.h>
+#endif
+#ifdef TCTI_RECORD_REPLAY
+#include <tss2/tss2_tcti_record.h>
+#include <tss2/tss2_tcti_replay.h>
+#endif
+
+#ifndef TCTI_UTILS_ASSERT
+#error "define TCTI_UTILS_ASSERT before including tcti-utils.h"
+#endif
+
+#ifdef TCTI_RECORD_REPLAY
+/*
+ * Recordings for the record and replay TCTIs are named
+ * <dir>/<source file name>.<n>.rec, for the n-th TCTI opened by the program.
+ */
+static inline
+void recording_path(char *path,
+                    size_t path_size,
+                    const char *dir,
+                    const char *source_file)
+{
+    static unsigned count = 0;
+
+    const char *name = strrchr(source_file, '/');
+    name = (NULL != name) ? name + 1 : source_file;
+
+    int ret = snprintf(path, path_size, "%s/%.*s.%u.rec", dir, (int)strcspn(name, "."), name, count++);
+    TCTI_UTILS_ASSERT(0 < ret && (size_t)ret < path_size);
+}
+#endif
+
+#define init_tcti(tcti_ctx) init_tcti_for(tcti_ctx, __FILE__)
+
+static inline
+void init_tcti_for(TSS2_TCTI_CONTEXT **tcti_ctx, const char *source_file)
+{
+    TSS2_RC init_ret;
+    size_t ctx_size;
+    size_t record_size = 0;     // room for a record TCTI in front of the real one
+    TSS2_TCTI_CONTEXT *inner;
+
+#ifdef TCTI_RECORD_REPLAY
+    char path[512];
+
+    // XTPM_TCTI_REPLAY_DIR: replay recordings instead of using a TPM
+    // (with XTPM_TCTI_REPLAY_TIMING set, at the recorded speed).
+    const char *replay_dir = getenv("XTPM_TCTI_REPLAY_DIR");
+    if (NULL != replay_dir) {
+        char conf[sizeof(path) + 32];
+        recording_path(path, sizeof(path), replay_dir, source_file);
+        snprintf(conf, sizeof(conf), "file=%s%s", path, getenv("XTPM_TCTI_REPLAY_TIMING") ? ",timing=original" : "");
+
+        init_ret = Tss2_Tcti_Replay_Init(NULL, &ctx_size, conf);
+        TCTI_UTILS_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+        *tcti_ctx = calloc(ctx_size, 1);
+        TCTI_UTILS_ASSERT(NULL != *tcti_ctx);
+
+        init_ret = Tss2_Tcti_Replay_Init(*tcti_ctx, &ctx_size, conf);
+        TCTI_UTILS_ASSERT(TSS2_RC_SUCCESS == init_ret);
+        return;
+    }
+
+    // XTPM_TCTI_RECORD_DIR: record the traffic to the TPM.
+    const char *record_dir = getenv("XTPM_TCTI_RECORD_DIR");
+    if (NULL != record_dir)
+        Tss2_Tcti_Record_Init(NULL, &record_size, NULL, NULL);
+#else
+    (void)source_file;
+#endif
+
+#ifdef USE_TCP_TPM
+    init_ret = Tss2_Tcti_Mssim_Init(NULL, &ctx_size, mssim_conf_g);
+    TCTI_UTILS_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    *tcti_ctx = calloc(record_size + ctx_size, 1);
+    TCTI_UTILS_ASSERT(NULL != *tcti_ctx);
+    inner = (TSS2_TCTI_CONTEXT*)((uint8_t*)*tcti_ctx + record_size);
+
+    init_ret = Tss2_Tcti_Mssim_Init(inner, &ctx_size, mssim_conf_g);
+    TCTI_UTILS_ASSERT(TSS2_RC_SUCCESS == init_ret);
+#elif defined(USE_LOOPBACK_TPM)
+    // XTPM_TCTI_LOOPBACK_CONF: e.g. "latency_us=<n>", to add a delay to each command
+    const char *loopback_conf = getenv("XTPM_TCTI_LOOPBACK_CONF");
+    init_ret = Tss2_Tcti_Loopback_Init(NULL, &ctx_size, loopback_conf);
+    TCTI_UTILS_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    *tcti_ctx = calloc(record_size + ctx_size, 1);
+    TCTI_UTILS_ASSERT(NULL != *tcti_ctx);
+    inner = (TSS2_TCTI_CONTEXT*)((uint8_t*)*tcti_ctx + record_size);
+
+    init_ret = Tss2_Tcti_Loopback_Init(inner, &ctx_size, loopback_conf);
+    TCTI_UTILS_ASSERT(TSS2_RC_SUCCESS == init_ret);
+#else
+    init_ret = Tss2_Tcti_Device_Init(NULL, &ctx_size, dev_file_path_g);
+    TCTI_UTILS_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    *tcti_ctx = calloc(record_size + ctx_size, 1);
+    TCTI_UTILS_ASSERT(NULL != *tcti_ctx);
+    inner = (TSS2_TCTI_CONTEXT*)((uint8_t*)*tcti_ctx + record_size);
+
+    init_ret = Tss2_Tcti_Device_Init(inner, &ctx_size, dev_file_path_g);
+    TCTI_UTILS_ASSERT(TSS2_RC_SUCCESS == init_ret);
+#endif
+
+#ifdef TCTI_RECORD_REPLAY
+    if (NULL != record_dir) {
+        recording_path(path, sizeof(path), record_dir, source_file);
+        init_ret = Tss2_Tcti_Record_Init(*tcti_ctx, &record_size, inner, path);
+        TCTI_UTILS_ASSERT(TSS2_RC_SUCCESS == init_ret);
+    }
+#else
+    (void)inner;
+#endif
+}
+
+#endif
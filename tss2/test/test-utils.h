@@ -18,9 +18,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include <tss2/tss2_tcti_mssim.h>
-#include <tss2/tss2_tcti_device.h>
 #include <tss2/tss2_sys.h>
 
 char *mssim_conf_g = "host=localhost,port=2321";
@@ -80,32 +79,18 @@ char *handle_filename_g = "handle.txt";
     .count = 1                          \
 }
 
+#define TCTI_UTILS_ASSERT TEST_ASSERT
+#include "tcti-utils.h"
+
+#define init_sapi(sapi_ctx) init_sapi_for(sapi_ctx, __FILE__)
+
 static inline
-void init_sapi(TSS2_SYS_CONTEXT **sapi_ctx)
+void init_sapi_for(TSS2_SYS_CONTEXT **sapi_ctx, const char *source_file)
 {
     TSS2_RC init_ret;
 
-#ifdef USE_TCP_TPM
-    size_t ctx_size;
-    init_ret = Tss2_Tcti_Mssim_Init(NULL, &ctx_size, mssim_conf_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-
-    TSS2_TCTI_CONTEXT * tcti_ctx = malloc(ctx_size);
-    TEST_ASSERT(NULL != tcti_ctx);
-
-    init_ret = Tss2_Tcti_Mssim_Init(tcti_ctx, &ctx_size, mssim_conf_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-#else
-    size_t ctx_size;
-    init_ret = Tss2_Tcti_Device_Init(NULL, &ctx_size, mssim_conf_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-
-    TSS2_TCTI_CONTEXT * tcti_ctx = malloc(ctx_size);
-    TEST_ASSERT(NULL != tcti_ctx);
-
-    init_ret = Tss2_Tcti_Device_Init(tcti_ctx, &ctx_size, dev_file_path_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-#endif
+    TSS2_TCTI_CONTEXT *tcti_ctx;
+    init_tcti_for(&tcti_ctx, source_file);
 
     size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
 
@@ -17,12 +17,12 @@
  *****************************************************************************/
 
 #include <tss2/tss2_sys.h>
-#include <tss2/tss2_tcti_mssim.h>
-#include <tss2/tss2_tcti_device.h>
 
 #include "test-utils.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 struct test_context {
     TSS2_SYS_CONTEXT *sapi_ctx;
@@ -32,51 +32,23 @@ static void initialize(struct test_context *ctx);
 static void cleanup(struct test_context *ctx);
 
 static void init_test();
+static void retry_policy_test();
+static void retry_slots_test();
+static void nonblocking_retry_test();
 
 int main(int argc, char *argv[])
 {
     parse_cmd_args(argc, argv);
 
     init_test();
+    retry_policy_test();
+    retry_slots_test();
+    nonblocking_retry_test();
 }
 
 void initialize(struct test_context *ctx)
 {
-    TSS2_RC init_ret;
-
-#ifdef USE_TCP_TPM
-    size_t ctx_size;
-    init_ret = Tss2_Tcti_Mssim_Init(NULL, &ctx_size, mssim_conf_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-
-    TSS2_TCTI_CONTEXT * tcti_ctx = malloc(ctx_size);
-    TEST_ASSERT(NULL != tcti_ctx);
-
-    init_ret = Tss2_Tcti_Mssim_Init(tcti_ctx, &ctx_size, mssim_conf_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-#else
-    size_t ctx_size;
-    init_ret = Tss2_Tcti_Device_Init(NULL, &ctx_size, mssim_conf_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-
-    TSS2_TCTI_CONTEXT * tcti_ctx = malloc(ctx_size);
-    TEST_ASSERT(NULL != tcti_ctx);
-
-    init_ret = Tss2_Tcti_Device_Init(tcti_ctx, &ctx_size, dev_file_path_g);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
-#endif
-
-    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
-
-    ctx->sapi_ctx = malloc(sapi_ctx_size);
-    TEST_EXPECT(NULL != ctx->sapi_ctx);
-
-    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
-    init_ret = Tss2_Sys_Initialize(ctx->sapi_ctx,
-                                   sapi_ctx_size,
-                                   tcti_ctx,
-                                   &abi_version);
-    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+    init_sapi(&ctx->sapi_ctx);
 }
 
 void cleanup(struct test_context *ctx)
@@ -107,3 +79,167 @@ void init_test()
     printf("ok\n");
 }
 
+
+void retry_policy_test()
+{
+    printf("In tss2_sys_context-test::retry_policy_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TSS2_SYS_RETRY_COUNTERS counters = {.retries = 1, .exhausted = 1};
+    TSS2_RC rc = Tss2_Sys_GetRetryCounters(ctx.sapi_ctx, TPM2_CC_Sign, &counters);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+    TEST_ASSERT(0 == counters.retries);
+    TEST_ASSERT(0 == counters.exhausted);
+
+    rc = Tss2_Sys_GetRetryCounters(ctx.sapi_ctx, 0x1, &counters);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_VALUE == rc);
+
+    TSS2_SYS_RETRY_POLICY bad_policy = {.maxRetries = 3, .initialDelayUs = 1000, .maxDelayUs = 10};
+    rc = Tss2_Sys_SetRetryPolicy(ctx.sapi_ctx, &bad_policy);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_VALUE == rc);
+
+    TSS2_SYS_RETRY_POLICY disabled = {.maxRetries = 0};
+    rc = Tss2_Sys_SetRetryPolicy(ctx.sapi_ctx, &disabled);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+// Answers every other command with TPM_RC_RETRY, and the rest with an empty success.
+struct warning_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V1 v1;
+    unsigned responses;
+};
+
+static
+TSS2_RC warning_transmit(TSS2_TCTI_CONTEXT *tcti_context, size_t size, uint8_t *command)
+{
+    (void)tcti_context;
+    (void)size;
+    (void)command;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC warning_receive(TSS2_TCTI_CONTEXT *tcti_context, size_t *size, uint8_t *response, int32_t timeout)
+{
+    (void)timeout;
+
+    struct warning_tcti *tcti = (struct warning_tcti*)tcti_context;
+    if (*size < 10)
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+
+    TSS2_RC rc = (tcti->responses++ % 2) ? TSS2_RC_SUCCESS : TPM_RC_RETRY;
+    const uint8_t header[10] = {TPM2_ST_NO_SESSIONS >> 8, TPM2_ST_NO_SESSIONS & 0xFF,
+                                0, 0, 0, 10,
+                                rc >> 24, (rc >> 16) & 0xFF, (rc >> 8) & 0xFF, rc & 0xFF};
+    memcpy(response, header, sizeof(header));
+    *size = sizeof(header);
+
+    return TSS2_RC_SUCCESS;
+}
+
+void retry_slots_test()
+{
+    printf("In tss2_sys_context-test::retry_slots_test...\n");
+
+    struct warning_tcti tcti = {.v1 = {.version = 1,
+                                       .transmit = warning_transmit,
+                                       .receive = warning_receive}};
+
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    TSS2_SYS_CONTEXT *sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TSS2_RC rc = Tss2_Sys_Initialize(sapi_ctx, sapi_ctx_size, (TSS2_TCTI_CONTEXT*)&tcti, &abi_version);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+    TSS2_SYS_RETRY_POLICY fast = {.maxRetries = 2, .initialDelayUs = 1, .maxDelayUs = 1};
+    rc = Tss2_Sys_SetRetryPolicy(sapi_ctx, &fast);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+    // Five different commands, each retried once (their empty responses don't unmarshal).
+    TPM2B_DIGEST random_bytes;
+    (void)Tss2_Sys_GetRandom(sapi_ctx, NULL, 8, &random_bytes, NULL);
+    TPMS_CONTEXT context;
+    (void)Tss2_Sys_ContextSave(sapi_ctx, TPM2_HR_TRANSIENT, &context);
+    (void)Tss2_Sys_FlushContext(sapi_ctx, TPM2_HR_TRANSIENT);
+    TPMI_YES_NO more_data;
+    TPMS_CAPABILITY_DATA capability_data;
+    (void)Tss2_Sys_GetCapability(sapi_ctx, NULL, TPM2_CAP_HANDLES, TPM2_HR_TRANSIENT, 1, &more_data, &capability_data, NULL);
+    TPM2B_PUBLIC public_area;
+    TPM2B_NAME name;
+    TPM2B_NAME qualified_name;
+    (void)Tss2_Sys_ReadPublic(sapi_ctx, TPM2_HR_TRANSIENT, NULL, &public_area, &name, &qualified_name, NULL);
+    TEST_ASSERT(10 == tcti.responses);
+
+    // Only the most recently retried ones still have their counters.
+    TSS2_SYS_RETRY_COUNTERS counters;
+    rc = Tss2_Sys_GetRetryCounters(sapi_ctx, TPM2_CC_ReadPublic, &counters);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+    TEST_ASSERT(1 == counters.retries);
+    rc = Tss2_Sys_GetRetryCounters(sapi_ctx, TPM2_CC_ContextSave, &counters);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+    TEST_ASSERT(1 == counters.retries);
+    rc = Tss2_Sys_GetRetryCounters(sapi_ctx, TPM2_CC_GetRandom, &counters);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+    TEST_ASSERT(0 == counters.retries);
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void nonblocking_retry_test()
+{
+    printf("In tss2_sys_context-test::nonblocking_retry_test...\n");
+
+    struct warning_tcti tcti = {.v1 = {.version = 1,
+                                       .transmit = warning_transmit,
+                                       .receive = warning_receive}};
+
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    TSS2_SYS_CONTEXT *sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TSS2_RC rc = Tss2_Sys_Initialize(sapi_ctx, sapi_ctx_size, (TSS2_TCTI_CONTEXT*)&tcti, &abi_version);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+    // Long enough that sleeping even once would be noticed.
+    TSS2_SYS_RETRY_POLICY slow = {.maxRetries = 2, .initialDelayUs = 5000000, .maxDelayUs = 5000000};
+    rc = Tss2_Sys_SetRetryPolicy(sapi_ctx, &slow);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    rc = Tss2_Sys_NV_Read_Prepare(sapi_ctx, 0x1410000, 0x1410000, 8, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+    rc = Tss2_Sys_ExecuteAsync(sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+    rc = Tss2_Sys_ExecuteFinish(sapi_ctx, 0);
+    TEST_ASSERT(TPM_RC_RETRY == rc);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    TEST_ASSERT(end.tv_sec - start.tv_sec < 2);
+    TEST_ASSERT(1 == tcti.responses);
+
+    TSS2_SYS_RETRY_COUNTERS counters;
+    rc = Tss2_Sys_GetRetryCounters(sapi_ctx, TPM2_CC_NV_Read, &counters);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+    TEST_ASSERT(0 == counters.retries);
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    printf("ok\n");
+}
@@ -0,0 +1,251 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include "test-utils.h"
+
+const TPMA_OBJECT parent_attrs = TPMA_OBJECT_FIXEDTPM | TPMA_OBJECT_FIXEDPARENT | TPMA_OBJECT_SENSITIVEDATAORIGIN | TPMA_OBJECT_USERWITHAUTH | TPMA_OBJECT_DECRYPT | TPMA_OBJECT_RESTRICTED;
+const TPMA_OBJECT obj_attrs = TPMA_OBJECT_FIXEDTPM | TPMA_OBJECT_FIXEDPARENT | TPMA_OBJECT_SENSITIVEDATAORIGIN | TPMA_OBJECT_USERWITHAUTH | TPMA_OBJECT_SIGN_ENCRYPT;
+
+struct test_context {
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    TPM2_HANDLE parent_handle;
+};
+
+static void initialize(struct test_context *ctx);
+static void cleanup(struct test_context *ctx);
+static int clear(struct test_context *ctx);
+static int createprimary(struct test_context *ctx);
+static int createloaded(struct test_context *ctx, TPM2_HANDLE *handle_out, TPM2B_PUBLIC *public_out);
+
+static void createloaded_test();
+static void context_test();
+
+int main(int argc, char *argv[])
+{
+    parse_cmd_args(argc, argv);
+
+    createloaded_test();
+    context_test();
+}
+
+void initialize(struct test_context *ctx)
+{
+    init_sapi(&ctx->sapi_ctx);
+
+    TEST_ASSERT(0 == createprimary(ctx));
+}
+
+void cleanup(struct test_context *ctx)
+{
+    TSS2_TCTI_CONTEXT *tcti_context = NULL;
+
+    if (ctx->sapi_ctx != NULL) {
+        TSS2_RC rc = Tss2_Sys_GetTctiContext(ctx->sapi_ctx, &tcti_context);
+        TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+        Tss2_Tcti_Finalize(tcti_context);
+        free(tcti_context);
+
+        Tss2_Sys_Finalize(ctx->sapi_ctx);
+        free(ctx->sapi_ctx);
+    }
+}
+
+int createprimary(struct test_context *ctx)
+{
+    TEST_ASSERT(0 == clear(ctx));
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPM2B_SENSITIVE_CREATE inSensitive = {};
+
+    TPM2B_PUBLIC in_public = {.publicArea = {.type=TPM2_ALG_ECC,
+                                             .nameAlg=TPM2_ALG_SHA256,
+                                             .objectAttributes=parent_attrs}};
+    in_public.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_AES;
+    in_public.publicArea.parameters.eccDetail.symmetric.keyBits.aes = 128;
+    in_public.publicArea.parameters.eccDetail.symmetric.mode.sym = TPM2_ALG_CFB;
+    in_public.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    in_public.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+
+    TPM2B_DATA outsideInfo = {};
+
+    TPML_PCR_SELECTION creationPCR = {};
+
+    TPM2B_CREATION_DATA creationData = {};
+    TPM2B_DIGEST creationHash = {};
+    TPMT_TK_CREATION creationTicket = {};
+
+    TPM2B_NAME name = {};
+
+    TPM2B_PUBLIC public_key;
+
+    TSS2_RC ret = Tss2_Sys_CreatePrimary(ctx->sapi_ctx,
+                                         TPM2_RH_OWNER,
+                                         &sessionsData,
+                                         &inSensitive,
+                                         &in_public,
+                                         &outsideInfo,
+                                         &creationPCR,
+                                         &ctx->parent_handle,
+                                         &public_key,
+                                         &creationData,
+                                         &creationHash,
+                                         &creationTicket,
+                                         &name,
+                                         &sessionsDataOut);
+
+    if (TSS2_RC_SUCCESS != ret)
+        return -1;
+
+    return 0;
+}
+
+int createloaded(struct test_context *ctx, TPM2_HANDLE *handle_out, TPM2B_PUBLIC *public_out)
+{
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPM2B_SENSITIVE_CREATE inSensitive = {};
+
+    TPM2B_PUBLIC in_public = {.publicArea = {.type=TPM2_ALG_ECC,
+                                             .nameAlg=TPM2_ALG_SHA256,
+                                             .objectAttributes=obj_attrs}};
+    in_public.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_ECDSA;
+    in_public.publicArea.parameters.eccDetail.scheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+    in_public.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    in_public.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+
+    TPM2B_TEMPLATE in_template;
+    TSS2_RC ret = Tss2_Sys_SetTemplate(&in_public, &in_template);
+    if (TSS2_RC_SUCCESS != ret)
+        return -1;
+
+    TPM2B_PRIVATE private_blob = {};
+    TPM2B_NAME name = {};
+
+    ret = Tss2_Sys_CreateLoaded(ctx->sapi_ctx,
+                                ctx->parent_handle,
+                                &sessionsData,
+                                &inSensitive,
+                                &in_template,
+                                handle_out,
+                                &private_blob,
+                                public_out,
+                                &name,
+                                &sessionsDataOut);
+
+    printf("CreateLoaded ret = %#X\n", ret);
+    if (TSS2_RC_SUCCESS != ret)
+        return -1;
+
+    if (0 == private_blob.size || 0 == name.size)
+        return -1;
+
+    return 0;
+}
+
+void createloaded_test()
+{
+    printf("In tss2_sys_createloaded-test::createloaded_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TPM2_HANDLE handle;
+    TPM2B_PUBLIC public_key = {};
+    TEST_ASSERT(0 == createloaded(&ctx, &handle, &public_key));
+
+    TEST_ASSERT(obj_attrs == public_key.publicArea.objectAttributes);
+    TEST_ASSERT(32 == public_key.publicArea.unique.ecc.x.size);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(ctx.sapi_ctx, handle));
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(ctx.sapi_ctx, ctx.parent_handle));
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+void context_test()
+{
+    printf("In tss2_sys_createloaded-test::context_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TPM2_HANDLE handle;
+    TPM2B_PUBLIC public_key = {};
+    TEST_ASSERT(0 == createloaded(&ctx, &handle, &public_key));
+
+    TPMS_CONTEXT saved = {};
+    TSS2_RC ret = Tss2_Sys_ContextSave(ctx.sapi_ctx, handle, &saved);
+    printf("ContextSave ret = %#X\n", ret);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(0 != saved.contextBlob.size);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(ctx.sapi_ctx, handle));
+
+    TPM2_HANDLE loaded_handle;
+    ret = Tss2_Sys_ContextLoad(ctx.sapi_ctx, &saved, &loaded_handle);
+    printf("ContextLoad ret = %#X\n", ret);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TPM2B_PUBLIC public_key_out = {};
+    TPM2B_NAME name = {};
+    TPM2B_NAME qualified_name = {};
+    ret = Tss2_Sys_ReadPublic(ctx.sapi_ctx, loaded_handle, NULL, &public_key_out, &name, &qualified_name, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(0 == memcmp(public_key.publicArea.unique.ecc.x.buffer,
+                            public_key_out.publicArea.unique.ecc.x.buffer,
+                            public_key.publicArea.unique.ecc.x.size));
+
+    // A handle is returned, so somewhere to put it is required.
+    ret = Tss2_Sys_ContextLoad(ctx.sapi_ctx, &saved, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_REFERENCE == ret);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(ctx.sapi_ctx, loaded_handle));
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(ctx.sapi_ctx, ctx.parent_handle));
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+int clear(struct test_context *ctx)
+{
+   TPMI_RH_CLEAR auth_handle = TPM2_RH_LOCKOUT;
+
+   TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+   TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+   TSS2_RC ret = Tss2_Sys_Clear(ctx->sapi_ctx,
+                                auth_handle,
+                                &sessionsData,
+                                &sessionsDataOut);
+
+   printf("Clear ret=%#X\n", ret);
+
+   return ret;
+}
@@ -0,0 +1,223 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+
+#include "test-utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static TSS2_SYS_CONTEXT *init_dryrun(void);
+static TSS2_SYS_CONTEXT *init_dryrun_sized(size_t max_command_size);
+
+static void readpublic_test();
+static void prepare_test();
+static void sequence_test();
+static void context_size_test();
+
+int main(int argc, char *argv[])
+{
+    parse_cmd_args(argc, argv);
+
+    readpublic_test();
+    prepare_test();
+    sequence_test();
+    context_size_test();
+}
+
+TSS2_SYS_CONTEXT *init_dryrun(void)
+{
+    return init_dryrun_sized(0);
+}
+
+TSS2_SYS_CONTEXT *init_dryrun_sized(size_t max_command_size)
+{
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(max_command_size);
+
+    TSS2_SYS_CONTEXT *sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TSS2_RC ret = Tss2_Sys_InitializeDryRun(sapi_ctx,
+                                            sapi_ctx_size,
+                                            &abi_version);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    return sapi_ctx;
+}
+
+void readpublic_test()
+{
+    printf("In tss2_sys_dryrun-test::readpublic_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx = init_dryrun();
+
+    TPM2B_PUBLIC out_public = {0};
+    TPM2B_NAME name = {0};
+    TPM2B_NAME qualified_name = {0};
+    TSS2_RC ret = Tss2_Sys_ReadPublic(sapi_ctx,
+                                      0x81000001,
+                                      NULL,
+                                      &out_public,
+                                      &name,
+                                      &qualified_name,
+                                      NULL);
+    TEST_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+
+    size_t cmd_size = 0;
+    const uint8_t *cmd = NULL;
+    ret = Tss2_Sys_GetCommandBuffer(sapi_ctx, &cmd_size, &cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    const uint8_t expected[] = {0x80, 0x01,
+                                0x00, 0x00, 0x00, 0x0e,
+                                0x00, 0x00, 0x01, 0x73,
+                                0x81, 0x00, 0x00, 0x01};
+    TEST_ASSERT(sizeof(expected) == cmd_size);
+    TEST_ASSERT(0 == memcmp(expected, cmd, cmd_size));
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void prepare_test()
+{
+    printf("In tss2_sys_dryrun-test::prepare_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx = init_dryrun();
+
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = {
+        .auths[0] = {.sessionHandle = TPM2_RS_PW},
+        .count = 1
+    };
+
+    TSS2_RC ret = Tss2_Sys_NV_Read_Prepare(sapi_ctx, 0x1410000, 0x1410000, 32, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    ret = Tss2_Sys_SetCmdAuths(sapi_ctx, &auth_cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    size_t prepared_size = 0;
+    const uint8_t *cmd = NULL;
+    ret = Tss2_Sys_GetCommandBuffer(sapi_ctx, &prepared_size, &cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    ret = Tss2_Sys_ExecuteAsync(sapi_ctx);
+    TEST_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+
+    size_t cmd_size = 0;
+    ret = Tss2_Sys_GetCommandBuffer(sapi_ctx, &cmd_size, &cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // header, 2 handles, authorization area (4 + 9), size and offset
+    TEST_ASSERT(10 + 8 + 13 + 4 == cmd_size);
+    TEST_ASSERT(prepared_size == cmd_size);
+    TEST_ASSERT(0x80 == cmd[0] && 0x02 == cmd[1]);
+    TEST_ASSERT(cmd_size == (size_t)cmd[5]);
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void sequence_test()
+{
+    printf("In tss2_sys_dryrun-test::sequence_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx = init_dryrun();
+
+    size_t cmd_size = 0;
+    const uint8_t *cmd = NULL;
+    TSS2_RC ret = Tss2_Sys_GetCommandBuffer(sapi_ctx, &cmd_size, &cmd);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_SEQUENCE == ret);
+
+    ret = Tss2_Sys_GetCommandBuffer(sapi_ctx, &cmd_size, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_REFERENCE == ret);
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void context_size_test()
+{
+    printf("In tss2_sys_dryrun-test::context_size_test...\n");
+
+    TEST_ASSERT(Tss2_Sys_GetContextSize(0) - Tss2_Sys_GetContextSize(1280) == TPM2_MAX_COMMAND_SIZE - 1280);
+    TEST_ASSERT(Tss2_Sys_GetContextSize(1) == Tss2_Sys_GetContextSize(64));
+
+    // A context for the SLB9670's 1280-byte I/O buffer stays under 1.4 KB.
+    TEST_ASSERT(Tss2_Sys_GetContextSize(1280) <= 1280 + 144);
+
+    TSS2_SYS_CONTEXT *sapi_ctx = malloc(Tss2_Sys_GetContextSize(64));
+    TEST_ASSERT(NULL != sapi_ctx);
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TSS2_RC ret = Tss2_Sys_InitializeDryRun(sapi_ctx, Tss2_Sys_GetContextSize(64) - 1, &abi_version);
+    TEST_ASSERT(TSS2_SYS_RC_INSUFFICIENT_CONTEXT == ret);
+
+    // Only the dry-run entry point takes no TCTI.
+    ret = Tss2_Sys_Initialize(sapi_ctx, Tss2_Sys_GetContextSize(64), NULL, &abi_version);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_REFERENCE == ret);
+    free(sapi_ctx);
+
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = {
+        .auths[0] = {.sessionHandle = TPM2_RS_PW},
+        .count = 1
+    };
+    TPM2B_MAX_NV_BUFFER data = {.size = 32};
+
+    // header, 2 handles, authorization area (4 + 9), data (2 + 32) and offset
+    const size_t write_size = 10 + 8 + 13 + 34 + 2;
+
+    sapi_ctx = init_dryrun_sized(write_size);
+    ret = Tss2_Sys_NV_Write(sapi_ctx, 0x1410000, 0x1410000, &auth_cmd, &data, 0, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+
+    size_t cmd_size = 0;
+    const uint8_t *cmd = NULL;
+    ret = Tss2_Sys_GetCommandBuffer(sapi_ctx, &cmd_size, &cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(write_size == cmd_size);
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    sapi_ctx = init_dryrun_sized(write_size - 1);
+    ret = Tss2_Sys_NV_Write(sapi_ctx, 0x1410000, 0x1410000, &auth_cmd, &data, 0, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_INSUFFICIENT_CONTEXT == ret);
+
+    // Room for the parameters, but not for the authorization area added after them.
+    ret = Tss2_Sys_NV_Write_Prepare(sapi_ctx, 0x1410000, 0x1410000, &data, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_SetCmdAuths(sapi_ctx, &auth_cmd);
+    TEST_ASSERT(TSS2_SYS_RC_INSUFFICIENT_CONTEXT == ret);
+
+    data.size = TPM2_MAX_NV_BUFFER_SIZE;
+    ret = Tss2_Sys_NV_Write_Prepare(sapi_ctx, 0x1410000, 0x1410000, &data, 0);
+    TEST_ASSERT(TSS2_SYS_RC_INSUFFICIENT_CONTEXT == ret);
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    printf("ok\n");
+}
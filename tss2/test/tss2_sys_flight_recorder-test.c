@@ -0,0 +1,102 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+#include <tss2/tss2_sys_flight_recorder.h>
+
+#include "test-utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct test_context {
+    TSS2_SYS_CONTEXT *sapi_ctx;
+};
+
+static void initialize(struct test_context *ctx);
+static void cleanup(struct test_context *ctx);
+
+static void record_test();
+
+int main(int argc, char *argv[])
+{
+    parse_cmd_args(argc, argv);
+
+    record_test();
+}
+
+void initialize(struct test_context *ctx)
+{
+    init_sapi(&ctx->sapi_ctx);
+}
+
+void cleanup(struct test_context *ctx)
+{
+    TSS2_TCTI_CONTEXT *tcti_context = NULL;
+
+    if (ctx->sapi_ctx != NULL) {
+        TSS2_RC rc = Tss2_Sys_GetTctiContext(ctx->sapi_ctx, &tcti_context);
+        TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+        Tss2_Tcti_Finalize(tcti_context);
+        free(tcti_context);
+
+        Tss2_Sys_Finalize(ctx->sapi_ctx);
+        free(ctx->sapi_ctx);
+    }
+}
+
+void record_test()
+{
+    printf("In tss2_sys_flight_recorder-test::record_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    // Reading a non-existent object fails, so records an error.
+    TPM2B_PUBLIC out_public = {0};
+    TPM2B_NAME name = {0};
+    TPM2B_NAME qualified_name = {0};
+    TSS2_RC rc = Tss2_Sys_ReadPublic(ctx.sapi_ctx, 0x81FFFFFF, NULL, &out_public, &name, &qualified_name, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS != rc);
+
+    struct xtpm_flight_entry entries[XTPM_FLIGHT_RECORDER_SIZE];
+    size_t count = xtpm_flight_recorder_snapshot(entries, XTPM_FLIGHT_RECORDER_SIZE);
+    TEST_ASSERT(count > 0);
+
+    const struct xtpm_flight_entry *last = &entries[count - 1];
+    TEST_ASSERT(TPM2_CC_ReadPublic == last->command_code);
+    TEST_ASSERT(0x81FFFFFF == last->handle);
+    TEST_ASSERT(rc == last->rc);
+    TEST_ASSERT(0 != last->end_ns && last->start_ns <= last->end_ns);
+
+    int fds[2];
+    TEST_ASSERT(0 == pipe(fds));
+    TEST_ASSERT(0 == xtpm_flight_recorder_dump(fds[1]));
+    close(fds[1]);
+
+    char dump[4096] = {0};
+    TEST_ASSERT(0 < read(fds[0], dump, sizeof(dump) - 1));
+    close(fds[0]);
+    TEST_ASSERT(NULL != strstr(dump, "cc=0x00000173 handle=0x81ffffff"));
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
@@ -0,0 +1,283 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include "test-utils.h"
+
+static void initialize(TSS2_SYS_CONTEXT **sapi_ctx);
+static void cleanup(TSS2_SYS_CONTEXT *sapi_ctx);
+static int start(TSS2_SYS_CONTEXT *sapi_ctx, TPMI_DH_OBJECT *handle);
+static int complete(TSS2_SYS_CONTEXT *sapi_ctx,
+                    TPMI_DH_OBJECT handle,
+                    const TPM2B_MAX_BUFFER *buffer,
+                    TPMI_RH_HIERARCHY hierarchy,
+                    TPM2B_DIGEST *result,
+                    TPMT_TK_HASHCHECK *validation);
+
+static void chunking_test();
+static void staged_update_test();
+static void generated_value_test();
+static void bad_parameters_test();
+
+int main(int argc, char *argv[])
+{
+    parse_cmd_args(argc, argv);
+
+    chunking_test();
+    staged_update_test();
+    generated_value_test();
+    bad_parameters_test();
+}
+
+void initialize(TSS2_SYS_CONTEXT **sapi_ctx)
+{
+    init_sapi(sapi_ctx);
+}
+
+void cleanup(TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    TSS2_TCTI_CONTEXT *tcti_context = NULL;
+
+    if (sapi_ctx != NULL) {
+        TSS2_RC rc = Tss2_Sys_GetTctiContext(sapi_ctx, &tcti_context);
+        TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+        Tss2_Tcti_Finalize(tcti_context);
+        free(tcti_context);
+
+        Tss2_Sys_Finalize(sapi_ctx);
+        free(sapi_ctx);
+    }
+}
+
+int start(TSS2_SYS_CONTEXT *sapi_ctx, TPMI_DH_OBJECT *handle)
+{
+    TPM2B_AUTH auth = {.size = 0};
+
+    TSS2_RC ret = Tss2_Sys_HashSequenceStart(sapi_ctx,
+                                             NULL,
+                                             &auth,
+                                             TPM2_ALG_SHA256,
+                                             handle,
+                                             NULL);
+
+    printf("HashSequenceStart ret = %#X\n", ret);
+    if (TSS2_RC_SUCCESS != ret)
+        return -1;
+
+    return 0;
+}
+
+int complete(TSS2_SYS_CONTEXT *sapi_ctx,
+             TPMI_DH_OBJECT handle,
+             const TPM2B_MAX_BUFFER *buffer,
+             TPMI_RH_HIERARCHY hierarchy,
+             TPM2B_DIGEST *result,
+             TPMT_TK_HASHCHECK *validation)
+{
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TSS2_RC ret = Tss2_Sys_SequenceComplete(sapi_ctx,
+                                            handle,
+                                            &sessionsData,
+                                            buffer,
+                                            hierarchy,
+                                            result,
+                                            validation,
+                                            &sessionsDataOut);
+
+    printf("SequenceComplete ret = %#X\n", ret);
+    if (TSS2_RC_SUCCESS != ret)
+        return -1;
+
+    return 0;
+}
+
+void chunking_test()
+{
+    printf("In tss2_sys_hashsequence-test::chunking_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    initialize(&sapi_ctx);
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPM2B_MAX_BUFFER all = {.size = 300};
+    for (unsigned i = 0; i < all.size; i++)
+        all.buffer[i] = (uint8_t)i;
+
+    // All the data in SequenceComplete
+    TPMI_DH_OBJECT handle;
+    TEST_ASSERT(0 == start(sapi_ctx, &handle));
+    TPM2B_DIGEST whole = {.size = 0};
+    TPMT_TK_HASHCHECK whole_ticket = {};
+    TEST_ASSERT(0 == complete(sapi_ctx, handle, &all, TPM2_RH_OWNER, &whole, &whole_ticket));
+    TEST_ASSERT(TPM2_SHA256_DIGEST_SIZE == whole.size);
+    TEST_ASSERT(TPM2_ST_HASHCHECK == whole_ticket.tag);
+    TEST_ASSERT(TPM2_RH_OWNER == whole_ticket.hierarchy);
+    TEST_ASSERT(0 != whole_ticket.digest.size);
+
+    // The same data, split over two SequenceUpdates and SequenceComplete
+    TEST_ASSERT(0 == start(sapi_ctx, &handle));
+    const uint16_t splits[] = {100, 150, 300};
+    uint16_t done = 0;
+    for (unsigned i = 0; i < 2; i++) {
+        TPM2B_MAX_BUFFER part = {.size = splits[i] - done};
+        memcpy(part.buffer, all.buffer + done, part.size);
+        done = splits[i];
+
+        TSS2_RC ret = Tss2_Sys_SequenceUpdate(sapi_ctx, handle, &sessionsData, &part, &sessionsDataOut);
+        printf("SequenceUpdate ret = %#X\n", ret);
+        TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    }
+    TPM2B_MAX_BUFFER last = {.size = all.size - done};
+    memcpy(last.buffer, all.buffer + done, last.size);
+    TPM2B_DIGEST parts = {.size = 0};
+    TPMT_TK_HASHCHECK parts_ticket = {};
+    TEST_ASSERT(0 == complete(sapi_ctx, handle, &last, TPM2_RH_OWNER, &parts, &parts_ticket));
+
+    TEST_ASSERT(whole.size == parts.size);
+    TEST_ASSERT(0 == memcmp(whole.buffer, parts.buffer, whole.size));
+    TEST_ASSERT(whole_ticket.digest.size == parts_ticket.digest.size);
+    TEST_ASSERT(0 == memcmp(whole_ticket.digest.buffer, parts_ticket.digest.buffer, whole_ticket.digest.size));
+
+    // SequenceComplete flushes the sequence.
+    TSS2_RC ret = Tss2_Sys_SequenceUpdate(sapi_ctx, handle, &sessionsData, &last, &sessionsDataOut);
+    TEST_ASSERT(TSS2_RC_SUCCESS != ret);
+
+    cleanup(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void staged_update_test()
+{
+    printf("In tss2_sys_hashsequence-test::staged_update_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    initialize(&sapi_ctx);
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPM2B_MAX_BUFFER data = {.size = TPM2_MAX_DIGEST_BUFFER};
+    memset(data.buffer, 0x5A, data.size);
+    TPM2B_MAX_BUFFER empty = {.size = 0};
+
+    TPMI_DH_OBJECT handle;
+    TEST_ASSERT(0 == start(sapi_ctx, &handle));
+    TSS2_RC ret = Tss2_Sys_SequenceUpdate(sapi_ctx, handle, &sessionsData, &data, &sessionsDataOut);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TPM2B_DIGEST expected = {.size = 0};
+    TEST_ASSERT(0 == complete(sapi_ctx, handle, &empty, TPM2_RH_NULL, &expected, NULL));
+
+    // The same update, sent with the staged calls
+    TEST_ASSERT(0 == start(sapi_ctx, &handle));
+
+    ret = Tss2_Sys_SequenceUpdate_Prepare(sapi_ctx, handle, &data);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_SetCmdAuths(sapi_ctx, &sessionsData);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_ExecuteAsync(sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_ExecuteFinish(sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_GetRspAuths(sapi_ctx, &sessionsDataOut);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_SequenceUpdate_Complete(sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // With no ticket wanted
+    TPM2B_DIGEST result = {.size = 0};
+    TEST_ASSERT(0 == complete(sapi_ctx, handle, &empty, TPM2_RH_NULL, &result, NULL));
+    TEST_ASSERT(expected.size == result.size);
+    TEST_ASSERT(0 == memcmp(expected.buffer, result.buffer, expected.size));
+
+    cleanup(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void generated_value_test()
+{
+    printf("In tss2_sys_hashsequence-test::generated_value_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    initialize(&sapi_ctx);
+
+    // Data that starts like a TPM-generated structure gets a NULL ticket.
+    TPM2B_MAX_BUFFER data = {.size = 64};
+    data.buffer[0] = (uint8_t)(TPM2_GENERATED_VALUE >> 24);
+    data.buffer[1] = (uint8_t)(TPM2_GENERATED_VALUE >> 16);
+    data.buffer[2] = (uint8_t)(TPM2_GENERATED_VALUE >> 8);
+    data.buffer[3] = (uint8_t)TPM2_GENERATED_VALUE;
+
+    TPMI_DH_OBJECT handle;
+    TEST_ASSERT(0 == start(sapi_ctx, &handle));
+    TPM2B_DIGEST result = {.size = 0};
+    TPMT_TK_HASHCHECK ticket = {};
+    TEST_ASSERT(0 == complete(sapi_ctx, handle, &data, TPM2_RH_OWNER, &result, &ticket));
+    TEST_ASSERT(TPM2_SHA256_DIGEST_SIZE == result.size);
+    TEST_ASSERT(TPM2_ST_HASHCHECK == ticket.tag);
+    TEST_ASSERT(TPM2_RH_NULL == ticket.hierarchy);
+    TEST_ASSERT(0 == ticket.digest.size);
+
+    // So does any data, if the ticket is for the NULL hierarchy.
+    data.buffer[0] = 0;
+    TEST_ASSERT(0 == start(sapi_ctx, &handle));
+    TEST_ASSERT(0 == complete(sapi_ctx, handle, &data, TPM2_RH_NULL, &result, &ticket));
+    TEST_ASSERT(TPM2_RH_NULL == ticket.hierarchy);
+    TEST_ASSERT(0 == ticket.digest.size);
+
+    cleanup(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void bad_parameters_test()
+{
+    printf("In tss2_sys_hashsequence-test::bad_parameters_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    initialize(&sapi_ctx);
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+    // Larger than TPM2_MAX_DIGEST_BUFFER: refused before anything is sent.
+    TPM2B_MAX_BUFFER data = {.size = TPM2_MAX_DIGEST_BUFFER + 1};
+    TSS2_RC ret = Tss2_Sys_SequenceUpdate(sapi_ctx, TPM2_HR_TRANSIENT, &sessionsData, &data, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_SIZE == ret);
+
+    // As is a sequence with no handle to return it in.
+    TPM2B_AUTH auth = {.size = 0};
+    ret = Tss2_Sys_HashSequenceStart(sapi_ctx, NULL, &auth, TPM2_ALG_SHA256, NULL, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_REFERENCE == ret);
+
+    // An unknown hash algorithm is refused by the TPM.
+    TPMI_DH_OBJECT handle;
+    ret = Tss2_Sys_HashSequenceStart(sapi_ctx, NULL, &auth, TPM2_ALG_NULL, &handle, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS != ret);
+
+    cleanup(sapi_ctx);
+
+    printf("ok\n");
+}
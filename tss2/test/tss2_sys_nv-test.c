@@ -29,12 +29,16 @@ static void initialize(struct test_context *ctx);
 static void cleanup(struct test_context *ctx);
 
 static void full_test();
+static void async_write_test();
+static void async_read_test();
 
 int main(int argc, char *argv[])
 {
     parse_cmd_args(argc, argv);
 
     full_test();
+    async_write_test();
+    async_read_test();
 }
 
 void initialize(struct test_context *ctx)
@@ -244,3 +248,110 @@ void full_test()
     printf("ok\n");
 }
 
+
+void async_write_test()
+{
+    printf("In tss2_sys_nv-test::async_write_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    uint32_t index = 0x1600002;
+    uint32_t size = 32;
+    const char *data = "async test data";
+    uint32_t data_size = strlen(data);
+
+    int undefine_ret = undefine(&ctx, index);
+    TEST_ASSERT(0 == undefine_ret || 0x28b == undefine_ret);
+
+    int define_ret = define(&ctx, index, size);
+    TEST_ASSERT(0 == define_ret);
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPM2B_MAX_NV_BUFFER nv_write_data = {.size = data_size};
+    memcpy(nv_write_data.buffer, data, data_size);
+
+    // Out-of-order calls are rejected
+    TEST_ASSERT(TSS2_SYS_RC_BAD_SEQUENCE == Tss2_Sys_ExecuteFinish(ctx.sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK));
+
+    TSS2_RC rval = Tss2_Sys_NV_Write_Prepare(ctx.sapi_ctx, TPM2_RH_OWNER, index, &nv_write_data, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    rval = Tss2_Sys_SetCmdAuths(ctx.sapi_ctx, &sessionsData);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    rval = Tss2_Sys_ExecuteAsync(ctx.sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    rval = Tss2_Sys_ExecuteFinish(ctx.sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    rval = Tss2_Sys_GetRspAuths(ctx.sapi_ctx, &sessionsDataOut);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    rval = Tss2_Sys_NV_Write_Complete(ctx.sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    char output_data[32];
+    int read_ret = read_from_nv(&ctx, index, (uint8_t*)output_data, data_size);
+    TEST_ASSERT((int)data_size == read_ret);
+
+    TEST_ASSERT(0 == memcmp(data, output_data, data_size));
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+void async_read_test()
+{
+    printf("In tss2_sys_nv-test::async_read_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    uint32_t index = 0x1600002;
+    uint32_t size = 32;
+    const char *data = "async read data";
+    uint32_t data_size = strlen(data);
+
+    int undefine_ret = undefine(&ctx, index);
+    TEST_ASSERT(0 == undefine_ret || 0x28b == undefine_ret);
+
+    int define_ret = define(&ctx, index, size);
+    TEST_ASSERT(0 == define_ret);
+
+    int write_ret = write_to_nv(&ctx, index, (uint8_t*)data, data_size);
+    TEST_ASSERT((int)data_size == write_ret);
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TSS2_RC rval = Tss2_Sys_NV_Read_Prepare(ctx.sapi_ctx, TPM2_RH_OWNER, index, data_size, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    rval = Tss2_Sys_SetCmdAuths(ctx.sapi_ctx, &sessionsData);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    rval = Tss2_Sys_ExecuteAsync(ctx.sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    rval = Tss2_Sys_ExecuteFinish(ctx.sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    rval = Tss2_Sys_GetRspAuths(ctx.sapi_ctx, &sessionsDataOut);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    TPM2B_MAX_NV_BUFFER nv_data = {.size = 0};
+    rval = Tss2_Sys_NV_Read_Complete(ctx.sapi_ctx, &nv_data);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rval);
+
+    TEST_ASSERT(data_size == nv_data.size);
+    TEST_ASSERT(0 == memcmp(data, nv_data.buffer, data_size));
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
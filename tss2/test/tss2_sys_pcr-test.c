@@ -0,0 +1,166 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include "test-utils.h"
+
+// The debug PCR, which any locality may extend
+#define TEST_PCR 16
+
+static void initialize(TSS2_SYS_CONTEXT **sapi_ctx);
+static void cleanup(TSS2_SYS_CONTEXT *sapi_ctx);
+static int read_pcr(TSS2_SYS_CONTEXT *sapi_ctx, uint32_t *update_counter, TPM2B_DIGEST *value);
+
+static void extend_test();
+static void bad_selection_test();
+
+int main(int argc, char *argv[])
+{
+    parse_cmd_args(argc, argv);
+
+    extend_test();
+    bad_selection_test();
+}
+
+void initialize(TSS2_SYS_CONTEXT **sapi_ctx)
+{
+    init_sapi(sapi_ctx);
+}
+
+void cleanup(TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    TSS2_TCTI_CONTEXT *tcti_context = NULL;
+
+    if (sapi_ctx != NULL) {
+        TSS2_RC rc = Tss2_Sys_GetTctiContext(sapi_ctx, &tcti_context);
+        TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+        Tss2_Tcti_Finalize(tcti_context);
+        free(tcti_context);
+
+        Tss2_Sys_Finalize(sapi_ctx);
+        free(sapi_ctx);
+    }
+}
+
+int read_pcr(TSS2_SYS_CONTEXT *sapi_ctx, uint32_t *update_counter, TPM2B_DIGEST *value)
+{
+    TPML_PCR_SELECTION selection_in = {.count = 1};
+    selection_in.pcrSelections[0].hash = TPM2_ALG_SHA256;
+    selection_in.pcrSelections[0].sizeofSelect = 3;
+    selection_in.pcrSelections[0].pcrSelect[TEST_PCR / 8] = 1 << (TEST_PCR % 8);
+
+    TPML_PCR_SELECTION selection_out = {};
+    TPML_DIGEST values = {};
+
+    TSS2_RC ret = Tss2_Sys_PCR_Read(sapi_ctx,
+                                    NULL,
+                                    &selection_in,
+                                    update_counter,
+                                    &selection_out,
+                                    &values,
+                                    NULL);
+
+    printf("PCR_Read ret = %#X\n", ret);
+    if (TSS2_RC_SUCCESS != ret)
+        return -1;
+
+    if (1 != selection_out.count || 1 != values.count)
+        return -1;
+
+    if (0 == (selection_out.pcrSelections[0].pcrSelect[TEST_PCR / 8] & (1 << (TEST_PCR % 8))))
+        return -1;
+
+    *value = values.digests[0];
+
+    return 0;
+}
+
+void extend_test()
+{
+    printf("In tss2_sys_pcr-test::extend_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    initialize(&sapi_ctx);
+
+    uint32_t counter_before;
+    TPM2B_DIGEST value_before;
+    TEST_ASSERT(0 == read_pcr(sapi_ctx, &counter_before, &value_before));
+    TEST_ASSERT(TPM2_SHA256_DIGEST_SIZE == value_before.size);
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPML_DIGEST_VALUES digests = {.count = 1};
+    digests.digests[0].hashAlg = TPM2_ALG_SHA256;
+    memset(digests.digests[0].digest.sha256, 0xA5, TPM2_SHA256_DIGEST_SIZE);
+
+    TSS2_RC ret = Tss2_Sys_PCR_Extend(sapi_ctx,
+                                      TEST_PCR,
+                                      &sessionsData,
+                                      &digests,
+                                      &sessionsDataOut);
+
+    printf("PCR_Extend ret = %#X\n", ret);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    uint32_t counter_after;
+    TPM2B_DIGEST value_after;
+    TEST_ASSERT(0 == read_pcr(sapi_ctx, &counter_after, &value_after));
+    TEST_ASSERT(counter_after != counter_before);
+    TEST_ASSERT(0 != memcmp(value_before.buffer, value_after.buffer, TPM2_SHA256_DIGEST_SIZE));
+
+    cleanup(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void bad_selection_test()
+{
+    printf("In tss2_sys_pcr-test::bad_selection_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    initialize(&sapi_ctx);
+
+    // Larger than TPM2_PCR_SELECT_MAX: refused before anything is sent.
+    TPML_PCR_SELECTION selection_in = {.count = 1};
+    selection_in.pcrSelections[0].hash = TPM2_ALG_SHA256;
+    selection_in.pcrSelections[0].sizeofSelect = TPM2_PCR_SELECT_MAX + 1;
+
+    uint32_t update_counter;
+    TPML_PCR_SELECTION selection_out;
+    TPML_DIGEST values;
+
+    TSS2_RC ret = Tss2_Sys_PCR_Read(sapi_ctx,
+                                    NULL,
+                                    &selection_in,
+                                    &update_counter,
+                                    &selection_out,
+                                    &values,
+                                    NULL);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_SIZE == ret);
+
+    // So is extending with no auths.
+    TPML_DIGEST_VALUES digests = {.count = 0};
+    ret = Tss2_Sys_PCR_Extend(sapi_ctx, TEST_PCR, NULL, &digests, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_REFERENCE == ret);
+
+    cleanup(sapi_ctx);
+
+    printf("ok\n");
+}
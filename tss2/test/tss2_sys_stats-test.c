@@ -0,0 +1,283 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+#include <tss2/tss2_sys_stats.h>
+
+#include "test-utils.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// How many times each command shows up in the stats.
+#if defined(XTPM_NO_HEAP) && 0 == XTPM_STATS_STATIC_BLOCKS
+#define COUNTED 0   // compiled out
+#else
+#define COUNTED 1
+#endif
+
+struct test_context {
+    TSS2_SYS_CONTEXT *sapi_ctx;
+};
+
+static void initialize(struct test_context *ctx);
+static void cleanup(struct test_context *ctx);
+
+static void percentile_test();
+static void count_test();
+static void poll_test();
+static void thread_exit_test();
+
+int main(int argc, char *argv[])
+{
+    parse_cmd_args(argc, argv);
+
+    percentile_test();
+    count_test();
+    poll_test();
+    thread_exit_test();
+}
+
+void initialize(struct test_context *ctx)
+{
+    init_sapi(&ctx->sapi_ctx);
+}
+
+void cleanup(struct test_context *ctx)
+{
+    TSS2_TCTI_CONTEXT *tcti_context = NULL;
+
+    if (ctx->sapi_ctx != NULL) {
+        TSS2_RC rc = Tss2_Sys_GetTctiContext(ctx->sapi_ctx, &tcti_context);
+        TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+        Tss2_Tcti_Finalize(tcti_context);
+        free(tcti_context);
+
+        Tss2_Sys_Finalize(ctx->sapi_ctx);
+        free(ctx->sapi_ctx);
+    }
+}
+
+void percentile_test()
+{
+    printf("In tss2_sys_stats-test::percentile_test...\n");
+
+    struct xtpm_stats_histogram histogram = {0};
+    TEST_ASSERT(0 == xtpm_stats_percentile_us(&histogram, 99.0));
+
+    // 98 samples under 2us, 2 samples in [512us, 1024us)
+    histogram.buckets[1] = 98;
+    histogram.buckets[10] = 2;
+
+    TEST_ASSERT(2 == xtpm_stats_percentile_us(&histogram, 50.0));
+    TEST_ASSERT(2 == xtpm_stats_percentile_us(&histogram, 98.0));
+    TEST_ASSERT(1024 == xtpm_stats_percentile_us(&histogram, 99.0));
+    TEST_ASSERT(1024 == xtpm_stats_percentile_us(&histogram, 100.0));
+
+    struct xtpm_stats *stats = calloc(1, sizeof(struct xtpm_stats));
+    TEST_ASSERT(NULL != stats);
+    TEST_ASSERT(NULL == xtpm_stats_for_command(stats, 0x1));
+    TEST_ASSERT(&stats->commands[TPM2_CC_Sign - XTPM_STATS_CC_FIRST] == xtpm_stats_for_command(stats, TPM2_CC_Sign));
+    free(stats);
+
+    printf("ok\n");
+}
+
+void count_test()
+{
+    printf("In tss2_sys_stats-test::count_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    struct xtpm_stats *before = calloc(1, sizeof(struct xtpm_stats));
+    TEST_ASSERT(NULL != before);
+    struct xtpm_stats *after = calloc(1, sizeof(struct xtpm_stats));
+    TEST_ASSERT(NULL != after);
+
+    xtpm_stats_snapshot(before);
+
+    // Reading a non-existent object fails, so should count as an error.
+    TPM2B_PUBLIC out_public = {0};
+    TPM2B_NAME name = {0};
+    TPM2B_NAME qualified_name = {0};
+    TSS2_RC rc = Tss2_Sys_ReadPublic(ctx.sapi_ctx, 0x81FFFFFF, NULL, &out_public, &name, &qualified_name, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS != rc);
+
+    xtpm_stats_snapshot(after);
+
+    const struct xtpm_cc_stats *cc_before = xtpm_stats_for_command(before, TPM2_CC_ReadPublic);
+    const struct xtpm_cc_stats *cc_after = xtpm_stats_for_command(after, TPM2_CC_ReadPublic);
+    TEST_ASSERT(cc_before->calls + COUNTED == cc_after->calls);
+    TEST_ASSERT(cc_before->errors + COUNTED == cc_after->errors);
+    TEST_ASSERT(!COUNTED || cc_before->latency[XTPM_STATS_TPM_WAIT].total_ns < cc_after->latency[XTPM_STATS_TPM_WAIT].total_ns);
+
+    TEST_ASSERT(0 == xtpm_stats_dump(after, stdout));
+
+    free(before);
+    free(after);
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+// Answers every command with TPM_RC_HANDLE, but only to a blocking receive.
+static
+TSS2_RC slow_transmit(TSS2_TCTI_CONTEXT *tcti_context, size_t size, uint8_t *command)
+{
+    (void)tcti_context;
+    (void)size;
+    (void)command;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC slow_receive(TSS2_TCTI_CONTEXT *tcti_context, size_t *size, uint8_t *response, int32_t timeout)
+{
+    (void)tcti_context;
+
+    if (0 == timeout)
+        return TSS2_TCTI_RC_TRY_AGAIN;
+    if (*size < 10)
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+
+    const uint8_t header[10] = {TPM2_ST_NO_SESSIONS >> 8, TPM2_ST_NO_SESSIONS & 0xFF,
+                                0, 0, 0, 10,
+                                0, 0, TPM_RC_HANDLE >> 8, TPM_RC_HANDLE & 0xFF};
+    memcpy(response, header, sizeof(header));
+    *size = sizeof(header);
+
+    return TSS2_RC_SUCCESS;
+}
+
+static TSS2_TCTI_CONTEXT_COMMON_V1 slow_tcti_g = {.version = 1,
+                                                  .transmit = slow_transmit,
+                                                  .receive = slow_receive};
+
+static
+TSS2_SYS_CONTEXT* init_slow_sapi(void)
+{
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    TSS2_SYS_CONTEXT *sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TSS2_RC rc = Tss2_Sys_Initialize(sapi_ctx, sapi_ctx_size, (TSS2_TCTI_CONTEXT*)&slow_tcti_g, &abi_version);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+    return sapi_ctx;
+}
+
+void poll_test()
+{
+    printf("In tss2_sys_stats-test::poll_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx = init_slow_sapi();
+
+    struct xtpm_stats *before = calloc(1, sizeof(struct xtpm_stats));
+    TEST_ASSERT(NULL != before);
+    struct xtpm_stats *after = calloc(1, sizeof(struct xtpm_stats));
+    TEST_ASSERT(NULL != after);
+
+    xtpm_stats_snapshot(before);
+
+    TSS2_RC rc = Tss2_Sys_NV_Read_Prepare(sapi_ctx, 0x01000000, 0x01000000, 8, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+    rc = Tss2_Sys_ExecuteAsync(sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+    // Polls that find no response yet aren't calls.
+    for (int i = 0; i < 3; i++) {
+        rc = Tss2_Sys_ExecuteFinish(sapi_ctx, 0);
+        TEST_ASSERT(TSS2_TCTI_RC_TRY_AGAIN == rc);
+    }
+
+    rc = Tss2_Sys_ExecuteFinish(sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+    TEST_ASSERT(TPM_RC_HANDLE == rc);
+
+    xtpm_stats_snapshot(after);
+
+    const struct xtpm_cc_stats *cc_before = xtpm_stats_for_command(before, TPM2_CC_NV_Read);
+    const struct xtpm_cc_stats *cc_after = xtpm_stats_for_command(after, TPM2_CC_NV_Read);
+    TEST_ASSERT(cc_before->calls + COUNTED == cc_after->calls);
+    TEST_ASSERT(cc_before->errors + COUNTED == cc_after->errors);
+
+    free(before);
+    free(after);
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    printf("ok\n");
+}
+
+static
+void* read_public_thread(void *arg)
+{
+    TSS2_SYS_CONTEXT *sapi_ctx = arg;
+
+    TPM2B_PUBLIC out_public = {0};
+    TPM2B_NAME name = {0};
+    TPM2B_NAME qualified_name = {0};
+    TSS2_RC rc = Tss2_Sys_ReadPublic(sapi_ctx, 0x81FFFFFF, NULL, &out_public, &name, &qualified_name, NULL);
+    TEST_ASSERT(TPM_RC_HANDLE == rc);
+
+    return NULL;
+}
+
+void thread_exit_test()
+{
+    printf("In tss2_sys_stats-test::thread_exit_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx = init_slow_sapi();
+
+    struct xtpm_stats *before = calloc(1, sizeof(struct xtpm_stats));
+    TEST_ASSERT(NULL != before);
+    struct xtpm_stats *after = calloc(1, sizeof(struct xtpm_stats));
+    TEST_ASSERT(NULL != after);
+
+    xtpm_stats_snapshot(before);
+
+    // More short-lived threads than a static pool has blocks:
+    // each one's block is handed to the next, which keeps counting on top.
+    const unsigned thread_count = 64;
+    for (unsigned i = 0; i < thread_count; i++) {
+        pthread_t thread;
+        TEST_ASSERT(0 == pthread_create(&thread, NULL, read_public_thread, sapi_ctx));
+        TEST_ASSERT(0 == pthread_join(thread, NULL));
+    }
+
+    xtpm_stats_snapshot(after);
+
+    const struct xtpm_cc_stats *cc_before = xtpm_stats_for_command(before, TPM2_CC_ReadPublic);
+    const struct xtpm_cc_stats *cc_after = xtpm_stats_for_command(after, TPM2_CC_ReadPublic);
+    TEST_ASSERT(cc_before->calls + COUNTED * thread_count == cc_after->calls);
+    TEST_ASSERT(cc_before->errors + COUNTED * thread_count == cc_after->errors);
+
+    free(before);
+    free(after);
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    printf("ok\n");
+}
@@ -0,0 +1,314 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+#include <tss2/tss2_sys_template.h>
+
+#include "test-utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static TSS2_SYS_CONTEXT *init_dryrun_sized(size_t max_command_size);
+static void free_dryrun(TSS2_SYS_CONTEXT *sapi_ctx);
+static void save_sign_template(TSS2_SYS_CONTEXT *sapi_ctx,
+                               TPM2_HANDLE key_handle,
+                               const TPM2B_DIGEST *digest,
+                               struct xtpm_command_template *tmpl);
+
+static void sign_matches_test();
+static void nv_read_matches_test();
+static void bad_patch_test();
+static void sign_live_test();
+
+static const TPMT_TK_HASHCHECK validation_g = {.tag = TPM2_ST_HASHCHECK, .hierarchy = TPM2_RH_NULL};
+
+int main(int argc, char *argv[])
+{
+    parse_cmd_args(argc, argv);
+
+    sign_matches_test();
+    nv_read_matches_test();
+    bad_patch_test();
+    sign_live_test();
+}
+
+TSS2_SYS_CONTEXT *init_dryrun_sized(size_t max_command_size)
+{
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(max_command_size);
+
+    TSS2_SYS_CONTEXT *sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TSS2_RC ret = Tss2_Sys_InitializeDryRun(sapi_ctx,
+                                            sapi_ctx_size,
+                                            &abi_version);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    return sapi_ctx;
+}
+
+void free_dryrun(TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+}
+
+void save_sign_template(TSS2_SYS_CONTEXT *sapi_ctx,
+                        TPM2_HANDLE key_handle,
+                        const TPM2B_DIGEST *digest,
+                        struct xtpm_command_template *tmpl)
+{
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = EMPTY_AUTH_COMMAND;
+
+    TPMT_SIG_SCHEME scheme = {.scheme = TPM2_ALG_ECDSA};
+    scheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+
+    TSS2_RC ret = Tss2_Sys_Sign_Prepare(sapi_ctx, key_handle, digest, &scheme, &validation_g);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    ret = Tss2_Sys_SetCmdAuths(sapi_ctx, &auth_cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    ret = Tss2_Sys_SaveTemplate(sapi_ctx, tmpl);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+}
+
+void sign_matches_test()
+{
+    printf("In tss2_sys_template-test::sign_matches_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx = init_dryrun_sized(0);
+
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = EMPTY_AUTH_COMMAND;
+    TPMT_SIG_SCHEME scheme = {.scheme = TPM2_ALG_ECDSA};
+    scheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+    TPM2B_DIGEST digest = {.size = 32};
+    memset(digest.buffer, 0xAB, 32);
+    TPMT_SIGNATURE signature;
+
+    TSS2_RC ret = Tss2_Sys_Sign(sapi_ctx, 0x80000002, &auth_cmd, &digest, &scheme, &validation_g, &signature, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+
+    size_t expected_size = 0;
+    const uint8_t *cmd = NULL;
+    ret = Tss2_Sys_GetCommandBuffer(sapi_ctx, &expected_size, &cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    uint8_t expected[128];
+    TEST_ASSERT(expected_size <= sizeof(expected));
+    memcpy(expected, cmd, expected_size);
+
+    // Saved with a different handle and digest, then patched.
+    struct xtpm_command_template tmpl;
+    TPM2B_DIGEST other_digest = {.size = 32};
+    save_sign_template(sapi_ctx, 0x80000001, &other_digest, &tmpl);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_template_set_handle(&tmpl, 0, 0x80000002));
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_template_set_digest(&tmpl, &digest));
+
+    ret = Tss2_Sys_LoadTemplate(sapi_ctx, &tmpl);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    size_t cmd_size = 0;
+    ret = Tss2_Sys_GetCommandBuffer(sapi_ctx, &cmd_size, &cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(expected_size == cmd_size);
+    TEST_ASSERT(0 == memcmp(expected, cmd, cmd_size));
+
+    ret = Tss2_Sys_Sign_FromTemplate(sapi_ctx, &tmpl, &signature, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+
+    ret = Tss2_Sys_GetCommandBuffer(sapi_ctx, &cmd_size, &cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(expected_size == cmd_size);
+    TEST_ASSERT(0 == memcmp(expected, cmd, cmd_size));
+
+    free_dryrun(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void nv_read_matches_test()
+{
+    printf("In tss2_sys_template-test::nv_read_matches_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx = init_dryrun_sized(0);
+
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = EMPTY_AUTH_COMMAND;
+    TPM2B_MAX_NV_BUFFER data;
+
+    TSS2_RC ret = Tss2_Sys_NV_Read(sapi_ctx, 0x1410000, 0x1410009, &auth_cmd, 48, 96, &data, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+
+    size_t expected_size = 0;
+    const uint8_t *cmd = NULL;
+    ret = Tss2_Sys_GetCommandBuffer(sapi_ctx, &expected_size, &cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    uint8_t expected[64];
+    TEST_ASSERT(expected_size <= sizeof(expected));
+    memcpy(expected, cmd, expected_size);
+
+    struct xtpm_command_template tmpl;
+    ret = Tss2_Sys_NV_Read_Prepare(sapi_ctx, 0x1410000, 0x1410000, 0, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_SetCmdAuths(sapi_ctx, &auth_cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_SaveTemplate(sapi_ctx, &tmpl);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_template_set_handle(&tmpl, 1, 0x1410009));
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_template_set_nv_range(&tmpl, 48, 96));
+
+    ret = Tss2_Sys_NV_Read_FromTemplate(sapi_ctx, &tmpl, &data, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_NOT_PERMITTED == ret);
+
+    size_t cmd_size = 0;
+    ret = Tss2_Sys_GetCommandBuffer(sapi_ctx, &cmd_size, &cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(expected_size == cmd_size);
+    TEST_ASSERT(0 == memcmp(expected, cmd, cmd_size));
+
+    free_dryrun(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void bad_patch_test()
+{
+    printf("In tss2_sys_template-test::bad_patch_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx = init_dryrun_sized(0);
+
+    struct xtpm_command_template tmpl;
+
+    // Nothing prepared yet.
+    TSS2_RC ret = Tss2_Sys_SaveTemplate(sapi_ctx, &tmpl);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_SEQUENCE == ret);
+
+    TPM2B_DIGEST digest = {.size = 32};
+    save_sign_template(sapi_ctx, 0x80000001, &digest, &tmpl);
+
+    TPM2B_DIGEST short_digest = {.size = 20};
+    TEST_ASSERT(TSS2_SYS_RC_BAD_SIZE == xtpm_template_set_digest(&tmpl, &short_digest));
+    TEST_ASSERT(TSS2_SYS_RC_BAD_VALUE == xtpm_template_set_nv_range(&tmpl, 32, 0));
+    TEST_ASSERT(TSS2_SYS_RC_BAD_VALUE == xtpm_template_set_handle(&tmpl, 1, 0x80000001));
+
+    TPM2B_MAX_NV_BUFFER data;
+    ret = Tss2_Sys_NV_Read_FromTemplate(sapi_ctx, &tmpl, &data, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_BAD_VALUE == ret);
+
+    // Fields pointing past the saved command are rejected, not written through.
+    struct xtpm_command_template corrupt = tmpl;
+    corrupt.parameters_offset = XTPM_TEMPLATE_MAX_SIZE - 1;
+    TEST_ASSERT(TSS2_SYS_RC_BAD_VALUE == xtpm_template_set_digest(&corrupt, &digest));
+    TEST_ASSERT(TSS2_SYS_RC_BAD_VALUE == Tss2_Sys_LoadTemplate(sapi_ctx, &corrupt));
+
+    corrupt = tmpl;
+    corrupt.size = tmpl.parameters_offset + sizeof(uint16_t) + digest.size - 1;   // cuts off the digest
+    TEST_ASSERT(TSS2_SYS_RC_BAD_VALUE == xtpm_template_set_digest(&corrupt, &digest));
+
+    corrupt = tmpl;
+    corrupt.size = XTPM_TEMPLATE_MAX_SIZE + 1;
+    TEST_ASSERT(TSS2_SYS_RC_BAD_VALUE == xtpm_template_set_handle(&corrupt, 0, 0x80000001));
+    TEST_ASSERT(TSS2_SYS_RC_BAD_VALUE == Tss2_Sys_LoadTemplate(sapi_ctx, &corrupt));
+
+    corrupt = tmpl;
+    corrupt.handle_count = 200;
+    TEST_ASSERT(TSS2_SYS_RC_BAD_VALUE == xtpm_template_set_handle(&corrupt, 199, 0x80000001));
+
+    free_dryrun(sapi_ctx);
+
+    // The template doesn't fit the smallest context.
+    sapi_ctx = init_dryrun_sized(64);
+    ret = Tss2_Sys_LoadTemplate(sapi_ctx, &tmpl);
+    TEST_ASSERT(TSS2_SYS_RC_INSUFFICIENT_CONTEXT == ret);
+    free_dryrun(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void sign_live_test()
+{
+    printf("In tss2_sys_template-test::sign_live_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(&sapi_ctx);
+
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = EMPTY_AUTH_COMMAND;
+
+    TPM2B_SENSITIVE_CREATE in_sensitive = {0};
+    TPMA_OBJECT obj_attrs = TPMA_OBJECT_FIXEDTPM | TPMA_OBJECT_FIXEDPARENT | TPMA_OBJECT_SENSITIVEDATAORIGIN | TPMA_OBJECT_USERWITHAUTH | TPMA_OBJECT_SIGN_ENCRYPT;
+    TPM2B_PUBLIC in_public = {.publicArea = {.type = TPM2_ALG_ECC,
+                                             .nameAlg = TPM2_ALG_SHA256,
+                                             .objectAttributes = obj_attrs}};
+    in_public.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    in_public.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+    TPM2B_DATA outside_info = {0};
+    TPML_PCR_SELECTION creation_pcr = {0};
+    TPM2_HANDLE key_handle;
+
+    TSS2_RC ret = Tss2_Sys_CreatePrimary(sapi_ctx,
+                                         TPM2_RH_ENDORSEMENT,
+                                         &auth_cmd,
+                                         &in_sensitive,
+                                         &in_public,
+                                         &outside_info,
+                                         &creation_pcr,
+                                         &key_handle,
+                                         NULL,
+                                         NULL,
+                                         NULL,
+                                         NULL,
+                                         NULL,
+                                         NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TPM2B_DIGEST digest = {.size = 32};
+    struct xtpm_command_template tmpl;
+    save_sign_template(sapi_ctx, key_handle, &digest, &tmpl);
+
+    for (uint8_t i = 0; i < 3; i++) {
+        memset(digest.buffer, i, 32);
+        TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_template_set_digest(&tmpl, &digest));
+
+        TPMT_SIGNATURE signature = {0};
+        TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+        ret = Tss2_Sys_Sign_FromTemplate(sapi_ctx, &tmpl, &signature, &auth_rsp);
+        TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+        TEST_ASSERT(TPM2_ALG_ECDSA == signature.sigAlg);
+        TEST_ASSERT(0 != signature.signature.ecdsa.signatureR.size);
+        TEST_ASSERT(0 != signature.signature.ecdsa.signatureS.size);
+    }
+
+    ret = Tss2_Sys_FlushContext(sapi_ctx, key_handle);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    ret = Tss2_Sys_GetTctiContext(sapi_ctx, &tcti_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    Tss2_Tcti_Finalize(tcti_ctx);
+    free(tcti_ctx);
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    printf("ok\n");
+}
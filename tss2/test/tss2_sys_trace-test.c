@@ -0,0 +1,182 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+#include <tss2/tss2_sys_trace.h>
+
+#include "test-utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct test_context {
+    TSS2_SYS_CONTEXT *sapi_ctx;
+};
+
+static void initialize(struct test_context *ctx);
+static void cleanup(struct test_context *ctx);
+
+static void ring_test();
+static void hook_test();
+
+int main(int argc, char *argv[])
+{
+    parse_cmd_args(argc, argv);
+
+    ring_test();
+    hook_test();
+}
+
+void initialize(struct test_context *ctx)
+{
+    init_sapi(&ctx->sapi_ctx);
+}
+
+void cleanup(struct test_context *ctx)
+{
+    TSS2_TCTI_CONTEXT *tcti_context = NULL;
+
+    if (ctx->sapi_ctx != NULL) {
+        TSS2_RC rc = Tss2_Sys_GetTctiContext(ctx->sapi_ctx, &tcti_context);
+        TEST_ASSERT(TSS2_RC_SUCCESS == rc);
+
+        Tss2_Tcti_Finalize(tcti_context);
+        free(tcti_context);
+
+        Tss2_Sys_Finalize(ctx->sapi_ctx);
+        free(ctx->sapi_ctx);
+    }
+}
+
+static
+void
+record_event(struct xtpm_trace_ring *ring,
+             TPM2_CC command_code,
+             const uint8_t *buffer,
+             size_t length)
+{
+    struct xtpm_trace_event event = {.layer = XTPM_TRACE_LAYER_SAPI,
+                                     .direction = XTPM_TRACE_COMMAND,
+                                     .command_code = command_code,
+                                     .buffer = buffer,
+                                     .length = length,
+                                     .start_ns = 1,
+                                     .end_ns = 2};
+    xtpm_trace_ring_record(&event, ring);
+}
+
+void ring_test()
+{
+    printf("In tss2_sys_trace-test::ring_test...\n");
+
+    struct xtpm_trace_ring ring;
+    uint8_t storage[4 * (sizeof(struct xtpm_trace_record) + 8) + 3];
+
+    TEST_ASSERT(TSS2_BASE_RC_INSUFFICIENT_BUFFER == xtpm_trace_ring_init(&ring, storage, sizeof(struct xtpm_trace_record), 8));
+    TEST_ASSERT(TSS2_RC_SUCCESS == xtpm_trace_ring_init(&ring, storage, sizeof(storage), 8));
+
+    struct xtpm_trace_record record;
+    uint8_t data[16];
+    TEST_ASSERT(0 == xtpm_trace_ring_pop(&ring, &record, data, sizeof(data)));
+
+    // Ten records of 8 bytes (snapped from 12) into room for four:
+    // the oldest are overwritten, and records wrap around the end of the storage.
+    uint8_t buffer[12];
+    for (uint8_t i = 0; i < 10; i++) {
+        memset(buffer, i, sizeof(buffer));
+        record_event(&ring, 0x100 + i, buffer, sizeof(buffer));
+    }
+    TEST_ASSERT(6 == xtpm_trace_ring_overwritten(&ring));
+
+    for (uint8_t i = 6; i < 10; i++) {
+        TEST_ASSERT(1 == xtpm_trace_ring_pop(&ring, &record, data, sizeof(data)));
+        TEST_ASSERT(0x100u + i == record.command_code);
+        TEST_ASSERT(12 == record.length);
+        TEST_ASSERT(8 == record.captured_length);
+        TEST_ASSERT(XTPM_TRACE_LAYER_SAPI == record.layer);
+        TEST_ASSERT(XTPM_TRACE_COMMAND == record.direction);
+        TEST_ASSERT(1 == record.start_ns && 2 == record.end_ns);
+        for (size_t j = 0; j < record.captured_length; j++)
+            TEST_ASSERT(i == data[j]);
+    }
+    TEST_ASSERT(0 == xtpm_trace_ring_pop(&ring, &record, data, sizeof(data)));
+
+    printf("ok\n");
+}
+
+struct hook_counts {
+    unsigned sapi_commands;
+    unsigned sapi_responses;
+    unsigned tcti_commands;
+    unsigned tcti_responses;
+    TPM2_CC last_command_code;
+};
+
+static
+void
+count_event(const struct xtpm_trace_event *event,
+            void *user_data)
+{
+    struct hook_counts *counts = user_data;
+
+    if (XTPM_TRACE_LAYER_SAPI == event->layer) {
+        if (XTPM_TRACE_COMMAND == event->direction)
+            counts->sapi_commands++;
+        else
+            counts->sapi_responses++;
+    } else {
+        if (XTPM_TRACE_COMMAND == event->direction)
+            counts->tcti_commands++;
+        else
+            counts->tcti_responses++;
+    }
+
+    counts->last_command_code = event->command_code;
+}
+
+void hook_test()
+{
+    printf("In tss2_sys_trace-test::hook_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    struct hook_counts counts = {0};
+    struct xtpm_trace_hook hook = {.fn = count_event,
+                                   .user_data = &counts,
+                                   .layers = XTPM_TRACE_LAYER_SAPI | XTPM_TRACE_LAYER_TCTI};
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_SetTraceHook(ctx.sapi_ctx, &hook));
+
+    TPM2B_PUBLIC out_public = {0};
+    TPM2B_NAME name = {0};
+    TPM2B_NAME qualified_name = {0};
+    (void)Tss2_Sys_ReadPublic(ctx.sapi_ctx, 0x81FFFFFF, NULL, &out_public, &name, &qualified_name, NULL);
+
+    TEST_ASSERT(1 == counts.sapi_commands && 1 == counts.sapi_responses);
+    TEST_ASSERT(1 == counts.tcti_commands && 1 == counts.tcti_responses);
+    TEST_ASSERT(TPM2_CC_ReadPublic == counts.last_command_code);
+
+    // Once unregistered, nothing more is traced.
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_SetTraceHook(ctx.sapi_ctx, NULL));
+    (void)Tss2_Sys_ReadPublic(ctx.sapi_ctx, 0x81FFFFFF, NULL, &out_public, &name, &qualified_name, NULL);
+    TEST_ASSERT(1 == counts.sapi_commands && 1 == counts.tcti_commands);
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
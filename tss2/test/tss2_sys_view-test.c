@@ -0,0 +1,379 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+#include <tss2/tss2_sys_view.h>
+#include <tss2/tss2_tcti.h>
+
+#include "test-utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Returns the same response to every command.
+struct canned_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V1 v1;
+    uint8_t response[128];
+    size_t response_size;
+};
+
+static void sign_view_test();
+static void nv_read_view_test();
+static void malformed_view_test();
+static void readpublic_view_test();
+
+int main(int argc, char *argv[])
+{
+    parse_cmd_args(argc, argv);
+
+    sign_view_test();
+    nv_read_view_test();
+    malformed_view_test();
+    readpublic_view_test();
+}
+
+static
+TSS2_RC canned_transmit(TSS2_TCTI_CONTEXT *tcti_context, size_t size, uint8_t *command)
+{
+    (void)tcti_context;
+    (void)size;
+    (void)command;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC canned_receive(TSS2_TCTI_CONTEXT *tcti_context, size_t *size, uint8_t *response, int32_t timeout)
+{
+    (void)timeout;
+
+    struct canned_tcti *tcti = (struct canned_tcti*)tcti_context;
+    if (*size < tcti->response_size)
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+
+    memcpy(response, tcti->response, tcti->response_size);
+    *size = tcti->response_size;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+void put_uint16(uint8_t **ptr, uint16_t value)
+{
+    *(*ptr)++ = value >> 8;
+    *(*ptr)++ = value & 0xFF;
+}
+
+static
+void put_uint32(uint8_t **ptr, uint32_t value)
+{
+    put_uint16(ptr, value >> 16);
+    put_uint16(ptr, value & 0xFFFF);
+}
+
+// Set `tcti` up to answer with a successful response with one (password) session,
+// whose parameters are the `parameters_size` bytes at `parameters`.
+static
+void init_canned(struct canned_tcti *tcti,
+                 const uint8_t *parameters,
+                 uint32_t parameters_size)
+{
+    memset(tcti, 0, sizeof(struct canned_tcti));
+    tcti->v1.version = 1;
+    tcti->v1.transmit = canned_transmit;
+    tcti->v1.receive = canned_receive;
+
+    uint8_t *ptr = tcti->response;
+    put_uint16(&ptr, TPM2_ST_SESSIONS);
+    put_uint32(&ptr, 10 + 4 + parameters_size + 5);
+    put_uint32(&ptr, TSS2_RC_SUCCESS);
+    put_uint32(&ptr, parameters_size);
+    memcpy(ptr, parameters, parameters_size);
+    ptr += parameters_size;
+    put_uint16(&ptr, 0);    // nonce
+    *ptr++ = TPMA_SESSION_CONTINUESESSION;
+    put_uint16(&ptr, 0);    // hmac
+    tcti->response_size = ptr - tcti->response;
+}
+
+static
+TSS2_SYS_CONTEXT *init_sapi_canned(struct canned_tcti *tcti)
+{
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    TSS2_SYS_CONTEXT *sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TSS2_RC ret = Tss2_Sys_Initialize(sapi_ctx, sapi_ctx_size, (TSS2_TCTI_CONTEXT*)tcti, &abi_version);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    return sapi_ctx;
+}
+
+static
+void free_sapi_canned(TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+}
+
+static
+TSS2_RC sign_view(TSS2_SYS_CONTEXT *sapi_ctx, struct xtpm_signature_view *view)
+{
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = EMPTY_AUTH_COMMAND;
+    TPM2B_DIGEST digest = {.size = 32};
+    TPMT_SIG_SCHEME scheme = {.scheme = TPM2_ALG_ECDSA};
+    scheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+    TPMT_TK_HASHCHECK validation = {.tag = TPM2_ST_HASHCHECK, .hierarchy = TPM2_RH_NULL};
+
+    return Tss2_Sys_Sign_View(sapi_ctx, 0x80000001, &auth_cmd, &digest, &scheme, &validation, view, NULL);
+}
+
+void sign_view_test()
+{
+    printf("In tss2_sys_view-test::sign_view_test...\n");
+
+    uint8_t signature[2 + 2 + 2 * (2 + 32)];
+    uint8_t *ptr = signature;
+    put_uint16(&ptr, TPM2_ALG_ECDSA);
+    put_uint16(&ptr, TPM2_ALG_SHA256);
+    put_uint16(&ptr, 32);
+    memset(ptr, 0x11, 32);
+    ptr += 32;
+    put_uint16(&ptr, 32);
+    memset(ptr, 0x22, 32);
+
+    struct canned_tcti tcti;
+    init_canned(&tcti, signature, sizeof(signature));
+    TSS2_SYS_CONTEXT *sapi_ctx = init_sapi_canned(&tcti);
+
+    struct xtpm_signature_view view;
+    TSS2_RC ret = sign_view(sapi_ctx, &view);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(TPM2_ALG_ECDSA == view.sigAlg);
+    TEST_ASSERT(TPM2_ALG_SHA256 == view.hash);
+    TEST_ASSERT(32 == view.r.size);
+    TEST_ASSERT(32 == view.s.size);
+    TEST_ASSERT(0x11 == view.r.data[0] && 0x11 == view.r.data[31]);
+    TEST_ASSERT(0x22 == view.s.data[0] && 0x22 == view.s.data[31]);
+    // Right after r, in the response itself.
+    TEST_ASSERT(view.r.data + 32 + 2 == view.s.data);
+
+    free_sapi_canned(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void nv_read_view_test()
+{
+    printf("In tss2_sys_view-test::nv_read_view_test...\n");
+
+    uint8_t data[2 + 16];
+    uint8_t *ptr = data;
+    put_uint16(&ptr, 16);
+    for (uint8_t i = 0; i < 16; i++)
+        *ptr++ = i;
+
+    struct canned_tcti tcti;
+    init_canned(&tcti, data, sizeof(data));
+    TSS2_SYS_CONTEXT *sapi_ctx = init_sapi_canned(&tcti);
+
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = EMPTY_AUTH_COMMAND;
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+    struct xtpm_span view;
+    TSS2_RC ret = Tss2_Sys_NV_Read_View(sapi_ctx, 0x1410000, 0x1410000, &auth_cmd, 16, 0, &view, &auth_rsp);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(16 == view.size);
+    TEST_ASSERT(0 == memcmp(data + 2, view.data, 16));
+    TEST_ASSERT(TPMA_SESSION_CONTINUESESSION == auth_rsp.auths[0].sessionAttributes);
+
+    // The same, in stages.
+    ret = Tss2_Sys_NV_Read_Prepare(sapi_ctx, 0x1410000, 0x1410000, 16, 0);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_SetCmdAuths(sapi_ctx, &auth_cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_ExecuteAsync(sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_ExecuteFinish(sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_GetRspAuths(sapi_ctx, &auth_rsp);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_NV_Read_CompleteView(sapi_ctx, &view);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(16 == view.size);
+    TEST_ASSERT(0 == memcmp(data + 2, view.data, 16));
+
+    free_sapi_canned(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void malformed_view_test()
+{
+    printf("In tss2_sys_view-test::malformed_view_test...\n");
+
+    // s claims more bytes than the response holds.
+    uint8_t signature[2 + 2 + (2 + 32) + 2];
+    uint8_t *ptr = signature;
+    put_uint16(&ptr, TPM2_ALG_ECDSA);
+    put_uint16(&ptr, TPM2_ALG_SHA256);
+    put_uint16(&ptr, 32);
+    memset(ptr, 0x11, 32);
+    ptr += 32;
+    put_uint16(&ptr, 32);
+
+    struct canned_tcti tcti;
+    init_canned(&tcti, signature, sizeof(signature));
+    TSS2_SYS_CONTEXT *sapi_ctx = init_sapi_canned(&tcti);
+
+    struct xtpm_signature_view view;
+    TSS2_RC ret = sign_view(sapi_ctx, &view);
+    TEST_ASSERT(TSS2_SYS_RC_MALFORMED_RESPONSE == ret);
+
+    // Not an ECC signature.
+    ptr = signature;
+    put_uint16(&ptr, 0x0014);   // TPM2_ALG_RSASSA
+    init_canned(&tcti, signature, sizeof(signature));
+    ret = sign_view(sapi_ctx, &view);
+    TEST_ASSERT(TSS2_SYS_RC_MALFORMED_RESPONSE == ret);
+
+    // A whole signature, with a byte left over.
+    uint8_t long_signature[2 + 2 + (2 + 32) + (2 + 32) + 1];
+    ptr = long_signature;
+    put_uint16(&ptr, TPM2_ALG_ECDSA);
+    put_uint16(&ptr, TPM2_ALG_SHA256);
+    put_uint16(&ptr, 32);
+    memset(ptr, 0x11, 32);
+    ptr += 32;
+    put_uint16(&ptr, 32);
+    memset(ptr, 0x22, 32 + 1);
+    init_canned(&tcti, long_signature, sizeof(long_signature));
+    ret = sign_view(sapi_ctx, &view);
+    TEST_ASSERT(TSS2_SYS_RC_MALFORMED_RESPONSE == ret);
+
+    // NV data, with a byte left over.
+    uint8_t long_data[2 + 16 + 1];
+    ptr = long_data;
+    put_uint16(&ptr, 16);
+    memset(ptr, 0x33, 16 + 1);
+    init_canned(&tcti, long_data, sizeof(long_data));
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = EMPTY_AUTH_COMMAND;
+    struct xtpm_span data_view;
+    ret = Tss2_Sys_NV_Read_View(sapi_ctx, 0x1410000, 0x1410000, &auth_cmd, 16, 0, &data_view, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_MALFORMED_RESPONSE == ret);
+
+    free_sapi_canned(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void readpublic_view_test()
+{
+    printf("In tss2_sys_view-test::readpublic_view_test...\n");
+
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    init_sapi(&sapi_ctx);
+
+    TSS2L_SYS_AUTH_COMMAND auth_cmd = EMPTY_AUTH_COMMAND;
+
+    TPM2B_SENSITIVE_CREATE in_sensitive = {0};
+    TPMA_OBJECT obj_attrs = TPMA_OBJECT_FIXEDTPM | TPMA_OBJECT_FIXEDPARENT | TPMA_OBJECT_SENSITIVEDATAORIGIN | TPMA_OBJECT_USERWITHAUTH | TPMA_OBJECT_SIGN_ENCRYPT;
+    TPM2B_PUBLIC in_public = {.publicArea = {.type = TPM2_ALG_ECC,
+                                             .nameAlg = TPM2_ALG_SHA256,
+                                             .objectAttributes = obj_attrs}};
+    in_public.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_ECDSA;
+    in_public.publicArea.parameters.eccDetail.scheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+    in_public.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    in_public.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+    TPM2B_DATA outside_info = {0};
+    TPML_PCR_SELECTION creation_pcr = {0};
+    TPM2_HANDLE key_handle;
+
+    TSS2_RC ret = Tss2_Sys_CreatePrimary(sapi_ctx,
+                                         TPM2_RH_ENDORSEMENT,
+                                         &auth_cmd,
+                                         &in_sensitive,
+                                         &in_public,
+                                         &outside_info,
+                                         &creation_pcr,
+                                         &key_handle,
+                                         NULL,
+                                         NULL,
+                                         NULL,
+                                         NULL,
+                                         NULL,
+                                         NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TPM2B_PUBLIC out_public = {0};
+    ret = Tss2_Sys_ReadPublic(sapi_ctx, key_handle, NULL, &out_public, NULL, NULL, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    struct xtpm_public_view view;
+    ret = Tss2_Sys_ReadPublic_View(sapi_ctx, key_handle, &view);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TEST_ASSERT(TPM2_ALG_ECC == view.type);
+    TEST_ASSERT(TPM2_ALG_SHA256 == view.nameAlg);
+    TEST_ASSERT(out_public.publicArea.objectAttributes == view.objectAttributes);
+    TEST_ASSERT(TPM2_ECC_NIST_P256 == view.curveID);
+    TEST_ASSERT(out_public.publicArea.unique.ecc.x.size == view.x.size);
+    TEST_ASSERT(0 == memcmp(out_public.publicArea.unique.ecc.x.buffer, view.x.data, view.x.size));
+    TEST_ASSERT(out_public.publicArea.unique.ecc.y.size == view.y.size);
+    TEST_ASSERT(0 == memcmp(out_public.publicArea.unique.ecc.y.buffer, view.y.data, view.y.size));
+
+    // Sign and view the signature in stages.
+    TPM2B_DIGEST digest = {.size = 32};
+    TPMT_SIG_SCHEME scheme = {.scheme = TPM2_ALG_ECDSA};
+    scheme.details.ecdsa.hashAlg = TPM2_ALG_SHA256;
+    TPMT_TK_HASHCHECK validation = {.tag = TPM2_ST_HASHCHECK, .hierarchy = TPM2_RH_NULL};
+    TSS2L_SYS_AUTH_RESPONSE auth_rsp = {.count = 1};
+
+    ret = Tss2_Sys_Sign_Prepare(sapi_ctx, key_handle, &digest, &scheme, &validation);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_SetCmdAuths(sapi_ctx, &auth_cmd);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_ExecuteAsync(sapi_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_ExecuteFinish(sapi_ctx, TSS2_TCTI_TIMEOUT_BLOCK);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    ret = Tss2_Sys_GetRspAuths(sapi_ctx, &auth_rsp);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    struct xtpm_signature_view signature;
+    ret = Tss2_Sys_Sign_CompleteView(sapi_ctx, &signature);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(TPM2_ALG_ECDSA == signature.sigAlg);
+    TEST_ASSERT(0 != signature.r.size);
+    TEST_ASSERT(0 != signature.s.size);
+
+    ret = Tss2_Sys_FlushContext(sapi_ctx, key_handle);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    ret = Tss2_Sys_GetTctiContext(sapi_ctx, &tcti_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    Tss2_Tcti_Finalize(tcti_ctx);
+    free(tcti_ctx);
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    printf("ok\n");
+}
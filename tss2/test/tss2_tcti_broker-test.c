@@ -0,0 +1,377 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_tcti_broker.h>
+#include <tss2/tss2_tcti_loopback.h>
+#include <tss2/tss2_sys.h>
+
+#include "test-utils.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CLIENT_COUNT 3
+#define OBJECTS_PER_CLIENT 2    // so the clients need twice the loopback TPM's 3 object slots
+#define THREAD_COUNT 4
+#define ITERATIONS 100
+
+struct test_context {
+    TSS2_TCTI_CONTEXT *inner_ctx;
+    TSS2_TCTI_BROKER_CONTEXT *broker_ctx;
+};
+
+struct client {
+    TSS2_TCTI_CONTEXT *tcti_ctx;
+    TSS2_SYS_CONTEXT *sapi_ctx;
+    TPM2_HANDLE handles[OBJECTS_PER_CLIENT];
+    TPM2B_PUBLIC publics[OBJECTS_PER_CLIENT];
+};
+
+struct thread_args {
+    TSS2_TCTI_BROKER_CONTEXT *broker_ctx;
+    int seed;
+    int failures;
+};
+
+static void initialize(struct test_context *ctx);
+static void cleanup(struct test_context *ctx);
+
+static void new_client(TSS2_TCTI_BROKER_CONTEXT *broker_ctx, struct client *client);
+static void free_client(struct client *client);
+
+static TSS2_RC create_primary(TSS2_SYS_CONTEXT *sapi_ctx,
+                              uint8_t seed,
+                              TPM2_HANDLE *handle_out,
+                              TPM2B_PUBLIC *public_out);
+static int matches(TSS2_SYS_CONTEXT *sapi_ctx,
+                   TPM2_HANDLE handle,
+                   const TPM2B_PUBLIC *expected);
+
+static void init_test();
+static void virtual_handle_test();
+static void swap_test();
+static void threads_test();
+
+int main()
+{
+    init_test();
+    virtual_handle_test();
+    swap_test();
+    threads_test();
+}
+
+void initialize(struct test_context *ctx)
+{
+    size_t ctx_size;
+    TSS2_RC init_ret = Tss2_Tcti_Loopback_Init(NULL, &ctx_size, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    ctx->inner_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != ctx->inner_ctx);
+
+    init_ret = Tss2_Tcti_Loopback_Init(ctx->inner_ctx, &ctx_size, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    init_ret = Tss2_Tcti_Broker_Init(NULL, &ctx_size, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    ctx->broker_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != ctx->broker_ctx);
+
+    init_ret = Tss2_Tcti_Broker_Init(ctx->broker_ctx, &ctx_size, ctx->inner_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+}
+
+void cleanup(struct test_context *ctx)
+{
+    Tss2_Tcti_Broker_Finalize(ctx->broker_ctx);
+    free(ctx->broker_ctx);
+    free(ctx->inner_ctx);
+}
+
+void new_client(TSS2_TCTI_BROKER_CONTEXT *broker_ctx, struct client *client)
+{
+    memset(client, 0, sizeof(struct client));
+
+    size_t ctx_size;
+    TSS2_RC init_ret = Tss2_Tcti_Broker_Client_Init(NULL, &ctx_size, broker_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    client->tcti_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != client->tcti_ctx);
+
+    init_ret = Tss2_Tcti_Broker_Client_Init(client->tcti_ctx, &ctx_size, broker_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    client->sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != client->sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    init_ret = Tss2_Sys_Initialize(client->sapi_ctx, sapi_ctx_size, client->tcti_ctx, &abi_version);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+}
+
+void free_client(struct client *client)
+{
+    Tss2_Sys_Finalize(client->sapi_ctx);
+    free(client->sapi_ctx);
+
+    Tss2_Tcti_Finalize(client->tcti_ctx);
+    free(client->tcti_ctx);
+}
+
+TSS2_RC create_primary(TSS2_SYS_CONTEXT *sapi_ctx,
+                       uint8_t seed,
+                       TPM2_HANDLE *handle_out,
+                       TPM2B_PUBLIC *public_out)
+{
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPM2B_SENSITIVE_CREATE inSensitive = {};
+
+    TPM2B_PUBLIC in_public = {.publicArea = {.type=TPM2_ALG_ECC,
+                                             .nameAlg=TPM2_ALG_SHA256,
+                                             .objectAttributes=(TPMA_OBJECT_USERWITHAUTH |
+                                                                TPMA_OBJECT_RESTRICTED |
+                                                                TPMA_OBJECT_DECRYPT |
+                                                                TPMA_OBJECT_FIXEDTPM |
+                                                                TPMA_OBJECT_FIXEDPARENT |
+                                                                TPMA_OBJECT_SENSITIVEDATAORIGIN)}};
+    in_public.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_AES;
+    in_public.publicArea.parameters.eccDetail.symmetric.keyBits.aes = 128;
+    in_public.publicArea.parameters.eccDetail.symmetric.mode.sym = TPM2_ALG_CFB;
+    in_public.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    in_public.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+
+    // A different template gives a different primary key.
+    in_public.publicArea.unique.ecc.x.size = 1;
+    in_public.publicArea.unique.ecc.x.buffer[0] = seed;
+
+    TPM2B_DATA outsideInfo = {};
+    TPML_PCR_SELECTION creationPCR = {};
+    TPM2B_CREATION_DATA creationData = {};
+    TPM2B_DIGEST creationHash = {};
+    TPMT_TK_CREATION creationTicket = {};
+    TPM2B_NAME name = {};
+
+    return Tss2_Sys_CreatePrimary(sapi_ctx,
+                                  TPM2_RH_OWNER,
+                                  &sessionsData,
+                                  &inSensitive,
+                                  &in_public,
+                                  &outsideInfo,
+                                  &creationPCR,
+                                  handle_out,
+                                  public_out,
+                                  &creationData,
+                                  &creationHash,
+                                  &creationTicket,
+                                  &name,
+                                  &sessionsDataOut);
+}
+
+int matches(TSS2_SYS_CONTEXT *sapi_ctx,
+            TPM2_HANDLE handle,
+            const TPM2B_PUBLIC *expected)
+{
+    TPM2B_PUBLIC out_public = {};
+    TPM2B_NAME name = {};
+    TPM2B_NAME qualified_name = {};
+    TSS2_RC ret = Tss2_Sys_ReadPublic(sapi_ctx, handle, NULL, &out_public, &name, &qualified_name, NULL);
+
+    return TSS2_RC_SUCCESS == ret &&
+           out_public.publicArea.unique.ecc.x.size == expected->publicArea.unique.ecc.x.size &&
+           0 == memcmp(out_public.publicArea.unique.ecc.x.buffer,
+                       expected->publicArea.unique.ecc.x.buffer,
+                       out_public.publicArea.unique.ecc.x.size);
+}
+
+void init_test()
+{
+    printf("In tss2_tcti_broker-test::init_test...\n");
+
+    size_t ctx_size = 0;
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_REFERENCE == Tss2_Tcti_Broker_Init(NULL, NULL, NULL));
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_REFERENCE == Tss2_Tcti_Broker_Client_Init(NULL, NULL, NULL));
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Broker_Init(NULL, &ctx_size, NULL));
+    TEST_ASSERT(0 != ctx_size);
+
+    TSS2_TCTI_BROKER_CONTEXT *broker_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != broker_ctx);
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_REFERENCE == Tss2_Tcti_Broker_Init(broker_ctx, &ctx_size, NULL));
+    free(broker_ctx);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Broker_Client_Init(NULL, &ctx_size, NULL));
+    TEST_ASSERT(0 != ctx_size);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != tcti_ctx);
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_REFERENCE == Tss2_Tcti_Broker_Client_Init(tcti_ctx, &ctx_size, NULL));
+    free(tcti_ctx);
+
+    printf("ok\n");
+}
+
+void virtual_handle_test()
+{
+    printf("In tss2_tcti_broker-test::virtual_handle_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    struct client first, second;
+    new_client(ctx.broker_ctx, &first);
+    new_client(ctx.broker_ctx, &second);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == create_primary(first.sapi_ctx, 1, &first.handles[0], &first.publics[0]));
+    TEST_ASSERT(0x80ff0000 == (first.handles[0] & 0xffff0000));
+    TEST_ASSERT(matches(first.sapi_ctx, first.handles[0], &first.publics[0]));
+
+    // Each client only sees its own objects, even under the same virtual handle.
+    TEST_ASSERT(!matches(second.sapi_ctx, first.handles[0], &first.publics[0]));
+    TEST_ASSERT(TSS2_RC_SUCCESS == create_primary(second.sapi_ctx, 2, &second.handles[0], &second.publics[0]));
+    TEST_ASSERT(second.handles[0] == first.handles[0]);
+    TEST_ASSERT(matches(second.sapi_ctx, second.handles[0], &second.publics[0]));
+    TEST_ASSERT(matches(first.sapi_ctx, first.handles[0], &first.publics[0]));
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_FlushContext(first.sapi_ctx, first.handles[0]));
+    TEST_ASSERT(!matches(first.sapi_ctx, first.handles[0], &first.publics[0]));
+    TEST_ASSERT(TSS2_RC_SUCCESS != Tss2_Sys_FlushContext(first.sapi_ctx, first.handles[0]));
+    TEST_ASSERT(matches(second.sapi_ctx, second.handles[0], &second.publics[0]));
+
+    // Startup isn't passed on.
+    uint8_t startup[] = {0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x44, 0x00, 0x00};
+    uint8_t response[TPM2_MAX_RESPONSE_SIZE];
+    size_t response_size = sizeof(response);
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Transmit(first.tcti_ctx, sizeof(startup), startup));
+    TEST_ASSERT(TSS2_TCTI_RC_NOT_IMPLEMENTED ==
+            Tss2_Tcti_Receive(first.tcti_ctx, &response_size, response, 0));
+    TEST_ASSERT(TSS2_RC_SUCCESS ==
+            Tss2_Tcti_Receive(first.tcti_ctx, &response_size, response, TSS2_TCTI_TIMEOUT_BLOCK));
+    TEST_ASSERT(10 == response_size);
+    TEST_ASSERT(0x00 == response[6] && 0x00 == response[7] && 0x01 == response[8] && 0x43 == response[9]);
+
+    free_client(&first);
+    free_client(&second);
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+void swap_test()
+{
+    printf("In tss2_tcti_broker-test::swap_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    struct client clients[CLIENT_COUNT];
+    for (int i = 0; i < CLIENT_COUNT; i++) {
+        new_client(ctx.broker_ctx, &clients[i]);
+        for (int j = 0; j < OBJECTS_PER_CLIENT; j++)
+            TEST_ASSERT(TSS2_RC_SUCCESS == create_primary(clients[i].sapi_ctx,
+                                                          i * OBJECTS_PER_CLIENT + j,
+                                                          &clients[i].handles[j],
+                                                          &clients[i].publics[j]));
+    }
+
+    for (int round = 0; round < 3; round++) {
+        for (int j = 0; j < OBJECTS_PER_CLIENT; j++) {
+            for (int i = 0; i < CLIENT_COUNT; i++)
+                TEST_ASSERT(matches(clients[i].sapi_ctx, clients[i].handles[j], &clients[i].publics[j]));
+        }
+    }
+
+    TSS2_TCTI_BROKER_STATS stats;
+    Tss2_Tcti_Broker_GetStats(ctx.broker_ctx, &stats);
+    TEST_ASSERT(stats.evictions > 0);
+    TEST_ASSERT(stats.reloads > 0);
+
+    // Finalizing the clients flushes all their objects, so there's room again.
+    for (int i = 0; i < CLIENT_COUNT; i++)
+        free_client(&clients[i]);
+
+    struct client client;
+    new_client(ctx.broker_ctx, &client);
+    for (int j = 0; j < OBJECTS_PER_CLIENT; j++)
+        TEST_ASSERT(TSS2_RC_SUCCESS == create_primary(client.sapi_ctx, j, &client.handles[j], &client.publics[j]));
+
+    TSS2_TCTI_BROKER_STATS after;
+    Tss2_Tcti_Broker_GetStats(ctx.broker_ctx, &after);
+    TEST_ASSERT(after.evictions == stats.evictions);
+
+    free_client(&client);
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+static
+void *create_and_read_loop(void *arg)
+{
+    struct thread_args *args = arg;
+
+    struct client client;
+    new_client(args->broker_ctx, &client);
+
+    for (int j = 0; j < OBJECTS_PER_CLIENT; j++) {
+        if (TSS2_RC_SUCCESS != create_primary(client.sapi_ctx,
+                                              args->seed * OBJECTS_PER_CLIENT + j,
+                                              &client.handles[j],
+                                              &client.publics[j]))
+            args->failures++;
+    }
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        if (!matches(client.sapi_ctx, client.handles[i % OBJECTS_PER_CLIENT], &client.publics[i % OBJECTS_PER_CLIENT]))
+            args->failures++;
+    }
+
+    free_client(&client);
+
+    return NULL;
+}
+
+void threads_test()
+{
+    printf("In tss2_tcti_broker-test::threads_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    pthread_t threads[THREAD_COUNT];
+    struct thread_args args[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        args[i] = (struct thread_args){.broker_ctx = ctx.broker_ctx, .seed = i};
+        TEST_ASSERT(0 == pthread_create(&threads[i], NULL, create_and_read_loop, &args[i]));
+    }
+
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        TEST_ASSERT(0 == pthread_join(threads[i], NULL));
+        TEST_ASSERT(0 == args[i].failures);
+    }
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
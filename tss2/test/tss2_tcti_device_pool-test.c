@@ -0,0 +1,279 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_tcti_device_pool.h>
+
+#include "test-utils.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Writes to it succeed, and reads return an empty response, so no TPM is needed.
+#define NULL_DEVICE "/dev/null"
+
+#define THREAD_COUNT 8
+#define ITERATIONS 500
+#define MAX_FDS 3
+
+static TSS2_TCTI_DEVICE_POOL *new_pool(size_t max_fds);
+static void free_pool(TSS2_TCTI_DEVICE_POOL *pool);
+
+static TSS2_TCTI_CONTEXT *new_client(TSS2_TCTI_DEVICE_POOL *pool,
+                                     enum tss2_tcti_device_pool_lease lease);
+static void free_client(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+static TSS2_RC round_trip(TSS2_TCTI_CONTEXT *tcti_ctx);
+
+static void init_test();
+static void per_command_test();
+static void per_client_test();
+static void threads_test();
+
+int main()
+{
+    init_test();
+    per_command_test();
+    per_client_test();
+    threads_test();
+}
+
+TSS2_TCTI_DEVICE_POOL *new_pool(size_t max_fds)
+{
+    size_t pool_size;
+    TSS2_RC init_ret = Tss2_Tcti_Device_Pool_Init(NULL, &pool_size, NULL_DEVICE, max_fds);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    TSS2_TCTI_DEVICE_POOL *pool = malloc(pool_size);
+    TEST_ASSERT(NULL != pool);
+
+    init_ret = Tss2_Tcti_Device_Pool_Init(pool, &pool_size, NULL_DEVICE, max_fds);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    return pool;
+}
+
+void free_pool(TSS2_TCTI_DEVICE_POOL *pool)
+{
+    Tss2_Tcti_Device_Pool_Finalize(pool);
+    free(pool);
+}
+
+TSS2_TCTI_CONTEXT *new_client(TSS2_TCTI_DEVICE_POOL *pool,
+                              enum tss2_tcti_device_pool_lease lease)
+{
+    size_t ctx_size;
+    TSS2_RC init_ret = Tss2_Tcti_Device_Pool_Client_Init(NULL, &ctx_size, pool, lease);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != tcti_ctx);
+
+    init_ret = Tss2_Tcti_Device_Pool_Client_Init(tcti_ctx, &ctx_size, pool, lease);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    return tcti_ctx;
+}
+
+void free_client(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    Tss2_Tcti_Finalize(tcti_ctx);
+    free(tcti_ctx);
+}
+
+TSS2_RC round_trip(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    uint8_t command[] = {0x80, 0x01, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x7b};
+    uint8_t response[64];
+    size_t response_size = sizeof(response);
+
+    TSS2_RC ret = Tss2_Tcti_Transmit(tcti_ctx, sizeof(command), command);
+    if (TSS2_RC_SUCCESS != ret)
+        return ret;
+
+    return Tss2_Tcti_Receive(tcti_ctx, &response_size, response, TSS2_TCTI_TIMEOUT_BLOCK);
+}
+
+void init_test()
+{
+    printf("In tss2_tcti_device_pool-test::init_test...\n");
+
+    size_t size = 0;
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_REFERENCE == Tss2_Tcti_Device_Pool_Init(NULL, NULL, NULL, 1));
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_VALUE == Tss2_Tcti_Device_Pool_Init(NULL, &size, NULL, 0));
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_VALUE ==
+            Tss2_Tcti_Device_Pool_Init(NULL, &size, NULL, TSS2_TCTI_DEVICE_POOL_MAX_FDS + 1));
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Device_Pool_Init(NULL, &size, NULL, 1));
+    size_t one_fd_size = size;
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Device_Pool_Init(NULL, &size, NULL, 2));
+    TEST_ASSERT(size > one_fd_size);
+
+    TSS2_TCTI_DEVICE_POOL *pool = malloc(size);
+    TEST_ASSERT(NULL != pool);
+    TEST_ASSERT(TSS2_TCTI_RC_IO_ERROR == Tss2_Tcti_Device_Pool_Init(pool, &size, "/nonexistent/tpmrm0", 2));
+
+    char long_path[128];
+    memset(long_path, 'a', sizeof(long_path) - 1);
+    long_path[sizeof(long_path) - 1] = 0;
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_VALUE == Tss2_Tcti_Device_Pool_Init(pool, &size, long_path, 2));
+    free(pool);
+
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_REFERENCE ==
+            Tss2_Tcti_Device_Pool_Client_Init(NULL, NULL, NULL, TSS2_TCTI_DEVICE_POOL_LEASE_PER_COMMAND));
+    TEST_ASSERT(TSS2_RC_SUCCESS ==
+            Tss2_Tcti_Device_Pool_Client_Init(NULL, &size, NULL, TSS2_TCTI_DEVICE_POOL_LEASE_PER_COMMAND));
+    TEST_ASSERT(0 != size);
+
+    printf("ok\n");
+}
+
+void per_command_test()
+{
+    printf("In tss2_tcti_device_pool-test::per_command_test...\n");
+
+    TSS2_TCTI_DEVICE_POOL *pool = new_pool(2);
+    TSS2_TCTI_CONTEXT *tcti_ctx = new_client(pool, TSS2_TCTI_DEVICE_POOL_LEASE_PER_COMMAND);
+
+    TSS2_TCTI_DEVICE_POOL_STATS stats;
+    Tss2_Tcti_Device_Pool_GetStats(pool, &stats);
+    TEST_ASSERT(1 == stats.open_fds);
+    TEST_ASSERT(0 == stats.leased_fds);
+
+    uint8_t response[64];
+    size_t response_size = sizeof(response);
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_SEQUENCE ==
+            Tss2_Tcti_Receive(tcti_ctx, &response_size, response, TSS2_TCTI_TIMEOUT_BLOCK));
+
+    uint8_t command[] = {0x80, 0x01, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x7b};
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Transmit(tcti_ctx, sizeof(command), command));
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_SEQUENCE == Tss2_Tcti_Transmit(tcti_ctx, sizeof(command), command));
+
+    Tss2_Tcti_Device_Pool_GetStats(pool, &stats);
+    TEST_ASSERT(1 == stats.leased_fds);
+
+    // Rejected without reading, so the response is still there.
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_REFERENCE ==
+            Tss2_Tcti_Receive(tcti_ctx, &response_size, NULL, TSS2_TCTI_TIMEOUT_BLOCK));
+    TEST_ASSERT(TSS2_TCTI_RC_NOT_IMPLEMENTED ==
+            Tss2_Tcti_Receive(tcti_ctx, &response_size, response, 0));
+
+    TEST_ASSERT(TSS2_RC_SUCCESS ==
+            Tss2_Tcti_Receive(tcti_ctx, &response_size, response, TSS2_TCTI_TIMEOUT_BLOCK));
+
+    Tss2_Tcti_Device_Pool_GetStats(pool, &stats);
+    TEST_ASSERT(1 == stats.open_fds);
+    TEST_ASSERT(0 == stats.leased_fds);
+    TEST_ASSERT(1 == stats.leases);
+
+    // Two clients in flight at once need two fds.
+    TSS2_TCTI_CONTEXT *other_ctx = new_client(pool, TSS2_TCTI_DEVICE_POOL_LEASE_PER_COMMAND);
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Transmit(tcti_ctx, sizeof(command), command));
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Transmit(other_ctx, sizeof(command), command));
+
+    Tss2_Tcti_Device_Pool_GetStats(pool, &stats);
+    TEST_ASSERT(2 == stats.open_fds);
+    TEST_ASSERT(2 == stats.leased_fds);
+
+    // A client finalized with its response unread closes the fd.
+    free_client(other_ctx);
+
+    Tss2_Tcti_Device_Pool_GetStats(pool, &stats);
+    TEST_ASSERT(1 == stats.open_fds);
+    TEST_ASSERT(1 == stats.leased_fds);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS ==
+            Tss2_Tcti_Receive(tcti_ctx, &response_size, response, TSS2_TCTI_TIMEOUT_BLOCK));
+
+    free_client(tcti_ctx);
+    free_pool(pool);
+
+    printf("ok\n");
+}
+
+void per_client_test()
+{
+    printf("In tss2_tcti_device_pool-test::per_client_test...\n");
+
+    TSS2_TCTI_DEVICE_POOL *pool = new_pool(2);
+    TSS2_TCTI_CONTEXT *tcti_ctx = new_client(pool, TSS2_TCTI_DEVICE_POOL_LEASE_PER_CLIENT);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == round_trip(tcti_ctx));
+    TEST_ASSERT(TSS2_RC_SUCCESS == round_trip(tcti_ctx));
+
+    TSS2_TCTI_DEVICE_POOL_STATS stats;
+    Tss2_Tcti_Device_Pool_GetStats(pool, &stats);
+    TEST_ASSERT(1 == stats.open_fds);
+    TEST_ASSERT(1 == stats.leased_fds);
+    TEST_ASSERT(1 == stats.leases);
+
+    free_client(tcti_ctx);
+
+    Tss2_Tcti_Device_Pool_GetStats(pool, &stats);
+    TEST_ASSERT(0 == stats.open_fds);
+    TEST_ASSERT(0 == stats.leased_fds);
+
+    // And the fd is reopened for the next client.
+    tcti_ctx = new_client(pool, TSS2_TCTI_DEVICE_POOL_LEASE_PER_CLIENT);
+    TEST_ASSERT(TSS2_RC_SUCCESS == round_trip(tcti_ctx));
+
+    Tss2_Tcti_Device_Pool_GetStats(pool, &stats);
+    TEST_ASSERT(1 == stats.open_fds);
+
+    free_client(tcti_ctx);
+    free_pool(pool);
+
+    printf("ok\n");
+}
+
+static
+void *thread_main(void *arg)
+{
+    TSS2_TCTI_DEVICE_POOL *pool = arg;
+    TSS2_TCTI_CONTEXT *tcti_ctx = new_client(pool, TSS2_TCTI_DEVICE_POOL_LEASE_PER_COMMAND);
+
+    for (int i = 0; i < ITERATIONS; i++)
+        TEST_ASSERT(TSS2_RC_SUCCESS == round_trip(tcti_ctx));
+
+    free_client(tcti_ctx);
+
+    return NULL;
+}
+
+void threads_test()
+{
+    printf("In tss2_tcti_device_pool-test::threads_test...\n");
+
+    TSS2_TCTI_DEVICE_POOL *pool = new_pool(MAX_FDS);
+
+    pthread_t threads[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++)
+        TEST_ASSERT(0 == pthread_create(&threads[i], NULL, thread_main, pool));
+    for (int i = 0; i < THREAD_COUNT; i++)
+        TEST_ASSERT(0 == pthread_join(threads[i], NULL));
+
+    TSS2_TCTI_DEVICE_POOL_STATS stats;
+    Tss2_Tcti_Device_Pool_GetStats(pool, &stats);
+    TEST_ASSERT(stats.open_fds >= 1 && stats.open_fds <= MAX_FDS);
+    TEST_ASSERT(0 == stats.leased_fds);
+    TEST_ASSERT(THREAD_COUNT * ITERATIONS == stats.leases);
+
+    free_pool(pool);
+
+    printf("ok\n");
+}
@@ -0,0 +1,435 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_tcti_loopback.h>
+#include <tss2/tss2_sys.h>
+
+#include "../src/internal/tcti_common.h"
+
+#include "test-utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct test_context {
+    TSS2_TCTI_CONTEXT *tcti_ctx;
+    TSS2_SYS_CONTEXT *sapi_ctx;
+};
+
+static void initialize(struct test_context *ctx);
+static void cleanup(struct test_context *ctx);
+
+static TSS2_RC create_primary(struct test_context *ctx, const char *password, TPM2_HANDLE *handle_out);
+static TSS2_RC read_public(struct test_context *ctx, TPM2_HANDLE handle);
+
+static void init_test();
+static void auth_test();
+static void evict_clear_test();
+static void load_integrity_test();
+static void latency_test();
+static void small_context_test();
+
+int main()
+{
+    init_test();
+    auth_test();
+    evict_clear_test();
+    load_integrity_test();
+    latency_test();
+    small_context_test();
+}
+
+void initialize(struct test_context *ctx)
+{
+    TSS2_RC init_ret;
+
+    size_t ctx_size;
+    init_ret = Tss2_Tcti_Loopback_Init(NULL, &ctx_size, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    ctx->tcti_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != ctx->tcti_ctx);
+
+    init_ret = Tss2_Tcti_Loopback_Init(ctx->tcti_ctx, &ctx_size, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    ctx->sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != ctx->sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    init_ret = Tss2_Sys_Initialize(ctx->sapi_ctx,
+                                   sapi_ctx_size,
+                                   ctx->tcti_ctx,
+                                   &abi_version);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+}
+
+void cleanup(struct test_context *ctx)
+{
+    Tss2_Sys_Finalize(ctx->sapi_ctx);
+    free(ctx->sapi_ctx);
+
+    Tss2_Tcti_Finalize(ctx->tcti_ctx);
+    free(ctx->tcti_ctx);
+}
+
+TSS2_RC create_primary(struct test_context *ctx, const char *password, TPM2_HANDLE *handle_out)
+{
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    sessionsData.auths[0].hmac.size = strlen(password);
+    memcpy(sessionsData.auths[0].hmac.buffer, password, strlen(password));
+
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPM2B_SENSITIVE_CREATE inSensitive = {};
+
+    TPM2B_PUBLIC in_public = {.publicArea = {.type=TPM2_ALG_ECC,
+                                             .nameAlg=TPM2_ALG_SHA256,
+                                             .objectAttributes=(TPMA_OBJECT_USERWITHAUTH |
+                                                                TPMA_OBJECT_RESTRICTED |
+                                                                TPMA_OBJECT_DECRYPT |
+                                                                TPMA_OBJECT_FIXEDTPM |
+                                                                TPMA_OBJECT_FIXEDPARENT |
+                                                                TPMA_OBJECT_SENSITIVEDATAORIGIN)}};
+    in_public.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_AES;
+    in_public.publicArea.parameters.eccDetail.symmetric.keyBits.aes = 128;
+    in_public.publicArea.parameters.eccDetail.symmetric.mode.sym = TPM2_ALG_CFB;
+    in_public.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    in_public.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+
+    TPM2B_DATA outsideInfo = {};
+    TPML_PCR_SELECTION creationPCR = {};
+    TPM2B_CREATION_DATA creationData = {};
+    TPM2B_DIGEST creationHash = {};
+    TPMT_TK_CREATION creationTicket = {};
+    TPM2B_NAME name = {};
+    TPM2B_PUBLIC public_key = {};
+
+    return Tss2_Sys_CreatePrimary(ctx->sapi_ctx,
+                                  TPM2_RH_OWNER,
+                                  &sessionsData,
+                                  &inSensitive,
+                                  &in_public,
+                                  &outsideInfo,
+                                  &creationPCR,
+                                  handle_out,
+                                  &public_key,
+                                  &creationData,
+                                  &creationHash,
+                                  &creationTicket,
+                                  &name,
+                                  &sessionsDataOut);
+}
+
+TSS2_RC read_public(struct test_context *ctx, TPM2_HANDLE handle)
+{
+    TPM2B_PUBLIC public_key = {};
+    TPM2B_NAME name = {};
+    TPM2B_NAME qualified_name = {};
+
+    return Tss2_Sys_ReadPublic(ctx->sapi_ctx,
+                               handle,
+                               NULL,
+                               &public_key,
+                               &name,
+                               &qualified_name,
+                               NULL);
+}
+
+void init_test()
+{
+    printf("In tss2_tcti_loopback-test::init_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TEST_ASSERT(TCTI_MAGIC == ((TSS2_TCTI_CONTEXT_VERSION *)ctx.tcti_ctx)->magic);
+    TEST_ASSERT(TCTI_VERSION == ((TSS2_TCTI_CONTEXT_VERSION *)ctx.tcti_ctx)->version);
+
+    size_t ctx_size;
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Loopback_Init(NULL, &ctx_size, NULL));
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_VALUE == Tss2_Tcti_Loopback_Init(ctx.tcti_ctx, &ctx_size, "latency_us=x"));
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_VALUE == Tss2_Tcti_Loopback_Init(ctx.tcti_ctx, &ctx_size, "port=2321"));
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Loopback_Init(ctx.tcti_ctx, &ctx_size, "latency_us=0"));
+
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_VALUE == Tss2_Tcti_Loopback_SetLatency(ctx.tcti_ctx, 0x1FF, 10));
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+void auth_test()
+{
+    printf("In tss2_tcti_loopback-test::auth_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPM2B_AUTH newAuth = {.size = 4, .buffer = "pass"};
+    TSS2_RC ret = Tss2_Sys_HierarchyChangeAuth(ctx.sapi_ctx,
+                                               TPM2_RH_OWNER,
+                                               &sessionsData,
+                                               &newAuth,
+                                               &sessionsDataOut);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TPM2_HANDLE handle;
+    ret = create_primary(&ctx, "", &handle);
+    TEST_ASSERT(TPM_RC_AUTH_FAIL + TPM_RC_S + (1 << TPM_RC_N_SHIFT) == ret);
+
+    ret = create_primary(&ctx, "pass", &handle);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // Clear resets the owner auth
+    ret = Tss2_Sys_Clear(ctx.sapi_ctx,
+                         TPM2_RH_LOCKOUT,
+                         &sessionsData,
+                         &sessionsDataOut);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    ret = create_primary(&ctx, "", &handle);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+void evict_clear_test()
+{
+    printf("In tss2_tcti_loopback-test::evict_clear_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPM2_HANDLE handle;
+    TSS2_RC ret = create_primary(&ctx, "", &handle);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    // The owner can't persist into the platform's range
+    ret = Tss2_Sys_EvictControl(ctx.sapi_ctx,
+                                TPM2_RH_OWNER,
+                                handle,
+                                &sessionsData,
+                                0x81800000,
+                                &sessionsDataOut);
+    TEST_ASSERT(TPM_RC_RANGE + TPM_RC_P + (1 << TPM_RC_N_SHIFT) == ret);
+
+    ret = Tss2_Sys_EvictControl(ctx.sapi_ctx,
+                                TPM2_RH_OWNER,
+                                handle,
+                                &sessionsData,
+                                0x81000001,
+                                &sessionsDataOut);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    ret = Tss2_Sys_FlushContext(ctx.sapi_ctx, handle);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TEST_ASSERT(TPM_RC_HANDLE + TPM_RC_H + (1 << TPM_RC_N_SHIFT) == read_public(&ctx, handle));
+    TEST_ASSERT(TSS2_RC_SUCCESS == read_public(&ctx, 0x81000001));
+
+    ret = Tss2_Sys_Clear(ctx.sapi_ctx,
+                         TPM2_RH_LOCKOUT,
+                         &sessionsData,
+                         &sessionsDataOut);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TEST_ASSERT(TPM_RC_HANDLE + TPM_RC_H + (1 << TPM_RC_N_SHIFT) == read_public(&ctx, 0x81000001));
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+void load_integrity_test()
+{
+    printf("In tss2_tcti_loopback-test::load_integrity_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPM2_HANDLE parent;
+    TSS2_RC ret = create_primary(&ctx, "", &parent);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    TPM2B_SENSITIVE_CREATE inSensitive = {};
+    TPM2B_PUBLIC in_public = {.publicArea = {.type=TPM2_ALG_ECC,
+                                             .nameAlg=TPM2_ALG_SHA256,
+                                             .objectAttributes=(TPMA_OBJECT_USERWITHAUTH |
+                                                                TPMA_OBJECT_SIGN_ENCRYPT |
+                                                                TPMA_OBJECT_FIXEDTPM |
+                                                                TPMA_OBJECT_FIXEDPARENT |
+                                                                TPMA_OBJECT_SENSITIVEDATAORIGIN)}};
+    in_public.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    in_public.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+    TPM2B_DATA outsideInfo = {};
+    TPML_PCR_SELECTION creationPCR = {};
+    TPM2B_CREATION_DATA creationData = {};
+    TPM2B_DIGEST creationHash = {};
+    TPMT_TK_CREATION creationTicket = {};
+    TPM2B_PRIVATE private_blob = {};
+    TPM2B_PUBLIC public_key = {};
+
+    ret = Tss2_Sys_Create(ctx.sapi_ctx,
+                          parent,
+                          &sessionsData,
+                          &inSensitive,
+                          &in_public,
+                          &outsideInfo,
+                          &creationPCR,
+                          &private_blob,
+                          &public_key,
+                          &creationData,
+                          &creationHash,
+                          &creationTicket,
+                          &sessionsDataOut);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(32 == public_key.publicArea.unique.ecc.x.size);
+
+    TPM2_HANDLE key;
+    TPM2B_NAME name = {};
+    private_blob.buffer[0] ^= 1;
+    ret = Tss2_Sys_Load(ctx.sapi_ctx,
+                        parent,
+                        &sessionsData,
+                        &private_blob,
+                        &public_key,
+                        &key,
+                        &name,
+                        &sessionsDataOut);
+    TEST_ASSERT(TPM_RC_INTEGRITY + TPM_RC_P + (1 << TPM_RC_N_SHIFT) == ret);
+
+    private_blob.buffer[0] ^= 1;
+    ret = Tss2_Sys_Load(ctx.sapi_ctx,
+                        parent,
+                        &sessionsData,
+                        &private_blob,
+                        &public_key,
+                        &key,
+                        &name,
+                        &sessionsDataOut);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+void latency_test()
+{
+    printf("In tss2_tcti_loopback-test::latency_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TSS2_RC ret = Tss2_Tcti_Loopback_SetLatency(ctx.tcti_ctx, TPM2_CC_ReadPublic, 20000);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    uint8_t read_public_command[] = {0x80, 0x01,    // TPM_ST_NO_SESSION
+                                     0x00, 0x00, 0x00, 0x0E,    // Size = 14
+                                     0x00, 0x00, 0x01, 0x73,    // Command code = 0x173 = readpublic
+                                     0x81, 0x00, 0x00, 0x01};
+
+    uint64_t start_ns = tcti_now_ns();
+
+    ret = Tss2_Tcti_Transmit(ctx.tcti_ctx,
+                             sizeof(read_public_command),
+                             read_public_command);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    uint8_t response[1024];
+    size_t response_size = sizeof(response);
+    ret = Tss2_Tcti_Receive(ctx.tcti_ctx,
+                            &response_size,
+                            response,
+                            0);
+    TEST_ASSERT(TSS2_TCTI_RC_TRY_AGAIN == ret);
+
+    ret = Tss2_Tcti_Receive(ctx.tcti_ctx,
+                            &response_size,
+                            response,
+                            TSS2_TCTI_TIMEOUT_BLOCK);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+    TEST_ASSERT(tcti_now_ns() - start_ns >= 20000000);
+
+    // 0x18B: no object at 0x81000001
+    TEST_ASSERT(10 == response_size);
+    TEST_ASSERT(0x8B == response[9] && 0x01 == response[8]);
+
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+void small_context_test()
+{
+    printf("In tss2_tcti_loopback-test::small_context_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TSS2_SYS_CONTEXT *default_sapi_ctx = ctx.sapi_ctx;
+
+    // It all fits in the SLB9670's 1280 bytes.
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(1280);
+    TEST_ASSERT(sapi_ctx_size < Tss2_Sys_GetContextSize(0));
+    ctx.sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != ctx.sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_Initialize(ctx.sapi_ctx, sapi_ctx_size, ctx.tcti_ctx, &abi_version));
+
+    TPM2_HANDLE handle;
+    TEST_ASSERT(TSS2_RC_SUCCESS == create_primary(&ctx, "", &handle));
+    TEST_ASSERT(TSS2_RC_SUCCESS == read_public(&ctx, handle));
+
+    Tss2_Sys_Finalize(ctx.sapi_ctx);
+    free(ctx.sapi_ctx);
+
+    // CreatePrimary's command fits in 128 bytes, but its response doesn't.
+    sapi_ctx_size = Tss2_Sys_GetContextSize(128);
+    ctx.sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != ctx.sapi_ctx);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_Initialize(ctx.sapi_ctx, sapi_ctx_size, ctx.tcti_ctx, &abi_version));
+
+    TEST_ASSERT(TSS2_TCTI_RC_INSUFFICIENT_BUFFER == create_primary(&ctx, "", &handle));
+
+    Tss2_Sys_Finalize(ctx.sapi_ctx);
+    free(ctx.sapi_ctx);
+
+    ctx.sapi_ctx = default_sapi_ctx;
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
@@ -0,0 +1,342 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_tcti_mux.h>
+#include <tss2/tss2_tcti_loopback.h>
+#include <tss2/tss2_sys.h>
+
+#include "test-utils.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define THREAD_COUNT 8
+#define ITERATIONS 200
+
+struct test_context {
+    TSS2_TCTI_CONTEXT *inner_ctx;
+    TSS2_TCTI_MUX_CONTEXT *mux_ctx;
+};
+
+struct thread_args {
+    TSS2_TCTI_MUX_CONTEXT *mux_ctx;
+    TPM2_HANDLE handle;
+    const TPM2B_PUBLIC *expected;
+    int failures;
+};
+
+static void initialize(struct test_context *ctx);
+static void cleanup(struct test_context *ctx);
+
+static TSS2_TCTI_CONTEXT *new_client(TSS2_TCTI_MUX_CONTEXT *mux_ctx);
+static TSS2_SYS_CONTEXT *new_sapi(TSS2_TCTI_CONTEXT *tcti_ctx);
+static void free_client(TSS2_TCTI_CONTEXT *tcti_ctx, TSS2_SYS_CONTEXT *sapi_ctx);
+
+static TSS2_RC create_primary(TSS2_SYS_CONTEXT *sapi_ctx, TPM2_HANDLE *handle_out);
+
+static void init_test();
+static void sequence_test();
+static void shared_drain_test();
+static void threads_test();
+
+int main()
+{
+    init_test();
+    sequence_test();
+    shared_drain_test();
+    threads_test();
+}
+
+void initialize(struct test_context *ctx)
+{
+    size_t ctx_size;
+    TSS2_RC init_ret = Tss2_Tcti_Loopback_Init(NULL, &ctx_size, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    ctx->inner_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != ctx->inner_ctx);
+
+    init_ret = Tss2_Tcti_Loopback_Init(ctx->inner_ctx, &ctx_size, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    init_ret = Tss2_Tcti_Mux_Init(NULL, &ctx_size, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    ctx->mux_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != ctx->mux_ctx);
+
+    init_ret = Tss2_Tcti_Mux_Init(ctx->mux_ctx, &ctx_size, ctx->inner_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+}
+
+void cleanup(struct test_context *ctx)
+{
+    Tss2_Tcti_Mux_Finalize(ctx->mux_ctx);
+    free(ctx->mux_ctx);
+    free(ctx->inner_ctx);
+}
+
+TSS2_TCTI_CONTEXT *new_client(TSS2_TCTI_MUX_CONTEXT *mux_ctx)
+{
+    size_t ctx_size;
+    TSS2_RC init_ret = Tss2_Tcti_Mux_Client_Init(NULL, &ctx_size, mux_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != tcti_ctx);
+
+    init_ret = Tss2_Tcti_Mux_Client_Init(tcti_ctx, &ctx_size, mux_ctx);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    return tcti_ctx;
+}
+
+TSS2_SYS_CONTEXT *new_sapi(TSS2_TCTI_CONTEXT *tcti_ctx)
+{
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    TSS2_SYS_CONTEXT *sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TSS2_RC init_ret = Tss2_Sys_Initialize(sapi_ctx,
+                                           sapi_ctx_size,
+                                           tcti_ctx,
+                                           &abi_version);
+    TEST_ASSERT(TSS2_RC_SUCCESS == init_ret);
+
+    return sapi_ctx;
+}
+
+void free_client(TSS2_TCTI_CONTEXT *tcti_ctx, TSS2_SYS_CONTEXT *sapi_ctx)
+{
+    if (sapi_ctx) {
+        Tss2_Sys_Finalize(sapi_ctx);
+        free(sapi_ctx);
+    }
+
+    Tss2_Tcti_Finalize(tcti_ctx);
+    free(tcti_ctx);
+}
+
+TSS2_RC create_primary(TSS2_SYS_CONTEXT *sapi_ctx, TPM2_HANDLE *handle_out)
+{
+    TSS2L_SYS_AUTH_COMMAND sessionsData = EMPTY_AUTH_COMMAND;
+    TSS2L_SYS_AUTH_RESPONSE sessionsDataOut = {.count = 1};
+
+    TPM2B_SENSITIVE_CREATE inSensitive = {};
+
+    TPM2B_PUBLIC in_public = {.publicArea = {.type=TPM2_ALG_ECC,
+                                             .nameAlg=TPM2_ALG_SHA256,
+                                             .objectAttributes=(TPMA_OBJECT_USERWITHAUTH |
+                                                                TPMA_OBJECT_RESTRICTED |
+                                                                TPMA_OBJECT_DECRYPT |
+                                                                TPMA_OBJECT_FIXEDTPM |
+                                                                TPMA_OBJECT_FIXEDPARENT |
+                                                                TPMA_OBJECT_SENSITIVEDATAORIGIN)}};
+    in_public.publicArea.parameters.eccDetail.symmetric.algorithm = TPM2_ALG_AES;
+    in_public.publicArea.parameters.eccDetail.symmetric.keyBits.aes = 128;
+    in_public.publicArea.parameters.eccDetail.symmetric.mode.sym = TPM2_ALG_CFB;
+    in_public.publicArea.parameters.eccDetail.scheme.scheme = TPM2_ALG_NULL;
+    in_public.publicArea.parameters.eccDetail.curveID = TPM2_ECC_NIST_P256;
+    in_public.publicArea.parameters.eccDetail.kdf.scheme = TPM2_ALG_NULL;
+
+    TPM2B_DATA outsideInfo = {};
+    TPML_PCR_SELECTION creationPCR = {};
+    TPM2B_CREATION_DATA creationData = {};
+    TPM2B_DIGEST creationHash = {};
+    TPMT_TK_CREATION creationTicket = {};
+    TPM2B_NAME name = {};
+    TPM2B_PUBLIC public_key = {};
+
+    return Tss2_Sys_CreatePrimary(sapi_ctx,
+                                  TPM2_RH_OWNER,
+                                  &sessionsData,
+                                  &inSensitive,
+                                  &in_public,
+                                  &outsideInfo,
+                                  &creationPCR,
+                                  handle_out,
+                                  &public_key,
+                                  &creationData,
+                                  &creationHash,
+                                  &creationTicket,
+                                  &name,
+                                  &sessionsDataOut);
+}
+
+void init_test()
+{
+    printf("In tss2_tcti_mux-test::init_test...\n");
+
+    size_t ctx_size = 0;
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_REFERENCE == Tss2_Tcti_Mux_Init(NULL, NULL, NULL));
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_REFERENCE == Tss2_Tcti_Mux_Client_Init(NULL, NULL, NULL));
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Mux_Init(NULL, &ctx_size, NULL));
+    TEST_ASSERT(0 != ctx_size);
+
+    TSS2_TCTI_MUX_CONTEXT *mux_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != mux_ctx);
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_REFERENCE == Tss2_Tcti_Mux_Init(mux_ctx, &ctx_size, NULL));
+    free(mux_ctx);
+
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Mux_Client_Init(NULL, &ctx_size, NULL));
+    TEST_ASSERT(0 != ctx_size);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = malloc(ctx_size);
+    TEST_ASSERT(NULL != tcti_ctx);
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_REFERENCE == Tss2_Tcti_Mux_Client_Init(tcti_ctx, &ctx_size, NULL));
+    free(tcti_ctx);
+
+    printf("ok\n");
+}
+
+void sequence_test()
+{
+    printf("In tss2_tcti_mux-test::sequence_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = new_client(ctx.mux_ctx);
+
+    uint8_t buffer[TPM2_MAX_RESPONSE_SIZE];
+    size_t size = sizeof(buffer);
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_SEQUENCE == Tss2_Tcti_Receive(tcti_ctx, &size, buffer, TSS2_TCTI_TIMEOUT_BLOCK));
+
+    // ReadPublic of an unused handle
+    uint8_t command[] = {0x80, 0x01, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x00, 0x01, 0x73, 0x80, 0x00, 0x00, 0x07};
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Transmit(tcti_ctx, sizeof(command), command));
+    TEST_ASSERT(TSS2_TCTI_RC_BAD_SEQUENCE == Tss2_Tcti_Transmit(tcti_ctx, sizeof(command), command));
+
+    // A too-small buffer leaves the response to be collected.
+    size = 4;
+    TEST_ASSERT(TSS2_TCTI_RC_INSUFFICIENT_BUFFER == Tss2_Tcti_Receive(tcti_ctx, &size, buffer, TSS2_TCTI_TIMEOUT_BLOCK));
+
+    size = sizeof(buffer);
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Receive(tcti_ctx, &size, buffer, TSS2_TCTI_TIMEOUT_BLOCK));
+    TEST_ASSERT(10 == size);
+    TEST_ASSERT(0x80 == buffer[0] && 0x01 == buffer[1]);
+
+    TEST_ASSERT(TSS2_TCTI_RC_NOT_IMPLEMENTED == Tss2_Tcti_SetLocality(tcti_ctx, 0));
+
+    free_client(tcti_ctx, NULL);
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+void shared_drain_test()
+{
+    printf("In tss2_tcti_mux-test::shared_drain_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TSS2_TCTI_CONTEXT *first = new_client(ctx.mux_ctx);
+    TSS2_TCTI_CONTEXT *second = new_client(ctx.mux_ctx);
+
+    uint8_t command[] = {0x80, 0x01, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x00, 0x01, 0x73, 0x80, 0x00, 0x00, 0x07};
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Transmit(first, sizeof(command), command));
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Transmit(second, sizeof(command), command));
+
+    // Draining for the second client also sends the first client's command...
+    uint8_t buffer[TPM2_MAX_RESPONSE_SIZE];
+    size_t size = sizeof(buffer);
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Receive(second, &size, buffer, TSS2_TCTI_TIMEOUT_BLOCK));
+
+    // ...so its response is ready without waiting.
+    size = sizeof(buffer);
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Tcti_Receive(first, &size, buffer, 0));
+    TEST_ASSERT(10 == size);
+
+    free_client(first, NULL);
+    free_client(second, NULL);
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
+
+static
+void *read_public_loop(void *arg)
+{
+    struct thread_args *args = arg;
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = new_client(args->mux_ctx);
+    TSS2_SYS_CONTEXT *sapi_ctx = new_sapi(tcti_ctx);
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        TPM2B_PUBLIC out_public = {};
+        TPM2B_NAME name = {};
+        TPM2B_NAME qualified_name = {};
+        TSS2_RC ret = Tss2_Sys_ReadPublic(sapi_ctx,
+                                          args->handle,
+                                          NULL,
+                                          &out_public,
+                                          &name,
+                                          &qualified_name,
+                                          NULL);
+        if (TSS2_RC_SUCCESS != ret ||
+                out_public.publicArea.unique.ecc.x.size != args->expected->publicArea.unique.ecc.x.size ||
+                0 != memcmp(out_public.publicArea.unique.ecc.x.buffer,
+                            args->expected->publicArea.unique.ecc.x.buffer,
+                            out_public.publicArea.unique.ecc.x.size))
+            args->failures++;
+    }
+
+    free_client(tcti_ctx, sapi_ctx);
+
+    return NULL;
+}
+
+void threads_test()
+{
+    printf("In tss2_tcti_mux-test::threads_test...\n");
+
+    struct test_context ctx;
+    initialize(&ctx);
+
+    TSS2_TCTI_CONTEXT *tcti_ctx = new_client(ctx.mux_ctx);
+    TSS2_SYS_CONTEXT *sapi_ctx = new_sapi(tcti_ctx);
+
+    TPM2_HANDLE handle;
+    TEST_ASSERT(TSS2_RC_SUCCESS == create_primary(sapi_ctx, &handle));
+
+    TPM2B_PUBLIC expected = {};
+    TPM2B_NAME name = {};
+    TPM2B_NAME qualified_name = {};
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_ReadPublic(sapi_ctx, handle, NULL, &expected, &name, &qualified_name, NULL));
+
+    pthread_t threads[THREAD_COUNT];
+    struct thread_args args[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        args[i] = (struct thread_args){.mux_ctx = ctx.mux_ctx, .handle = handle, .expected = &expected};
+        TEST_ASSERT(0 == pthread_create(&threads[i], NULL, read_public_loop, &args[i]));
+    }
+
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        TEST_ASSERT(0 == pthread_join(threads[i], NULL));
+        TEST_ASSERT(0 == args[i].failures);
+    }
+
+    free_client(tcti_ctx, sapi_ctx);
+    cleanup(&ctx);
+
+    printf("ok\n");
+}
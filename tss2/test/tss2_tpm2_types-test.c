@@ -0,0 +1,167 @@
+/******************************************************************************
+ *
+ * Copyright 2020 Xaptum, Inc.
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License
+ *
+ *****************************************************************************/
+
+#include <tss2/tss2_sys.h>
+#include <tss2/tss2_tcti.h>
+
+#include "test-utils.h"
+
+#include <string.h>
+
+// Returns the same response to every command.
+struct canned_tcti {
+    TSS2_TCTI_CONTEXT_COMMON_V1 v1;
+    uint8_t response[128];
+    size_t response_size;
+};
+
+static void profile_test();
+static void abi_mismatch_test();
+static void oversized_tpm2b_test();
+
+int main(int argc, char *argv[])
+{
+    parse_cmd_args(argc, argv);
+
+    profile_test();
+    abi_mismatch_test();
+    oversized_tpm2b_test();
+}
+
+static
+TSS2_RC canned_transmit(TSS2_TCTI_CONTEXT *tcti_context, size_t size, uint8_t *command)
+{
+    (void)tcti_context;
+    (void)size;
+    (void)command;
+
+    return TSS2_RC_SUCCESS;
+}
+
+static
+TSS2_RC canned_receive(TSS2_TCTI_CONTEXT *tcti_context, size_t *size, uint8_t *response, int32_t timeout)
+{
+    (void)timeout;
+
+    struct canned_tcti *tcti = (struct canned_tcti*)tcti_context;
+    if (*size < tcti->response_size)
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+
+    memcpy(response, tcti->response, tcti->response_size);
+    *size = tcti->response_size;
+
+    return TSS2_RC_SUCCESS;
+}
+
+void profile_test()
+{
+    printf("In tss2_tpm2_types-test::profile_test...\n");
+
+    printf("\tTPM2B_DIGEST: %zu, TPM2B_NAME: %zu, TPM2B_PUBLIC: %zu, TPM2B_PRIVATE: %zu, TSS2L_SYS_AUTH_COMMAND: %zu bytes\n",
+           sizeof(TPM2B_DIGEST), sizeof(TPM2B_NAME), sizeof(TPM2B_PUBLIC), sizeof(TPM2B_PRIVATE), sizeof(TSS2L_SYS_AUTH_COMMAND));
+
+    TPM2B_DIGEST digest;
+    TPM2B_NAME name;
+    TPM2B_SENSITIVE_DATA sensitive_data;
+    TEST_ASSERT(sizeof(digest.buffer) >= TPM2_SHA256_DIGEST_SIZE);
+    TEST_ASSERT(sizeof(name.name) >= sizeof(TPM2_ALG_ID) + TPM2_SHA256_DIGEST_SIZE);
+    // Commit's s2 (an ECDAA basename) may be as long as the TPM allows, in any profile.
+    TEST_ASSERT(sizeof(sensitive_data.buffer) == 128);
+
+#ifdef XTPM_ECC_ONLY
+    TEST_ASSERT(sizeof(digest.buffer) == TPM2_SHA256_DIGEST_SIZE);
+#else
+    TEST_ASSERT(sizeof(digest.buffer) == TPM2_SHA512_DIGEST_SIZE);
+#endif
+
+    printf("ok\n");
+}
+
+void abi_mismatch_test()
+{
+    printf("In tss2_tpm2_types-test::abi_mismatch_test...\n");
+
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    TSS2_SYS_CONTEXT *sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != sapi_ctx);
+
+    // Built for the other profile
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    abi_version.tssVersion = (3 == abi_version.tssVersion) ? 4 : 3;
+    TEST_ASSERT(TSS2_SYS_RC_ABI_MISMATCH == Tss2_Sys_InitializeDryRun(sapi_ctx, sapi_ctx_size, &abi_version));
+
+    // Built against the header from before TPMS_PCR_SELECTION grew to 24 PCRs
+    abi_version = (TSS2_ABI_VERSION)TSS2_ABI_VERSION_CURRENT;
+    abi_version.tssVersion -= 2;
+    TEST_ASSERT(TSS2_SYS_RC_ABI_MISMATCH == Tss2_Sys_InitializeDryRun(sapi_ctx, sapi_ctx_size, &abi_version));
+
+    free(sapi_ctx);
+
+    printf("ok\n");
+}
+
+void oversized_tpm2b_test()
+{
+    printf("In tss2_tpm2_types-test::oversized_tpm2b_test...\n");
+
+    // A ReadPublic response with an empty public area,
+    // and a name with a digest larger than any this SAPI's types hold.
+    struct canned_tcti tcti = {
+        .v1 = {
+            .version = 1,
+            .transmit = canned_transmit,
+            .receive = canned_receive,
+        },
+    };
+    uint8_t *ptr = tcti.response;
+    const uint16_t name_size = 100;
+    const uint8_t header[] = {0x80, 0x01,   // TPM2_ST_NO_SESSIONS
+                              0x00, 0x00, 0x00, 0x00,   // size (set below)
+                              0x00, 0x00, 0x00, 0x00};  // TPM2_RC_SUCCESS
+    memcpy(ptr, header, sizeof(header));
+    ptr += sizeof(header);
+    *ptr++ = 0; *ptr++ = 0;     // outPublic
+    *ptr++ = name_size >> 8; *ptr++ = name_size & 0xFF;
+    memset(ptr, 0xAB, name_size);
+    ptr += name_size;
+    *ptr++ = 0; *ptr++ = 0;     // qualifiedName
+    tcti.response_size = ptr - tcti.response;
+    tcti.response[5] = (uint8_t)tcti.response_size;
+
+    TPM2B_NAME name;
+    TEST_ASSERT(sizeof(name.name) < name_size);
+
+    size_t sapi_ctx_size = Tss2_Sys_GetContextSize(0);
+    TSS2_SYS_CONTEXT *sapi_ctx = malloc(sapi_ctx_size);
+    TEST_ASSERT(NULL != sapi_ctx);
+
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TEST_ASSERT(TSS2_RC_SUCCESS == Tss2_Sys_Initialize(sapi_ctx, sapi_ctx_size, (TSS2_TCTI_CONTEXT*)&tcti, &abi_version));
+
+    TSS2_RC ret = Tss2_Sys_ReadPublic(sapi_ctx, 0x81000001, NULL, NULL, &name, NULL, NULL);
+    TEST_ASSERT(TSS2_SYS_RC_MALFORMED_RESPONSE == ret);
+
+    // Skipping it is fine, though.
+    ret = Tss2_Sys_ReadPublic(sapi_ctx, 0x81000001, NULL, NULL, NULL, NULL, NULL);
+    TEST_ASSERT(TSS2_RC_SUCCESS == ret);
+
+    Tss2_Sys_Finalize(sapi_ctx);
+    free(sapi_ctx);
+
+    printf("ok\n");
+}